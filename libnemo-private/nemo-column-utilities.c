@@ -247,11 +247,13 @@ nemo_get_common_columns (void)
 	static GList *columns = NULL;
 
 	if (!columns) {
-		columns = g_list_concat (get_builtin_columns (),
-		                         get_extension_columns ());
+		columns = get_builtin_columns ();
 	}
 
-	return nemo_column_list_copy (columns);
+	/* FINDERZ: Providers are asked every time, as the metadata columns
+	 * follow the fields found in the files extracted so far */
+	return g_list_concat (nemo_column_list_copy (columns),
+	                      get_extension_columns ());
 }
 
 GList *
@@ -134,6 +134,12 @@ struct FavoriteCheckState {
     NemoDirectory *directory;
 };
 
+struct FinderzMetadataState {
+    NemoDirectory *directory;
+    GCancellable *cancellable;
+    NemoFile *file;
+};
+
 typedef struct {
 	NemoFile *file; /* Which file, NULL means all. */
 	union {
@@ -549,6 +555,17 @@ file_info_cancel (NemoDirectory *directory)
 	}
 }
 
+static void
+finderz_metadata_cancel (NemoDirectory *directory)
+{
+    if (directory->details->finderz_metadata_state != NULL) {
+        g_cancellable_cancel (directory->details->finderz_metadata_state->cancellable);
+        directory->details->finderz_metadata_state->directory = NULL;
+        directory->details->finderz_metadata_state = NULL;
+        async_job_end (directory, "finderz metadata");
+    }
+}
+
 static void
 favorite_check_cancel (NemoDirectory *directory)
 {
@@ -705,6 +722,10 @@ nemo_directory_set_up_request (NemoFileAttributes file_attributes)
         REQUEST_SET_TYPE (request, REQUEST_FAVORITE_CHECK);
     }
 
+    if (file_attributes & NEMO_FILE_ATTRIBUTE_FINDERZ_METADATA) {
+        REQUEST_SET_TYPE (request, REQUEST_FINDERZ_METADATA);
+    }
+
 	return request;
 }
 
@@ -1122,6 +1143,13 @@ directory_load_done (NemoDirectory *directory,
 	}
 	dequeue_pending_idle_callback (directory);
 
+	/* FINDERZ: With every name in file_hash, sidecar lookups no longer
+	 * need to check the disk */
+	if (error == NULL) {
+		extern void finderz_sidecar_map_set_complete (gpointer map, gboolean complete);
+		finderz_sidecar_map_set_complete (directory->details->finderz_sidecar_map, TRUE);
+	}
+
 	directory_load_cancel (directory);
 }
 
@@ -1606,6 +1634,12 @@ nemo_async_destroying_file (NemoFile *file)
 		directory->details->thumbnail_state->file = NULL;
 		changed = TRUE;
 	}
+
+    if (directory->details->finderz_metadata_state != NULL &&
+        directory->details->finderz_metadata_state->file == file) {
+        directory->details->finderz_metadata_state->file = NULL;
+        changed = TRUE;
+    }
 	
 	if (directory->details->mount_state != NULL &&
 	    directory->details->mount_state->file ==  file) {
@@ -1653,6 +1687,13 @@ lacks_favorite_check (NemoFile *file)
         && !file->details->is_gone;
 }
 
+static gboolean
+lacks_finderz_metadata (NemoFile *file)
+{
+    return !file->details->finderz_metadata_is_up_to_date
+        && !file->details->is_gone;
+}
+
 static gboolean
 lacks_filesystem_info (NemoFile *file)
 {
@@ -1812,6 +1853,12 @@ request_is_satisfied (NemoDirectory *directory,
         }
     }
 
+    if (REQUEST_WANTS_TYPE (request, REQUEST_FINDERZ_METADATA)) {
+        if (has_problem (directory, file, lacks_finderz_metadata)) {
+            return FALSE;
+        }
+    }
+
 	return TRUE;
 }
 
@@ -2136,6 +2183,12 @@ nemo_directory_stop_monitoring_file_list (NemoDirectory *directory)
 	file_list_cancel (directory);
 	nemo_file_list_unref (directory->details->file_list);
 	directory->details->directory_loaded = FALSE;
+
+	/* FINDERZ: Changes are no longer followed */
+	{
+		extern void finderz_sidecar_map_set_complete (gpointer map, gboolean complete);
+		finderz_sidecar_map_set_complete (directory->details->finderz_sidecar_map, FALSE);
+	}
 }
 
 static void
@@ -2209,6 +2262,12 @@ nemo_directory_force_reload_internal (NemoDirectory     *directory,
 	file_list_cancel (directory);
 	directory->details->directory_loaded = FALSE;
 
+	/* FINDERZ: Until the reload finishes, sidecars are checked on disk */
+	{
+		extern void finderz_sidecar_map_set_complete (gpointer map, gboolean complete);
+		finderz_sidecar_map_set_complete (directory->details->finderz_sidecar_map, FALSE);
+	}
+
 	/* Start a new directory count. */
 	nemo_directory_invalidate_count_and_mime_list (directory);
 
@@ -3392,6 +3451,121 @@ favorite_check_start (NemoDirectory *directory,
     directory->details->favorite_check_idle_id = g_idle_add ((GSourceFunc) favorite_check_callback, state);
 }
 
+static void
+finderz_metadata_stop (NemoDirectory *directory)
+{
+    NemoFile *file;
+
+    if (directory->details->finderz_metadata_state != NULL) {
+        file = directory->details->finderz_metadata_state->file;
+
+        if (file != NULL) {
+            g_assert (NEMO_IS_FILE (file));
+            g_assert (file->details->directory == directory);
+            if (is_needy (file,
+                          lacks_finderz_metadata,
+                          REQUEST_FINDERZ_METADATA)) {
+                return;
+            }
+        }
+
+        /* The metadata is not wanted, so stop it. */
+        finderz_metadata_cancel (directory);
+    }
+}
+
+static void
+finderz_metadata_state_free (FinderzMetadataState *state)
+{
+    g_object_unref (state->cancellable);
+    g_free (state);
+}
+
+static void
+finderz_metadata_callback (GObject *source_object,
+                           GAsyncResult *res,
+                           gpointer user_data)
+{
+    extern gboolean finderz_file_attributes_load_finish (GAsyncResult *result,
+                                                         GError **error);
+    extern void finderz_file_attributes_file_loaded (NemoFile *file);
+    FinderzMetadataState *state;
+    NemoDirectory *directory;
+    NemoFile *file;
+
+    state = user_data;
+
+    /* Extraction results are cached on the worker side; this only
+     * tells us the cache now holds an entry for the file. */
+    finderz_file_attributes_load_finish (res, NULL);
+
+    if (state->directory == NULL) {
+        /* Operation was cancelled. Bail out */
+        finderz_metadata_state_free (state);
+        return;
+    }
+
+    directory = nemo_directory_ref (state->directory);
+    file = state->file;
+
+    directory->details->finderz_metadata_state = NULL;
+    async_job_end (directory, "finderz metadata");
+
+    if (file != NULL) {
+        nemo_file_ref (file);
+        file->details->finderz_metadata_is_up_to_date = TRUE;
+        finderz_file_attributes_file_loaded (file);
+        nemo_file_changed (file);
+        nemo_file_unref (file);
+    }
+
+    finderz_metadata_state_free (state);
+
+    nemo_directory_async_state_changed (directory);
+    nemo_directory_unref (directory);
+}
+
+static void
+finderz_metadata_start (NemoDirectory *directory,
+                        NemoFile *file,
+                        gboolean *doing_io)
+{
+    extern void finderz_file_attributes_load_async (NemoFile *file,
+                                                    GCancellable *cancellable,
+                                                    GAsyncReadyCallback callback,
+                                                    gpointer user_data);
+    FinderzMetadataState *state;
+
+    if (directory->details->finderz_metadata_state != NULL) {
+        *doing_io = TRUE;
+        return;
+    }
+
+    if (!is_needy (file,
+                   lacks_finderz_metadata,
+                   REQUEST_FINDERZ_METADATA)) {
+        return;
+    }
+    *doing_io = TRUE;
+
+    if (!async_job_start (directory, "finderz metadata")) {
+        return;
+    }
+
+    state = g_new0 (FinderzMetadataState, 1);
+    state->directory = directory;
+    state->file = file;
+    state->cancellable = g_cancellable_new ();
+
+    directory->details->finderz_metadata_state = state;
+
+    /* FINDERZ: file parsing and xattr reads happen on a worker thread */
+    finderz_file_attributes_load_async (file,
+                                        state->cancellable,
+                                        finderz_metadata_callback,
+                                        state);
+}
+
 static gboolean
 is_link_trusted (NemoFile *file,
 		 gboolean is_launcher)
@@ -4410,6 +4584,7 @@ start_or_stop_io (NemoDirectory *directory)
 	thumbnail_stop (directory);
 	filesystem_info_stop (directory);
     favorite_check_stop (directory);
+    finderz_metadata_stop (directory);
 
 	doing_io = FALSE;
 	/* Take files that are all done off the queue. */
@@ -4439,6 +4614,7 @@ start_or_stop_io (NemoDirectory *directory)
 		thumbnail_start (directory, file, &doing_io);
 		filesystem_info_start (directory, file, &doing_io);
         favorite_check_start (directory, file, &doing_io);
+        finderz_metadata_start (directory, file, &doing_io);
 
 		if (doing_io) {
 			return;
@@ -4511,6 +4687,7 @@ nemo_directory_cancel (NemoDirectory *directory)
 	mount_cancel (directory);
 	filesystem_info_cancel (directory);
     favorite_check_cancel (directory);
+    finderz_metadata_cancel (directory);
 
 	/* We aren't waiting for anything any more. */
 	if (waiting_directories != NULL) {
@@ -4568,6 +4745,16 @@ cancel_favorite_check_for_file (NemoDirectory *directory,
     }
 }
 
+static void
+cancel_finderz_metadata_for_file (NemoDirectory *directory,
+                                  NemoFile      *file)
+{
+    if (directory->details->finderz_metadata_state != NULL &&
+        directory->details->finderz_metadata_state->file == file) {
+        finderz_metadata_cancel (directory);
+    }
+}
+
 static void
 cancel_thumbnail_for_file (NemoDirectory *directory,
 			   NemoFile      *file)
@@ -4649,6 +4836,9 @@ cancel_loading_attributes (NemoDirectory *directory,
 	}
    if (REQUEST_WANTS_TYPE (request, REQUEST_FAVORITE_CHECK)) {
         favorite_check_cancel (directory);
+    }
+    if (REQUEST_WANTS_TYPE (request, REQUEST_FINDERZ_METADATA)) {
+        finderz_metadata_cancel (directory);
     }
 	nemo_directory_async_state_changed (directory);
 }
@@ -4690,6 +4880,9 @@ nemo_directory_cancel_loading_file_attributes (NemoDirectory      *directory,
 	}
     if (REQUEST_WANTS_TYPE (request, REQUEST_FAVORITE_CHECK)) {
         cancel_favorite_check_for_file (directory, file);
+    }
+    if (REQUEST_WANTS_TYPE (request, REQUEST_FINDERZ_METADATA)) {
+        cancel_finderz_metadata_for_file (directory, file);
     }
 	nemo_directory_async_state_changed (directory);
 }
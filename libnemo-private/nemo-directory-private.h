@@ -42,6 +42,7 @@ typedef struct ThumbnailState ThumbnailState;
 typedef struct MountState MountState;
 typedef struct FilesystemInfoState FilesystemInfoState;
 typedef struct FavoriteCheckState FavoriteCheckState;
+typedef struct FinderzMetadataState FinderzMetadataState;
 
 typedef enum {
 	REQUEST_LINK_INFO,
@@ -55,6 +56,7 @@ typedef enum {
 	REQUEST_MOUNT,
 	REQUEST_FILESYSTEM_INFO,
     REQUEST_FAVORITE_CHECK,
+    REQUEST_FINDERZ_METADATA,
 	REQUEST_TYPE_LAST
 } RequestType;
 
@@ -133,6 +135,9 @@ struct NemoDirectoryDetails
 
 	ThumbnailState *thumbnail_state;
 
+    FinderzMetadataState *finderz_metadata_state;
+    gpointer finderz_sidecar_map;
+
 	MountState *mount_state;
 
 	FilesystemInfoState *filesystem_info_state;
@@ -178,6 +178,12 @@ nemo_directory_finalize (GObject *object)
 		g_object_unref (directory->details->location);
 	}
 
+	/* FINDERZ: Drop the sidecar map along with the listing */
+	{
+		extern void finderz_sidecar_map_free (gpointer map);
+		finderz_sidecar_map_free (directory->details->finderz_sidecar_map);
+	}
+
 	g_assert (directory->details->file_list == NULL);
 	g_hash_table_destroy (directory->details->file_hash);
 
@@ -590,9 +596,59 @@ nemo_directory_are_all_files_seen (NemoDirectory *directory)
 	return NEMO_DIRECTORY_CLASS (G_OBJECT_GET_CLASS (directory))->are_all_files_seen (directory);
 }
 
+/* FINDERZ: Sidecars are read on top of the metadata of the files they
+ * belong to, so when one comes, goes or changes, theirs is reloaded */
+static void
+finderz_sidecar_changed (NemoDirectory *directory, const char *name)
+{
+	extern gchar *finderz_sidecar_get_owner (const gchar *name, gboolean *by_stem);
+	NemoFile *file;
+	GList *owners, *l;
+	gboolean by_stem;
+	char *owner;
+	gsize owner_len;
+
+	owner = finderz_sidecar_get_owner (name, &by_stem);
+	if (owner == NULL) {
+		return;
+	}
+
+	owners = NULL;
+	file = nemo_directory_find_file_by_name (directory, owner);
+	if (file != NULL) {
+		owners = g_list_prepend (owners, nemo_file_ref (file));
+	}
+
+	/* "photo.xmp" also belongs to "photo.jpg" */
+	if (by_stem) {
+		owner_len = strlen (owner);
+		for (l = directory->details->file_list; l != NULL; l = l->next) {
+			const char *file_name = NEMO_FILE (l->data)->details->name;
+
+			if (strncmp (file_name, owner, owner_len) == 0 &&
+			    file_name[owner_len] == '.' &&
+			    strchr (file_name + owner_len + 1, '.') == NULL &&
+			    strcmp (file_name, name) != 0) {
+				owners = g_list_prepend (owners, nemo_file_ref (l->data));
+			}
+		}
+	}
+	g_free (owner);
+
+	for (l = owners; l != NULL; l = l->next) {
+		nemo_file_invalidate_attributes (l->data, NEMO_FILE_ATTRIBUTE_FINDERZ_METADATA);
+		nemo_file_changed (l->data);
+	}
+	nemo_file_list_free (owners);
+}
+
+/* FINDERZ: Every name entering or leaving file_hash passes through
+ * the two functions below, including both ends of a rename, so they
+ * keep the sidecar map in step with the listing. */
 static void
 add_to_hash_table (NemoDirectory *directory, NemoFile *file, GList *node)
 {
+	extern gboolean finderz_sidecar_map_file_added (gpointer map, const char *name);
 	const char *name;
 
 	name = file->details->name;
@@ -601,6 +657,10 @@ add_to_hash_table (NemoDirectory *directory, NemoFile *file, GList *node)
 	g_assert (g_hash_table_lookup (directory->details->file_hash,
 				       name) == NULL);
 	g_hash_table_insert (directory->details->file_hash, (char *) name, node);
+
+	if (finderz_sidecar_map_file_added (directory->details->finderz_sidecar_map, name)) {
+		finderz_sidecar_changed (directory, name);
+	}
 }
 
 static GList *
@@ -618,6 +678,13 @@ extract_from_hash_table (NemoDirectory *directory, NemoFile *file)
 	node = g_hash_table_lookup (directory->details->file_hash, name);
 	g_hash_table_remove (directory->details->file_hash, name);
 
+	if (node != NULL) {
+		extern gboolean finderz_sidecar_map_file_removed (gpointer map, const char *name);
+		if (finderz_sidecar_map_file_removed (directory->details->finderz_sidecar_map, name)) {
+			finderz_sidecar_changed (directory, name);
+		}
+	}
+
 	return node;
 }
 
@@ -931,6 +998,18 @@ collect_parent_directories (GHashTable *hash_table, NemoDirectory *directory)
 	}
 }
 
+/* FINDERZ: Forget cached Finder settings when a .DS_Store changes */
+static void
+finderz_notify_ds_store_changes (GList *files)
+{
+	extern void finderz_ds_store_location_changed (GFile *location);
+	GList *p;
+
+	for (p = files; p != NULL; p = p->next) {
+		finderz_ds_store_location_changed (p->data);
+	}
+}
+
 void
 nemo_directory_notify_files_added (GList *files)
 {
@@ -941,6 +1020,8 @@ nemo_directory_notify_files_added (GList *files)
 	NemoFile *file;
 	GFile *location, *parent;
 
+	finderz_notify_ds_store_changes (files);
+
 	/* Make a list of added files in each directory. */
 	added_lists = g_hash_table_new (NULL, NULL);
 
@@ -1061,6 +1142,8 @@ nemo_directory_notify_files_changed (GList *files)
     NemoDirectory *dir;
 	NemoFile *file;
 
+	finderz_notify_ds_store_changes (files);
+
 	/* Make a list of changed files in each directory. */
 	changed_lists = g_hash_table_new (NULL, NULL);
 
@@ -1078,6 +1161,11 @@ nemo_directory_notify_files_changed (GList *files)
 			file->details->link_info_is_up_to_date = FALSE;
 			nemo_file_invalidate_extension_info_internal (file);
 
+			/* FINDERZ: An edited sidecar, as a rating set in Lightroom */
+			if (file->details->directory != NULL && file->details->name != NULL) {
+				finderz_sidecar_changed (file->details->directory, file->details->name);
+			}
+
 			hash_table_list_prepend (changed_lists,
 						 file->details->directory,
 						 file);
@@ -1125,6 +1213,8 @@ nemo_directory_notify_files_removed (GList *files)
 	NemoFile *file;
 	GFile *location;
 
+	finderz_notify_ds_store_changes (files);
+
 	/* Make a list of changed files in each directory. */
 	changed_lists = g_hash_table_new (NULL, NULL);
 
@@ -1177,11 +1267,17 @@ static void
 set_directory_location (NemoDirectory *directory,
 			GFile *location)
 {
+	/* FINDERZ: Sidecar files of this folder, filled in from file_hash */
+	extern gpointer finderz_sidecar_map_new (GFile *location);
+	extern void finderz_sidecar_map_free (gpointer map);
+
 	if (directory->details->location) {
 		g_object_unref (directory->details->location);
 	}
 	directory->details->location = g_object_ref (location);
-	
+
+	finderz_sidecar_map_free (directory->details->finderz_sidecar_map);
+	directory->details->finderz_sidecar_map = finderz_sidecar_map_new (location);
 }
 
 static void
@@ -1348,6 +1444,13 @@ nemo_directory_notify_files_moved (GList *file_pairs)
 		from_location = pair->from;
 		to_location = pair->to;
 
+		/* FINDERZ: Either end of a move may be a .DS_Store */
+		{
+			extern void finderz_ds_store_location_changed (GFile *location);
+			finderz_ds_store_location_changed (from_location);
+			finderz_ds_store_location_changed (to_location);
+		}
+
 		/* Handle overwriting a file. */
 		file = nemo_file_get_existing (to_location);
 		if (file != NULL) {
@@ -42,6 +42,7 @@ typedef enum {
 	NEMO_FILE_ATTRIBUTE_MOUNT = 1 << 9,
 	NEMO_FILE_ATTRIBUTE_FILESYSTEM_INFO = 1 << 10,
     NEMO_FILE_ATTRIBUTE_FAVORITE_CHECK = 1 << 11,
+    NEMO_FILE_ATTRIBUTE_FINDERZ_METADATA = 1 << 12, /* embedded/xattr metadata, read off the main thread */
 } NemoFileAttributes;
 
 #endif /* NEMO_FILE_ATTRIBUTES_H */
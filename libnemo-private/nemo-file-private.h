@@ -200,6 +200,7 @@ struct NemoFileDetails
 	eel_boolean_bit is_hidden                     : 1;
 
     eel_boolean_bit favorite_checked              : 1;
+    eel_boolean_bit finderz_metadata_is_up_to_date : 1;
 
 	eel_boolean_bit has_permissions               : 1;
 	
@@ -790,6 +790,13 @@ finalize (GObject *object)
 		g_free (uri);
 	}
 
+	if (file->details->finderz_metadata_is_up_to_date) {
+		extern void finderz_file_attributes_file_finalized (NemoFile *file);
+
+		/* FINDERZ: the file left every view, so evict its metadata */
+		finderz_file_attributes_file_finalized (file);
+	}
+
 	nemo_async_destroying_file (file);
 
 	remove_from_link_hash_table (file);
@@ -3541,6 +3548,31 @@ nemo_file_compare_for_sort_by_attribute_q   (NemoFile                   *file_1,
                                search_dir);
     }
 
+	/* FINDERZ: metadata columns compare typed keys, not display strings */
+	{
+		extern gboolean finderz_is_metadata_attribute (const gchar *attribute);
+		extern gint finderz_file_compare_by_metadata (NemoFile *file1,
+							      NemoFile *file2,
+							      const gchar *attribute);
+		const char *attribute_str = g_quark_to_string (attribute);
+
+		if (finderz_is_metadata_attribute (attribute_str)) {
+			result = nemo_file_compare_for_sort_internal (file_1, file_2, directories_first, favorites_first, reversed);
+
+			if (result == 0) {
+				result = finderz_file_compare_by_metadata (file_1, file_2, attribute_str);
+				if (result == 0) {
+					result = compare_by_display_name (file_1, file_2);
+				}
+				if (reversed) {
+					result = -result;
+				}
+			}
+
+			return result;
+		}
+	}
+
 	/* it is a normal attribute, compare by strings */
 
 	result = nemo_file_compare_for_sort_internal (file_1, file_2, directories_first, favorites_first, reversed);
@@ -6959,6 +6991,15 @@ nemo_file_get_string_attribute_with_default_q (NemoFile *file, GQuark attribute_
 		return g_strdup ("");
 	}
 
+	/* FINDERZ: placeholder until the metadata workers report back */
+	{
+		extern gboolean finderz_is_metadata_attribute (const gchar *attribute);
+
+		if (finderz_is_metadata_attribute (g_quark_to_string (attribute_q))) {
+			return g_strdup (file->details->finderz_metadata_is_up_to_date ? "" : "...");
+		}
+	}
+
 	/* Fallback, use for both unknown attributes and attributes
 	 * for which we have no more appropriate default.
 	 */
@@ -7964,6 +8005,13 @@ nemo_file_emit_changed (NemoFile *file)
 
 	g_assert (NEMO_IS_FILE (file));
 
+	{
+		extern void finderz_sorting_profile_file_changed (NemoFile *file);
+
+		/* FINDERZ: sort keys kept on the file describe what it was */
+		finderz_sorting_profile_file_changed (file);
+	}
+
 	/* Send out a signal. */
 	g_signal_emit (file, signals[CHANGED], 0, file);
 
@@ -8331,6 +8379,17 @@ invalidate_favorite_check (NemoFile *file)
     file->details->favorite_checked = FALSE;
 }
 
+static void
+invalidate_finderz_metadata (NemoFile *file)
+{
+    extern void finderz_file_attributes_invalidate_file (NemoFile *file);
+
+    file->details->finderz_metadata_is_up_to_date = FALSE;
+
+    /* FINDERZ: make the next load re-read the file instead of the cache */
+    finderz_file_attributes_invalidate_file (file);
+}
+
 void
 nemo_file_invalidate_extension_info_internal (NemoFile *file)
 {
@@ -8400,6 +8459,9 @@ nemo_file_invalidate_attributes_internal (NemoFile *file,
 	}
     if (REQUEST_WANTS_TYPE (request, REQUEST_FAVORITE_CHECK)) {
         invalidate_favorite_check (file);
+    }
+    if (REQUEST_WANTS_TYPE (request, REQUEST_FINDERZ_METADATA)) {
+        invalidate_finderz_metadata (file);
     }
 	/* FIXME bugzilla.gnome.org 45075: implement invalidating metadata */
 }
@@ -8477,7 +8539,8 @@ nemo_file_get_all_attributes (void)
 		NEMO_FILE_ATTRIBUTE_EXTENSION_INFO |
 		NEMO_FILE_ATTRIBUTE_THUMBNAIL |
 		NEMO_FILE_ATTRIBUTE_MOUNT |
-        NEMO_FILE_ATTRIBUTE_FAVORITE_CHECK;
+        NEMO_FILE_ATTRIBUTE_FAVORITE_CHECK |
+        NEMO_FILE_ATTRIBUTE_FINDERZ_METADATA;
 }
 
 void
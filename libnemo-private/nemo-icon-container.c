@@ -937,6 +937,7 @@ nemo_icon_container_update_scroll_region (NemoIconContainer *container)
 		x1 = MIN (x1, 0);
 		x2 = MAX (x2, allocation.width / pixels_per_unit);
 		y1 = 0;
+		y2 = MAX (y2, container->details->layout_bottom);
 	} else {
 		/* Otherwise we add the padding that is at the start of the
 		   layout */
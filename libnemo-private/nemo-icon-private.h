@@ -309,6 +309,10 @@ struct NemoIconContainerDetails {
     GList *current_selection;
     gint current_selection_count;
     gint fixed_text_height;
+
+    /* FINDERZ: the bottom of what a layout put below the icons, such
+     * as group headers, so the scroll region takes it in */
+    double layout_bottom;
 };
 
 typedef struct {
@@ -32,6 +32,8 @@
 struct NemoQueryDetails {
     gchar *file_pattern;
     gchar *content_pattern;
+    gchar *metadata_field;
+    gchar *metadata_pattern;
     char *location_uri;
     GList *mime_types;
     gboolean show_hidden;
@@ -53,6 +55,8 @@ finalize (GObject *object)
 	query = NEMO_QUERY (object);
     g_free (query->details->file_pattern);
 	g_free (query->details->content_pattern);
+    g_free (query->details->metadata_field);
+    g_free (query->details->metadata_pattern);
 	g_free (query->details->location_uri);
 
 	G_OBJECT_CLASS (nemo_query_parent_class)->finalize (object);
@@ -127,6 +131,110 @@ nemo_query_has_content_pattern (NemoQuery *query)
     return query->details->content_pattern != NULL;
 }
 
+char *
+nemo_query_get_metadata_field (NemoQuery *query)
+{
+    g_return_val_if_fail (NEMO_IS_QUERY (query), NULL);
+
+    return g_strdup (query->details->metadata_field);
+}
+
+char *
+nemo_query_get_metadata_pattern (NemoQuery *query)
+{
+    g_return_val_if_fail (NEMO_IS_QUERY (query), NULL);
+
+    return g_strdup (query->details->metadata_pattern);
+}
+
+void
+nemo_query_set_metadata_pattern (NemoQuery *query, const char *field, const char *text)
+{
+    g_return_if_fail (NEMO_IS_QUERY (query));
+
+    g_clear_pointer (&query->details->metadata_field, g_free);
+    g_clear_pointer (&query->details->metadata_pattern, g_free);
+
+    if (text && text[0] != '\0') {
+        query->details->metadata_field = g_strdup (field);
+        query->details->metadata_pattern = g_strstrip (g_strdup (text));
+    }
+}
+
+gboolean
+nemo_query_has_metadata_pattern (NemoQuery *query)
+{
+    g_return_val_if_fail (NEMO_IS_QUERY (query), FALSE);
+
+    return query->details->metadata_pattern != NULL;
+}
+
+char *
+nemo_query_take_metadata_pattern (NemoQuery *query, const char *text)
+{
+    extern gboolean finderz_text_index_has_field (const gchar *field);
+    const char *start;
+
+    g_return_val_if_fail (NEMO_IS_QUERY (query), NULL);
+
+    nemo_query_set_metadata_pattern (query, NULL, NULL);
+
+    if (text == NULL) {
+        return g_strdup ("");
+    }
+
+    for (start = text; *start != '\0'; start++) {
+        const char *colon, *value, *end, *term_end;
+        char *field, *pattern, *rest;
+
+        if ((start != text && !g_ascii_isspace (start[-1])) || !g_ascii_isalpha (*start)) {
+            continue;
+        }
+
+        colon = start;
+        while (g_ascii_isalnum (*colon) || *colon == '_') {
+            colon++;
+        }
+        if (*colon != ':') {
+            continue;
+        }
+
+        value = colon + 1;
+        if (*value == '"') {
+            value++;
+            end = strchr (value, '"');
+            if (end == NULL) {
+                end = value + strlen (value);
+                term_end = end;
+            } else {
+                term_end = end + 1;
+            }
+        } else {
+            end = value;
+            while (*end != '\0' && !g_ascii_isspace (*end)) {
+                end++;
+            }
+            term_end = end;
+        }
+
+        field = g_strndup (start, colon - start);
+        if (end == value || !finderz_text_index_has_field (field)) {
+            g_free (field);
+            continue;
+        }
+
+        pattern = g_strndup (value, end - value);
+        nemo_query_set_metadata_pattern (query, field, pattern);
+        g_free (pattern);
+        g_free (field);
+
+        rest = g_strdup_printf ("%.*s%s", (int) (start - text), text, term_end);
+        return g_strstrip (rest);
+    }
+
+    return g_strdup (text);
+}
+
 char *
 nemo_query_get_location (NemoQuery *query)
 {
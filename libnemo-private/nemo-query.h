@@ -56,6 +56,17 @@ char *         nemo_query_get_content_pattern (NemoQuery *query);
 void           nemo_query_set_content_pattern (NemoQuery *query, const char *text);
 gboolean       nemo_query_has_content_pattern (NemoQuery *query);
 
+/* FINDERZ: Match a metadata text field, such as "prompt", from the
+ * Finderz text index instead of the files; a NULL field means any */
+char *         nemo_query_get_metadata_field   (NemoQuery *query);
+char *         nemo_query_get_metadata_pattern (NemoQuery *query);
+void           nemo_query_set_metadata_pattern (NemoQuery *query, const char *field, const char *text);
+gboolean       nemo_query_has_metadata_pattern (NemoQuery *query);
+/* FINDERZ: Take a field:"phrase" or field:word term naming an indexed
+ * field, such as prompt:"cyberpunk alley", out of @text into the
+ * metadata pattern.  Returns the rest of @text, for the file pattern. */
+char *         nemo_query_take_metadata_pattern (NemoQuery *query, const char *text);
+
 char *         nemo_query_get_location       (NemoQuery *query);
 void           nemo_query_set_location       (NemoQuery *query, const char *uri);
 
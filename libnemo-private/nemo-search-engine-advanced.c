@@ -23,12 +23,14 @@
 #include "nemo-file-utilities.h"
 #include "nemo-search-engine-advanced.h"
 #include "nemo-global-preferences.h"
+#include "nemo-lib-self-check-functions.h"
 
 #include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 #include <glib.h>
 #include <gio/gio.h>
+#include <glib/gstdio.h>
 
 #define DEBUG_FLAG NEMO_DEBUG_SEARCH
 #include "nemo-debug.h"
@@ -68,6 +70,9 @@ typedef struct {
     GRegex *filename_re;
     GPatternSpec *filename_glob_pattern;
 
+    gchar *metadata_field;
+    gchar *metadata_pattern;
+
     GMutex hit_list_lock;
     GList *hit_list; // holds FileSearchResults
 
@@ -496,7 +501,10 @@ search_thread_data_new (NemoSearchEngineAdvanced *engine,
 
     g_mutex_init (&data->hit_list_lock);
 
-    if (nemo_query_has_content_pattern (query)) {
+    if (nemo_query_has_metadata_pattern (query)) {
+        data->metadata_field = nemo_query_get_metadata_field (query);
+        data->metadata_pattern = nemo_query_get_metadata_pattern (query);
+    } else if (nemo_query_has_content_pattern (query)) {
         data->content_re = nemo_search_engine_advanced_create_content_regex (query, &error);
 
         if (data->content_re == NULL) {
@@ -541,6 +549,8 @@ search_thread_data_free (SearchThreadData *data)
     g_clear_pointer (&data->newline_re, g_regex_unref);
     g_clear_pointer (&data->filename_re, g_regex_unref);
     g_clear_pointer (&data->filename_glob_pattern, g_pattern_spec_free);
+    g_free (data->metadata_field);
+    g_free (data->metadata_pattern);
     g_timer_destroy (data->timer);
     g_mutex_clear (&data->hit_list_lock);
 
@@ -960,6 +970,38 @@ lookup_helpers_for_content_type (const gchar *content_type)
     return find_data.helpers;
 }
 
+static gboolean
+file_name_matches (SearchThreadData *data, const char *display_name)
+{
+    char *normalized;
+    gboolean hit;
+
+    normalized = g_utf8_normalize (display_name, -1, G_NORMALIZE_NFD);
+
+    if (data->file_use_regex) {
+        GMatchInfo *match_info;
+        hit = g_regex_match (data->filename_re, normalized, 0, &match_info);
+        g_match_info_unref (match_info);
+    } else {
+        gchar *cased;
+
+        if (!data->file_case_sensitive) {
+            cased = g_utf8_strdown (normalized, -1);
+        } else {
+            cased = g_strdup (normalized);
+        }
+
+        gchar *cased_reversed = g_utf8_strreverse (cased, -1);
+        hit = g_pattern_spec_match (data->filename_glob_pattern, strlen (cased), cased, cased_reversed);
+        g_free (cased);
+        g_free (cased_reversed);
+    }
+
+    g_free (normalized);
+
+    return hit;
+}
+
 static void
 visit_directory (GFile *dir, SearchThreadData *data)
 {
@@ -967,7 +1009,6 @@ visit_directory (GFile *dir, SearchThreadData *data)
 	GFileInfo *info;
     GFile *child;
 	const char *display_name;
-	char *normalized;
 	gboolean hit, is_dir, skip_child;
 
     const gchar *attrs;
@@ -995,28 +1036,7 @@ visit_directory (GFile *dir, SearchThreadData *data)
 			goto next;
 		}
 
-		normalized = g_utf8_normalize (display_name, -1, G_NORMALIZE_NFD);
-
-        if (data->file_use_regex) {
-            GMatchInfo *match_info;
-            hit = g_regex_match (data->filename_re, normalized, 0, &match_info);
-            g_match_info_unref (match_info);
-        } else {
-            gchar *cased;
-
-            if (!data->file_case_sensitive) {
-                cased = g_utf8_strdown (normalized, -1);
-            } else {
-                cased = g_strdup (normalized);
-            }
-
-            gchar *cased_reversed = g_utf8_strreverse (cased, -1);
-            hit = g_pattern_spec_match (data->filename_glob_pattern, strlen (cased), cased, cased_reversed);
-            g_free (cased);
-            g_free (cased_reversed);
-        }
-
-        g_free (normalized);
+		hit = file_name_matches (data, display_name);
 
         child = g_file_get_child (dir, g_file_info_get_name (info));
         is_dir = g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY;
@@ -1127,6 +1147,70 @@ visit_directory (GFile *dir, SearchThreadData *data)
 }
 
 
+/* FINDERZ: Metadata text is answered from the Finderz text index, so
+ * no file is opened, only checked for with a stat.  Files that have
+ * gone since they were indexed are dropped from it. */
+static void
+search_text_index (SearchThreadData *data, GFile *root)
+{
+    extern GPtrArray *finderz_text_index_search (const gchar *field, const gchar *text,
+                                                 const gchar *directory, gboolean recurse);
+    extern void finderz_text_index_remove (const gchar *path);
+    GPtrArray *paths;
+    const char *root_path;
+    guint i;
+
+    root_path = g_file_peek_path (root);
+    if (root_path == NULL) {
+        return;
+    }
+
+    paths = finderz_text_index_search (data->metadata_field, data->metadata_pattern,
+                                       root_path, data->recurse);
+    if (paths == NULL) {
+        return;
+    }
+
+    for (i = 0; i < paths->len && !g_cancellable_is_cancelled (data->cancellable); i++) {
+        const char *path = g_ptr_array_index (paths, i);
+        FileSearchResult *fsr;
+        gchar *display_name;
+        GFile *file;
+        gboolean hit;
+
+        if (!g_file_test (path, G_FILE_TEST_EXISTS)) {
+            finderz_text_index_remove (path);
+            continue;
+        }
+
+        if (!data->show_hidden && strstr (path + strlen (root_path), "/.") != NULL) {
+            continue;
+        }
+
+        display_name = g_filename_display_basename (path);
+        hit = file_name_matches (data, display_name);
+        g_free (display_name);
+
+        if (!hit) {
+            continue;
+        }
+
+        file = g_file_new_for_path (path);
+        fsr = file_search_result_new (g_file_get_uri (file), NULL);
+        g_object_unref (file);
+
+        g_mutex_lock (&data->hit_list_lock);
+        data->hit_list = g_list_prepend (data->hit_list, fsr);
+        g_mutex_unlock (&data->hit_list_lock);
+
+        if (++data->n_processed_files > FILE_SEARCH_ONLY_BATCH_SIZE) {
+            send_batch (data);
+        }
+    }
+
+    g_ptr_array_unref (paths);
+}
+
 static gpointer
 search_thread_func (gpointer user_data)
 {
@@ -1136,6 +1220,13 @@ search_thread_func (gpointer user_data)
 	const char *id;
 	data = user_data;
 
+    if (data->metadata_pattern) {
+        search_text_index (data, g_queue_peek_head (data->directories));
+        send_batch (data);
+        g_idle_add (search_thread_done_idle, data);
+        return NULL;
+    }
+
 	/* Insert id for toplevel directory into visited */
 	dir = g_queue_peek_head (data->directories);
 	info = g_file_query_info (dir, G_FILE_ATTRIBUTE_ID_FILE, 0, data->cancellable, NULL);
@@ -1286,3 +1377,145 @@ nemo_search_engine_advanced_check_content_pattern (NemoQuery *query,
     g_clear_pointer (&regex, g_regex_unref);
     return ret;
 }
+
+#if !defined (NEMO_OMIT_SELF_CHECK)
+
+static void
+append_png_chunk (GByteArray *png, const char *type, const guchar *data, guint32 length)
+{
+    guchar header[4] = { length >> 24, length >> 16, length >> 8, length };
+    guchar crc[4] = { 0, 0, 0, 0 };
+
+    g_byte_array_append (png, header, 4);
+    g_byte_array_append (png, (const guchar *) type, 4);
+    g_byte_array_append (png, data, length);
+    g_byte_array_append (png, crc, 4);
+}
+
+/* A PNG holding nothing but the generation parameters of @prompt, as
+ * A1111 writes them; chunk CRCs are not checked when reading */
+static void
+write_prompt_png (const char *path, const char *prompt)
+{
+    static const guchar signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    static const guchar ihdr[] = { 0, 0, 0, 1, 0, 0, 0, 1, 8, 2, 0, 0, 0 };
+    GByteArray *png, *text;
+
+    text = g_byte_array_new ();
+    g_byte_array_append (text, (const guchar *) "parameters", strlen ("parameters") + 1);
+    g_byte_array_append (text, (const guchar *) prompt, strlen (prompt));
+    g_byte_array_append (text, (const guchar *) "\nSteps: 20, Seed: 1", strlen ("\nSteps: 20, Seed: 1"));
+
+    png = g_byte_array_new ();
+    g_byte_array_append (png, signature, sizeof (signature));
+    append_png_chunk (png, "IHDR", ihdr, sizeof (ihdr));
+    append_png_chunk (png, "tEXt", text->data, text->len);
+    append_png_chunk (png, "IEND", NULL, 0);
+
+    g_file_set_contents (path, (const gchar *) png->data, png->len, NULL);
+
+    g_byte_array_unref (png);
+    g_byte_array_unref (text);
+}
+
+typedef struct {
+    GList *uris;
+    gboolean finished;
+} SelfCheckSearch;
+
+static void
+self_check_hits_added (NemoSearchEngine *engine, GList *hits, SelfCheckSearch *search)
+{
+    GList *l;
+
+    for (l = hits; l != NULL; l = l->next) {
+        FileSearchResult *fsr = l->data;
+
+        search->uris = g_list_prepend (search->uris, g_strdup (fsr->uri));
+        file_search_result_free (fsr);
+    }
+}
+
+static void
+self_check_finished (NemoSearchEngine *engine, SelfCheckSearch *search)
+{
+    search->finished = TRUE;
+}
+
+void
+nemo_self_check_search_engine_advanced (void)
+{
+    extern void finderz_text_index_init (void);
+    extern gpointer finderz_extract_all_metadata (const gchar *file_path, GError **error);
+    extern void finderz_text_index_update (const gchar *path, gpointer metadata);
+    extern void finderz_text_index_remove (const gchar *path);
+    extern void finderz_universal_metadata_unref (gpointer metadata);
+    static const char *names[] = { "alley.png", "forest.png" };
+    static const char *prompts[] = { "a cyberpunk alley at night", "a quiet forest" };
+    SelfCheckSearch search = { NULL, FALSE };
+    NemoSearchEngine *engine;
+    NemoQuery *query;
+    char *directory, *paths[2], *uri;
+    guint i;
+
+    /* FINDERZ: the query editor's field:"phrase" terms */
+    query = nemo_query_new ();
+    EEL_CHECK_STRING_RESULT (nemo_query_take_metadata_pattern (query, "prompt:\"cyberpunk alley\" *.png"), "*.png");
+    EEL_CHECK_STRING_RESULT (nemo_query_get_metadata_field (query), "prompt");
+    EEL_CHECK_STRING_RESULT (nemo_query_get_metadata_pattern (query), "cyberpunk alley");
+    EEL_CHECK_STRING_RESULT (nemo_query_take_metadata_pattern (query, "draft keywords:neon"), "draft");
+    EEL_CHECK_STRING_RESULT (nemo_query_get_metadata_pattern (query), "neon");
+    EEL_CHECK_STRING_RESULT (nemo_query_take_metadata_pattern (query, "notes:todo 12:30"), "notes:todo 12:30");
+    EEL_CHECK_BOOLEAN_RESULT (nemo_query_has_metadata_pattern (query), FALSE);
+
+    /* and a search for one, answered from the text index */
+    directory = g_dir_make_tmp ("nemo-search-XXXXXX", NULL);
+    g_assert (directory != NULL);
+
+    finderz_text_index_init ();
+    for (i = 0; i < G_N_ELEMENTS (names); i++) {
+        gpointer metadata;
+
+        paths[i] = g_build_filename (directory, names[i], NULL);
+        write_prompt_png (paths[i], prompts[i]);
+        metadata = finderz_extract_all_metadata (paths[i], NULL);
+        if (metadata != NULL) {
+            finderz_text_index_update (paths[i], metadata);
+            finderz_universal_metadata_unref (metadata);
+        }
+    }
+
+    uri = g_filename_to_uri (directory, NULL, NULL);
+    nemo_query_set_location (query, uri);
+    nemo_query_set_file_pattern (query, "*");
+    g_free (nemo_query_take_metadata_pattern (query, "prompt:\"Cyberpunk Alley\""));
+    g_free (uri);
+
+    engine = nemo_search_engine_advanced_new ();
+    g_signal_connect (engine, "hits-added", G_CALLBACK (self_check_hits_added), &search);
+    g_signal_connect (engine, "finished", G_CALLBACK (self_check_finished), &search);
+    nemo_search_engine_set_query (engine, query);
+    nemo_search_engine_start (engine);
+    while (!search.finished) {
+        g_main_context_iteration (NULL, TRUE);
+    }
+
+    uri = g_filename_to_uri (paths[0], NULL, NULL);
+    EEL_CHECK_INTEGER_RESULT (g_list_length (search.uris), 1);
+    EEL_CHECK_STRING_RESULT (search.uris != NULL ? g_strdup (search.uris->data) : NULL, uri);
+    g_free (uri);
+
+    g_list_free_full (search.uris, g_free);
+    g_object_unref (engine);
+    g_object_unref (query);
+
+    for (i = 0; i < G_N_ELEMENTS (names); i++) {
+        finderz_text_index_remove (paths[i]);
+        g_unlink (paths[i]);
+        g_free (paths[i]);
+    }
+    g_rmdir (directory);
+    g_free (directory);
+}
+
+#endif /* !NEMO_OMIT_SELF_CHECK */
@@ -0,0 +1,1890 @@
+/* finderz-bench.c
+ *
+ * Benchmark of the Finderz metadata readers
+ *
+ * Writes a corpus of the files Finderz reads metadata from, the same
+ * bytes for the same seed: PNGs with text chunks from a few hundred
+ * bytes to a few hundred KB, JPEGs with EXIF and XMP, WebPs, images
+ * with XMP sidecars, files tagged with xattrs and .DS_Store files of
+ * several sizes.  Extraction, the DS_Store parser, metadata sorts and
+ * filters are then timed over it and each phase is printed as a line
+ * of JSON:
+ *
+ *   {"phase":"extract","files":1500,"seconds":0.412,"files_per_sec":3640.8,...}
+ *
+ * Bytes read and syscalls come from /proc/self/io, which counts read
+ * and write calls but not open or stat, nor the pages of a mapped
+ * file; those show up as page faults instead.  Allocations are counted
+ * by wrapping glibc's malloc, so they are null elsewhere and under
+ * AddressSanitizer.  Peak RSS is reset before each phase where the
+ * kernel allows it, and is otherwise the peak of the whole run.
+ *
+ * Run through meson with "meson test --benchmark -v", or directly:
+ *
+ *   finderz-bench [--files N] [--iterations N] [--seed N] [--corpus DIR]
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/xattr.h>
+#include <sys/resource.h>
+#include "finderz-universal-metadata.h"
+#include "finderz-xattr-handler.h"
+#include "finderz-ds-store.h"
+#include "finderz-filter.h"
+
+/* DS_Store records per file, each size written BENCH_DS_STORE_COPIES times */
+static const guint ds_store_sizes[] = { 10, 100, 1000, 10000 };
+#define BENCH_DS_STORE_COPIES   3
+/* Names looked up in each lazily parsed DS_Store */
+#define BENCH_DS_STORE_LOOKUPS  32
+
+/* Images of one ComfyUI batch share a workflow */
+#define BENCH_COMFYUI_BATCH     8
+
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+#define BENCH_COUNT_ALLOCATIONS 1
+
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t n_members, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+
+static gsize allocations = 0;
+
+void *
+malloc (size_t size)
+{
+    __atomic_fetch_add (&allocations, 1, __ATOMIC_RELAXED);
+    return __libc_malloc (size);
+}
+
+void *
+calloc (size_t n_members, size_t size)
+{
+    __atomic_fetch_add (&allocations, 1, __ATOMIC_RELAXED);
+    return __libc_calloc (n_members, size);
+}
+
+void *
+realloc (void *ptr, size_t size)
+{
+    __atomic_fetch_add (&allocations, 1, __ATOMIC_RELAXED);
+    return __libc_realloc (ptr, size);
+}
+#endif
+
+static gint option_files = 600;
+static gint option_iterations = 3;
+static gint option_seed = 1;
+static gchar *option_corpus = NULL;
+
+static const GOptionEntry options[] = {
+    { "files", 'n', 0, G_OPTION_ARG_INT, &option_files,
+      "Number of files to extract metadata from", "N" },
+    { "iterations", 'i', 0, G_OPTION_ARG_INT, &option_iterations,
+      "Times each phase is run", "N" },
+    { "seed", 's', 0, G_OPTION_ARG_INT, &option_seed,
+      "Seed of the corpus", "N" },
+    { "corpus", 'c', 0, G_OPTION_ARG_FILENAME, &option_corpus,
+      "Write the corpus to DIR and keep it", "DIR" },
+    { NULL }
+};
+
+static const gchar *words[] = {
+    "portrait", "landscape", "cinematic", "lighting", "volumetric", "fog",
+    "detailed", "masterpiece", "octane", "render", "bokeh", "golden", "hour",
+    "cyberpunk", "city", "neon", "rain", "reflections", "forest", "ancient",
+    "temple", "dramatic", "sky", "studio", "photograph", "film", "grain",
+    "watercolor", "sketch", "isometric", "castle", "ocean", "storm", "robot",
+    "astronaut", "flowers", "macro", "ultra", "sharp", "focus", "8k", "moody"
+};
+
+static const gchar *models[] = {
+    "sd_xl_base_1.0.safetensors", "juggernautXL_v9.safetensors",
+    "dreamshaper_8.safetensors", "flux1-dev.safetensors",
+    "realisticVisionV51.safetensors"
+};
+
+static const gchar *samplers[] = {
+    "Euler a", "DPM++ 2M Karras", "DDIM", "UniPC", "DPM++ SDE Karras"
+};
+
+static const gchar *comfyui_samplers[] = {
+    "euler", "euler_ancestral", "dpmpp_2m", "ddim", "uni_pc"
+};
+
+static const gchar *cameras[][3] = {
+    { "Canon", "Canon EOS R5", "RF24-70mm F2.8 L IS USM" },
+    { "NIKON CORPORATION", "NIKON Z 6_2", "NIKKOR Z 50mm f/1.8 S" },
+    { "SONY", "ILCE-7M4", "FE 35mm F1.4 GM" },
+    { "FUJIFILM", "X-T5", "XF33mmF1.4 R LM WR" }
+};
+
+static const gchar *labels[] = { "Red", "Yellow", "Green", "Blue", "Purple" };
+
+typedef struct {
+    GRand *rand;
+    gchar *root;
+    GPtrArray *files;           /* paths to extract metadata from */
+    GPtrArray *ds_stores;       /* .DS_Store paths */
+    GPtrArray *ds_store_names;  /* names to look up, per .DS_Store */
+    guint64 bytes;
+    gboolean xattrs;
+} BenchCorpus;
+
+/* Big- and little-endian writers for the file formats below */
+
+static void
+put_be16 (GByteArray *buf, guint16 value)
+{
+    guint8 bytes[2] = { value >> 8, value };
+    
+    g_byte_array_append (buf, bytes, 2);
+}
+
+static void
+put_be32 (GByteArray *buf, guint32 value)
+{
+    guint8 bytes[4] = { value >> 24, value >> 16, value >> 8, value };
+    
+    g_byte_array_append (buf, bytes, 4);
+}
+
+static void
+put_le16 (GByteArray *buf, guint16 value)
+{
+    guint8 bytes[2] = { value, value >> 8 };
+    
+    g_byte_array_append (buf, bytes, 2);
+}
+
+static void
+put_le24 (GByteArray *buf, guint32 value)
+{
+    guint8 bytes[3] = { value, value >> 8, value >> 16 };
+    
+    g_byte_array_append (buf, bytes, 3);
+}
+
+static void
+put_le32 (GByteArray *buf, guint32 value)
+{
+    guint8 bytes[4] = { value, value >> 8, value >> 16, value >> 24 };
+    
+    g_byte_array_append (buf, bytes, 4);
+}
+
+static void
+set_be32 (GByteArray *buf, gsize offset, guint32 value)
+{
+    buf->data[offset] = value >> 24;
+    buf->data[offset + 1] = value >> 16;
+    buf->data[offset + 2] = value >> 8;
+    buf->data[offset + 3] = value;
+}
+
+static void
+set_le32 (GByteArray *buf, gsize offset, guint32 value)
+{
+    buf->data[offset] = value;
+    buf->data[offset + 1] = value >> 8;
+    buf->data[offset + 2] = value >> 16;
+    buf->data[offset + 3] = value >> 24;
+}
+
+static void
+put_string (GByteArray *buf, const gchar *text)
+{
+    g_byte_array_append (buf, (const guint8 *)text, strlen (text));
+}
+
+static void
+put_zeros (GByteArray *buf, gsize count)
+{
+    gsize length = buf->len;
+    
+    g_byte_array_set_size (buf, length + count);
+    memset (buf->data + length, 0, count);
+}
+
+/* Filler that never contains 0xff, so it cannot be read as a JPEG marker */
+static void
+put_filler (GByteArray *buf, GRand *rand, gsize count)
+{
+    gsize length = buf->len;
+    guint32 state = g_rand_int (rand);
+    gsize i;
+    
+    g_byte_array_set_size (buf, length + count);
+    for (i = 0; i < count; i++) {
+        state = state * 1103515245 + 12345;
+        buf->data[length + i] = (state >> 16) % 0xff;
+    }
+}
+
+#define PICK(rand, array) ((array)[g_rand_int_range ((rand), 0, G_N_ELEMENTS (array))])
+
+static void
+append_words (GString *text, GRand *rand, guint count)
+{
+    guint i;
+    
+    for (i = 0; i < count; i++) {
+        if (i > 0) {
+            g_string_append (text, i % 5 == 0 ? ", " : " ");
+        }
+        g_string_append (text, PICK (rand, words));
+    }
+}
+
+static gchar*
+random_prompt (GRand *rand, guint min_words, guint max_words)
+{
+    GString *text = g_string_new (NULL);
+    
+    append_words (text, rand, g_rand_int_range (rand, min_words, max_words + 1));
+    
+    return g_string_free (text, FALSE);
+}
+
+/* The "parameters" text the SD WebUI family writes */
+static gchar*
+sd_parameters (GRand *rand, guint prompt_words)
+{
+    gchar *prompt = random_prompt (rand, prompt_words, prompt_words * 2);
+    gchar *negative = random_prompt (rand, 4, 24);
+    gchar *text;
+    
+    text = g_strdup_printf ("%s\nNegative prompt: %s\n"
+                            "Steps: %d, Sampler: %s, CFG scale: %.1f, Seed: %u, "
+                            "Size: 1024x1024, Model hash: %08x, Model: %s",
+                            prompt, negative,
+                            g_rand_int_range (rand, 10, 80), PICK (rand, samplers),
+                            g_rand_int_range (rand, 10, 150) / 10.0,
+                            g_rand_int (rand), g_rand_int (rand), PICK (rand, models));
+    g_free (prompt);
+    g_free (negative);
+    
+    return text;
+}
+
+/* A ComfyUI "prompt" graph of about @size bytes: loader, sampler and
+ * text encoders, then enough other nodes to make up the size */
+static gchar*
+comfyui_prompt (GRand *rand, gsize size)
+{
+    GString *json = g_string_new (NULL);
+    gchar *positive = random_prompt (rand, 12, 60);
+    gchar *negative = random_prompt (rand, 4, 16);
+    guint node = 10;
+    
+    g_string_append_printf (json,
+        "{\"3\": {\"inputs\": {\"seed\": %u, \"steps\": %d, \"cfg\": %.1f, "
+        "\"sampler_name\": \"%s\", \"scheduler\": \"karras\", \"denoise\": 1, "
+        "\"model\": [\"4\", 0], \"positive\": [\"6\", 0], \"negative\": [\"7\", 0], "
+        "\"latent_image\": [\"5\", 0]}, \"class_type\": \"KSampler\"}, "
+        "\"4\": {\"inputs\": {\"ckpt_name\": \"%s\"}, \"class_type\": \"CheckpointLoaderSimple\"}, "
+        "\"5\": {\"inputs\": {\"width\": 1024, \"height\": 1024, \"batch_size\": 1}, "
+        "\"class_type\": \"EmptyLatentImage\"}, "
+        "\"6\": {\"inputs\": {\"text\": \"%s\", \"clip\": [\"4\", 1]}, \"class_type\": \"CLIPTextEncode\"}, "
+        "\"7\": {\"inputs\": {\"text\": \"%s\", \"clip\": [\"4\", 1]}, \"class_type\": \"CLIPTextEncode\"}, "
+        "\"8\": {\"inputs\": {\"samples\": [\"3\", 0], \"vae\": [\"4\", 2]}, \"class_type\": \"VAEDecode\"}",
+        g_rand_int (rand), g_rand_int_range (rand, 10, 60), g_rand_int_range (rand, 10, 120) / 10.0,
+        PICK (rand, comfyui_samplers), PICK (rand, models), positive, negative);
+    
+    while (json->len < size) {
+        g_string_append_printf (json,
+            ", \"%u\": {\"inputs\": {\"upscale_method\": \"nearest-exact\", \"width\": %d, "
+            "\"height\": %d, \"crop\": \"disabled\", \"image\": [\"%u\", 0]}, "
+            "\"class_type\": \"ImageScale\"}",
+            node, g_rand_int_range (rand, 512, 4096), g_rand_int_range (rand, 512, 4096),
+            node - 1);
+        node++;
+    }
+    g_string_append_c (json, '}');
+    
+    g_free (positive);
+    g_free (negative);
+    
+    return g_string_free (json, FALSE);
+}
+
+/* The editor's copy of a graph, of about @size bytes */
+static gchar*
+comfyui_workflow (GRand *rand, gsize size)
+{
+    GString *json = g_string_new ("{\"last_node_id\": 0, \"nodes\": [");
+    guint node = 1;
+    
+    g_string_append_printf (json,
+        "{\"id\": 3, \"type\": \"KSampler\", \"pos\": [863, 186], \"size\": [315, 262], "
+        "\"widgets_values\": [%u, \"randomize\", %d, %.1f, \"%s\", \"karras\", 1]}, "
+        "{\"id\": 4, \"type\": \"CheckpointLoaderSimple\", \"pos\": [26, 474], "
+        "\"widgets_values\": [\"%s\"]}",
+        g_rand_int (rand), g_rand_int_range (rand, 10, 60), g_rand_int_range (rand, 10, 120) / 10.0,
+        PICK (rand, comfyui_samplers), PICK (rand, models));
+    
+    while (json->len < size) {
+        g_string_append_printf (json,
+            ", {\"id\": %u, \"type\": \"Note\", \"pos\": [%d, %d], \"size\": [400, 120], "
+            "\"flags\": {}, \"order\": %u, \"mode\": 0, \"properties\": {\"text\": \"\"}, "
+            "\"widgets_values\": [\"",
+            node + 10, g_rand_int_range (rand, 0, 4000), g_rand_int_range (rand, 0, 4000), node);
+        append_words (json, rand, 16);
+        g_string_append (json, "\"]}");
+        node++;
+    }
+    g_string_append (json, "], \"links\": [], \"groups\": [], \"version\": 0.4}");
+    
+    return g_string_free (json, FALSE);
+}
+
+/* An XMP packet with a rating, label, title, creator and keywords,
+ * followed by the padding writers leave for editing in place */
+static gchar*
+xmp_packet (GRand *rand, gsize padding)
+{
+    GString *xmp = g_string_new (NULL);
+    guint i, n_keywords = g_rand_int_range (rand, 0, 12);
+    
+    g_string_append_printf (xmp,
+        "<?xpacket begin=\"\xef\xbb\xbf\" id=\"W5M0MpCehiHzreSzNTczkc9d\"?>\n"
+        "<x:xmpmeta xmlns:x=\"adobe:ns:meta/\">\n"
+        " <rdf:RDF xmlns:rdf=\"http://www.w3.org/1999/02/22-rdf-syntax-ns#\">\n"
+        "  <rdf:Description rdf:about=\"\"\n"
+        "    xmlns:xmp=\"http://ns.adobe.com/xap/1.0/\"\n"
+        "    xmlns:dc=\"http://purl.org/dc/elements/1.1/\"\n"
+        "   xmp:Rating=\"%d\" xmp:Label=\"%s\">\n"
+        "   <dc:title><rdf:Alt><rdf:li xml:lang=\"x-default\">%s %s</rdf:li></rdf:Alt></dc:title>\n"
+        "   <dc:creator><rdf:Seq><rdf:li>Studio %d</rdf:li></rdf:Seq></dc:creator>\n"
+        "   <dc:subject>\n    <rdf:Bag>\n",
+        g_rand_int_range (rand, 0, 6), PICK (rand, labels),
+        PICK (rand, words), PICK (rand, words), g_rand_int_range (rand, 1, 20));
+    for (i = 0; i < n_keywords; i++) {
+        g_string_append_printf (xmp, "     <rdf:li>%s</rdf:li>\n", PICK (rand, words));
+    }
+    g_string_append (xmp,
+        "    </rdf:Bag>\n   </dc:subject>\n  </rdf:Description>\n </rdf:RDF>\n</x:xmpmeta>\n");
+    for (i = 0; i < padding / 64; i++) {
+        g_string_append (xmp, "                                                               \n");
+    }
+    g_string_append (xmp, "<?xpacket end=\"w\"?>");
+    
+    return g_string_free (xmp, FALSE);
+}
+
+static gboolean
+write_file (BenchCorpus *corpus, const gchar *path, GByteArray *buf)
+{
+    GError *error = NULL;
+    
+    if (!g_file_set_contents (path, (const gchar *)buf->data, buf->len, &error)) {
+        g_printerr ("finderz-bench: %s\n", error->message);
+        g_error_free (error);
+        return FALSE;
+    }
+    corpus->bytes += buf->len;
+    
+    return TRUE;
+}
+
+/* PNG */
+
+static guint32 crc_table[256];
+
+static void
+crc_table_init (void)
+{
+    guint32 n, k, c;
+    
+    for (n = 0; n < 256; n++) {
+        c = n;
+        for (k = 0; k < 8; k++) {
+            c = c & 1 ? 0xedb88320U ^ (c >> 1) : c >> 1;
+        }
+        crc_table[n] = c;
+    }
+}
+
+static guint32
+crc32 (const guint8 *data, gsize length)
+{
+    guint32 c = 0xffffffffU;
+    gsize i;
+    
+    for (i = 0; i < length; i++) {
+        c = crc_table[(c ^ data[i]) & 0xff] ^ (c >> 8);
+    }
+    
+    return c ^ 0xffffffffU;
+}
+
+static void
+png_chunk (GByteArray *png, const gchar *type, const guint8 *data, gsize length)
+{
+    gsize start;
+    
+    put_be32 (png, length);
+    start = png->len;
+    g_byte_array_append (png, (const guint8 *)type, 4);
+    if (length > 0) {
+        g_byte_array_append (png, data, length);
+    }
+    put_be32 (png, crc32 (png->data + start, png->len - start));
+}
+
+/* tEXt, or iTXt with no language or translation */
+static void
+png_text_chunk (GByteArray *png, gboolean international,
+                const gchar *keyword, const gchar *text)
+{
+    GByteArray *body = g_byte_array_new ();
+    
+    g_byte_array_append (body, (const guint8 *)keyword, strlen (keyword) + 1);
+    if (international) {
+        put_zeros (body, 4);    /* not compressed, method, empty language and translation */
+    }
+    put_string (body, text);
+    png_chunk (png, international ? "iTXt" : "tEXt", body->data, body->len);
+    g_byte_array_unref (body);
+}
+
+/* A @side x @side grayscale image, its rows kept in stored deflate
+ * blocks, so the file has the size of a real one without compressing */
+static void
+png_image_data (GByteArray *png, guint side)
+{
+    GByteArray *raw = g_byte_array_new ();
+    GByteArray *zlib = g_byte_array_new ();
+    guint32 a = 1, b = 0;
+    gsize offset;
+    guint x, y;
+    
+    for (y = 0; y < side; y++) {
+        g_byte_array_append (raw, (const guint8 *)"", 1);     /* filter: none */
+        for (x = 0; x < side; x++) {
+            guint8 pixel = (x ^ y) & 0xff;
+            
+            g_byte_array_append (raw, &pixel, 1);
+        }
+    }
+    
+    put_be16 (zlib, 0x7801);
+    for (offset = 0; offset < raw->len; offset += 0xffff) {
+        gsize length = MIN (raw->len - offset, 0xffff);
+        guint8 final = offset + length == raw->len;
+        
+        g_byte_array_append (zlib, &final, 1);
+        put_le16 (zlib, length);
+        put_le16 (zlib, ~length);
+        g_byte_array_append (zlib, raw->data + offset, length);
+    }
+    for (offset = 0; offset < raw->len; offset++) {
+        a = (a + raw->data[offset]) % 65521;
+        b = (b + a) % 65521;
+    }
+    put_be32 (zlib, (b << 16) | a);
+    
+    png_chunk (png, "IDAT", zlib->data, zlib->len);
+    g_byte_array_unref (zlib);
+    g_byte_array_unref (raw);
+}
+
+static GByteArray*
+png_begin (guint side)
+{
+    static const guint8 signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    GByteArray *png = g_byte_array_new ();
+    GByteArray *header = g_byte_array_new ();
+    
+    g_byte_array_append (png, signature, sizeof (signature));
+    put_be32 (header, side);
+    put_be32 (header, side);
+    g_byte_array_append (header, (const guint8 *)"\x08\0\0\0\0", 5);  /* 8-bit gray */
+    png_chunk (png, "IHDR", header->data, header->len);
+    g_byte_array_unref (header);
+    
+    return png;
+}
+
+static void
+png_end (GByteArray *png, guint side)
+{
+    png_image_data (png, side);
+    png_chunk (png, "IEND", NULL, 0);
+}
+
+static const guint png_sides[] = { 32, 128, 384 };
+static const gsize comfyui_sizes[] = { 4 * 1024, 32 * 1024, 256 * 1024 };
+
+/* PNGs in turn: without text, with short and long WebUI parameters,
+ * with ComfyUI graphs of three sizes, with XMP, and with a large text
+ * chunk Finderz does not want ahead of the parameters */
+static void
+generate_pngs (BenchCorpus *corpus, const gchar *dir, guint count)
+{
+    gchar *workflow = NULL;
+    guint i;
+    
+    for (i = 0; i < count; i++) {
+        guint side = PICK (corpus->rand, png_sides);
+        GByteArray *png = png_begin (side);
+        gchar *path, *text;
+        
+        switch (i % 6) {
+            case 0:
+                break;
+            case 1:
+                text = sd_parameters (corpus->rand, 8);
+                png_text_chunk (png, FALSE, "parameters", text);
+                g_free (text);
+                break;
+            case 2:
+                text = sd_parameters (corpus->rand, 300);
+                png_text_chunk (png, TRUE, "parameters", text);
+                g_free (text);
+                break;
+            case 3: {
+                gsize size = comfyui_sizes[(i / (6 * BENCH_COMFYUI_BATCH)) % G_N_ELEMENTS (comfyui_sizes)];
+                
+                if (!workflow || (i / 6) % BENCH_COMFYUI_BATCH == 0) {
+                    g_free (workflow);
+                    workflow = comfyui_workflow (corpus->rand, size);
+                }
+                text = comfyui_prompt (corpus->rand, size / 4);
+                png_text_chunk (png, FALSE, "prompt", text);
+                png_text_chunk (png, FALSE, "workflow", workflow);
+                g_free (text);
+                break;
+            }
+            case 4:
+                text = xmp_packet (corpus->rand, 2048);
+                png_text_chunk (png, TRUE, "XML:com.adobe.xmp", text);
+                g_free (text);
+                break;
+            case 5: {
+                GString *comment = g_string_new (NULL);
+                
+                append_words (comment, corpus->rand, 2000);
+                png_text_chunk (png, FALSE, "Comment", comment->str);
+                g_string_free (comment, TRUE);
+                
+                text = sd_parameters (corpus->rand, 20);
+                png_text_chunk (png, FALSE, "parameters", text);
+                g_free (text);
+                break;
+            }
+        }
+        png_end (png, side);
+        
+        path = g_strdup_printf ("%s/render_%05u.png", dir, i);
+        if (write_file (corpus, path, png)) {
+            g_ptr_array_add (corpus->files, path);
+        } else {
+            g_free (path);
+        }
+        g_byte_array_unref (png);
+    }
+    
+    g_free (workflow);
+}
+
+/* TIFF, big-endian, as found in JPEG APP1 and WebP EXIF chunks */
+
+enum {
+    TIFF_BYTE = 1,
+    TIFF_ASCII = 2,
+    TIFF_SHORT = 3,
+    TIFF_LONG = 4,
+    TIFF_RATIONAL = 5,
+    TIFF_UNDEFINED = 7
+};
+
+typedef struct {
+    guint16 tag;
+    guint16 type;
+    guint32 count;
+    GByteArray *value;
+} TiffField;
+
+static TiffField*
+tiff_add (GArray *ifd, guint16 tag, guint16 type, guint32 count)
+{
+    TiffField field = { tag, type, count, g_byte_array_new () };
+    
+    g_array_append_val (ifd, field);
+    
+    return &g_array_index (ifd, TiffField, ifd->len - 1);
+}
+
+static void
+tiff_add_ascii (GArray *ifd, guint16 tag, const gchar *text)
+{
+    TiffField *field = tiff_add (ifd, tag, TIFF_ASCII, strlen (text) + 1);
+    
+    g_byte_array_append (field->value, (const guint8 *)text, strlen (text) + 1);
+}
+
+static void
+tiff_add_short (GArray *ifd, guint16 tag, guint16 value)
+{
+    put_be16 (tiff_add (ifd, tag, TIFF_SHORT, 1)->value, value);
+}
+
+static void
+tiff_add_long (GArray *ifd, guint16 tag, guint32 value)
+{
+    put_be32 (tiff_add (ifd, tag, TIFF_LONG, 1)->value, value);
+}
+
+/* @values holds @count numerator, denominator pairs */
+static void
+tiff_add_rationals (GArray *ifd, guint16 tag, const guint32 *values, guint count)
+{
+    TiffField *field = tiff_add (ifd, tag, TIFF_RATIONAL, count);
+    guint i;
+    
+    for (i = 0; i < count * 2; i++) {
+        put_be32 (field->value, values[i]);
+    }
+}
+
+static GArray*
+tiff_ifd_new (void)
+{
+    return g_array_new (FALSE, FALSE, sizeof (TiffField));
+}
+
+/* Bytes the IFD takes with the values that do not fit in its entries */
+static gsize
+tiff_ifd_length (GArray *ifd)
+{
+    gsize length = 2 + 12 * ifd->len + 4;
+    guint i;
+    
+    for (i = 0; i < ifd->len; i++) {
+        gsize size = g_array_index (ifd, TiffField, i).value->len;
+        
+        if (size > 4) {
+            length += size + (size & 1);
+        }
+    }
+    
+    return length;
+}
+
+/* Append @ifd, its values after it, and free it.  Offsets are from
+ * @tiff_start, the start of the TIFF header. */
+static void
+tiff_write_ifd (GByteArray *buf, gsize tiff_start, GArray *ifd)
+{
+    gsize data_offset = buf->len - tiff_start + 2 + 12 * ifd->len + 4;
+    guint i;
+    
+    put_be16 (buf, ifd->len);
+    for (i = 0; i < ifd->len; i++) {
+        TiffField *field = &g_array_index (ifd, TiffField, i);
+        
+        put_be16 (buf, field->tag);
+        put_be16 (buf, field->type);
+        put_be32 (buf, field->count);
+        if (field->value->len <= 4) {
+            g_byte_array_append (buf, field->value->data, field->value->len);
+            put_zeros (buf, 4 - field->value->len);
+        } else {
+            put_be32 (buf, data_offset);
+            data_offset += field->value->len + (field->value->len & 1);
+        }
+    }
+    put_be32 (buf, 0);
+    
+    for (i = 0; i < ifd->len; i++) {
+        TiffField *field = &g_array_index (ifd, TiffField, i);
+        
+        if (field->value->len > 4) {
+            g_byte_array_append (buf, field->value->data, field->value->len);
+            put_zeros (buf, field->value->len & 1);
+        }
+        g_byte_array_unref (field->value);
+    }
+    g_array_unref (ifd);
+}
+
+/* Camera EXIF, GPS for every other file, and @user_comment if not NULL */
+static void
+put_exif (GByteArray *buf, GRand *rand, const gchar *user_comment)
+{
+    const gchar **camera = cameras[g_rand_int_range (rand, 0, G_N_ELEMENTS (cameras))];
+    GArray *ifd0 = tiff_ifd_new ();
+    GArray *exif = tiff_ifd_new ();
+    GArray *gps = NULL;
+    gsize tiff_start = buf->len;
+    gsize ifd0_length, exif_length;
+    guint32 rationals[6];
+    gchar *date;
+    
+    date = g_strdup_printf ("20%02d:%02d:%02d %02d:%02d:%02d",
+                            g_rand_int_range (rand, 10, 26), g_rand_int_range (rand, 1, 13),
+                            g_rand_int_range (rand, 1, 29), g_rand_int_range (rand, 0, 24),
+                            g_rand_int_range (rand, 0, 60), g_rand_int_range (rand, 0, 60));
+    
+    tiff_add_ascii (ifd0, 0x010f, camera[0]);
+    tiff_add_ascii (ifd0, 0x0110, camera[1]);
+    tiff_add_ascii (ifd0, 0x0132, date);
+    tiff_add_long (ifd0, 0x8769, 0);
+    
+    rationals[0] = 1;
+    rationals[1] = 1 << g_rand_int_range (rand, 3, 12);
+    tiff_add_rationals (exif, 0x829a, rationals, 1);
+    rationals[0] = g_rand_int_range (rand, 14, 110);
+    rationals[1] = 10;
+    tiff_add_rationals (exif, 0x829d, rationals, 1);
+    tiff_add_short (exif, 0x8827, 100 << g_rand_int_range (rand, 0, 7));
+    tiff_add_ascii (exif, 0x9003, date);
+    tiff_add_ascii (exif, 0x9011, "+02:00");
+    rationals[0] = g_rand_int_range (rand, 14, 400);
+    rationals[1] = 1;
+    tiff_add_rationals (exif, 0x920a, rationals, 1);
+    tiff_add_ascii (exif, 0xa434, camera[2]);
+    if (user_comment) {
+        TiffField *field = tiff_add (exif, 0x9286, TIFF_UNDEFINED, 8 + strlen (user_comment));
+        
+        g_byte_array_append (field->value, (const guint8 *)"ASCII\0\0\0", 8);
+        put_string (field->value, user_comment);
+    }
+    
+    if (g_rand_boolean (rand)) {
+        TiffField *field;
+        
+        gps = tiff_ifd_new ();
+        tiff_add_ascii (gps, 0x0001, "N");
+        rationals[0] = g_rand_int_range (rand, 0, 80);
+        rationals[1] = 1;
+        rationals[2] = g_rand_int_range (rand, 0, 60);
+        rationals[3] = 1;
+        rationals[4] = g_rand_int_range (rand, 0, 6000);
+        rationals[5] = 100;
+        tiff_add_rationals (gps, 0x0002, rationals, 3);
+        tiff_add_ascii (gps, 0x0003, "W");
+        rationals[0] = g_rand_int_range (rand, 0, 180);
+        tiff_add_rationals (gps, 0x0004, rationals, 3);
+        field = tiff_add (gps, 0x0005, TIFF_BYTE, 1);
+        g_byte_array_append (field->value, (const guint8 *)"", 1);
+        rationals[0] = g_rand_int_range (rand, 0, 300000);
+        rationals[1] = 100;
+        tiff_add_rationals (gps, 0x0006, rationals, 1);
+        tiff_add_long (ifd0, 0x8825, 0);
+    }
+    
+    /* IFD0 follows the header, then the Exif and GPS IFDs */
+    ifd0_length = tiff_ifd_length (ifd0);
+    exif_length = tiff_ifd_length (exif);
+    set_be32 (g_array_index (ifd0, TiffField, 3).value, 0, 8 + ifd0_length);
+    if (gps) {
+        set_be32 (g_array_index (ifd0, TiffField, 4).value, 0, 8 + ifd0_length + exif_length);
+    }
+    
+    put_string (buf, "MM");
+    put_be16 (buf, 42);
+    put_be32 (buf, 8);
+    tiff_write_ifd (buf, tiff_start, ifd0);
+    tiff_write_ifd (buf, tiff_start, exif);
+    if (gps) {
+        tiff_write_ifd (buf, tiff_start, gps);
+    }
+    
+    g_free (date);
+}
+
+/* JPEG */
+
+static void
+jpeg_segment (GByteArray *jpeg, guint8 marker, GByteArray *body)
+{
+    guint8 bytes[2] = { 0xff, marker };
+    
+    g_byte_array_append (jpeg, bytes, 2);
+    put_be16 (jpeg, body->len + 2);
+    g_byte_array_append (jpeg, body->data, body->len);
+}
+
+/* A JPEG with an Exif APP1 segment, an XMP one if @with_xmp, and scan
+ * data of a realistic size that extraction must not read */
+static GByteArray*
+jpeg_new (GRand *rand, gboolean with_xmp)
+{
+    GByteArray *jpeg = g_byte_array_new ();
+    GByteArray *body = g_byte_array_new ();
+    
+    g_byte_array_append (jpeg, (const guint8 *)"\xff\xd8", 2);
+    
+    g_byte_array_append (body, (const guint8 *)"JFIF\0\x01\x01\0\0\x01\0\x01\0\0", 14);
+    jpeg_segment (jpeg, 0xe0, body);
+    
+    g_byte_array_set_size (body, 0);
+    g_byte_array_append (body, (const guint8 *)"Exif\0\0", 6);
+    put_exif (body, rand, NULL);
+    jpeg_segment (jpeg, 0xe1, body);
+    
+    if (with_xmp) {
+        gchar *xmp = xmp_packet (rand, g_rand_int_range (rand, 0, 4096));
+        
+        g_byte_array_set_size (body, 0);
+        g_byte_array_append (body, (const guint8 *)"http://ns.adobe.com/xap/1.0/", 29);
+        put_string (body, xmp);
+        jpeg_segment (jpeg, 0xe1, body);
+        g_free (xmp);
+    }
+    
+    g_byte_array_set_size (body, 0);
+    g_byte_array_append (body, (const guint8 *)"\x01\x01\0\0\x3f", 6);
+    jpeg_segment (jpeg, 0xda, body);
+    put_filler (jpeg, rand, g_rand_int_range (rand, 8 * 1024, 256 * 1024));
+    g_byte_array_append (jpeg, (const guint8 *)"\xff\xd9", 2);
+    
+    g_byte_array_unref (body);
+    
+    return jpeg;
+}
+
+static void
+generate_jpegs (BenchCorpus *corpus, const gchar *dir, guint count)
+{
+    guint i;
+    
+    for (i = 0; i < count; i++) {
+        GByteArray *jpeg = jpeg_new (corpus->rand, i % 2 == 0);
+        gchar *path = g_strdup_printf ("%s/IMG_%04u.jpg", dir, i);
+        
+        if (write_file (corpus, path, jpeg)) {
+            g_ptr_array_add (corpus->files, path);
+        } else {
+            g_free (path);
+        }
+        g_byte_array_unref (jpeg);
+    }
+}
+
+/* WebP */
+
+static void
+riff_chunk (GByteArray *riff, const gchar *type, const guint8 *data, gsize length)
+{
+    g_byte_array_append (riff, (const guint8 *)type, 4);
+    put_le32 (riff, length);
+    g_byte_array_append (riff, data, length);
+    put_zeros (riff, length & 1);
+}
+
+/* Extended WebPs, as generators save them: image data, then EXIF with
+ * the parameters in its UserComment, then XMP on every other file */
+static void
+generate_webps (BenchCorpus *corpus, const gchar *dir, guint count)
+{
+    guint i;
+    
+    for (i = 0; i < count; i++) {
+        GByteArray *webp = g_byte_array_new ();
+        GByteArray *chunk = g_byte_array_new ();
+        gboolean with_xmp = i % 2 == 1;
+        gchar *path, *parameters;
+        guint8 flags;
+        
+        put_string (webp, "RIFF");
+        put_le32 (webp, 0);
+        put_string (webp, "WEBP");
+        
+        flags = 0x08 | (with_xmp ? 0x04 : 0);
+        g_byte_array_append (chunk, &flags, 1);
+        put_zeros (chunk, 3);
+        put_le24 (chunk, 1023);
+        put_le24 (chunk, 1023);
+        riff_chunk (webp, "VP8X", chunk->data, chunk->len);
+        
+        g_byte_array_set_size (chunk, 0);
+        put_filler (chunk, corpus->rand, g_rand_int_range (corpus->rand, 4 * 1024, 128 * 1024));
+        riff_chunk (webp, "VP8L", chunk->data, chunk->len);
+        
+        g_byte_array_set_size (chunk, 0);
+        parameters = sd_parameters (corpus->rand, 16);
+        put_exif (chunk, corpus->rand, parameters);
+        riff_chunk (webp, "EXIF", chunk->data, chunk->len);
+        g_free (parameters);
+        
+        if (with_xmp) {
+            gchar *xmp = xmp_packet (corpus->rand, 0);
+            
+            riff_chunk (webp, "XMP ", (const guint8 *)xmp, strlen (xmp));
+            g_free (xmp);
+        }
+        set_le32 (webp, 4, webp->len - 8);
+        
+        path = g_strdup_printf ("%s/gen_%05u.webp", dir, i);
+        if (write_file (corpus, path, webp)) {
+            g_ptr_array_add (corpus->files, path);
+        } else {
+            g_free (path);
+        }
+        g_byte_array_unref (chunk);
+        g_byte_array_unref (webp);
+    }
+}
+
+/* Images whose rating and keywords are in an XMP sidecar, named
+ * either "IMG.xmp" or "IMG.jpg.xmp" as different editors do */
+static void
+generate_sidecars (BenchCorpus *corpus, const gchar *dir, guint count)
+{
+    guint i;
+    
+    for (i = 0; i < count; i++) {
+        GByteArray *image, *sidecar;
+        gchar *path, *sidecar_path, *xmp;
+        
+        if (i % 3 == 2) {
+            guint side = PICK (corpus->rand, png_sides);
+            
+            image = png_begin (side);
+            png_end (image, side);
+            path = g_strdup_printf ("%s/scan_%04u.png", dir, i);
+        } else {
+            image = jpeg_new (corpus->rand, FALSE);
+            path = g_strdup_printf ("%s/DSC_%04u.jpg", dir, i);
+        }
+        
+        sidecar_path = i % 2 == 0 ?
+                       g_strdup_printf ("%s.xmp", path) :
+                       g_strdup_printf ("%.*s.xmp", (int)(strrchr (path, '.') - path), path);
+        xmp = xmp_packet (corpus->rand, 2048);
+        sidecar = g_byte_array_new ();
+        put_string (sidecar, xmp);
+        
+        if (write_file (corpus, path, image) && write_file (corpus, sidecar_path, sidecar)) {
+            g_ptr_array_add (corpus->files, path);
+        } else {
+            g_free (path);
+        }
+        
+        g_free (xmp);
+        g_free (sidecar_path);
+        g_byte_array_unref (sidecar);
+        g_byte_array_unref (image);
+    }
+}
+
+/* Plain files whose only metadata is in user.finderz.* xattrs.  The
+ * corpus goes on without them where the file system has no xattrs. */
+static void
+generate_xattr_files (BenchCorpus *corpus, const gchar *dir, guint count)
+{
+    guint i;
+    
+    for (i = 0; i < count; i++) {
+        GByteArray *data = g_byte_array_new ();
+        gchar *path, *value;
+        
+        if (i % 2 == 0) {
+            guint side = PICK (corpus->rand, png_sides);
+            
+            g_byte_array_unref (data);
+            data = png_begin (side);
+            png_end (data, side);
+            path = g_strdup_printf ("%s/tagged_%04u.png", dir, i);
+        } else {
+            put_filler (data, corpus->rand, g_rand_int_range (corpus->rand, 256, 16 * 1024));
+            path = g_strdup_printf ("%s/notes_%04u.txt", dir, i);
+        }
+        
+        if (!write_file (corpus, path, data)) {
+            g_free (path);
+            g_byte_array_unref (data);
+            continue;
+        }
+        g_ptr_array_add (corpus->files, path);
+        g_byte_array_unref (data);
+        
+        if (!corpus->xattrs) {
+            continue;
+        }
+        
+        value = g_strdup_printf ("%d", g_rand_int_range (corpus->rand, 0, 6));
+        if (setxattr (path, "user.finderz.rating", value, strlen (value), 0) != 0) {
+            corpus->xattrs = FALSE;
+        }
+        g_free (value);
+        
+        if (corpus->xattrs && i % 3 == 0) {
+            const gchar *label = PICK (corpus->rand, labels);
+            
+            setxattr (path, "user.finderz.color_label", label, strlen (label), 0);
+        }
+        if (corpus->xattrs && i % 4 == 0) {
+            value = random_prompt (corpus->rand, 8, 40);
+            setxattr (path, "user.finderz.ai.prompt", value, strlen (value), 0);
+            g_free (value);
+            setxattr (path, "user.finderz.ai.model", models[i % G_N_ELEMENTS (models)],
+                      strlen (models[i % G_N_ELEMENTS (models)]), 0);
+        }
+    }
+}
+
+/* DS_Store */
+
+typedef struct {
+    gchar *sort_key;    /* folded name, then code */
+    GByteArray *bytes;
+} DSRecord;
+
+static void
+ds_record_free (gpointer data)
+{
+    DSRecord *record = data;
+    
+    g_free (record->sort_key);
+    g_byte_array_unref (record->bytes);
+    g_free (record);
+}
+
+static gint
+ds_record_compare (gconstpointer a, gconstpointer b)
+{
+    const DSRecord *record_a = *(DSRecord * const *)a;
+    const DSRecord *record_b = *(DSRecord * const *)b;
+    
+    return strcmp (record_a->sort_key, record_b->sort_key);
+}
+
+/* A record of @type with its value; names are ASCII so sort keys can
+ * be folded the way Finder does with g_ascii_strdown() */
+static DSRecord*
+ds_record_new (const gchar *name, const gchar *code, const gchar *type,
+               const guint8 *value, gsize length)
+{
+    DSRecord *record = g_new0 (DSRecord, 1);
+    gchar *folded = g_ascii_strdown (name, -1);
+    const gchar *p;
+    
+    /* A separator below every name character keeps "a" before "a.b" */
+    record->sort_key = g_strconcat (folded, "\x01", code, NULL);
+    g_free (folded);
+    
+    record->bytes = g_byte_array_new ();
+    put_be32 (record->bytes, strlen (name));
+    for (p = name; *p; p++) {
+        put_be16 (record->bytes, (guchar)*p);
+    }
+    put_string (record->bytes, code);
+    put_string (record->bytes, type);
+    
+    if (strcmp (type, "blob") == 0) {
+        put_be32 (record->bytes, length);
+    } else if (strcmp (type, "ustr") == 0) {
+        put_be32 (record->bytes, length / 2);
+    }
+    g_byte_array_append (record->bytes, value, length);
+    
+    return record;
+}
+
+static DSRecord*
+ds_record_new_ustr (const gchar *name, const gchar *code, const gchar *text)
+{
+    GByteArray *value = g_byte_array_new ();
+    DSRecord *record;
+    const gchar *p;
+    
+    for (p = text; *p; p++) {
+        put_be16 (value, (guchar)*p);
+    }
+    record = ds_record_new (name, code, "ustr", value->data, value->len);
+    g_byte_array_unref (value);
+    
+    return record;
+}
+
+typedef struct {
+    GPtrArray *blocks;      /* GByteArray per block, 0 and 1 reserved */
+    guint records_per_leaf;
+    guint records_per_node;
+    guint levels;
+} DSTreeWriter;
+
+/* Records a subtree of @levels levels can hold */
+static guint64
+ds_tree_capacity (DSTreeWriter *writer, guint levels)
+{
+    if (levels <= 1) {
+        return writer->records_per_leaf;
+    }
+    return (writer->records_per_node + 1) * ds_tree_capacity (writer, levels - 1) +
+           writer->records_per_node;
+}
+
+/* Write records [@first, @first + @count) as a subtree of @levels
+ * levels, children split evenly with one record between each */
+static guint32
+ds_tree_write (DSTreeWriter *writer, GPtrArray *records,
+               guint first, guint count, guint levels)
+{
+    GByteArray *node = g_byte_array_new ();
+    guint32 block = writer->blocks->len;
+    guint i;
+    
+    g_ptr_array_add (writer->blocks, node);
+    
+    if (levels <= 1) {
+        put_be32 (node, 0);
+        put_be32 (node, count);
+        for (i = 0; i < count; i++) {
+            DSRecord *record = g_ptr_array_index (records, first + i);
+            
+            g_byte_array_append (node, record->bytes->data, record->bytes->len);
+        }
+    } else {
+        guint64 child_capacity = ds_tree_capacity (writer, levels - 1);
+        guint children = (count + child_capacity) / (child_capacity + 1);
+        guint per_child, extra, offset = first;
+        
+        children = MAX (children, 2);
+        per_child = (count - (children - 1)) / children;
+        extra = (count - (children - 1)) % children;
+        
+        put_be32 (node, 0);
+        put_be32 (node, children - 1);
+        for (i = 0; i < children; i++) {
+            guint child_count = per_child + (i < extra ? 1 : 0);
+            guint32 child = ds_tree_write (writer, records, offset, child_count, levels - 1);
+            
+            offset += child_count;
+            if (i == children - 1) {
+                set_be32 (node, 0, child);
+            } else {
+                DSRecord *separator = g_ptr_array_index (records, offset++);
+                
+                put_be32 (node, child);
+                g_byte_array_append (node, separator->bytes->data, separator->bytes->len);
+            }
+        }
+    }
+    
+    return block;
+}
+
+/* Lay out @records as a .DS_Store: the buddy allocator's header and
+ * root block, the DSDB tree header, then the B-tree in 4 KB pages */
+static GByteArray*
+ds_store_build (GPtrArray *records)
+{
+    DSTreeWriter writer = { 0 };
+    GByteArray *file, *root, *header;
+    gsize max_record = 0, offset;
+    guint32 root_node, root_address;
+    guint i, levels;
+    
+    g_ptr_array_sort (records, ds_record_compare);
+    for (i = 0; i < records->len; i++) {
+        max_record = MAX (max_record, ((DSRecord *)g_ptr_array_index (records, i))->bytes->len);
+    }
+    
+    writer.blocks = g_ptr_array_new_with_free_func ((GDestroyNotify)g_byte_array_unref);
+    writer.records_per_leaf = MAX ((4096 - 8) / max_record, 1);
+    writer.records_per_node = MAX ((4096 - 8) / (max_record + 4), 2);
+    g_ptr_array_add (writer.blocks, NULL);
+    g_ptr_array_add (writer.blocks, NULL);
+    
+    for (levels = 1; ds_tree_capacity (&writer, levels) < records->len; levels++);
+    root_node = ds_tree_write (&writer, records, 0, records->len, levels);
+    
+    header = g_byte_array_new ();
+    put_be32 (header, root_node);
+    put_be32 (header, levels - 1);
+    put_be32 (header, records->len);
+    put_be32 (header, writer.blocks->len - 2);
+    put_be32 (header, 4096);
+    g_ptr_array_index (writer.blocks, 1) = header;
+    
+    /* Allocator root block: block addresses, table of contents, and
+     * empty free lists */
+    root = g_byte_array_new ();
+    g_ptr_array_index (writer.blocks, 0) = root;
+    put_be32 (root, writer.blocks->len);
+    put_be32 (root, 0);
+    put_zeros (root, ((writer.blocks->len + 255) / 256) * 256 * 4);
+    put_be32 (root, 1);
+    g_byte_array_append (root, (const guint8 *)"\x04" "DSDB", 5);
+    put_be32 (root, 1);
+    put_zeros (root, 32 * 4);
+    
+    /* Blocks are placed at offsets aligned to their size, which is
+     * the smallest power of two holding them, 4 KB for tree pages */
+    offset = 4096;
+    for (i = 0; i < writer.blocks->len; i++) {
+        GByteArray *block = g_ptr_array_index (writer.blocks, i);
+        guint shift = i >= 2 ? 12 : 5;
+        
+        while (((gsize)1 << shift) < block->len) {
+            shift++;
+        }
+        offset = (offset + ((gsize)1 << shift) - 1) & ~(((gsize)1 << shift) - 1);
+        set_be32 (root, 8 + i * 4, offset | shift);
+        offset += (gsize)1 << shift;
+    }
+    
+    file = g_byte_array_new ();
+    put_be32 (file, 1);
+    put_string (file, "Bud1");
+    root_address = 0;
+    for (i = 0; i < writer.blocks->len; i++) {
+        GByteArray *block = g_ptr_array_index (writer.blocks, i);
+        guint32 address = (root->data[8 + i * 4] << 24) | (root->data[9 + i * 4] << 16) |
+                          (root->data[10 + i * 4] << 8) | root->data[11 + i * 4];
+        gsize block_offset = 4 + (address & ~0x1fU);
+        
+        if (i == 0) {
+            root_address = address & ~0x1fU;
+        }
+        if (file->len < block_offset + ((gsize)1 << (address & 0x1f))) {
+            put_zeros (file, block_offset + ((gsize)1 << (address & 0x1f)) - file->len);
+        }
+        memcpy (file->data + block_offset, block->data, block->len);
+    }
+    set_be32 (file, 8, root_address);
+    set_be32 (file, 12, root->len);
+    set_be32 (file, 16, root_address);
+    
+    g_ptr_array_unref (writer.blocks);
+    
+    return file;
+}
+
+/* Folders of @n_files files each, as Finder leaves them: icon
+ * positions for every file, comments and sizes for some, and the
+ * folder's own window and view settings */
+static void
+generate_ds_stores (BenchCorpus *corpus, const gchar *dir)
+{
+    guint size, copy;
+    
+    for (size = 0; size < G_N_ELEMENTS (ds_store_sizes); size++) {
+        for (copy = 0; copy < BENCH_DS_STORE_COPIES; copy++) {
+            GPtrArray *records = g_ptr_array_new_with_free_func (ds_record_free);
+            GPtrArray *names = g_ptr_array_new_with_free_func (g_free);
+            guint n_files = ds_store_sizes[size];
+            GByteArray *value = g_byte_array_new (), *file;
+            gchar *folder, *path;
+            guint i;
+            
+            put_be16 (value, 80);       /* top, left, bottom, right */
+            put_be16 (value, 120);
+            put_be16 (value, 780);
+            put_be16 (value, 1320);
+            put_string (value, "icnv");
+            put_zeros (value, 4);
+            g_ptr_array_add (records, ds_record_new (".", "fwi0", "blob", value->data, value->len));
+            g_ptr_array_add (records, ds_record_new (".", "vmod", "type",
+                                                     (const guint8 *)"Nlsv", 4));
+            
+            for (i = 0; i < n_files; i++) {
+                gchar *name = g_strdup_printf (i % 2 ? "Render %05u.png" : "shot-%05u.JPG", i);
+                
+                g_byte_array_set_size (value, 0);
+                put_be32 (value, g_rand_int_range (corpus->rand, 0, 2000));
+                put_be32 (value, g_rand_int_range (corpus->rand, 0, 2000));
+                g_byte_array_append (value, (const guint8 *)"\xff\xff\xff\xff\xff\xff\0\0", 8);
+                g_ptr_array_add (records, ds_record_new (name, "Iloc", "blob",
+                                                         value->data, value->len));
+                
+                if (i % 3 == 0) {
+                    gchar *comment = random_prompt (corpus->rand, 2, 12);
+                    
+                    g_ptr_array_add (records, ds_record_new_ustr (name, "cmmt", comment));
+                    g_free (comment);
+                }
+                if (i % 4 == 0) {
+                    g_byte_array_set_size (value, 0);
+                    put_be32 (value, 0);
+                    put_be32 (value, g_rand_int (corpus->rand));
+                    g_ptr_array_add (records, ds_record_new (name, "ph1S", "comp",
+                                                             value->data, value->len));
+                    g_ptr_array_add (records, ds_record_new (name, "modD", "dutc",
+                                                             value->data, value->len));
+                }
+                
+                if (i % MAX (n_files / BENCH_DS_STORE_LOOKUPS, 1) == 0) {
+                    g_ptr_array_add (names, name);
+                } else {
+                    g_free (name);
+                }
+            }
+            
+            file = ds_store_build (records);
+            folder = g_strdup_printf ("%s/folder-%u-%u", dir, n_files, copy);
+            path = g_build_filename (folder, ".DS_Store", NULL);
+            
+            if (g_mkdir_with_parents (folder, 0755) == 0 && write_file (corpus, path, file)) {
+                g_ptr_array_add (corpus->ds_stores, path);
+                g_ptr_array_add (corpus->ds_store_names, g_ptr_array_ref (names));
+            } else {
+                g_free (path);
+            }
+            
+            g_free (folder);
+            g_byte_array_unref (file);
+            g_byte_array_unref (value);
+            g_ptr_array_unref (names);
+            g_ptr_array_unref (records);
+        }
+    }
+}
+
+static gchar*
+make_subdir (const gchar *root, const gchar *name)
+{
+    gchar *dir = g_build_filename (root, name, NULL);
+    
+    g_mkdir_with_parents (dir, 0755);
+    
+    return dir;
+}
+
+static void
+corpus_generate (BenchCorpus *corpus, guint n_files)
+{
+    guint n_png = n_files * 2 / 5;
+    guint n_jpeg = n_files / 5;
+    guint n_webp = n_files * 3 / 20;
+    guint n_sidecar = n_files / 10;
+    guint n_xattr = n_files - n_png - n_jpeg - n_webp - n_sidecar;
+    gchar *dir;
+    
+    dir = make_subdir (corpus->root, "png");
+    generate_pngs (corpus, dir, n_png);
+    g_free (dir);
+    
+    dir = make_subdir (corpus->root, "jpeg");
+    generate_jpegs (corpus, dir, n_jpeg);
+    g_free (dir);
+    
+    dir = make_subdir (corpus->root, "webp");
+    generate_webps (corpus, dir, n_webp);
+    g_free (dir);
+    
+    dir = make_subdir (corpus->root, "sidecar");
+    generate_sidecars (corpus, dir, n_sidecar);
+    g_free (dir);
+    
+    dir = make_subdir (corpus->root, "xattr");
+    generate_xattr_files (corpus, dir, n_xattr);
+    g_free (dir);
+    
+    dir = make_subdir (corpus->root, "ds_store");
+    generate_ds_stores (corpus, dir);
+    g_free (dir);
+}
+
+static void
+remove_tree (const gchar *path)
+{
+    GDir *dir = g_dir_open (path, 0, NULL);
+    const gchar *name;
+    
+    if (dir) {
+        while ((name = g_dir_read_name (dir))) {
+            gchar *child = g_build_filename (path, name, NULL);
+            
+            remove_tree (child);
+            g_free (child);
+        }
+        g_dir_close (dir);
+    }
+    g_remove (path);
+}
+
+/* Counters */
+
+typedef struct {
+    gint64 time;
+    gint64 bytes_read;      /* -1 when /proc/self/io can't be read */
+    gint64 syscalls;
+    gint64 page_faults;
+    gint64 allocations;     /* -1 when not counted */
+} BenchCounters;
+
+static gint64
+proc_field (const gchar *text, const gchar *name)
+{
+    const gchar *p = text ? strstr (text, name) : NULL;
+    
+    return p ? g_ascii_strtoll (p + strlen (name), NULL, 10) : -1;
+}
+
+/* Read a small /proc file into @buffer without allocating */
+static const gchar*
+read_proc_file (const gchar *path, gchar *buffer, gsize size)
+{
+    gssize length;
+    int fd;
+    
+    fd = open (path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    length = read (fd, buffer, size - 1);
+    close (fd);
+    if (length <= 0) {
+        return NULL;
+    }
+    buffer[length] = '\0';
+    
+    return buffer;
+}
+
+static void
+bench_counters_read (BenchCounters *counters)
+{
+    gchar buffer[2048];
+    const gchar *io;
+    struct rusage usage;
+    
+    io = read_proc_file ("/proc/self/io", buffer, sizeof (buffer));
+    counters->bytes_read = proc_field (io, "rchar: ");
+    counters->syscalls = io ? proc_field (io, "syscr: ") + proc_field (io, "syscw: ") : -1;
+    
+    getrusage (RUSAGE_SELF, &usage);
+    counters->page_faults = usage.ru_minflt + usage.ru_majflt;
+    
+#ifdef BENCH_COUNT_ALLOCATIONS
+    counters->allocations = __atomic_load_n (&allocations, __ATOMIC_RELAXED);
+#else
+    counters->allocations = -1;
+#endif
+    
+    counters->time = g_get_monotonic_time ();
+}
+
+/* Start a phase's peak RSS from the current RSS; Linux 4.0 and later */
+static void
+bench_reset_peak_rss (void)
+{
+    int fd = open ("/proc/self/clear_refs", O_WRONLY);
+    
+    if (fd >= 0) {
+        if (write (fd, "5", 1) != 1) {
+            g_debug ("FINDERZ: Peak RSS cannot be reset: %s", g_strerror (errno));
+        }
+        close (fd);
+    }
+}
+
+static gint64
+bench_peak_rss_kb (void)
+{
+    gchar buffer[4096];
+    struct rusage usage;
+    gint64 peak;
+    
+    peak = proc_field (read_proc_file ("/proc/self/status", buffer, sizeof (buffer)), "VmHWM:");
+    if (peak < 0) {
+        getrusage (RUSAGE_SELF, &usage);
+        peak = usage.ru_maxrss;
+    }
+    
+    return peak;
+}
+
+static void
+append_rate (GString *json, const gchar *name, gint64 before, gint64 after, guint files)
+{
+    if (before < 0 || after < 0 || files == 0) {
+        g_string_append_printf (json, ",\"%s\":null", name);
+    } else {
+        g_string_append_printf (json, ",\"%s\":%.1f", name, (gdouble)(after - before) / files);
+    }
+}
+
+/* Print one phase as a line of JSON; @extra, if not NULL, is appended
+ * as further members */
+static void
+bench_report (const gchar *phase, guint files,
+              const BenchCounters *before, const BenchCounters *after,
+              const gchar *extra)
+{
+    GString *json = g_string_new (NULL);
+    gdouble seconds = (after->time - before->time) / (gdouble)G_USEC_PER_SEC;
+    
+    g_string_append_printf (json, "{\"phase\":\"%s\",\"files\":%u,\"seconds\":%.6f,"
+                            "\"files_per_sec\":%.1f",
+                            phase, files, seconds, seconds > 0 ? files / seconds : 0.0);
+    append_rate (json, "bytes_read_per_file", before->bytes_read, after->bytes_read, files);
+    append_rate (json, "syscalls_per_file", before->syscalls, after->syscalls, files);
+    append_rate (json, "page_faults_per_file", before->page_faults, after->page_faults, files);
+    if (before->allocations < 0) {
+        g_string_append (json, ",\"allocations\":null");
+    } else {
+        g_string_append_printf (json, ",\"allocations\":%" G_GINT64_FORMAT,
+                                after->allocations - before->allocations);
+    }
+    append_rate (json, "allocations_per_file", before->allocations, after->allocations, files);
+    g_string_append_printf (json, ",\"peak_rss_kb\":%" G_GINT64_FORMAT, bench_peak_rss_kb ());
+    if (extra) {
+        g_string_append_printf (json, ",%s", extra);
+    }
+    g_string_append (json, "}\n");
+    
+    g_print ("%s", json->str);
+    g_string_free (json, TRUE);
+}
+
+/* Phases */
+
+/* Extract every file as the attribute worker does: embedded metadata,
+ * then sidecars.  Returns the records, or NULL when @records is FALSE. */
+static GPtrArray*
+bench_extract_once (BenchCorpus *corpus, gboolean records, guint *failures)
+{
+    GPtrArray *result = records ?
+                        g_ptr_array_new_with_free_func ((GDestroyNotify)finderz_universal_metadata_unref) :
+                        NULL;
+    guint i;
+    
+    for (i = 0; i < corpus->files->len; i++) {
+        const gchar *path = g_ptr_array_index (corpus->files, i);
+        FinderzUniversalMetadata *metadata;
+        GError *error = NULL;
+        
+        metadata = finderz_extract_all_metadata (path, &error);
+        if (!metadata) {
+            g_clear_error (&error);
+            (*failures)++;
+            continue;
+        }
+        finderz_apply_sidecar_metadata (metadata, path);
+        
+        if (result) {
+            g_ptr_array_add (result, metadata);
+        } else {
+            finderz_universal_metadata_unref (metadata);
+        }
+    }
+    
+    return result;
+}
+
+/* The first pass is not reported: it brings the corpus to the state
+ * browsing leaves it in, with the page cache warm.  The records of the
+ * last pass are returned. */
+static GPtrArray*
+bench_extract (BenchCorpus *corpus, guint iterations)
+{
+    BenchCounters before, after;
+    GPtrArray *records = NULL;
+    guint failures = 0, fields = 0, i;
+    gchar *extra;
+    
+    bench_extract_once (corpus, FALSE, &failures);
+    failures = 0;
+    
+    bench_reset_peak_rss ();
+    bench_counters_read (&before);
+    for (i = 0; i < iterations; i++) {
+        if (records) {
+            g_ptr_array_unref (records);
+        }
+        records = bench_extract_once (corpus, TRUE, &failures);
+    }
+    bench_counters_read (&after);
+    
+    for (i = 0; i < records->len; i++) {
+        fields += ((FinderzUniversalMetadata *)g_ptr_array_index (records, i))->n_values;
+    }
+    extra = g_strdup_printf ("\"iterations\":%u,\"failures\":%u,\"fields_per_file\":%.2f",
+                             iterations, failures,
+                             records->len ? (gdouble)fields / records->len : 0.0);
+    bench_report ("extract", corpus->files->len * iterations, &before, &after, extra);
+    g_free (extra);
+    
+    return records;
+}
+
+static void
+bench_ds_store (BenchCorpus *corpus, guint iterations, gboolean lazy)
+{
+    FinderzDSStore *ds_store = finderz_ds_store_new ();
+    BenchCounters before, after;
+    guint failures = 0, records = 0, i, j;
+    gchar *extra;
+    
+    bench_reset_peak_rss ();
+    bench_counters_read (&before);
+    
+    for (i = 0; i < iterations; i++) {
+        for (j = 0; j < corpus->ds_stores->len; j++) {
+            FinderzDSStoreData *data;
+            GError *error = NULL;
+            
+            data = finderz_ds_store_parse_file_full (ds_store,
+                                                     g_ptr_array_index (corpus->ds_stores, j),
+                                                     lazy ? FINDERZ_DS_STORE_PARSE_LAZY :
+                                                            FINDERZ_DS_STORE_PARSE_NONE,
+                                                     &error);
+            if (!data) {
+                g_clear_error (&error);
+                failures++;
+                continue;
+            }
+            
+            if (lazy) {
+                GPtrArray *names = g_ptr_array_index (corpus->ds_store_names, j);
+                guint k;
+                
+                /* The names a view scrolled into sight would ask for */
+                for (k = 0; k < names->len; k++) {
+                    const gchar *name = g_ptr_array_index (names, k);
+                    
+                    records += finderz_ds_store_get_icon_position (data, name) != NULL;
+                    records += finderz_ds_store_get_comment (data, name) != NULL;
+                }
+            } else {
+                records += g_hash_table_size (data->icon_locations) +
+                           g_hash_table_size (data->comments);
+            }
+            finderz_ds_store_data_unref (data);
+        }
+    }
+    
+    bench_counters_read (&after);
+    
+    extra = g_strdup_printf ("\"iterations\":%u,\"failures\":%u,\"records_per_file\":%.1f",
+                             iterations, failures,
+                             corpus->ds_stores->len ?
+                             (gdouble)records / (corpus->ds_stores->len * iterations) : 0.0);
+    bench_report (lazy ? "ds_store_lazy" : "ds_store", corpus->ds_stores->len * iterations,
+                  &before, &after, extra);
+    g_free (extra);
+    
+    g_object_unref (ds_store);
+}
+
+typedef struct {
+    FinderzFieldId field_id;
+    guint64 comparisons;
+} SortContext;
+
+static gint
+compare_by_field (gconstpointer a, gconstpointer b, gpointer user_data)
+{
+    FinderzUniversalMetadata *metadata1 = *(FinderzUniversalMetadata * const *)a;
+    FinderzUniversalMetadata *metadata2 = *(FinderzUniversalMetadata * const *)b;
+    SortContext *context = user_data;
+    
+    context->comparisons++;
+    
+    return finderz_metadata_value_compare (finderz_metadata_get_value (metadata1, context->field_id),
+                                           finderz_metadata_get_value (metadata2, context->field_id));
+}
+
+/* Sort the extracted records by fields of each kind of sort key, as a
+ * list view sorted by a metadata column does */
+static void
+bench_sort (GPtrArray *records, guint iterations)
+{
+    static const FinderzFieldId fields[] = {
+        FINDERZ_FIELD_AI_PROMPT,        /* collation keys */
+        FINDERZ_FIELD_AI_MODEL,
+        FINDERZ_FIELD_EXIF_CAMERA,
+        FINDERZ_FIELD_AI_STEPS,         /* integers */
+        FINDERZ_FIELD_RATING,
+        FINDERZ_FIELD_EXIF_APERTURE,    /* reals */
+        FINDERZ_FIELD_EXIF_DATE_TAKEN   /* dates */
+    };
+    SortContext context = { 0 };
+    BenchCounters before, after;
+    GPtrArray *sorted;
+    guint i, f, j;
+    gchar *extra;
+    
+    sorted = g_ptr_array_sized_new (records->len);
+    
+    bench_reset_peak_rss ();
+    bench_counters_read (&before);
+    
+    for (i = 0; i < iterations; i++) {
+        for (f = 0; f < G_N_ELEMENTS (fields); f++) {
+            g_ptr_array_set_size (sorted, 0);
+            for (j = 0; j < records->len; j++) {
+                g_ptr_array_add (sorted, g_ptr_array_index (records, j));
+            }
+            context.field_id = fields[f];
+            g_ptr_array_sort_with_data (sorted, compare_by_field, &context);
+        }
+    }
+    
+    bench_counters_read (&after);
+    
+    extra = g_strdup_printf ("\"iterations\":%u,\"fields\":%u,\"comparisons\":%" G_GUINT64_FORMAT,
+                             iterations, (guint)G_N_ELEMENTS (fields), context.comparisons);
+    bench_report ("sort", records->len * G_N_ELEMENTS (fields) * iterations,
+                  &before, &after, extra);
+    g_free (extra);
+    
+    g_ptr_array_unref (sorted);
+}
+
+/* Rows a filter runs over, as many as a large folder has; the
+ * extracted records are repeated to fill them */
+#define BENCH_FILTER_ROWS 100000
+
+/* Run filters over the extracted records, as a view does on every
+ * change of the filter text */
+static void
+bench_filter (GPtrArray *records, guint iterations)
+{
+    static const gchar *filters[] = {
+        "rating>=3",
+        "ai_model:sdxl* steps>=30 rating>=4 exif_iso<800",
+        "prompt:alley",
+        "prompt:*city*night* -keywords:draft",
+        "*.png"
+    };
+    BenchCounters before, after;
+    FinderzUniversalMetadata **rows;
+    gchar **names;
+    guint8 *matches;
+    guint64 passed = 0;
+    guint n_rows, i, f, j;
+    gchar *extra;
+    
+    if (records->len == 0) {
+        return;
+    }
+    
+    n_rows = MAX (records->len, BENCH_FILTER_ROWS);
+    rows = g_new (FinderzUniversalMetadata *, n_rows);
+    names = g_new0 (gchar *, n_rows + 1);
+    matches = g_new (guint8, n_rows);
+    for (j = 0; j < n_rows; j++) {
+        rows[j] = g_ptr_array_index (records, j % records->len);
+        names[j] = g_path_get_basename (rows[j]->file_path);
+    }
+    
+    bench_reset_peak_rss ();
+    bench_counters_read (&before);
+    
+    for (i = 0; i < iterations; i++) {
+        for (f = 0; f < G_N_ELEMENTS (filters); f++) {
+            FinderzFilter *filter = finderz_filter_new (filters[f], NULL);
+            
+            finderz_filter_run (filter, (const gchar * const *)names, rows, n_rows, matches);
+            for (j = 0; j < n_rows; j++) {
+                passed += matches[j];
+            }
+            finderz_filter_free (filter);
+        }
+    }
+    
+    bench_counters_read (&after);
+    
+    extra = g_strdup_printf ("\"iterations\":%u,\"filters\":%u,\"rows\":%u,\"passed\":%.3f",
+                             iterations, (guint)G_N_ELEMENTS (filters), n_rows,
+                             (gdouble)passed / ((guint64)n_rows * G_N_ELEMENTS (filters) * iterations));
+    bench_report ("filter", n_rows * G_N_ELEMENTS (filters) * iterations,
+                  &before, &after, extra);
+    g_free (extra);
+    
+    g_strfreev (names);
+    g_free (matches);
+    g_free (rows);
+}
+
+int
+main (int argc, char *argv[])
+{
+    GOptionContext *context;
+    GError *error = NULL;
+    BenchCorpus corpus = { 0 };
+    GPtrArray *records;
+    gchar *cache;
+    
+    context = g_option_context_new ("- benchmark the Finderz metadata readers");
+    g_option_context_add_main_entries (context, options, NULL);
+    if (!g_option_context_parse (context, &argc, &argv, &error)) {
+        g_printerr ("finderz-bench: %s\n", error->message);
+        g_error_free (error);
+        g_option_context_free (context);
+        return 1;
+    }
+    g_option_context_free (context);
+    
+    if (option_files < 1 || option_iterations < 1) {
+        g_printerr ("finderz-bench: --files and --iterations must be positive\n");
+        return 1;
+    }
+    
+    if (option_corpus) {
+        corpus.root = g_strdup (option_corpus);
+        if (g_mkdir_with_parents (corpus.root, 0755) != 0) {
+            g_printerr ("finderz-bench: cannot create %s: %s\n",
+                        corpus.root, g_strerror (errno));
+            return 1;
+        }
+    } else {
+        corpus.root = g_dir_make_tmp ("finderz-bench-XXXXXX", &error);
+        if (!corpus.root) {
+            g_printerr ("finderz-bench: %s\n", error->message);
+            g_error_free (error);
+            return 1;
+        }
+    }
+    
+    /* Keep the blob store of the run with its corpus, away from the
+     * user's cache; set before anything asks for the cache directory */
+    cache = g_build_filename (corpus.root, "cache", NULL);
+    g_setenv ("XDG_CACHE_HOME", cache, TRUE);
+    g_free (cache);
+    
+    crc_table_init ();
+    finderz_metadata_schema_init ();
+    
+    corpus.rand = g_rand_new_with_seed (option_seed);
+    corpus.files = g_ptr_array_new_with_free_func (g_free);
+    corpus.ds_stores = g_ptr_array_new_with_free_func (g_free);
+    corpus.ds_store_names = g_ptr_array_new_with_free_func ((GDestroyNotify)g_ptr_array_unref);
+    corpus.xattrs = TRUE;
+    corpus_generate (&corpus, option_files);
+    
+    g_print ("{\"corpus\":\"%s\",\"seed\":%d,\"files\":%u,\"ds_stores\":%u,"
+             "\"bytes\":%" G_GUINT64_FORMAT ",\"xattrs\":%s,\"allocations_counted\":%s}\n",
+             corpus.root, option_seed, corpus.files->len, corpus.ds_stores->len,
+             corpus.bytes, corpus.xattrs ? "true" : "false",
+#ifdef BENCH_COUNT_ALLOCATIONS
+             "true"
+#else
+             "false"
+#endif
+             );
+    
+    records = bench_extract (&corpus, option_iterations);
+    bench_ds_store (&corpus, option_iterations, FALSE);
+    bench_ds_store (&corpus, option_iterations, TRUE);
+    bench_sort (records, option_iterations);
+    bench_filter (records, option_iterations);
+    
+    g_ptr_array_unref (records);
+    g_ptr_array_unref (corpus.files);
+    g_ptr_array_unref (corpus.ds_stores);
+    g_ptr_array_unref (corpus.ds_store_names);
+    g_rand_free (corpus.rand);
+    
+    if (!option_corpus) {
+        remove_tree (corpus.root);
+    }
+    g_free (corpus.root);
+    
+    return 0;
+}
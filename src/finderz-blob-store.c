@@ -0,0 +1,251 @@
+/* finderz-blob-store.c
+ *
+ * Content-addressed store for large metadata values
+ *
+ * Blobs such as ComfyUI workflows are repeated across every image a
+ * graph produced, so records keep only the blob's SHA-256 and the blob
+ * itself is written once to $XDG_CACHE_HOME/finderz/blobs, in a
+ * subdirectory named after the first two hex digits of the key.
+ *
+ * The store is a cache: once it outgrows its budget the blobs written
+ * or asked to be written longest ago are deleted, and their keys then
+ * find nothing.
+ */
+
+#include "finderz-blob-store.h"
+#include <glib/gstdio.h>
+#include <errno.h>
+#include <string.h>
+
+/* Larger values are not worth keeping, nor is a store past the budget */
+#define BLOB_MAX_SIZE (4 * 1024 * 1024)
+#define BLOB_STORE_BUDGET ((gint64)256 * 1024 * 1024)
+
+static gchar *blob_dir = NULL;
+/* Keys known to be on disk, so each is checked at most once */
+static GHashTable *stored_keys = NULL;
+/* Bytes on disk, -1 until the store was first measured */
+static gint64 store_bytes = -1;
+static GMutex blob_mutex;
+
+typedef struct {
+    gchar *path;
+    gchar *key;
+    gint64 size;
+    gint64 mtime;
+} BlobFile;
+
+/* Called with blob_mutex held */
+static void
+blob_store_init (void)
+{
+    if (!blob_dir) {
+        blob_dir = g_build_filename (g_get_user_cache_dir (), "finderz", "blobs", NULL);
+        stored_keys = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    }
+}
+
+static gboolean
+is_valid_key (const gchar *key)
+{
+    gsize i;
+    
+    for (i = 0; key[i]; i++) {
+        if (!g_ascii_isxdigit (key[i])) {
+            return FALSE;
+        }
+    }
+    
+    return i == 64;
+}
+
+static gchar*
+blob_path (const gchar *key)
+{
+    gchar prefix[3] = { key[0], key[1], '\0' };
+    
+    return g_build_filename (blob_dir, prefix, key + 2, NULL);
+}
+
+static void
+blob_file_free (BlobFile *file)
+{
+    g_free (file->path);
+    g_free (file->key);
+    g_free (file);
+}
+
+static gint
+blob_file_older_compare (gconstpointer a, gconstpointer b)
+{
+    const BlobFile *file1 = *(const BlobFile **)a;
+    const BlobFile *file2 = *(const BlobFile **)b;
+    
+    return (file1->mtime > file2->mtime) - (file1->mtime < file2->mtime);
+}
+
+/* Every blob on disk, adding their sizes to @total */
+static GPtrArray*
+list_blobs (gint64 *total)
+{
+    GPtrArray *files;
+    const gchar *prefix, *name;
+    GDir *dir, *subdir;
+    
+    files = g_ptr_array_new_with_free_func ((GDestroyNotify)blob_file_free);
+    *total = 0;
+    
+    dir = g_dir_open (blob_dir, 0, NULL);
+    if (!dir) {
+        return files;
+    }
+    
+    while ((prefix = g_dir_read_name (dir)) != NULL) {
+        gchar *subdir_path = g_build_filename (blob_dir, prefix, NULL);
+        
+        subdir = strlen (prefix) == 2 ? g_dir_open (subdir_path, 0, NULL) : NULL;
+        while (subdir && (name = g_dir_read_name (subdir)) != NULL) {
+            BlobFile *file;
+            GStatBuf st;
+            gchar *path;
+            
+            path = g_build_filename (subdir_path, name, NULL);
+            if (g_stat (path, &st) != 0 || !S_ISREG (st.st_mode)) {
+                g_free (path);
+                continue;
+            }
+            
+            file = g_new0 (BlobFile, 1);
+            file->path = path;
+            file->key = g_strconcat (prefix, name, NULL);
+            file->size = st.st_size;
+            file->mtime = st.st_mtime;
+            g_ptr_array_add (files, file);
+            *total += st.st_size;
+        }
+        if (subdir) {
+            g_dir_close (subdir);
+        }
+        g_free (subdir_path);
+    }
+    g_dir_close (dir);
+    
+    return files;
+}
+
+/* Called with blob_mutex held after @added bytes were written.  The
+ * first call measures the store; once it is over budget the oldest
+ * blobs go until it is back to three quarters of it. */
+static void
+blob_store_account (gint64 added)
+{
+    GPtrArray *files;
+    gint64 total;
+    guint i;
+    
+    if (store_bytes >= 0) {
+        store_bytes += added;
+        if (store_bytes <= BLOB_STORE_BUDGET) {
+            return;
+        }
+    }
+    
+    files = list_blobs (&total);
+    store_bytes = total;
+    
+    if (store_bytes > BLOB_STORE_BUDGET) {
+        g_ptr_array_sort (files, blob_file_older_compare);
+        for (i = 0; i < files->len && store_bytes > BLOB_STORE_BUDGET / 4 * 3; i++) {
+            BlobFile *file = g_ptr_array_index (files, i);
+            
+            if (g_unlink (file->path) == 0) {
+                g_hash_table_remove (stored_keys, file->key);
+                store_bytes -= file->size;
+            }
+        }
+        g_debug ("FINDERZ: Trimmed blob store to %" G_GINT64_FORMAT " bytes", store_bytes);
+    }
+    
+    g_ptr_array_free (files, TRUE);
+}
+
+gchar*
+finderz_blob_store_put (const gchar *data, gsize length)
+{
+    gchar *key, *path, *directory;
+    gboolean known;
+    GError *error = NULL;
+    
+    g_return_val_if_fail (data != NULL, NULL);
+    
+    if (length > BLOB_MAX_SIZE) {
+        return NULL;
+    }
+    
+    key = g_compute_checksum_for_data (G_CHECKSUM_SHA256, (const guchar *)data, length);
+    
+    g_mutex_lock (&blob_mutex);
+    blob_store_init ();
+    known = g_hash_table_contains (stored_keys, key);
+    g_mutex_unlock (&blob_mutex);
+    
+    if (known) {
+        return key;
+    }
+    
+    path = blob_path (key);
+    if (g_file_test (path, G_FILE_TEST_EXISTS)) {
+        /* Used again, so not among the first to be trimmed */
+        g_utime (path, NULL);
+        length = 0;
+    } else {
+        directory = g_path_get_dirname (path);
+        
+        /* Written whole to a temporary file and renamed, so a reader
+         * never sees a partial blob under its key */
+        if (g_mkdir_with_parents (directory, 0700) != 0 ||
+            !g_file_set_contents (path, data, length, &error)) {
+            g_debug ("FINDERZ: Cannot store blob %s: %s", key,
+                     error ? error->message : g_strerror (errno));
+            g_clear_error (&error);
+            g_free (directory);
+            g_free (path);
+            return key;
+        }
+        g_free (directory);
+    }
+    g_free (path);
+    
+    g_mutex_lock (&blob_mutex);
+    g_hash_table_add (stored_keys, g_strdup (key));
+    blob_store_account (length);
+    g_mutex_unlock (&blob_mutex);
+    
+    return key;
+}
+
+GBytes*
+finderz_blob_store_get (const gchar *key)
+{
+    gchar *path, *contents;
+    gsize length;
+    
+    g_return_val_if_fail (key != NULL, NULL);
+    
+    if (!is_valid_key (key)) {
+        return NULL;
+    }
+    
+    g_mutex_lock (&blob_mutex);
+    blob_store_init ();
+    g_mutex_unlock (&blob_mutex);
+    
+    path = blob_path (key);
+    if (!g_file_get_contents (path, &contents, &length, NULL)) {
+        g_free (path);
+        return NULL;
+    }
+    g_free (path);
+    
+    return g_bytes_new_take (contents, length);
+}
@@ -0,0 +1,25 @@
+/* finderz-blob-store.h
+ *
+ * Content-addressed store for large metadata values
+ * Keeps one copy of a blob however many files carry it
+ */
+
+#ifndef FINDERZ_BLOB_STORE_H
+#define FINDERZ_BLOB_STORE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Store @data once under the SHA-256 of its contents and return that
+ * key, in hex; the key is returned even if the blob cannot be written.
+ * Blobs over a few MB are not stored and get no key (NULL). */
+gchar* finderz_blob_store_put (const gchar *data, gsize length);
+
+/* The blob stored under @key, or NULL if there is none, which includes
+ * blobs trimmed from the store since */
+GBytes* finderz_blob_store_get (const gchar *key);
+
+G_END_DECLS
+
+#endif /* FINDERZ_BLOB_STORE_H */
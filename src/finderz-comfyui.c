@@ -0,0 +1,866 @@
+/* finderz-comfyui.c
+ *
+ * Generation settings from ComfyUI graphs
+ *
+ * ComfyUI saves two JSON graphs in each PNG: "prompt", the graph as it
+ * ran, keyed by node id with every node's inputs, and "workflow", the
+ * editor's copy with layout and widget values.  Each can run to
+ * hundreds of KB and is the same across every image of a batch.
+ *
+ * The graphs are scanned in one pass without building a tree, keeping
+ * only the inputs of checkpoint, sampler, LoRA and text encoder nodes.
+ * The workflow is written once to the blob store, and records carry
+ * only its hash.  Seeds are set to 0 in the stored copy: they differ
+ * from image to image of a batch, and each record keeps its own.
+ */
+
+#include "finderz-comfyui.h"
+#include "finderz-blob-store.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Widget values read from an editor node, enough for KSamplerAdvanced */
+#define COMFY_MAX_WIDGETS 8
+
+/* Nesting deeper than any graph ComfyUI writes */
+#define COMFY_MAX_DEPTH 64
+
+typedef enum {
+    INPUT_SEED,
+    INPUT_NOISE_SEED,
+    INPUT_STEPS,
+    INPUT_CFG,
+    INPUT_SAMPLER,
+    INPUT_SCHEDULER,
+    INPUT_CHECKPOINT,
+    INPUT_UNET,
+    INPUT_LORA,
+    INPUT_LORA_STRENGTH,
+    INPUT_TEXT,
+    INPUT_POSITIVE,
+    INPUT_NEGATIVE,
+    N_INPUTS
+} ComfyInput;
+
+static const gchar *comfy_input_names[N_INPUTS] = {
+    "seed",
+    "noise_seed",
+    "steps",
+    "cfg",
+    "sampler_name",
+    "scheduler",
+    "ckpt_name",
+    "unet_name",
+    "lora_name",
+    "strength_model",
+    "text",
+    "positive",
+    "negative"
+};
+
+/* One node, with only the inputs listed above */
+typedef struct {
+    gchar *class_type;
+    gchar *inputs[N_INPUTS];    /* text of scalars, node id of links */
+} ComfyNode;
+
+/* What the graph says, gathered node by node */
+typedef struct {
+    gchar *model;
+    gchar *sampler;
+    gchar *scheduler;
+    gchar *steps;
+    gchar *cfg;
+    gchar *seed;
+    gchar *positive;            /* node ids of the first sampler's prompts */
+    gchar *negative;
+    gboolean has_sampler;
+    GHashTable *texts;          /* node id -> text encoder text */
+    GHashTable *loras;          /* display name -> strength */
+} ComfyGraph;
+
+typedef struct {
+    const gchar *p;
+    const gchar *end;
+    gboolean failed;
+} JsonScanner;
+
+/* JSON scanning.  Every function returns FALSE once the scanner has
+ * failed, so callers can simply stop. */
+
+static void
+json_skip_space (JsonScanner *s)
+{
+    while (s->p < s->end && (*s->p == ' ' || *s->p == '\t' ||
+                             *s->p == '\n' || *s->p == '\r')) {
+        s->p++;
+    }
+}
+
+static gboolean
+json_fail (JsonScanner *s)
+{
+    s->failed = TRUE;
+    s->p = s->end;
+    return FALSE;
+}
+
+/* Whether the next character is @c, which is not consumed */
+static gboolean
+json_peek (JsonScanner *s, gchar c)
+{
+    json_skip_space (s);
+    return !s->failed && s->p < s->end && *s->p == c;
+}
+
+static gboolean
+json_expect (JsonScanner *s, gchar c)
+{
+    if (!json_peek (s, c)) {
+        return json_fail (s);
+    }
+    s->p++;
+    return TRUE;
+}
+
+static gboolean
+json_read_hex4 (JsonScanner *s, gunichar *result)
+{
+    gint i;
+    
+    if (s->end - s->p < 4) {
+        return FALSE;
+    }
+    
+    *result = 0;
+    for (i = 0; i < 4; i++) {
+        gint digit = g_ascii_xdigit_value (s->p[i]);
+        
+        if (digit < 0) {
+            return FALSE;
+        }
+        *result = (*result << 4) | digit;
+    }
+    s->p += 4;
+    
+    return TRUE;
+}
+
+/* A string, decoded into @out unless it is NULL */
+static gboolean
+json_read_string (JsonScanner *s, GString *out)
+{
+    if (!json_expect (s, '"')) {
+        return FALSE;
+    }
+    
+    if (out) {
+        g_string_truncate (out, 0);
+    }
+    
+    while (s->p < s->end) {
+        const gchar *run = s->p;
+        gunichar c;
+        
+        while (s->p < s->end && *s->p != '"' && *s->p != '\\') {
+            s->p++;
+        }
+        if (out) {
+            g_string_append_len (out, run, s->p - run);
+        }
+        if (s->p >= s->end) {
+            break;
+        }
+        if (*s->p++ == '"') {
+            return TRUE;
+        }
+        
+        if (s->p >= s->end) {
+            break;
+        }
+        switch (*s->p++) {
+            case '"':  c = '"';  break;
+            case '\\': c = '\\'; break;
+            case '/':  c = '/';  break;
+            case 'b':  c = '\b'; break;
+            case 'f':  c = '\f'; break;
+            case 'n':  c = '\n'; break;
+            case 'r':  c = '\r'; break;
+            case 't':  c = '\t'; break;
+            case 'u':
+                if (!json_read_hex4 (s, &c)) {
+                    return json_fail (s);
+                }
+                /* Characters outside the BMP come as surrogate pairs */
+                if (c >= 0xd800 && c < 0xdc00) {
+                    gunichar low;
+                    
+                    if (s->end - s->p < 2 || s->p[0] != '\\' || s->p[1] != 'u') {
+                        return json_fail (s);
+                    }
+                    s->p += 2;
+                    if (!json_read_hex4 (s, &low) || low < 0xdc00 || low >= 0xe000) {
+                        return json_fail (s);
+                    }
+                    c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+                } else if (c >= 0xdc00 && c < 0xe000) {
+                    return json_fail (s);
+                }
+                break;
+            default:
+                return json_fail (s);
+        }
+        if (out && c != 0) {
+            g_string_append_unichar (out, c);
+        }
+    }
+    
+    return json_fail (s);
+}
+
+/* A number, true, false or null, copied as written */
+static gboolean
+json_read_literal (JsonScanner *s, GString *out)
+{
+    const gchar *start = s->p;
+    
+    while (s->p < s->end && (g_ascii_isalnum (*s->p) || *s->p == '-' ||
+                             *s->p == '+' || *s->p == '.')) {
+        s->p++;
+    }
+    if (s->p == start) {
+        return json_fail (s);
+    }
+    
+    if (out) {
+        g_string_truncate (out, 0);
+        g_string_append_len (out, start, s->p - start);
+    }
+    
+    return TRUE;
+}
+
+/* Skip one value of any kind, keeping count of nesting instead of
+ * recursing, so deep graphs cannot exhaust the stack */
+static gboolean
+json_skip_value (JsonScanner *s)
+{
+    guint depth = 0;
+    
+    do {
+        json_skip_space (s);
+        if (s->failed || s->p >= s->end) {
+            return json_fail (s);
+        }
+        
+        switch (*s->p) {
+            case '"':
+                if (!json_read_string (s, NULL)) {
+                    return FALSE;
+                }
+                break;
+            case '{':
+            case '[':
+                depth++;
+                s->p++;
+                break;
+            case '}':
+            case ']':
+                if (depth == 0) {
+                    return json_fail (s);
+                }
+                depth--;
+                s->p++;
+                break;
+            case ',':
+            case ':':
+                if (depth == 0) {
+                    return json_fail (s);
+                }
+                s->p++;
+                break;
+            default:
+                if (!json_read_literal (s, NULL)) {
+                    return FALSE;
+                }
+                break;
+        }
+    } while (depth > 0);
+    
+    return TRUE;
+}
+
+/* The text of a string or literal, or NULL after skipping a container */
+static gboolean
+json_read_scalar (JsonScanner *s, gchar **text)
+{
+    GString *out;
+    gboolean ok;
+    
+    *text = NULL;
+    json_skip_space (s);
+    if (s->failed || s->p >= s->end) {
+        return json_fail (s);
+    }
+    if (*s->p == '{' || *s->p == '[') {
+        return json_skip_value (s);
+    }
+    
+    out = g_string_new (NULL);
+    ok = *s->p == '"' ? json_read_string (s, out) : json_read_literal (s, out);
+    if (ok) {
+        *text = g_string_free (out, FALSE);
+    } else {
+        g_string_free (out, TRUE);
+    }
+    
+    return ok;
+}
+    
+/* Walk the members of an object whose '{' has been read, leaving each
+ * key in @key and the scanner at its value; FALSE after the last one */
+static gboolean
+json_next_member (JsonScanner *s, gboolean *first, GString *key)
+{
+    if (json_peek (s, '}')) {
+        s->p++;
+        return FALSE;
+    }
+    if (!*first && !json_expect (s, ',')) {
+        return FALSE;
+    }
+    *first = FALSE;
+    
+    return json_read_string (s, key) && json_expect (s, ':');
+}
+    
+/* Same for arrays, whose '[' has been read */
+static gboolean
+json_next_element (JsonScanner *s, gboolean *first)
+{
+    if (json_peek (s, ']')) {
+        s->p++;
+        return FALSE;
+    }
+    if (!*first && !json_expect (s, ',')) {
+        return FALSE;
+    }
+    *first = FALSE;
+    
+    return !s->failed;
+}
+    
+/* A link, ["node id", output index], as the node id */
+static gboolean
+json_read_link (JsonScanner *s, gchar **node_id)
+{
+    gboolean first = TRUE;
+    gchar *text;
+    
+    *node_id = NULL;
+    if (!json_expect (s, '[')) {
+        return FALSE;
+    }
+    
+    while (json_next_element (s, &first)) {
+        if (!json_read_scalar (s, &text)) {
+            return FALSE;
+        }
+        if (!*node_id) {
+            *node_id = text;
+        } else {
+            g_free (text);
+        }
+    }
+    
+    return !s->failed;
+}
+    
+/* Graph handling */
+    
+static ComfyInput
+comfy_find_input (const gchar *name)
+{
+    gint i;
+    
+    for (i = 0; i < N_INPUTS; i++) {
+        if (strcmp (name, comfy_input_names[i]) == 0) {
+            return i;
+        }
+    }
+    
+    return N_INPUTS;
+}
+    
+static void
+comfy_node_clear (ComfyNode *node)
+{
+    gint i;
+    
+    g_free (node->class_type);
+    for (i = 0; i < N_INPUTS; i++) {
+        g_free (node->inputs[i]);
+    }
+    memset (node, 0, sizeof (ComfyNode));
+}
+    
+static void
+take_unset (gchar **target, gchar **value)
+{
+    if (!*target && *value) {
+        *target = *value;
+        *value = NULL;
+    }
+}
+    
+/* Keep what @node contributes; values taken are cleared from it */
+static void
+comfy_graph_add_node (ComfyGraph *graph, const gchar *node_id, ComfyNode *node)
+{
+    gchar **inputs = node->inputs;
+    
+    if (!node->class_type) {
+        return;
+    }
+    
+    if (inputs[INPUT_TEXT] && strstr (node->class_type, "TextEncode")) {
+        g_hash_table_replace (graph->texts, g_strdup (node_id), inputs[INPUT_TEXT]);
+        inputs[INPUT_TEXT] = NULL;
+    }
+    
+    take_unset (&graph->model, &inputs[INPUT_CHECKPOINT]);
+    take_unset (&graph->model, &inputs[INPUT_UNET]);
+    
+    if (inputs[INPUT_LORA]) {
+        g_hash_table_replace (graph->loras, inputs[INPUT_LORA],
+                              inputs[INPUT_LORA_STRENGTH] ? inputs[INPUT_LORA_STRENGTH]
+                                                          : g_strdup ("1"));
+        inputs[INPUT_LORA] = inputs[INPUT_LORA_STRENGTH] = NULL;
+    }
+    
+    /* A second sampler is usually an upscaling pass; the first one
+     * made the image */
+    if (!graph->has_sampler && inputs[INPUT_STEPS] && strstr (node->class_type, "Sampler")) {
+        graph->has_sampler = TRUE;
+        take_unset (&graph->seed, &inputs[INPUT_SEED]);
+        take_unset (&graph->seed, &inputs[INPUT_NOISE_SEED]);
+        take_unset (&graph->steps, &inputs[INPUT_STEPS]);
+        take_unset (&graph->cfg, &inputs[INPUT_CFG]);
+        take_unset (&graph->sampler, &inputs[INPUT_SAMPLER]);
+        take_unset (&graph->scheduler, &inputs[INPUT_SCHEDULER]);
+        take_unset (&graph->positive, &inputs[INPUT_POSITIVE]);
+        take_unset (&graph->negative, &inputs[INPUT_NEGATIVE]);
+    }
+}
+    
+/* { "inputs": { ... }, "class_type": "KSampler", ... } */
+static void
+scan_prompt_node (JsonScanner *s, ComfyNode *node)
+{
+    GString *key = g_string_new (NULL);
+    gboolean first = TRUE;
+    
+    if (!json_peek (s, '{')) {
+        json_skip_value (s);
+        g_string_free (key, TRUE);
+        return;
+    }
+    s->p++;
+    
+    while (json_next_member (s, &first, key)) {
+        if (strcmp (key->str, "class_type") == 0 && !node->class_type) {
+            json_read_scalar (s, &node->class_type);
+        } else if (strcmp (key->str, "inputs") == 0 && json_peek (s, '{')) {
+            gboolean first_input = TRUE;
+            
+            s->p++;
+            while (json_next_member (s, &first_input, key)) {
+                ComfyInput input = comfy_find_input (key->str);
+                
+                if (input == N_INPUTS || node->inputs[input]) {
+                    json_skip_value (s);
+                } else if (json_peek (s, '[')) {
+                    /* Only prompts are followed through links */
+                    if (input == INPUT_POSITIVE || input == INPUT_NEGATIVE) {
+                        json_read_link (s, &node->inputs[input]);
+                    } else {
+                        json_skip_value (s);
+                    }
+                } else {
+                    json_read_scalar (s, &node->inputs[input]);
+                }
+            }
+        } else {
+            json_skip_value (s);
+        }
+    }
+    
+    g_string_free (key, TRUE);
+}
+    
+/* { "3": { node }, "4": { node }, ... } */
+static void
+scan_prompt_graph (JsonScanner *s, ComfyGraph *graph)
+{
+    GString *node_id = g_string_new (NULL);
+    gboolean first = TRUE;
+    
+    if (json_expect (s, '{')) {
+        while (json_next_member (s, &first, node_id)) {
+            ComfyNode node = { 0 };
+            
+            scan_prompt_node (s, &node);
+            comfy_graph_add_node (graph, node_id->str, &node);
+            comfy_node_clear (&node);
+        }
+    }
+    
+    g_string_free (node_id, TRUE);
+}
+    
+/* Editor nodes hold their settings as positional widget values */
+static void
+comfy_graph_add_widgets (ComfyGraph *graph, const gchar *type, gchar **widgets)
+{
+    ComfyNode node = { 0 };
+    
+    node.class_type = g_strdup (type);
+    
+    if (strstr (type, "CheckpointLoader")) {
+        node.inputs[INPUT_CHECKPOINT] = g_strdup (widgets[0]);
+    } else if (strcmp (type, "UNETLoader") == 0) {
+        node.inputs[INPUT_UNET] = g_strdup (widgets[0]);
+    } else if (g_str_has_prefix (type, "LoraLoader")) {
+        node.inputs[INPUT_LORA] = g_strdup (widgets[0]);
+        node.inputs[INPUT_LORA_STRENGTH] = g_strdup (widgets[1]);
+    } else if (strcmp (type, "KSampler") == 0) {
+        /* seed, seed control, steps, cfg, sampler, scheduler, denoise */
+        node.inputs[INPUT_SEED] = g_strdup (widgets[0]);
+        node.inputs[INPUT_STEPS] = g_strdup (widgets[2]);
+        node.inputs[INPUT_CFG] = g_strdup (widgets[3]);
+        node.inputs[INPUT_SAMPLER] = g_strdup (widgets[4]);
+        node.inputs[INPUT_SCHEDULER] = g_strdup (widgets[5]);
+    } else if (strcmp (type, "KSamplerAdvanced") == 0) {
+        /* add noise, then the same as KSampler */
+        node.inputs[INPUT_SEED] = g_strdup (widgets[1]);
+        node.inputs[INPUT_STEPS] = g_strdup (widgets[3]);
+        node.inputs[INPUT_CFG] = g_strdup (widgets[4]);
+        node.inputs[INPUT_SAMPLER] = g_strdup (widgets[5]);
+        node.inputs[INPUT_SCHEDULER] = g_strdup (widgets[6]);
+    }
+    
+    comfy_graph_add_node (graph, "", &node);
+    comfy_node_clear (&node);
+}
+    
+/* { "nodes": [ { "type": "KSampler", "widgets_values": [...] }, ... ] } */
+static void
+scan_workflow_graph (JsonScanner *s, ComfyGraph *graph)
+{
+    GString *key = g_string_new (NULL);
+    gboolean first = TRUE;
+    
+    if (!json_expect (s, '{')) {
+        g_string_free (key, TRUE);
+        return;
+    }
+    
+    while (json_next_member (s, &first, key)) {
+        gboolean first_node = TRUE;
+        
+        if (strcmp (key->str, "nodes") != 0 || !json_peek (s, '[')) {
+            json_skip_value (s);
+            continue;
+        }
+        
+        s->p++;
+        while (json_next_element (s, &first_node)) {
+            gchar *widgets[COMFY_MAX_WIDGETS] = { NULL };
+            gchar *type = NULL;
+            gboolean first_member = TRUE;
+            gint i;
+            
+            if (!json_expect (s, '{')) {
+                break;
+            }
+            while (json_next_member (s, &first_member, key)) {
+                if (strcmp (key->str, "type") == 0 && !type) {
+                    json_read_scalar (s, &type);
+                } else if (strcmp (key->str, "widgets_values") == 0 && json_peek (s, '[')) {
+                    gboolean first_widget = TRUE;
+                    
+                    s->p++;
+                    for (i = 0; json_next_element (s, &first_widget); i++) {
+                        if (i < COMFY_MAX_WIDGETS && !widgets[i]) {
+                            json_read_scalar (s, &widgets[i]);
+                        } else {
+                            json_skip_value (s);
+                        }
+                    }
+                } else {
+                    json_skip_value (s);
+                }
+            }
+            
+            if (type) {
+                comfy_graph_add_widgets (graph, type, widgets);
+            }
+            g_free (type);
+            for (i = 0; i < COMFY_MAX_WIDGETS; i++) {
+                g_free (widgets[i]);
+            }
+        }
+    }
+    
+    g_string_free (key, TRUE);
+}
+    
+/* "SDXL\\juggernautXL_v9.safetensors" as "juggernautXL_v9", the way
+ * other tools name models */
+static gchar*
+model_display_name (const gchar *name)
+{
+    static const gchar *extensions[] = {
+        ".safetensors", ".ckpt", ".pt", ".pth", ".bin", ".gguf", ".sft", NULL
+    };
+    const gchar *base = name;
+    const gchar *p, *dot;
+    gint i;
+    
+    for (p = name; *p; p++) {
+        if (*p == '/' || *p == '\\') {
+            base = p + 1;
+        }
+    }
+    
+    if ((dot = strrchr (base, '.')) && dot != base) {
+        for (i = 0; extensions[i]; i++) {
+            if (g_ascii_strcasecmp (dot, extensions[i]) == 0) {
+                return g_strndup (base, dot - base);
+            }
+        }
+    }
+    
+    return g_strdup (base);
+}
+    
+/* Seed masking */
+    
+/* What the editor does to a seed widget after each run, kept as the
+ * widget value right after the seed */
+static const gchar * const seed_controls[] = {
+    "randomize", "fixed", "increment", "decrement", NULL
+};
+    
+/* Byte range of one seed in the graph text */
+typedef struct {
+    gsize start;
+    gsize end;
+} SeedSpan;
+    
+static gboolean
+json_at_number (JsonScanner *s)
+{
+    json_skip_space (s);
+    return !s->failed && s->p < s->end && (g_ascii_isdigit (*s->p) || *s->p == '-');
+}
+    
+static void
+read_seed_span (JsonScanner *s, const gchar *text, SeedSpan *span)
+{
+    span->start = s->p - text;
+    json_read_literal (s, NULL);
+    span->end = s->p - text;
+}
+    
+/* Add to @seeds the span of every seed in the value at the scanner:
+ * "seed" and "noise_seed" inputs of the executed graph, and numbers
+ * followed by a seed control in the editor's widget lists */
+static gboolean
+find_seeds (JsonScanner *s, const gchar *text, GArray *seeds,
+            gboolean widgets, guint depth)
+{
+    gboolean first = TRUE;
+    
+    if (depth > COMFY_MAX_DEPTH) {
+        return json_fail (s);
+    }
+    
+    if (json_peek (s, '{')) {
+        GString *key = g_string_new (NULL);
+        
+        s->p++;
+        while (json_next_member (s, &first, key)) {
+            if ((strcmp (key->str, "seed") == 0 || strcmp (key->str, "noise_seed") == 0) &&
+                json_at_number (s)) {
+                SeedSpan span;
+                
+                read_seed_span (s, text, &span);
+                g_array_append_val (seeds, span);
+            } else {
+                find_seeds (s, text, seeds,
+                            strcmp (key->str, "widgets_values") == 0, depth + 1);
+            }
+        }
+        g_string_free (key, TRUE);
+    } else if (json_peek (s, '[')) {
+        GString *value = g_string_new (NULL);
+        SeedSpan number = { 0, 0 };
+        
+        s->p++;
+        while (json_next_element (s, &first)) {
+            if (widgets && json_at_number (s)) {
+                read_seed_span (s, text, &number);
+                continue;
+            }
+            
+            if (widgets && json_peek (s, '"')) {
+                if (json_read_string (s, value) && number.end > 0 &&
+                    g_strv_contains (seed_controls, value->str)) {
+                    g_array_append_val (seeds, number);
+                }
+            } else {
+                find_seeds (s, text, seeds, FALSE, depth + 1);
+            }
+            number.end = 0;
+        }
+        g_string_free (value, TRUE);
+    } else {
+        json_skip_value (s);
+    }
+    
+    return !s->failed;
+}
+    
+/* @text with every seed written as 0, so that the images of a batch
+ * share one blob; NULL if the graph does not parse */
+static gchar*
+comfy_canonical_graph (const gchar *text)
+{
+    JsonScanner s = { text, text + strlen (text), FALSE };
+    GArray *seeds;
+    GString *out;
+    gsize copied = 0;
+    guint i;
+    
+    seeds = g_array_new (FALSE, FALSE, sizeof (SeedSpan));
+    if (!find_seeds (&s, text, seeds, FALSE, 0)) {
+        g_array_free (seeds, TRUE);
+        return NULL;
+    }
+    
+    out = g_string_sized_new (s.end - text);
+    for (i = 0; i < seeds->len; i++) {
+        SeedSpan *span = &g_array_index (seeds, SeedSpan, i);
+        
+        g_string_append_len (out, text + copied, span->start - copied);
+        g_string_append_c (out, '0');
+        copied = span->end;
+    }
+    g_string_append (out, text + copied);
+    g_array_free (seeds, TRUE);
+    
+    return g_string_free (out, FALSE);
+}
+    
+void
+finderz_comfyui_parse (const gchar *prompt,
+                       const gchar *workflow,
+                       FinderzAIMetadata *ai_data)
+{
+    ComfyGraph graph = { 0 };
+    const gchar *text;
+    gboolean prompt_ok = FALSE;
+    
+    g_return_if_fail (ai_data != NULL);
+    
+    graph.texts = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    graph.loras = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    
+    if (prompt) {
+        JsonScanner s = { prompt, prompt + strlen (prompt), FALSE };
+        
+        scan_prompt_graph (&s, &graph);
+        if (s.failed) {
+            g_debug ("FINDERZ: Malformed ComfyUI prompt graph");
+        }
+        prompt_ok = !s.failed;
+    }
+    
+    /* The editor graph also holds muted nodes, so it is only read for
+     * images saved without the executed graph */
+    if (workflow && !graph.has_sampler && !graph.model) {
+        JsonScanner s = { workflow, workflow + strlen (workflow), FALSE };
+        
+        scan_workflow_graph (&s, &graph);
+        if (s.failed) {
+            g_debug ("FINDERZ: Malformed ComfyUI workflow");
+        }
+    }
+    
+    if (graph.positive && (text = g_hash_table_lookup (graph.texts, graph.positive))) {
+        g_free (ai_data->prompt);
+        ai_data->prompt = g_strdup (text);
+    }
+    if (graph.negative && (text = g_hash_table_lookup (graph.texts, graph.negative))) {
+        g_free (ai_data->negative_prompt);
+        ai_data->negative_prompt = g_strdup (text);
+    }
+    
+    if (graph.model && !ai_data->model) {
+        ai_data->model = model_display_name (graph.model);
+    }
+    if (graph.sampler && !ai_data->sampler) {
+        /* Written like "DPM++ 2M Karras" in other tools */
+        if (graph.scheduler && strcmp (graph.scheduler, "normal") != 0) {
+            ai_data->sampler = g_strdup_printf ("%s %s", graph.sampler, graph.scheduler);
+        } else {
+            ai_data->sampler = g_strdup (graph.sampler);
+        }
+    }
+    if (graph.steps && ai_data->steps <= 0) {
+        ai_data->steps = atoi (graph.steps);
+    }
+    if (graph.cfg && ai_data->cfg_scale <= 0) {
+        ai_data->cfg_scale = g_ascii_strtod (graph.cfg, NULL);
+    }
+    if (graph.seed && ai_data->seed == 0) {
+        ai_data->seed = g_ascii_strtoll (graph.seed, NULL, 10);
+    }
+    
+    if (g_hash_table_size (graph.loras) > 0 && !ai_data->loras) {
+        GHashTableIter iter;
+        gpointer name, strength;
+        
+        ai_data->loras = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+        g_hash_table_iter_init (&iter, graph.loras);
+        while (g_hash_table_iter_next (&iter, &name, &strength)) {
+            g_hash_table_replace (ai_data->loras, model_display_name (name),
+                                  g_strdup (strength));
+        }
+    }
+    
+    /* Without a workflow the executed graph is the next best thing */
+    text = workflow ? workflow : (prompt_ok ? prompt : NULL);
+    if (text && !ai_data->workflow_hash) {
+        gchar *canonical = comfy_canonical_graph (text);
+        
+        if (canonical) {
+            text = canonical;
+        }
+        ai_data->workflow_hash = finderz_blob_store_put (text, strlen (text));
+        g_free (canonical);
+    }
+    
+    g_free (graph.model);
+    g_free (graph.sampler);
+    g_free (graph.scheduler);
+    g_free (graph.steps);
+    g_free (graph.cfg);
+    g_free (graph.seed);
+    g_free (graph.positive);
+    g_free (graph.negative);
+    g_hash_table_destroy (graph.texts);
+    g_hash_table_destroy (graph.loras);
+}
+    
\ No newline at end of file
@@ -0,0 +1,25 @@
+/* finderz-comfyui.h
+ *
+ * Generation settings from ComfyUI graphs
+ */
+
+#ifndef FINDERZ_COMFYUI_H
+#define FINDERZ_COMFYUI_H
+
+#include <glib.h>
+#include "finderz-universal-metadata.h"
+
+G_BEGIN_DECLS
+
+/* Fill @ai_data from the graphs ComfyUI saves in its PNG text chunks:
+ * @prompt is the executed graph of the "prompt" chunk and @workflow the
+ * editor graph of the "workflow" chunk; either may be NULL.  The text
+ * is scanned once and not kept: the workflow, with its seeds set to 0,
+ * goes to the blob store and @ai_data->workflow_hash gets its key. */
+void finderz_comfyui_parse (const gchar *prompt,
+                            const gchar *workflow,
+                            FinderzAIMetadata *ai_data);
+
+G_END_DECLS
+
+#endif /* FINDERZ_COMFYUI_H */
@@ -0,0 +1,2025 @@
+/* finderz-document-probe.c
+ *
+ * Title, author and page count of PDF and office documents
+ *
+ * PDF keeps the way into its objects at the end of the file: startxref
+ * points at the last cross-reference section, whose trailer names the
+ * Info dictionary and the document catalog.  The objects wanted are
+ * then read where the cross-reference data says they are, including
+ * from compressed object streams.  OOXML and OpenDocument files are
+ * ZIP archives, whose central directory at the end lists the offset of
+ * every member, so only the small metadata members are inflated.
+ */
+
+#include "finderz-document-probe.h"
+#include "finderz-xmp-parser.h"
+#include <gio/gio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Read first from the end; enough for the PDF trailer and for a ZIP
+ * end record without an archive comment */
+#define DOC_TAIL_SIZE           2048
+/* The end record plus the longest archive comment */
+#define ZIP_MAX_TAIL_SIZE       (22 + 65535)
+
+#define PDF_MAX_OBJECT_SIZE     (8 * 1024)
+#define PDF_MAX_SECTIONS        32
+#define PDF_MAX_SUBSECTIONS     256
+/* Bounds on the streams read: cross-reference and object streams of
+ * large files, and the XMP packet */
+#define PDF_MAX_STREAM_SIZE     (1024 * 1024)
+#define PDF_MAX_DECODED_SIZE    (4 * 1024 * 1024)
+
+#define ZIP_MAX_DIRECTORY_SIZE  (1024 * 1024)
+#define ZIP_MAX_MEMBER_SIZE     (256 * 1024)
+#define ZIP_MAX_XML_SIZE        (1024 * 1024)
+
+typedef struct {
+    GInputStream *stream;
+    goffset size;
+} DocFile;
+
+/* What the document told us; the first source of each field wins */
+typedef struct {
+    gchar *title;
+    gchar *author;
+    gchar *keywords;
+    gchar *application;
+    GDateTime *created;
+    GDateTime *modified;
+    gint64 pages;
+} DocInfo;
+
+static const gchar *pdf_extensions[] = {
+    "pdf",
+};
+
+static const gchar *office_extensions[] = {
+    "docx", "docm", "xlsx", "xlsm", "pptx", "pptm",
+    "odt", "ods", "odp", "odg",
+};
+
+static inline guint16
+le16 (const guint8 *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static inline guint32
+le32 (const guint8 *p)
+{
+    return p[0] | (p[1] << 8) | ((guint32)p[2] << 16) | ((guint32)p[3] << 24);
+}
+
+static inline guint64
+le64 (const guint8 *p)
+{
+    return le32 (p) | ((guint64)le32 (p + 4) << 32);
+}
+
+static gboolean
+doc_file_open (DocFile *file, const gchar *file_path)
+{
+    GFile *location;
+    GFileInputStream *stream;
+    GFileInfo *info;
+    
+    location = g_file_new_for_path (file_path);
+    stream = g_file_read (location, NULL, NULL);
+    g_object_unref (location);
+    if (!stream) {
+        return FALSE;
+    }
+    
+    info = g_file_input_stream_query_info (stream, G_FILE_ATTRIBUTE_STANDARD_SIZE,
+                                           NULL, NULL);
+    if (!info) {
+        g_object_unref (stream);
+        return FALSE;
+    }
+    file->size = g_file_info_get_size (info);
+    g_object_unref (info);
+    
+    file->stream = G_INPUT_STREAM (stream);
+    
+    return TRUE;
+}
+
+/* Up to @length bytes at @offset in a new buffer with a NUL after
+ * them, so text can be scanned in place; NULL if nothing could be read */
+static guint8*
+doc_read (DocFile *file, goffset offset, gsize length, gsize *bytes_read)
+{
+    guint8 *buffer;
+    
+    if (offset < 0 || offset >= file->size) {
+        return NULL;
+    }
+    length = MIN ((goffset)length, file->size - offset);
+    
+    buffer = g_malloc (length + 1);
+    if (!g_seekable_seek (G_SEEKABLE (file->stream), offset, G_SEEK_SET, NULL, NULL) ||
+        !g_input_stream_read_all (file->stream, buffer, length, bytes_read, NULL, NULL) ||
+        *bytes_read == 0) {
+        g_free (buffer);
+        return NULL;
+    }
+    buffer[*bytes_read] = '\0';
+    
+    return buffer;
+}
+
+/* Inflate @data, giving up past @max_length bytes of output */
+static guint8*
+doc_inflate (const guint8 *data, gsize length, GZlibCompressorFormat format,
+             gsize max_length, gsize *out_length)
+{
+    GConverter *decompressor;
+    GByteArray *output;
+    guint8 buffer[16 * 1024];
+    gboolean ok = FALSE;
+    
+    decompressor = G_CONVERTER (g_zlib_decompressor_new (format));
+    output = g_byte_array_new ();
+    
+    while (output->len <= max_length) {
+        GConverterResult result;
+        gsize bytes_read, bytes_written;
+        
+        result = g_converter_convert (decompressor, data, length,
+                                      buffer, sizeof (buffer),
+                                      G_CONVERTER_INPUT_AT_END,
+                                      &bytes_read, &bytes_written, NULL);
+        if (result == G_CONVERTER_ERROR) {
+            break;
+        }
+        
+        g_byte_array_append (output, buffer, bytes_written);
+        data += bytes_read;
+        length -= bytes_read;
+        
+        if (result == G_CONVERTER_FINISHED) {
+            ok = output->len <= max_length;
+            break;
+        }
+    }
+    
+    g_object_unref (decompressor);
+    
+    if (!ok) {
+        g_byte_array_unref (output);
+        return NULL;
+    }
+    
+    /* NUL-terminated like doc_read(), for the XML parsers */
+    *out_length = output->len;
+    g_byte_array_append (output, (const guint8 *)"", 1);
+    return g_byte_array_free (output, FALSE);
+}
+
+/* Keep @value in *@field unless the field is set or @value is blank */
+static void
+doc_take_string (gchar **field, gchar *value)
+{
+    if (value) {
+        g_strstrip (value);
+    }
+    
+    if (*field || !value || !*value) {
+        g_free (value);
+        return;
+    }
+    
+    *field = value;
+}
+
+static void
+doc_take_date (GDateTime **field, GDateTime *value)
+{
+    if (*field || !value) {
+        if (value) {
+            g_date_time_unref (value);
+        }
+        return;
+    }
+    
+    *field = value;
+}
+
+/* ISO 8601 as written in office documents, local time if no zone is given */
+static GDateTime*
+doc_parse_iso8601 (const gchar *text)
+{
+    GTimeZone *local;
+    GDateTime *date;
+    
+    local = g_time_zone_new_local ();
+    date = g_date_time_new_from_iso8601 (text, local);
+    g_time_zone_unref (local);
+    
+    return date;
+}
+
+/* === PDF objects === */
+
+typedef enum {
+    PDF_TOKEN_END,
+    PDF_TOKEN_NAME,             /* without the slash */
+    PDF_TOKEN_STRING,           /* inside the parentheses, escapes kept */
+    PDF_TOKEN_HEX_STRING,       /* inside the angle brackets */
+    PDF_TOKEN_NUMBER,
+    PDF_TOKEN_KEYWORD,          /* obj, R, stream, true, null... */
+    PDF_TOKEN_DICT_BEGIN,
+    PDF_TOKEN_DICT_END,
+    PDF_TOKEN_ARRAY_BEGIN,
+    PDF_TOKEN_ARRAY_END
+} PdfTokenType;
+
+typedef struct {
+    PdfTokenType type;
+    const gchar *start;
+    gsize length;
+} PdfToken;
+
+typedef struct {
+    const gchar *data;
+    gsize length;
+    gsize position;
+} PdfLexer;
+
+/* A dictionary value.  Arrays and dictionaries are left for the caller
+ * to read from @token; references carry the object number. */
+typedef struct {
+    PdfToken token;
+    gint64 number;
+    gboolean is_reference;
+} PdfValue;
+
+static gboolean
+pdf_is_space (gchar c)
+{
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\f' || c == '\0';
+}
+
+static gboolean
+pdf_is_delimiter (gchar c)
+{
+    return strchr ("()<>[]{}/%", c) != NULL;
+}
+
+static void
+pdf_lexer_init (PdfLexer *lexer, const gchar *data, gsize length)
+{
+    lexer->data = data;
+    lexer->length = length;
+    lexer->position = 0;
+}
+
+static gboolean
+pdf_next_token (PdfLexer *lexer, PdfToken *token)
+{
+    const gchar *data = lexer->data;
+    gsize length = lexer->length;
+    gsize p = lexer->position;
+    
+    /* Whitespace and comments */
+    while (p < length) {
+        if (pdf_is_space (data[p])) {
+            p++;
+        } else if (data[p] == '%') {
+            while (p < length && data[p] != '\n' && data[p] != '\r') {
+                p++;
+            }
+        } else {
+            break;
+        }
+    }
+    
+    token->type = PDF_TOKEN_END;
+    token->start = data + p;
+    token->length = 0;
+    if (p >= length) {
+        lexer->position = p;
+        return FALSE;
+    }
+    
+    switch (data[p]) {
+        case '(': {
+            gint nesting = 1;
+            
+            token->type = PDF_TOKEN_STRING;
+            token->start = data + ++p;
+            while (p < length && nesting > 0) {
+                if (data[p] == '\\') {
+                    p++;
+                } else if (data[p] == '(') {
+                    nesting++;
+                } else if (data[p] == ')') {
+                    nesting--;
+                }
+                p++;
+            }
+            if (nesting > 0) {
+                lexer->position = length;
+                return FALSE;
+            }
+            token->length = data + p - 1 - token->start;
+            break;
+        }
+        case '<':
+            if (p + 1 < length && data[p + 1] == '<') {
+                token->type = PDF_TOKEN_DICT_BEGIN;
+                token->length = 2;
+                p += 2;
+                break;
+            }
+            token->type = PDF_TOKEN_HEX_STRING;
+            token->start = data + ++p;
+            while (p < length && data[p] != '>') {
+                p++;
+            }
+            if (p >= length) {
+                lexer->position = length;
+                return FALSE;
+            }
+            token->length = data + p - token->start;
+            p++;
+            break;
+        case '>':
+            if (p + 1 >= length || data[p + 1] != '>') {
+                lexer->position = length;
+                return FALSE;
+            }
+            token->type = PDF_TOKEN_DICT_END;
+            token->length = 2;
+            p += 2;
+            break;
+        case '[':
+        case ']':
+            token->type = data[p] == '[' ? PDF_TOKEN_ARRAY_BEGIN : PDF_TOKEN_ARRAY_END;
+            token->length = 1;
+            p++;
+            break;
+        case '/':
+            token->type = PDF_TOKEN_NAME;
+            token->start = data + ++p;
+            while (p < length && !pdf_is_space (data[p]) && !pdf_is_delimiter (data[p])) {
+                p++;
+            }
+            token->length = data + p - token->start;
+            break;
+        default:
+            if (pdf_is_delimiter (data[p])) {
+                /* ), { or } out of place */
+                lexer->position = length;
+                return FALSE;
+            }
+            token->type = g_ascii_isdigit (data[p]) || data[p] == '-' ||
+                          data[p] == '+' || data[p] == '.' ?
+                          PDF_TOKEN_NUMBER : PDF_TOKEN_KEYWORD;
+            while (p < length && !pdf_is_space (data[p]) && !pdf_is_delimiter (data[p])) {
+                p++;
+            }
+            token->length = data + p - token->start;
+            break;
+    }
+    
+    lexer->position = p;
+    return TRUE;
+}
+
+static gboolean
+pdf_token_is (const PdfToken *token, PdfTokenType type, const gchar *text)
+{
+    return token->type == type && token->length == strlen (text) &&
+           memcmp (token->start, text, token->length) == 0;
+}
+
+static gint64
+pdf_token_to_int (const PdfToken *token)
+{
+    gchar buffer[32];
+    gsize length = MIN (token->length, sizeof (buffer) - 1);
+    
+    memcpy (buffer, token->start, length);
+    buffer[length] = '\0';
+    
+    return g_ascii_strtoll (buffer, NULL, 10);
+}
+
+/* After a number, "G R" makes it a reference; otherwise nothing is used */
+static gboolean
+pdf_match_reference (PdfLexer *lexer)
+{
+    gsize saved = lexer->position;
+    PdfToken generation, keyword;
+    
+    if (pdf_next_token (lexer, &generation) && generation.type == PDF_TOKEN_NUMBER &&
+        pdf_next_token (lexer, &keyword) && pdf_token_is (&keyword, PDF_TOKEN_KEYWORD, "R")) {
+        return TRUE;
+    }
+    
+    lexer->position = saved;
+    return FALSE;
+}
+
+/* Step over the rest of the value that starts with @token */
+static gboolean
+pdf_skip_value (PdfLexer *lexer, const PdfToken *token)
+{
+    PdfToken inner;
+    guint depth = 1;
+    
+    switch (token->type) {
+        case PDF_TOKEN_DICT_BEGIN:
+        case PDF_TOKEN_ARRAY_BEGIN:
+            while (depth > 0) {
+                if (!pdf_next_token (lexer, &inner)) {
+                    return FALSE;
+                }
+                if (inner.type == PDF_TOKEN_DICT_BEGIN || inner.type == PDF_TOKEN_ARRAY_BEGIN) {
+                    depth++;
+                } else if (inner.type == PDF_TOKEN_DICT_END || inner.type == PDF_TOKEN_ARRAY_END) {
+                    depth--;
+                }
+            }
+            return TRUE;
+        case PDF_TOKEN_NUMBER:
+            pdf_match_reference (lexer);
+            return TRUE;
+        case PDF_TOKEN_END:
+        case PDF_TOKEN_DICT_END:
+        case PDF_TOKEN_ARRAY_END:
+            return FALSE;
+        default:
+            return TRUE;
+    }
+}
+
+/* The value of /@key in the dictionary at the start of @data */
+static gboolean
+pdf_dict_lookup (const gchar *data, gsize length, const gchar *key, PdfValue *value)
+{
+    PdfLexer lexer;
+    PdfToken token;
+    
+    pdf_lexer_init (&lexer, data, length);
+    if (!pdf_next_token (&lexer, &token) || token.type != PDF_TOKEN_DICT_BEGIN) {
+        return FALSE;
+    }
+    
+    while (pdf_next_token (&lexer, &token) && token.type == PDF_TOKEN_NAME) {
+        gboolean match = pdf_token_is (&token, PDF_TOKEN_NAME, key);
+        
+        if (!pdf_next_token (&lexer, &value->token)) {
+            return FALSE;
+        }
+        
+        if (match) {
+            value->number = 0;
+            value->is_reference = FALSE;
+            if (value->token.type == PDF_TOKEN_NUMBER) {
+                value->number = pdf_token_to_int (&value->token);
+                value->is_reference = pdf_match_reference (&lexer);
+            }
+            return TRUE;
+        }
+        
+        if (!pdf_skip_value (&lexer, &value->token)) {
+            return FALSE;
+        }
+    }
+    
+    return FALSE;
+}
+
+static gboolean
+pdf_dict_get_int (const gchar *data, gsize length, const gchar *key, gint64 *number)
+{
+    PdfValue value;
+    
+    if (!pdf_dict_lookup (data, length, key, &value) ||
+        value.token.type != PDF_TOKEN_NUMBER || value.is_reference) {
+        return FALSE;
+    }
+    
+    *number = value.number;
+    return TRUE;
+}
+
+static gboolean
+pdf_dict_get_reference (const gchar *data, gsize length, const gchar *key, gint64 *number)
+{
+    PdfValue value;
+    
+    if (!pdf_dict_lookup (data, length, key, &value) || !value.is_reference ||
+        value.number <= 0) {
+        return FALSE;
+    }
+    
+    *number = value.number;
+    return TRUE;
+}
+
+/* Up to @max numbers of the array value @value; returns how many */
+static guint
+pdf_array_get_ints (const PdfValue *value, const gchar *end, gint64 *numbers, guint max)
+{
+    PdfLexer lexer;
+    PdfToken token;
+    guint n = 0;
+    
+    if (value->token.type != PDF_TOKEN_ARRAY_BEGIN) {
+        return 0;
+    }
+    
+    pdf_lexer_init (&lexer, value->token.start + 1, end - value->token.start - 1);
+    while (n < max && pdf_next_token (&lexer, &token) && token.type == PDF_TOKEN_NUMBER) {
+        numbers[n++] = pdf_token_to_int (&token);
+    }
+    
+    return n;
+}
+
+/* PDFDocEncoding matches Latin-1 but for these */
+static const gunichar pdf_doc_encoding_high[] = {
+    0x2022, 0x2020, 0x2021, 0x2026, 0x2014, 0x2013, 0x0192, 0x2044,
+    0x2039, 0x203a, 0x2212, 0x2030, 0x201e, 0x201c, 0x201d, 0x2018,
+    0x2019, 0x201a, 0x2122, 0xfb01, 0xfb02, 0x0141, 0x0152, 0x0160,
+    0x0178, 0x017d, 0x0131, 0x0142, 0x0153, 0x0161, 0x017e, 0xfffd,
+    0x20ac,
+};
+
+/* Undo the escapes of a literal string or the hex digits of a hex one */
+static GByteArray*
+pdf_string_bytes (const PdfToken *token)
+{
+    GByteArray *bytes = g_byte_array_sized_new (token->length);
+    const gchar *p = token->start;
+    const gchar *end = token->start + token->length;
+    
+    if (token->type == PDF_TOKEN_HEX_STRING) {
+        gint high = -1;
+        
+        for (; p < end; p++) {
+            gint digit = g_ascii_xdigit_value (*p);
+            
+            if (digit < 0) {
+                continue;
+            }
+            if (high < 0) {
+                high = digit;
+            } else {
+                guint8 byte = (high << 4) | digit;
+                
+                g_byte_array_append (bytes, &byte, 1);
+                high = -1;
+            }
+        }
+        if (high >= 0) {
+            guint8 byte = high << 4;
+            
+            g_byte_array_append (bytes, &byte, 1);
+        }
+        return bytes;
+    }
+    
+    while (p < end) {
+        guint8 byte = *p++;
+        
+        if (byte == '\\' && p < end) {
+            gchar escape = *p++;
+            
+            switch (escape) {
+                case 'n': byte = '\n'; break;
+                case 'r': byte = '\r'; break;
+                case 't': byte = '\t'; break;
+                case 'b': byte = '\b'; break;
+                case 'f': byte = '\f'; break;
+                case '\r':
+                    /* A line continuation */
+                    if (p < end && *p == '\n') {
+                        p++;
+                    }
+                    continue;
+                case '\n':
+                    continue;
+                default:
+                    if (escape >= '0' && escape <= '7') {
+                        guint code = escape - '0';
+                        gint i;
+                        
+                        for (i = 0; i < 2 && p < end && *p >= '0' && *p <= '7'; i++) {
+                            code = code * 8 + (*p++ - '0');
+                        }
+                        byte = code & 0xff;
+                    } else {
+                        byte = escape;
+                    }
+                    break;
+            }
+        }
+        g_byte_array_append (bytes, &byte, 1);
+    }
+    
+    return bytes;
+}
+
+/* A text string as UTF-8: UTF-16BE or UTF-8 after a byte order mark,
+ * otherwise PDFDocEncoding */
+static gchar*
+pdf_decode_text (const PdfToken *token)
+{
+    GByteArray *bytes;
+    gchar *text = NULL;
+    
+    if (token->type != PDF_TOKEN_STRING && token->type != PDF_TOKEN_HEX_STRING) {
+        return NULL;
+    }
+    
+    bytes = pdf_string_bytes (token);
+    
+    if (bytes->len >= 2 && bytes->data[0] == 0xfe && bytes->data[1] == 0xff) {
+        text = g_convert ((const gchar *)bytes->data + 2, (bytes->len - 2) & ~1,
+                          "UTF-8", "UTF-16BE", NULL, NULL, NULL);
+    } else if (bytes->len >= 3 && memcmp (bytes->data, "\xef\xbb\xbf", 3) == 0) {
+        if (g_utf8_validate ((const gchar *)bytes->data + 3, bytes->len - 3, NULL)) {
+            text = g_strndup ((const gchar *)bytes->data + 3, bytes->len - 3);
+        }
+    } else {
+        GString *string = g_string_sized_new (bytes->len);
+        guint i;
+        
+        for (i = 0; i < bytes->len; i++) {
+            guint8 byte = bytes->data[i];
+            
+            if (byte >= 0x80 && byte <= 0xa0) {
+                g_string_append_unichar (string, pdf_doc_encoding_high[byte - 0x80]);
+            } else if (byte != 0) {
+                g_string_append_unichar (string, byte);
+            }
+        }
+        text = g_string_free (string, FALSE);
+    }
+    
+    g_byte_array_unref (bytes);
+    return text;
+}
+
+/* "D:YYYYMMDDHHmmSSOHH'mm'", where everything after the year may be
+ * left out; without a zone the time is local */
+static GDateTime*
+pdf_parse_date (const gchar *text)
+{
+    gint fields[6] = { 0, 1, 1, 0, 0, 0 };
+    const gint widths[6] = { 4, 2, 2, 2, 2, 2 };
+    gint offset_hours = 0, offset_minutes = 0;
+    GDateTime *utc, *result;
+    gchar sign;
+    gint i, j;
+    
+    if (g_str_has_prefix (text, "D:")) {
+        text += 2;
+    }
+    
+    for (i = 0; i < 6; i++) {
+        gint value = 0;
+        
+        for (j = 0; j < widths[i]; j++) {
+            if (!g_ascii_isdigit (text[j])) {
+                break;
+            }
+            value = value * 10 + (text[j] - '0');
+        }
+        if (j < widths[i]) {
+            if (i == 0 || j > 0) {
+                return NULL;
+            }
+            break;
+        }
+        fields[i] = value;
+        text += widths[i];
+    }
+    
+    sign = *text;
+    if (sign != '+' && sign != '-' && sign != 'Z') {
+        return g_date_time_new_local (fields[0], fields[1], fields[2],
+                                      fields[3], fields[4], fields[5]);
+    }
+    
+    if (sign != 'Z' && sscanf (text + 1, "%2d'%2d", &offset_hours, &offset_minutes) < 1) {
+        return NULL;
+    }
+    
+    utc = g_date_time_new_utc (fields[0], fields[1], fields[2],
+                               fields[3], fields[4], fields[5]);
+    if (!utc) {
+        return NULL;
+    }
+    
+    result = g_date_time_add_seconds (utc, (sign == '-' ? 60 : -60) *
+                                           (offset_hours * 60 + offset_minutes));
+    g_date_time_unref (utc);
+    
+    return result;
+}
+
+/* === PDF cross-reference data === */
+
+typedef struct {
+    guint64 first;
+    guint64 count;
+    goffset entries;    /* file offset of a table, row index in a stream */
+} PdfSubsection;
+
+/* One revision's cross-reference section: a table of 20-byte text
+ * entries, or a stream of binary ones decoded into @entries */
+typedef struct {
+    GArray *subsections;
+    guint8 *entries;
+    gsize entries_length;
+    guint widths[3];
+    guint entry_size;
+} PdfSection;
+
+typedef struct {
+    DocFile *file;
+    GPtrArray *sections;        /* newest first */
+    gchar *trailer;             /* the newest trailer dictionary */
+    gsize trailer_length;
+    gboolean encrypted;
+    
+    /* The last object stream decoded */
+    gint64 object_stream;
+    guint8 *object_stream_data;
+    gsize object_stream_length;
+    gsize object_stream_first;
+} PdfDocument;
+
+static void
+pdf_section_free (PdfSection *section)
+{
+    g_array_unref (section->subsections);
+    g_free (section->entries);
+    g_free (section);
+}
+
+/* Where object @number is: type 1 at byte @field2, type 2 as entry
+ * @field3 of object stream @field2 */
+static gboolean
+pdf_find_object (PdfDocument *doc, gint64 number, guint *type, guint64 *field2, guint64 *field3)
+{
+    guint i, j;
+    
+    if (number <= 0) {
+        return FALSE;
+    }
+    
+    for (i = 0; i < doc->sections->len; i++) {
+        PdfSection *section = g_ptr_array_index (doc->sections, i);
+        
+        for (j = 0; j < section->subsections->len; j++) {
+            PdfSubsection *sub = &g_array_index (section->subsections, PdfSubsection, j);
+            guint64 row = number - sub->first;
+            
+            if ((guint64)number < sub->first || row >= sub->count) {
+                continue;
+            }
+            
+            if (!section->entries) {
+                gchar entry[21];
+                gsize bytes_read;
+                guint8 *data;
+                
+                data = doc_read (doc->file, sub->entries + row * 20, 20, &bytes_read);
+                if (!data || bytes_read < 18) {
+                    g_free (data);
+                    return FALSE;
+                }
+                memcpy (entry, data, MIN (bytes_read, 20));
+                entry[MIN (bytes_read, 20)] = '\0';
+                g_free (data);
+                
+                /* "oooooooooo ggggg n" */
+                if (entry[17] != 'n') {
+                    return FALSE;
+                }
+                *type = 1;
+                *field2 = g_ascii_strtoull (entry, NULL, 10);
+                *field3 = 0;
+                return TRUE;
+            } else {
+                guint64 fields[3] = { 1, 0, 0 };
+                const guint8 *p;
+                guint k, b;
+                
+                row += sub->entries;
+                if (row >= section->entries_length / section->entry_size) {
+                    return FALSE;
+                }
+                p = section->entries + row * section->entry_size;
+                
+                for (k = 0; k < 3; k++) {
+                    if (section->widths[k] == 0) {
+                        continue;
+                    }
+                    fields[k] = 0;
+                    for (b = 0; b < section->widths[k]; b++) {
+                        fields[k] = (fields[k] << 8) | *p++;
+                    }
+                }
+                
+                if (fields[0] != 1 && fields[0] != 2) {
+                    return FALSE;
+                }
+                *type = fields[0];
+                *field2 = fields[1];
+                *field3 = fields[2];
+                return TRUE;
+            }
+        }
+    }
+    
+    return FALSE;
+}
+
+/* The object whose "N G obj" header is at @offset: its body from after
+ * the header, at most PDF_MAX_OBJECT_SIZE bytes, and for a stream the
+ * offset of its data.  @number -1 accepts any object. */
+static gchar*
+pdf_read_object_at (PdfDocument *doc, goffset offset, gint64 number,
+                    gsize *length, goffset *stream_offset)
+{
+    PdfLexer lexer;
+    PdfToken token;
+    gchar *data, *body;
+    gsize bytes_read, start;
+    
+    data = (gchar *)doc_read (doc->file, offset, PDF_MAX_OBJECT_SIZE, &bytes_read);
+    if (!data) {
+        return NULL;
+    }
+    
+    pdf_lexer_init (&lexer, data, bytes_read);
+    if (!pdf_next_token (&lexer, &token) || token.type != PDF_TOKEN_NUMBER ||
+        (number >= 0 && pdf_token_to_int (&token) != number) ||
+        !pdf_next_token (&lexer, &token) || token.type != PDF_TOKEN_NUMBER ||
+        !pdf_next_token (&lexer, &token) || !pdf_token_is (&token, PDF_TOKEN_KEYWORD, "obj")) {
+        g_free (data);
+        return NULL;
+    }
+    start = lexer.position;
+    
+    if (stream_offset) {
+        *stream_offset = -1;
+        if (pdf_next_token (&lexer, &token) && pdf_skip_value (&lexer, &token) &&
+            pdf_next_token (&lexer, &token) &&
+            pdf_token_is (&token, PDF_TOKEN_KEYWORD, "stream")) {
+            gsize p = lexer.position;
+            
+            /* The data starts after CRLF or LF */
+            if (p < bytes_read && data[p] == '\r') {
+                p++;
+            }
+            if (p < bytes_read && data[p] == '\n') {
+                p++;
+            }
+            *stream_offset = offset + p;
+        }
+    }
+    
+    *length = bytes_read - start;
+    body = g_memdup (data + start, *length + 1);
+    g_free (data);
+    
+    return body;
+}
+
+static gchar* pdf_read_object (PdfDocument *doc, gint64 number, gsize *length,
+                               goffset *stream_offset);
+
+/* Reverse the PNG predictors of a cross-reference stream in place:
+ * each row of @columns bytes follows a byte naming its filter */
+static gboolean
+pdf_unpredict (guint8 *data, gsize *length, guint columns)
+{
+    gsize rows = *length / (columns + 1);
+    gsize row;
+    guint i;
+    
+    for (row = 0; row < rows; row++) {
+        const guint8 *in = data + row * (columns + 1);
+        guint8 *out = data + row * columns;
+        const guint8 *up = row > 0 ? out - columns : NULL;
+        guint8 filter = in[0];
+        
+        in++;
+        for (i = 0; i < columns; i++) {
+            guint8 left = i > 0 ? out[i - 1] : 0;
+            guint8 above = up ? up[i] : 0;
+            guint8 corner = up && i > 0 ? up[i - 1] : 0;
+            guint8 x = in[i];
+            
+            switch (filter) {
+                case 0:
+                    break;
+                case 1:
+                    x += left;
+                    break;
+                case 2:
+                    x += above;
+                    break;
+                case 3:
+                    x += (left + above) / 2;
+                    break;
+                case 4: {
+                    gint estimate = left + above - corner;
+                    gint pa = abs (estimate - left);
+                    gint pb = abs (estimate - above);
+                    gint pc = abs (estimate - corner);
+                    
+                    x += pa <= pb && pa <= pc ? left : pb <= pc ? above : corner;
+                    break;
+                }
+                default:
+                    return FALSE;
+            }
+            out[i] = x;
+        }
+    }
+    
+    *length = rows * columns;
+    return TRUE;
+}
+
+/* The decoded data of the stream with dictionary @dict whose data is at
+ * @data_offset.  Only FlateDecode and unfiltered streams are read. */
+static guint8*
+pdf_read_stream (PdfDocument *doc, const gchar *dict, gsize dict_length,
+                 goffset data_offset, gsize *length)
+{
+    PdfValue value;
+    gint64 stream_length = -1;
+    gboolean deflated = FALSE;
+    guint8 *raw, *decoded;
+    gsize bytes_read;
+    
+    if (data_offset < 0) {
+        return NULL;
+    }
+    
+    if (pdf_dict_lookup (dict, dict_length, "Length", &value) &&
+        value.token.type == PDF_TOKEN_NUMBER) {
+        if (!value.is_reference) {
+            stream_length = value.number;
+        } else {
+            gchar *object;
+            gsize object_length;
+            
+            object = pdf_read_object (doc, value.number, &object_length, NULL);
+            if (object) {
+                stream_length = g_ascii_strtoll (object, NULL, 10);
+                g_free (object);
+            }
+        }
+    }
+    if (stream_length <= 0 || stream_length > PDF_MAX_STREAM_SIZE) {
+        return NULL;
+    }
+    
+    if (pdf_dict_lookup (dict, dict_length, "Filter", &value)) {
+        PdfToken filter = value.token;
+        
+        /* A one-element filter array */
+        if (filter.type == PDF_TOKEN_ARRAY_BEGIN) {
+            PdfLexer lexer;
+            
+            pdf_lexer_init (&lexer, filter.start + 1, dict + dict_length - filter.start - 1);
+            if (!pdf_next_token (&lexer, &filter) ||
+                !pdf_next_token (&lexer, &value.token) ||
+                value.token.type != PDF_TOKEN_ARRAY_END) {
+                return NULL;
+            }
+        }
+        if (!pdf_token_is (&filter, PDF_TOKEN_NAME, "FlateDecode")) {
+            return NULL;
+        }
+        deflated = TRUE;
+    }
+    
+    raw = doc_read (doc->file, data_offset, stream_length, &bytes_read);
+    if (!raw) {
+        return NULL;
+    }
+    if (!deflated) {
+        *length = bytes_read;
+        return raw;
+    }
+    
+    decoded = doc_inflate (raw, bytes_read, G_ZLIB_COMPRESSOR_FORMAT_ZLIB,
+                           PDF_MAX_DECODED_SIZE, length);
+    g_free (raw);
+    if (!decoded) {
+        return NULL;
+    }
+    
+    if (pdf_dict_lookup (dict, dict_length, "DecodeParms", &value) &&
+        value.token.type == PDF_TOKEN_DICT_BEGIN) {
+        gsize parms_length = dict + dict_length - value.token.start;
+        gint64 predictor = 1, columns = 1;
+        
+        pdf_dict_get_int (value.token.start, parms_length, "Predictor", &predictor);
+        pdf_dict_get_int (value.token.start, parms_length, "Columns", &columns);
+        if (predictor >= 10 &&
+            (columns <= 0 || columns > 256 || !pdf_unpredict (decoded, length, columns))) {
+            g_free (decoded);
+            return NULL;
+        }
+    }
+    
+    return decoded;
+}
+
+/* Decode object stream @stream_number unless it is the cached one */
+static gboolean
+pdf_load_object_stream (PdfDocument *doc, gint64 stream_number)
+{
+    guint type;
+    guint64 offset, unused;
+    gint64 count, first;
+    gchar *dict;
+    gsize dict_length;
+    goffset data_offset;
+    
+    if (doc->object_stream == stream_number) {
+        return doc->object_stream_data != NULL;
+    }
+    
+    g_clear_pointer (&doc->object_stream_data, g_free);
+    doc->object_stream = stream_number;
+    
+    /* Object streams are encrypted along with everything else */
+    if (doc->encrypted ||
+        !pdf_find_object (doc, stream_number, &type, &offset, &unused) || type != 1) {
+        return FALSE;
+    }
+    
+    dict = pdf_read_object_at (doc, offset, stream_number, &dict_length, &data_offset);
+    if (!dict) {
+        return FALSE;
+    }
+    
+    if (pdf_dict_get_int (dict, dict_length, "N", &count) && count > 0 &&
+        pdf_dict_get_int (dict, dict_length, "First", &first) && first > 0) {
+        doc->object_stream_data = pdf_read_stream (doc, dict, dict_length, data_offset,
+                                                   &doc->object_stream_length);
+        doc->object_stream_first = first;
+        if (doc->object_stream_data && (gsize)first >= doc->object_stream_length) {
+            g_clear_pointer (&doc->object_stream_data, g_free);
+        }
+    }
+    g_free (dict);
+    
+    return doc->object_stream_data != NULL;
+}
+
+/* Object @index of object stream @stream_number.  The stream starts
+ * with pairs of object number and offset from /First, where the
+ * objects follow one another. */
+static gchar*
+pdf_read_from_object_stream (PdfDocument *doc, gint64 stream_number, guint64 index,
+                             gint64 number, gsize *length)
+{
+    PdfLexer lexer;
+    PdfToken token;
+    guint64 i, start = 0, end;
+    
+    if (index > 100000 || !pdf_load_object_stream (doc, stream_number)) {
+        return NULL;
+    }
+    
+    pdf_lexer_init (&lexer, (const gchar *)doc->object_stream_data, doc->object_stream_first);
+    end = doc->object_stream_length - doc->object_stream_first;
+    for (i = 0; i <= index + 1; i++) {
+        gint64 object_number, offset;
+        
+        if (!pdf_next_token (&lexer, &token) || token.type != PDF_TOKEN_NUMBER) {
+            break;
+        }
+        object_number = pdf_token_to_int (&token);
+        if (!pdf_next_token (&lexer, &token) || token.type != PDF_TOKEN_NUMBER) {
+            break;
+        }
+        offset = pdf_token_to_int (&token);
+        
+        if (i == index) {
+            if (object_number != number || offset < 0) {
+                return NULL;
+            }
+            start = offset;
+        } else if (i == index + 1 && offset >= 0) {
+            end = MIN ((guint64)offset, end);
+        }
+    }
+    if (i <= index || start >= end) {
+        return NULL;
+    }
+    
+    end = MIN (end, start + PDF_MAX_OBJECT_SIZE);
+    *length = end - start;
+    return g_strndup ((const gchar *)doc->object_stream_data + doc->object_stream_first + start,
+                      *length);
+}
+
+/* The body of object @number, at most PDF_MAX_OBJECT_SIZE bytes */
+static gchar*
+pdf_read_object (PdfDocument *doc, gint64 number, gsize *length, goffset *stream_offset)
+{
+    guint type;
+    guint64 field2, field3;
+    
+    if (!pdf_find_object (doc, number, &type, &field2, &field3)) {
+        return NULL;
+    }
+    
+    if (type == 1) {
+        return pdf_read_object_at (doc, field2, number, length, stream_offset);
+    }
+    
+    if (stream_offset) {
+        *stream_offset = -1;
+    }
+    return pdf_read_from_object_stream (doc, field2, field3, number, length);
+}
+
+/* A cross-reference table: "xref", then subsections of a "first count"
+ * line and count 20-byte entries, then "trailer" and its dictionary.
+ * Only the subsection lines are read; entries are read when looked up. */
+static PdfSection*
+pdf_load_table (PdfDocument *doc, goffset offset, gchar **trailer, gsize *trailer_length)
+{
+    PdfSection *section;
+    guint n;
+    
+    section = g_new0 (PdfSection, 1);
+    section->subsections = g_array_new (FALSE, FALSE, sizeof (PdfSubsection));
+    
+    for (n = 0; n < PDF_MAX_SUBSECTIONS; n++) {
+        PdfSubsection sub;
+        PdfLexer lexer;
+        PdfToken first, count;
+        gchar *line;
+        gsize bytes_read, p;
+        
+        line = (gchar *)doc_read (doc->file, offset, 64, &bytes_read);
+        if (!line) {
+            break;
+        }
+        
+        pdf_lexer_init (&lexer, line, bytes_read);
+        if (!pdf_next_token (&lexer, &first)) {
+            g_free (line);
+            break;
+        }
+        
+        if (pdf_token_is (&first, PDF_TOKEN_KEYWORD, "trailer")) {
+            gchar *dict;
+            
+            dict = (gchar *)doc_read (doc->file, offset + lexer.position,
+                                      PDF_MAX_OBJECT_SIZE, &bytes_read);
+            g_free (line);
+            if (dict) {
+                *trailer = dict;
+                *trailer_length = bytes_read;
+                return section;
+            }
+            break;
+        }
+        
+        if (first.type != PDF_TOKEN_NUMBER ||
+            !pdf_next_token (&lexer, &count) || count.type != PDF_TOKEN_NUMBER ||
+            pdf_token_to_int (&first) < 0 || pdf_token_to_int (&count) < 0) {
+            g_free (line);
+            break;
+        }
+        sub.first = pdf_token_to_int (&first);
+        sub.count = pdf_token_to_int (&count);
+        
+        /* Entries start on the next line */
+        p = lexer.position;
+        while (p < bytes_read && (line[p] == ' ' || line[p] == '\r' || line[p] == '\n')) {
+            p++;
+        }
+        g_free (line);
+        
+        sub.entries = offset + p;
+        g_array_append_val (section->subsections, sub);
+        
+        offset = sub.entries + sub.count * 20;
+        if (offset >= doc->file->size) {
+            break;
+        }
+    }
+    
+    pdf_section_free (section);
+    return NULL;
+}
+
+/* A cross-reference stream, whose dictionary is also the trailer */
+static PdfSection*
+pdf_load_stream (PdfDocument *doc, goffset offset, gchar **trailer, gsize *trailer_length)
+{
+    PdfSection *section;
+    PdfValue value;
+    gint64 widths[3], index[2 * 64], size;
+    gchar *dict;
+    gsize dict_length;
+    goffset data_offset;
+    guint n_widths, n_index, i;
+    guint64 rows = 0;
+    
+    dict = pdf_read_object_at (doc, offset, -1, &dict_length, &data_offset);
+    if (!dict) {
+        return NULL;
+    }
+    
+    if (!pdf_dict_lookup (dict, dict_length, "Type", &value) ||
+        !pdf_token_is (&value.token, PDF_TOKEN_NAME, "XRef") ||
+        !pdf_dict_lookup (dict, dict_length, "W", &value) ||
+        (n_widths = pdf_array_get_ints (&value, dict + dict_length, widths, 3)) != 3 ||
+        !pdf_dict_get_int (dict, dict_length, "Size", &size) || size <= 0) {
+        g_free (dict);
+        return NULL;
+    }
+    
+    section = g_new0 (PdfSection, 1);
+    section->subsections = g_array_new (FALSE, FALSE, sizeof (PdfSubsection));
+    for (i = 0; i < 3; i++) {
+        if (widths[i] < 0 || widths[i] > 8) {
+            goto invalid;
+        }
+        section->widths[i] = widths[i];
+        section->entry_size += widths[i];
+    }
+    if (section->entry_size == 0) {
+        goto invalid;
+    }
+    
+    /* Pairs of first object and count; all objects by default */
+    n_index = 0;
+    if (pdf_dict_lookup (dict, dict_length, "Index", &value)) {
+        n_index = pdf_array_get_ints (&value, dict + dict_length, index, G_N_ELEMENTS (index));
+    }
+    if (n_index < 2) {
+        index[0] = 0;
+        index[1] = size;
+        n_index = 2;
+    }
+    for (i = 0; i + 1 < n_index; i += 2) {
+        PdfSubsection sub;
+        
+        if (index[i] < 0 || index[i + 1] < 0) {
+            goto invalid;
+        }
+        sub.first = index[i];
+        sub.count = index[i + 1];
+        sub.entries = rows;
+        rows += sub.count;
+        g_array_append_val (section->subsections, sub);
+    }
+    
+    section->entries = pdf_read_stream (doc, dict, dict_length, data_offset,
+                                        &section->entries_length);
+    if (!section->entries) {
+        goto invalid;
+    }
+    
+    *trailer = dict;
+    *trailer_length = dict_length;
+    return section;
+    
+invalid:
+    pdf_section_free (section);
+    g_free (dict);
+    return NULL;
+}
+
+static PdfSection*
+pdf_load_section (PdfDocument *doc, goffset offset, gchar **trailer, gsize *trailer_length)
+{
+    gchar *head;
+    gsize bytes_read, p = 0;
+    gboolean is_table;
+    
+    head = (gchar *)doc_read (doc->file, offset, 16, &bytes_read);
+    if (!head) {
+        return NULL;
+    }
+    while (p < bytes_read && pdf_is_space (head[p])) {
+        p++;
+    }
+    is_table = bytes_read - p >= 4 && memcmp (head + p, "xref", 4) == 0;
+    g_free (head);
+    
+    if (is_table) {
+        return pdf_load_table (doc, offset + p + 4, trailer, trailer_length);
+    }
+    return pdf_load_stream (doc, offset + p, trailer, trailer_length);
+}
+
+/* Follow startxref, then /Prev back through the earlier revisions.
+ * Files saved by hybrid writers also have /XRefStm, a stream section
+ * for the same revision that is looked at after the table. */
+static gboolean
+pdf_load_xref (PdfDocument *doc)
+{
+    gchar *tail, *found;
+    gsize bytes_read, p;
+    goffset offset;
+    GHashTable *seen;
+    guint n;
+    
+    tail = (gchar *)doc_read (doc->file, MAX (doc->file->size - DOC_TAIL_SIZE, 0),
+                              DOC_TAIL_SIZE, &bytes_read);
+    if (!tail) {
+        return FALSE;
+    }
+    /* The tail can hold binary stream data, so no string functions */
+    found = NULL;
+    for (p = bytes_read >= 9 ? bytes_read - 9 + 1 : 0; p-- > 0; ) {
+        if (memcmp (tail + p, "startxref", 9) == 0) {
+            found = tail + p + 9;
+            break;
+        }
+    }
+    offset = found ? g_ascii_strtoll (found, NULL, 10) : 0;
+    g_free (tail);
+    if (offset <= 0) {
+        return FALSE;
+    }
+    
+    seen = g_hash_table_new_full (g_int64_hash, g_int64_equal, g_free, NULL);
+    
+    for (n = 0; n < PDF_MAX_SECTIONS && offset > 0; n++) {
+        PdfSection *section;
+        gchar *trailer = NULL;
+        gsize trailer_length = 0;
+        gint64 next = 0, stream_offset;
+        
+        /* Broken files can point back at a section already read */
+        if (g_hash_table_contains (seen, &offset)) {
+            break;
+        }
+        g_hash_table_add (seen, g_memdup (&offset, sizeof (offset)));
+        
+        section = pdf_load_section (doc, offset, &trailer, &trailer_length);
+        if (!section) {
+            break;
+        }
+        g_ptr_array_add (doc->sections, section);
+        
+        if (pdf_dict_get_int (trailer, trailer_length, "XRefStm", &stream_offset) &&
+            stream_offset > 0) {
+            gchar *stream_trailer = NULL;
+            gsize stream_trailer_length;
+            PdfSection *stream_section;
+            
+            stream_section = pdf_load_stream (doc, stream_offset,
+                                              &stream_trailer, &stream_trailer_length);
+            if (stream_section) {
+                g_ptr_array_add (doc->sections, stream_section);
+                g_free (stream_trailer);
+            }
+        }
+        
+        pdf_dict_get_int (trailer, trailer_length, "Prev", &next);
+        
+        if (!doc->trailer) {
+            doc->trailer = trailer;
+            doc->trailer_length = trailer_length;
+        } else {
+            g_free (trailer);
+        }
+        offset = next;
+    }
+    
+    g_hash_table_destroy (seen);
+    
+    return doc->trailer != NULL;
+}
+
+/* === PDF metadata === */
+
+/* The value of /@key in @dict as text, following one reference */
+static gchar*
+pdf_dict_get_text (PdfDocument *doc, const gchar *dict, gsize dict_length, const gchar *key)
+{
+    PdfValue value;
+    PdfLexer lexer;
+    PdfToken token;
+    gchar *object, *text;
+    gsize length;
+    
+    if (!pdf_dict_lookup (dict, dict_length, key, &value)) {
+        return NULL;
+    }
+    if (!value.is_reference) {
+        return pdf_decode_text (&value.token);
+    }
+    
+    object = pdf_read_object (doc, value.number, &length, NULL);
+    if (!object) {
+        return NULL;
+    }
+    pdf_lexer_init (&lexer, object, length);
+    text = pdf_next_token (&lexer, &token) ? pdf_decode_text (&token) : NULL;
+    g_free (object);
+    
+    return text;
+}
+
+static void
+pdf_read_info (PdfDocument *doc, gint64 number, DocInfo *info)
+{
+    gchar *dict, *text;
+    gsize length;
+    
+    if (!(dict = pdf_read_object (doc, number, &length, NULL))) {
+        return;
+    }
+    
+    doc_take_string (&info->title, pdf_dict_get_text (doc, dict, length, "Title"));
+    doc_take_string (&info->author, pdf_dict_get_text (doc, dict, length, "Author"));
+    doc_take_string (&info->keywords, pdf_dict_get_text (doc, dict, length, "Keywords"));
+    /* The authoring application, else the one that made the PDF */
+    doc_take_string (&info->application, pdf_dict_get_text (doc, dict, length, "Creator"));
+    doc_take_string (&info->application, pdf_dict_get_text (doc, dict, length, "Producer"));
+    
+    if ((text = pdf_dict_get_text (doc, dict, length, "CreationDate"))) {
+        doc_take_date (&info->created, pdf_parse_date (text));
+        g_free (text);
+    }
+    if ((text = pdf_dict_get_text (doc, dict, length, "ModDate"))) {
+        doc_take_date (&info->modified, pdf_parse_date (text));
+        g_free (text);
+    }
+    
+    g_free (dict);
+}
+
+/* The XMP packet the catalog points at, which PDF 2.0 prefers to the
+ * Info dictionary */
+static void
+pdf_read_xmp (PdfDocument *doc, gint64 number, DocInfo *info)
+{
+    FinderzImageMetadata *xmp;
+    gchar *dict;
+    guint8 *packet;
+    gsize dict_length, packet_length;
+    goffset data_offset;
+    
+    dict = pdf_read_object (doc, number, &dict_length, &data_offset);
+    if (!dict) {
+        return;
+    }
+    packet = pdf_read_stream (doc, dict, dict_length, data_offset, &packet_length);
+    g_free (dict);
+    if (!packet) {
+        return;
+    }
+    
+    xmp = g_new0 (FinderzImageMetadata, 1);
+    finderz_xmp_parse_packet ((const gchar *)packet, packet_length, xmp);
+    g_free (packet);
+    
+    doc_take_string (&info->title, g_steal_pointer (&xmp->title));
+    doc_take_string (&info->author, g_steal_pointer (&xmp->creator));
+    if (!info->keywords && xmp->keywords) {
+        GString *keywords = g_string_new (NULL);
+        GList *l;
+        
+        for (l = xmp->keywords; l; l = l->next) {
+            g_string_append_printf (keywords, "%s%s", keywords->len ? ", " : "",
+                                    (const gchar *)l->data);
+        }
+        info->keywords = g_string_free (keywords, FALSE);
+    }
+    
+    finderz_image_metadata_free (xmp);
+}
+
+static gboolean
+probe_pdf (DocFile *file, DocInfo *info)
+{
+    PdfDocument doc = { 0 };
+    PdfValue value;
+    gint64 info_number, root_number, pages_number, count;
+    gchar *root;
+    gsize root_length;
+    
+    doc.file = file;
+    doc.sections = g_ptr_array_new_with_free_func ((GDestroyNotify)pdf_section_free);
+    doc.object_stream = -1;
+    
+    if (!pdf_load_xref (&doc)) {
+        g_ptr_array_unref (doc.sections);
+        return FALSE;
+    }
+    
+    /* Strings and streams of encrypted files can't be read without
+     * the key, but numbers can */
+    doc.encrypted = pdf_dict_lookup (doc.trailer, doc.trailer_length, "Encrypt", &value);
+    
+    if (!doc.encrypted &&
+        pdf_dict_get_reference (doc.trailer, doc.trailer_length, "Info", &info_number)) {
+        pdf_read_info (&doc, info_number, info);
+    }
+    
+    if (pdf_dict_get_reference (doc.trailer, doc.trailer_length, "Root", &root_number) &&
+        (root = pdf_read_object (&doc, root_number, &root_length, NULL))) {
+        gchar *pages;
+        gsize pages_length;
+        gint64 metadata_number;
+        
+        /* The root of the page tree counts every page below it */
+        if (pdf_dict_get_reference (root, root_length, "Pages", &pages_number) &&
+            (pages = pdf_read_object (&doc, pages_number, &pages_length, NULL))) {
+            if (pdf_dict_get_int (pages, pages_length, "Count", &count) && count > 0) {
+                info->pages = count;
+            }
+            g_free (pages);
+        }
+        
+        if (!doc.encrypted &&
+            pdf_dict_get_reference (root, root_length, "Metadata", &metadata_number)) {
+            pdf_read_xmp (&doc, metadata_number, info);
+        }
+        g_free (root);
+    }
+    
+    g_ptr_array_unref (doc.sections);
+    g_free (doc.trailer);
+    g_free (doc.object_stream_data);
+    
+    return TRUE;
+}
+
+/* === OOXML and OpenDocument === */
+
+typedef enum {
+    OFFICE_FIELD_NONE,
+    OFFICE_FIELD_TITLE,
+    OFFICE_FIELD_CREATOR,           /* the author in OOXML, the last editor in ODF */
+    OFFICE_FIELD_INITIAL_CREATOR,
+    OFFICE_FIELD_KEYWORDS,
+    OFFICE_FIELD_CREATED,
+    OFFICE_FIELD_MODIFIED,
+    OFFICE_FIELD_APPLICATION,
+    OFFICE_FIELD_PAGES,
+    OFFICE_FIELD_SLIDES
+} OfficeField;
+
+/* Elements by local name: docProps/core.xml and app.xml of OOXML, and
+ * meta.xml of OpenDocument, use distinct names for what they share */
+static const struct {
+    const gchar *name;
+    OfficeField field;
+} office_elements[] = {
+    { "title",           OFFICE_FIELD_TITLE },
+    { "creator",         OFFICE_FIELD_CREATOR },
+    { "initial-creator", OFFICE_FIELD_INITIAL_CREATOR },
+    { "keywords",        OFFICE_FIELD_KEYWORDS },
+    { "keyword",         OFFICE_FIELD_KEYWORDS },
+    { "created",         OFFICE_FIELD_CREATED },
+    { "creation-date",   OFFICE_FIELD_CREATED },
+    { "modified",        OFFICE_FIELD_MODIFIED },
+    { "date",            OFFICE_FIELD_MODIFIED },
+    { "Application",     OFFICE_FIELD_APPLICATION },
+    { "generator",       OFFICE_FIELD_APPLICATION },
+    { "Pages",           OFFICE_FIELD_PAGES },
+    { "Slides",          OFFICE_FIELD_SLIDES },
+};
+
+typedef struct {
+    DocInfo *info;
+    OfficeField field;
+    GString *text;
+    gchar *creator;             /* used if there is no initial creator */
+    gint64 slides;
+} OfficeParser;
+
+static const gchar*
+office_local_name (const gchar *name)
+{
+    const gchar *colon = strchr (name, ':');
+    
+    return colon ? colon + 1 : name;
+}
+
+static void
+office_start_element (GMarkupParseContext *context,
+                      const gchar *element_name,
+                      const gchar **attribute_names,
+                      const gchar **attribute_values,
+                      gpointer user_data,
+                      GError **error)
+{
+    OfficeParser *parser = user_data;
+    const gchar *local = office_local_name (element_name);
+    guint i;
+    
+    /* OpenDocument gives its counts as attributes */
+    if (strcmp (local, "document-statistic") == 0) {
+        for (i = 0; attribute_names[i]; i++) {
+            if (strcmp (office_local_name (attribute_names[i]), "page-count") == 0 &&
+                parser->info->pages == 0) {
+                parser->info->pages = MAX (g_ascii_strtoll (attribute_values[i], NULL, 10), 0);
+            }
+        }
+        return;
+    }
+    
+    parser->field = OFFICE_FIELD_NONE;
+    for (i = 0; i < G_N_ELEMENTS (office_elements); i++) {
+        if (strcmp (local, office_elements[i].name) == 0) {
+            parser->field = office_elements[i].field;
+            g_string_truncate (parser->text, 0);
+            break;
+        }
+    }
+}
+
+static void
+office_end_element (GMarkupParseContext *context,
+                    const gchar *element_name,
+                    gpointer user_data,
+                    GError **error)
+{
+    OfficeParser *parser = user_data;
+    DocInfo *info = parser->info;
+    gchar *text;
+    
+    if (parser->field == OFFICE_FIELD_NONE) {
+        return;
+    }
+    
+    text = g_strstrip (g_strdup (parser->text->str));
+    
+    switch (parser->field) {
+        case OFFICE_FIELD_TITLE:
+            doc_take_string (&info->title, text);
+            text = NULL;
+            break;
+        case OFFICE_FIELD_CREATOR:
+            doc_take_string (&parser->creator, text);
+            text = NULL;
+            break;
+        case OFFICE_FIELD_INITIAL_CREATOR:
+            doc_take_string (&info->author, text);
+            text = NULL;
+            break;
+        case OFFICE_FIELD_KEYWORDS:
+            /* OpenDocument has one element per keyword */
+            if (*text && info->keywords) {
+                gchar *joined = g_strconcat (info->keywords, ", ", text, NULL);
+                
+                g_free (info->keywords);
+                info->keywords = joined;
+            } else {
+                doc_take_string (&info->keywords, text);
+                text = NULL;
+            }
+            break;
+        case OFFICE_FIELD_CREATED:
+            doc_take_date (&info->created, doc_parse_iso8601 (text));
+            break;
+        case OFFICE_FIELD_MODIFIED:
+            doc_take_date (&info->modified, doc_parse_iso8601 (text));
+            break;
+        case OFFICE_FIELD_APPLICATION:
+            doc_take_string (&info->application, text);
+            text = NULL;
+            break;
+        case OFFICE_FIELD_PAGES:
+            if (info->pages == 0) {
+                info->pages = MAX (g_ascii_strtoll (text, NULL, 10), 0);
+            }
+            break;
+        case OFFICE_FIELD_SLIDES:
+            parser->slides = MAX (g_ascii_strtoll (text, NULL, 10), 0);
+            break;
+        case OFFICE_FIELD_NONE:
+            break;
+    }
+    
+    g_free (text);
+    parser->field = OFFICE_FIELD_NONE;
+}
+
+static void
+office_text (GMarkupParseContext *context,
+             const gchar *text,
+             gsize text_len,
+             gpointer user_data,
+             GError **error)
+{
+    OfficeParser *parser = user_data;
+    
+    if (parser->field != OFFICE_FIELD_NONE) {
+        g_string_append_len (parser->text, text, text_len);
+    }
+}
+
+static const GMarkupParser office_markup_parser = {
+    office_start_element,
+    office_end_element,
+    office_text,
+    NULL,
+    NULL
+};
+
+static void
+office_parse_xml (const gchar *xml, gsize length, DocInfo *info)
+{
+    GMarkupParseContext *context;
+    OfficeParser parser = { 0 };
+    
+    parser.info = info;
+    parser.text = g_string_new (NULL);
+    
+    context = g_markup_parse_context_new (&office_markup_parser, 0, &parser, NULL);
+    if (g_markup_parse_context_parse (context, xml, length, NULL)) {
+        g_markup_parse_context_end_parse (context, NULL);
+    }
+    g_markup_parse_context_free (context);
+    
+    doc_take_string (&info->author, parser.creator);
+    if (info->pages == 0) {
+        info->pages = parser.slides;
+    }
+    g_string_free (parser.text, TRUE);
+}
+
+/* The end of central directory record: where the directory is and how
+ * large.  Archives over 4 GB keep the real values in a ZIP64 record
+ * that a locator just before it points at. */
+static gboolean
+zip_find_directory (DocFile *file, goffset *directory_offset, gsize *directory_size)
+{
+    guint8 *tail;
+    gsize bytes_read, tail_size = DOC_TAIL_SIZE;
+    goffset tail_offset, end_offset = -1;
+    guint64 offset, size;
+    gsize i;
+    
+    while (TRUE) {
+        tail_size = MIN ((goffset)tail_size, file->size);
+        tail_offset = file->size - tail_size;
+        tail = doc_read (file, tail_offset, tail_size, &bytes_read);
+        if (!tail || bytes_read < 22) {
+            g_free (tail);
+            return FALSE;
+        }
+        
+        for (i = bytes_read - 22 + 1; i-- > 0; ) {
+            if (memcmp (tail + i, "PK\005\006", 4) == 0) {
+                end_offset = tail_offset + i;
+                break;
+            }
+        }
+        if (end_offset >= 0 || tail_size >= ZIP_MAX_TAIL_SIZE || tail_offset == 0) {
+            break;
+        }
+        
+        /* An archive comment pushed the record further back */
+        g_free (tail);
+        tail_size = ZIP_MAX_TAIL_SIZE;
+    }
+    
+    if (end_offset < 0) {
+        g_free (tail);
+        return FALSE;
+    }
+    
+    size = le32 (tail + (end_offset - tail_offset) + 12);
+    offset = le32 (tail + (end_offset - tail_offset) + 16);
+    g_free (tail);
+    
+    if (size == G_MAXUINT32 || offset == G_MAXUINT32) {
+        guint8 *record;
+        
+        record = doc_read (file, end_offset - 20, 20, &bytes_read);
+        if (!record || bytes_read < 20 || memcmp (record, "PK\006\007", 4) != 0) {
+            g_free (record);
+            return FALSE;
+        }
+        offset = le64 (record + 8);
+        g_free (record);
+        
+        record = doc_read (file, offset, 56, &bytes_read);
+        if (!record || bytes_read < 56 || memcmp (record, "PK\006\006", 4) != 0) {
+            g_free (record);
+            return FALSE;
+        }
+        size = le64 (record + 40);
+        offset = le64 (record + 48);
+        g_free (record);
+    }
+    
+    if (size > ZIP_MAX_DIRECTORY_SIZE || offset >= (guint64)file->size) {
+        return FALSE;
+    }
+    
+    *directory_offset = offset;
+    *directory_size = size;
+    return TRUE;
+}
+
+/* The uncompressed data of the member whose local header is at
+ * @offset; only stored and deflated members are read */
+static gchar*
+zip_read_member (DocFile *file, goffset offset, guint16 method,
+                 guint64 compressed_size, gsize *length)
+{
+    guint8 *header, *data;
+    gsize bytes_read;
+    goffset data_offset;
+    gchar *text;
+    
+    if (compressed_size > ZIP_MAX_MEMBER_SIZE || (method != 0 && method != 8)) {
+        return NULL;
+    }
+    
+    header = doc_read (file, offset, 30, &bytes_read);
+    if (!header || bytes_read < 30 || memcmp (header, "PK\003\004", 4) != 0) {
+        g_free (header);
+        return NULL;
+    }
+    data_offset = offset + 30 + le16 (header + 26) + le16 (header + 28);
+    g_free (header);
+    
+    data = doc_read (file, data_offset, compressed_size, &bytes_read);
+    if (!data || bytes_read < compressed_size) {
+        g_free (data);
+        return NULL;
+    }
+    
+    if (method == 0) {
+        *length = bytes_read;
+        return (gchar *)data;
+    }
+    
+    text = (gchar *)doc_inflate (data, bytes_read, G_ZLIB_COMPRESSOR_FORMAT_RAW,
+                                 ZIP_MAX_XML_SIZE, length);
+    g_free (data);
+    return text;
+}
+
+/* Walk the central directory for the metadata members and parse them */
+static gboolean
+probe_office (DocFile *file, DocInfo *info)
+{
+    guint8 *directory;
+    goffset directory_offset;
+    gsize directory_size, bytes_read, p = 0;
+    gboolean found = FALSE;
+    
+    if (!zip_find_directory (file, &directory_offset, &directory_size) ||
+        !(directory = doc_read (file, directory_offset, directory_size, &bytes_read))) {
+        return FALSE;
+    }
+    
+    while (p + 46 <= bytes_read && memcmp (directory + p, "PK\001\002", 4) == 0) {
+        const guint8 *entry = directory + p;
+        guint16 name_length = le16 (entry + 28);
+        const gchar *name = (const gchar *)entry + 46;
+        
+        if (p + 46 + name_length > bytes_read) {
+            break;
+        }
+        
+        if ((name_length == strlen ("docProps/core.xml") &&
+             memcmp (name, "docProps/core.xml", name_length) == 0) ||
+            (name_length == strlen ("docProps/app.xml") &&
+             memcmp (name, "docProps/app.xml", name_length) == 0) ||
+            (name_length == strlen ("meta.xml") &&
+             memcmp (name, "meta.xml", name_length) == 0)) {
+            gchar *xml;
+            gsize xml_length;
+            
+            xml = zip_read_member (file, le32 (entry + 42), le16 (entry + 10),
+                                   le32 (entry + 20), &xml_length);
+            if (xml) {
+                office_parse_xml (xml, xml_length, info);
+                g_free (xml);
+            }
+            found = TRUE;
+        }
+        
+        p += 46 + name_length + le16 (entry + 30) + le16 (entry + 32);
+    }
+    
+    g_free (directory);
+    return found;
+}
+
+/* === Public API === */
+
+static void
+doc_info_apply (const DocInfo *info, FinderzUniversalMetadata *metadata)
+{
+    if (info->title) {
+        finderz_metadata_set_string (metadata, FINDERZ_FIELD_DOC_TITLE, info->title);
+    }
+    if (info->author) {
+        finderz_metadata_set_string (metadata, FINDERZ_FIELD_DOC_AUTHOR, info->author);
+    }
+    if (info->pages > 0) {
+        finderz_metadata_set_int (metadata, FINDERZ_FIELD_DOC_PAGES, info->pages);
+    }
+    if (info->created) {
+        finderz_metadata_set_date (metadata, FINDERZ_FIELD_DOC_CREATED, info->created);
+    }
+    if (info->modified) {
+        finderz_metadata_set_date (metadata, FINDERZ_FIELD_DOC_MODIFIED, info->modified);
+    }
+    if (info->application) {
+        finderz_metadata_set_string (metadata, FINDERZ_FIELD_DOC_APPLICATION, info->application);
+    }
+    if (info->keywords) {
+        finderz_metadata_set_string (metadata, FINDERZ_FIELD_KEYWORDS, info->keywords);
+    }
+}
+
+static gboolean
+has_extension_in (const gchar *file_path, const gchar **extensions, gsize n_extensions)
+{
+    const gchar *dot;
+    gsize i;
+    
+    if (!file_path || !(dot = strrchr (file_path, '.'))) {
+        return FALSE;
+    }
+    
+    for (i = 0; i < n_extensions; i++) {
+        if (g_ascii_strcasecmp (dot + 1, extensions[i]) == 0) {
+            return TRUE;
+        }
+    }
+    
+    return FALSE;
+}
+
+gboolean
+finderz_document_probe_supports (const gchar *file_path)
+{
+    return has_extension_in (file_path, pdf_extensions, G_N_ELEMENTS (pdf_extensions)) ||
+           has_extension_in (file_path, office_extensions, G_N_ELEMENTS (office_extensions));
+}
+
+gboolean
+finderz_document_probe (const gchar *file_path, FinderzUniversalMetadata *metadata)
+{
+    DocFile file;
+    DocInfo info = { 0 };
+    guint8 *head;
+    gsize bytes_read;
+    gboolean found = FALSE;
+    
+    if (!file_path || !metadata || !doc_file_open (&file, file_path)) {
+        return FALSE;
+    }
+    
+    /* Sniff the format rather than trust the extension */
+    head = doc_read (&file, 0, 5, &bytes_read);
+    if (head && bytes_read == 5) {
+        if (memcmp (head, "%PDF-", 5) == 0) {
+            found = probe_pdf (&file, &info);
+        } else if (memcmp (head, "PK\003\004", 4) == 0) {
+            found = probe_office (&file, &info);
+        }
+    }
+    g_free (head);
+    
+    if (found) {
+        doc_info_apply (&info, metadata);
+    } else {
+        g_debug ("FINDERZ: No document metadata found in %s", file_path);
+    }
+    
+    g_free (info.title);
+    g_free (info.author);
+    g_free (info.keywords);
+    g_free (info.application);
+    if (info.created) {
+        g_date_time_unref (info.created);
+    }
+    if (info.modified) {
+        g_date_time_unref (info.modified);
+    }
+    g_object_unref (file.stream);
+    
+    return found;
+}
@@ -0,0 +1,28 @@
+/* finderz-document-probe.h
+ *
+ * Title, author and page count of PDF and office documents
+ */
+
+#ifndef FINDERZ_DOCUMENT_PROBE_H
+#define FINDERZ_DOCUMENT_PROBE_H
+
+#include <glib.h>
+#include "finderz-universal-metadata.h"
+
+G_BEGIN_DECLS
+
+/* Whether @file_path's extension names a document the prober reads */
+gboolean finderz_document_probe_supports (const gchar *file_path);
+
+/* Add the title, author, page count, dates and authoring application
+ * of the PDF, OOXML or OpenDocument file at @file_path to @metadata.
+ * Both formats are read from the end: a PDF through its trailer and
+ * cross-reference data, an office file through the ZIP central
+ * directory, so a few KB are read whatever the size of the document.
+ * Returns FALSE if the file is neither. */
+gboolean finderz_document_probe (const gchar *file_path,
+                                 FinderzUniversalMetadata *metadata);
+
+G_END_DECLS
+
+#endif /* FINDERZ_DOCUMENT_PROBE_H */
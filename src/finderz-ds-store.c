@@ -1,19 +1,48 @@
 /* finderz-ds-store.c
- * 
+ *
  * Implementation of .DS_Store file parser for Finderz
+ *
+ * A .DS_Store file is a "buddy allocator" holding a single B-tree (the
+ * "DSDB" entry of the allocator's table of contents).  The file is
+ * memory-mapped and every block, node and record is decoded in place;
+ * nothing is copied to the heap except the values we keep.
+ *
+ * In lazy mode the file is copied to the heap after parsing, since a
+ * mapping kept open faults if the file is truncated underneath it, and
+ * per-file records are found by descending the tree, whose records are
+ * sorted by case-folded filename, the first time a name is asked for.
+ *
+ * Parsed data is cached per directory and revalidated with a single
+ * stat: an entry is only reused while the .DS_Store keeps the same
+ * device, inode, mtime and size.  Entries are evicted least recently
+ * used first once their estimated footprint exceeds the byte budget.
  */
 
 #include "finderz-ds-store.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
-#include <arpa/inet.h>
+#include <errno.h>
+#include <glib/gstdio.h>
 
 /* DS_Store file structure constants */
 #define DS_STORE_MAGIC_1 0x00000001
 #define DS_STORE_MAGIC_2 "Bud1"
 #define DS_STORE_BLOCK_SIZE 4096
 
+/* The allocator header follows the 4-byte file magic; every offset
+ * stored in the file is relative to this position. */
+#define DS_STORE_ALLOCATOR_OFFSET 4
+#define DS_STORE_ALLOCATOR_HEADER_SIZE 32
+
+/* Guard against corrupt or hostile trees */
+#define DS_STORE_MAX_TREE_DEPTH 32
+#define DS_STORE_MAX_NAME_LENGTH 1024
+
+/* Cache sizing; a lazy entry costs about as much as its file */
+#define DS_STORE_CACHE_BUDGET (8 * 1024 * 1024)
+#define DS_STORE_ENTRY_COST 64
+
 /* Record type codes found in DS_Store files */
 #define DS_STORE_CODE_ILOC "Iloc"  /* Icon location */
 #define DS_STORE_CODE_BWSP "bwsp"  /* Browser window settings plist */
@@ -21,27 +50,112 @@
 #define DS_STORE_CODE_LSVP_CAP "lsvP"  /* List view settings plist (alternate) */
 #define DS_STORE_CODE_ICVP "icvp"  /* Icon view settings plist */
 #define DS_STORE_CODE_VMOD "vmod"  /* View mode */
+#define DS_STORE_CODE_FWI0 "fwi0"  /* Legacy Finder window info */
+#define DS_STORE_CODE_CMMT "cmmt"  /* Spotlight comment */
+
+/* Record data type codes */
+#define DS_STORE_TYPE_BOOL "bool"
+#define DS_STORE_TYPE_LONG "long"
+#define DS_STORE_TYPE_SHOR "shor"
+#define DS_STORE_TYPE_TYPE "type"
+#define DS_STORE_TYPE_COMP "comp"
+#define DS_STORE_TYPE_DUTC "dutc"
+#define DS_STORE_TYPE_BLOB "blob"
+#define DS_STORE_TYPE_USTR "ustr"
+
+/* Identity of a .DS_Store on disk; any difference forces a re-parse */
+typedef struct {
+    guint64 device;
+    guint64 inode;
+    gint64 mtime_nsec;
+    gint64 size;
+} DSStoreFileKey;
+
+typedef struct {
+    gchar *directory_path;
+    DSStoreFileKey key;
+    FinderzDSStoreData *data; /* NULL when the file is known to be unparsable */
+    gsize cost;
+    GList *lru_link;
+} DSStoreCacheEntry;
 
 struct _FinderzDSStore {
     GObject parent_instance;
-    GHashTable *cache; /* directory_path -> FinderzDSStoreData */
+    GHashTable *cache; /* directory_path -> DSStoreCacheEntry */
+    GQueue lru; /* most recently used first */
+    gsize cache_bytes;
+    gsize cache_budget;
 };
 
 struct _FinderzDSStoreClass {
     GObjectClass parent_class;
 };
 
+/* Allocator view over the mapped file */
+typedef struct {
+    const guchar *base;        /* allocator start (file offset 4) */
+    gsize length;              /* bytes available from base */
+    const guchar *offsets;     /* block address table, big-endian */
+    guint32 n_blocks;
+} DSStoreAllocator;
+
+/* One B-tree record, pointing into the mapping */
+typedef struct {
+    const guchar *name;        /* UTF-16BE, not terminated */
+    guint32 name_length;       /* in UTF-16 code units */
+    const guchar *code;        /* 4 bytes */
+    const guchar *type;        /* 4 bytes */
+    const guchar *value;
+    gsize value_length;
+} DSStoreRecord;
+
+typedef gboolean (*DSStoreRecordFunc) (const DSStoreRecord *record,
+                                       gpointer user_data);
+
+/* Private copy of the tree kept alive for lazy lookups */
+struct _FinderzDSStoreTree {
+    GBytes *contents;
+    DSStoreAllocator allocator;
+    guint32 root_node;
+};
+
+typedef enum {
+    SEARCH_CONTINUE,
+    SEARCH_DONE,
+    SEARCH_ERROR
+} DSStoreSearchResult;
+
+/* Folder settings seen while walking the tree; strings point into the map */
+typedef struct {
+    FinderzDSStoreData *data;
+    gboolean have_view_style;
+    const gchar *arrange_by;
+    gsize arrange_by_length;
+    const gchar *list_sort_column;
+    gsize list_sort_column_length;
+} DSStoreParseState;
+
 G_DEFINE_TYPE (FinderzDSStore, finderz_ds_store, G_TYPE_OBJECT)
 
+static void
+cache_entry_free (DSStoreCacheEntry *entry)
+{
+    g_free (entry->directory_path);
+    finderz_ds_store_data_unref (entry->data);
+    g_free (entry);
+}
+
 static void
 finderz_ds_store_finalize (GObject *object)
 {
     FinderzDSStore *self = (FinderzDSStore *)object;
-    
+
     if (self->cache) {
         g_hash_table_destroy (self->cache);
     }
-    
+
+    g_queue_clear (&self->lru);
+
     G_OBJECT_CLASS (finderz_ds_store_parent_class)->finalize (object);
 }
 
@@ -55,109 +169,1054 @@ finderz_ds_store_class_init (FinderzDSStoreClass *klass)
 static void
 finderz_ds_store_init (FinderzDSStore *self)
 {
+    /* Entries own their key; the table only indexes them */
     self->cache = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                          g_free,
-                                          (GDestroyNotify)finderz_ds_store_data_free);
+                                          NULL,
+                                          (GDestroyNotify)cache_entry_free);
+    g_queue_init (&self->lru);
+    self->cache_budget = DS_STORE_CACHE_BUDGET;
 }
 
 FinderzDSStore*
 finderz_ds_store_new (void)
 {
-    return g_object_new (G_TYPE_OBJECT, NULL);
+    return g_object_new (FINDERZ_TYPE_DS_STORE, NULL);
 }
 
-void
-finderz_ds_store_data_free (FinderzDSStoreData *data)
+static void
+ds_store_data_free (FinderzDSStoreData *data)
 {
-    if (!data) return;
-    
     g_free (data->sort_column);
     g_free (data->background_image_path);
-    
+
     if (data->icon_locations) {
         g_hash_table_destroy (data->icon_locations);
     }
-    
-    if (data->color_labels) {
-        g_hash_table_destroy (data->color_labels);
+
+    if (data->comments) {
+        g_hash_table_destroy (data->comments);
+    }
+
+    if (data->tree) {
+        g_bytes_unref (data->tree->contents);
+        g_free (data->tree);
     }
-    
+
     g_free (data);
 }
 
+FinderzDSStoreData*
+finderz_ds_store_data_ref (FinderzDSStoreData *data)
+{
+    g_return_val_if_fail (data != NULL, NULL);
+
+    g_atomic_int_inc (&data->ref_count);
+
+    return data;
+}
+
+void
+finderz_ds_store_data_unref (FinderzDSStoreData *data)
+{
+    if (!data) return;
+
+    if (g_atomic_int_dec_and_test (&data->ref_count)) {
+        ds_store_data_free (data);
+    }
+}
+
+/* Unaligned big-endian reads straight from the mapping */
+static inline guint32
+read_be32 (const guchar *p)
+{
+    return ((guint32)p[0] << 24) | ((guint32)p[1] << 16) |
+           ((guint32)p[2] << 8) | (guint32)p[3];
+}
+
+static inline guint64
+read_be_uint (const guchar *p, guint size)
+{
+    guint64 value = 0;
+
+    while (size--) {
+        value = (value << 8) | *p++;
+    }
+
+    return value;
+}
+
+static inline gboolean
+code_equals (const guchar *code, const gchar *expected)
+{
+    return memcmp (code, expected, 4) == 0;
+}
+
 static gboolean
-read_ds_store_header (FILE *file, GError **error)
+read_ds_store_header (const guchar *contents,
+                      gsize length,
+                      DSStoreAllocator *allocator,
+                      guint32 *root_offset,
+                      guint32 *root_size,
+                      GError **error)
 {
     guint32 magic1;
-    char magic2[4];
-    guint32 offset_info[3];
-    
-    /* Read first magic number (should be 0x00000001) */
-    if (fread (&magic1, sizeof(guint32), 1, file) != 1) {
-        g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                     "Failed to read DS_Store magic number 1");
+    guint32 offset2;
+
+    if (length < DS_STORE_ALLOCATOR_OFFSET + DS_STORE_ALLOCATOR_HEADER_SIZE) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                     "DS_Store file is truncated (%" G_GSIZE_FORMAT " bytes)",
+                     length);
         return FALSE;
     }
-    
-    /* Convert from big-endian */
-    magic1 = ntohl(magic1);
+
+    magic1 = read_be32 (contents);
     if (magic1 != DS_STORE_MAGIC_1) {
-        g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
                      "Invalid DS_Store magic number 1: 0x%08x", magic1);
         return FALSE;
     }
-    
-    /* Read "Bud1" magic string */
-    if (fread (magic2, 1, 4, file) != 4) {
-        g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                     "Failed to read DS_Store magic number 2");
+
+    if (memcmp (contents + 4, DS_STORE_MAGIC_2, 4) != 0) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                     "Invalid DS_Store file format - expected 'Bud1'");
         return FALSE;
     }
-    
-    if (memcmp (magic2, DS_STORE_MAGIC_2, 4) != 0) {
-        g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                     "Invalid DS_Store file format - expected 'Bud1'");
+
+    allocator->base = contents + DS_STORE_ALLOCATOR_OFFSET;
+    allocator->length = length - DS_STORE_ALLOCATOR_OFFSET;
+
+    /* The root block offset is stored twice as a consistency check */
+    *root_offset = read_be32 (allocator->base + 4);
+    *root_size = read_be32 (allocator->base + 8);
+    offset2 = read_be32 (allocator->base + 12);
+
+    if (*root_offset != offset2) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                     "DS_Store root block offsets disagree (0x%x vs 0x%x)",
+                     *root_offset, offset2);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* Resolve a block number to its bytes inside the mapping */
+static const guchar *
+allocator_get_block (const DSStoreAllocator *allocator,
+                     guint32 block,
+                     gsize *size)
+{
+    guint32 address;
+    guint32 offset;
+    gsize block_size;
+
+    if (block >= allocator->n_blocks) {
+        return NULL;
+    }
+
+    /* Low five bits are log2 of the block size, the rest the offset */
+    address = read_be32 (allocator->offsets + (gsize)block * 4);
+    offset = address & ~0x1fU;
+    block_size = (gsize)1 << (address & 0x1f);
+
+    if (offset >= allocator->length ||
+        block_size > allocator->length - offset) {
+        return NULL;
+    }
+
+    *size = block_size;
+    return allocator->base + offset;
+}
+
+/* Parse the allocator's root block and find the DSDB tree header */
+static gboolean
+allocator_find_dsdb (DSStoreAllocator *allocator,
+                     guint32 root_offset,
+                     guint32 root_size,
+                     guint32 *dsdb_block,
+                     GError **error)
+{
+    const guchar *p, *end;
+    guint32 n_entries, i;
+    gsize table_size;
+
+    if (root_offset >= allocator->length ||
+        root_size > allocator->length - root_offset ||
+        root_size < 12) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                     "DS_Store root block lies outside the file");
+        return FALSE;
+    }
+
+    p = allocator->base + root_offset;
+    end = p + root_size;
+
+    allocator->n_blocks = read_be32 (p);
+    p += 8; /* block count, then an unused word */
+
+    /* The address table is padded to a multiple of 256 entries */
+    table_size = (((gsize)allocator->n_blocks + 255) / 256) * 256 * 4;
+    if (table_size > (gsize)(end - p) - 4) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                     "DS_Store block table is truncated");
+        return FALSE;
+    }
+    allocator->offsets = p;
+    p += table_size;
+
+    /* Table of contents: (u8 length, name, u32 block) entries */
+    n_entries = read_be32 (p);
+    p += 4;
+
+    for (i = 0; i < n_entries; i++) {
+        guint name_length;
+
+        if (p >= end) break;
+        name_length = *p++;
+        if ((gsize)(end - p) < name_length + 4) break;
+
+        if (name_length == 4 && memcmp (p, "DSDB", 4) == 0) {
+            *dsdb_block = read_be32 (p + name_length);
+            return TRUE;
+        }
+        p += name_length + 4;
+    }
+
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                 "DS_Store file has no DSDB entry");
+    return FALSE;
+}
+
+/* Decode one record at *pp, advancing past it; all pointers stay in the map */
+static gboolean
+read_record (const guchar **pp,
+             const guchar *end,
+             DSStoreRecord *record)
+{
+    const guchar *p = *pp;
+    gsize name_bytes;
+
+    if ((gsize)(end - p) < 4) return FALSE;
+    record->name_length = read_be32 (p);
+    p += 4;
+
+    if (record->name_length > DS_STORE_MAX_NAME_LENGTH) return FALSE;
+    name_bytes = (gsize)record->name_length * 2;
+    if ((gsize)(end - p) < name_bytes + 8) return FALSE;
+
+    record->name = p;
+    p += name_bytes;
+    record->code = p;
+    record->type = p + 4;
+    p += 8;
+
+    if (code_equals (record->type, DS_STORE_TYPE_BOOL)) {
+        record->value_length = 1;
+    } else if (code_equals (record->type, DS_STORE_TYPE_LONG) ||
+               code_equals (record->type, DS_STORE_TYPE_SHOR) ||
+               code_equals (record->type, DS_STORE_TYPE_TYPE)) {
+        record->value_length = 4;
+    } else if (code_equals (record->type, DS_STORE_TYPE_COMP) ||
+               code_equals (record->type, DS_STORE_TYPE_DUTC)) {
+        record->value_length = 8;
+    } else if (code_equals (record->type, DS_STORE_TYPE_BLOB) ||
+               code_equals (record->type, DS_STORE_TYPE_USTR)) {
+        guint32 count;
+
+        if ((gsize)(end - p) < 4) return FALSE;
+        count = read_be32 (p);
+        p += 4;
+        record->value_length = code_equals (record->type, DS_STORE_TYPE_USTR) ?
+                               (gsize)count * 2 : count;
+    } else {
+        /* Unknown type: we cannot know its length, so the node is unusable */
+        return FALSE;
+    }
+
+    if ((gsize)(end - p) < record->value_length) return FALSE;
+    record->value = p;
+    *pp = p + record->value_length;
+
+    return TRUE;
+}
+
+/* In-order walk of the B-tree rooted at @node.  A sound tree uses each
+ * block once, so @visits starts at the block count and a tree whose
+ * children point back into it runs out instead of fanning out. */
+static gboolean
+walk_node (const DSStoreAllocator *allocator,
+           guint32 node,
+           guint depth,
+           guint32 *visits,
+           DSStoreRecordFunc func,
+           gpointer user_data)
+{
+    const guchar *p, *end;
+    gsize size;
+    guint32 rightmost, count, i;
+    DSStoreRecord record;
+
+    if (depth > DS_STORE_MAX_TREE_DEPTH || *visits == 0) {
+        return FALSE;
+    }
+    (*visits)--;
+
+    p = allocator_get_block (allocator, node, &size);
+    if (!p || size < 8) {
+        return FALSE;
+    }
+    end = p + size;
+
+    rightmost = read_be32 (p);
+    count = read_be32 (p + 4);
+    p += 8;
+
+    for (i = 0; i < count; i++) {
+        if (rightmost != 0) {
+            guint32 child;
+
+            if ((gsize)(end - p) < 4) return FALSE;
+            child = read_be32 (p);
+            p += 4;
+
+            if (!walk_node (allocator, child, depth + 1, visits, func, user_data)) {
+                return FALSE;
+            }
+        }
+
+        if (!read_record (&p, end, &record)) {
+            return FALSE;
+        }
+
+        if (!func (&record, user_data)) {
+            return FALSE;
+        }
+    }
+
+    if (rightmost != 0) {
+        return walk_node (allocator, rightmost, depth + 1, visits, func, user_data);
+    }
+
+    return TRUE;
+}
+
+/* Finder orders records by case-insensitive filename, then by code */
+static inline gunichar2
+fold_name_unit (gunichar2 unit)
+{
+    if (unit < 0x80) {
+        return g_ascii_tolower (unit);
+    }
+    if (unit >= 0xd800 && unit <= 0xdfff) {
+        return unit; /* surrogate halves compare as-is */
+    }
+    return (gunichar2)g_unichar_tolower (unit);
+}
+
+static gint
+compare_record_name (const DSStoreRecord *record,
+                     const gunichar2 *key,
+                     guint32 key_length)
+{
+    guint32 i, n = MIN (record->name_length, key_length);
+
+    for (i = 0; i < n; i++) {
+        gunichar2 unit = fold_name_unit ((gunichar2)((record->name[i * 2] << 8) |
+                                                     record->name[i * 2 + 1]));
+        if (unit != key[i]) {
+            return unit < key[i] ? -1 : 1;
+        }
+    }
+
+    if (record->name_length == key_length) {
+        return 0;
+    }
+    return record->name_length < key_length ? -1 : 1;
+}
+
+/* Visit every record named @key (pre-folded) below @node, in order.
+ * Subtrees whose separators show they cannot contain the key are
+ * skipped, so this costs one root-to-leaf descent plus the matches.
+ * @visits bounds the nodes entered, as for walk_node(). */
+static DSStoreSearchResult
+search_node (const DSStoreAllocator *allocator,
+             guint32 node,
+             guint depth,
+             guint32 *visits,
+             const gunichar2 *key,
+             guint32 key_length,
+             DSStoreRecordFunc func,
+             gpointer user_data)
+{
+    const guchar *p, *end;
+    gsize size;
+    guint32 rightmost, count, i;
+    DSStoreRecord record;
+    DSStoreSearchResult result;
+
+    if (depth > DS_STORE_MAX_TREE_DEPTH || *visits == 0) {
+        return SEARCH_ERROR;
+    }
+    (*visits)--;
+
+    p = allocator_get_block (allocator, node, &size);
+    if (!p || size < 8) {
+        return SEARCH_ERROR;
+    }
+    end = p + size;
+
+    rightmost = read_be32 (p);
+    count = read_be32 (p + 4);
+    p += 8;
+
+    for (i = 0; i < count; i++) {
+        guint32 child = 0;
+        gint cmp;
+
+        if (rightmost != 0) {
+            if ((gsize)(end - p) < 4) return SEARCH_ERROR;
+            child = read_be32 (p);
+            p += 4;
+        }
+
+        if (!read_record (&p, end, &record)) {
+            return SEARCH_ERROR;
+        }
+
+        cmp = compare_record_name (&record, key, key_length);
+        if (cmp < 0) {
+            /* Separator and everything left of it sort before the key */
+            continue;
+        }
+
+        if (rightmost != 0) {
+            result = search_node (allocator, child, depth + 1, visits,
+                                  key, key_length, func, user_data);
+            if (result != SEARCH_CONTINUE) {
+                return result;
+            }
+        }
+
+        if (cmp > 0) {
+            return SEARCH_DONE;
+        }
+
+        func (&record, user_data);
+    }
+
+    if (rightmost != 0) {
+        return search_node (allocator, rightmost, depth + 1, visits,
+                            key, key_length, func, user_data);
+    }
+
+    return SEARCH_CONTINUE;
+}
+
+static gboolean
+tree_search (FinderzDSStoreTree *tree,
+             const gchar *filename,
+             DSStoreRecordFunc func,
+             gpointer user_data)
+{
+    gunichar2 *key;
+    glong key_length, i;
+    guint32 visits;
+    DSStoreSearchResult result;
+
+    key = g_utf8_to_utf16 (filename, -1, NULL, &key_length, NULL);
+    if (!key || key_length > DS_STORE_MAX_NAME_LENGTH) {
+        g_free (key);
+        return FALSE;
+    }
+
+    for (i = 0; i < key_length; i++) {
+        key[i] = fold_name_unit (key[i]);
+    }
+
+    visits = tree->allocator.n_blocks;
+    result = search_node (&tree->allocator, tree->root_node, 0, &visits,
+                          key, (guint32)key_length, func, user_data);
+    g_free (key);
+
+    return result != SEARCH_ERROR;
+}
+
+/* Convert a record filename to UTF-8 */
+static gchar *
+record_name_to_utf8 (const DSStoreRecord *record)
+{
+    gunichar2 name[DS_STORE_MAX_NAME_LENGTH];
+    guint32 i;
+
+    for (i = 0; i < record->name_length; i++) {
+        name[i] = (gunichar2)((record->name[i * 2] << 8) | record->name[i * 2 + 1]);
+    }
+
+    return g_utf16_to_utf8 (name, record->name_length, NULL, NULL, NULL);
+}
+
+static gchar *
+ustr_to_utf8 (const guchar *value, gsize length)
+{
+    gunichar2 *text;
+    gchar *result;
+    gsize i, n_units = length / 2;
+
+    text = g_new (gunichar2, n_units + 1);
+    for (i = 0; i < n_units; i++) {
+        text[i] = (gunichar2)((value[i * 2] << 8) | value[i * 2 + 1]);
+    }
+
+    result = g_utf16_to_utf8 (text, n_units, NULL, NULL, NULL);
+    g_free (text);
+
+    return result;
+}
+
+static inline gboolean
+record_is_folder (const DSStoreRecord *record)
+{
+    /* Folder-wide settings are stored under the name "." */
+    return record->name_length == 1 &&
+           record->name[0] == 0 && record->name[1] == '.';
+}
+
+/* Minimal in-place reader for the binary plists (bplist00) embedded in
+ * bwsp/icvp/lsvp records.  Only top-level dictionary lookups of
+ * booleans, numbers and ASCII strings are needed. */
+typedef struct {
+    const guchar *data;
+    gsize length;
+    guint offset_size;
+    guint ref_size;
+    guint64 n_objects;
+    guint64 top_object;
+    guint64 offset_table;
+} DSStorePlist;
+
+static gboolean
+plist_init (DSStorePlist *plist, const guchar *data, gsize length)
+{
+    const guchar *trailer;
+
+    if (length < 8 + 32 || memcmp (data, "bplist00", 8) != 0) {
+        return FALSE;
+    }
+
+    trailer = data + length - 32;
+    plist->data = data;
+    plist->length = length;
+    plist->offset_size = trailer[6];
+    plist->ref_size = trailer[7];
+    plist->n_objects = read_be_uint (trailer + 8, 8);
+    plist->top_object = read_be_uint (trailer + 16, 8);
+    plist->offset_table = read_be_uint (trailer + 24, 8);
+
+    if (plist->offset_size < 1 || plist->offset_size > 8 ||
+        plist->ref_size < 1 || plist->ref_size > 8 ||
+        plist->top_object >= plist->n_objects ||
+        plist->offset_table >= length ||
+        plist->n_objects > (length - plist->offset_table) / plist->offset_size) {
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static const guchar *
+plist_get_object (const DSStorePlist *plist, guint64 ref)
+{
+    guint64 offset;
+
+    if (ref >= plist->n_objects) {
+        return NULL;
+    }
+
+    offset = read_be_uint (plist->data + plist->offset_table + ref * plist->offset_size,
+                           plist->offset_size);
+    if (offset >= plist->offset_table) {
+        return NULL;
+    }
+
+    return plist->data + offset;
+}
+
+/* Element count of a string/array/dict object and the start of its payload */
+static gboolean
+plist_get_count (const DSStorePlist *plist,
+                 const guchar *object,
+                 guint64 *count,
+                 const guchar **payload)
+{
+    const guchar *end = plist->data + plist->offset_table;
+    guint size;
+
+    *count = object[0] & 0x0f;
+    *payload = object + 1;
+
+    if (*count != 0x0f) {
+        return TRUE;
+    }
+
+    /* Long form: an integer object follows the marker */
+    if (*payload >= end || ((*payload)[0] & 0xf0) != 0x10) {
         return FALSE;
     }
-    
-    /* Read offset information (we don't use it yet, but validates file) */
-    if (fread (offset_info, sizeof(guint32), 3, file) != 3) {
-        g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                     "Failed to read DS_Store offset information");
+    size = 1U << ((*payload)[0] & 0x0f);
+    if (size > 8 || (gsize)(end - *payload) < size + 1) {
         return FALSE;
     }
-    
-    g_debug ("FINDERZ: Valid DS_Store header found - magic1=0x%08x, magic2='%c%c%c%c'",
-             magic1, magic2[0], magic2[1], magic2[2], magic2[3]);
-    
+    *count = read_be_uint (*payload + 1, size);
+    *payload += 1 + size;
+
     return TRUE;
 }
 
+static const guchar *
+plist_dict_lookup (const DSStorePlist *plist,
+                   const guchar *dict,
+                   const gchar *key)
+{
+    const guchar *end = plist->data + plist->offset_table;
+    const guchar *refs;
+    guint64 count, i;
+    gsize key_length = strlen (key);
+
+    if (!dict || (dict[0] & 0xf0) != 0xd0 ||
+        !plist_get_count (plist, dict, &count, &refs) ||
+        count > (guint64)(end - refs) / (2 * plist->ref_size)) {
+        return NULL;
+    }
+
+    for (i = 0; i < count; i++) {
+        const guchar *name, *chars;
+        guint64 name_length;
+
+        name = plist_get_object (plist, read_be_uint (refs + i * plist->ref_size,
+                                                      plist->ref_size));
+        if (!name || (name[0] & 0xf0) != 0x50 ||
+            !plist_get_count (plist, name, &name_length, &chars)) {
+            continue;
+        }
+
+        if (name_length == key_length &&
+            (gsize)(end - chars) >= key_length &&
+            memcmp (chars, key, key_length) == 0) {
+            return plist_get_object (plist,
+                                     read_be_uint (refs + (count + i) * plist->ref_size,
+                                                   plist->ref_size));
+        }
+    }
+
+    return NULL;
+}
+
+static gboolean
+plist_get_boolean (const guchar *object, gboolean *value)
+{
+    if (!object || (object[0] != 0x08 && object[0] != 0x09)) {
+        return FALSE;
+    }
+
+    *value = object[0] == 0x09;
+    return TRUE;
+}
+
+static gboolean
+plist_get_number (const DSStorePlist *plist, const guchar *object, gdouble *value)
+{
+    const guchar *end = plist->data + plist->offset_table;
+    guint size;
+
+    if (!object) {
+        return FALSE;
+    }
+
+    size = 1U << (object[0] & 0x0f);
+    if ((gsize)(end - object) < size + 1) {
+        return FALSE;
+    }
+
+    if ((object[0] & 0xf0) == 0x10 && size <= 8) {
+        *value = (gdouble)(gint64)read_be_uint (object + 1, size);
+        return TRUE;
+    }
+
+    if (object[0] == 0x22) {
+        union { guint32 i; gfloat f; } u;
+        u.i = read_be32 (object + 1);
+        *value = u.f;
+        return TRUE;
+    }
+
+    if (object[0] == 0x23) {
+        union { guint64 i; gdouble d; } u;
+        u.i = read_be_uint (object + 1, 8);
+        *value = u.d;
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+/* ASCII strings only; returns a pointer into the plist */
+static gboolean
+plist_get_ascii (const DSStorePlist *plist,
+                 const guchar *object,
+                 const gchar **value,
+                 gsize *length)
+{
+    const guchar *end = plist->data + plist->offset_table;
+    const guchar *chars;
+    guint64 count;
+
+    if (!object || (object[0] & 0xf0) != 0x50 ||
+        !plist_get_count (plist, object, &count, &chars) ||
+        count > (guint64)(end - chars)) {
+        return FALSE;
+    }
+
+    *value = (const gchar *)chars;
+    *length = count;
+    return TRUE;
+}
+
+static void
+parse_window_settings (DSStoreParseState *state, const DSStorePlist *plist)
+{
+    const guchar *top = plist_get_object (plist, plist->top_object);
+    const gchar *bounds;
+    gsize length;
+    gchar text[64];
+    gint x, y, width, height;
+
+    /* WindowBounds looks like "{{x, y}, {w, h}}" */
+    if (plist_get_ascii (plist, plist_dict_lookup (plist, top, "WindowBounds"),
+                         &bounds, &length) &&
+        length < sizeof (text)) {
+        memcpy (text, bounds, length);
+        text[length] = '\0';
+
+        if (sscanf (text, "{{%d, %d}, {%d, %d}}", &x, &y, &width, &height) == 4) {
+            state->data->window_bounds.x = x;
+            state->data->window_bounds.y = y;
+            state->data->window_bounds.width = width;
+            state->data->window_bounds.height = height;
+        }
+    }
+}
+
+static void
+parse_icon_view_settings (DSStoreParseState *state, const DSStorePlist *plist)
+{
+    const guchar *top = plist_get_object (plist, plist->top_object);
+    gboolean flag;
+    gdouble number;
+
+    if (plist_get_number (plist, plist_dict_lookup (plist, top, "iconSize"), &number)) {
+        state->data->icon_size = (gint)number;
+    }
+    if (plist_get_number (plist, plist_dict_lookup (plist, top, "textSize"), &number)) {
+        state->data->text_size = (gint)number;
+    }
+    if (plist_get_boolean (plist_dict_lookup (plist, top, "labelOnBottom"), &flag)) {
+        state->data->label_on_bottom = flag;
+    }
+    if (plist_get_boolean (plist_dict_lookup (plist, top, "showIconPreview"), &flag)) {
+        state->data->show_icon_preview = flag;
+    }
+    if (plist_get_boolean (plist_dict_lookup (plist, top, "showItemInfo"), &flag)) {
+        state->data->show_item_info = flag;
+    }
+
+    plist_get_ascii (plist, plist_dict_lookup (plist, top, "arrangeBy"),
+                     &state->arrange_by, &state->arrange_by_length);
+}
+
+static void
+parse_list_view_settings (DSStoreParseState *state, const DSStorePlist *plist)
+{
+    const guchar *top = plist_get_object (plist, plist->top_object);
+
+    plist_get_ascii (plist, plist_dict_lookup (plist, top, "sortColumn"),
+                     &state->list_sort_column, &state->list_sort_column_length);
+}
+
+static gboolean
+view_style_from_code (const guchar *code, FinderzViewStyle *style)
+{
+    if (code_equals (code, "icnv")) {
+        *style = FINDERZ_VIEW_ICON;
+    } else if (code_equals (code, "Nlsv")) {
+        *style = FINDERZ_VIEW_LIST;
+    } else if (code_equals (code, "clmv")) {
+        *style = FINDERZ_VIEW_COLUMN;
+    } else if (code_equals (code, "Flwv") || code_equals (code, "glyv")) {
+        *style = FINDERZ_VIEW_GALLERY;
+    } else {
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void
+parse_folder_record (DSStoreParseState *state, const DSStoreRecord *record)
+{
+    DSStorePlist plist;
+    FinderzViewStyle style;
+
+    if (code_equals (record->code, DS_STORE_CODE_VMOD)) {
+        if (code_equals (record->type, DS_STORE_TYPE_TYPE) &&
+            view_style_from_code (record->value, &style)) {
+            state->data->view_style = style;
+            state->have_view_style = TRUE;
+        }
+    } else if (code_equals (record->code, DS_STORE_CODE_FWI0)) {
+        /* Pre-10.5 window info: top, left, bottom, right, view code */
+        if (record->value_length >= 12) {
+            gint top = (gint16)((record->value[0] << 8) | record->value[1]);
+            gint left = (gint16)((record->value[2] << 8) | record->value[3]);
+            gint bottom = (gint16)((record->value[4] << 8) | record->value[5]);
+            gint right = (gint16)((record->value[6] << 8) | record->value[7]);
+
+            if (state->data->window_bounds.width == 0) {
+                state->data->window_bounds.x = left;
+                state->data->window_bounds.y = top;
+                state->data->window_bounds.width = right - left;
+                state->data->window_bounds.height = bottom - top;
+            }
+            /* vmod sorts after fwi0 and overrides this if present */
+            if (view_style_from_code (record->value + 8, &style)) {
+                state->data->view_style = style;
+            }
+        }
+    } else if (!code_equals (record->type, DS_STORE_TYPE_BLOB) ||
+               !plist_init (&plist, record->value, record->value_length)) {
+        return;
+    } else if (code_equals (record->code, DS_STORE_CODE_BWSP)) {
+        parse_window_settings (state, &plist);
+    } else if (code_equals (record->code, DS_STORE_CODE_ICVP)) {
+        parse_icon_view_settings (state, &plist);
+    } else if (code_equals (record->code, DS_STORE_CODE_LSVP) ||
+               code_equals (record->code, DS_STORE_CODE_LSVP_CAP)) {
+        parse_list_view_settings (state, &plist);
+    }
+}
+
+/* Store a per-file record under @name, or under the record's own name */
+static void
+parse_file_record (FinderzDSStoreData *data,
+                   const DSStoreRecord *record,
+                   const gchar *name)
+{
+    if (code_equals (record->code, DS_STORE_CODE_ILOC)) {
+        FinderzIconPosition *position;
+        gchar *key;
+
+        if (!code_equals (record->type, DS_STORE_TYPE_BLOB) ||
+            record->value_length < 8) {
+            return;
+        }
+
+        key = name ? g_strdup (name) : record_name_to_utf8 (record);
+        if (!key) return;
+
+        position = g_new (FinderzIconPosition, 1);
+        position->x = (gint32)read_be32 (record->value);
+        position->y = (gint32)read_be32 (record->value + 4);
+        g_hash_table_replace (data->icon_locations, key, position);
+    } else if (code_equals (record->code, DS_STORE_CODE_CMMT)) {
+        gchar *key, *comment;
+
+        if (!code_equals (record->type, DS_STORE_TYPE_USTR)) {
+            return;
+        }
+
+        key = name ? g_strdup (name) : record_name_to_utf8 (record);
+        comment = ustr_to_utf8 (record->value, record->value_length);
+        if (key && comment) {
+            g_hash_table_replace (data->comments, key, comment);
+        } else {
+            g_free (key);
+            g_free (comment);
+        }
+    }
+}
+
+static gboolean
+parse_record (const DSStoreRecord *record, gpointer user_data)
+{
+    DSStoreParseState *state = user_data;
+
+    if (record_is_folder (record)) {
+        parse_folder_record (state, record);
+    } else {
+        parse_file_record (state->data, record, NULL);
+    }
+
+    return TRUE;
+}
+
+static gboolean
+parse_folder_only_record (const DSStoreRecord *record, gpointer user_data)
+{
+    parse_folder_record (user_data, record);
+    return TRUE;
+}
+
+typedef struct {
+    FinderzDSStoreData *data;
+    const gchar *name;
+} DSStoreLookupState;
+
+static gboolean
+parse_lookup_record (const DSStoreRecord *record, gpointer user_data)
+{
+    DSStoreLookupState *lookup = user_data;
+
+    parse_file_record (lookup->data, record, lookup->name);
+    return TRUE;
+}
+
+/* Lazy mode: pull every record for @filename out of the tree copy.
+ * Names without records are remembered as NULL entries in
+ * icon_locations so each name is searched at most once. */
+static void
+resolve_lazy_name (FinderzDSStoreData *data, const gchar *filename)
+{
+    DSStoreLookupState lookup;
+
+    if (!data->tree ||
+        g_hash_table_lookup_extended (data->icon_locations, filename, NULL, NULL)) {
+        return;
+    }
+
+    lookup.data = data;
+    lookup.name = filename;
+
+    if (!tree_search (data->tree, filename, parse_lookup_record, &lookup)) {
+        g_debug ("FINDERZ: DS_Store lookup for %s hit a damaged node", filename);
+    }
+
+    if (!g_hash_table_contains (data->icon_locations, filename)) {
+        g_hash_table_insert (data->icon_locations, g_strdup (filename), NULL);
+    }
+}
+
+/* Map Finder's sort keys to Nemo sort attribute names */
+static gchar *
+sort_column_from_finder (const gchar *key, gsize length)
+{
+    static const struct {
+        const gchar *finder;
+        const gchar *nemo;
+    } columns[] = {
+        { "name", "name" },
+        { "size", "size" },
+        { "kind", "type" },
+        { "dateModified", "date_modified" },
+        { "dateCreated", "date_created" },
+        { "dateLastOpened", "date_accessed" },
+        { "label", "color_label" },
+    };
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS (columns); i++) {
+        if (strlen (columns[i].finder) == length &&
+            memcmp (columns[i].finder, key, length) == 0) {
+            return g_strdup (columns[i].nemo);
+        }
+    }
+
+    return NULL;
+}
+
+static void
+resolve_sort_column (DSStoreParseState *state)
+{
+    gchar *column = NULL;
+
+    /* The list view sort applies when the folder opens in list view;
+     * otherwise the icon view's "arrange by" decides. */
+    if (state->data->view_style == FINDERZ_VIEW_LIST && state->list_sort_column) {
+        column = sort_column_from_finder (state->list_sort_column,
+                                          state->list_sort_column_length);
+    } else if (state->arrange_by) {
+        column = sort_column_from_finder (state->arrange_by,
+                                          state->arrange_by_length);
+    }
+
+    if (column) {
+        g_free (state->data->sort_column);
+        state->data->sort_column = column;
+    }
+}
+
 FinderzDSStoreData*
 finderz_ds_store_parse_file (FinderzDSStore *ds_store,
                               const gchar *ds_store_path,
                               GError **error)
+{
+    return finderz_ds_store_parse_file_full (ds_store, ds_store_path,
+                                             FINDERZ_DS_STORE_PARSE_NONE, error);
+}
+
+FinderzDSStoreData*
+finderz_ds_store_parse_file_full (FinderzDSStore *ds_store,
+                                   const gchar *ds_store_path,
+                                   FinderzDSStoreParseFlags flags,
+                                   GError **error)
 {
     FinderzDSStoreData *data;
-    FILE *file;
-    
+    GMappedFile *mapped;
+    DSStoreAllocator allocator = { 0 };
+    DSStoreParseState state = { 0 };
+    const guchar *contents, *header;
+    gsize length, header_size;
+    guint32 root_offset, root_size, dsdb_block, root_node;
+    gboolean intact;
+
     g_return_val_if_fail (ds_store != NULL, NULL);
     g_return_val_if_fail (ds_store_path != NULL, NULL);
-    
-    file = fopen (ds_store_path, "rb");
-    if (!file) {
-        g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
-                     "Could not open DS_Store file: %s", ds_store_path);
+
+    mapped = g_mapped_file_new (ds_store_path, FALSE, error);
+    if (!mapped) {
         return NULL;
     }
-    
-    if (!read_ds_store_header (file, error)) {
-        fclose (file);
+
+    contents = (const guchar *)g_mapped_file_get_contents (mapped);
+    length = g_mapped_file_get_length (mapped);
+
+    if (!contents) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                     "DS_Store file is empty");
+        g_mapped_file_unref (mapped);
+        return NULL;
+    }
+
+    if (!read_ds_store_header (contents, length, &allocator,
+                               &root_offset, &root_size, error) ||
+        !allocator_find_dsdb (&allocator, root_offset, root_size,
+                              &dsdb_block, error)) {
+        g_mapped_file_unref (mapped);
         return NULL;
     }
-    
+
+    header = allocator_get_block (&allocator, dsdb_block, &header_size);
+    if (!header || header_size < 20) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                     "DS_Store tree header is missing");
+        g_mapped_file_unref (mapped);
+        return NULL;
+    }
+
+    /* Tree header: root node, levels, records, nodes, page size */
+    root_node = read_be32 (header);
+
     data = g_new0 (FinderzDSStoreData, 1);
-    
+    data->ref_count = 1;
+
     /* Set defaults matching macOS Finder */
     data->view_style = FINDERZ_VIEW_ICON;
     data->icon_size = 64;
@@ -168,39 +1227,264 @@ finderz_ds_store_parse_file (FinderzDSStore *ds_store,
     data->sort_column = g_strdup ("name");
     data->icon_locations = g_hash_table_new_full (g_str_hash, g_str_equal,
                                                    g_free, g_free);
-    data->color_labels = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                                 g_free, g_free);
-    
-    /* TODO: Implement actual DS_Store parsing
-     * This requires:
-     * 1. Reading the B-tree structure
-     * 2. Parsing record blocks
-     * 3. Extracting relevant metadata
-     * 
-     * For now, return defaults that can be used for testing
-     */
-    
-    fclose (file);
-    
-    /* Cache the parsed data */
-    gchar *dir_path = g_path_get_dirname (ds_store_path);
-    g_hash_table_insert (ds_store->cache, dir_path, data);
-    
+    data->comments = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                             g_free, g_free);
+
+    state.data = data;
+
+    if (flags & FINDERZ_DS_STORE_PARSE_LAZY) {
+        const guchar *copy;
+
+        /* Lookups come long after the file was last checked, when it
+         * may have been rewritten shorter; a copy cannot SIGBUS */
+        data->tree = g_new0 (FinderzDSStoreTree, 1);
+        data->tree->contents = g_bytes_new (contents, length);
+        copy = g_bytes_get_data (data->tree->contents, NULL);
+        data->tree->allocator = allocator;
+        data->tree->allocator.base = copy + (allocator.base - contents);
+        data->tree->allocator.offsets = copy + (allocator.offsets - contents);
+        data->tree->root_node = root_node;
+
+        intact = tree_search (data->tree, ".", parse_folder_only_record, &state);
+    } else {
+        guint32 visits = allocator.n_blocks;
+
+        intact = walk_node (&allocator, root_node, 0, &visits, parse_record, &state);
+    }
+
+    if (!intact) {
+        g_debug ("FINDERZ: DS_Store tree in %s is damaged, using partial data",
+                 ds_store_path);
+    }
+
+    resolve_sort_column (&state);
+
+    g_debug ("FINDERZ: Parsed DS_Store %s%s - %u records, view style %d",
+             ds_store_path, data->tree ? " (lazy)" : "",
+             read_be32 (header + 8), data->view_style);
+
+    /* Everything kept was copied out of the mapping */
+    g_mapped_file_unref (mapped);
+
     return data;
 }
 
+static void
+file_key_from_stat (const GStatBuf *st, DSStoreFileKey *key)
+{
+    key->device = st->st_dev;
+    key->inode = st->st_ino;
+    key->mtime_nsec = (gint64)st->st_mtim.tv_sec * G_GINT64_CONSTANT (1000000000) +
+                      st->st_mtim.tv_nsec;
+    key->size = st->st_size;
+}
+
+static gboolean
+file_key_equal (const DSStoreFileKey *a, const DSStoreFileKey *b)
+{
+    return a->device == b->device &&
+           a->inode == b->inode &&
+           a->mtime_nsec == b->mtime_nsec &&
+           a->size == b->size;
+}
+
+/* Rough heap footprint of one entry.  Lazy entries grow as
+ * names are resolved, so this is recomputed whenever an entry is used. */
+static gsize
+cache_entry_cost (const DSStoreCacheEntry *entry)
+{
+    const FinderzDSStoreData *data = entry->data;
+    gsize cost;
+
+    cost = sizeof (DSStoreCacheEntry) + strlen (entry->directory_path) + 1;
+
+    if (!data) {
+        return cost;
+    }
+
+    cost += sizeof (FinderzDSStoreData);
+    cost += (g_hash_table_size (data->icon_locations) +
+             g_hash_table_size (data->comments)) * DS_STORE_ENTRY_COST;
+
+    if (data->tree) {
+        cost += sizeof (FinderzDSStoreTree) +
+                g_bytes_get_size (data->tree->contents);
+    }
+
+    return cost;
+}
+
+static void
+cache_update_cost (FinderzDSStore *ds_store, DSStoreCacheEntry *entry)
+{
+    gsize cost = cache_entry_cost (entry);
+
+    ds_store->cache_bytes = ds_store->cache_bytes - entry->cost + cost;
+    entry->cost = cost;
+}
+
+static void
+cache_remove_entry (FinderzDSStore *ds_store, DSStoreCacheEntry *entry)
+{
+    g_queue_delete_link (&ds_store->lru, entry->lru_link);
+    ds_store->cache_bytes -= entry->cost;
+    g_hash_table_remove (ds_store->cache, entry->directory_path);
+}
+
+/* Evict from the cold end, always keeping the entry just used */
+static void
+cache_trim (FinderzDSStore *ds_store)
+{
+    while (ds_store->cache_bytes > ds_store->cache_budget &&
+           g_queue_get_length (&ds_store->lru) > 1) {
+        DSStoreCacheEntry *entry = g_queue_peek_tail (&ds_store->lru);
+
+        g_debug ("FINDERZ: Evicting DS_Store data for %s (%" G_GSIZE_FORMAT " bytes)",
+                 entry->directory_path, entry->cost);
+        cache_remove_entry (ds_store, entry);
+    }
+}
+
+static void
+cache_touch (FinderzDSStore *ds_store, DSStoreCacheEntry *entry)
+{
+    if (ds_store->lru.head != entry->lru_link) {
+        g_queue_unlink (&ds_store->lru, entry->lru_link);
+        g_queue_push_head_link (&ds_store->lru, entry->lru_link);
+    }
+
+    cache_update_cost (ds_store, entry);
+    cache_trim (ds_store);
+}
+
+static void
+cache_insert (FinderzDSStore *ds_store,
+              const gchar *directory_path,
+              const DSStoreFileKey *key,
+              FinderzDSStoreData *data)
+{
+    DSStoreCacheEntry *entry;
+
+    entry = g_new0 (DSStoreCacheEntry, 1);
+    entry->directory_path = g_strdup (directory_path);
+    entry->key = *key;
+    entry->data = data ? finderz_ds_store_data_ref (data) : NULL;
+
+    g_queue_push_head (&ds_store->lru, entry);
+    entry->lru_link = ds_store->lru.head;
+    g_hash_table_insert (ds_store->cache, entry->directory_path, entry);
+
+    cache_update_cost (ds_store, entry);
+    cache_trim (ds_store);
+}
+
+FinderzDSStoreData*
+finderz_ds_store_lookup (FinderzDSStore *ds_store,
+                         const gchar *directory_path,
+                         FinderzDSStoreParseFlags flags,
+                         GError **error)
+{
+    DSStoreCacheEntry *entry;
+    DSStoreFileKey key;
+    FinderzDSStoreData *data;
+    GError *local_error = NULL;
+    GStatBuf st;
+    gchar *ds_store_path;
+
+    g_return_val_if_fail (ds_store != NULL, NULL);
+    g_return_val_if_fail (directory_path != NULL, NULL);
+
+    entry = g_hash_table_lookup (ds_store->cache, directory_path);
+    ds_store_path = g_build_filename (directory_path, ".DS_Store", NULL);
+
+    if (g_stat (ds_store_path, &st) != 0) {
+        int saved_errno = errno;
+
+        if (entry) {
+            cache_remove_entry (ds_store, entry);
+        }
+
+        g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                     "%s: %s", ds_store_path, g_strerror (saved_errno));
+        g_free (ds_store_path);
+        return NULL;
+    }
+
+    file_key_from_stat (&st, &key);
+
+    if (entry && file_key_equal (&entry->key, &key)) {
+        cache_touch (ds_store, entry);
+        g_free (ds_store_path);
+
+        if (!entry->data) {
+            g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                         "DS_Store in %s could not be parsed", directory_path);
+            return NULL;
+        }
+
+        return finderz_ds_store_data_ref (entry->data);
+    }
+
+    /* Changed on disk since we last read it */
+    if (entry) {
+        cache_remove_entry (ds_store, entry);
+    }
+
+    data = finderz_ds_store_parse_file_full (ds_store, ds_store_path, flags,
+                                             &local_error);
+    g_free (ds_store_path);
+
+    /* Remember malformed files so they are not re-parsed for every row,
+     * but not transient failures such as a file vanishing under us */
+    if (data || g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA)) {
+        cache_insert (ds_store, directory_path, &key, data);
+    }
+
+    if (local_error) {
+        g_propagate_error (error, local_error);
+    }
+
+    return data;
+}
+
+void
+finderz_ds_store_invalidate (FinderzDSStore *ds_store,
+                             const gchar *directory_path)
+{
+    DSStoreCacheEntry *entry;
+
+    g_return_if_fail (ds_store != NULL);
+    g_return_if_fail (directory_path != NULL);
+
+    entry = g_hash_table_lookup (ds_store->cache, directory_path);
+    if (entry) {
+        g_debug ("FINDERZ: Dropping cached DS_Store data for %s", directory_path);
+        cache_remove_entry (ds_store, entry);
+    }
+}
+
+void
+finderz_ds_store_set_cache_budget (FinderzDSStore *ds_store,
+                                   gsize budget_bytes)
+{
+    g_return_if_fail (ds_store != NULL);
+
+    ds_store->cache_budget = budget_bytes;
+    cache_trim (ds_store);
+}
+
 gboolean
 finderz_ds_store_exists_for_directory (const gchar *directory_path)
 {
     gchar *ds_store_path;
     gboolean exists;
-    
+
     g_return_val_if_fail (directory_path != NULL, FALSE);
-    
+
     ds_store_path = g_build_filename (directory_path, ".DS_Store", NULL);
     exists = g_file_test (ds_store_path, G_FILE_TEST_EXISTS);
     g_free (ds_store_path);
-    
+
     return exists;
 }
 
@@ -208,10 +1492,14 @@ FinderzDSStoreData*
 finderz_ds_store_get_cached_data (FinderzDSStore *ds_store,
                                    const gchar *directory_path)
 {
+    DSStoreCacheEntry *entry;
+
     g_return_val_if_fail (ds_store != NULL, NULL);
     g_return_val_if_fail (directory_path != NULL, NULL);
-    
-    return g_hash_table_lookup (ds_store->cache, directory_path);
+
+    entry = g_hash_table_lookup (ds_store->cache, directory_path);
+
+    return entry ? entry->data : NULL;
 }
 
 /* Get icon position for a specific file */
@@ -222,27 +1510,24 @@ finderz_ds_store_get_icon_position (FinderzDSStoreData *data,
     if (!data || !data->icon_locations || !filename) {
         return NULL;
     }
-    
+
+    resolve_lazy_name (data, filename);
+
     return g_hash_table_lookup (data->icon_locations, filename);
 }
 
-/* Get color label for a specific file */
-gint
-finderz_ds_store_get_color_label (FinderzDSStoreData *data,
-                                   const gchar *filename)
+/* Get the Spotlight comment for a specific file */
+const gchar*
+finderz_ds_store_get_comment (FinderzDSStoreData *data,
+                               const gchar *filename)
 {
-    gpointer value;
-    
-    if (!data || !data->color_labels || !filename) {
-        return -1;
-    }
-    
-    value = g_hash_table_lookup (data->color_labels, filename);
-    if (value) {
-        return GPOINTER_TO_INT (value);
+    if (!data || !data->comments || !filename) {
+        return NULL;
     }
-    
-    return -1;
+
+    resolve_lazy_name (data, filename);
+
+    return g_hash_table_lookup (data->comments, filename);
 }
 
 /* Get the sort column preference */
@@ -252,6 +1537,6 @@ finderz_ds_store_get_sort_column (FinderzDSStoreData *data)
     if (!data) {
         return NULL;
     }
-    
+
     return data->sort_column;
-}
\ No newline at end of file
+}
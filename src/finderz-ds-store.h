@@ -9,11 +9,15 @@
 
 #include <glib.h>
 #include <gio/gio.h>
+#include <gdk/gdk.h>
 
 G_BEGIN_DECLS
 
+#define FINDERZ_TYPE_DS_STORE (finderz_ds_store_get_type ())
+
 typedef struct _FinderzDSStore FinderzDSStore;
 typedef struct _FinderzDSStoreClass FinderzDSStoreClass;
+typedef struct _FinderzDSStoreTree FinderzDSStoreTree;
 
 /* DS_Store record types we care about */
 typedef enum {
@@ -29,6 +33,14 @@ typedef enum {
     FINDERZ_DS_STORE_SHOW_ITEM_INFO
 } FinderzDSStoreRecordType;
 
+/* How much of the file to decode up front */
+typedef enum {
+    FINDERZ_DS_STORE_PARSE_NONE = 0,
+    /* Decode folder settings only; per-file records are looked up in
+     * a copy of the tree on first use and cached by name */
+    FINDERZ_DS_STORE_PARSE_LAZY = 1 << 0
+} FinderzDSStoreParseFlags;
+
 /* View styles from macOS Finder */
 typedef enum {
     FINDERZ_VIEW_ICON = 0,
@@ -54,27 +66,47 @@ typedef struct {
     gchar *sort_column;
     gchar *background_image_path;
     GHashTable *icon_locations; /* filename -> FinderzIconPosition* */
-    GHashTable *color_labels; /* filename -> color label index */
+    GHashTable *comments; /* filename -> Spotlight comment */
     GdkRectangle window_bounds;
+    FinderzDSStoreTree *tree; /* B-tree copy, only kept in lazy mode */
+    gint ref_count;
 } FinderzDSStoreData;
 
 /* Public functions */
+GType finderz_ds_store_get_type (void);
 FinderzDSStore* finderz_ds_store_new (void);
 FinderzDSStoreData* finderz_ds_store_parse_file (FinderzDSStore *ds_store,
                                                   const gchar *ds_store_path,
                                                   GError **error);
-void finderz_ds_store_data_free (FinderzDSStoreData *data);
+FinderzDSStoreData* finderz_ds_store_parse_file_full (FinderzDSStore *ds_store,
+                                                       const gchar *ds_store_path,
+                                                       FinderzDSStoreParseFlags flags,
+                                                       GError **error);
+FinderzDSStoreData* finderz_ds_store_data_ref (FinderzDSStoreData *data);
+void finderz_ds_store_data_unref (FinderzDSStoreData *data);
 gboolean finderz_ds_store_exists_for_directory (const gchar *directory_path);
+
+/* Cached access: returns a new reference, re-parsing only when the
+ * .DS_Store's device, inode, mtime or size changed since last time */
+FinderzDSStoreData* finderz_ds_store_lookup (FinderzDSStore *ds_store,
+                                              const gchar *directory_path,
+                                              FinderzDSStoreParseFlags flags,
+                                              GError **error);
+/* Borrowed and not revalidated; prefer finderz_ds_store_lookup() */
 FinderzDSStoreData* finderz_ds_store_get_cached_data (FinderzDSStore *ds_store,
                                                        const gchar *directory_path);
+void finderz_ds_store_invalidate (FinderzDSStore *ds_store,
+                                  const gchar *directory_path);
+void finderz_ds_store_set_cache_budget (FinderzDSStore *ds_store,
+                                        gsize budget_bytes);
 
 /* Get metadata for specific files */
 FinderzIconPosition* finderz_ds_store_get_icon_position (FinderzDSStoreData *data,
                                                           const gchar *filename);
-gint finderz_ds_store_get_color_label (FinderzDSStoreData *data,
-                                        const gchar *filename);
+const gchar* finderz_ds_store_get_comment (FinderzDSStoreData *data,
+                                            const gchar *filename);
 const gchar* finderz_ds_store_get_sort_column (FinderzDSStoreData *data);
 
 G_END_DECLS
 
-#endif /* FINDERZ_DS_STORE_H */
\ No newline at end of file
+#endif /* FINDERZ_DS_STORE_H */
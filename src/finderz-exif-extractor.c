@@ -6,97 +6,296 @@
 
 #include <glib.h>
 #include <gio/gio.h>
+#include <fcntl.h>
+#include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
 #include "finderz-universal-metadata.h"
 #include "finderz-xattr-handler.h"
+#include "finderz-xmp-parser.h"
+#include "finderz-comfyui.h"
+#include "finderz-media-probe.h"
+#include "finderz-document-probe.h"
 
 /* For now, we'll use basic extraction. Later integrate libexiv2 */
 
-/* PNG text chunk structure */
-typedef struct {
-    guint32 length;
-    gchar type[4];
-    /* data follows */
-} PNGChunk;
+/* Files are read through one buffered window and only their headers
+ * are touched; everything else is skipped by seeking */
+#define READ_BUFFER_SIZE       (16 * 1024)
+
+/* Text chunks come before the image data in practice, so only the head
+ * of a PNG is read.  Chunks above these sizes are skipped rather than
+ * read, which bounds what a corrupt or hostile file can make us hold. */
+#define PNG_MAX_CHUNK_SIZE     (4 * 1024 * 1024)
+#define PNG_MAX_TEXT_SIZE      (8 * 1024 * 1024)
+#define PNG_MAX_KEYWORD_LENGTH 79
+/* iTXt chunk holding an XMP packet */
+#define PNG_XMP_KEYWORD        "XML:com.adobe.xmp"
+
+static const guchar png_signature[8] = { 0x89, 'P', 'N', 'G', 0x0d, 0x0a, 0x1a, 0x0a };
 
 /* Forward declarations */
 static void parse_sd_parameters (GHashTable *metadata, const gchar *params);
+static GHashTable* new_ai_parameters (void);
+
+static gboolean
+stream_read (GInputStream *stream, gpointer buffer, gsize count)
+{
+    gsize bytes_read;
+    
+    return g_input_stream_read_all (stream, buffer, count, &bytes_read, NULL, NULL) &&
+           bytes_read == count;
+}
+
+static gboolean
+stream_skip (GInputStream *stream, gsize count)
+{
+    while (count > 0) {
+        gssize skipped = g_input_stream_skip (stream, MIN (count, G_MAXSSIZE), NULL, NULL);
+        
+        if (skipped <= 0) {
+            return FALSE;
+        }
+        count -= skipped;
+    }
+    
+    return TRUE;
+}
+
+/* Camera cards write upper-case names, so compare without case */
+static gboolean
+has_extension (const gchar *filepath, const gchar *extension)
+{
+    const gchar *dot = strrchr (filepath, '.');
+    
+    return dot && g_ascii_strcasecmp (dot + 1, extension) == 0;
+}
+
+static GInputStream*
+open_buffered_stream (const gchar *filepath)
+{
+    GFile *file;
+    GFileInputStream *file_stream;
+    GInputStream *stream;
+    
+    file = g_file_new_for_path (filepath);
+    file_stream = g_file_read (file, NULL, NULL);
+    g_object_unref (file);
+    if (!file_stream) {
+        return NULL;
+    }
+    
+    stream = g_buffered_input_stream_new_sized (G_INPUT_STREAM (file_stream),
+                                                READ_BUFFER_SIZE);
+    g_object_unref (file_stream);
+    
+    return stream;
+}
+
+/* The keyword that starts a text chunk, read without consuming it so
+ * chunks we don't want can be skipped unread */
+static gboolean
+png_peek_keyword (GBufferedInputStream *stream, guint32 length, gchar *keyword)
+{
+    gsize wanted = MIN (length, PNG_MAX_KEYWORD_LENGTH + 1);
+    gsize available;
+    const gchar *data;
+    const gchar *end;
+    
+    if (g_buffered_input_stream_get_available (stream) < wanted &&
+        g_buffered_input_stream_fill (stream, wanted, NULL, NULL) < 0) {
+        return FALSE;
+    }
+    
+    data = g_buffered_input_stream_peek_buffer (stream, &available);
+    end = memchr (data, '\0', MIN (available, wanted));
+    if (!end || end == data) {
+        return FALSE;
+    }
+    
+    memcpy (keyword, data, end - data + 1);
+    return TRUE;
+}
+
+static gboolean
+is_wanted_keyword (const gchar *keyword)
+{
+    return strcmp (keyword, "parameters") == 0 ||
+           strcmp (keyword, "prompt") == 0 ||
+           strcmp (keyword, "workflow") == 0 ||
+           strcmp (keyword, "Dream") == 0 ||
+           strcmp (keyword, PNG_XMP_KEYWORD) == 0;
+}
+
+/* Inflate zlib @data piece by piece, giving up past PNG_MAX_TEXT_SIZE */
+static gchar*
+png_inflate_text (const guint8 *data, gsize length)
+{
+    GConverter *decompressor;
+    GString *text;
+    gchar buffer[READ_BUFFER_SIZE];
+    gboolean ok = FALSE;
+    
+    decompressor = G_CONVERTER (g_zlib_decompressor_new (G_ZLIB_COMPRESSOR_FORMAT_ZLIB));
+    text = g_string_new (NULL);
+    
+    while (text->len <= PNG_MAX_TEXT_SIZE) {
+        GConverterResult result;
+        gsize bytes_read, bytes_written;
+        
+        result = g_converter_convert (decompressor, data, length,
+                                      buffer, sizeof (buffer),
+                                      G_CONVERTER_INPUT_AT_END,
+                                      &bytes_read, &bytes_written, NULL);
+        if (result == G_CONVERTER_ERROR) {
+            break;
+        }
+        
+        g_string_append_len (text, buffer, bytes_written);
+        data += bytes_read;
+        length -= bytes_read;
+        
+        if (result == G_CONVERTER_FINISHED) {
+            ok = text->len <= PNG_MAX_TEXT_SIZE;
+            break;
+        }
+    }
+    
+    g_object_unref (decompressor);
+    return g_string_free (text, !ok);
+}
+
+/* Decode the body of a tEXt, zTXt or iTXt chunk into UTF-8 text */
+static gchar*
+png_decode_text_chunk (const gchar *type, const guint8 *data, gsize length)
+{
+    const guint8 *end = data + length;
+    const guint8 *text;
+    gboolean compressed = FALSE;
+    gchar *result;
+    
+    text = memchr (data, '\0', length);
+    if (!text) {
+        return NULL;
+    }
+    text++;
+    
+    if (memcmp (type, "zTXt", 4) == 0) {
+        /* Compression method, always 0 (zlib) */
+        if (text >= end || *text != 0) {
+            return NULL;
+        }
+        text++;
+        compressed = TRUE;
+    } else if (memcmp (type, "iTXt", 4) == 0) {
+        /* Compression flag and method, then language tag and
+         * translated keyword, both NUL-terminated */
+        if (end - text < 2 || (text[0] && text[1] != 0)) {
+            return NULL;
+        }
+        compressed = text[0] != 0;
+        text += 2;
+        
+        for (int i = 0; i < 2; i++) {
+            text = memchr (text, '\0', end - text);
+            if (!text) {
+                return NULL;
+            }
+            text++;
+        }
+    }
+    
+    if (compressed) {
+        result = png_inflate_text (text, end - text);
+    } else {
+        result = g_strndup ((const gchar *)text, end - text);
+    }
+    
+    /* tEXt and zTXt are Latin-1 by the spec, though many tools write
+     * UTF-8 into them anyway */
+    if (result && !g_utf8_validate (result, -1, NULL)) {
+        gchar *converted = g_convert (result, -1, "UTF-8", "ISO-8859-1", NULL, NULL, NULL);
+        
+        g_free (result);
+        result = converted;
+    }
+    
+    return result;
+}
 
 /* Extract metadata from PNG text chunks (ComfyUI, SD, etc) */
 static GHashTable*
 extract_png_metadata (const gchar *filepath)
 {
-    GHashTable *metadata = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                                   g_free, g_free);
-    FILE *file = fopen (filepath, "rb");
-    if (!file) return metadata;
-    
-    /* Check PNG signature */
+    GHashTable *metadata = new_ai_parameters ();
+    GInputStream *stream;
     guchar signature[8];
-    if (fread (signature, 1, 8, file) != 8) {
-        fclose (file);
+    
+    stream = open_buffered_stream (filepath);
+    if (!stream) {
         return metadata;
     }
     
-    /* PNG signature: 89 50 4E 47 0D 0A 1A 0A */
-    if (signature[0] != 0x89 || signature[1] != 'P' || 
-        signature[2] != 'N' || signature[3] != 'G') {
-        fclose (file);
+    if (!stream_read (stream, signature, sizeof (signature)) ||
+        memcmp (signature, png_signature, sizeof (signature)) != 0) {
+        g_object_unref (stream);
         return metadata;
     }
     
     /* Read chunks */
-    while (!feof (file)) {
+    for (;;) {
+        guint8 header[8];
+        const gchar *type = (const gchar *)header + 4;
+        gchar keyword[PNG_MAX_KEYWORD_LENGTH + 1];
         guint32 length;
-        gchar type[5] = {0};
+        guint8 *data;
+        gchar *value;
         
-        if (fread (&length, 4, 1, file) != 1) break;
+        if (!stream_read (stream, header, sizeof (header))) {
+            break;
+        }
+        memcpy (&length, header, sizeof (length));
         length = GUINT32_FROM_BE (length);
         
-        if (fread (type, 1, 4, file) != 4) break;
+        if (memcmp (type, "IDAT", 4) == 0 || memcmp (type, "IEND", 4) == 0) {
+            break;
+        }
         
-        /* Look for text chunks */
-        if (strcmp (type, "tEXt") == 0 || strcmp (type, "iTXt") == 0) {
-            gchar *data = g_malloc (length + 1);
-            if (fread (data, 1, length, file) == length) {
-                data[length] = '\0';
-                
-                /* Parse key=value */
-                gchar *value = strchr (data, '\0');
-                if (value && value < data + length - 1) {
-                    value++; /* Skip null terminator */
-                    
-                    /* Common AI metadata keys */
-                    if (strcmp (data, "parameters") == 0 ||
-                        strcmp (data, "prompt") == 0 ||
-                        strcmp (data, "workflow") == 0 ||
-                        strcmp (data, "Dream") == 0) {
-                        
-                        g_hash_table_insert (metadata, 
-                                             g_strdup (data),
-                                             g_strdup (value));
-                        
-                        /* Parse SD/ComfyUI parameters */
-                        if (strstr (value, "Steps:") || strstr (value, "Sampler:")) {
-                            /* Parse Stable Diffusion format */
-                            parse_sd_parameters (metadata, value);
-                        }
-                    }
-                }
+        /* Anything but a wanted text chunk is skipped with its CRC */
+        if ((memcmp (type, "tEXt", 4) != 0 &&
+             memcmp (type, "zTXt", 4) != 0 &&
+             memcmp (type, "iTXt", 4) != 0) ||
+            length > PNG_MAX_CHUNK_SIZE ||
+            !png_peek_keyword (G_BUFFERED_INPUT_STREAM (stream), length, keyword) ||
+            !is_wanted_keyword (keyword)) {
+            if (!stream_skip (stream, (gsize)length + 4)) {
+                break;
             }
+            continue;
+        }
+        
+        data = g_malloc (length);
+        if (!stream_read (stream, data, length) || !stream_skip (stream, 4)) {
             g_free (data);
-            
-            /* Skip CRC */
-            fseek (file, 4, SEEK_CUR);
-        } else if (strcmp (type, "IEND") == 0) {
             break;
-        } else {
-            /* Skip chunk data and CRC */
-            fseek (file, length + 4, SEEK_CUR);
+        }
+        
+        value = png_decode_text_chunk (type, data, length);
+        g_free (data);
+        
+        if (value) {
+            g_hash_table_insert (metadata, g_strdup (keyword), value);
+            
+            /* Parse SD/ComfyUI parameters */
+            if (strcmp (keyword, PNG_XMP_KEYWORD) != 0 &&
+                (strstr (value, "Steps:") || strstr (value, "Sampler:"))) {
+                /* Parse Stable Diffusion format */
+                parse_sd_parameters (metadata, value);
+            }
         }
     }
     
-    fclose (file);
+    g_object_unref (stream);
     return metadata;
 }
 
@@ -138,208 +337,1022 @@ parse_sd_parameters (GHashTable *metadata, const gchar *params)
     g_strfreev (lines);
 }
 
-/* Extract basic image metadata using GdkPixbuf (temporary solution) */
-FinderzImageMetadata*
-finderz_extract_image_metadata_basic (const gchar *filepath)
+/* EXIF is a TIFF structure: a header naming the byte order, then IFDs
+ * of 12-byte entries whose values sit inline or at an offset.  It is
+ * read in place; every offset is checked against the buffer. */
+typedef struct {
+    const guint8 *data;
+    gsize length;
+    gboolean big_endian;
+} TiffReader;
+
+/* Bound on the entries read from one IFD */
+#define TIFF_MAX_IFD_ENTRIES 512
+
+enum {
+    TIFF_TYPE_BYTE = 1,
+    TIFF_TYPE_ASCII = 2,
+    TIFF_TYPE_SHORT = 3,
+    TIFF_TYPE_LONG = 4,
+    TIFF_TYPE_RATIONAL = 5,
+    TIFF_TYPE_UNDEFINED = 7,
+    TIFF_TYPE_SLONG = 9,
+    TIFF_TYPE_SRATIONAL = 10
+};
+
+enum {
+    TIFF_TAG_MAKE = 0x010f,
+    TIFF_TAG_MODEL = 0x0110,
+    TIFF_TAG_DATE_TIME = 0x0132,
+    TIFF_TAG_EXIF_IFD = 0x8769,
+    TIFF_TAG_GPS_IFD = 0x8825,
+    EXIF_TAG_EXPOSURE_TIME = 0x829a,
+    EXIF_TAG_F_NUMBER = 0x829d,
+    EXIF_TAG_ISO = 0x8827,
+    EXIF_TAG_DATE_TIME_ORIGINAL = 0x9003,
+    EXIF_TAG_OFFSET_TIME_ORIGINAL = 0x9011,
+    EXIF_TAG_FOCAL_LENGTH = 0x920a,
+    EXIF_TAG_USER_COMMENT = 0x9286,
+    EXIF_TAG_LENS_MODEL = 0xa434,
+    GPS_TAG_LATITUDE_REF = 0x0001,
+    GPS_TAG_LATITUDE = 0x0002,
+    GPS_TAG_LONGITUDE_REF = 0x0003,
+    GPS_TAG_LONGITUDE = 0x0004,
+    GPS_TAG_ALTITUDE_REF = 0x0005,
+    GPS_TAG_ALTITUDE = 0x0006
+};
+
+typedef struct {
+    guint16 tag;
+    guint16 type;
+    guint32 count;
+    const guint8 *value;    /* checked to hold count values of type */
+} TiffEntry;
+
+static guint16
+tiff_u16 (const TiffReader *tiff, const guint8 *p)
 {
-    FinderzImageMetadata *img_meta = g_new0 (FinderzImageMetadata, 1);
+    return tiff->big_endian ? (p[0] << 8) | p[1] : (p[1] << 8) | p[0];
+}
+
+static guint32
+tiff_u32 (const TiffReader *tiff, const guint8 *p)
+{
+    return tiff->big_endian ?
+        ((guint32)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3] :
+        ((guint32)p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0];
+}
+
+static gsize
+tiff_type_size (guint16 type)
+{
+    switch (type) {
+        case TIFF_TYPE_BYTE:
+        case TIFF_TYPE_ASCII:
+        case TIFF_TYPE_UNDEFINED:
+            return 1;
+        case TIFF_TYPE_SHORT:
+            return 2;
+        case TIFF_TYPE_LONG:
+        case TIFF_TYPE_SLONG:
+            return 4;
+        case TIFF_TYPE_RATIONAL:
+        case TIFF_TYPE_SRATIONAL:
+            return 8;
+        default:
+            return 0;
+    }
+}
+
+/* Entry @index of the IFD at @offset, or FALSE if it lies outside the
+ * buffer or has a type we don't read */
+static gboolean
+tiff_get_entry (const TiffReader *tiff, guint32 offset, guint index, TiffEntry *entry)
+{
+    const guint8 *p = tiff->data + offset + 2 + index * 12;
+    guint64 size;
     
-    /* Try to get from extended attributes first (cached) */
-    img_meta->rating = finderz_xattr_get_rating (filepath);
+    entry->tag = tiff_u16 (tiff, p);
+    entry->type = tiff_u16 (tiff, p + 2);
+    entry->count = tiff_u32 (tiff, p + 4);
     
-    gchar *ai_prompt = finderz_xattr_get_ai_prompt (filepath);
-    gchar *ai_model = finderz_xattr_get_ai_model (filepath);
+    size = (guint64)tiff_type_size (entry->type) * entry->count;
+    if (size == 0) {
+        return FALSE;
+    }
     
-    if (ai_prompt || ai_model) {
-        img_meta->ai_data = g_new0 (FinderzAIMetadata, 1);
-        img_meta->ai_data->prompt = ai_prompt;
-        img_meta->ai_data->model = ai_model;
+    if (size <= 4) {
+        entry->value = p + 8;
+    } else {
+        guint32 value_offset = tiff_u32 (tiff, p + 8);
+        
+        if (value_offset > tiff->length || size > tiff->length - value_offset) {
+            return FALSE;
+        }
+        entry->value = tiff->data + value_offset;
+    }
+    
+    return TRUE;
+}
+
+/* Number of entries in the IFD at @offset, 0 if it does not fit */
+static guint
+tiff_ifd_size (const TiffReader *tiff, guint32 offset)
+{
+    guint n_entries;
+    
+    if (offset < 8 || offset > tiff->length - 2) {
+        return 0;
+    }
+    
+    n_entries = tiff_u16 (tiff, tiff->data + offset);
+    if ((guint64)offset + 2 + (guint64)n_entries * 12 > tiff->length) {
+        return 0;
+    }
+    
+    return MIN (n_entries, TIFF_MAX_IFD_ENTRIES);
+}
+
+static gchar*
+tiff_get_string (const TiffEntry *entry)
+{
+    gchar *string;
+    
+    if (entry->type != TIFF_TYPE_ASCII && entry->type != TIFF_TYPE_UNDEFINED) {
+        return NULL;
+    }
+    
+    string = g_strstrip (g_strndup ((const gchar *)entry->value, entry->count));
+    if (!*string || !g_utf8_validate (string, -1, NULL)) {
+        g_free (string);
+        return NULL;
+    }
+    
+    return string;
+}
+
+static gboolean
+tiff_get_uint (const TiffReader *tiff, const TiffEntry *entry, guint32 *value)
+{
+    switch (entry->type) {
+        case TIFF_TYPE_SHORT:
+            *value = tiff_u16 (tiff, entry->value);
+            return TRUE;
+        case TIFF_TYPE_LONG:
+            *value = tiff_u32 (tiff, entry->value);
+            return TRUE;
+        default:
+            return FALSE;
+    }
+}
+
+/* Rational @index of @entry as a double */
+static gboolean
+tiff_get_rational (const TiffReader *tiff, const TiffEntry *entry, guint index, gdouble *value)
+{
+    const guint8 *p = entry->value + index * 8;
+    guint32 numerator, denominator;
+    
+    if (index >= entry->count ||
+        (entry->type != TIFF_TYPE_RATIONAL && entry->type != TIFF_TYPE_SRATIONAL)) {
+        return FALSE;
+    }
+    
+    numerator = tiff_u32 (tiff, p);
+    denominator = tiff_u32 (tiff, p + 4);
+    if (denominator == 0) {
+        return FALSE;
+    }
+    
+    if (entry->type == TIFF_TYPE_SRATIONAL) {
+        *value = (gdouble)(gint32)numerator / (gint32)denominator;
+    } else {
+        *value = (gdouble)numerator / denominator;
+    }
+    
+    return TRUE;
+}
+
+/* "YYYY:MM:DD HH:MM:SS", in the zone given by an OffsetTime tag such
+ * as "+02:00", or local time when there is none */
+static GDateTime*
+exif_parse_date (const gchar *date, const gchar *offset)
+{
+    GDateTime *utc, *result;
+    gint year, month, day, hour, minute, second;
+    gint offset_hours, offset_minutes;
+    gchar sign;
+    
+    if (sscanf (date, "%4d:%2d:%2d %2d:%2d:%2d",
+                &year, &month, &day, &hour, &minute, &second) != 6) {
+        return NULL;
+    }
+    
+    /* Both constructors check the ranges and return NULL when wrong */
+    if (!offset ||
+        sscanf (offset, "%c%2d:%2d", &sign, &offset_hours, &offset_minutes) != 3 ||
+        (sign != '+' && sign != '-')) {
+        return g_date_time_new_local (year, month, day, hour, minute, second);
+    }
+    
+    utc = g_date_time_new_utc (year, month, day, hour, minute, second);
+    if (!utc) {
+        return NULL;
     }
     
-    /* Check if PNG and extract embedded metadata */
-    if (g_str_has_suffix (filepath, ".png") || 
-        g_str_has_suffix (filepath, ".PNG")) {
+    result = g_date_time_add_seconds (utc, (sign == '+' ? -60 : 60) *
+                                           (offset_hours * 60 + offset_minutes));
+    g_date_time_unref (utc);
+    
+    return result;
+}
+
+static void
+exif_parse_gps_ifd (const TiffReader *tiff, guint32 offset, FinderzImageMetadata *img_meta)
+{
+    gdouble latitude = 0, longitude = 0;
+    gboolean has_latitude = FALSE, has_longitude = FALSE;
+    gchar latitude_ref = 'N', longitude_ref = 'E';
+    guint n_entries = tiff_ifd_size (tiff, offset);
+    
+    for (guint i = 0; i < n_entries; i++) {
+        TiffEntry entry;
+        gdouble degrees, minutes, seconds;
+        
+        if (!tiff_get_entry (tiff, offset, i, &entry)) {
+            continue;
+        }
+        
+        switch (entry.tag) {
+            case GPS_TAG_LATITUDE_REF:
+            case GPS_TAG_LONGITUDE_REF:
+                if (entry.type == TIFF_TYPE_ASCII) {
+                    *(entry.tag == GPS_TAG_LATITUDE_REF ? &latitude_ref : &longitude_ref) =
+                        entry.value[0];
+                }
+                break;
+            case GPS_TAG_LATITUDE:
+            case GPS_TAG_LONGITUDE:
+                /* Degrees, minutes and seconds as three rationals */
+                if (tiff_get_rational (tiff, &entry, 0, &degrees) &&
+                    tiff_get_rational (tiff, &entry, 1, &minutes) &&
+                    tiff_get_rational (tiff, &entry, 2, &seconds)) {
+                    gdouble value = degrees + minutes / 60 + seconds / 3600;
+                    
+                    if (entry.tag == GPS_TAG_LATITUDE) {
+                        latitude = value;
+                        has_latitude = TRUE;
+                    } else {
+                        longitude = value;
+                        has_longitude = TRUE;
+                    }
+                }
+                break;
+            case GPS_TAG_ALTITUDE:
+                tiff_get_rational (tiff, &entry, 0, &img_meta->altitude);
+                break;
+            case GPS_TAG_ALTITUDE_REF:
+                /* 1 means below sea level */
+                if (entry.type == TIFF_TYPE_BYTE && entry.value[0] == 1) {
+                    img_meta->altitude = -ABS (img_meta->altitude);
+                }
+                break;
+        }
+    }
+    
+    if (has_latitude && has_longitude && latitude <= 90 && longitude <= 180) {
+        img_meta->latitude = latitude_ref == 'S' ? -latitude : latitude;
+        img_meta->longitude = longitude_ref == 'W' ? -longitude : longitude;
+        img_meta->has_location = TRUE;
+    }
+}
+
+/* UserComment starts with an 8-byte character code.  A1111 and Forge
+ * store their generation parameters here, as UTF-16 ("UNICODE"). */
+static gchar*
+exif_decode_user_comment (const TiffReader *tiff, const TiffEntry *entry)
+{
+    const guint8 *text = entry->value + 8;
+    gsize length;
+    gchar *result;
+    
+    if (entry->type != TIFF_TYPE_UNDEFINED || entry->count <= 8) {
+        return NULL;
+    }
+    length = entry->count - 8;
+    
+    if (memcmp (entry->value, "UNICODE\0", 8) == 0) {
+        gunichar2 *units = g_new (gunichar2, length / 2);
+        gboolean big_endian = tiff->big_endian;
+        
+        /* Writers disagree on the byte order; a leading ASCII
+         * character tells which half is zero */
+        if (length >= 2 && (text[0] == 0) != (text[1] == 0)) {
+            big_endian = text[0] == 0;
+        }
         
-        GHashTable *png_meta = extract_png_metadata (filepath);
+        for (gsize i = 0; i < length / 2; i++) {
+            units[i] = big_endian ? (text[2 * i] << 8) | text[2 * i + 1] :
+                                    (text[2 * i + 1] << 8) | text[2 * i];
+        }
         
-        if (g_hash_table_size (png_meta) > 0) {
-            if (!img_meta->ai_data) {
-                img_meta->ai_data = g_new0 (FinderzAIMetadata, 1);
+        result = g_utf16_to_utf8 (units, length / 2, NULL, NULL, NULL);
+        g_free (units);
+    } else if (memcmp (entry->value, "ASCII\0\0\0", 8) == 0 ||
+               memcmp (entry->value, "\0\0\0\0\0\0\0\0", 8) == 0) {
+        result = g_strndup ((const gchar *)text, length);
+    } else {
+        return NULL;
+    }
+    
+    if (result && (!g_utf8_validate (result, -1, NULL) || !*g_strchomp (result))) {
+        g_free (result);
+        result = NULL;
+    }
+    
+    return result;
+}
+
+/* Fill @img_meta from a TIFF structure, such as the body of a JPEG
+ * APP1 Exif segment.  @user_comment, if not NULL, receives the
+ * UserComment text. */
+static void
+exif_parse_tiff (const guint8 *data,
+                 gsize length,
+                 FinderzImageMetadata *img_meta,
+                 gchar **user_comment)
+{
+    TiffReader tiff = { data, length, FALSE };
+    gchar *date_time = NULL, *date_time_original = NULL, *offset_time = NULL;
+    guint32 ifds[2] = { 0, 0 };    /* Exif and GPS IFD offsets */
+    guint32 value;
+    
+    if (length < 8 || length > G_MAXUINT32) {
+        return;
+    }
+    
+    if (memcmp (data, "MM\0*", 4) == 0) {
+        tiff.big_endian = TRUE;
+    } else if (memcmp (data, "II*\0", 4) != 0) {
+        return;
+    }
+    
+    /* IFD0, then the Exif and GPS IFDs it points to.  Only those are
+     * followed, so a malformed file can't make us loop. */
+    for (gint level = 0; level < 3; level++) {
+        guint32 offset = level == 0 ? tiff_u32 (&tiff, data + 4) : ifds[level - 1];
+        guint n_entries;
+        
+        if (level == 2) {
+            if (offset) {
+                exif_parse_gps_ifd (&tiff, offset, img_meta);
             }
+            break;
+        }
+        
+        n_entries = offset ? tiff_ifd_size (&tiff, offset) : 0;
+        for (guint i = 0; i < n_entries; i++) {
+            TiffEntry entry;
             
-            /* Extract AI fields */
-            gchar *value;
-            if ((value = g_hash_table_lookup (png_meta, "prompt"))) {
-                g_free (img_meta->ai_data->prompt);
-                img_meta->ai_data->prompt = g_strdup (value);
+            if (!tiff_get_entry (&tiff, offset, i, &entry)) {
+                continue;
             }
-            if ((value = g_hash_table_lookup (png_meta, "negative_prompt"))) {
-                img_meta->ai_data->negative_prompt = g_strdup (value);
-            }
-            if ((value = g_hash_table_lookup (png_meta, "sampler"))) {
-                img_meta->ai_data->sampler = g_strdup (value);
-            }
-            if ((value = g_hash_table_lookup (png_meta, "steps"))) {
-                img_meta->ai_data->steps = atoi (value);
+            
+            switch (entry.tag) {
+                case TIFF_TAG_MAKE:
+                    if (!img_meta->camera_make) {
+                        img_meta->camera_make = tiff_get_string (&entry);
+                    }
+                    break;
+                case TIFF_TAG_MODEL:
+                    if (!img_meta->camera_model) {
+                        img_meta->camera_model = tiff_get_string (&entry);
+                    }
+                    break;
+                case TIFF_TAG_DATE_TIME:
+                    if (!date_time) {
+                        date_time = tiff_get_string (&entry);
+                    }
+                    break;
+                case TIFF_TAG_EXIF_IFD:
+                    if (level == 0 && tiff_get_uint (&tiff, &entry, &value)) {
+                        ifds[0] = value;
+                    }
+                    break;
+                case TIFF_TAG_GPS_IFD:
+                    if (level == 0 && tiff_get_uint (&tiff, &entry, &value)) {
+                        ifds[1] = value;
+                    }
+                    break;
+                case EXIF_TAG_EXPOSURE_TIME:
+                    tiff_get_rational (&tiff, &entry, 0, &img_meta->shutter_speed);
+                    break;
+                case EXIF_TAG_F_NUMBER:
+                    tiff_get_rational (&tiff, &entry, 0, &img_meta->aperture);
+                    break;
+                case EXIF_TAG_FOCAL_LENGTH:
+                    tiff_get_rational (&tiff, &entry, 0, &img_meta->focal_length);
+                    break;
+                case EXIF_TAG_ISO:
+                    if (tiff_get_uint (&tiff, &entry, &value)) {
+                        img_meta->iso = value;
+                    }
+                    break;
+                case EXIF_TAG_DATE_TIME_ORIGINAL:
+                    if (!date_time_original) {
+                        date_time_original = tiff_get_string (&entry);
+                    }
+                    break;
+                case EXIF_TAG_OFFSET_TIME_ORIGINAL:
+                    if (!offset_time) {
+                        offset_time = tiff_get_string (&entry);
+                    }
+                    break;
+                case EXIF_TAG_USER_COMMENT:
+                    if (user_comment && !*user_comment) {
+                        *user_comment = exif_decode_user_comment (&tiff, &entry);
+                    }
+                    break;
+                case EXIF_TAG_LENS_MODEL:
+                    if (!img_meta->lens) {
+                        img_meta->lens = tiff_get_string (&entry);
+                    }
+                    break;
             }
-            if ((value = g_hash_table_lookup (png_meta, "cfg_scale"))) {
-                img_meta->ai_data->cfg_scale = g_ascii_strtod (value, NULL);
+        }
+    }
+    
+    if (!img_meta->date_taken && (date_time_original || date_time)) {
+        img_meta->date_taken = exif_parse_date (date_time_original ? date_time_original : date_time,
+                                                offset_time);
+    }
+    
+    g_free (date_time);
+    g_free (date_time_original);
+    g_free (offset_time);
+}
+
+#define JPEG_EXIF_HEADER "Exif\0\0"
+#define JPEG_XMP_HEADER  "http://ns.adobe.com/xap/1.0/"
+
+/* Walk the marker segments that precede the image data.  Only APP1
+ * segments holding Exif or XMP are read, each at most 64 KB; the rest
+ * are skipped by seeking, and the walk stops at the start of scan. */
+static void
+extract_jpeg_metadata (const gchar *filepath,
+                       FinderzImageMetadata *img_meta,
+                       gchar **user_comment)
+{
+    GInputStream *stream;
+    gboolean have_exif = FALSE, have_xmp = FALSE;
+    guint8 soi[2];
+    
+    stream = open_buffered_stream (filepath);
+    if (!stream) {
+        return;
+    }
+    
+    if (!stream_read (stream, soi, 2) || soi[0] != 0xff || soi[1] != 0xd8) {
+        g_object_unref (stream);
+        return;
+    }
+    
+    while (!have_exif || !have_xmp) {
+        guint8 marker[2], size[2];
+        guint8 *segment;
+        guint16 length;
+        
+        if (!stream_read (stream, marker, 2) || marker[0] != 0xff) {
+            break;
+        }
+        
+        /* Fill bytes may pad any marker */
+        while (marker[1] == 0xff) {
+            if (!stream_read (stream, &marker[1], 1)) {
+                break;
             }
-            if ((value = g_hash_table_lookup (png_meta, "seed"))) {
-                img_meta->ai_data->seed = atoi (value);
+        }
+        
+        /* Start of scan or end of image: no headers follow */
+        if (marker[1] == 0xda || marker[1] == 0xd9) {
+            break;
+        }
+        
+        /* Standalone markers carry no length */
+        if (marker[1] == 0x01 || (marker[1] >= 0xd0 && marker[1] <= 0xd7)) {
+            continue;
+        }
+        
+        if (!stream_read (stream, size, 2)) {
+            break;
+        }
+        length = (size[0] << 8) | size[1];
+        if (length < 2) {
+            break;
+        }
+        length -= 2;
+        
+        if (marker[1] != 0xe1) {
+            if (!stream_skip (stream, length)) {
+                break;
             }
-            
-            /* Detect tool */
-            if (g_hash_table_lookup (png_meta, "workflow")) {
-                img_meta->ai_data->tool = g_strdup ("ComfyUI");
-            } else if (g_hash_table_lookup (png_meta, "parameters")) {
-                img_meta->ai_data->tool = g_strdup ("Stable Diffusion WebUI");
+            continue;
+        }
+        
+        segment = g_malloc (length);
+        if (!stream_read (stream, segment, length)) {
+            g_free (segment);
+            break;
+        }
+        
+        if (!have_exif && length > 6 && memcmp (segment, JPEG_EXIF_HEADER, 6) == 0) {
+            exif_parse_tiff (segment + 6, length - 6, img_meta, user_comment);
+            have_exif = TRUE;
+        } else if (!have_xmp && length > sizeof (JPEG_XMP_HEADER) &&
+                   memcmp (segment, JPEG_XMP_HEADER, sizeof (JPEG_XMP_HEADER)) == 0) {
+            finderz_xmp_parse_packet ((const gchar *)segment + sizeof (JPEG_XMP_HEADER),
+                                      length - sizeof (JPEG_XMP_HEADER), img_meta);
+            have_xmp = TRUE;
+        }
+        
+        g_free (segment);
+    }
+    
+    g_object_unref (stream);
+}
+
+/* Bound on the EXIF and XMP chunks read from a WebP */
+#define WEBP_MAX_CHUNK_SIZE (4 * 1024 * 1024)
+
+/* VP8X feature flags */
+#define WEBP_FLAG_XMP  0x04
+#define WEBP_FLAG_EXIF 0x08
+
+/* Walk the RIFF chunks of a WebP.  Only the extended format (VP8X)
+ * can carry metadata and its flags say which, so simple files cost one
+ * read, and otherwise image data is skipped by seeking until the EXIF
+ * and XMP chunks at the end have been read. */
+static void
+extract_webp_metadata (const gchar *filepath,
+                       FinderzImageMetadata *img_meta,
+                       gchar **user_comment)
+{
+    GInputStream *stream;
+    guint8 header[12];
+    guint32 size;
+    guint8 flags;
+    gboolean want_exif, want_xmp;
+    
+    stream = open_buffered_stream (filepath);
+    if (!stream) {
+        return;
+    }
+    
+    /* RIFF header, then VP8X as the first chunk with its flags first */
+    if (!stream_read (stream, header, 12) ||
+        memcmp (header, "RIFF", 4) != 0 || memcmp (header + 8, "WEBP", 4) != 0 ||
+        !stream_read (stream, header, 8) || memcmp (header, "VP8X", 4) != 0) {
+        g_object_unref (stream);
+        return;
+    }
+    
+    memcpy (&size, header + 4, sizeof (size));
+    size = GUINT32_FROM_LE (size);
+    if (size < 1 || !stream_read (stream, &flags, 1) ||
+        !stream_skip (stream, (gsize)size + (size & 1) - 1)) {
+        g_object_unref (stream);
+        return;
+    }
+    
+    want_exif = (flags & WEBP_FLAG_EXIF) != 0;
+    want_xmp = (flags & WEBP_FLAG_XMP) != 0;
+    
+    while (want_exif || want_xmp) {
+        gsize padded;
+        guint8 *data;
+        
+        if (!stream_read (stream, header, 8)) {
+            break;
+        }
+        memcpy (&size, header + 4, sizeof (size));
+        size = GUINT32_FROM_LE (size);
+        padded = (gsize)size + (size & 1);
+        
+        if ((memcmp (header, "EXIF", 4) != 0 && memcmp (header, "XMP ", 4) != 0) ||
+            size > WEBP_MAX_CHUNK_SIZE) {
+            if (!stream_skip (stream, padded)) {
+                break;
             }
+            continue;
+        }
+        
+        data = g_malloc (padded);
+        if (!stream_read (stream, data, padded)) {
+            g_free (data);
+            break;
+        }
+        
+        if (memcmp (header, "EXIF", 4) == 0) {
+            /* Some writers keep the JPEG APP1 prefix */
+            gsize offset = size > 6 && memcmp (data, JPEG_EXIF_HEADER, 6) == 0 ? 6 : 0;
             
-            /* Cache in xattrs for fast access */
-            if (img_meta->ai_data->prompt) {
-                finderz_xattr_set_ai_prompt (filepath, img_meta->ai_data->prompt);
-            }
-            if (img_meta->ai_data->model) {
-                finderz_xattr_set_ai_model (filepath, img_meta->ai_data->model);
-            }
+            exif_parse_tiff (data + offset, size - offset, img_meta, user_comment);
+            want_exif = FALSE;
+        } else {
+            finderz_xmp_parse_packet ((const gchar *)data, size, img_meta);
+            want_xmp = FALSE;
         }
         
-        g_hash_table_destroy (png_meta);
+        g_free (data);
     }
     
-    return img_meta;
+    g_object_unref (stream);
+}
+
+static GHashTable*
+new_ai_parameters (void)
+{
+    return g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+}
+
+/* Parameters from an EXIF UserComment, when it is the "Steps: ..."
+ * text the SD WebUI family writes; cameras put other text there */
+static GHashTable*
+parse_user_comment (const gchar *comment)
+{
+    GHashTable *params;
+    
+    if (!strstr (comment, "Steps:") && !strstr (comment, "Sampler:")) {
+        return NULL;
+    }
+    
+    params = new_ai_parameters ();
+    g_hash_table_insert (params, g_strdup ("parameters"), g_strdup (comment));
+    parse_sd_parameters (params, comment);
+    
+    return params;
 }
 
+/* Fill the AI fields of @img_meta from parsed generation parameters */
+static void
+apply_ai_parameters (FinderzImageMetadata *img_meta,
+                     GHashTable *params)
+{
+    gchar *value;
+    
+    if (!img_meta->ai_data) {
+        img_meta->ai_data = g_new0 (FinderzAIMetadata, 1);
+    }
+    
+    /* Extract AI fields */
+    if ((value = g_hash_table_lookup (params, "prompt"))) {
+        g_free (img_meta->ai_data->prompt);
+        img_meta->ai_data->prompt = g_strdup (value);
+    }
+    if ((value = g_hash_table_lookup (params, "model")) && !img_meta->ai_data->model) {
+        img_meta->ai_data->model = g_strdup (value);
+    }
+    if ((value = g_hash_table_lookup (params, "negative_prompt"))) {
+        g_free (img_meta->ai_data->negative_prompt);
+        img_meta->ai_data->negative_prompt = g_strdup (g_strchug (value));
+    }
+    /* ComfyUI's has the scheduler in it */
+    if ((value = g_hash_table_lookup (params, "sampler")) && !img_meta->ai_data->sampler) {
+        img_meta->ai_data->sampler = g_strdup (value);
+    }
+    if ((value = g_hash_table_lookup (params, "steps"))) {
+        img_meta->ai_data->steps = atoi (value);
+    }
+    if ((value = g_hash_table_lookup (params, "cfg_scale"))) {
+        img_meta->ai_data->cfg_scale = g_ascii_strtod (value, NULL);
+    }
+    if ((value = g_hash_table_lookup (params, "seed"))) {
+        img_meta->ai_data->seed = g_ascii_strtoll (value, NULL, 10);
+    }
+    
+    /* Detect tool; ComfyUI images have theirs set already */
+    if (!img_meta->ai_data->tool && g_hash_table_lookup (params, "parameters")) {
+        img_meta->ai_data->tool = g_strdup ("Stable Diffusion WebUI");
+    }
+    
+    /* Not cached in xattrs: a write changes the file's ctime, so the
+     * next look would extract it again, and the metadata index keeps
+     * these values without touching the file */
+}
+
+/* Reduce ComfyUI's "prompt" and "workflow" graphs to the settings they
+ * hold and drop them, so their JSON is not kept past this point or
+ * taken for a prompt */
+static void
+apply_comfyui_graphs (FinderzImageMetadata *img_meta, GHashTable *params)
+{
+    gchar *prompt = g_hash_table_lookup (params, "prompt");
+    const gchar *workflow = g_hash_table_lookup (params, "workflow");
+    
+    /* Other tools write a plain "prompt" chunk */
+    if (prompt && *g_strchug (prompt) != '{') {
+        prompt = NULL;
+    }
+    if (!prompt && !workflow) {
+        return;
+    }
+    
+    if (!img_meta->ai_data) {
+        img_meta->ai_data = g_new0 (FinderzAIMetadata, 1);
+    }
+    finderz_comfyui_parse (prompt, workflow, img_meta->ai_data);
+    if (!img_meta->ai_data->tool) {
+        img_meta->ai_data->tool = g_strdup ("ComfyUI");
+    }
+    
+    if (prompt) {
+        g_hash_table_remove (params, "prompt");
+    }
+    g_hash_table_remove (params, "workflow");
+}
+    
+/* @xattrs holds the file's Finderz attributes, as returned by
+ * finderz_xattr_get_all_finderz() */
+static FinderzImageMetadata*
+extract_image_metadata (const gchar *filepath, GHashTable *xattrs)
+{
+    FinderzImageMetadata *img_meta = g_new0 (FinderzImageMetadata, 1);
+    GHashTable *params = NULL;
+    gchar *user_comment = NULL;
+    const gchar *value;
+    
+    /* Try to get from extended attributes first (cached) */
+    if ((value = g_hash_table_lookup (xattrs, "rating"))) {
+        img_meta->rating = CLAMP (atoi (value), 0, 5);
+    }
+    
+    const gchar *ai_prompt = g_hash_table_lookup (xattrs, "ai.prompt");
+    const gchar *ai_model = g_hash_table_lookup (xattrs, "ai.model");
+    
+    if (ai_prompt || ai_model) {
+        img_meta->ai_data = g_new0 (FinderzAIMetadata, 1);
+        img_meta->ai_data->prompt = g_strdup (ai_prompt);
+        img_meta->ai_data->model = g_strdup (ai_model);
+    }
+    
+    if (has_extension (filepath, "jpg") || has_extension (filepath, "jpeg")) {
+        extract_jpeg_metadata (filepath, img_meta, &user_comment);
+    } else if (has_extension (filepath, "webp")) {
+        extract_webp_metadata (filepath, img_meta, &user_comment);
+    } else if (has_extension (filepath, "png")) {
+        /* Check if PNG and extract embedded metadata */
+        params = extract_png_metadata (filepath);
+        
+        if (params && (value = g_hash_table_lookup (params, PNG_XMP_KEYWORD))) {
+            finderz_xmp_parse_packet (value, strlen (value), img_meta);
+            g_hash_table_remove (params, PNG_XMP_KEYWORD);
+        }
+        if (params) {
+            apply_comfyui_graphs (img_meta, params);
+        }
+    }
+    
+    if (user_comment) {
+        params = parse_user_comment (user_comment);
+        g_free (user_comment);
+    }
+    
+    if (params) {
+        if (g_hash_table_size (params) > 0) {
+            apply_ai_parameters (img_meta, params);
+        }
+        g_hash_table_destroy (params);
+    }
+    
+    return img_meta;
+}
+    
+/* Extract basic image metadata using GdkPixbuf (temporary solution) */
+FinderzImageMetadata*
+finderz_extract_image_metadata_basic (const gchar *filepath)
+{
+    GHashTable *xattrs = finderz_xattr_get_all_finderz (filepath);
+    FinderzImageMetadata *img_meta = extract_image_metadata (filepath, xattrs);
+    
+    g_hash_table_destroy (xattrs);
+    return img_meta;
+}
+    
 /* Convert image metadata to universal metadata format */
 FinderzUniversalMetadata*
 finderz_image_to_universal_metadata (FinderzImageMetadata *img_meta,
                                       const gchar *filepath)
 {
-    FinderzUniversalMetadata *meta = g_new0 (FinderzUniversalMetadata, 1);
-    meta->fields = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                           g_free, 
-                                           (GDestroyNotify)finderz_metadata_field_free);
-    meta->file_path = g_strdup (filepath);
-    meta->last_extracted = g_date_time_new_now_local ();
+    FinderzUniversalMetadata *meta = finderz_universal_metadata_new (filepath);
     
     /* Add rating */
     if (img_meta->rating > 0) {
-        FinderzMetadataField *field = g_new0 (FinderzMetadataField, 1);
-        field->key = g_strdup ("rating");
-        field->value = g_strdup_printf ("%d", img_meta->rating);
-        field->display_name = g_strdup ("Rating");
-        field->category = g_strdup ("General");
-        field->sortable = TRUE;
-        field->numeric = TRUE;
-        field->numeric_value = img_meta->rating;
-        g_hash_table_insert (meta->fields, g_strdup ("rating"), field);
+        finderz_metadata_set_int (meta, FINDERZ_FIELD_RATING, img_meta->rating);
+    }
+    finderz_metadata_set_string (meta, FINDERZ_FIELD_COLOR_LABEL, img_meta->color_label);
+    
+    if (img_meta->keywords) {
+        GString *keywords = g_string_new (NULL);
+        
+        for (GList *l = img_meta->keywords; l; l = l->next) {
+            if (keywords->len > 0) {
+                g_string_append (keywords, ", ");
+            }
+            g_string_append (keywords, l->data);
+        }
+        finderz_metadata_set_string (meta, FINDERZ_FIELD_KEYWORDS, keywords->str);
+        g_string_free (keywords, TRUE);
+    }
+    
+    /* Add camera metadata; models usually repeat the make already */
+    if (img_meta->camera_model) {
+        if (img_meta->camera_make &&
+            g_ascii_strncasecmp (img_meta->camera_model, img_meta->camera_make,
+                                 strlen (img_meta->camera_make)) != 0) {
+            gchar *camera = g_strdup_printf ("%s %s", img_meta->camera_make,
+                                             img_meta->camera_model);
+            
+            finderz_metadata_set_string (meta, FINDERZ_FIELD_EXIF_CAMERA, camera);
+            g_free (camera);
+        } else {
+            finderz_metadata_set_string (meta, FINDERZ_FIELD_EXIF_CAMERA, img_meta->camera_model);
+        }
+    } else {
+        finderz_metadata_set_string (meta, FINDERZ_FIELD_EXIF_CAMERA, img_meta->camera_make);
+    }
+    
+    finderz_metadata_set_string (meta, FINDERZ_FIELD_EXIF_LENS, img_meta->lens);
+    if (img_meta->focal_length > 0) {
+        finderz_metadata_set_double (meta, FINDERZ_FIELD_EXIF_FOCAL_LENGTH, img_meta->focal_length);
+    }
+    if (img_meta->aperture > 0) {
+        finderz_metadata_set_double (meta, FINDERZ_FIELD_EXIF_APERTURE, img_meta->aperture);
+    }
+    if (img_meta->iso > 0) {
+        finderz_metadata_set_int (meta, FINDERZ_FIELD_EXIF_ISO, img_meta->iso);
+    }
+    if (img_meta->date_taken) {
+        finderz_metadata_set_date (meta, FINDERZ_FIELD_EXIF_DATE_TAKEN, img_meta->date_taken);
+    }
+    if (img_meta->has_location) {
+        gchar latitude[G_ASCII_DTOSTR_BUF_SIZE], longitude[G_ASCII_DTOSTR_BUF_SIZE];
+        gchar *location;
+        
+        /* Not in the locale's format, which may use a decimal comma */
+        g_ascii_formatd (latitude, sizeof (latitude), "%.5f", img_meta->latitude);
+        g_ascii_formatd (longitude, sizeof (longitude), "%.5f", img_meta->longitude);
+        location = g_strdup_printf ("%s, %s", latitude, longitude);
+        finderz_metadata_set_string (meta, FINDERZ_FIELD_GPS_LOCATION, location);
+        g_free (location);
     }
     
     /* Add AI metadata */
     if (img_meta->ai_data) {
         FinderzAIMetadata *ai = img_meta->ai_data;
         
-        if (ai->prompt) {
-            FinderzMetadataField *field = g_new0 (FinderzMetadataField, 1);
-            field->key = g_strdup ("ai_prompt");
-            field->value = g_strdup (ai->prompt);
-            field->display_name = g_strdup ("AI Prompt");
-            field->category = g_strdup ("AI Generation");
-            field->sortable = TRUE;
-            g_hash_table_insert (meta->fields, g_strdup ("ai_prompt"), field);
-        }
+        finderz_metadata_set_string (meta, FINDERZ_FIELD_AI_PROMPT, ai->prompt);
+        finderz_metadata_set_string (meta, FINDERZ_FIELD_AI_MODEL, ai->model);
+        finderz_metadata_set_string (meta, FINDERZ_FIELD_AI_SAMPLER, ai->sampler);
         
-        if (ai->model) {
-            FinderzMetadataField *field = g_new0 (FinderzMetadataField, 1);
-            field->key = g_strdup ("ai_model");
-            field->value = g_strdup (ai->model);
-            field->display_name = g_strdup ("AI Model");
-            field->category = g_strdup ("AI Generation");
-            field->sortable = TRUE;
-            g_hash_table_insert (meta->fields, g_strdup ("ai_model"), field);
-        }
+        finderz_metadata_set_string (meta, FINDERZ_FIELD_AI_NEGATIVE_PROMPT, ai->negative_prompt);
+        finderz_metadata_set_string (meta, FINDERZ_FIELD_AI_TOOL, ai->tool);
         
-        if (ai->sampler) {
-            FinderzMetadataField *field = g_new0 (FinderzMetadataField, 1);
-            field->key = g_strdup ("ai_sampler");
-            field->value = g_strdup (ai->sampler);
-            field->display_name = g_strdup ("Sampler");
-            field->category = g_strdup ("AI Generation");
-            field->sortable = TRUE;
-            g_hash_table_insert (meta->fields, g_strdup ("ai_sampler"), field);
+        if (ai->steps > 0) {
+            finderz_metadata_set_int (meta, FINDERZ_FIELD_AI_STEPS, ai->steps);
+        }
+        if (ai->cfg_scale > 0) {
+            finderz_metadata_set_double (meta, FINDERZ_FIELD_AI_CFG, ai->cfg_scale);
+        }
+        if (ai->seed != 0) {
+            finderz_metadata_set_int (meta, FINDERZ_FIELD_AI_SEED, ai->seed);
         }
         
-        if (ai->steps > 0) {
-            FinderzMetadataField *field = g_new0 (FinderzMetadataField, 1);
-            field->key = g_strdup ("ai_steps");
-            field->value = g_strdup_printf ("%d", ai->steps);
-            field->display_name = g_strdup ("Steps");
-            field->category = g_strdup ("AI Generation");
-            field->sortable = TRUE;
-            field->numeric = TRUE;
-            field->numeric_value = ai->steps;
-            g_hash_table_insert (meta->fields, g_strdup ("ai_steps"), field);
+        if (ai->loras && g_hash_table_size (ai->loras) > 0) {
+            GList *names = g_list_sort (g_hash_table_get_keys (ai->loras),
+                                        (GCompareFunc)g_utf8_collate);
+            GString *loras = g_string_new (NULL);
+            
+            for (GList *l = names; l; l = l->next) {
+                const gchar *strength = g_hash_table_lookup (ai->loras, l->data);
+                
+                g_string_append_printf (loras, "%s%s (%s)", loras->len ? ", " : "",
+                                        (const gchar *)l->data, strength);
+            }
+            finderz_metadata_set_string (meta, FINDERZ_FIELD_AI_LORAS, loras->str);
+            g_string_free (loras, TRUE);
+            g_list_free (names);
         }
+        finderz_metadata_set_string (meta, FINDERZ_FIELD_AI_WORKFLOW, ai->workflow_hash);
     }
     
     return meta;
 }
-
+    
+FinderzParserFlags
+finderz_metadata_parser_for_file (const gchar *filepath)
+{
+    if (has_extension (filepath, "png") ||
+        has_extension (filepath, "jpg") ||
+        has_extension (filepath, "jpeg") ||
+        has_extension (filepath, "webp")) {
+        return FINDERZ_PARSER_IMAGE;
+    }
+    if (finderz_media_probe_supports (filepath)) {
+        return FINDERZ_PARSER_MEDIA;
+    }
+    if (finderz_document_probe_supports (filepath)) {
+        return FINDERZ_PARSER_DOCUMENT;
+    }
+    
+    return 0;
+}
+    
 /* Main extraction function */
 FinderzUniversalMetadata*
 finderz_extract_all_metadata (const gchar *filepath, GError **error)
 {
-    if (!g_file_test (filepath, G_FILE_TEST_EXISTS)) {
+    return finderz_extract_metadata_skipping (filepath, 0, error);
+}
+    
+FinderzUniversalMetadata*
+finderz_extract_metadata_skipping (const gchar *filepath,
+                                   FinderzParserFlags skip,
+                                   GError **error)
+{
+    return finderz_extract_metadata_at (AT_FDCWD, filepath, skip, error);
+}
+    
+FinderzUniversalMetadata*
+finderz_extract_metadata_at (int dir_fd,
+                             const gchar *filepath,
+                             FinderzParserFlags skip,
+                             GError **error)
+{
+    const gchar *name;
+    struct stat st;
+    
+    /* Files of a folder being listed are found through the folder */
+    name = filepath;
+    if (dir_fd != AT_FDCWD) {
+        const gchar *slash = strrchr (filepath, '/');
+        
+        name = slash != NULL ? slash + 1 : filepath;
+    }
+    
+    if (fstatat (dir_fd, name, &st, 0) != 0) {
         g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
                      "File not found: %s", filepath);
         return NULL;
     }
     
+    /* Read every Finderz xattr in one pass; the image extractors and
+     * the generic merge below both use them */
+    GHashTable *xattrs = finderz_xattr_get_all_finderz_at (dir_fd, name);
+    
     /* Determine file type and extract accordingly */
     FinderzUniversalMetadata *metadata = NULL;
     
-    if (g_str_has_suffix (filepath, ".png") || 
-        g_str_has_suffix (filepath, ".PNG") ||
-        g_str_has_suffix (filepath, ".jpg") ||
-        g_str_has_suffix (filepath, ".jpeg") ||
-        g_str_has_suffix (filepath, ".webp")) {
-        
-        FinderzImageMetadata *img_meta = finderz_extract_image_metadata_basic (filepath);
-        metadata = finderz_image_to_universal_metadata (img_meta, filepath);
-        finderz_image_metadata_free (img_meta);
-    } else {
-        /* Generic metadata container */
-        metadata = g_new0 (FinderzUniversalMetadata, 1);
-        metadata->fields = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                                   g_free,
-                                                   (GDestroyNotify)finderz_metadata_field_free);
-        metadata->file_path = g_strdup (filepath);
-        metadata->last_extracted = g_date_time_new_now_local ();
+    switch (finderz_metadata_parser_for_file (filepath) & ~skip) {
+        case FINDERZ_PARSER_IMAGE: {
+            FinderzImageMetadata *img_meta = extract_image_metadata (filepath, xattrs);
+            metadata = finderz_image_to_universal_metadata (img_meta, filepath);
+            finderz_image_metadata_free (img_meta);
+            break;
+        }
+        case FINDERZ_PARSER_MEDIA:
+            metadata = finderz_universal_metadata_new (filepath);
+            finderz_media_probe (filepath, metadata);
+            break;
+        case FINDERZ_PARSER_DOCUMENT:
+            metadata = finderz_universal_metadata_new (filepath);
+            finderz_document_probe (filepath, metadata);
+            break;
+        default:
+            /* Generic metadata container */
+            metadata = finderz_universal_metadata_new (filepath);
+            break;
     }
     
     /* Always add xattr metadata */
-    GHashTable *xattrs = finderz_xattr_get_all_finderz (filepath);
-    if (xattrs) {
-        GHashTableIter iter;
-        gpointer key, value;
-        
-        g_hash_table_iter_init (&iter, xattrs);
-        while (g_hash_table_iter_next (&iter, &key, &value)) {
-            /* Don't duplicate if already extracted */
-            if (!g_hash_table_lookup (metadata->fields, key)) {
-                FinderzMetadataField *field = g_new0 (FinderzMetadataField, 1);
-                field->key = g_strdup (key);
-                field->value = g_strdup (value);
-                field->display_name = g_strdup (key);
-                field->category = g_strdup ("Extended Attributes");
-                field->sortable = TRUE;
-                field->source = FINDERZ_METADATA_SOURCE_XATTR;
-                g_hash_table_insert (metadata->fields, g_strdup (key), field);
-            }
+    GHashTableIter iter;
+    gpointer key, value;
+    
+    g_hash_table_iter_init (&iter, xattrs);
+    while (g_hash_table_iter_next (&iter, &key, &value)) {
+        FinderzFieldId field_id;
+        
+        field_id = finderz_metadata_schema_register (key, NULL, "Extended Attributes",
+                                                     FINDERZ_FIELD_TYPE_STRING,
+                                                     FINDERZ_METADATA_SOURCE_XATTR);
+        
+        /* Don't duplicate if already extracted */
+        if (!finderz_metadata_get_value (metadata, field_id)) {
+            finderz_metadata_set_from_string (metadata, field_id, value);
         }
-        g_hash_table_destroy (xattrs);
     }
+    g_hash_table_destroy (xattrs);
+    
+    finderz_universal_metadata_freeze (metadata);
     
     return metadata;
 }
\ No newline at end of file
@@ -0,0 +1,448 @@
+/* finderz-field-census.c
+ *
+ * Which metadata fields occur where, counted as files are extracted
+ *
+ * Every directory keeps a count of the files sampled under it and of
+ * how many carried each field, so a file is counted in its directory
+ * and in the directories above it: a question about a tree is answered
+ * by the entry for its root.  Files are counted by MIME type as well.
+ * Parsers are followed apart from fields, per directory only, to know
+ * in which folders they never find anything: a tree says nothing about
+ * a sibling folder that has not been browsed.
+ */
+
+#include "finderz-field-census.h"
+#include <string.h>
+
+/* Directories kept, the least recently counted dropped first */
+#define CENSUS_MAX_DIRECTORIES  4096
+/* Directories above a file that count it */
+#define CENSUS_MAX_DEPTH        16
+
+/* Every file of a directory is counted until this many have been,
+ * then one file in CENSUS_SAMPLE_INTERVAL */
+#define CENSUS_SAMPLE_SIZE      256
+#define CENSUS_SAMPLE_INTERVAL  16
+
+/* Files a parser has to find nothing in before it is skipped, and how
+ * often it runs anyway once it is */
+#define CENSUS_MIN_PROBES       32
+#define CENSUS_PROBE_INTERVAL   64
+
+/* Metadata is prefetched when a field is carried by this share of at
+ * least this many sampled files */
+#define CENSUS_PREFETCH_MIN_FILES  16
+#define CENSUS_PREFETCH_RATIO      0.5
+
+typedef struct {
+    guint probed;
+    guint found;
+    guint skipped;          /* since it last ran */
+} ParserCounts;
+
+typedef struct {
+    gchar *key;             /* directory path or MIME type */
+    guint files;            /* files sampled */
+    guint recorded;         /* files directly in the directory, sampled or not */
+    GArray *fields;         /* guint per field id, files carrying it */
+    ParserCounts parsers[FINDERZ_N_PARSERS];
+    GList *lru_link;        /* directories only */
+} CensusEntry;
+
+static GHashTable *directories = NULL;  /* path -> CensusEntry */
+static GQueue directories_lru = G_QUEUE_INIT; /* most recently counted first */
+static GHashTable *types = NULL;        /* MIME type -> CensusEntry */
+static CensusEntry *total = NULL;
+static GMutex census_mutex;
+static gint skip_generation = 0;
+
+static CensusEntry*
+census_entry_new (const gchar *key)
+{
+    CensusEntry *entry = g_new0 (CensusEntry, 1);
+    
+    entry->key = g_strdup (key);
+    entry->fields = g_array_new (FALSE, TRUE, sizeof (guint));
+    
+    return entry;
+}
+
+static void
+census_entry_free (CensusEntry *entry)
+{
+    g_free (entry->key);
+    g_array_unref (entry->fields);
+    g_free (entry);
+}
+
+/* The helpers below are called with census_mutex held */
+
+static void
+census_ensure (void)
+{
+    if (!total) {
+        directories = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                             (GDestroyNotify)census_entry_free);
+        types = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                       (GDestroyNotify)census_entry_free);
+        total = census_entry_new (NULL);
+    }
+}
+
+static CensusEntry*
+census_get_directory (const gchar *path)
+{
+    CensusEntry *entry;
+    
+    entry = g_hash_table_lookup (directories, path);
+    if (entry) {
+        if (directories_lru.head != entry->lru_link) {
+            g_queue_unlink (&directories_lru, entry->lru_link);
+            g_queue_push_head_link (&directories_lru, entry->lru_link);
+        }
+        return entry;
+    }
+    
+    if (g_hash_table_size (directories) >= CENSUS_MAX_DIRECTORIES) {
+        CensusEntry *oldest = g_queue_pop_tail (&directories_lru);
+        guint i;
+        
+        /* Its files were extracted without some parser; forgetting
+         * why means they should be looked at again */
+        for (i = 0; i < FINDERZ_N_PARSERS; i++) {
+            if (oldest->parsers[i].probed >= CENSUS_MIN_PROBES &&
+                oldest->parsers[i].found == 0) {
+                g_atomic_int_inc (&skip_generation);
+                break;
+            }
+        }
+        g_hash_table_remove (directories, oldest->key);
+    }
+    
+    entry = census_entry_new (path);
+    g_queue_push_head (&directories_lru, entry);
+    entry->lru_link = directories_lru.head;
+    g_hash_table_insert (directories, entry->key, entry);
+    
+    return entry;
+}
+
+static void
+census_count_fields (CensusEntry *entry, FinderzUniversalMetadata *metadata)
+{
+    guint i;
+    
+    entry->files++;
+    for (i = 0; i < metadata->n_values; i++) {
+        FinderzFieldId id = metadata->values[i].field_id;
+        
+        if (id >= entry->fields->len) {
+            g_array_set_size (entry->fields, id + 1);
+        }
+        g_array_index (entry->fields, guint, id)++;
+    }
+}
+
+static void
+census_count_parsers (CensusEntry *entry, FinderzParserFlags probed, FinderzParserFlags found)
+{
+    guint i;
+    
+    for (i = 0; i < FINDERZ_N_PARSERS; i++) {
+        if (probed & (1 << i)) {
+            ParserCounts *counts = &entry->parsers[i];
+            
+            /* A parser that was being skipped here turned out useful,
+             * so the files it was skipped for are out of date */
+            if ((found & (1 << i)) && counts->found == 0 &&
+                counts->probed >= CENSUS_MIN_PROBES) {
+                g_atomic_int_inc (&skip_generation);
+            }
+            
+            counts->probed++;
+            counts->skipped = 0;
+            if (found & (1 << i)) {
+                counts->found++;
+            }
+        }
+    }
+}
+
+/* Whether @metadata has fields a parser could have given it.  Records
+ * also hold xattrs, which are left out, and sidecar fields, which can
+ * only make a parser look useful when it was not, never the reverse. */
+static gboolean
+census_parser_found (FinderzUniversalMetadata *metadata)
+{
+    guint i;
+    
+    for (i = 0; i < metadata->n_values; i++) {
+        const FinderzFieldDescriptor *field;
+        
+        field = finderz_metadata_schema_get (metadata->values[i].field_id);
+        if (field &&
+            field->source != FINDERZ_METADATA_SOURCE_XATTR &&
+            field->source != FINDERZ_METADATA_SOURCE_SIDECAR) {
+            return TRUE;
+        }
+    }
+    
+    return FALSE;
+}
+
+/* The parent of directory @path, or NULL at the top */
+static gchar*
+census_parent (const gchar *path)
+{
+    gchar *parent = g_path_get_dirname (path);
+    
+    if (strcmp (parent, path) == 0 || strcmp (parent, ".") == 0) {
+        g_free (parent);
+        return NULL;
+    }
+    
+    return parent;
+}
+
+void
+finderz_field_census_record (const gchar *file_path,
+                             const gchar *mime_type,
+                             FinderzParserFlags probed,
+                             FinderzUniversalMetadata *metadata)
+{
+    FinderzParserFlags found;
+    CensusEntry *entry;
+    gboolean sampled;
+    gchar *path;
+    guint depth;
+    
+    g_return_if_fail (file_path != NULL);
+    g_return_if_fail (metadata != NULL);
+    
+    found = probed && census_parser_found (metadata) ? probed : 0;
+    path = g_path_get_dirname (file_path);
+    
+    g_mutex_lock (&census_mutex);
+    census_ensure ();
+    
+    entry = census_get_directory (path);
+    sampled = entry->recorded < CENSUS_SAMPLE_SIZE ||
+              entry->recorded % CENSUS_SAMPLE_INTERVAL == 0;
+    entry->recorded++;
+    census_count_parsers (entry, probed, found);
+    
+    for (depth = 0; entry; depth++) {
+        gchar *parent;
+        
+        if (sampled) {
+            census_count_fields (entry, metadata);
+        }
+        
+        parent = depth < CENSUS_MAX_DEPTH ? census_parent (path) : NULL;
+        g_free (path);
+        path = parent;
+        entry = path ? census_get_directory (path) : NULL;
+    }
+    
+    if (sampled) {
+        census_count_fields (total, metadata);
+        
+        if (mime_type) {
+            entry = g_hash_table_lookup (types, mime_type);
+            if (!entry) {
+                entry = census_entry_new (mime_type);
+                g_hash_table_insert (types, entry->key, entry);
+            }
+            census_count_fields (entry, metadata);
+        }
+    }
+    
+    g_mutex_unlock (&census_mutex);
+}
+
+gboolean
+finderz_field_census_is_empty (void)
+{
+    gboolean empty;
+    
+    g_mutex_lock (&census_mutex);
+    empty = !total || total->files == 0;
+    g_mutex_unlock (&census_mutex);
+    
+    return empty;
+}
+
+/* Called with census_mutex held; @entry may be NULL */
+static GList*
+census_get_fields (CensusEntry *entry)
+{
+    GList *fields = NULL;
+    guint id;
+    
+    if (!entry) {
+        return NULL;
+    }
+    
+    /* Ids go in as (count << 16 | id), so sorting by the counts is a
+     * sort of integers; FinderzFieldId is 16 bits */
+    for (id = 1; id < entry->fields->len; id++) {
+        guint count = g_array_index (entry->fields, guint, id);
+        
+        if (count > 0) {
+            fields = g_list_prepend (fields,
+                                     GUINT_TO_POINTER (MIN (count, G_MAXUINT16) << 16 | id));
+        }
+    }
+    
+    return fields;
+}
+
+static gint
+compare_by_count (gconstpointer a, gconstpointer b)
+{
+    guint count_a = GPOINTER_TO_UINT (a) >> 16;
+    guint count_b = GPOINTER_TO_UINT (b) >> 16;
+    
+    if (count_a != count_b) {
+        return count_a > count_b ? -1 : 1;
+    }
+    
+    return (gint)(GPOINTER_TO_UINT (a) & 0xffff) - (gint)(GPOINTER_TO_UINT (b) & 0xffff);
+}
+
+/* Most common first, the counts taken back out */
+static GList*
+census_sort_fields (GList *fields)
+{
+    GList *l;
+    
+    fields = g_list_sort (fields, compare_by_count);
+    for (l = fields; l; l = l->next) {
+        l->data = GUINT_TO_POINTER (GPOINTER_TO_UINT (l->data) & 0xffff);
+    }
+    
+    return fields;
+}
+
+GList*
+finderz_field_census_get_fields (const gchar *directory)
+{
+    GList *fields = NULL;
+    
+    g_mutex_lock (&census_mutex);
+    if (total) {
+        fields = census_get_fields (directory ?
+                                    g_hash_table_lookup (directories, directory) : total);
+    }
+    g_mutex_unlock (&census_mutex);
+    
+    return census_sort_fields (fields);
+}
+
+GList*
+finderz_field_census_get_fields_for_type (const gchar *mime_type)
+{
+    GList *fields = NULL;
+    
+    g_return_val_if_fail (mime_type != NULL, NULL);
+    
+    g_mutex_lock (&census_mutex);
+    if (total) {
+        fields = census_get_fields (g_hash_table_lookup (types, mime_type));
+    }
+    g_mutex_unlock (&census_mutex);
+    
+    return census_sort_fields (fields);
+}
+
+gboolean
+finderz_field_census_should_prefetch (const gchar *directory)
+{
+    CensusEntry *entry = NULL;
+    gboolean prefetch = FALSE;
+    gchar *path;
+    guint id;
+    
+    g_return_val_if_fail (directory != NULL, FALSE);
+    
+    g_mutex_lock (&census_mutex);
+    
+    /* A directory not seen yet goes by the tree it is in */
+    path = g_strdup (directory);
+    while (total && path) {
+        gchar *parent;
+        
+        entry = g_hash_table_lookup (directories, path);
+        if (entry && entry->files >= CENSUS_PREFETCH_MIN_FILES) {
+            break;
+        }
+        entry = NULL;
+        
+        parent = census_parent (path);
+        g_free (path);
+        path = parent;
+    }
+    g_free (path);
+    
+    for (id = 1; entry && id < entry->fields->len && !prefetch; id++) {
+        prefetch = g_array_index (entry->fields, guint, id) >=
+                   entry->files * CENSUS_PREFETCH_RATIO;
+    }
+    
+    g_mutex_unlock (&census_mutex);
+    
+    return prefetch;
+}
+
+gboolean
+finderz_field_census_should_skip (const gchar *file_path, FinderzParserFlags parser)
+{
+    CensusEntry *entry = NULL;
+    gboolean skip = FALSE;
+    gchar *path;
+    gint index;
+    
+    g_return_val_if_fail (file_path != NULL, FALSE);
+    
+    index = g_bit_nth_lsf (parser, -1);
+    if (index < 0 || index >= FINDERZ_N_PARSERS) {
+        return FALSE;
+    }
+    
+    path = g_path_get_dirname (file_path);
+    
+    g_mutex_lock (&census_mutex);
+    
+    if (total) {
+        entry = g_hash_table_lookup (directories, path);
+    }
+    if (entry &&
+        entry->parsers[index].probed >= CENSUS_MIN_PROBES &&
+        entry->parsers[index].found == 0) {
+        skip = ++entry->parsers[index].skipped % CENSUS_PROBE_INTERVAL != 0;
+    }
+    
+    g_mutex_unlock (&census_mutex);
+    
+    g_free (path);
+    return skip;
+}
+
+guint
+finderz_field_census_get_skip_generation (void)
+{
+    return (guint)g_atomic_int_get (&skip_generation);
+}
+
+void
+finderz_field_census_clear (void)
+{
+    g_mutex_lock (&census_mutex);
+    if (total) {
+        g_queue_clear (&directories_lru);
+        g_clear_pointer (&directories, g_hash_table_destroy);
+        g_clear_pointer (&types, g_hash_table_destroy);
+        g_clear_pointer (&total, census_entry_free);
+    }
+    g_mutex_unlock (&census_mutex);
+}
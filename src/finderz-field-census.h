@@ -0,0 +1,54 @@
+/* finderz-field-census.h
+ *
+ * Which metadata fields occur where, counted as files are extracted
+ */
+
+#ifndef FINDERZ_FIELD_CENSUS_H
+#define FINDERZ_FIELD_CENSUS_H
+
+#include <glib.h>
+#include "finderz-universal-metadata.h"
+
+G_BEGIN_DECLS
+
+/* Count the fields of @metadata, extracted from @file_path of type
+ * @mime_type (may be NULL), under its directory and the directories
+ * above it.  @probed are the parsers that were run on the file.  Once
+ * a directory has been sampled well, only some of its files count. */
+void finderz_field_census_record (const gchar *file_path,
+                                  const gchar *mime_type,
+                                  FinderzParserFlags probed,
+                                  FinderzUniversalMetadata *metadata);
+
+/* Whether any file has been counted yet */
+gboolean finderz_field_census_is_empty (void);
+
+/* Ids of the fields seen under @directory, or anywhere when NULL, most
+ * common first, as GUINT_TO_POINTER().  Free with g_list_free(). */
+GList* finderz_field_census_get_fields (const gchar *directory);
+
+/* The same for the files of type @mime_type */
+GList* finderz_field_census_get_fields_for_type (const gchar *mime_type);
+
+/* Whether most files under @directory, or under the nearest directory
+ * above it sampled well enough, carry some field, so metadata is worth
+ * loading with the listing rather than when a column asks for it */
+gboolean finderz_field_census_should_prefetch (const gchar *directory);
+
+/* Whether @parser can be left out for @file_path: it has found nothing
+ * in enough of the files probed in the file's own directory.  It is
+ * still run once in a while, so a folder that gains such files is
+ * noticed. */
+gboolean finderz_field_census_should_skip (const gchar *file_path,
+                                           FinderzParserFlags parser);
+
+/* Changes when a parser skipped somewhere may no longer be; a record
+ * extracted with parsers skipped under an older value is out of date */
+guint finderz_field_census_get_skip_generation (void);
+
+/* Forget everything counted */
+void finderz_field_census_clear (void);
+
+G_END_DECLS
+
+#endif /* FINDERZ_FIELD_CENSUS_H */
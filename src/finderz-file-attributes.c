@@ -5,60 +5,332 @@
  */
 
 #include <glib.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
 #include <libnemo-private/nemo-file.h>
 #include "finderz-universal-metadata.h"
+#include "finderz-metadata-index.h"
+#include "finderz-field-census.h"
+#include "finderz-text-index.h"
 #include "finderz-xattr-handler.h"
 #include "finderz-integration.h"
+#include "finderz-file-attributes.h"
 
-/* Cache of metadata for active files */
-static GHashTable *metadata_cache = NULL;
+/* Cache of extracted metadata, bounded by a byte budget and trimmed
+ * least recently used first.  A record attached to a live NemoFile
+ * stays alive through that reference after it is evicted. */
+#define FINDERZ_METADATA_CACHE_BUDGET (32 * 1024 * 1024)
+
+typedef struct {
+    gchar *uri;
+    FinderzUniversalMetadata *metadata;
+    gsize cost;
+    GList *lru_link;
+} MetadataCacheEntry;
+
+static GHashTable *metadata_cache = NULL; /* uri -> MetadataCacheEntry */
+static GQueue metadata_lru = G_QUEUE_INIT; /* most recently used first */
+static gsize metadata_cache_bytes = 0;
+static gsize metadata_cache_budget = FINDERZ_METADATA_CACHE_BUDGET;
 static GMutex metadata_cache_mutex;
 
+/* Extraction opens and parses files, which can take a long time on
+ * network mounts, so it runs here and never on the main thread */
+#define FINDERZ_EXTRACTION_THREADS 4
+static GThreadPool *extraction_pool = NULL;
+
+/* Each NemoFile keeps a reference to its metadata once it has been
+ * looked up, so sorting reads sort keys without touching the cache */
+static GQuark file_metadata_quark = 0;
+
+/* A folder whose files are being loaded.  It is opened once, by the
+ * first worker to reach one of its files, and the rest of the folder is
+ * stat'ed and read relative to it; it is closed when the last load for
+ * it is done.  Guarded by load_directories_mutex. */
+typedef struct {
+    gchar *path;
+    int fd;
+    gboolean opened;
+    guint n_requests;
+} LoadDirectory;
+
+static GHashTable *load_directories = NULL; /* path -> LoadDirectory */
+static GMutex load_directories_mutex;
+
+/* What a worker needs to know about the file it extracts */
+typedef struct {
+    gchar *uri;
+    gchar *mime_type;
+    FinderzFileStamp stamp;
+    LoadDirectory *directory;
+} LoadRequest;
+
+static void extract_metadata_thread (gpointer data, gpointer user_data);
+
+static void
+cache_entry_free (MetadataCacheEntry *entry)
+{
+    g_free (entry->uri);
+    finderz_universal_metadata_unref (entry->metadata);
+    g_free (entry);
+}
+
+static LoadDirectory*
+load_directory_ref (NemoFile *file)
+{
+    LoadDirectory *directory;
+    GFile *parent;
+    gchar *path;
+    
+    parent = nemo_file_get_parent_location (file);
+    path = parent ? g_file_get_path (parent) : NULL;
+    g_clear_object (&parent);
+    if (!path) {
+        return NULL;
+    }
+    
+    g_mutex_lock (&load_directories_mutex);
+    directory = g_hash_table_lookup (load_directories, path);
+    if (!directory) {
+        directory = g_new0 (LoadDirectory, 1);
+        directory->path = path;
+        directory->fd = -1;
+        g_hash_table_insert (load_directories, directory->path, directory);
+    } else {
+        g_free (path);
+    }
+    directory->n_requests++;
+    g_mutex_unlock (&load_directories_mutex);
+    
+    return directory;
+}
+
+static void
+load_directory_unref (LoadDirectory *directory)
+{
+    g_mutex_lock (&load_directories_mutex);
+    if (--directory->n_requests == 0) {
+        g_hash_table_remove (load_directories, directory->path);
+    } else {
+        directory = NULL;
+    }
+    g_mutex_unlock (&load_directories_mutex);
+    
+    if (directory) {
+        if (directory->fd >= 0) {
+            close (directory->fd);
+        }
+        g_free (directory->path);
+        g_free (directory);
+    }
+}
+
+/* The descriptor of @directory, opened on first use; AT_FDCWD when it
+ * cannot be opened, so the file is found by its full path instead */
+static int
+load_directory_get_fd (LoadDirectory *directory)
+{
+    int fd;
+    
+    if (!directory) {
+        return AT_FDCWD;
+    }
+    
+    g_mutex_lock (&load_directories_mutex);
+    if (!directory->opened) {
+#ifdef O_PATH
+        directory->fd = open (directory->path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+#else
+        directory->fd = open (directory->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+#endif
+        directory->opened = TRUE;
+    }
+    fd = directory->fd >= 0 ? directory->fd : AT_FDCWD;
+    g_mutex_unlock (&load_directories_mutex);
+    
+    return fd;
+}
+
+static void
+load_request_free (LoadRequest *request)
+{
+    if (request->directory) {
+        load_directory_unref (request->directory);
+    }
+    g_free (request->uri);
+    g_free (request->mime_type);
+    g_free (request);
+}
+
 /* Initialize the metadata cache */
 void
 finderz_file_attributes_init (void)
 {
     if (!metadata_cache) {
         metadata_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                                 g_free,
-                                                 (GDestroyNotify)finderz_universal_metadata_free);
+                                                 NULL,
+                                                 (GDestroyNotify)cache_entry_free);
         g_mutex_init (&metadata_cache_mutex);
+        load_directories = g_hash_table_new (g_str_hash, g_str_equal);
+        g_mutex_init (&load_directories_mutex);
+        file_metadata_quark = g_quark_from_static_string ("finderz-file-metadata");
+        
+        extraction_pool = g_thread_pool_new (extract_metadata_thread, NULL,
+                                             FINDERZ_EXTRACTION_THREADS,
+                                             FALSE, NULL);
         
         /* Initialize metadata system */
         finderz_universal_metadata_init ();
+        finderz_metadata_index_init ();
+        finderz_text_index_init ();
     }
 }
 
-/* Get or load metadata for a file */
-static FinderzUniversalMetadata*
-get_or_load_metadata (const gchar *uri)
+/* The cache helpers below are called with metadata_cache_mutex held */
+
+static void
+cache_remove_entry (MetadataCacheEntry *entry)
+{
+    g_queue_delete_link (&metadata_lru, entry->lru_link);
+    metadata_cache_bytes -= entry->cost;
+    g_hash_table_remove (metadata_cache, entry->uri);
+}
+
+static void
+cache_trim (void)
+{
+    while (metadata_cache_bytes > metadata_cache_budget &&
+           g_queue_get_length (&metadata_lru) > 1) {
+        cache_remove_entry (g_queue_peek_tail (&metadata_lru));
+    }
+}
+
+static void
+cache_touch (MetadataCacheEntry *entry)
+{
+    if (metadata_lru.head != entry->lru_link) {
+        g_queue_unlink (&metadata_lru, entry->lru_link);
+        g_queue_push_head_link (&metadata_lru, entry->lru_link);
+    }
+}
+
+/* Takes over the caller's reference to @metadata */
+static void
+cache_insert (const gchar *uri, FinderzUniversalMetadata *metadata)
+{
+    MetadataCacheEntry *entry;
+    
+    entry = g_hash_table_lookup (metadata_cache, uri);
+    if (entry) {
+        cache_remove_entry (entry);
+    }
+    
+    entry = g_new0 (MetadataCacheEntry, 1);
+    entry->uri = g_strdup (uri);
+    entry->metadata = metadata;
+    entry->cost = sizeof (MetadataCacheEntry) + strlen (uri) + 1 +
+                  finderz_universal_metadata_get_size (metadata);
+    
+    g_queue_push_head (&metadata_lru, entry);
+    entry->lru_link = metadata_lru.head;
+    g_hash_table_insert (metadata_cache, entry->uri, entry);
+    metadata_cache_bytes += entry->cost;
+    
+    cache_trim ();
+}
+
+static void
+file_stamp (NemoFile *file, FinderzFileStamp *stamp)
+{
+    stamp->mtime = nemo_file_get_mtime (file);
+    stamp->ctime = nemo_file_get_ctime (file);
+    stamp->size = nemo_file_get_size (file);
+}
+
+/* Writing a file changes its mtime and size; setting a rating or
+ * other xattr changes only its ctime.  A record extracted without some
+ * parser is also out of date once the census finds it useful. */
+static gboolean
+metadata_is_current (FinderzUniversalMetadata *metadata, NemoFile *file)
+{
+    FinderzFileStamp stamp;
+    
+    if (metadata->skipped_parsers &&
+        metadata->skip_generation != finderz_field_census_get_skip_generation ()) {
+        return FALSE;
+    }
+    
+    file_stamp (file, &stamp);
+    
+    return metadata->stamp.mtime == stamp.mtime &&
+           metadata->stamp.ctime == stamp.ctime &&
+           metadata->stamp.size == stamp.size;
+}
+
+/* Runs on a pool thread; the lock is only held to publish the result */
+static void
+extract_metadata_thread (gpointer data, gpointer user_data)
 {
+    GTask *task = data;
+    LoadRequest *request = g_task_get_task_data (task);
     FinderzUniversalMetadata *metadata;
-    gchar *path;
+    FinderzFileKey key;
+    FinderzParserFlags parser, skipped;
+    guint skip_generation;
+    gboolean indexed;
+    GError *error = NULL;
     GFile *gfile;
+    gchar *path;
+    const gchar *name;
+    int dir_fd;
     
-    g_mutex_lock (&metadata_cache_mutex);
-    
-    /* Check cache first */
-    metadata = g_hash_table_lookup (metadata_cache, uri);
-    if (metadata) {
-        g_mutex_unlock (&metadata_cache_mutex);
-        return metadata;
+    /* The view moved on before we got to this file */
+    if (g_task_return_error_if_cancelled (task)) {
+        g_object_unref (task);
+        return;
     }
     
-    /* Convert URI to path */
-    gfile = g_file_new_for_uri (uri);
+    gfile = g_file_new_for_uri (request->uri);
     path = g_file_get_path (gfile);
     g_object_unref (gfile);
     
-    if (!path) {
-        g_mutex_unlock (&metadata_cache_mutex);
-        return NULL;
+    /* Relative to the folder when it is open, so each file costs no
+     * full path lookup on a network mount */
+    dir_fd = AT_FDCWD;
+    name = path;
+    if (path && request->directory &&
+        g_str_has_prefix (path, request->directory->path) &&
+        strrchr (path, '/') == path + strlen (request->directory->path)) {
+        dir_fd = load_directory_get_fd (request->directory);
+        if (dir_fd != AT_FDCWD) {
+            name = strrchr (path, '/') + 1;
+        }
     }
     
-    /* Extract metadata */
-    GError *error = NULL;
-    metadata = finderz_extract_all_metadata (path, &error);
+    metadata = NULL;
+    indexed = path && finderz_metadata_index_stat_at (dir_fd, name, &key);
+    if (indexed) {
+        /* Files seen in an earlier session are answered from the
+         * index without being opened */
+        metadata = finderz_metadata_index_lookup (path, &key);
+    }
+    
+    parser = path ? finderz_metadata_parser_for_file (path) : 0;
+    skipped = 0;
+    skip_generation = finderz_field_census_get_skip_generation ();
+    if (path && !metadata) {
+        /* Parsers that never find anything in this tree are left out */
+        if (parser && finderz_field_census_should_skip (path, parser)) {
+            skipped = parser;
+        }
+        metadata = finderz_extract_metadata_at (dir_fd, path, skipped, &error);
+        
+        /* Only complete records are kept for later sessions */
+        if (metadata && indexed && !skipped) {
+            finderz_metadata_index_store (path, &key, metadata);
+        }
+    }
     
     if (error) {
         g_debug ("FINDERZ: Failed to extract metadata for %s: %s", 
@@ -66,78 +338,231 @@ get_or_load_metadata (const gchar *uri)
         g_error_free (error);
     }
     
-    /* Cache it */
-    if (metadata) {
-        g_hash_table_insert (metadata_cache, g_strdup (uri), metadata);
+    /* Files we could not read get an empty record, so they are not
+     * retried on every redraw */
+    if (!metadata) {
+        metadata = finderz_universal_metadata_new (path);
     }
     
-    g_free (path);
+    /* Sidecars can change while the file stays the same, so they are
+     * read on top of the indexed record rather than stored in it */
+    if (path) {
+        finderz_apply_sidecar_metadata (metadata, path);
+        if (!error) {
+            finderz_field_census_record (path, request->mime_type,
+                                         parser & ~skipped, metadata);
+            /* Only writes when the file's text fields changed */
+            finderz_text_index_update (path, metadata);
+        }
+    }
+    metadata->stamp = request->stamp;
+    metadata->skipped_parsers = skipped;
+    metadata->skip_generation = skip_generation;
+    
+    g_mutex_lock (&metadata_cache_mutex);
+    cache_insert (request->uri, metadata);
     g_mutex_unlock (&metadata_cache_mutex);
     
-    return metadata;
+    g_free (path);
+    
+    g_task_return_boolean (task, TRUE);
+    g_object_unref (task);
 }
 
-/* Get string value for a Finderz attribute */
-gchar*
-finderz_file_get_metadata_attribute (NemoFile *file, const gchar *attribute)
+/* Extract metadata for @file on a worker thread; @callback runs in the
+ * caller's main context once the cache holds an entry for it */
+void
+finderz_file_attributes_load_async (NemoFile *file,
+                                    GCancellable *cancellable,
+                                    GAsyncReadyCallback callback,
+                                    gpointer user_data)
 {
-    gchar *uri;
-    FinderzUniversalMetadata *metadata;
-    FinderzMetadataField *field;
-    gchar *result = NULL;
+    LoadRequest *request;
+    GTask *task;
     
-    if (!file || !attribute) {
-        return NULL;
+    g_return_if_fail (file != NULL);
+    
+    request = g_new0 (LoadRequest, 1);
+    request->uri = nemo_file_get_uri (file);
+    request->mime_type = nemo_file_get_mime_type (file);
+    file_stamp (file, &request->stamp);
+    if (load_directories) {
+        request->directory = load_directory_ref (file);
     }
     
-    /* Get file URI */
+    task = g_task_new (NULL, cancellable, callback, user_data);
+    g_task_set_source_tag (task, finderz_file_attributes_load_async);
+    g_task_set_task_data (task, request, (GDestroyNotify)load_request_free);
+    
+    if (!extraction_pool) {
+        g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_NOT_INITIALIZED,
+                                 "Finderz metadata is not initialized");
+        g_object_unref (task);
+        return;
+    }
+    
+    g_thread_pool_push (extraction_pool, task, NULL);
+}
+
+gboolean
+finderz_file_attributes_load_finish (GAsyncResult *result,
+                                     GError **error)
+{
+    g_return_val_if_fail (g_task_is_valid (result, NULL), FALSE);
+    
+    return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+/* Ask the file's directory to load its metadata on the worker pool */
+static void
+request_metadata_load (NemoFile *file)
+{
+    if (nemo_file_check_if_ready (file, NEMO_FILE_ATTRIBUTE_FINDERZ_METADATA)) {
+        /* Loaded before, but dropped from the cache since */
+        nemo_file_invalidate_attributes (file, NEMO_FILE_ATTRIBUTE_FINDERZ_METADATA);
+    } else {
+        nemo_file_call_when_ready (file, NEMO_FILE_ATTRIBUTE_FINDERZ_METADATA,
+                                   NULL, NULL);
+    }
+}
+
+/* Drop the record attached to @file and its cache entry */
+static void
+forget_file_metadata (NemoFile *file)
+{
+    gchar *uri;
+    
+    g_object_set_qdata (G_OBJECT (file), file_metadata_quark, NULL);
+    
+    uri = nemo_file_get_uri (file);
+    finderz_file_attributes_invalidate (uri);
+    g_free (uri);
+}
+
+/* Attach the cached record for @file, if there is a current one */
+static FinderzUniversalMetadata*
+attach_cached_metadata (NemoFile *file)
+{
+    FinderzUniversalMetadata *metadata = NULL;
+    MetadataCacheEntry *entry;
+    gchar *uri;
+    
     uri = nemo_file_get_uri (file);
     if (!uri) {
         return NULL;
     }
     
-    /* Special handling for quick attributes */
-    if (g_strcmp0 (attribute, "rating") == 0) {
-        /* Try xattr first for speed */
-        GFile *gfile = nemo_file_get_location (file);
-        gchar *path = g_file_get_path (gfile);
-        if (path) {
-            gint rating = finderz_xattr_get_rating (path);
-            if (rating > 0) {
-                GString *stars = g_string_new ("");
-                for (int i = 0; i < rating; i++) {
-                    g_string_append (stars, "★");
-                }
-                for (int i = rating; i < 5; i++) {
-                    g_string_append (stars, "☆");
-                }
-                result = g_string_free (stars, FALSE);
-            }
-            g_free (path);
+    g_mutex_lock (&metadata_cache_mutex);
+    entry = g_hash_table_lookup (metadata_cache, uri);
+    if (entry && !metadata_is_current (entry->metadata, file)) {
+        cache_remove_entry (entry);
+        entry = NULL;
+    }
+    if (entry) {
+        cache_touch (entry);
+        metadata = finderz_universal_metadata_ref (entry->metadata);
+    }
+    g_mutex_unlock (&metadata_cache_mutex);
+    
+    if (metadata) {
+        g_object_set_qdata_full (G_OBJECT (file), file_metadata_quark, metadata,
+                                 (GDestroyNotify)finderz_universal_metadata_unref);
+    }
+    
+    g_free (uri);
+    return metadata;
+}
+
+/* Metadata attached to @file, fetched from the cache on first use.
+ * Never touches the file itself: on a miss, or once Nemo has seen the
+ * file change, the load is queued and the view hears about the result
+ * through nemo_file_changed(). */
+static FinderzUniversalMetadata*
+peek_file_metadata (NemoFile *file)
+{
+    FinderzUniversalMetadata *metadata;
+    
+    metadata = g_object_get_qdata (G_OBJECT (file), file_metadata_quark);
+    if (metadata) {
+        if (metadata_is_current (metadata, file)) {
+            return metadata;
         }
-        g_object_unref (gfile);
         
-        if (result) {
-            g_free (uri);
-            return result;
-        }
+        forget_file_metadata (file);
+        request_metadata_load (file);
+        return NULL;
     }
     
-    /* Load full metadata */
-    metadata = get_or_load_metadata (uri);
+    metadata = attach_cached_metadata (file);
     if (!metadata) {
-        g_free (uri);
+        request_metadata_load (file);
+    }
+    
+    return metadata;
+}
+
+/* Called on the main thread once a load for @file has finished */
+void
+finderz_file_attributes_file_loaded (NemoFile *file)
+{
+    if (!file || !metadata_cache) {
+        return;
+    }
+    
+    /* The new record replaces whatever was attached before */
+    g_object_set_qdata (G_OBJECT (file), file_metadata_quark, NULL);
+    attach_cached_metadata (file);
+}
+
+FinderzUniversalMetadata*
+finderz_file_get_attached_metadata (NemoFile *file)
+{
+    FinderzUniversalMetadata *metadata;
+    
+    if (!file || !metadata_cache) {
         return NULL;
     }
     
-    /* Get the field */
-    field = finderz_get_metadata_field (metadata, attribute);
-    if (field) {
-        result = finderz_format_metadata_value (field);
+    metadata = g_object_get_qdata (G_OBJECT (file), file_metadata_quark);
+    if (metadata && !metadata_is_current (metadata, file)) {
+        return NULL;
     }
     
-    g_free (uri);
-    return result;
+    return metadata;
+}
+
+FinderzUniversalMetadata*
+finderz_file_peek_metadata (NemoFile *file)
+{
+    if (!file || !metadata_cache) {
+        return NULL;
+    }
+    
+    return peek_file_metadata (file);
+}
+
+/* Get string value for a Finderz attribute; NULL until it is loaded */
+gchar*
+finderz_file_get_metadata_attribute (NemoFile *file, const gchar *attribute)
+{
+    FinderzUniversalMetadata *metadata;
+    const FinderzMetadataValue *value;
+    
+    if (!file || !attribute || !metadata_cache) {
+        return NULL;
+    }
+    
+    metadata = peek_file_metadata (file);
+    if (!metadata) {
+        return NULL;
+    }
+    
+    value = finderz_get_metadata_field (metadata, attribute);
+    if (!value) {
+        return NULL;
+    }
+    
+    return finderz_format_metadata_value (value);
 }
 
 /* Check if we handle this attribute */
@@ -153,6 +578,8 @@ finderz_is_metadata_attribute (const gchar *attribute)
             g_str_has_prefix (attribute, "exif_") ||
             g_str_has_prefix (attribute, "mac_") ||
             g_str_has_prefix (attribute, "gps_") ||
+            g_str_has_prefix (attribute, "media_") ||
+            g_str_has_prefix (attribute, "doc_") ||
             g_strcmp0 (attribute, "rating") == 0 ||
             g_strcmp0 (attribute, "color_label") == 0 ||
             g_strcmp0 (attribute, "keywords") == 0 ||
@@ -169,56 +596,110 @@ finderz_is_metadata_attribute (const gchar *attribute)
 void
 finderz_file_attributes_invalidate (const gchar *uri)
 {
+    MetadataCacheEntry *entry;
+    
+    if (!metadata_cache || !uri) {
+        return;
+    }
+    
     g_mutex_lock (&metadata_cache_mutex);
-    g_hash_table_remove (metadata_cache, uri);
+    entry = g_hash_table_lookup (metadata_cache, uri);
+    if (entry) {
+        cache_remove_entry (entry);
+    }
     g_mutex_unlock (&metadata_cache_mutex);
 }
 
+/* Forget everything known about @file so the next load re-reads it */
+void
+finderz_file_attributes_invalidate_file (NemoFile *file)
+{
+    if (!file || !metadata_cache) {
+        return;
+    }
+    
+    forget_file_metadata (file);
+}
+
+/* The file left every view; keep the cache for files still shown */
+void
+finderz_file_attributes_file_finalized (NemoFile *file)
+{
+    if (!metadata_cache) {
+        return;
+    }
+    
+    forget_file_metadata (file);
+}
+
 /* Clear all cached metadata */
 void
 finderz_file_attributes_clear_cache (void)
 {
+    if (!metadata_cache) {
+        return;
+    }
+    
     g_mutex_lock (&metadata_cache_mutex);
     g_hash_table_remove_all (metadata_cache);
+    g_queue_clear (&metadata_lru);
+    metadata_cache_bytes = 0;
     g_mutex_unlock (&metadata_cache_mutex);
 }
 
-/* Get sortable value for an attribute */
+/* Limit the memory held by cached records; records still attached to
+ * a NemoFile are not counted once evicted */
+void
+finderz_file_attributes_set_cache_budget (gsize budget_bytes)
+{
+    g_mutex_lock (&metadata_cache_mutex);
+    metadata_cache_budget = budget_bytes;
+    if (metadata_cache) {
+        cache_trim ();
+    }
+    g_mutex_unlock (&metadata_cache_mutex);
+}
+
+/* Sorting asks for the same attribute on every comparison; remember
+ * its field id rather than looking it up in the schema each time.
+ * Only used from the main thread. */
+static FinderzFieldId
+attribute_field_id (const gchar *attribute)
+{
+    static const gchar *cached_key = NULL;
+    static FinderzFieldId cached_id = FINDERZ_FIELD_INVALID;
+    
+    if (!cached_key || strcmp (attribute, cached_key) != 0) {
+        const FinderzFieldDescriptor *descriptor;
+        
+        cached_id = finderz_metadata_schema_lookup (attribute);
+        descriptor = finderz_metadata_schema_get (cached_id);
+        cached_key = descriptor ? descriptor->key : NULL;
+    }
+    
+    return cached_id;
+}
+
+/* Compare files by the precomputed sort key of a metadata field.
+ * Only records already attached are used, so a comparison neither
+ * allocates nor queues loads: the view asks for the metadata of the
+ * whole folder before sorting by it, and files still waiting sort as
+ * lacking the field until nemo_file_changed() moves them. */
 gint
 finderz_file_compare_by_metadata (NemoFile *file1, NemoFile *file2, 
                                    const gchar *attribute)
 {
-    gchar *value1 = finderz_file_get_metadata_attribute (file1, attribute);
-    gchar *value2 = finderz_file_get_metadata_attribute (file2, attribute);
-    gint result;
+    FinderzUniversalMetadata *metadata1, *metadata2;
+    FinderzFieldId field_id;
     
-    /* Handle NULL values */
-    if (!value1 && !value2) {
+    if (!metadata_cache || !attribute) {
         return 0;
-    } else if (!value1) {
-        g_free (value2);
-        return -1;
-    } else if (!value2) {
-        g_free (value1);
-        return 1;
-    }
-    
-    /* Special handling for numeric fields */
-    if (g_strcmp0 (attribute, "rating") == 0 ||
-        g_strcmp0 (attribute, "ai_steps") == 0 ||
-        g_strcmp0 (attribute, "ai_seed") == 0 ||
-        g_strcmp0 (attribute, "exif_iso") == 0) {
-        /* Compare as numbers */
-        gint num1 = atoi (value1);
-        gint num2 = atoi (value2);
-        result = num1 - num2;
-    } else {
-        /* Compare as strings */
-        result = g_utf8_collate (value1, value2);
     }
     
-    g_free (value1);
-    g_free (value2);
+    field_id = attribute_field_id (attribute);
+    metadata1 = finderz_file_get_attached_metadata (file1);
+    metadata2 = finderz_file_get_attached_metadata (file2);
     
-    return result;
-}
\ No newline at end of file
+    return finderz_metadata_value_compare (finderz_metadata_get_value (metadata1, field_id),
+                                           finderz_metadata_get_value (metadata2, field_id));
+}
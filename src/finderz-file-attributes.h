@@ -7,14 +7,37 @@
 #define FINDERZ_FILE_ATTRIBUTES_H
 
 #include <glib.h>
+#include <gio/gio.h>
 #include <libnemo-private/nemo-file.h>
+#include "finderz-universal-metadata.h"
 
 G_BEGIN_DECLS
 
 /* Initialize the metadata attribute system */
 void finderz_file_attributes_init (void);
 
-/* Get string value for a Finderz attribute */
+/* Extract metadata for a file on the worker pool */
+void finderz_file_attributes_load_async (NemoFile *file,
+                                         GCancellable *cancellable,
+                                         GAsyncReadyCallback callback,
+                                         gpointer user_data);
+gboolean finderz_file_attributes_load_finish (GAsyncResult *result,
+                                              GError **error);
+
+/* The metadata of @file, or NULL until it is loaded, queueing the load
+ * as a column does; the view hears when it is done through
+ * nemo_file_changed().  Borrowed, and valid until the file changes. */
+FinderzUniversalMetadata* finderz_file_peek_metadata (NemoFile *file);
+
+/* The metadata already attached to @file while it is current, or NULL;
+ * unlike finderz_file_peek_metadata() it never queues a load, so it is
+ * safe to call from comparators */
+FinderzUniversalMetadata* finderz_file_get_attached_metadata (NemoFile *file);
+
+/* Attach the record a finished load left in the cache to @file */
+void finderz_file_attributes_file_loaded (NemoFile *file);
+
+/* Get string value for a Finderz attribute; NULL until loaded */
 gchar* finderz_file_get_metadata_attribute (NemoFile *file, const gchar *attribute);
 
 /* Check if we handle this attribute */
@@ -23,10 +46,20 @@ gboolean finderz_is_metadata_attribute (const gchar *attribute);
 /* Clear metadata cache for a file */
 void finderz_file_attributes_invalidate (const gchar *uri);
 
+/* Clear cached metadata for a file, including what is attached to it */
+void finderz_file_attributes_invalidate_file (NemoFile *file);
+
+/* Evict the metadata of a file that is being destroyed */
+void finderz_file_attributes_file_finalized (NemoFile *file);
+
 /* Clear all cached metadata */
 void finderz_file_attributes_clear_cache (void);
 
-/* Compare files by metadata attribute for sorting */
+/* Bound the metadata cache; 32 MiB unless changed */
+void finderz_file_attributes_set_cache_budget (gsize budget_bytes);
+
+/* Compare files by metadata attribute for sorting; only metadata
+ * already attached to the files is used */
 gint finderz_file_compare_by_metadata (NemoFile *file1, NemoFile *file2, 
                                         const gchar *attribute);
 
@@ -0,0 +1,909 @@
+/* finderz-filter.c
+ *
+ * Filters over file names and metadata
+ *
+ * The filter text is compiled into a flat list of instructions, one per
+ * term: a field id, an opcode and a constant already in the form values
+ * are compared in, that is bounds on the sort key for numbers and dates
+ * and casefolded text or a glob for text.  A folder is filtered one
+ * instruction at a time over a vector of the rows still in, each
+ * instruction narrowing it, so the dearer text terms only look at the
+ * files the cheap numeric ones let through.
+ */
+
+#include "finderz-filter.h"
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef GLIB_VERSION_2_70
+#define g_pattern_spec_match g_pattern_match
+#endif
+
+/* In the order they run, cheapest first */
+typedef enum {
+    FILTER_OP_EXISTS,           /* the field is set */
+    FILTER_OP_RANGE,            /* a number or date within bounds */
+    FILTER_OP_TEXT_EQUAL,
+    FILTER_OP_TEXT_ORDER,       /* text sorts before or after the constant */
+    FILTER_OP_TEXT_CONTAINS,
+    FILTER_OP_TEXT_GLOB,
+    FILTER_OP_NAME_CONTAINS,
+    FILTER_OP_NAME_GLOB
+} FilterOpcode;
+
+/* Operators as written */
+typedef enum {
+    FILTER_OPERATOR_MATCH,      /* : */
+    FILTER_OPERATOR_EQUAL,
+    FILTER_OPERATOR_NOT_EQUAL,
+    FILTER_OPERATOR_LESS,
+    FILTER_OPERATOR_LESS_EQUAL,
+    FILTER_OPERATOR_GREATER,
+    FILTER_OPERATOR_GREATER_EQUAL
+} FilterOperator;
+
+typedef struct {
+    FilterOpcode opcode;
+    FinderzFieldId field_id;    /* FINDERZ_FIELD_INVALID for the name */
+    gboolean negate;
+    /* RANGE: inclusive bounds on INT64 and DATE keys, and on DOUBLE keys */
+    gint64 int_min;
+    gint64 int_max;
+    gdouble double_min;
+    gdouble double_max;
+    /* TEXT_ORDER: the signs the comparison of collate keys may have */
+    gint order_min;
+    gint order_max;
+    gchar *text;                /* casefolded; a collate key for TEXT_ORDER */
+    gsize text_length;
+    gboolean ascii;             /* values can be compared without casefolding */
+    GPatternSpec *pattern;      /* globs with ? or outside ASCII */
+    gchar **segments;           /* other globs: the text around the stars */
+    guint n_segments;
+} FilterInstruction;
+
+typedef struct {
+    gboolean negate;
+    gchar *key;                 /* NULL for a bare term */
+    FilterOperator operator;
+    gchar *value;
+} FilterTerm;
+
+struct _FinderzFilter {
+    gchar *text;
+    FilterInstruction *instructions;
+    guint n_instructions;
+    gboolean needs_metadata;
+    GString *scratch;           /* values lowercased for globs */
+};
+
+/* Parsing */
+
+static gboolean
+scan_operator (const gchar *p, FilterOperator *operator, gsize *length)
+{
+    *length = 1;
+    
+    switch (*p) {
+        case ':':
+            *operator = FILTER_OPERATOR_MATCH;
+            return TRUE;
+        case '=':
+            *operator = FILTER_OPERATOR_EQUAL;
+            return TRUE;
+        case '!':
+            *operator = FILTER_OPERATOR_NOT_EQUAL;
+            *length = 2;
+            return p[1] == '=';
+        case '<':
+            *operator = p[1] == '=' ? FILTER_OPERATOR_LESS_EQUAL : FILTER_OPERATOR_LESS;
+            *length = p[1] == '=' ? 2 : 1;
+            return TRUE;
+        case '>':
+            *operator = p[1] == '=' ? FILTER_OPERATOR_GREATER_EQUAL : FILTER_OPERATOR_GREATER;
+            *length = p[1] == '=' ? 2 : 1;
+            return TRUE;
+        default:
+            return FALSE;
+    }
+}
+
+/* A quoted or a plain word.  A quote left open is taken to the end of
+ * the text, as it is still being typed. */
+static gchar*
+scan_value (const gchar **cursor)
+{
+    const gchar *p = *cursor;
+    const gchar *start, *end;
+    
+    if (*p == '"') {
+        start = p + 1;
+        end = strchr (start, '"');
+        if (end) {
+            *cursor = end + 1;
+        } else {
+            end = start + strlen (start);
+            *cursor = end;
+        }
+    } else {
+        for (start = p; *p && !g_ascii_isspace (*p); p++) {
+        }
+        end = p;
+        *cursor = p;
+    }
+    
+    return g_strndup (start, end - start);
+}
+
+/* Split off the next term; FALSE at the end of the text */
+static gboolean
+scan_term (const gchar **cursor, FilterTerm *term)
+{
+    const gchar *p = *cursor;
+    const gchar *key;
+    gsize length;
+    
+    memset (term, 0, sizeof (FilterTerm));
+    
+    while (g_ascii_isspace (*p)) {
+        p++;
+    }
+    if (*p == '\0') {
+        *cursor = p;
+        return FALSE;
+    }
+    
+    if (*p == '-' && p[1] != '\0' && !g_ascii_isspace (p[1])) {
+        term->negate = TRUE;
+        p++;
+    }
+    
+    key = p;
+    while (g_ascii_isalnum (*p) || *p == '_' || *p == '.' || *p == '-') {
+        p++;
+    }
+    if (p > key && scan_operator (p, &term->operator, &length)) {
+        term->key = g_strndup (key, p - key);
+        p += length;
+    } else {
+        p = key;
+    }
+    
+    term->value = scan_value (&p);
+    *cursor = p;
+    
+    return TRUE;
+}
+
+/* The field @key names, trying the common prefixes in front of it */
+static FinderzFieldId
+lookup_field (const gchar *key)
+{
+    static const gchar *prefixes[] = { "ai_", "exif_", "doc_", "media_" };
+    FinderzFieldId id;
+    guint i;
+    
+    id = finderz_metadata_schema_lookup (key);
+    for (i = 0; i < G_N_ELEMENTS (prefixes) && id == FINDERZ_FIELD_INVALID; i++) {
+        gchar *prefixed = g_strconcat (prefixes[i], key, NULL);
+        
+        id = finderz_metadata_schema_lookup (prefixed);
+        g_free (prefixed);
+    }
+    
+    return id;
+}
+
+/* Compiling */
+
+static gboolean
+parse_number (const gchar *text, gint64 *int_value, gdouble *double_value)
+{
+    gchar *end;
+    
+    if (g_ascii_strcasecmp (text, "yes") == 0 || g_ascii_strcasecmp (text, "true") == 0) {
+        *int_value = 1;
+        *double_value = 1;
+        return TRUE;
+    } else if (g_ascii_strcasecmp (text, "no") == 0 || g_ascii_strcasecmp (text, "false") == 0) {
+        *int_value = 0;
+        *double_value = 0;
+        return TRUE;
+    }
+    
+    errno = 0;
+    *int_value = g_ascii_strtoll (text, &end, 10);
+    if (end != text && *end == '\0' && errno == 0) {
+        *double_value = (gdouble)*int_value;
+        return TRUE;
+    }
+    
+    *double_value = g_ascii_strtod (text, &end);
+    if (end == text || *end != '\0' || !isfinite (*double_value)) {
+        return FALSE;
+    }
+    
+    /* Integer keys compare against the whole numbers on either side */
+    if (*double_value >= (gdouble)G_MAXINT64) {
+        *int_value = G_MAXINT64;
+    } else if (*double_value <= (gdouble)G_MININT64) {
+        *int_value = G_MININT64;
+    } else {
+        *int_value = (gint64)*double_value;
+    }
+    
+    return TRUE;
+}
+
+/* Bounds on integer keys for a comparison with the span of keys from
+ * @first to @last: one key for a number, every microsecond of the day
+ * for a date.  @first > @last stands for a number between two keys. */
+static void
+set_int_bounds (FilterInstruction *instruction,
+                FilterOperator operator,
+                gint64 first,
+                gint64 last)
+{
+    instruction->int_min = G_MININT64;
+    instruction->int_max = G_MAXINT64;
+    
+    switch (operator) {
+        case FILTER_OPERATOR_LESS:
+            if (first == G_MININT64) {
+                instruction->int_min = 1;
+                instruction->int_max = 0;
+            } else {
+                instruction->int_max = first - 1;
+            }
+            break;
+        case FILTER_OPERATOR_LESS_EQUAL:
+            instruction->int_max = last;
+            break;
+        case FILTER_OPERATOR_GREATER:
+            if (last == G_MAXINT64) {
+                instruction->int_min = 1;
+                instruction->int_max = 0;
+            } else {
+                instruction->int_min = last + 1;
+            }
+            break;
+        case FILTER_OPERATOR_GREATER_EQUAL:
+            instruction->int_min = first;
+            break;
+        default:
+            instruction->int_min = first;
+            instruction->int_max = last;
+            break;
+    }
+}
+
+static void
+set_double_bounds (FilterInstruction *instruction,
+                   FilterOperator operator,
+                   gdouble number)
+{
+    instruction->double_min = -INFINITY;
+    instruction->double_max = INFINITY;
+    
+    switch (operator) {
+        case FILTER_OPERATOR_LESS:
+            instruction->double_max = nextafter (number, -INFINITY);
+            break;
+        case FILTER_OPERATOR_LESS_EQUAL:
+            instruction->double_max = number;
+            break;
+        case FILTER_OPERATOR_GREATER:
+            instruction->double_min = nextafter (number, INFINITY);
+            break;
+        case FILTER_OPERATOR_GREATER_EQUAL:
+            instruction->double_min = number;
+            break;
+        default:
+            instruction->double_min = number;
+            instruction->double_max = number;
+            break;
+    }
+}
+
+static gboolean
+compile_number (FilterInstruction *instruction,
+                FilterOperator operator,
+                const gchar *text,
+                GError **error)
+{
+    gint64 int_value;
+    gdouble double_value;
+    gint64 first, last;
+    
+    if (!parse_number (text, &int_value, &double_value)) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                     "'%s' is not a number", text);
+        return FALSE;
+    }
+    
+    first = last = int_value;
+    if (double_value != (gdouble)int_value) {
+        /* Between two whole numbers */
+        if (double_value > (gdouble)int_value && int_value < G_MAXINT64) {
+            first = int_value + 1;
+        } else if (double_value < (gdouble)int_value && int_value > G_MININT64) {
+            last = int_value - 1;
+        }
+    }
+    
+    instruction->opcode = FILTER_OP_RANGE;
+    set_int_bounds (instruction, operator, first, last);
+    set_double_bounds (instruction, operator, double_value);
+    
+    return TRUE;
+}
+
+static gint64
+date_time_to_usec (GDateTime *date)
+{
+    return g_date_time_to_unix (date) * G_USEC_PER_SEC +
+           g_date_time_get_microsecond (date);
+}
+
+/* The microseconds @text covers: a whole year, month or day in local
+ * time, or one instant for a full ISO 8601 date */
+static gboolean
+parse_date (const gchar *text, gint64 *first, gint64 *last)
+{
+    GDateTime *start, *end;
+    gsize length = strlen (text);
+    gboolean calendar = length == 4 || length == 7 || length == 10;
+    gsize i;
+    
+    for (i = 0; i < length && calendar; i++) {
+        calendar = i == 4 || i == 7 ? text[i] == '-' : g_ascii_isdigit (text[i]);
+    }
+    
+    if (!calendar) {
+        GTimeZone *local = g_time_zone_new_local ();
+        
+        start = g_date_time_new_from_iso8601 (text, local);
+        g_time_zone_unref (local);
+        if (!start) {
+            return FALSE;
+        }
+        
+        *first = *last = date_time_to_usec (start);
+        g_date_time_unref (start);
+        return TRUE;
+    }
+    
+    start = g_date_time_new_local (atoi (text),
+                                   length > 4 ? atoi (text + 5) : 1,
+                                   length > 7 ? atoi (text + 8) : 1,
+                                   0, 0, 0);
+    if (!start) {
+        return FALSE;
+    }
+    
+    if (length == 4) {
+        end = g_date_time_add_years (start, 1);
+    } else if (length == 7) {
+        end = g_date_time_add_months (start, 1);
+    } else {
+        end = g_date_time_add_days (start, 1);
+    }
+    
+    *first = date_time_to_usec (start);
+    *last = date_time_to_usec (end) - 1;
+    g_date_time_unref (start);
+    g_date_time_unref (end);
+    
+    return TRUE;
+}
+
+static gboolean
+compile_date (FilterInstruction *instruction,
+              FilterOperator operator,
+              const gchar *text,
+              GError **error)
+{
+    gint64 first, last;
+    
+    if (!parse_date (text, &first, &last)) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                     "'%s' is not a date", text);
+        return FALSE;
+    }
+    
+    instruction->opcode = FILTER_OP_RANGE;
+    set_int_bounds (instruction, operator, first, last);
+    /* Dates have no DOUBLE keys */
+    instruction->double_min = INFINITY;
+    instruction->double_max = -INFINITY;
+    
+    return TRUE;
+}
+
+static gboolean
+is_ascii (const gchar *text)
+{
+    for (; *text; text++) {
+        if ((guchar)*text >= 0x80) {
+            return FALSE;
+        }
+    }
+    
+    return TRUE;
+}
+
+static void
+compile_text (FilterInstruction *instruction, FilterOpcode opcode, const gchar *text)
+{
+    instruction->opcode = opcode;
+    instruction->text = g_utf8_casefold (text, -1);
+    instruction->text_length = strlen (instruction->text);
+    instruction->ascii = is_ascii (instruction->text);
+    
+    if (opcode != FILTER_OP_TEXT_GLOB && opcode != FILTER_OP_NAME_GLOB) {
+        return;
+    }
+    
+    /* Most globs are only stars and text, matched without copying */
+    if (instruction->ascii && !strchr (instruction->text, '?')) {
+        instruction->segments = g_strsplit (instruction->text, "*", -1);
+        instruction->n_segments = g_strv_length (instruction->segments);
+    } else {
+        instruction->pattern = g_pattern_spec_new (instruction->text);
+    }
+}
+
+static void
+compile_order (FilterInstruction *instruction, FilterOperator operator, const gchar *text)
+{
+    instruction->opcode = FILTER_OP_TEXT_ORDER;
+    instruction->text = g_utf8_collate_key (text, -1);
+    instruction->order_min = operator == FILTER_OPERATOR_LESS ||
+                             operator == FILTER_OPERATOR_LESS_EQUAL ? -1 :
+                             operator == FILTER_OPERATOR_GREATER ? 1 : 0;
+    instruction->order_max = operator == FILTER_OPERATOR_GREATER ||
+                             operator == FILTER_OPERATOR_GREATER_EQUAL ? 1 :
+                             operator == FILTER_OPERATOR_LESS ? -1 : 0;
+}
+
+static gboolean
+has_wildcards (const gchar *text)
+{
+    return strpbrk (text, "*?") != NULL;
+}
+
+static gboolean
+compile_term (FilterTerm *term, FilterInstruction *instruction, GError **error)
+{
+    const FinderzFieldDescriptor *field;
+    FilterOperator operator = term->operator;
+    
+    instruction->negate = term->negate;
+    if (operator == FILTER_OPERATOR_NOT_EQUAL) {
+        instruction->negate = !instruction->negate;
+        operator = FILTER_OPERATOR_EQUAL;
+    }
+    
+    if (!term->key || strcmp (term->key, "name") == 0) {
+        if (operator != FILTER_OPERATOR_MATCH && operator != FILTER_OPERATOR_EQUAL) {
+            g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                         "File names can only be matched, with : or =");
+            return FALSE;
+        }
+        
+        /* A bare word is looked for in the name, name: matches all of it */
+        compile_text (instruction,
+                      term->key || has_wildcards (term->value) ?
+                      FILTER_OP_NAME_GLOB : FILTER_OP_NAME_CONTAINS,
+                      term->value);
+        return TRUE;
+    }
+    
+    instruction->field_id = lookup_field (term->key);
+    field = finderz_metadata_schema_get (instruction->field_id);
+    if (!field) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                     "Unknown field '%s'", term->key);
+        return FALSE;
+    }
+    
+    if (operator == FILTER_OPERATOR_MATCH || operator == FILTER_OPERATOR_EQUAL) {
+        if (term->value[0] == '\0' || strcmp (term->value, "*") == 0) {
+            instruction->opcode = FILTER_OP_EXISTS;
+            return TRUE;
+        }
+    } else if (term->value[0] == '\0') {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                     "Nothing to compare '%s' with", term->key);
+        return FALSE;
+    }
+    
+    switch (field->type) {
+        case FINDERZ_FIELD_TYPE_STRING:
+            if (operator == FILTER_OPERATOR_MATCH) {
+                compile_text (instruction,
+                              has_wildcards (term->value) ?
+                              FILTER_OP_TEXT_GLOB : FILTER_OP_TEXT_CONTAINS,
+                              term->value);
+            } else if (operator == FILTER_OPERATOR_EQUAL) {
+                compile_text (instruction, FILTER_OP_TEXT_EQUAL, term->value);
+            } else if (!compile_number (instruction, operator, term->value, NULL)) {
+                /* Text that holds numbers sorts by them, other text by
+                 * its collate key */
+                compile_order (instruction, operator, term->value);
+            }
+            return TRUE;
+        case FINDERZ_FIELD_TYPE_DATE:
+            return compile_date (instruction, operator, term->value, error);
+        default:
+            return compile_number (instruction, operator, term->value, error);
+    }
+}
+
+static void
+instruction_clear (FilterInstruction *instruction)
+{
+    g_free (instruction->text);
+    g_strfreev (instruction->segments);
+    if (instruction->pattern) {
+        g_pattern_spec_free (instruction->pattern);
+    }
+}
+
+static gint
+compare_instructions (gconstpointer a, gconstpointer b)
+{
+    const FilterInstruction *instruction1 = a;
+    const FilterInstruction *instruction2 = b;
+    
+    return (gint)instruction1->opcode - (gint)instruction2->opcode;
+}
+
+FinderzFilter*
+finderz_filter_new (const gchar *text, GError **error)
+{
+    FinderzFilter *filter;
+    GArray *instructions;
+    FilterTerm term;
+    const gchar *cursor;
+    guint i;
+    
+    g_return_val_if_fail (text != NULL, NULL);
+    
+    instructions = g_array_new (FALSE, TRUE, sizeof (FilterInstruction));
+    
+    cursor = text;
+    while (scan_term (&cursor, &term)) {
+        FilterInstruction instruction;
+        gboolean compiled;
+        
+        memset (&instruction, 0, sizeof (FilterInstruction));
+        compiled = compile_term (&term, &instruction, error);
+        g_free (term.key);
+        g_free (term.value);
+        
+        if (!compiled) {
+            instruction_clear (&instruction);
+            for (i = 0; i < instructions->len; i++) {
+                instruction_clear (&g_array_index (instructions, FilterInstruction, i));
+            }
+            g_array_free (instructions, TRUE);
+            return NULL;
+        }
+        
+        g_array_append_val (instructions, instruction);
+    }
+    
+    /* Terms are all ANDed, so they can run in any order */
+    g_array_sort (instructions, compare_instructions);
+    
+    filter = g_new0 (FinderzFilter, 1);
+    filter->text = g_strdup (text);
+    filter->n_instructions = instructions->len;
+    filter->instructions = (FilterInstruction *)g_array_free (instructions, FALSE);
+    filter->scratch = g_string_new (NULL);
+    
+    for (i = 0; i < filter->n_instructions; i++) {
+        if (filter->instructions[i].field_id != FINDERZ_FIELD_INVALID) {
+            filter->needs_metadata = TRUE;
+        }
+    }
+    
+    return filter;
+}
+
+void
+finderz_filter_free (FinderzFilter *filter)
+{
+    guint i;
+    
+    if (!filter) {
+        return;
+    }
+    
+    for (i = 0; i < filter->n_instructions; i++) {
+        instruction_clear (&filter->instructions[i]);
+    }
+    g_free (filter->instructions);
+    g_free (filter->text);
+    g_string_free (filter->scratch, TRUE);
+    g_free (filter);
+}
+
+const gchar*
+finderz_filter_get_text (FinderzFilter *filter)
+{
+    g_return_val_if_fail (filter != NULL, NULL);
+    
+    return filter->text;
+}
+
+gboolean
+finderz_filter_needs_metadata (FinderzFilter *filter)
+{
+    g_return_val_if_fail (filter != NULL, FALSE);
+    
+    return filter->needs_metadata;
+}
+
+/* Running */
+
+/* Where @needle, lowercase ASCII, is in @haystack, ignoring ASCII case */
+static const gchar*
+ascii_find (const gchar *haystack, const gchar *needle, gsize needle_length)
+{
+    gchar first[3];
+    const gchar *p;
+    
+    if (needle_length == 0) {
+        return haystack;
+    }
+    
+    /* Jump from one place the first letter is, in either case, to the next */
+    first[0] = needle[0];
+    first[1] = g_ascii_toupper (needle[0]);
+    first[2] = '\0';
+    
+    for (p = strpbrk (haystack, first); p; p = strpbrk (p + 1, first)) {
+        if (g_ascii_strncasecmp (p, needle, needle_length) == 0) {
+            return p;
+        }
+    }
+    
+    return NULL;
+}
+
+/* Match a glob of stars and ASCII text: the first segment at the start
+ * of @string, the last at its end and the ones between, leftmost first,
+ * in order in what is left */
+static gboolean
+segments_match (gchar **segments, guint n_segments, const gchar *string)
+{
+    const gchar *p = string;
+    gsize length, rest;
+    guint i;
+    
+    if (n_segments == 1) {
+        return g_ascii_strcasecmp (string, segments[0]) == 0;
+    }
+    
+    length = strlen (segments[0]);
+    if (g_ascii_strncasecmp (p, segments[0], length) != 0) {
+        return FALSE;
+    }
+    p += length;
+    
+    for (i = 1; i < n_segments - 1; i++) {
+        length = strlen (segments[i]);
+        p = ascii_find (p, segments[i], length);
+        if (!p) {
+            return FALSE;
+        }
+        p += length;
+    }
+    
+    length = strlen (segments[n_segments - 1]);
+    rest = strlen (p);
+    
+    return rest >= length &&
+           g_ascii_strcasecmp (p + rest - length, segments[n_segments - 1]) == 0;
+}
+
+/* Whether @string passes the text test of @instruction, negation aside.
+ * Text in ASCII is matched in place, ignoring ASCII case; other text
+ * against the casefolded string. */
+static gboolean
+text_matches (const FilterInstruction *instruction, const gchar *string, GString *scratch)
+{
+    gchar *folded = NULL;
+    gboolean result;
+    
+    if (!instruction->ascii && g_utf8_validate (string, -1, NULL)) {
+        folded = g_utf8_casefold (string, -1);
+        string = folded;
+    }
+    
+    switch (instruction->opcode) {
+        case FILTER_OP_TEXT_EQUAL:
+            result = g_ascii_strcasecmp (string, instruction->text) == 0;
+            break;
+        case FILTER_OP_TEXT_GLOB:
+        case FILTER_OP_NAME_GLOB:
+            if (instruction->segments) {
+                result = segments_match (instruction->segments, instruction->n_segments, string);
+                break;
+            }
+            if (!folded) {
+                g_string_assign (scratch, string);
+                g_string_ascii_down (scratch);
+                string = scratch->str;
+            }
+            result = g_pattern_spec_match (instruction->pattern, strlen (string), string, NULL);
+            break;
+        default:
+            result = ascii_find (string, instruction->text, instruction->text_length) != NULL;
+            break;
+    }
+    
+    g_free (folded);
+    return result;
+}
+
+static inline gboolean
+value_in_range (const FilterInstruction *instruction, const FinderzMetadataValue *value)
+{
+    switch (value->sort_type) {
+        case FINDERZ_SORT_KEY_INT64:
+        case FINDERZ_SORT_KEY_DATE:
+            return value->data.v_int64 >= instruction->int_min &&
+                   value->data.v_int64 <= instruction->int_max;
+        case FINDERZ_SORT_KEY_DOUBLE:
+            return value->data.v_double >= instruction->double_min &&
+                   value->data.v_double <= instruction->double_max;
+        default:
+            return FALSE;
+    }
+}
+
+static gboolean
+instruction_matches (const FilterInstruction *instruction,
+                     const gchar *name,
+                     FinderzUniversalMetadata *metadata,
+                     GString *scratch)
+{
+    const FinderzMetadataValue *value;
+    gboolean result;
+    
+    if (instruction->field_id == FINDERZ_FIELD_INVALID) {
+        return text_matches (instruction, name ? name : "", scratch) != instruction->negate;
+    }
+    
+    /* Not loaded yet; the file is looked at again once it is */
+    if (!metadata) {
+        return FALSE;
+    }
+    
+    value = finderz_metadata_get_value (metadata, instruction->field_id);
+    switch (instruction->opcode) {
+        case FILTER_OP_EXISTS:
+            result = value != NULL;
+            break;
+        case FILTER_OP_RANGE:
+            result = value && value_in_range (instruction, value);
+            break;
+        case FILTER_OP_TEXT_ORDER: {
+            gint order;
+            
+            if (!value || value->sort_type != FINDERZ_SORT_KEY_COLLATE) {
+                result = FALSE;
+                break;
+            }
+            order = strcmp (value->collate_key, instruction->text);
+            order = (order > 0) - (order < 0);
+            result = order >= instruction->order_min && order <= instruction->order_max;
+            break;
+        }
+        default:
+            result = value && value->type == FINDERZ_VALUE_STRING &&
+                     text_matches (instruction, value->string, scratch);
+            break;
+    }
+    
+    return result != instruction->negate;
+}
+
+gboolean
+finderz_filter_matches (FinderzFilter *filter,
+                        const gchar *name,
+                        FinderzUniversalMetadata *metadata)
+{
+    guint i;
+    
+    g_return_val_if_fail (filter != NULL, FALSE);
+    
+    for (i = 0; i < filter->n_instructions; i++) {
+        if (!instruction_matches (&filter->instructions[i], name, metadata, filter->scratch)) {
+            return FALSE;
+        }
+    }
+    
+    return TRUE;
+}
+
+/* Narrow @selection, the @n_selected rows still in, to the ones that
+ * pass @instruction, keeping their order; returns how many are left */
+static guint
+run_instruction (FinderzFilter *filter,
+                 const FilterInstruction *instruction,
+                 const gchar * const *names,
+                 FinderzUniversalMetadata * const *records,
+                 guint32 *selection,
+                 guint n_selected)
+{
+    guint kept = 0;
+    guint i;
+    
+    if (instruction->opcode == FILTER_OP_EXISTS || instruction->opcode == FILTER_OP_RANGE) {
+        /* The common case, without a call per row beyond the lookup */
+        for (i = 0; i < n_selected; i++) {
+            guint32 row = selection[i];
+            const FinderzMetadataValue *value;
+            gboolean pass = FALSE;
+            
+            if (records[row]) {
+                value = finderz_metadata_get_value (records[row], instruction->field_id);
+                pass = (instruction->opcode == FILTER_OP_EXISTS ?
+                        value != NULL :
+                        value != NULL && value_in_range (instruction, value)) != instruction->negate;
+            }
+            
+            selection[kept] = row;
+            kept += pass;
+        }
+        return kept;
+    }
+    
+    for (i = 0; i < n_selected; i++) {
+        guint32 row = selection[i];
+        
+        selection[kept] = row;
+        kept += instruction_matches (instruction, names[row], records[row], filter->scratch);
+    }
+    
+    return kept;
+}
+
+void
+finderz_filter_run (FinderzFilter *filter,
+                    const gchar * const *names,
+                    FinderzUniversalMetadata * const *records,
+                    guint n_rows,
+                    guint8 *matches)
+{
+    guint32 *selection;
+    guint n_selected;
+    guint i;
+    
+    g_return_if_fail (filter != NULL);
+    g_return_if_fail (n_rows == 0 || (names && records && matches));
+    
+    selection = g_new (guint32, n_rows);
+    for (i = 0; i < n_rows; i++) {
+        selection[i] = i;
+    }
+    
+    n_selected = n_rows;
+    for (i = 0; i < filter->n_instructions && n_selected > 0; i++) {
+        n_selected = run_instruction (filter, &filter->instructions[i],
+                                      names, records, selection, n_selected);
+    }
+    
+    memset (matches, 0, n_rows);
+    for (i = 0; i < n_selected; i++) {
+        matches[selection[i]] = 1;
+    }
+    
+    g_free (selection);
+}
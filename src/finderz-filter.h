@@ -0,0 +1,65 @@
+/* finderz-filter.h
+ *
+ * Filters over file names and metadata, compiled once per change of
+ * the filter text and run over every loaded file
+ */
+
+#ifndef FINDERZ_FILTER_H
+#define FINDERZ_FILTER_H
+
+#include <glib.h>
+#include <gio/gio.h>
+#include "finderz-universal-metadata.h"
+
+G_BEGIN_DECLS
+
+typedef struct _FinderzFilter FinderzFilter;
+
+/* Compile @text, a list of terms that must all hold:
+ *
+ *   sunset            the file name contains "sunset"
+ *   "red car"         the same, for text with spaces
+ *   *.png             the file name matches a glob
+ *   ai_model:sdxl*    a text field matches a glob, or contains the text
+ *                     when it has no wildcards; case is ignored
+ *   ai_model=sdxl     a text field is the text
+ *   steps>=30         a number or date compares; also <, <=, >, != and
+ *                     : or = for equality.  Dates are written 2024,
+ *                     2024-05 or 2024-05-01, or in full ISO 8601.
+ *   rating:*          the field is set
+ *   -keywords:draft   a leading - negates a term
+ *
+ * Fields are the keys of the metadata schema; the ai_, exif_, doc_ and
+ * media_ prefixes may be left out, and name is the file name.  Empty
+ * text compiles to a filter that lets everything through.  Returns
+ * NULL with @error set when a term does not parse or names a field
+ * that is not known. */
+FinderzFilter* finderz_filter_new (const gchar *text, GError **error);
+void finderz_filter_free (FinderzFilter *filter);
+
+/* The text @filter was compiled from */
+const gchar* finderz_filter_get_text (FinderzFilter *filter);
+
+/* Whether @filter has terms on metadata fields.  Files whose metadata
+ * is not loaded yet fail those terms, negated or not, until it is. */
+gboolean finderz_filter_needs_metadata (FinderzFilter *filter);
+
+/* Whether the file @name with @metadata, NULL when it is not loaded,
+ * passes @filter */
+gboolean finderz_filter_matches (FinderzFilter *filter,
+                                 const gchar *name,
+                                 FinderzUniversalMetadata *metadata);
+
+/* finderz_filter_matches() for @n_rows files at once, setting
+ * @matches[i] to 1 or 0.  Terms run one at a time over the files that
+ * passed the ones before, cheapest first; nothing is allocated per file
+ * unless a term has text outside ASCII. */
+void finderz_filter_run (FinderzFilter *filter,
+                         const gchar * const *names,
+                         FinderzUniversalMetadata * const *records,
+                         guint n_rows,
+                         guint8 *matches);
+
+G_END_DECLS
+
+#endif /* FINDERZ_FILTER_H */
@@ -0,0 +1,867 @@
+/* finderz-grouping.c
+ *
+ * Files in groups, by kind, date, size, first letter, extension, tags
+ * or label, kept in order as they come and go
+ *
+ * Each group keeps its files in a GSequence sorted by the profile, so a
+ * file is placed, moved or taken out with O(log n) comparisons within
+ * its group alone.  Groups are kept in order in an array, with a
+ * Fenwick tree over the rows each one shows: its header, and its files
+ * unless it is collapsed.  The row of a group and the group of a row
+ * are then found in O(log g), and collapsing a group changes one count
+ * in the tree and nothing in the other groups.
+ */
+
+#include "finderz-grouping.h"
+#include "finderz-file-attributes.h"
+#include <libnemo-private/nemo-file-private.h>
+#include <glib/gi18n.h>
+#include <string.h>
+
+/* Group order for files without the value grouped on: last */
+#define GROUP_ORDER_NONE  G_MAXINT
+
+struct _FinderzGroup {
+    gchar *key;             /* order and name, unique in the grouping */
+    gchar *name;
+    gint order;
+    GSequence *files;       /* NemoFile, sorted by the profile */
+    gboolean collapsed;
+    gboolean appending;     /* filled from sorted files by add_files() */
+    guint index;            /* in FinderzGrouping.groups */
+};
+
+typedef struct {
+    FinderzGroup *group;
+    GSequenceIter *iter;
+} GroupedFile;
+
+struct _FinderzGrouping {
+    FinderzSortingProfile *profile;
+    NemoDateType date_type;
+    /* Start of each date range from today to this year */
+    time_t date_starts[FINDERZ_DATE_OLDER];
+    
+    GPtrArray *groups;      /* FinderzGroup with files, in order */
+    GHashTable *groups_by_key;
+    GHashTable *files;      /* NemoFile -> GroupedFile */
+    
+    /* Fenwick tree over the rows of the groups, from 1 */
+    guint *row_tree;
+    guint row_tree_size;
+    
+    FinderzGroupingRowsChangedFunc rows_changed_func;
+    gpointer rows_changed_data;
+};
+
+typedef enum {
+    KIND_FOLDER,
+    KIND_DOCUMENT,
+    KIND_IMAGE,
+    KIND_MUSIC,
+    KIND_VIDEO,
+    KIND_ARCHIVE,
+    KIND_OTHER
+} FileKind;
+
+static gint
+compare_files (gconstpointer a, gconstpointer b, gpointer user_data)
+{
+    FinderzGrouping *grouping = user_data;
+    
+    return finderz_sorting_profile_compare_files (grouping->profile,
+                                                  (NemoFile *) a, (NemoFile *) b);
+}
+
+static FileKind
+get_file_kind (NemoFile *file)
+{
+    const gchar *mime_type = file->details->mime_type;
+    
+    if (nemo_file_is_directory (file)) {
+        return KIND_FOLDER;
+    }
+    if (mime_type == NULL) {
+        return KIND_OTHER;
+    }
+    if (g_str_has_prefix (mime_type, "image/")) {
+        return KIND_IMAGE;
+    }
+    if (g_str_has_prefix (mime_type, "audio/")) {
+        return KIND_MUSIC;
+    }
+    if (g_str_has_prefix (mime_type, "video/")) {
+        return KIND_VIDEO;
+    }
+    if (g_str_has_prefix (mime_type, "text/") ||
+        strcmp (mime_type, "application/pdf") == 0 ||
+        strstr (mime_type, "document") != NULL ||
+        strstr (mime_type, "spreadsheet") != NULL ||
+        strstr (mime_type, "presentation") != NULL ||
+        strstr (mime_type, "msword") != NULL) {
+        return KIND_DOCUMENT;
+    }
+    if (strstr (mime_type, "zip") != NULL ||
+        strstr (mime_type, "compressed") != NULL ||
+        strstr (mime_type, "-tar") != NULL ||
+        strstr (mime_type, "-rar") != NULL ||
+        strstr (mime_type, "-7z") != NULL ||
+        strstr (mime_type, "-xz") != NULL) {
+        return KIND_ARCHIVE;
+    }
+    return KIND_OTHER;
+}
+
+static const gchar*
+get_kind_name (FileKind kind)
+{
+    switch (kind) {
+        case KIND_FOLDER:
+            return _("Folders");
+        case KIND_DOCUMENT:
+            return _("Documents");
+        case KIND_IMAGE:
+            return _("Images");
+        case KIND_MUSIC:
+            return _("Music");
+        case KIND_VIDEO:
+            return _("Videos");
+        case KIND_ARCHIVE:
+            return _("Archives");
+        default:
+            return _("Other");
+    }
+}
+
+static const gchar*
+get_date_range_name (FinderzDateRange range)
+{
+    switch (range) {
+        case FINDERZ_DATE_TODAY:
+            return _("Today");
+        case FINDERZ_DATE_YESTERDAY:
+            return _("Yesterday");
+        case FINDERZ_DATE_THIS_WEEK:
+            return _("This Week");
+        case FINDERZ_DATE_LAST_WEEK:
+            return _("Last Week");
+        case FINDERZ_DATE_THIS_MONTH:
+            return _("This Month");
+        case FINDERZ_DATE_LAST_MONTH:
+            return _("Last Month");
+        case FINDERZ_DATE_THIS_YEAR:
+            return _("This Year");
+        default:
+            return _("Older");
+    }
+}
+
+static void
+compute_date_starts (FinderzGrouping *grouping)
+{
+    GDateTime *now = g_date_time_new_now_local ();
+    GDateTime *today, *day, *week, *month;
+    
+    today = g_date_time_new_local (g_date_time_get_year (now),
+                                   g_date_time_get_month (now),
+                                   g_date_time_get_day_of_month (now), 0, 0, 0);
+    week = g_date_time_add_days (today, 1 - g_date_time_get_day_of_week (today));
+    month = g_date_time_new_local (g_date_time_get_year (now),
+                                   g_date_time_get_month (now), 1, 0, 0, 0);
+    
+    grouping->date_starts[FINDERZ_DATE_TODAY] = g_date_time_to_unix (today);
+    day = g_date_time_add_days (today, -1);
+    grouping->date_starts[FINDERZ_DATE_YESTERDAY] = g_date_time_to_unix (day);
+    g_date_time_unref (day);
+    grouping->date_starts[FINDERZ_DATE_THIS_WEEK] = g_date_time_to_unix (week);
+    day = g_date_time_add_weeks (week, -1);
+    grouping->date_starts[FINDERZ_DATE_LAST_WEEK] = g_date_time_to_unix (day);
+    g_date_time_unref (day);
+    grouping->date_starts[FINDERZ_DATE_THIS_MONTH] = g_date_time_to_unix (month);
+    day = g_date_time_add_months (month, -1);
+    grouping->date_starts[FINDERZ_DATE_LAST_MONTH] = g_date_time_to_unix (day);
+    g_date_time_unref (day);
+    day = g_date_time_new_local (g_date_time_get_year (now), 1, 1, 0, 0, 0);
+    grouping->date_starts[FINDERZ_DATE_THIS_YEAR] = g_date_time_to_unix (day);
+    g_date_time_unref (day);
+    
+    g_date_time_unref (month);
+    g_date_time_unref (week);
+    g_date_time_unref (today);
+    g_date_time_unref (now);
+}
+
+/* The first range @date falls in, checked from today back, so a day
+ * that is both yesterday and in last week is yesterday */
+static FinderzDateRange
+get_date_range (FinderzGrouping *grouping, NemoFile *file)
+{
+    time_t date;
+    guint range;
+    
+    if (!nemo_file_get_date (file, grouping->date_type, &date) || date == 0) {
+        return FINDERZ_DATE_OLDER;
+    }
+    for (range = FINDERZ_DATE_TODAY; range < FINDERZ_DATE_OLDER; range++) {
+        if (date >= grouping->date_starts[range]) {
+            return range;
+        }
+    }
+    return FINDERZ_DATE_OLDER;
+}
+
+static const struct {
+    const gchar *name;
+    gint64 min_size;
+    gint64 max_size;
+} default_size_ranges[] = {
+    { N_("Empty"), 0, 0 },
+    { N_("Tiny"), 1, 16 * 1024 - 1 },
+    { N_("Small"), 16 * 1024, 1024 * 1024 - 1 },
+    { N_("Medium"), 1024 * 1024, 128 * 1024 * 1024 - 1 },
+    { N_("Large"), 128 * 1024 * 1024, G_GINT64_CONSTANT (1024) * 1024 * 1024 - 1 },
+    { N_("Huge"), G_GINT64_CONSTANT (1024) * 1024 * 1024, G_MAXINT64 }
+};
+
+/* Folders first, then the profile's size ranges or the default ones, in
+ * the order they are listed */
+static const gchar*
+get_size_group (FinderzGrouping *grouping, NemoFile *file, gint *order)
+{
+    goffset size;
+    GList *l;
+    guint i;
+    
+    if (nemo_file_is_directory (file)) {
+        *order = -1;
+        return _("Folders");
+    }
+    
+    size = nemo_file_get_size (file);
+    if (size < 0) {
+        *order = GROUP_ORDER_NONE;
+        return _("Unknown");
+    }
+    
+    if (grouping->profile->custom_size_ranges != NULL) {
+        for (l = grouping->profile->custom_size_ranges, i = 0; l != NULL; l = l->next, i++) {
+            FinderzSizeRange *range = l->data;
+            
+            if (size >= range->min_size && size <= range->max_size) {
+                *order = i;
+                return range->name != NULL ? range->name : "";
+            }
+        }
+    } else {
+        for (i = 0; i < G_N_ELEMENTS (default_size_ranges); i++) {
+            if (size >= default_size_ranges[i].min_size &&
+                size <= default_size_ranges[i].max_size) {
+                *order = i;
+                return _(default_size_ranges[i].name);
+            }
+        }
+    }
+    
+    *order = GROUP_ORDER_NONE - 1;
+    return _("Other");
+}
+
+/* The first of the keywords, which are listed with commas or
+ * semicolons between them */
+static gchar*
+get_first_keyword (const gchar *keywords)
+{
+    gsize length = strcspn (keywords, ",;");
+    gchar *keyword = g_strndup (keywords, length);
+    
+    return g_strstrip (keyword);
+}
+
+/* The group @file belongs in, as its name, owned, and its place among
+ * the groups in *@order; groups of the same order go by name */
+static gchar*
+get_file_group (FinderzGrouping *grouping, NemoFile *file, gint *order)
+{
+    const gchar *name = file->details->display_name;
+    const FinderzMetadataValue *value;
+    const gchar *dot;
+    gunichar c;
+    
+    *order = 0;
+    switch (grouping->profile->grouping_type) {
+        case FINDERZ_GROUP_BY_KIND:
+            *order = get_file_kind (file);
+            return g_strdup (get_kind_name (*order));
+        
+        case FINDERZ_GROUP_BY_DATE_RANGE:
+            *order = get_date_range (grouping, file);
+            return g_strdup (get_date_range_name (*order));
+        
+        case FINDERZ_GROUP_BY_SIZE_RANGE:
+            return g_strdup (get_size_group (grouping, file, order));
+        
+        case FINDERZ_GROUP_BY_FIRST_LETTER:
+            /* Letters by name, and everything else before them */
+            c = name != NULL ? g_utf8_get_char_validated (name, -1) : 0;
+            if (c == (gunichar) -1 || c == (gunichar) -2 || !g_unichar_isalpha (c)) {
+                return g_strdup ("#");
+            }
+            *order = 1;
+            return g_utf8_strup (name, g_utf8_next_char (name) - name);
+        
+        case FINDERZ_GROUP_BY_EXTENSION:
+            if (nemo_file_is_directory (file)) {
+                *order = -1;
+                return g_strdup (_("Folders"));
+            }
+            dot = name != NULL ? strrchr (name, '.') : NULL;
+            if (dot == NULL || dot == name || dot[1] == '\0') {
+                *order = GROUP_ORDER_NONE;
+                return g_strdup (_("No Extension"));
+            }
+            return g_ascii_strdown (dot + 1, -1);
+        
+        case FINDERZ_GROUP_BY_TAGS:
+            value = finderz_metadata_get_value (finderz_file_get_attached_metadata (file),
+                                                FINDERZ_FIELD_KEYWORDS);
+            if (value == NULL || value->string == NULL || value->string[0] == '\0') {
+                *order = GROUP_ORDER_NONE;
+                return g_strdup (_("No Tags"));
+            }
+            return get_first_keyword (value->string);
+        
+        case FINDERZ_GROUP_BY_COLOR_LABEL:
+            value = finderz_metadata_get_value (finderz_file_get_attached_metadata (file),
+                                                FINDERZ_FIELD_COLOR_LABEL);
+            if (value == NULL || value->string == NULL || value->string[0] == '\0') {
+                *order = GROUP_ORDER_NONE;
+                return g_strdup (_("No Label"));
+            }
+            return g_strdup (value->string);
+        
+        default:
+            /* No grouping, or custom groups that are not defined: all
+             * files in one group */
+            return g_strdup (_("All Files"));
+    }
+}
+
+static gint
+compare_groups (const FinderzGroup *a, gint order, const gchar *name)
+{
+    if (a->order != order) {
+        return a->order < order ? -1 : 1;
+    }
+    return g_utf8_collate (a->name, name);
+}
+
+static guint
+get_group_rows (FinderzGroup *group)
+{
+    return 1 + (group->collapsed ? 0 : g_sequence_get_length (group->files));
+}
+
+static void
+row_tree_add (FinderzGrouping *grouping, guint index, gint delta)
+{
+    guint i;
+    
+    for (i = index + 1; i <= grouping->row_tree_size; i += i & -i) {
+        grouping->row_tree[i] += delta;
+    }
+}
+
+/* Rows before the group at @index */
+static guint
+row_tree_sum (FinderzGrouping *grouping, guint index)
+{
+    guint sum = 0;
+    guint i;
+    
+    for (i = index; i > 0; i -= i & -i) {
+        sum += grouping->row_tree[i];
+    }
+    return sum;
+}
+
+/* The index of the group @row is in; *@row is made relative to it */
+static guint
+row_tree_find (FinderzGrouping *grouping, guint *row)
+{
+    guint position = 0;
+    guint step = 1;
+    
+    while (step * 2 <= grouping->row_tree_size) {
+        step *= 2;
+    }
+    for (; step > 0; step /= 2) {
+        if (position + step <= grouping->row_tree_size &&
+            grouping->row_tree[position + step] <= *row) {
+            position += step;
+            *row -= grouping->row_tree[position];
+        }
+    }
+    return position;
+}
+
+/* After groups come or go: renumber them and build the tree again */
+static void
+rebuild_row_tree (FinderzGrouping *grouping)
+{
+    guint n_groups = grouping->groups->len;
+    guint i, parent;
+    
+    g_free (grouping->row_tree);
+    grouping->row_tree = g_new0 (guint, n_groups + 1);
+    grouping->row_tree_size = n_groups;
+    
+    for (i = 1; i <= n_groups; i++) {
+        FinderzGroup *group = g_ptr_array_index (grouping->groups, i - 1);
+        
+        group->index = i - 1;
+        grouping->row_tree[i] += get_group_rows (group);
+        parent = i + (i & -i);
+        if (parent <= n_groups) {
+            grouping->row_tree[parent] += grouping->row_tree[i];
+        }
+    }
+}
+
+static void
+emit_rows_changed (FinderzGrouping *grouping, guint position, guint removed, guint added)
+{
+    if (grouping->rows_changed_func != NULL && (removed > 0 || added > 0)) {
+        grouping->rows_changed_func (grouping, position, removed, added,
+                                     grouping->rows_changed_data);
+    }
+}
+
+static void
+group_free (gpointer data)
+{
+    FinderzGroup *group = data;
+    
+    g_sequence_free (group->files);
+    g_free (group->key);
+    g_free (group->name);
+    g_free (group);
+}
+
+/* The group named @name, made when there is none; *@created tells
+ * which.  The row tree is not rebuilt. */
+static FinderzGroup*
+lookup_group (FinderzGrouping *grouping, gchar *name, gint order, gboolean *created)
+{
+    FinderzGroup *group;
+    gchar *key = g_strdup_printf ("%d:%s", order, name);
+    guint low = 0, high = grouping->groups->len;
+    
+    group = g_hash_table_lookup (grouping->groups_by_key, key);
+    *created = group == NULL;
+    if (group != NULL) {
+        g_free (key);
+        g_free (name);
+        return group;
+    }
+    
+    group = g_new0 (FinderzGroup, 1);
+    group->key = key;
+    group->name = name;
+    group->order = order;
+    group->files = g_sequence_new (NULL);
+    group->collapsed = !grouping->profile->show_groups_expanded;
+    
+    while (low < high) {
+        guint middle = (low + high) / 2;
+        
+        if (compare_groups (g_ptr_array_index (grouping->groups, middle), order, name) < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    g_ptr_array_insert (grouping->groups, low, group);
+    g_hash_table_insert (grouping->groups_by_key, group->key, group);
+    return group;
+}
+
+static void
+remove_empty_group (FinderzGrouping *grouping, FinderzGroup *group)
+{
+    g_hash_table_remove (grouping->groups_by_key, group->key);
+    g_ptr_array_remove_index (grouping->groups, group->index);
+    rebuild_row_tree (grouping);
+}
+
+FinderzGrouping*
+finderz_grouping_new (FinderzSortingProfile *profile)
+{
+    FinderzGrouping *grouping;
+    
+    g_return_val_if_fail (profile != NULL, NULL);
+    
+    grouping = g_new0 (FinderzGrouping, 1);
+    grouping->profile = profile;
+    grouping->groups = g_ptr_array_new_with_free_func (group_free);
+    grouping->groups_by_key = g_hash_table_new (g_str_hash, g_str_equal);
+    grouping->files = g_hash_table_new_full (NULL, NULL,
+                                             (GDestroyNotify) nemo_file_unref, g_free);
+    
+    /* Dates are grouped by the date sorted on first, if any */
+    grouping->date_type = NEMO_DATE_TYPE_MODIFIED;
+    if (profile->sort_levels != NULL) {
+        FinderzSortLevel *level = profile->sort_levels->data;
+        
+        if (level->criteria == FINDERZ_SORT_BY_DATE_CREATED) {
+            grouping->date_type = NEMO_DATE_TYPE_CREATED;
+        } else if (level->criteria == FINDERZ_SORT_BY_DATE_ACCESSED) {
+            grouping->date_type = NEMO_DATE_TYPE_ACCESSED;
+        }
+    }
+    compute_date_starts (grouping);
+    rebuild_row_tree (grouping);
+    
+    return grouping;
+}
+
+void
+finderz_grouping_free (FinderzGrouping *grouping)
+{
+    if (grouping == NULL) {
+        return;
+    }
+    
+    g_hash_table_destroy (grouping->files);
+    g_hash_table_destroy (grouping->groups_by_key);
+    g_ptr_array_unref (grouping->groups);
+    g_free (grouping->row_tree);
+    g_free (grouping);
+}
+
+void
+finderz_grouping_set_rows_changed_func (FinderzGrouping *grouping,
+                                        FinderzGroupingRowsChangedFunc func,
+                                        gpointer user_data)
+{
+    g_return_if_fail (grouping != NULL);
+    
+    grouping->rows_changed_func = func;
+    grouping->rows_changed_data = user_data;
+}
+
+void
+finderz_grouping_add_file (FinderzGrouping *grouping, NemoFile *file)
+{
+    GroupedFile *grouped;
+    FinderzGroup *group;
+    gboolean created;
+    gchar *name;
+    gint order;
+    guint row;
+    
+    g_return_if_fail (grouping != NULL);
+    g_return_if_fail (file != NULL);
+    
+    if (g_hash_table_contains (grouping->files, file)) {
+        finderz_grouping_file_changed (grouping, file);
+        return;
+    }
+    
+    name = get_file_group (grouping, file, &order);
+    group = lookup_group (grouping, name, order, &created);
+    
+    grouped = g_new (GroupedFile, 1);
+    grouped->group = group;
+    grouped->iter = g_sequence_insert_sorted (group->files, file, compare_files, grouping);
+    g_hash_table_insert (grouping->files, nemo_file_ref (file), grouped);
+    
+    if (created) {
+        rebuild_row_tree (grouping);
+        emit_rows_changed (grouping, row_tree_sum (grouping, group->index),
+                           0, get_group_rows (group));
+    } else if (!group->collapsed) {
+        row_tree_add (grouping, group->index, 1);
+        row = row_tree_sum (grouping, group->index) + 1 +
+              g_sequence_iter_get_position (grouped->iter);
+        emit_rows_changed (grouping, row, 0, 1);
+    }
+}
+
+void
+finderz_grouping_remove_file (FinderzGrouping *grouping, NemoFile *file)
+{
+    GroupedFile *grouped;
+    FinderzGroup *group;
+    guint group_row, row;
+    
+    g_return_if_fail (grouping != NULL);
+    
+    grouped = g_hash_table_lookup (grouping->files, file);
+    if (grouped == NULL) {
+        return;
+    }
+    
+    group = grouped->group;
+    group_row = row_tree_sum (grouping, group->index);
+    row = group_row + 1 + g_sequence_iter_get_position (grouped->iter);
+    g_sequence_remove (grouped->iter);
+    g_hash_table_remove (grouping->files, file);
+    
+    if (g_sequence_is_empty (group->files)) {
+        guint removed = group->collapsed ? 1 : 2;
+        
+        remove_empty_group (grouping, group);
+        emit_rows_changed (grouping, group_row, removed, 0);
+    } else if (!group->collapsed) {
+        row_tree_add (grouping, group->index, -1);
+        emit_rows_changed (grouping, row, 1, 0);
+    }
+}
+
+void
+finderz_grouping_file_changed (FinderzGrouping *grouping, NemoFile *file)
+{
+    GroupedFile *grouped;
+    FinderzGroup *group;
+    GSequenceIter *neighbor;
+    gboolean in_order = TRUE;
+    gchar *name, *key;
+    gint order;
+    guint group_row, old_position;
+    
+    g_return_if_fail (grouping != NULL);
+    
+    grouped = g_hash_table_lookup (grouping->files, file);
+    if (grouped == NULL) {
+        return;
+    }
+    group = grouped->group;
+    
+    name = get_file_group (grouping, file, &order);
+    key = g_strdup_printf ("%d:%s", order, name);
+    g_free (name);
+    if (strcmp (key, group->key) != 0) {
+        g_free (key);
+        /* Keep the file alive between the two */
+        nemo_file_ref (file);
+        finderz_grouping_remove_file (grouping, file);
+        finderz_grouping_add_file (grouping, file);
+        nemo_file_unref (file);
+        return;
+    }
+    g_free (key);
+    
+    if (!g_sequence_iter_is_begin (grouped->iter)) {
+        neighbor = g_sequence_iter_prev (grouped->iter);
+        in_order = compare_files (g_sequence_get (neighbor), file, grouping) <= 0;
+    }
+    neighbor = g_sequence_iter_next (grouped->iter);
+    if (in_order && !g_sequence_iter_is_end (neighbor)) {
+        in_order = compare_files (file, g_sequence_get (neighbor), grouping) <= 0;
+    }
+    if (in_order) {
+        return;
+    }
+    
+    old_position = g_sequence_iter_get_position (grouped->iter);
+    g_sequence_sort_changed (grouped->iter, compare_files, grouping);
+    if (!group->collapsed) {
+        group_row = row_tree_sum (grouping, group->index);
+        emit_rows_changed (grouping, group_row + 1 + old_position, 1, 0);
+        emit_rows_changed (grouping, group_row + 1 + g_sequence_iter_get_position (grouped->iter), 0, 1);
+    }
+}
+
+void
+finderz_grouping_add_files (FinderzGrouping *grouping, GPtrArray *files)
+{
+    GPtrArray *sorted;
+    guint old_rows, i;
+    
+    g_return_if_fail (grouping != NULL);
+    g_return_if_fail (files != NULL);
+    
+    old_rows = finderz_grouping_get_n_rows (grouping);
+    
+    /* Files of groups that were empty come in order, so they are
+     * appended; others are placed among the files already there */
+    for (i = 0; i < grouping->groups->len; i++) {
+        FinderzGroup *group = g_ptr_array_index (grouping->groups, i);
+        
+        group->appending = FALSE;
+    }
+    
+    sorted = g_ptr_array_sized_new (files->len);
+    for (i = 0; i < files->len; i++) {
+        g_ptr_array_add (sorted, g_ptr_array_index (files, i));
+    }
+    finderz_sorting_profile_sort_files (grouping->profile, sorted);
+    
+    for (i = 0; i < sorted->len; i++) {
+        NemoFile *file = g_ptr_array_index (sorted, i);
+        GroupedFile *grouped;
+        FinderzGroup *group;
+        gboolean created;
+        gchar *name;
+        gint order;
+        
+        if (g_hash_table_contains (grouping->files, file)) {
+            continue;
+        }
+        
+        name = get_file_group (grouping, file, &order);
+        group = lookup_group (grouping, name, order, &created);
+        if (created) {
+            group->appending = TRUE;
+        }
+        
+        grouped = g_new (GroupedFile, 1);
+        grouped->group = group;
+        if (group->appending) {
+            grouped->iter = g_sequence_append (group->files, file);
+        } else {
+            grouped->iter = g_sequence_insert_sorted (group->files, file, compare_files, grouping);
+        }
+        g_hash_table_insert (grouping->files, nemo_file_ref (file), grouped);
+    }
+    g_ptr_array_unref (sorted);
+    
+    rebuild_row_tree (grouping);
+    emit_rows_changed (grouping, 0, old_rows, finderz_grouping_get_n_rows (grouping));
+}
+
+guint
+finderz_grouping_get_n_rows (FinderzGrouping *grouping)
+{
+    g_return_val_if_fail (grouping != NULL, 0);
+    
+    return row_tree_sum (grouping, grouping->groups->len);
+}
+
+NemoFile*
+finderz_grouping_get_row (FinderzGrouping *grouping, guint row, FinderzGroup **group)
+{
+    FinderzGroup *row_group;
+    guint index;
+    
+    if (group != NULL) {
+        *group = NULL;
+    }
+    g_return_val_if_fail (grouping != NULL, NULL);
+    
+    if (row >= finderz_grouping_get_n_rows (grouping)) {
+        return NULL;
+    }
+    
+    index = row_tree_find (grouping, &row);
+    row_group = g_ptr_array_index (grouping->groups, index);
+    if (group != NULL) {
+        *group = row_group;
+    }
+    if (row == 0) {
+        return NULL;
+    }
+    return g_sequence_get (g_sequence_get_iter_at_pos (row_group->files, row - 1));
+}
+
+gint
+finderz_grouping_get_file_row (FinderzGrouping *grouping, NemoFile *file)
+{
+    GroupedFile *grouped;
+    
+    g_return_val_if_fail (grouping != NULL, -1);
+    
+    grouped = g_hash_table_lookup (grouping->files, file);
+    if (grouped == NULL || grouped->group->collapsed) {
+        return -1;
+    }
+    return row_tree_sum (grouping, grouped->group->index) + 1 +
+           g_sequence_iter_get_position (grouped->iter);
+}
+
+guint
+finderz_grouping_get_n_groups (FinderzGrouping *grouping)
+{
+    g_return_val_if_fail (grouping != NULL, 0);
+    
+    return grouping->groups->len;
+}
+
+FinderzGroup*
+finderz_grouping_get_group (FinderzGrouping *grouping, guint index)
+{
+    g_return_val_if_fail (grouping != NULL, NULL);
+    
+    if (index >= grouping->groups->len) {
+        return NULL;
+    }
+    return g_ptr_array_index (grouping->groups, index);
+}
+
+guint
+finderz_grouping_get_group_row (FinderzGrouping *grouping, FinderzGroup *group)
+{
+    g_return_val_if_fail (grouping != NULL, 0);
+    g_return_val_if_fail (group != NULL, 0);
+    
+    return row_tree_sum (grouping, group->index);
+}
+
+void
+finderz_grouping_set_group_collapsed (FinderzGrouping *grouping,
+                                      FinderzGroup *group,
+                                      gboolean collapsed)
+{
+    guint n_files;
+    guint row;
+    
+    g_return_if_fail (grouping != NULL);
+    g_return_if_fail (group != NULL);
+    
+    collapsed = !!collapsed;
+    if (group->collapsed == collapsed) {
+        return;
+    }
+    
+    group->collapsed = collapsed;
+    n_files = g_sequence_get_length (group->files);
+    row_tree_add (grouping, group->index, collapsed ? -(gint) n_files : (gint) n_files);
+    
+    row = row_tree_sum (grouping, group->index) + 1;
+    emit_rows_changed (grouping, row, collapsed ? n_files : 0, collapsed ? 0 : n_files);
+}
+
+const gchar*
+finderz_group_get_name (FinderzGroup *group)
+{
+    g_return_val_if_fail (group != NULL, NULL);
+    
+    return group->name;
+}
+
+guint
+finderz_group_get_n_files (FinderzGroup *group)
+{
+    g_return_val_if_fail (group != NULL, 0);
+    
+    return g_sequence_get_length (group->files);
+}
+
+gboolean
+finderz_group_get_collapsed (FinderzGroup *group)
+{
+    g_return_val_if_fail (group != NULL, FALSE);
+    
+    return group->collapsed;
+}
+
+NemoFile*
+finderz_group_get_file (FinderzGroup *group, guint index)
+{
+    g_return_val_if_fail (group != NULL, NULL);
+    
+    if (index >= (guint) g_sequence_get_length (group->files)) {
+        return NULL;
+    }
+    return g_sequence_get (g_sequence_get_iter_at_pos (group->files, index));
+}
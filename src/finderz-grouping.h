@@ -0,0 +1,79 @@
+/* finderz-grouping.h
+ *
+ * Files in groups, by kind, date, size, first letter, extension, tags
+ * or label, kept in order as they come and go
+ */
+
+#ifndef FINDERZ_GROUPING_H
+#define FINDERZ_GROUPING_H
+
+#include <glib.h>
+#include <libnemo-private/nemo-file.h>
+#include "finderz-sorting-profiles.h"
+
+G_BEGIN_DECLS
+
+typedef struct _FinderzGrouping FinderzGrouping;
+typedef struct _FinderzGroup FinderzGroup;
+
+/* Rows @position to @position + @removed were replaced by @added new
+ * ones, as GListModel::items-changed reports it */
+typedef void (*FinderzGroupingRowsChangedFunc) (FinderzGrouping *grouping,
+                                                guint position,
+                                                guint removed,
+                                                guint added,
+                                                gpointer user_data);
+
+/* Group files as @profile says, each group sorted by its levels.  Date
+ * ranges are taken from the time the grouping is made.  The rows of a
+ * grouping are a header for every group that has files, each followed
+ * by the group's files unless it is collapsed.  @profile is not copied
+ * and must outlive the grouping, so its files keep their sort keys. */
+FinderzGrouping* finderz_grouping_new (FinderzSortingProfile *profile);
+void finderz_grouping_free (FinderzGrouping *grouping);
+
+void finderz_grouping_set_rows_changed_func (FinderzGrouping *grouping,
+                                             FinderzGroupingRowsChangedFunc func,
+                                             gpointer user_data);
+
+/* Adding, changing and removing a file costs O(log n) comparisons in
+ * its group, and O(log g) over the groups for the rows. */
+void finderz_grouping_add_file (FinderzGrouping *grouping, NemoFile *file);
+void finderz_grouping_remove_file (FinderzGrouping *grouping, NemoFile *file);
+/* Move @file to the group and place it now belongs in, if they changed */
+void finderz_grouping_file_changed (FinderzGrouping *grouping, NemoFile *file);
+
+/* Add many files at once, as when a folder is loaded: each new group's
+ * files are sorted together.  Reported as every row changing. */
+void finderz_grouping_add_files (FinderzGrouping *grouping, GPtrArray *files);
+
+guint finderz_grouping_get_n_rows (FinderzGrouping *grouping);
+/* The file at @row, or NULL when it is a group header; *@group, when
+ * not NULL, is set to the group the row is in */
+NemoFile* finderz_grouping_get_row (FinderzGrouping *grouping,
+                                    guint row,
+                                    FinderzGroup **group);
+/* The row of @file, or -1 when it is not grouped or its group is
+ * collapsed */
+gint finderz_grouping_get_file_row (FinderzGrouping *grouping, NemoFile *file);
+
+/* Groups with files, in order */
+guint finderz_grouping_get_n_groups (FinderzGrouping *grouping);
+FinderzGroup* finderz_grouping_get_group (FinderzGrouping *grouping, guint index);
+/* The row of @group's header */
+guint finderz_grouping_get_group_row (FinderzGrouping *grouping, FinderzGroup *group);
+
+/* Collapsing or expanding a group only changes its own rows */
+void finderz_grouping_set_group_collapsed (FinderzGrouping *grouping,
+                                           FinderzGroup *group,
+                                           gboolean collapsed);
+
+const gchar* finderz_group_get_name (FinderzGroup *group);
+guint finderz_group_get_n_files (FinderzGroup *group);
+gboolean finderz_group_get_collapsed (FinderzGroup *group);
+/* @group's file at @index, in order */
+NemoFile* finderz_group_get_file (FinderzGroup *group, guint index);
+
+G_END_DECLS
+
+#endif /* FINDERZ_GROUPING_H */
@@ -6,8 +6,64 @@
 #include <glib.h>
 #include <gio/gio.h>
 #include "finderz-ds-store.h"
+#include "finderz-integration.h"
 
 static FinderzDSStore *global_ds_store_parser = NULL;
+static FinderzSortingProfileManager *global_sorting_profiles = NULL;
+
+static gchar *
+sorting_profiles_file (void)
+{
+    return g_build_filename (g_get_user_config_dir (), "finderz",
+                             "sorting-profiles", NULL);
+}
+
+static void
+save_sorting_profiles (void)
+{
+    GError *error = NULL;
+    gchar *config_file;
+    
+    config_file = sorting_profiles_file ();
+    if (!finderz_sorting_profile_manager_save_profiles (global_sorting_profiles,
+                                                        config_file, &error)) {
+        g_warning ("FINDERZ: Could not save sorting profiles: %s", error->message);
+        g_error_free (error);
+    }
+    g_free (config_file);
+}
+
+/* Profiles saved by finderz_sorting_profile_manager_save_profiles().
+ * On first run the built-in ones are written with none of them the
+ * default, so the views keep their own sort order until a folder is
+ * given a profile with finderz_next_sorting_profile(). */
+static void
+load_sorting_profiles (void)
+{
+    GError *error = NULL;
+    gchar *config_file;
+    GList *l;
+    
+    global_sorting_profiles = finderz_sorting_profile_manager_new ();
+    config_file = sorting_profiles_file ();
+    
+    if (finderz_sorting_profile_manager_load_profiles (global_sorting_profiles,
+                                                       config_file, &error)) {
+        g_debug ("FINDERZ: Sorting profiles loaded from %s", config_file);
+    } else if (g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+        g_error_free (error);
+        finderz_sorting_profile_manager_create_default_profiles (global_sorting_profiles);
+        for (l = global_sorting_profiles->profiles; l != NULL; l = l->next) {
+            ((FinderzSortingProfile *) l->data)->is_default = FALSE;
+        }
+        save_sorting_profiles ();
+    } else {
+        g_warning ("FINDERZ: Could not load sorting profiles: %s", error->message);
+        g_error_free (error);
+    }
+    
+    g_free (config_file);
+}
 
 /* Initialize Finderz features */
 void
@@ -19,58 +75,45 @@ finderz_init (void)
         global_ds_store_parser = finderz_ds_store_new ();
         g_debug ("FINDERZ: DS_Store parser initialized");
     }
+    
+    if (!global_sorting_profiles) {
+        load_sorting_profiles ();
+    }
 }
 
 /* Check if a directory has Mac metadata */
 gboolean
 finderz_directory_has_mac_metadata (const gchar *directory_path)
 {
+    FinderzDSStoreData *data;
+    GError *error = NULL;
     gboolean has_ds_store;
-    gchar *ds_store_path;
     
     if (!directory_path) {
         return FALSE;
     }
     
-    ds_store_path = g_build_filename (directory_path, ".DS_Store", NULL);
-    has_ds_store = g_file_test (ds_store_path, G_FILE_TEST_EXISTS);
-    
-    if (has_ds_store) {
-        gint64 size = 0;
-        GFile *file = g_file_new_for_path (ds_store_path);
-        GFileInfo *info = g_file_query_info (file,
-                                              G_FILE_ATTRIBUTE_STANDARD_SIZE,
-                                              G_FILE_QUERY_INFO_NONE,
-                                              NULL, NULL);
-        
-        if (info) {
-            size = g_file_info_get_size (info);
-            g_object_unref (info);
-        }
-        
-        g_debug ("FINDERZ: Found .DS_Store in %s (size: %ld bytes)", 
-                 directory_path, (long)size);
-        
-        /* Try to parse it */
-        if (global_ds_store_parser) {
-            GError *error = NULL;
-            FinderzDSStoreData *data = finderz_ds_store_parse_file (
-                global_ds_store_parser, ds_store_path, &error);
-            
-            if (data) {
-                g_debug ("FINDERZ: Successfully parsed DS_Store - view style: %d", 
-                         data->view_style);
-                finderz_ds_store_data_free (data);
-            } else if (error) {
-                g_debug ("FINDERZ: Failed to parse DS_Store: %s", error->message);
-                g_error_free (error);
-            }
+    if (!global_ds_store_parser) {
+        return finderz_ds_store_exists_for_directory (directory_path);
+    }
+    
+    /* Views only ask about the rows they show, so keep the tree mapped
+     * and resolve filenames on demand.  A cache hit costs one stat. */
+    data = finderz_ds_store_lookup (global_ds_store_parser, directory_path,
+                                    FINDERZ_DS_STORE_PARSE_LAZY, &error);
+    
+    if (data) {
+        has_ds_store = TRUE;
+        finderz_ds_store_data_unref (data);
+    } else {
+        /* A .DS_Store we cannot read still marks a Mac folder */
+        has_ds_store = g_error_matches (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+        if (has_ds_store) {
+            g_debug ("FINDERZ: Failed to parse DS_Store: %s", error->message);
         }
-        
-        g_object_unref (file);
+        g_clear_error (&error);
     }
     
-    g_free (ds_store_path);
     return has_ds_store;
 }
 
@@ -78,27 +121,112 @@ finderz_directory_has_mac_metadata (const gchar *directory_path)
 gint
 finderz_get_mac_view_style (const gchar *directory_path)
 {
+    FinderzDSStoreData *data;
+    gint view_style;
+    
     if (!global_ds_store_parser || !directory_path) {
         return -1;
     }
     
-    FinderzDSStoreData *cached = finderz_ds_store_get_cached_data (
-        global_ds_store_parser, directory_path);
+    data = finderz_ds_store_lookup (global_ds_store_parser, directory_path,
+                                    FINDERZ_DS_STORE_PARSE_LAZY, NULL);
+    if (!data) {
+        return -1;
+    }
+    
+    view_style = data->view_style;
+    finderz_ds_store_data_unref (data);
     
-    if (cached) {
-        return cached->view_style;
+    return view_style;
+}
+
+/* Called by the directory monitor for every changed, added or removed
+ * file; drops cached Finder settings as soon as a .DS_Store moves */
+void
+finderz_ds_store_location_changed (GFile *location)
+{
+    GFile *parent;
+    gchar *basename, *directory_path;
+    
+    if (!global_ds_store_parser || !location) {
+        return;
+    }
+    
+    basename = g_file_get_basename (location);
+    if (g_strcmp0 (basename, ".DS_Store") != 0) {
+        g_free (basename);
+        return;
     }
+    g_free (basename);
     
-    /* Try to load it */
-    if (finderz_directory_has_mac_metadata (directory_path)) {
-        cached = finderz_ds_store_get_cached_data (
-            global_ds_store_parser, directory_path);
-        if (cached) {
-            return cached->view_style;
+    parent = g_file_get_parent (location);
+    directory_path = parent ? g_file_get_path (parent) : NULL;
+    
+    if (directory_path) {
+        finderz_ds_store_invalidate (global_ds_store_parser, directory_path);
+    }
+    
+    g_free (directory_path);
+    g_clear_object (&parent);
+}
+
+/* The sorting profile @directory is shown with, or NULL to keep the
+ * view's own order */
+FinderzSortingProfile*
+finderz_get_sorting_profile (NemoDirectory *directory)
+{
+    if (!global_sorting_profiles || !directory) {
+        return NULL;
+    }
+    
+    return finderz_sorting_profile_manager_get_profile_for_directory (global_sorting_profiles,
+                                                                      directory);
+}
+
+/* Give @directory the profile after its own one, or the first when it
+ * has none; after the last it goes back to inheriting one.  Saved
+ * right away.  Returns the profile's name, or NULL. */
+const gchar*
+finderz_next_sorting_profile (NemoDirectory *directory)
+{
+    FinderzSortingProfile *profile = NULL;
+    const gchar *current;
+    GFile *location;
+    gchar *path;
+    GList *l;
+    
+    if (!global_sorting_profiles || !directory) {
+        return NULL;
+    }
+    
+    location = nemo_directory_get_location (directory);
+    path = g_file_get_path (location);
+    g_object_unref (location);
+    if (path == NULL) {
+        return NULL;
+    }
+    
+    current = g_hash_table_lookup (global_sorting_profiles->directory_profiles, path);
+    if (current == NULL) {
+        l = global_sorting_profiles->profiles;
+    } else {
+        for (l = global_sorting_profiles->profiles; l != NULL; l = l->next) {
+            if (g_strcmp0 (((FinderzSortingProfile *) l->data)->name, current) == 0) {
+                l = l->next;
+                break;
+            }
         }
     }
+    if (l != NULL) {
+        profile = l->data;
+    }
+    
+    finderz_sorting_profile_manager_set_directory_profile (global_sorting_profiles, path,
+                                                           profile != NULL ? profile->name : NULL);
+    save_sorting_profiles ();
+    g_free (path);
     
-    return -1;
+    return profile != NULL ? profile->name : NULL;
 }
 
 /* Cleanup Finderz features */
@@ -110,4 +238,7 @@ finderz_cleanup (void)
         global_ds_store_parser = NULL;
         g_debug ("FINDERZ: Cleaned up DS_Store parser");
     }
+    
+    finderz_sorting_profile_manager_free (global_sorting_profiles);
+    global_sorting_profiles = NULL;
 }
\ No newline at end of file
@@ -7,6 +7,8 @@
 #define FINDERZ_INTEGRATION_H
 
 #include <glib.h>
+#include <gio/gio.h>
+#include "finderz-sorting-profiles.h"
 
 G_BEGIN_DECLS
 
@@ -19,6 +21,16 @@ gboolean finderz_directory_has_mac_metadata (const gchar *directory_path);
 /* Get view style from DS_Store if available */
 gint finderz_get_mac_view_style (const gchar *directory_path);
 
+/* Forget cached DS_Store data when the monitor reports a change */
+void finderz_ds_store_location_changed (GFile *location);
+
+/* Sorting profile a view of @directory is shown with, or NULL */
+FinderzSortingProfile* finderz_get_sorting_profile (NemoDirectory *directory);
+
+/* Give @directory the next sorting profile and save it; returns the
+ * profile's name, or NULL once it inherits one again */
+const gchar* finderz_next_sorting_profile (NemoDirectory *directory);
+
 /* Cleanup Finderz features */
 void finderz_cleanup (void);
 
@@ -0,0 +1,1694 @@
+/* finderz-media-probe.c
+ *
+ * Duration, codecs and tags from audio and video container headers
+ *
+ * Every container keeps what we show near its start or in one index
+ * structure, so the prober walks box, element, frame or page headers
+ * and jumps over everything else.  Reads go through one window that is
+ * refilled at most MEDIA_MAX_FILLS times, which bounds the I/O per file
+ * no matter how large or broken it is.
+ */
+
+#include "finderz-media-probe.h"
+#include <gio/gio.h>
+#include <string.h>
+
+/* Bytes read per refill; large enough for a whole Ogg page */
+#define MEDIA_WINDOW_SIZE   (64 * 1024)
+#define MEDIA_MAX_FILLS     48
+
+#define MP4_MAX_BOXES       2048
+#define MP4_MAX_DEPTH       8
+#define MP4_MAX_TEXT        1024
+
+#define EBML_MAX_ELEMENTS   512
+#define EBML_MAX_STRING     1024
+
+#define ID3_MAX_FRAMES      256
+#define ID3_MAX_TEXT        1024
+
+#define FLAC_MAX_BLOCKS     64
+
+#define OGG_MAX_PAGES       16
+#define OGG_MAX_PACKET      MEDIA_WINDOW_SIZE
+
+#define FOURCC(a, b, c, d) (((guint32)(a) << 24) | ((guint32)(b) << 16) | \
+                            ((guint32)(c) << 8) | (guint32)(d))
+
+/* Matroska element ids, with their length marker */
+#define EBML_ID_HEADER          0x1a45dfa3
+#define MKV_ID_SEGMENT          0x18538067
+#define MKV_ID_SEEK_HEAD        0x114d9b74
+#define MKV_ID_SEEK             0x4dbb
+#define MKV_ID_SEEK_ID          0x53ab
+#define MKV_ID_SEEK_POSITION    0x53ac
+#define MKV_ID_INFO             0x1549a966
+#define MKV_ID_TIMESTAMP_SCALE  0x2ad7b1
+#define MKV_ID_DURATION         0x4489
+#define MKV_ID_TITLE            0x7ba9
+#define MKV_ID_TRACKS           0x1654ae6b
+#define MKV_ID_TRACK_ENTRY      0xae
+#define MKV_ID_TRACK_TYPE       0x83
+#define MKV_ID_CODEC_ID         0x86
+#define MKV_ID_VIDEO            0xe0
+#define MKV_ID_PIXEL_WIDTH      0xb0
+#define MKV_ID_PIXEL_HEIGHT     0xba
+#define MKV_ID_CLUSTER          0x1f43b675
+
+#define MKV_TRACK_VIDEO 1
+#define MKV_TRACK_AUDIO 2
+
+typedef struct {
+    GInputStream *stream;
+    goffset size;
+    guint8 *window;
+    goffset window_offset;
+    gsize window_length;
+    guint n_fills;
+} MediaReader;
+
+/* What the headers told us; the first source of each field wins */
+typedef struct {
+    gdouble duration;       /* seconds */
+    gint64 bitrate;         /* bits per second, 0 to derive from the size */
+    guint width;
+    guint height;
+    gchar *video_codec;
+    gchar *audio_codec;
+    gchar *title;
+    gchar *artist;
+    gchar *album;
+} MediaInfo;
+
+typedef struct {
+    const gchar *tag;
+    const gchar *name;
+} CodecName;
+
+/* Sample entry formats of MP4 and QuickTime */
+static const CodecName mp4_codecs[] = {
+    { "avc1", "H.264" },
+    { "avc3", "H.264" },
+    { "hvc1", "HEVC" },
+    { "hev1", "HEVC" },
+    { "av01", "AV1" },
+    { "vp09", "VP9" },
+    { "vp08", "VP8" },
+    { "mp4v", "MPEG-4" },
+    { "apco", "ProRes 422 Proxy" },
+    { "apcs", "ProRes 422 LT" },
+    { "apcn", "ProRes 422" },
+    { "apch", "ProRes 422 HQ" },
+    { "ap4h", "ProRes 4444" },
+    { "ap4x", "ProRes 4444 XQ" },
+    { "jpeg", "Motion JPEG" },
+    { "mjpa", "Motion JPEG" },
+    { "mp4a", "AAC" },
+    { "ac-3", "AC-3" },
+    { "ec-3", "E-AC-3" },
+    { "Opus", "Opus" },
+    { "fLaC", "FLAC" },
+    { "alac", "ALAC" },
+    { ".mp3", "MP3" },
+    { "lpcm", "PCM" },
+    { "sowt", "PCM" },
+    { "twos", "PCM" },
+    { "in24", "PCM" },
+    { "in32", "PCM" },
+    { "fl32", "PCM" },
+    { "fl64", "PCM" },
+};
+
+/* Matroska codec ids; a tag also matches the ids it is a prefix of,
+ * as "A_AAC" does "A_AAC/MPEG4/LC" */
+static const CodecName matroska_codecs[] = {
+    { "V_MPEG4/ISO/AVC", "H.264" },
+    { "V_MPEGH/ISO/HEVC", "HEVC" },
+    { "V_AV1", "AV1" },
+    { "V_VP8", "VP8" },
+    { "V_VP9", "VP9" },
+    { "V_PRORES", "ProRes" },
+    { "V_MJPEG", "Motion JPEG" },
+    { "V_MPEG4/ISO", "MPEG-4" },
+    { "A_AAC", "AAC" },
+    { "A_OPUS", "Opus" },
+    { "A_VORBIS", "Vorbis" },
+    { "A_FLAC", "FLAC" },
+    { "A_AC3", "AC-3" },
+    { "A_EAC3", "E-AC-3" },
+    { "A_DTS", "DTS" },
+    { "A_MPEG/L3", "MP3" },
+    { "A_MPEG/L2", "MP2" },
+    { "A_PCM", "PCM" },
+};
+
+static const gchar *media_extensions[] = {
+    "mp4", "m4v", "m4a", "mov", "3gp",
+    "mkv", "mka", "webm",
+    "mp3", "flac", "ogg", "oga", "opus",
+};
+
+static inline guint16
+be16 (const guint8 *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static inline guint32
+be24 (const guint8 *p)
+{
+    return ((guint32)p[0] << 16) | (p[1] << 8) | p[2];
+}
+
+static inline guint32
+be32 (const guint8 *p)
+{
+    return ((guint32)p[0] << 24) | ((guint32)p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static inline guint64
+be64 (const guint8 *p)
+{
+    return ((guint64)be32 (p) << 32) | be32 (p + 4);
+}
+
+static inline guint16
+le16 (const guint8 *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static inline guint32
+le32 (const guint8 *p)
+{
+    return p[0] | (p[1] << 8) | ((guint32)p[2] << 16) | ((guint32)p[3] << 24);
+}
+
+static inline guint64
+le64 (const guint8 *p)
+{
+    return le32 (p) | ((guint64)le32 (p + 4) << 32);
+}
+
+/* ID3v2 sizes keep the top bit of each byte clear */
+static inline guint32
+synchsafe32 (const guint8 *p)
+{
+    return ((guint32)(p[0] & 0x7f) << 21) | ((p[1] & 0x7f) << 14) |
+           ((p[2] & 0x7f) << 7) | (p[3] & 0x7f);
+}
+
+static gboolean
+media_reader_open (MediaReader *reader, const gchar *file_path)
+{
+    GFile *file;
+    GFileInputStream *stream;
+    GFileInfo *info;
+    
+    memset (reader, 0, sizeof (MediaReader));
+    
+    file = g_file_new_for_path (file_path);
+    stream = g_file_read (file, NULL, NULL);
+    g_object_unref (file);
+    if (!stream) {
+        return FALSE;
+    }
+    
+    info = g_file_input_stream_query_info (stream, G_FILE_ATTRIBUTE_STANDARD_SIZE,
+                                           NULL, NULL);
+    if (!info) {
+        g_object_unref (stream);
+        return FALSE;
+    }
+    reader->size = g_file_info_get_size (info);
+    g_object_unref (info);
+    
+    reader->stream = G_INPUT_STREAM (stream);
+    reader->window = g_malloc (MEDIA_WINDOW_SIZE);
+    
+    return TRUE;
+}
+
+static void
+media_reader_close (MediaReader *reader)
+{
+    g_clear_object (&reader->stream);
+    g_free (reader->window);
+}
+
+/* The @length bytes at @offset, or NULL if they run past the end of
+ * the file or the read budget is spent.  The pointer is valid until the
+ * next call. */
+static const guint8*
+media_peek (MediaReader *reader, goffset offset, gsize length)
+{
+    gsize bytes_read;
+    
+    if (offset < 0 || offset > reader->size || length > MEDIA_WINDOW_SIZE ||
+        (goffset)length > reader->size - offset) {
+        return NULL;
+    }
+    
+    if (offset >= reader->window_offset &&
+        offset + (goffset)length <= reader->window_offset + (goffset)reader->window_length) {
+        return reader->window + (offset - reader->window_offset);
+    }
+    
+    if (reader->n_fills >= MEDIA_MAX_FILLS) {
+        return NULL;
+    }
+    reader->n_fills++;
+    reader->window_length = 0;
+    
+    if (!g_seekable_seek (G_SEEKABLE (reader->stream), offset, G_SEEK_SET, NULL, NULL) ||
+        !g_input_stream_read_all (reader->stream, reader->window,
+                                  MIN (MEDIA_WINDOW_SIZE, reader->size - offset),
+                                  &bytes_read, NULL, NULL) ||
+        bytes_read < length) {
+        return NULL;
+    }
+    
+    reader->window_offset = offset;
+    reader->window_length = bytes_read;
+    
+    return reader->window;
+}
+
+/* Keep @value in *@field unless the field is set or @value is blank */
+static void
+media_take_string (gchar **field, gchar *value)
+{
+    if (value) {
+        g_strstrip (value);
+    }
+    
+    if (*field || !value || !*value) {
+        g_free (value);
+        return;
+    }
+    
+    *field = value;
+}
+
+static gchar*
+codec_name (const CodecName *table, gsize n_entries, const gchar *tag)
+{
+    gsize i;
+    
+    for (i = 0; i < n_entries; i++) {
+        gsize length = strlen (table[i].tag);
+        
+        if (strncmp (tag, table[i].tag, length) == 0 &&
+            (tag[length] == '\0' || tag[length] == '/')) {
+            return g_strdup (table[i].name);
+        }
+    }
+    
+    return NULL;
+}
+
+/* === MP4 and QuickTime === */
+
+typedef struct {
+    guint32 type;
+    goffset data;
+    goffset end;
+} Mp4Box;
+
+/* The track being walked; only its first sample entry is read */
+typedef struct {
+    guint32 handler;
+    guint32 format;
+    guint width;            /* display size from tkhd */
+    guint height;
+    guint entry_width;      /* coded size from the sample entry */
+    guint entry_height;
+} Mp4Track;
+
+typedef struct {
+    MediaReader *reader;
+    MediaInfo *info;
+    Mp4Track track;
+    guint32 timescale;
+    guint64 fragment_duration;
+    guint n_boxes;
+    gboolean done;
+} Mp4Walk;
+
+static gboolean
+mp4_read_box (MediaReader *reader, goffset offset, goffset end, Mp4Box *box)
+{
+    const guint8 *p;
+    guint64 size;
+    goffset header = 8;
+    
+    if (end - offset < 8 || !(p = media_peek (reader, offset, 8))) {
+        return FALSE;
+    }
+    
+    size = be32 (p);
+    box->type = be32 (p + 4);
+    
+    if (size == 1) {
+        /* 64-bit size follows the type */
+        if (end - offset < 16 || !(p = media_peek (reader, offset + 8, 8))) {
+            return FALSE;
+        }
+        size = be64 (p);
+        header = 16;
+    } else if (size == 0) {
+        /* Runs to the end of the file */
+        size = end - offset;
+    }
+    
+    if (size < (guint64)header || size > (guint64)(end - offset)) {
+        return FALSE;
+    }
+    
+    box->data = offset + header;
+    box->end = offset + size;
+    
+    return TRUE;
+}
+
+/* The first @length bytes of @box's payload, or NULL if it is shorter */
+static const guint8*
+mp4_peek_data (Mp4Walk *walk, const Mp4Box *box, gsize length)
+{
+    if (box->end - box->data < (goffset)length) {
+        return NULL;
+    }
+    
+    return media_peek (walk->reader, box->data, length);
+}
+
+static gchar*
+mp4_codec_name (guint32 format)
+{
+    gchar tag[5];
+    gchar *name;
+    gint i;
+    
+    for (i = 0; i < 4; i++) {
+        tag[i] = (format >> (24 - i * 8)) & 0xff;
+        if (!g_ascii_isprint (tag[i])) {
+            return NULL;
+        }
+    }
+    tag[4] = '\0';
+    
+    name = codec_name (mp4_codecs, G_N_ELEMENTS (mp4_codecs), tag);
+    
+    return name ? name : g_strdup (tag);
+}
+
+static void
+mp4_read_mvhd (Mp4Walk *walk, const Mp4Box *box)
+{
+    const guint8 *p;
+    guint64 duration;
+    
+    if (!(p = mp4_peek_data (walk, box, 20))) {
+        return;
+    }
+    
+    if (p[0] == 1) {
+        if (!(p = mp4_peek_data (walk, box, 32))) {
+            return;
+        }
+        walk->timescale = be32 (p + 20);
+        duration = be64 (p + 24);
+    } else {
+        walk->timescale = be32 (p + 12);
+        duration = be32 (p + 16);
+        if (duration == G_MAXUINT32) {
+            duration = 0;
+        }
+    }
+    
+    if (walk->timescale > 0 && duration > 0 && duration != G_MAXUINT64) {
+        walk->info->duration = (gdouble)duration / walk->timescale;
+    }
+}
+
+/* Fragmented files may leave mvhd empty and give the length here */
+static void
+mp4_read_mehd (Mp4Walk *walk, const Mp4Box *box)
+{
+    const guint8 *p;
+    
+    if (!(p = mp4_peek_data (walk, box, 8))) {
+        return;
+    }
+    
+    if (p[0] == 1) {
+        if ((p = mp4_peek_data (walk, box, 12))) {
+            walk->fragment_duration = be64 (p + 4);
+        }
+    } else {
+        walk->fragment_duration = be32 (p + 4);
+    }
+}
+
+static void
+mp4_read_tkhd (Mp4Walk *walk, const Mp4Box *box)
+{
+    const guint8 *p;
+    gsize offset;
+    
+    if (!(p = mp4_peek_data (walk, box, 1))) {
+        return;
+    }
+    
+    /* Width and height end the box, as 16.16 fixed point */
+    offset = p[0] == 1 ? 88 : 76;
+    if (!(p = mp4_peek_data (walk, box, offset + 8))) {
+        return;
+    }
+    
+    walk->track.width = be32 (p + offset) >> 16;
+    walk->track.height = be32 (p + offset + 4) >> 16;
+}
+
+static void
+mp4_read_stsd (Mp4Walk *walk, const Mp4Box *box)
+{
+    const guint8 *p;
+    
+    /* Version and flags, entry count, then the first entry */
+    if (!(p = mp4_peek_data (walk, box, 16)) || be32 (p + 4) == 0) {
+        return;
+    }
+    walk->track.format = be32 (p + 12);
+    
+    /* A visual sample entry has its coded size 24 bytes in */
+    if (walk->track.handler == FOURCC ('v', 'i', 'd', 'e') &&
+        (p = mp4_peek_data (walk, box, 44))) {
+        walk->track.entry_width = be16 (p + 40);
+        walk->track.entry_height = be16 (p + 42);
+    }
+}
+
+/* An iTunes-style tag: a box named after the tag holding a data box
+ * of type indicator, locale and UTF-8 text */
+static void
+mp4_read_item (Mp4Walk *walk, const Mp4Box *box, gchar **field)
+{
+    Mp4Box data;
+    const guint8 *p;
+    gsize length;
+    
+    if (*field ||
+        !mp4_read_box (walk->reader, box->data, box->end, &data) ||
+        data.type != FOURCC ('d', 'a', 't', 'a') ||
+        data.end - data.data < 8) {
+        return;
+    }
+    
+    /* Type indicator 1 is UTF-8 text */
+    length = MIN (data.end - data.data - 8, MP4_MAX_TEXT);
+    p = media_peek (walk->reader, data.data, 8 + length);
+    if (p && be32 (p) == 1 && g_utf8_validate ((const gchar *)p + 8, length, NULL)) {
+        media_take_string (field, g_strndup ((const gchar *)p + 8, length));
+    }
+}
+
+static void
+mp4_finish_track (Mp4Walk *walk)
+{
+    MediaInfo *info = walk->info;
+    Mp4Track *track = &walk->track;
+    
+    if (track->handler == FOURCC ('v', 'i', 'd', 'e') && !info->video_codec) {
+        info->video_codec = mp4_codec_name (track->format);
+        if (track->width > 0 && track->height > 0) {
+            info->width = track->width;
+            info->height = track->height;
+        } else {
+            info->width = track->entry_width;
+            info->height = track->entry_height;
+        }
+    } else if (track->handler == FOURCC ('s', 'o', 'u', 'n') && !info->audio_codec) {
+        info->audio_codec = mp4_codec_name (track->format);
+    }
+}
+
+/* Walk the boxes between @offset and @end.  Only container boxes on
+ * the way to the headers are entered; sample tables and media data
+ * are stepped over without being read. */
+static void
+mp4_walk (Mp4Walk *walk, goffset offset, goffset end, guint32 parent, guint depth)
+{
+    Mp4Box box;
+    
+    while (!walk->done && offset < end && walk->n_boxes++ < MP4_MAX_BOXES &&
+           mp4_read_box (walk->reader, offset, end, &box)) {
+        
+        switch (box.type) {
+            case FOURCC ('m', 'o', 'o', 'v'):
+                if (depth == 0) {
+                    mp4_walk (walk, box.data, box.end, box.type, depth + 1);
+                    walk->done = TRUE;
+                }
+                break;
+            case FOURCC ('t', 'r', 'a', 'k'):
+                memset (&walk->track, 0, sizeof (Mp4Track));
+                mp4_walk (walk, box.data, box.end, box.type, depth + 1);
+                mp4_finish_track (walk);
+                break;
+            case FOURCC ('m', 'd', 'i', 'a'):
+            case FOURCC ('m', 'i', 'n', 'f'):
+            case FOURCC ('s', 't', 'b', 'l'):
+            case FOURCC ('m', 'v', 'e', 'x'):
+            case FOURCC ('u', 'd', 't', 'a'):
+            case FOURCC ('i', 'l', 's', 't'):
+                if (depth < MP4_MAX_DEPTH) {
+                    mp4_walk (walk, box.data, box.end, box.type, depth + 1);
+                }
+                break;
+            case FOURCC ('m', 'e', 't', 'a'): {
+                const guint8 *p = mp4_peek_data (walk, &box, 4);
+                
+                /* A full box in MP4 but a plain one in QuickTime */
+                if (p && depth < MP4_MAX_DEPTH) {
+                    mp4_walk (walk, box.data + (be32 (p) == 0 ? 4 : 0), box.end,
+                              box.type, depth + 1);
+                }
+                break;
+            }
+            case FOURCC ('m', 'v', 'h', 'd'):
+                mp4_read_mvhd (walk, &box);
+                break;
+            case FOURCC ('m', 'e', 'h', 'd'):
+                mp4_read_mehd (walk, &box);
+                break;
+            case FOURCC ('t', 'k', 'h', 'd'):
+                if (parent == FOURCC ('t', 'r', 'a', 'k')) {
+                    mp4_read_tkhd (walk, &box);
+                }
+                break;
+            case FOURCC ('h', 'd', 'l', 'r'):
+                /* Metadata boxes have handlers of their own */
+                if (parent == FOURCC ('m', 'd', 'i', 'a')) {
+                    const guint8 *p = mp4_peek_data (walk, &box, 12);
+                    
+                    if (p) {
+                        walk->track.handler = be32 (p + 8);
+                    }
+                }
+                break;
+            case FOURCC ('s', 't', 's', 'd'):
+                mp4_read_stsd (walk, &box);
+                break;
+            case FOURCC (0xa9, 'n', 'a', 'm'):
+                if (parent == FOURCC ('i', 'l', 's', 't')) {
+                    mp4_read_item (walk, &box, &walk->info->title);
+                }
+                break;
+            case FOURCC (0xa9, 'A', 'R', 'T'):
+                if (parent == FOURCC ('i', 'l', 's', 't')) {
+                    mp4_read_item (walk, &box, &walk->info->artist);
+                }
+                break;
+            case FOURCC (0xa9, 'a', 'l', 'b'):
+                if (parent == FOURCC ('i', 'l', 's', 't')) {
+                    mp4_read_item (walk, &box, &walk->info->album);
+                }
+                break;
+            default:
+                break;
+        }
+        
+        offset = box.end;
+    }
+}
+
+/* The movie header usually follows the media data in camera and
+ * render output, so top-level boxes are skipped by their sizes until
+ * moov turns up */
+static gboolean
+probe_mp4 (MediaReader *reader, MediaInfo *info)
+{
+    Mp4Walk walk = { 0 };
+    
+    walk.reader = reader;
+    walk.info = info;
+    mp4_walk (&walk, 0, reader->size, 0, 0);
+    
+    if (info->duration == 0 && walk.timescale > 0 && walk.fragment_duration > 0) {
+        info->duration = (gdouble)walk.fragment_duration / walk.timescale;
+    }
+    
+    return walk.done;
+}
+
+/* === Matroska and WebM === */
+
+typedef struct {
+    guint32 id;
+    goffset data;
+    goffset end;
+    gboolean unknown_size;
+} EbmlElement;
+
+/* Length of a variable-size integer from its first byte, 0 if invalid */
+static guint
+ebml_vint_length (guint8 first, guint max_length)
+{
+    guint length;
+    
+    for (length = 1; length <= max_length; length++) {
+        if (first & (0x80 >> (length - 1))) {
+            return length;
+        }
+    }
+    
+    return 0;
+}
+
+static gboolean
+ebml_read_element (MediaReader *reader, goffset offset, goffset end, EbmlElement *element)
+{
+    const guint8 *p;
+    gsize available;
+    guint id_length, size_length, i;
+    guint64 size;
+    gboolean all_ones;
+    
+    if (end - offset < 2) {
+        return FALSE;
+    }
+    available = MIN (end - offset, 12);
+    if (!(p = media_peek (reader, offset, available))) {
+        return FALSE;
+    }
+    
+    /* Ids keep their length marker */
+    id_length = ebml_vint_length (p[0], 4);
+    if (id_length == 0 || id_length >= available) {
+        return FALSE;
+    }
+    element->id = 0;
+    for (i = 0; i < id_length; i++) {
+        element->id = (element->id << 8) | p[i];
+    }
+    
+    /* Sizes drop it, and all value bits set means unknown */
+    p += id_length;
+    size_length = ebml_vint_length (p[0], 8);
+    if (size_length == 0 || id_length + size_length > available) {
+        return FALSE;
+    }
+    size = p[0] & (0xff >> size_length);
+    all_ones = size == (guint64)(0xff >> size_length);
+    for (i = 1; i < size_length; i++) {
+        size = (size << 8) | p[i];
+        all_ones = all_ones && p[i] == 0xff;
+    }
+    
+    element->data = offset + id_length + size_length;
+    element->unknown_size = all_ones;
+    if (all_ones) {
+        element->end = end;
+    } else if (size > (guint64)(end - element->data)) {
+        return FALSE;
+    } else {
+        element->end = element->data + size;
+    }
+    
+    return TRUE;
+}
+
+static gboolean
+ebml_read_uint (MediaReader *reader, const EbmlElement *element, guint64 *value)
+{
+    const guint8 *p;
+    gsize length = element->end - element->data;
+    gsize i;
+    
+    if (length < 1 || length > 8 || !(p = media_peek (reader, element->data, length))) {
+        return FALSE;
+    }
+    
+    *value = 0;
+    for (i = 0; i < length; i++) {
+        *value = (*value << 8) | p[i];
+    }
+    
+    return TRUE;
+}
+
+static gboolean
+ebml_read_float (MediaReader *reader, const EbmlElement *element, gdouble *value)
+{
+    const guint8 *p;
+    gsize length = element->end - element->data;
+    
+    if ((length != 4 && length != 8) || !(p = media_peek (reader, element->data, length))) {
+        return FALSE;
+    }
+    
+    if (length == 4) {
+        union { guint32 i; gfloat f; } u;
+        
+        u.i = be32 (p);
+        *value = u.f;
+    } else {
+        union { guint64 i; gdouble d; } u;
+        
+        u.i = be64 (p);
+        *value = u.d;
+    }
+    
+    return TRUE;
+}
+
+static gchar*
+ebml_read_string (MediaReader *reader, const EbmlElement *element)
+{
+    const guint8 *p;
+    gsize length = element->end - element->data;
+    gchar *string;
+    
+    if (length < 1 || length > EBML_MAX_STRING ||
+        !(p = media_peek (reader, element->data, length))) {
+        return NULL;
+    }
+    
+    /* Strings may be padded with NULs */
+    string = g_strndup ((const gchar *)p, length);
+    if (!g_utf8_validate (string, -1, NULL)) {
+        g_free (string);
+        return NULL;
+    }
+    
+    return string;
+}
+
+/* Where the SeekHead says Info and Tracks are, relative to the start
+ * of the segment's data */
+static void
+mkv_read_seek_head (MediaReader *reader, const EbmlElement *seek_head,
+                    guint64 *info_position, guint64 *tracks_position)
+{
+    EbmlElement seek, child;
+    goffset offset = seek_head->data;
+    guint n = 0;
+    
+    while (offset < seek_head->end && n++ < EBML_MAX_ELEMENTS &&
+           ebml_read_element (reader, offset, seek_head->end, &seek) &&
+           !seek.unknown_size) {
+        guint64 id = 0, position = 0;
+        goffset child_offset = seek.data;
+        
+        while (seek.id == MKV_ID_SEEK && child_offset < seek.end &&
+               ebml_read_element (reader, child_offset, seek.end, &child) &&
+               !child.unknown_size) {
+            if (child.id == MKV_ID_SEEK_ID) {
+                ebml_read_uint (reader, &child, &id);
+            } else if (child.id == MKV_ID_SEEK_POSITION) {
+                ebml_read_uint (reader, &child, &position);
+            }
+            child_offset = child.end;
+        }
+        
+        if (id == MKV_ID_INFO) {
+            *info_position = position;
+        } else if (id == MKV_ID_TRACKS) {
+            *tracks_position = position;
+        }
+        
+        offset = seek.end;
+    }
+}
+
+static void
+mkv_read_info (MediaReader *reader, const EbmlElement *info_element, MediaInfo *info)
+{
+    EbmlElement child;
+    goffset offset = info_element->data;
+    guint64 timestamp_scale = 1000000;
+    gdouble duration = 0;
+    guint n = 0;
+    
+    while (offset < info_element->end && n++ < EBML_MAX_ELEMENTS &&
+           ebml_read_element (reader, offset, info_element->end, &child) &&
+           !child.unknown_size) {
+        switch (child.id) {
+            case MKV_ID_TIMESTAMP_SCALE:
+                ebml_read_uint (reader, &child, &timestamp_scale);
+                break;
+            case MKV_ID_DURATION:
+                ebml_read_float (reader, &child, &duration);
+                break;
+            case MKV_ID_TITLE:
+                media_take_string (&info->title, ebml_read_string (reader, &child));
+                break;
+            default:
+                break;
+        }
+        offset = child.end;
+    }
+    
+    /* Duration counts ticks of timestamp_scale nanoseconds */
+    if (duration > 0 && timestamp_scale > 0) {
+        info->duration = duration * timestamp_scale / 1e9;
+    }
+}
+
+static void
+mkv_read_track_entry (MediaReader *reader, const EbmlElement *entry, MediaInfo *info)
+{
+    EbmlElement child, video;
+    goffset offset = entry->data;
+    guint64 type = 0, width = 0, height = 0;
+    gchar *codec_id = NULL;
+    guint n = 0;
+    
+    while (offset < entry->end && n++ < EBML_MAX_ELEMENTS &&
+           ebml_read_element (reader, offset, entry->end, &child) &&
+           !child.unknown_size) {
+        if (child.id == MKV_ID_TRACK_TYPE) {
+            ebml_read_uint (reader, &child, &type);
+        } else if (child.id == MKV_ID_CODEC_ID && !codec_id) {
+            codec_id = ebml_read_string (reader, &child);
+        } else if (child.id == MKV_ID_VIDEO) {
+            goffset video_offset = child.data;
+            
+            while (video_offset < child.end && n++ < EBML_MAX_ELEMENTS &&
+                   ebml_read_element (reader, video_offset, child.end, &video) &&
+                   !video.unknown_size) {
+                if (video.id == MKV_ID_PIXEL_WIDTH) {
+                    ebml_read_uint (reader, &video, &width);
+                } else if (video.id == MKV_ID_PIXEL_HEIGHT) {
+                    ebml_read_uint (reader, &video, &height);
+                }
+                video_offset = video.end;
+            }
+        }
+        offset = child.end;
+    }
+    
+    if (codec_id && type == MKV_TRACK_VIDEO && !info->video_codec) {
+        info->video_codec = codec_name (matroska_codecs, G_N_ELEMENTS (matroska_codecs), codec_id);
+        if (!info->video_codec) {
+            info->video_codec = g_strdup (g_str_has_prefix (codec_id, "V_") ? codec_id + 2 : codec_id);
+        }
+        if (width > 0 && height > 0 && width <= G_MAXUINT && height <= G_MAXUINT) {
+            info->width = width;
+            info->height = height;
+        }
+    } else if (codec_id && type == MKV_TRACK_AUDIO && !info->audio_codec) {
+        info->audio_codec = codec_name (matroska_codecs, G_N_ELEMENTS (matroska_codecs), codec_id);
+        if (!info->audio_codec) {
+            info->audio_codec = g_strdup (g_str_has_prefix (codec_id, "A_") ? codec_id + 2 : codec_id);
+        }
+    }
+    
+    g_free (codec_id);
+}
+
+static void
+mkv_read_tracks (MediaReader *reader, const EbmlElement *tracks, MediaInfo *info)
+{
+    EbmlElement entry;
+    goffset offset = tracks->data;
+    guint n = 0;
+    
+    while (offset < tracks->end && n++ < EBML_MAX_ELEMENTS &&
+           ebml_read_element (reader, offset, tracks->end, &entry) &&
+           !entry.unknown_size) {
+        if (entry.id == MKV_ID_TRACK_ENTRY) {
+            mkv_read_track_entry (reader, &entry, info);
+        }
+        offset = entry.end;
+    }
+}
+
+/* Segment Info and Tracks precede the clusters in practice, so the
+ * segment is walked until the first cluster; if either is missing by
+ * then, the SeekHead says where it is */
+static gboolean
+probe_matroska (MediaReader *reader, MediaInfo *info)
+{
+    EbmlElement header, segment, child;
+    guint64 info_position = 0, tracks_position = 0;
+    gboolean have_info = FALSE, have_tracks = FALSE;
+    goffset offset;
+    guint n = 0;
+    
+    if (!ebml_read_element (reader, 0, reader->size, &header) ||
+        header.id != EBML_ID_HEADER || header.unknown_size ||
+        !ebml_read_element (reader, header.end, reader->size, &segment) ||
+        segment.id != MKV_ID_SEGMENT) {
+        return FALSE;
+    }
+    
+    offset = segment.data;
+    while (offset < segment.end && n++ < EBML_MAX_ELEMENTS && !(have_info && have_tracks) &&
+           ebml_read_element (reader, offset, segment.end, &child) &&
+           child.id != MKV_ID_CLUSTER && !child.unknown_size) {
+        switch (child.id) {
+            case MKV_ID_SEEK_HEAD:
+                mkv_read_seek_head (reader, &child, &info_position, &tracks_position);
+                break;
+            case MKV_ID_INFO:
+                mkv_read_info (reader, &child, info);
+                have_info = TRUE;
+                break;
+            case MKV_ID_TRACKS:
+                mkv_read_tracks (reader, &child, info);
+                have_tracks = TRUE;
+                break;
+            default:
+                break;
+        }
+        offset = child.end;
+    }
+    
+    if (!have_info && info_position > 0 &&
+        info_position < (guint64)(segment.end - segment.data) &&
+        ebml_read_element (reader, segment.data + info_position, segment.end, &child) &&
+        child.id == MKV_ID_INFO && !child.unknown_size) {
+        mkv_read_info (reader, &child, info);
+    }
+    
+    if (!have_tracks && tracks_position > 0 &&
+        tracks_position < (guint64)(segment.end - segment.data) &&
+        ebml_read_element (reader, segment.data + tracks_position, segment.end, &child) &&
+        child.id == MKV_ID_TRACKS && !child.unknown_size) {
+        mkv_read_tracks (reader, &child, info);
+    }
+    
+    return TRUE;
+}
+
+/* === ID3v2 and MPEG audio === */
+
+/* The text of a T*** frame, up to its first terminator */
+static gchar*
+id3_read_text (MediaReader *reader, goffset offset, gsize length)
+{
+    const guint8 *p;
+    const guint8 *end;
+    gsize n;
+    
+    if (length < 2) {
+        return NULL;
+    }
+    length = MIN (length, ID3_MAX_TEXT);
+    if (!(p = media_peek (reader, offset, length))) {
+        return NULL;
+    }
+    
+    switch (p[0]) {
+        case 0:     /* ISO-8859-1 */
+            end = memchr (p + 1, '\0', length - 1);
+            n = end ? (gsize)(end - p - 1) : length - 1;
+            return g_convert ((const gchar *)p + 1, n, "UTF-8", "ISO-8859-1", NULL, NULL, NULL);
+        case 1:     /* UTF-16 with a byte order mark */
+        case 2:     /* UTF-16BE */
+            for (n = 0; n + 2 < length && (p[1 + n] || p[2 + n]); n += 2) {
+            }
+            return g_convert ((const gchar *)p + 1, n, "UTF-8",
+                              p[0] == 1 ? "UTF-16" : "UTF-16BE", NULL, NULL, NULL);
+        case 3:     /* UTF-8 */
+            end = memchr (p + 1, '\0', length - 1);
+            n = end ? (gsize)(end - p - 1) : length - 1;
+            if (!g_utf8_validate ((const gchar *)p + 1, n, NULL)) {
+                return NULL;
+            }
+            return g_strndup ((const gchar *)p + 1, n);
+        default:
+            return NULL;
+    }
+}
+
+/* Read the title, artist, album and length frames of the ID3v2 tag at
+ * the start of the file; the other frames, cover art included, are
+ * skipped unread.  Returns the offset where the audio starts, or 0 if
+ * there is no tag. */
+static goffset
+id3_read_tag (MediaReader *reader, MediaInfo *info)
+{
+    const guint8 *p;
+    guint8 major, flags;
+    goffset offset, frames_end, audio_start;
+    gsize header_length;
+    guint n = 0;
+    
+    if (!(p = media_peek (reader, 0, 10)) || memcmp (p, "ID3", 3) != 0 ||
+        p[3] < 2 || p[3] > 4 || ((p[6] | p[7] | p[8] | p[9]) & 0x80)) {
+        return 0;
+    }
+    
+    major = p[3];
+    flags = p[5];
+    frames_end = MIN (10 + (goffset)synchsafe32 (p + 6), reader->size);
+    audio_start = frames_end + (major == 4 && (flags & 0x10) ? 10 : 0);
+    offset = 10;
+    
+    /* ID3v2.2 compression was never defined */
+    if (major == 2 && (flags & 0x40)) {
+        return audio_start;
+    }
+    
+    if (major > 2 && (flags & 0x40)) {
+        if (!(p = media_peek (reader, offset, 4))) {
+            return audio_start;
+        }
+        offset += major == 4 ? (goffset)synchsafe32 (p) : (goffset)be32 (p) + 4;
+    }
+    
+    header_length = major == 2 ? 6 : 10;
+    while (offset + (goffset)header_length <= frames_end && n++ < ID3_MAX_FRAMES &&
+           (p = media_peek (reader, offset, header_length)) && p[0] != '\0') {
+        gchar id[5] = { 0 };
+        guint32 size;
+        guint16 frame_flags = 0;
+        goffset data = offset + header_length;
+        gchar **field = NULL;
+        gboolean length_frame = FALSE;
+        gchar *text;
+        
+        if (major == 2) {
+            memcpy (id, p, 3);
+            size = be24 (p + 3);
+        } else {
+            memcpy (id, p, 4);
+            size = major == 4 ? synchsafe32 (p + 4) : be32 (p + 4);
+            frame_flags = be16 (p + 8);
+        }
+        
+        if (size > frames_end - data) {
+            break;
+        }
+        offset = data + size;
+        
+        if (strcmp (id, "TIT2") == 0 || strcmp (id, "TT2") == 0) {
+            field = &info->title;
+        } else if (strcmp (id, "TPE1") == 0 || strcmp (id, "TP1") == 0) {
+            field = &info->artist;
+        } else if (strcmp (id, "TALB") == 0 || strcmp (id, "TAL") == 0) {
+            field = &info->album;
+        } else if (strcmp (id, "TLEN") == 0 || strcmp (id, "TLE") == 0) {
+            length_frame = TRUE;
+        } else {
+            continue;
+        }
+        
+        /* Compressed, encrypted or unsynchronised frames are left alone;
+         * a grouping byte and data length come before the text */
+        if (major == 4) {
+            if (frame_flags & 0x000e) {
+                continue;
+            }
+            data += (frame_flags & 0x0040 ? 1 : 0) + (frame_flags & 0x0001 ? 4 : 0);
+        } else if (major == 3) {
+            if (frame_flags & 0x00c0) {
+                continue;
+            }
+            data += frame_flags & 0x0020 ? 1 : 0;
+        }
+        if (data >= offset) {
+            continue;
+        }
+        
+        text = id3_read_text (reader, data, offset - data);
+        if (length_frame) {
+            guint64 milliseconds = text ? g_ascii_strtoull (text, NULL, 10) : 0;
+            
+            if (milliseconds > 0 && info->duration == 0) {
+                info->duration = milliseconds / 1000.0;
+            }
+            g_free (text);
+        } else {
+            media_take_string (field, text);
+        }
+    }
+    
+    return audio_start;
+}
+
+typedef struct {
+    guint version;          /* 3 MPEG-1, 2 MPEG-2, 0 MPEG-2.5 */
+    guint layer;
+    guint bitrate;          /* bits per second */
+    guint sample_rate;
+    guint samples;          /* per frame */
+    guint frame_length;
+    gboolean mono;
+} MpegHeader;
+
+static const guint16 mpeg_bitrates[5][15] = {
+    { 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448 },  /* 1, I */
+    { 0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384 },     /* 1, II */
+    { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 },      /* 1, III */
+    { 0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256 },     /* 2, I */
+    { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 },          /* 2, II & III */
+};
+
+static const guint32 mpeg_sample_rates[4][3] = {
+    { 11025, 12000, 8000 },     /* 2.5 */
+    { 0, 0, 0 },
+    { 22050, 24000, 16000 },    /* 2 */
+    { 44100, 48000, 32000 },    /* 1 */
+};
+
+static gboolean
+mpeg_parse_header (const guint8 *p, MpegHeader *header)
+{
+    guint layer_bits, bitrate_index, rate_index, table;
+    
+    if (p[0] != 0xff || (p[1] & 0xe0) != 0xe0) {
+        return FALSE;
+    }
+    
+    header->version = (p[1] >> 3) & 0x03;
+    layer_bits = (p[1] >> 1) & 0x03;
+    bitrate_index = p[2] >> 4;
+    rate_index = (p[2] >> 2) & 0x03;
+    if (header->version == 1 || layer_bits == 0 ||
+        bitrate_index == 0 || bitrate_index == 15 || rate_index == 3) {
+        return FALSE;
+    }
+    
+    header->layer = 4 - layer_bits;
+    if (header->version == 3) {
+        table = header->layer - 1;
+    } else {
+        table = header->layer == 1 ? 3 : 4;
+    }
+    header->bitrate = mpeg_bitrates[table][bitrate_index] * 1000;
+    header->sample_rate = mpeg_sample_rates[header->version][rate_index];
+    header->mono = (p[3] >> 6) == 3;
+    
+    if (header->layer == 1) {
+        header->samples = 384;
+        header->frame_length = (12 * header->bitrate / header->sample_rate + ((p[2] >> 1) & 1)) * 4;
+    } else {
+        header->samples = header->layer == 3 && header->version != 3 ? 576 : 1152;
+        header->frame_length = header->samples / 8 * header->bitrate / header->sample_rate +
+                               ((p[2] >> 1) & 1);
+    }
+    
+    return header->frame_length > 4;
+}
+
+/* Find the first frame after @offset.  A VBR file says how many frames
+ * it has in a Xing or VBRI header inside that frame; otherwise it is
+ * constant bitrate and the size gives the length. */
+static gboolean
+probe_mpeg (MediaReader *reader, MediaInfo *info, goffset offset)
+{
+    const guint8 *p;
+    gsize length, i, side;
+    MpegHeader header, next;
+    guint64 frames = 0, bytes = 0;
+    
+    if (offset >= reader->size) {
+        return FALSE;
+    }
+    length = MIN (reader->size - offset, MEDIA_WINDOW_SIZE);
+    if (length < 4 || !(p = media_peek (reader, offset, length))) {
+        return FALSE;
+    }
+    
+    for (i = 0; i + 4 <= length; i++) {
+        if (!mpeg_parse_header (p + i, &header)) {
+            continue;
+        }
+        
+        /* Sync patterns turn up by chance; a real frame is followed by
+         * another like it */
+        if (i + header.frame_length + 4 <= length &&
+            (!mpeg_parse_header (p + i + header.frame_length, &next) ||
+             next.version != header.version || next.layer != header.layer ||
+             next.sample_rate != header.sample_rate)) {
+            continue;
+        }
+        break;
+    }
+    if (i + 4 > length) {
+        return FALSE;
+    }
+    
+    if (header.version == 3) {
+        side = header.mono ? 17 : 32;
+    } else {
+        side = header.mono ? 9 : 17;
+    }
+    
+    if (i + 4 + side + 16 <= length &&
+        (memcmp (p + i + 4 + side, "Xing", 4) == 0 ||
+         memcmp (p + i + 4 + side, "Info", 4) == 0)) {
+        const guint8 *xing = p + i + 4 + side;
+        guint32 xing_flags = be32 (xing + 4);
+        gsize field = 8;
+        
+        if (xing_flags & 0x01) {
+            frames = be32 (xing + field);
+            field += 4;
+        }
+        if ((xing_flags & 0x02) && i + 4 + side + field + 4 <= length) {
+            bytes = be32 (xing + field);
+        }
+    } else if (i + 36 + 18 <= length && memcmp (p + i + 36, "VBRI", 4) == 0) {
+        bytes = be32 (p + i + 36 + 10);
+        frames = be32 (p + i + 36 + 14);
+    }
+    
+    if (frames > 0) {
+        info->duration = (gdouble)frames * header.samples / header.sample_rate;
+        if (bytes > 0) {
+            info->bitrate = bytes * 8 / info->duration;
+        }
+    } else {
+        info->bitrate = header.bitrate;
+        if (info->duration == 0) {
+            info->duration = (gdouble)(reader->size - offset - i) * 8 / header.bitrate;
+        }
+    }
+    
+    if (!info->audio_codec) {
+        info->audio_codec = g_strdup_printf ("MP%u", header.layer);
+    }
+    
+    return TRUE;
+}
+
+/* === FLAC and Ogg === */
+
+static void
+vorbis_take_comment (const gchar *comment, gsize length, MediaInfo *info)
+{
+    const gchar *equals = memchr (comment, '=', length);
+    gsize key_length;
+    gchar **field;
+    
+    if (!equals) {
+        return;
+    }
+    key_length = equals - comment;
+    
+    if (key_length == 5 && g_ascii_strncasecmp (comment, "TITLE", 5) == 0) {
+        field = &info->title;
+    } else if (key_length == 6 && g_ascii_strncasecmp (comment, "ARTIST", 6) == 0) {
+        field = &info->artist;
+    } else if (key_length == 5 && g_ascii_strncasecmp (comment, "ALBUM", 5) == 0) {
+        field = &info->album;
+    } else {
+        return;
+    }
+    
+    if (!*field && g_utf8_validate (equals + 1, length - key_length - 1, NULL)) {
+        media_take_string (field, g_strndup (equals + 1, length - key_length - 1));
+    }
+}
+
+/* A Vorbis comment list, as FLAC, Vorbis and Opus all store tags.
+ * Little-endian lengths; a list cut short is read as far as it goes. */
+static void
+vorbis_read_comments (const guint8 *data, gsize length, MediaInfo *info)
+{
+    guint32 vendor_length, count, i;
+    gsize position;
+    
+    if (length < 4) {
+        return;
+    }
+    vendor_length = le32 (data);
+    if (vendor_length > length - 4 || length - 4 - vendor_length < 4) {
+        return;
+    }
+    position = 4 + vendor_length;
+    count = le32 (data + position);
+    position += 4;
+    
+    for (i = 0; i < count && length - position >= 4; i++) {
+        guint32 entry_length = le32 (data + position);
+        
+        position += 4;
+        if (entry_length > length - position) {
+            break;
+        }
+        vorbis_take_comment ((const gchar *)data + position, entry_length, info);
+        position += entry_length;
+    }
+}
+
+/* Total samples and sample rate from a STREAMINFO block */
+static void
+flac_read_streaminfo (const guint8 *p, MediaInfo *info)
+{
+    guint32 sample_rate = ((guint32)p[10] << 12) | (p[11] << 4) | (p[12] >> 4);
+    guint64 samples = ((guint64)(p[13] & 0x0f) << 32) | be32 (p + 14);
+    
+    if (sample_rate > 0 && samples > 0) {
+        info->duration = (gdouble)samples / sample_rate;
+    }
+}
+
+/* Walk the metadata blocks after the "fLaC" marker at @offset, reading
+ * STREAMINFO and VORBIS_COMMENT and skipping pictures and the rest */
+static gboolean
+probe_flac (MediaReader *reader, MediaInfo *info, goffset offset)
+{
+    const guint8 *p;
+    guint n;
+    
+    if (!(p = media_peek (reader, offset, 4)) || memcmp (p, "fLaC", 4) != 0) {
+        return FALSE;
+    }
+    offset += 4;
+    
+    for (n = 0; n < FLAC_MAX_BLOCKS && (p = media_peek (reader, offset, 4)); n++) {
+        gboolean last = p[0] & 0x80;
+        guint type = p[0] & 0x7f;
+        guint32 length = be24 (p + 1);
+        goffset data = offset + 4;
+        
+        if (type == 0 && length >= 18 && (p = media_peek (reader, data, 18))) {
+            flac_read_streaminfo (p, info);
+        } else if (type == 4 && length > 0) {
+            gsize available = MIN (length, MIN (MEDIA_WINDOW_SIZE, reader->size - data));
+            
+            if ((p = media_peek (reader, data, available))) {
+                vorbis_read_comments (p, available, info);
+            }
+        }
+        
+        if (last) {
+            break;
+        }
+        offset = data + length;
+    }
+    
+    if (!info->audio_codec) {
+        info->audio_codec = g_strdup ("FLAC");
+    }
+    
+    return TRUE;
+}
+
+typedef enum {
+    OGG_UNKNOWN,
+    OGG_VORBIS,
+    OGG_OPUS,
+    OGG_FLAC
+} OggCodec;
+
+typedef struct {
+    OggCodec codec;
+    guint32 sample_rate;
+    guint16 pre_skip;
+} OggStream;
+
+/* The first two packets of a stream are its identification and its
+ * comments, in the same order for every codec */
+static void
+ogg_read_packet (const guint8 *p, gsize length, guint index,
+                 OggStream *stream, MediaInfo *info)
+{
+    if (index == 0) {
+        if (length >= 30 && memcmp (p, "\001vorbis", 7) == 0) {
+            gint32 nominal = (gint32)le32 (p + 20);
+            
+            stream->codec = OGG_VORBIS;
+            stream->sample_rate = le32 (p + 12);
+            if (nominal > 0) {
+                info->bitrate = nominal;
+            }
+        } else if (length >= 19 && memcmp (p, "OpusHead", 8) == 0) {
+            /* Opus positions always count 48 kHz samples */
+            stream->codec = OGG_OPUS;
+            stream->sample_rate = 48000;
+            stream->pre_skip = le16 (p + 10);
+        } else if (length >= 13 + 4 + 18 && memcmp (p, "\177FLAC", 5) == 0) {
+            stream->codec = OGG_FLAC;
+            flac_read_streaminfo (p + 13 + 4, info);
+            stream->sample_rate = ((guint32)p[27] << 12) | (p[28] << 4) | (p[29] >> 4);
+        }
+        return;
+    }
+    
+    switch (stream->codec) {
+        case OGG_VORBIS:
+            if (length > 7 && memcmp (p, "\003vorbis", 7) == 0) {
+                vorbis_read_comments (p + 7, length - 7, info);
+            }
+            break;
+        case OGG_OPUS:
+            if (length > 8 && memcmp (p, "OpusTags", 8) == 0) {
+                vorbis_read_comments (p + 8, length - 8, info);
+            }
+            break;
+        case OGG_FLAC:
+            if (length > 4 && (p[0] & 0x7f) == 4) {
+                vorbis_read_comments (p + 4, length - 4, info);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/* The whole page at @offset, which always fits in the window */
+static const guint8*
+ogg_peek_page (MediaReader *reader, goffset offset, gsize *page_length)
+{
+    const guint8 *p;
+    guint n_segments, i;
+    gsize body_length = 0;
+    
+    if (!(p = media_peek (reader, offset, 27)) || memcmp (p, "OggS", 4) != 0) {
+        return NULL;
+    }
+    n_segments = p[26];
+    if (!(p = media_peek (reader, offset, 27 + n_segments))) {
+        return NULL;
+    }
+    for (i = 0; i < n_segments; i++) {
+        body_length += p[27 + i];
+    }
+    
+    *page_length = 27 + n_segments + body_length;
+    return media_peek (reader, offset, *page_length);
+}
+
+/* Assemble the first two packets of the first logical stream from its
+ * opening pages.  The last page's granule position then gives the
+ * length, and only the tail of the file is read to find it. */
+static gboolean
+probe_ogg (MediaReader *reader, MediaInfo *info)
+{
+    OggStream stream = { 0 };
+    GByteArray *packet;
+    const guint8 *p;
+    goffset offset = 0;
+    gsize page_length, tail;
+    guint32 serial = 0;
+    guint n_pages, n_packets = 0;
+    
+    packet = g_byte_array_new ();
+    
+    for (n_pages = 0; n_pages < OGG_MAX_PAGES && n_packets < 2 &&
+         (p = ogg_peek_page (reader, offset, &page_length)); n_pages++) {
+        const guint8 *body = p + 27 + p[26];
+        guint segment;
+        
+        offset += page_length;
+        if (n_pages == 0) {
+            serial = le32 (p + 14);
+        } else if (le32 (p + 14) != serial) {
+            /* A page of another multiplexed stream */
+            continue;
+        }
+        
+        for (segment = 0; segment < p[26] && n_packets < 2; segment++) {
+            guint lacing = p[27 + segment];
+            
+            if (packet->len + lacing <= OGG_MAX_PACKET) {
+                g_byte_array_append (packet, body, lacing);
+            }
+            body += lacing;
+            
+            /* A lacing value under 255 ends the packet */
+            if (lacing < 255) {
+                ogg_read_packet (packet->data, packet->len, n_packets, &stream, info);
+                g_byte_array_set_size (packet, 0);
+                n_packets++;
+                if (stream.codec == OGG_UNKNOWN) {
+                    break;
+                }
+            }
+        }
+        
+        if (stream.codec == OGG_UNKNOWN && n_packets > 0) {
+            break;
+        }
+    }
+    
+    g_byte_array_unref (packet);
+    
+    if (stream.codec == OGG_UNKNOWN) {
+        return FALSE;
+    }
+    
+    tail = MIN (reader->size, MEDIA_WINDOW_SIZE);
+    if (stream.sample_rate > 0 && tail >= 27 &&
+        (p = media_peek (reader, reader->size - tail, tail))) {
+        gssize i;
+        
+        for (i = tail - 27; i >= 0; i--) {
+            guint64 granule;
+            
+            if (memcmp (p + i, "OggS", 4) != 0 || le32 (p + i + 14) != serial) {
+                continue;
+            }
+            granule = le64 (p + i + 6);
+            if (granule == G_MAXUINT64) {
+                continue;
+            }
+            if (granule > stream.pre_skip) {
+                info->duration = (gdouble)(granule - stream.pre_skip) / stream.sample_rate;
+            }
+            break;
+        }
+    }
+    
+    if (!info->audio_codec) {
+        info->audio_codec = g_strdup (stream.codec == OGG_VORBIS ? "Vorbis" :
+                                      stream.codec == OGG_OPUS ? "Opus" : "FLAC");
+    }
+    
+    return TRUE;
+}
+
+/* === Public API === */
+
+static void
+media_info_apply (const MediaInfo *info, goffset size, FinderzUniversalMetadata *metadata)
+{
+    gint64 bitrate = info->bitrate;
+    
+    /* Rejects the NaN or absurd values a corrupt header can give */
+    if (info->duration > 0 && info->duration < 1e9) {
+        finderz_metadata_set_double (metadata, FINDERZ_FIELD_DURATION, info->duration);
+        
+        /* Without a stated rate, the average over the whole file */
+        if (bitrate <= 0 && info->duration >= 0.01) {
+            bitrate = size * 8 / info->duration;
+        }
+    }
+    
+    if (bitrate > 0) {
+        finderz_metadata_set_int (metadata, FINDERZ_FIELD_BITRATE, (bitrate + 500) / 1000);
+    }
+    
+    if (info->video_codec && info->audio_codec) {
+        gchar *codec = g_strdup_printf ("%s, %s", info->video_codec, info->audio_codec);
+        
+        finderz_metadata_set_string (metadata, FINDERZ_FIELD_CODEC, codec);
+        g_free (codec);
+    } else if (info->video_codec || info->audio_codec) {
+        finderz_metadata_set_string (metadata, FINDERZ_FIELD_CODEC,
+                                     info->video_codec ? info->video_codec : info->audio_codec);
+    }
+    
+    if (info->width > 0 && info->height > 0) {
+        gchar *dimensions = g_strdup_printf ("%ux%u", info->width, info->height);
+        
+        finderz_metadata_set_string (metadata, FINDERZ_FIELD_DIMENSIONS, dimensions);
+        finderz_metadata_set_double (metadata, FINDERZ_FIELD_ASPECT_RATIO,
+                                     (gdouble)info->width / info->height);
+        g_free (dimensions);
+    }
+    
+    if (info->title) {
+        finderz_metadata_set_string (metadata, FINDERZ_FIELD_MEDIA_TITLE, info->title);
+    }
+    if (info->artist) {
+        finderz_metadata_set_string (metadata, FINDERZ_FIELD_MEDIA_ARTIST, info->artist);
+    }
+    if (info->album) {
+        finderz_metadata_set_string (metadata, FINDERZ_FIELD_MEDIA_ALBUM, info->album);
+    }
+}
+
+gboolean
+finderz_media_probe_supports (const gchar *file_path)
+{
+    const gchar *dot;
+    gsize i;
+    
+    if (!file_path || !(dot = strrchr (file_path, '.'))) {
+        return FALSE;
+    }
+    
+    for (i = 0; i < G_N_ELEMENTS (media_extensions); i++) {
+        if (g_ascii_strcasecmp (dot + 1, media_extensions[i]) == 0) {
+            return TRUE;
+        }
+    }
+    
+    return FALSE;
+}
+
+gboolean
+finderz_media_probe (const gchar *file_path, FinderzUniversalMetadata *metadata)
+{
+    MediaReader reader;
+    MediaInfo info = { 0 };
+    const guint8 *p;
+    guint8 head[12];
+    gboolean found = FALSE;
+    
+    if (!file_path || !metadata || !media_reader_open (&reader, file_path)) {
+        return FALSE;
+    }
+    
+    if (!(p = media_peek (&reader, 0, sizeof (head)))) {
+        media_reader_close (&reader);
+        return FALSE;
+    }
+    memcpy (head, p, sizeof (head));
+    
+    /* Sniff the container rather than trust the extension */
+    if (memcmp (head, "ID3", 3) == 0) {
+        goffset audio_start = id3_read_tag (&reader, &info);
+        
+        found = probe_flac (&reader, &info, audio_start) ||
+                probe_mpeg (&reader, &info, audio_start) ||
+                audio_start > 0;
+    } else if (memcmp (head, "fLaC", 4) == 0) {
+        found = probe_flac (&reader, &info, 0);
+    } else if (memcmp (head, "OggS", 4) == 0) {
+        found = probe_ogg (&reader, &info);
+    } else if (be32 (head) == EBML_ID_HEADER) {
+        found = probe_matroska (&reader, &info);
+    } else if (memcmp (head + 4, "ftyp", 4) == 0 || memcmp (head + 4, "moov", 4) == 0 ||
+               memcmp (head + 4, "mdat", 4) == 0 || memcmp (head + 4, "wide", 4) == 0 ||
+               memcmp (head + 4, "free", 4) == 0 || memcmp (head + 4, "skip", 4) == 0 ||
+               memcmp (head + 4, "pnot", 4) == 0) {
+        found = probe_mp4 (&reader, &info);
+    } else if (g_str_has_suffix (file_path, ".mp3") || g_str_has_suffix (file_path, ".MP3")) {
+        /* MP3 without a tag starts straight with a frame */
+        found = probe_mpeg (&reader, &info, 0);
+    }
+    
+    if (found) {
+        media_info_apply (&info, reader.size, metadata);
+    } else {
+        g_debug ("FINDERZ: No media headers found in %s", file_path);
+    }
+    
+    g_free (info.video_codec);
+    g_free (info.audio_codec);
+    g_free (info.title);
+    g_free (info.artist);
+    g_free (info.album);
+    media_reader_close (&reader);
+    
+    return found;
+}
@@ -0,0 +1,27 @@
+/* finderz-media-probe.h
+ *
+ * Duration, codecs and tags from audio and video container headers
+ */
+
+#ifndef FINDERZ_MEDIA_PROBE_H
+#define FINDERZ_MEDIA_PROBE_H
+
+#include <glib.h>
+#include "finderz-universal-metadata.h"
+
+G_BEGIN_DECLS
+
+/* Whether @file_path's extension names a container the prober reads */
+gboolean finderz_media_probe_supports (const gchar *file_path);
+
+/* Add the duration, bitrate, codecs, dimensions and tags found in the
+ * headers of the MP4/QuickTime, Matroska/WebM, MP3, FLAC or Ogg file
+ * at @file_path to @metadata.  No sample data is decoded and a bounded
+ * number of small reads is made however large the file is.  Returns
+ * FALSE if the file is not in a container we know. */
+gboolean finderz_media_probe (const gchar *file_path,
+                              FinderzUniversalMetadata *metadata);
+
+G_END_DECLS
+
+#endif /* FINDERZ_MEDIA_PROBE_H */
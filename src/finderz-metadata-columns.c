@@ -8,6 +8,8 @@
 #include <libnemo-extension/nemo-column-provider.h>
 #include <glib/gi18n.h>
 #include "finderz-universal-metadata.h"
+#include "finderz-field-census.h"
+#include "finderz-file-attributes.h"
 
 typedef struct {
     GObject parent_instance;
@@ -257,16 +259,73 @@ get_standard_metadata_columns (void)
     return columns;
 }
 
+/* A column for a field without a standard one, named by its schema key */
+static NemoColumn *
+new_field_column (const FinderzFieldDescriptor *field)
+{
+    gboolean numeric = field->type == FINDERZ_FIELD_TYPE_INTEGER ||
+                       field->type == FINDERZ_FIELD_TYPE_REAL ||
+                       field->type == FINDERZ_FIELD_TYPE_DURATION;
+    
+    return g_object_new (NEMO_TYPE_COLUMN,
+                         "name", field->key,
+                         "attribute", field->key,
+                         "label", field->display_name,
+                         "description", field->category,
+                         "xalign", numeric ? 1.0 : 0.0,
+                         NULL);
+}
+
 static GList *
-finderz_metadata_column_provider_get_columns (NemoColumnProvider *provider)
+finderz_metadata_column_provider_get_columns (NemoColumnProvider *column_provider)
 {
-    GList *columns = NULL;
+    FinderzMetadataColumnProvider *provider = (FinderzMetadataColumnProvider *)column_provider;
+    GHashTable *standard;
+    GList *columns, *fields, *l;
     
     /* Get standard columns */
     columns = get_standard_metadata_columns ();
     
-    /* TODO: Add dynamically discovered columns from 
-     * FinderzMetadataColumnProvider->discovered_fields */
+    /* Until files have been extracted there is nothing to go on */
+    if (finderz_field_census_is_empty ()) {
+        return columns;
+    }
+    
+    /* Fields seen so far, kept once seen so columns don't come and go */
+    fields = finderz_field_census_get_fields (NULL);
+    for (l = fields; l; l = l->next) {
+        const FinderzFieldDescriptor *field;
+        
+        field = finderz_metadata_schema_get (GPOINTER_TO_UINT (l->data));
+        if (field && finderz_is_metadata_attribute (field->key) &&
+            !g_hash_table_contains (provider->discovered_fields, field->key)) {
+            g_hash_table_add (provider->discovered_fields, g_strdup (field->key));
+        }
+    }
+    
+    /* Standard columns are always offered, whatever has been seen, so
+     * the columns a view was set up with stay valid */
+    standard = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    for (l = columns; l; l = l->next) {
+        gchar *attribute;
+        
+        g_object_get (l->data, "attribute", &attribute, NULL);
+        g_hash_table_add (standard, attribute);
+    }
+    
+    /* Then the other fields found, the most common first */
+    for (l = fields; l; l = l->next) {
+        const FinderzFieldDescriptor *field;
+        
+        field = finderz_metadata_schema_get (GPOINTER_TO_UINT (l->data));
+        if (field && g_hash_table_contains (provider->discovered_fields, field->key) &&
+            !g_hash_table_contains (standard, field->key)) {
+            columns = g_list_append (columns, new_field_column (field));
+        }
+    }
+    
+    g_hash_table_destroy (standard);
+    g_list_free (fields);
     
     return columns;
 }
@@ -312,35 +371,6 @@ finderz_format_metadata_for_column (const gchar *attribute,
         return g_strdup ("");
     }
     
-    FinderzMetadataField *field = finderz_get_metadata_field (metadata, attribute);
-    if (!field) {
-        return g_strdup ("");
-    }
-    
-    /* Special formatting for certain types */
-    if (g_strcmp0 (attribute, "rating") == 0) {
-        gint rating = (gint)field->numeric_value;
-        if (rating > 0) {
-            GString *stars = g_string_new ("");
-            for (int i = 0; i < rating; i++) {
-                g_string_append (stars, "★");
-            }
-            for (int i = rating; i < 5; i++) {
-                g_string_append (stars, "☆");
-            }
-            return g_string_free (stars, FALSE);
-        }
-    }
-    else if (g_strcmp0 (attribute, "has_xmp") == 0 || 
-             g_strcmp0 (attribute, "has_sidecar") == 0) {
-        return g_strdup (field->value ? "✓" : "");
-    }
-    else if (field->date_value) {
-        return g_date_time_format (field->date_value, "%Y-%m-%d %H:%M");
-    }
-    else if (field->numeric && field->numeric_value != 0) {
-        return g_strdup_printf ("%.2f", field->numeric_value);
-    }
-    
-    return g_strdup (field->value ? field->value : "");
+    /* Stars, check marks and dates follow the field's schema type */
+    return finderz_format_metadata_value (finderz_get_metadata_field (metadata, attribute));
 }
\ No newline at end of file
@@ -0,0 +1,1111 @@
+/* finderz-metadata-index.c
+ *
+ * Persistent on-disk index of extracted metadata
+ *
+ * Each directory gets two files under $XDG_CACHE_HOME/finderz/index,
+ * named after a hash of the directory path:
+ *
+ *   .idx  an immutable segment, memory-mapped and read in place.  The
+ *         layout is columnar: one array per key part, sorted by inode
+ *         for binary search, then arrays of values and a string pool.
+ *   .log  records extracted since the segment was written, appended
+ *         as checksummed frames.  A frame torn by a crash fails its
+ *         checksum and is cut off when the log is next read.
+ *
+ * Once the log holds as many records as the segment, both are merged
+ * into a new segment that replaces the old one atomically, so the
+ * total work stays linear in the number of files.
+ */
+
+#include "finderz-metadata-index.h"
+#include <glib/gstdio.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string.h>
+
+#define INDEX_MAGIC "FZIX"
+#define INDEX_VERSION 1
+#define LOG_FRAME_MAGIC 0x464c5a46
+
+/* Directories whose segments stay mapped */
+#define INDEX_MAX_SEGMENTS 16
+/* Smallest log worth merging into the segment */
+#define INDEX_COMPACT_MIN_RECORDS 256
+
+typedef struct {
+    gchar magic[4];
+    guint32 version;
+    guint32 n_records;
+    guint32 n_fields;
+    guint32 n_values;
+    guint32 strings_size;
+    guint32 directory;   /* string pool offset of the directory path */
+    guint32 reserved;
+} IndexHeader;
+
+typedef struct {
+    guint32 key;
+    guint32 display_name;
+    guint32 category;
+    guint16 type;
+    guint16 source;
+} IndexField;
+
+/* Section offsets; every section starts 8-byte aligned */
+typedef struct {
+    guint64 fields;
+    guint64 inodes;
+    guint64 devices;
+    guint64 mtimes;
+    guint64 ctimes;
+    guint64 sizes;
+    guint64 first_values;
+    guint64 value_counts;
+    guint64 value_fields;
+    guint64 value_types;
+    guint64 value_data;
+    guint64 strings;
+    guint64 total;
+} IndexOffsets;
+
+/* Pointers into a mapped segment */
+typedef struct {
+    const IndexHeader *header;
+    const IndexField *fields;
+    const guint64 *inodes;
+    const guint64 *devices;
+    const gint64 *mtimes;
+    const gint64 *ctimes;
+    const gint64 *sizes;
+    const guint32 *first_values;
+    const guint32 *value_counts;
+    const guint32 *value_fields;
+    const guint32 *value_types;
+    const guint64 *value_data;
+    const gchar *strings;
+} IndexLayout;
+
+typedef struct {
+    FinderzFileKey key;
+    FinderzUniversalMetadata *metadata;
+} IndexEntry;
+
+typedef struct {
+    gchar *directory;
+    gchar *segment_path;
+    gchar *log_path;
+    GMutex mutex;
+    gboolean loaded;
+    GMappedFile *mapped;          /* NULL when there is no segment yet */
+    IndexLayout layout;
+    FinderzFieldId *field_ids;    /* segment field -> schema id */
+    GHashTable *overlay;          /* inode -> IndexEntry, from the log */
+    guint n_logged;
+    gint log_fd;
+    gint ref_count;               /* protected by segments_mutex */
+    GList *lru_link;
+} IndexSegment;
+
+static gchar *index_dir = NULL;
+static GHashTable *segments = NULL;   /* directory -> IndexSegment */
+static GQueue segment_lru = G_QUEUE_INIT;
+static GMutex segments_mutex;
+
+static void
+index_entry_free (IndexEntry *entry)
+{
+    finderz_universal_metadata_unref (entry->metadata);
+    g_free (entry);
+}
+
+static gboolean
+file_key_equal (const FinderzFileKey *a, const FinderzFileKey *b)
+{
+    return a->device == b->device &&
+           a->inode == b->inode &&
+           a->mtime_nsec == b->mtime_nsec &&
+           a->ctime_nsec == b->ctime_nsec &&
+           a->size == b->size;
+}
+
+static gint
+index_entry_compare (gconstpointer a, gconstpointer b)
+{
+    const FinderzFileKey *key1 = &(*(IndexEntry **)a)->key;
+    const FinderzFileKey *key2 = &(*(IndexEntry **)b)->key;
+
+    if (key1->inode != key2->inode) {
+        return key1->inode < key2->inode ? -1 : 1;
+    }
+    return (key1->device > key2->device) - (key1->device < key2->device);
+}
+
+void
+finderz_metadata_index_init (void)
+{
+    gchar *path;
+
+    if (index_dir) {
+        return;
+    }
+
+    path = g_build_filename (g_get_user_cache_dir (), "finderz", "index", NULL);
+    if (g_mkdir_with_parents (path, 0700) != 0) {
+        g_debug ("FINDERZ: Metadata index disabled, cannot create %s", path);
+        g_free (path);
+        return;
+    }
+
+    segments = g_hash_table_new (g_str_hash, g_str_equal);
+    index_dir = path;
+}
+
+gboolean
+finderz_metadata_index_stat (const gchar *path, FinderzFileKey *key)
+{
+    return finderz_metadata_index_stat_at (AT_FDCWD, path, key);
+}
+
+gboolean
+finderz_metadata_index_stat_at (int dir_fd, const gchar *name, FinderzFileKey *key)
+{
+    struct stat st;
+
+    if (fstatat (dir_fd, name, &st, 0) != 0 || !S_ISREG (st.st_mode)) {
+        return FALSE;
+    }
+
+    key->device = st.st_dev;
+    key->inode = st.st_ino;
+    key->mtime_nsec = (gint64)st.st_mtim.tv_sec * G_GINT64_CONSTANT (1000000000) +
+                      st.st_mtim.tv_nsec;
+    key->ctime_nsec = (gint64)st.st_ctim.tv_sec * G_GINT64_CONSTANT (1000000000) +
+                      st.st_ctim.tv_nsec;
+    key->size = st.st_size;
+
+    return TRUE;
+}
+
+/* Segment layout */
+
+static void
+compute_offsets (guint64 n_records,
+                 guint64 n_fields,
+                 guint64 n_values,
+                 guint64 strings_size,
+                 IndexOffsets *offsets)
+{
+    offsets->fields = sizeof (IndexHeader);
+    offsets->inodes = offsets->fields + n_fields * sizeof (IndexField);
+    offsets->devices = offsets->inodes + n_records * sizeof (guint64);
+    offsets->mtimes = offsets->devices + n_records * sizeof (guint64);
+    offsets->ctimes = offsets->mtimes + n_records * sizeof (gint64);
+    offsets->sizes = offsets->ctimes + n_records * sizeof (gint64);
+    offsets->first_values = offsets->sizes + n_records * sizeof (gint64);
+    offsets->value_counts = offsets->first_values + n_records * sizeof (guint32);
+    offsets->value_fields = offsets->value_counts + n_records * sizeof (guint32);
+    offsets->value_types = offsets->value_fields + n_values * sizeof (guint32);
+    offsets->value_data = offsets->value_types + n_values * sizeof (guint32);
+    offsets->strings = offsets->value_data + n_values * sizeof (guint64);
+    offsets->total = offsets->strings + strings_size;
+}
+
+/* Check everything a lookup will rely on, so reads need no checks */
+static gboolean
+validate_segment (const IndexLayout *layout, guint n_records)
+{
+    const IndexHeader *header = layout->header;
+    guint i;
+
+    if (header->strings_size == 0 ||
+        layout->strings[header->strings_size - 1] != '\0' ||
+        header->directory >= header->strings_size) {
+        return FALSE;
+    }
+
+    for (i = 0; i < header->n_fields; i++) {
+        if (layout->fields[i].key >= header->strings_size ||
+            layout->fields[i].display_name >= header->strings_size ||
+            layout->fields[i].category >= header->strings_size ||
+            layout->strings[layout->fields[i].key] == '\0') {
+            return FALSE;
+        }
+    }
+
+    for (i = 0; i < n_records; i++) {
+        if ((guint64)layout->first_values[i] + layout->value_counts[i] > header->n_values ||
+            (i > 0 && layout->inodes[i] < layout->inodes[i - 1])) {
+            return FALSE;
+        }
+    }
+
+    for (i = 0; i < header->n_values; i++) {
+        if (layout->value_fields[i] >= header->n_fields ||
+            layout->value_types[i] > FINDERZ_VALUE_DATE ||
+            (layout->value_types[i] == FINDERZ_VALUE_STRING &&
+             layout->value_data[i] >= header->strings_size)) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/* Called with the segment mutex held */
+static void
+segment_unmap (IndexSegment *segment)
+{
+    g_clear_pointer (&segment->mapped, g_mapped_file_unref);
+    g_clear_pointer (&segment->field_ids, g_free);
+    memset (&segment->layout, 0, sizeof (IndexLayout));
+}
+
+static gboolean
+segment_map (IndexSegment *segment)
+{
+    const IndexHeader *header;
+    IndexOffsets offsets;
+    IndexLayout *layout = &segment->layout;
+    const guint8 *data;
+    gsize length;
+    guint i;
+
+    segment->mapped = g_mapped_file_new (segment->segment_path, FALSE, NULL);
+    if (!segment->mapped) {
+        return FALSE;
+    }
+
+    data = (const guint8 *)g_mapped_file_get_contents (segment->mapped);
+    length = g_mapped_file_get_length (segment->mapped);
+    header = (const IndexHeader *)data;
+
+    if (length < sizeof (IndexHeader) ||
+        memcmp (header->magic, INDEX_MAGIC, 4) != 0 ||
+        header->version != INDEX_VERSION) {
+        goto invalid;
+    }
+
+    compute_offsets (header->n_records, header->n_fields,
+                     header->n_values, header->strings_size, &offsets);
+    if (offsets.total > length) {
+        goto invalid;
+    }
+
+    layout->header = header;
+    layout->fields = (const IndexField *)(data + offsets.fields);
+    layout->inodes = (const guint64 *)(data + offsets.inodes);
+    layout->devices = (const guint64 *)(data + offsets.devices);
+    layout->mtimes = (const gint64 *)(data + offsets.mtimes);
+    layout->ctimes = (const gint64 *)(data + offsets.ctimes);
+    layout->sizes = (const gint64 *)(data + offsets.sizes);
+    layout->first_values = (const guint32 *)(data + offsets.first_values);
+    layout->value_counts = (const guint32 *)(data + offsets.value_counts);
+    layout->value_fields = (const guint32 *)(data + offsets.value_fields);
+    layout->value_types = (const guint32 *)(data + offsets.value_types);
+    layout->value_data = (const guint64 *)(data + offsets.value_data);
+    layout->strings = (const gchar *)(data + offsets.strings);
+
+    if (!validate_segment (layout, header->n_records) ||
+        strcmp (layout->strings + header->directory, segment->directory) != 0) {
+        goto invalid;
+    }
+
+    /* Field ids are per process, so the segment stores names */
+    segment->field_ids = g_new (FinderzFieldId, MAX (header->n_fields, 1));
+    for (i = 0; i < header->n_fields; i++) {
+        const IndexField *field = &layout->fields[i];
+
+        segment->field_ids[i] =
+            finderz_metadata_schema_register (layout->strings + field->key,
+                                              layout->strings + field->display_name,
+                                              layout->strings + field->category,
+                                              field->type, field->source);
+    }
+
+    return TRUE;
+
+invalid:
+    g_debug ("FINDERZ: Ignoring damaged metadata index %s", segment->segment_path);
+    segment_unmap (segment);
+    return FALSE;
+}
+
+static guint
+segment_n_records (IndexSegment *segment)
+{
+    return segment->mapped ? segment->layout.header->n_records : 0;
+}
+
+/* Index of the segment record for @key's inode and device, or -1 */
+static gint
+segment_find (IndexSegment *segment, const FinderzFileKey *key)
+{
+    const IndexLayout *layout = &segment->layout;
+    guint low = 0;
+    guint high = segment_n_records (segment);
+
+    while (low < high) {
+        guint middle = low + (high - low) / 2;
+
+        if (layout->inodes[middle] < key->inode) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    for (; low < segment_n_records (segment) && layout->inodes[low] == key->inode; low++) {
+        if (layout->devices[low] == key->device) {
+            return low;
+        }
+    }
+
+    return -1;
+}
+
+static void
+segment_get_key (IndexSegment *segment, guint record, FinderzFileKey *key)
+{
+    const IndexLayout *layout = &segment->layout;
+
+    key->device = layout->devices[record];
+    key->inode = layout->inodes[record];
+    key->mtime_nsec = layout->mtimes[record];
+    key->ctime_nsec = layout->ctimes[record];
+    key->size = layout->sizes[record];
+}
+
+static FinderzUniversalMetadata*
+segment_read_record (IndexSegment *segment, guint record, const gchar *path)
+{
+    const IndexLayout *layout = &segment->layout;
+    FinderzUniversalMetadata *metadata;
+    guint i, end;
+
+    metadata = finderz_universal_metadata_new (path);
+
+    end = layout->first_values[record] + layout->value_counts[record];
+    for (i = layout->first_values[record]; i < end; i++) {
+        FinderzFieldId field_id = segment->field_ids[layout->value_fields[i]];
+        guint64 data = layout->value_data[i];
+        gdouble number;
+
+        switch (layout->value_types[i]) {
+            case FINDERZ_VALUE_STRING:
+                finderz_metadata_set_string (metadata, field_id, layout->strings + data);
+                break;
+            case FINDERZ_VALUE_INT64:
+                finderz_metadata_set_int (metadata, field_id, (gint64)data);
+                break;
+            case FINDERZ_VALUE_DOUBLE:
+                memcpy (&number, &data, sizeof (number));
+                finderz_metadata_set_double (metadata, field_id, number);
+                break;
+            case FINDERZ_VALUE_DATE:
+                finderz_metadata_set_date_usec (metadata, field_id, (gint64)data);
+                break;
+        }
+    }
+
+    finderz_universal_metadata_freeze (metadata);
+    return metadata;
+}
+
+static FinderzUniversalMetadata*
+copy_record (FinderzUniversalMetadata *source, const gchar *path)
+{
+    FinderzUniversalMetadata *metadata;
+    guint i;
+
+    metadata = finderz_universal_metadata_new (path);
+
+    for (i = 0; i < source->n_values; i++) {
+        const FinderzMetadataValue *value = &source->values[i];
+
+        switch (value->type) {
+            case FINDERZ_VALUE_STRING:
+                finderz_metadata_set_string (metadata, value->field_id, value->string);
+                break;
+            case FINDERZ_VALUE_INT64:
+                finderz_metadata_set_int (metadata, value->field_id, value->data.v_int64);
+                break;
+            case FINDERZ_VALUE_DOUBLE:
+                finderz_metadata_set_double (metadata, value->field_id, value->data.v_double);
+                break;
+            case FINDERZ_VALUE_DATE:
+                finderz_metadata_set_date_usec (metadata, value->field_id, value->data.v_int64);
+                break;
+        }
+    }
+
+    finderz_universal_metadata_freeze (metadata);
+    return metadata;
+}
+
+/* Segment writing */
+
+typedef struct {
+    GString *pool;
+    GHashTable *offsets;          /* string -> offset + 1 */
+    GHashTable *field_indexes;    /* schema id -> segment field + 1 */
+    GArray *fields;               /* FinderzFieldId */
+} SegmentBuilder;
+
+static guint32
+builder_add_string (SegmentBuilder *builder, const gchar *string)
+{
+    gpointer offset;
+
+    if (g_hash_table_lookup_extended (builder->offsets, string, NULL, &offset)) {
+        return GPOINTER_TO_UINT (offset) - 1;
+    }
+
+    offset = GUINT_TO_POINTER (builder->pool->len + 1);
+    g_hash_table_insert (builder->offsets, g_strdup (string), offset);
+    g_string_append_len (builder->pool, string, strlen (string) + 1);
+
+    return GPOINTER_TO_UINT (offset) - 1;
+}
+
+static guint32
+builder_add_field (SegmentBuilder *builder, FinderzFieldId field_id)
+{
+    gpointer index = g_hash_table_lookup (builder->field_indexes,
+                                          GUINT_TO_POINTER (field_id));
+
+    if (!index) {
+        g_array_append_val (builder->fields, field_id);
+        index = GUINT_TO_POINTER (builder->fields->len);
+        g_hash_table_insert (builder->field_indexes, GUINT_TO_POINTER (field_id), index);
+    }
+
+    return GPOINTER_TO_UINT (index) - 1;
+}
+
+/* Serialize @entries, sorted by inode and device, as a segment */
+static GBytes*
+encode_segment (const gchar *directory, GPtrArray *entries)
+{
+    SegmentBuilder builder;
+    IndexOffsets offsets;
+    IndexHeader *header;
+    guint8 *data;
+    guint64 *inodes, *devices, *value_data;
+    gint64 *mtimes, *ctimes, *sizes;
+    guint32 *first_values, *value_counts, *value_fields, *value_types;
+    IndexField *fields;
+    guint n_values = 0;
+    guint i, j, v;
+
+    builder.pool = g_string_new (NULL);
+    builder.offsets = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    builder.field_indexes = g_hash_table_new (NULL, NULL);
+    builder.fields = g_array_new (FALSE, FALSE, sizeof (FinderzFieldId));
+
+    /* Offset 0 is the empty string */
+    builder_add_string (&builder, "");
+    builder_add_string (&builder, directory);
+
+    for (i = 0; i < entries->len; i++) {
+        FinderzUniversalMetadata *metadata = ((IndexEntry *)entries->pdata[i])->metadata;
+
+        for (j = 0; j < metadata->n_values; j++) {
+            builder_add_field (&builder, metadata->values[j].field_id);
+            if (metadata->values[j].type == FINDERZ_VALUE_STRING) {
+                builder_add_string (&builder, metadata->values[j].string);
+            }
+        }
+        n_values += metadata->n_values;
+    }
+
+    for (i = 0; i < builder.fields->len; i++) {
+        const FinderzFieldDescriptor *descriptor;
+
+        descriptor = finderz_metadata_schema_get (g_array_index (builder.fields, FinderzFieldId, i));
+        builder_add_string (&builder, descriptor->key);
+        builder_add_string (&builder, descriptor->display_name);
+        builder_add_string (&builder, descriptor->category);
+    }
+
+    compute_offsets (entries->len, builder.fields->len, n_values,
+                     builder.pool->len, &offsets);
+    data = g_malloc0 (offsets.total);
+
+    header = (IndexHeader *)data;
+    memcpy (header->magic, INDEX_MAGIC, 4);
+    header->version = INDEX_VERSION;
+    header->n_records = entries->len;
+    header->n_fields = builder.fields->len;
+    header->n_values = n_values;
+    header->strings_size = builder.pool->len;
+    header->directory = builder_add_string (&builder, directory);
+
+    fields = (IndexField *)(data + offsets.fields);
+    for (i = 0; i < builder.fields->len; i++) {
+        const FinderzFieldDescriptor *descriptor;
+
+        descriptor = finderz_metadata_schema_get (g_array_index (builder.fields, FinderzFieldId, i));
+        fields[i].key = builder_add_string (&builder, descriptor->key);
+        fields[i].display_name = builder_add_string (&builder, descriptor->display_name);
+        fields[i].category = builder_add_string (&builder, descriptor->category);
+        fields[i].type = descriptor->type;
+        fields[i].source = descriptor->source;
+    }
+
+    inodes = (guint64 *)(data + offsets.inodes);
+    devices = (guint64 *)(data + offsets.devices);
+    mtimes = (gint64 *)(data + offsets.mtimes);
+    ctimes = (gint64 *)(data + offsets.ctimes);
+    sizes = (gint64 *)(data + offsets.sizes);
+    first_values = (guint32 *)(data + offsets.first_values);
+    value_counts = (guint32 *)(data + offsets.value_counts);
+    value_fields = (guint32 *)(data + offsets.value_fields);
+    value_types = (guint32 *)(data + offsets.value_types);
+    value_data = (guint64 *)(data + offsets.value_data);
+
+    v = 0;
+    for (i = 0; i < entries->len; i++) {
+        IndexEntry *entry = entries->pdata[i];
+        FinderzUniversalMetadata *metadata = entry->metadata;
+
+        inodes[i] = entry->key.inode;
+        devices[i] = entry->key.device;
+        mtimes[i] = entry->key.mtime_nsec;
+        ctimes[i] = entry->key.ctime_nsec;
+        sizes[i] = entry->key.size;
+        first_values[i] = v;
+        value_counts[i] = metadata->n_values;
+
+        for (j = 0; j < metadata->n_values; j++, v++) {
+            const FinderzMetadataValue *value = &metadata->values[j];
+
+            value_fields[v] = builder_add_field (&builder, value->field_id);
+            value_types[v] = value->type;
+            if (value->type == FINDERZ_VALUE_STRING) {
+                value_data[v] = builder_add_string (&builder, value->string);
+            } else {
+                memcpy (&value_data[v], &value->data, sizeof (guint64));
+            }
+        }
+    }
+
+    memcpy (data + offsets.strings, builder.pool->str, builder.pool->len);
+
+    g_string_free (builder.pool, TRUE);
+    g_hash_table_destroy (builder.offsets);
+    g_hash_table_destroy (builder.field_indexes);
+    g_array_free (builder.fields, TRUE);
+
+    return g_bytes_new_take (data, offsets.total);
+}
+
+/* Log frames */
+
+typedef struct {
+    guint32 magic;
+    guint32 length;
+    guint32 checksum;
+} LogFrameHeader;
+
+static guint32
+frame_checksum (const guint8 *data, gsize length)
+{
+    guint32 hash = 2166136261u;
+    gsize i;
+
+    for (i = 0; i < length; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
+static void
+put_u32 (GByteArray *out, guint32 value)
+{
+    g_byte_array_append (out, (const guint8 *)&value, sizeof (value));
+}
+
+static void
+put_u64 (GByteArray *out, guint64 value)
+{
+    g_byte_array_append (out, (const guint8 *)&value, sizeof (value));
+}
+
+/* Length, then the bytes and their terminating NUL */
+static void
+put_string (GByteArray *out, const gchar *string)
+{
+    guint32 length = strlen (string);
+
+    put_u32 (out, length);
+    g_byte_array_append (out, (const guint8 *)string, length + 1);
+}
+
+typedef struct {
+    const guint8 *data;
+    gsize remaining;
+} LogReader;
+
+static gboolean
+get_bytes (LogReader *reader, gpointer result, gsize length)
+{
+    if (reader->remaining < length) {
+        return FALSE;
+    }
+
+    memcpy (result, reader->data, length);
+    reader->data += length;
+    reader->remaining -= length;
+    return TRUE;
+}
+
+static const gchar*
+get_string (LogReader *reader)
+{
+    const gchar *string;
+    guint32 length;
+
+    if (!get_bytes (reader, &length, sizeof (length)) ||
+        reader->remaining <= length ||
+        reader->data[length] != '\0') {
+        return NULL;
+    }
+
+    string = (const gchar *)reader->data;
+    reader->data += length + 1;
+    reader->remaining -= length + 1;
+    return string;
+}
+
+/* Frame payload: the key, then each value with its field descriptor,
+ * so the log can be read without the segment */
+static GByteArray*
+encode_frame (const FinderzFileKey *key, FinderzUniversalMetadata *metadata)
+{
+    GByteArray *frame = g_byte_array_new ();
+    LogFrameHeader header = { LOG_FRAME_MAGIC, 0, 0 };
+    guint i;
+
+    g_byte_array_append (frame, (const guint8 *)&header, sizeof (header));
+
+    put_u64 (frame, key->device);
+    put_u64 (frame, key->inode);
+    put_u64 (frame, key->mtime_nsec);
+    put_u64 (frame, key->ctime_nsec);
+    put_u64 (frame, key->size);
+    put_u32 (frame, metadata->n_values);
+
+    for (i = 0; i < metadata->n_values; i++) {
+        const FinderzMetadataValue *value = &metadata->values[i];
+        const FinderzFieldDescriptor *descriptor = finderz_metadata_schema_get (value->field_id);
+
+        put_string (frame, descriptor->key);
+        put_string (frame, descriptor->display_name);
+        put_string (frame, descriptor->category);
+        put_u32 (frame, descriptor->type);
+        put_u32 (frame, descriptor->source);
+        put_u32 (frame, value->type);
+        if (value->type == FINDERZ_VALUE_STRING) {
+            put_string (frame, value->string);
+        } else {
+            put_u64 (frame, value->data.v_int64);
+        }
+    }
+
+    header.length = frame->len - sizeof (header);
+    header.checksum = frame_checksum (frame->data + sizeof (header), header.length);
+    memcpy (frame->data, &header, sizeof (header));
+
+    return frame;
+}
+
+static IndexEntry*
+decode_frame (LogReader *reader)
+{
+    IndexEntry *entry = g_new0 (IndexEntry, 1);
+    guint32 n_values, i;
+
+    entry->metadata = finderz_universal_metadata_new (NULL);
+
+    if (!get_bytes (reader, &entry->key.device, sizeof (guint64)) ||
+        !get_bytes (reader, &entry->key.inode, sizeof (guint64)) ||
+        !get_bytes (reader, &entry->key.mtime_nsec, sizeof (gint64)) ||
+        !get_bytes (reader, &entry->key.ctime_nsec, sizeof (gint64)) ||
+        !get_bytes (reader, &entry->key.size, sizeof (gint64)) ||
+        !get_bytes (reader, &n_values, sizeof (n_values))) {
+        goto invalid;
+    }
+
+    for (i = 0; i < n_values; i++) {
+        const gchar *key, *display_name, *category, *string;
+        guint32 field_type, source, value_type;
+        FinderzFieldId field_id;
+        guint64 data;
+        gdouble number;
+
+        key = get_string (reader);
+        display_name = get_string (reader);
+        category = get_string (reader);
+        if (!key || !*key || !display_name || !category ||
+            !get_bytes (reader, &field_type, sizeof (field_type)) ||
+            !get_bytes (reader, &source, sizeof (source)) ||
+            !get_bytes (reader, &value_type, sizeof (value_type))) {
+            goto invalid;
+        }
+
+        field_id = finderz_metadata_schema_register (key, display_name, category,
+                                                     field_type, source);
+
+        if (value_type == FINDERZ_VALUE_STRING) {
+            if (!(string = get_string (reader))) {
+                goto invalid;
+            }
+            finderz_metadata_set_string (entry->metadata, field_id, string);
+            continue;
+        }
+
+        if (!get_bytes (reader, &data, sizeof (data))) {
+            goto invalid;
+        }
+
+        switch (value_type) {
+            case FINDERZ_VALUE_INT64:
+                finderz_metadata_set_int (entry->metadata, field_id, (gint64)data);
+                break;
+            case FINDERZ_VALUE_DOUBLE:
+                memcpy (&number, &data, sizeof (number));
+                finderz_metadata_set_double (entry->metadata, field_id, number);
+                break;
+            case FINDERZ_VALUE_DATE:
+                finderz_metadata_set_date_usec (entry->metadata, field_id, (gint64)data);
+                break;
+            default:
+                goto invalid;
+        }
+    }
+
+    finderz_universal_metadata_freeze (entry->metadata);
+    return entry;
+
+invalid:
+    index_entry_free (entry);
+    return NULL;
+}
+
+/* Called with the segment mutex held; the overlay keeps the newest
+ * record for each inode */
+static void
+overlay_insert (IndexSegment *segment, IndexEntry *entry)
+{
+    g_hash_table_replace (segment->overlay, &entry->key.inode, entry);
+}
+
+/* Read the log into the overlay, cutting off a torn tail so later
+ * appends stay readable */
+static void
+segment_replay_log (IndexSegment *segment)
+{
+    gchar *contents;
+    gsize length, offset = 0;
+
+    if (!g_file_get_contents (segment->log_path, &contents, &length, NULL)) {
+        return;
+    }
+
+    while (length - offset >= sizeof (LogFrameHeader)) {
+        LogFrameHeader header;
+        LogReader reader;
+        IndexEntry *entry;
+
+        memcpy (&header, contents + offset, sizeof (header));
+        if (header.magic != LOG_FRAME_MAGIC ||
+            header.length > length - offset - sizeof (header) ||
+            frame_checksum ((const guint8 *)contents + offset + sizeof (header),
+                            header.length) != header.checksum) {
+            break;
+        }
+
+        reader.data = (const guint8 *)contents + offset + sizeof (header);
+        reader.remaining = header.length;
+        entry = decode_frame (&reader);
+        if (!entry) {
+            break;
+        }
+
+        overlay_insert (segment, entry);
+        segment->n_logged++;
+        offset += sizeof (header) + header.length;
+    }
+
+    if (offset < length) {
+        g_debug ("FINDERZ: Dropping %" G_GSIZE_FORMAT " damaged bytes from %s",
+                 length - offset, segment->log_path);
+        if (truncate (segment->log_path, offset) != 0) {
+            g_unlink (segment->log_path);
+        }
+    }
+
+    g_free (contents);
+}
+
+static void
+segment_ensure_loaded (IndexSegment *segment)
+{
+    if (segment->loaded) {
+        return;
+    }
+
+    segment->loaded = TRUE;
+    segment_map (segment);
+    segment_replay_log (segment);
+}
+
+/* Merge the log into a new segment.  The segment is replaced by
+ * rename, so a crash leaves either the old or the new one; the log is
+ * only emptied afterwards and replaying it again is harmless. */
+static void
+segment_compact (IndexSegment *segment)
+{
+    GPtrArray *entries;
+    GHashTableIter iter;
+    gpointer value;
+    GBytes *bytes;
+    GError *error = NULL;
+    guint i;
+
+    entries = g_ptr_array_new_with_free_func ((GDestroyNotify)index_entry_free);
+
+    for (i = 0; i < segment_n_records (segment); i++) {
+        IndexEntry *entry, *newer;
+
+        entry = g_new0 (IndexEntry, 1);
+        segment_get_key (segment, i, &entry->key);
+
+        newer = g_hash_table_lookup (segment->overlay, &entry->key.inode);
+        if (newer && newer->key.device == entry->key.device) {
+            g_free (entry);
+            continue;
+        }
+
+        entry->metadata = segment_read_record (segment, i, NULL);
+        g_ptr_array_add (entries, entry);
+    }
+
+    g_hash_table_iter_init (&iter, segment->overlay);
+    while (g_hash_table_iter_next (&iter, NULL, &value)) {
+        IndexEntry *entry = value;
+        IndexEntry *copy = g_new0 (IndexEntry, 1);
+
+        copy->key = entry->key;
+        copy->metadata = finderz_universal_metadata_ref (entry->metadata);
+        g_ptr_array_add (entries, copy);
+    }
+
+    g_ptr_array_sort (entries, index_entry_compare);
+    bytes = encode_segment (segment->directory, entries);
+    g_ptr_array_unref (entries);
+
+    if (!g_file_set_contents (segment->segment_path,
+                              g_bytes_get_data (bytes, NULL),
+                              g_bytes_get_size (bytes), &error)) {
+        g_debug ("FINDERZ: Failed to write metadata index: %s", error->message);
+        g_error_free (error);
+        g_bytes_unref (bytes);
+        return;
+    }
+    g_bytes_unref (bytes);
+
+    segment_unmap (segment);
+    segment_map (segment);
+
+    g_hash_table_remove_all (segment->overlay);
+    segment->n_logged = 0;
+    if (segment->log_fd >= 0 && ftruncate (segment->log_fd, 0) != 0) {
+        close (segment->log_fd);
+        segment->log_fd = -1;
+        g_unlink (segment->log_path);
+    }
+}
+
+/* Segment table */
+
+static void
+segment_free (IndexSegment *segment)
+{
+    segment_unmap (segment);
+    g_hash_table_destroy (segment->overlay);
+    if (segment->log_fd >= 0) {
+        close (segment->log_fd);
+    }
+    g_mutex_clear (&segment->mutex);
+    g_free (segment->directory);
+    g_free (segment->segment_path);
+    g_free (segment->log_path);
+    g_free (segment);
+}
+
+/* Called with segments_mutex held */
+static void
+segment_unref_locked (IndexSegment *segment)
+{
+    if (--segment->ref_count == 0) {
+        segment_free (segment);
+    }
+}
+
+static void
+segment_unref (IndexSegment *segment)
+{
+    g_mutex_lock (&segments_mutex);
+    segment_unref_locked (segment);
+    g_mutex_unlock (&segments_mutex);
+}
+
+/* The segment for @directory, opened on first use; the table holds a
+ * reference of its own until the segment falls off the LRU */
+static IndexSegment*
+segment_get (const gchar *directory)
+{
+    IndexSegment *segment;
+
+    g_mutex_lock (&segments_mutex);
+
+    segment = g_hash_table_lookup (segments, directory);
+    if (segment) {
+        g_queue_unlink (&segment_lru, segment->lru_link);
+        g_queue_push_head_link (&segment_lru, segment->lru_link);
+    } else {
+        gchar *hash, *name;
+
+        segment = g_new0 (IndexSegment, 1);
+        segment->directory = g_strdup (directory);
+        g_mutex_init (&segment->mutex);
+        segment->overlay = g_hash_table_new_full (g_int64_hash, g_int64_equal,
+                                                  NULL, (GDestroyNotify)index_entry_free);
+        segment->log_fd = -1;
+        segment->ref_count = 1;
+
+        hash = g_compute_checksum_for_string (G_CHECKSUM_SHA1, directory, -1);
+        name = g_strconcat (hash, ".idx", NULL);
+        segment->segment_path = g_build_filename (index_dir, name, NULL);
+        g_free (name);
+        name = g_strconcat (hash, ".log", NULL);
+        segment->log_path = g_build_filename (index_dir, name, NULL);
+        g_free (name);
+        g_free (hash);
+
+        g_queue_push_head (&segment_lru, segment);
+        segment->lru_link = segment_lru.head;
+        g_hash_table_insert (segments, segment->directory, segment);
+
+        while (g_queue_get_length (&segment_lru) > INDEX_MAX_SEGMENTS) {
+            IndexSegment *oldest = g_queue_pop_tail (&segment_lru);
+
+            g_hash_table_remove (segments, oldest->directory);
+            segment_unref_locked (oldest);
+        }
+    }
+
+    segment->ref_count++;
+    g_mutex_unlock (&segments_mutex);
+
+    return segment;
+}
+
+FinderzUniversalMetadata*
+finderz_metadata_index_lookup (const gchar *path, const FinderzFileKey *key)
+{
+    FinderzUniversalMetadata *metadata = NULL;
+    IndexSegment *segment;
+    IndexEntry *entry;
+    gchar *directory;
+
+    g_return_val_if_fail (path != NULL && key != NULL, NULL);
+
+    if (!index_dir) {
+        return NULL;
+    }
+
+    directory = g_path_get_dirname (path);
+    segment = segment_get (directory);
+    g_free (directory);
+
+    g_mutex_lock (&segment->mutex);
+    segment_ensure_loaded (segment);
+
+    /* The log is newer than the segment, so an entry there decides */
+    entry = g_hash_table_lookup (segment->overlay, &key->inode);
+    if (entry && entry->key.device == key->device) {
+        if (file_key_equal (&entry->key, key)) {
+            metadata = copy_record (entry->metadata, path);
+        }
+    } else {
+        gint record = segment_find (segment, key);
+
+        if (record >= 0) {
+            FinderzFileKey stored;
+
+            segment_get_key (segment, record, &stored);
+            if (file_key_equal (&stored, key)) {
+                metadata = segment_read_record (segment, record, path);
+            }
+        }
+    }
+
+    g_mutex_unlock (&segment->mutex);
+    segment_unref (segment);
+
+    return metadata;
+}
+
+void
+finderz_metadata_index_store (const gchar *path,
+                              const FinderzFileKey *key,
+                              FinderzUniversalMetadata *metadata)
+{
+    IndexSegment *segment;
+    IndexEntry *entry;
+    GByteArray *frame;
+    gchar *directory;
+
+    g_return_if_fail (path != NULL && key != NULL && metadata != NULL);
+
+    if (!index_dir) {
+        return;
+    }
+
+    directory = g_path_get_dirname (path);
+    segment = segment_get (directory);
+    g_free (directory);
+
+    g_mutex_lock (&segment->mutex);
+    segment_ensure_loaded (segment);
+
+    if (segment->log_fd < 0) {
+        segment->log_fd = g_open (segment->log_path,
+                                  O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    }
+
+    /* One write per frame, so a crash tears at most the last one */
+    frame = encode_frame (key, metadata);
+    if (segment->log_fd >= 0 &&
+        write (segment->log_fd, frame->data, frame->len) == (gssize)frame->len) {
+        entry = g_new0 (IndexEntry, 1);
+        entry->key = *key;
+        /* The caller goes on to add sidecar fields, which belong to
+         * the file's view of it and not to the index */
+        entry->metadata = copy_record (metadata, path);
+        overlay_insert (segment, entry);
+        segment->n_logged++;
+    }
+    g_byte_array_unref (frame);
+
+    if (segment->n_logged >= MAX (INDEX_COMPACT_MIN_RECORDS, segment_n_records (segment))) {
+        segment_compact (segment);
+    }
+
+    g_mutex_unlock (&segment->mutex);
+    segment_unref (segment);
+}
@@ -0,0 +1,48 @@
+/* finderz-metadata-index.h
+ *
+ * Persistent on-disk index of extracted metadata
+ * Lets a folder's metadata columns fill in without reading its files
+ */
+
+#ifndef FINDERZ_METADATA_INDEX_H
+#define FINDERZ_METADATA_INDEX_H
+
+#include <glib.h>
+#include "finderz-universal-metadata.h"
+
+G_BEGIN_DECLS
+
+/* Identifies one version of a file.  Ctime is included because
+ * setting an xattr, such as a rating, changes nothing else. */
+typedef struct {
+    guint64 device;
+    guint64 inode;
+    gint64 mtime_nsec;
+    gint64 ctime_nsec;
+    gint64 size;
+} FinderzFileKey;
+
+/* Set up the index directory under the user cache directory */
+void finderz_metadata_index_init (void);
+
+/* Fill @key from a stat() of @path; no file is opened */
+gboolean finderz_metadata_index_stat (const gchar *path,
+                                      FinderzFileKey *key);
+/* The same for @name relative to the directory @dir_fd, as for fstatat() */
+gboolean finderz_metadata_index_stat_at (int dir_fd,
+                                         const gchar *name,
+                                         FinderzFileKey *key);
+
+/* A new record for @path if the index holds one for @key, else NULL */
+FinderzUniversalMetadata* finderz_metadata_index_lookup (const gchar *path,
+                                                         const FinderzFileKey *key);
+
+/* Remember @metadata, extracted from @path while it matched @key.
+ * The index keeps a copy of its own, so @metadata stays the caller's. */
+void finderz_metadata_index_store (const gchar *path,
+                                   const FinderzFileKey *key,
+                                   FinderzUniversalMetadata *metadata);
+
+G_END_DECLS
+
+#endif /* FINDERZ_METADATA_INDEX_H */
@@ -0,0 +1,225 @@
+/* finderz-metadata-schema.c
+ *
+ * Global registry of metadata field descriptors
+ */
+
+#include "finderz-metadata-schema.h"
+
+/* Descriptors live in fixed-size chunks that are never moved, so a
+ * reader only needs the published count to index them without a lock */
+#define FIELD_CHUNK_BITS 8
+#define FIELD_CHUNK_SIZE (1 << FIELD_CHUNK_BITS)
+#define FIELD_MAX_ID G_MAXUINT16
+
+static FinderzFieldDescriptor *field_chunks[(FIELD_MAX_ID >> FIELD_CHUNK_BITS) + 1];
+static gint n_fields = 0;           /* highest registered id, atomic */
+static GHashTable *fields_by_key = NULL;  /* interned key -> descriptor */
+static GMutex schema_mutex;
+
+static const struct {
+    FinderzBuiltinField id;
+    const gchar *key;
+    const gchar *display_name;
+    const gchar *category;
+    FinderzFieldType type;
+    FinderzMetadataSource source;
+} builtin_fields[] = {
+    { FINDERZ_FIELD_RATING, "rating", "Rating", "General",
+      FINDERZ_FIELD_TYPE_RATING, FINDERZ_METADATA_SOURCE_XATTR },
+    { FINDERZ_FIELD_COLOR_LABEL, "color_label", "Color Label", "General",
+      FINDERZ_FIELD_TYPE_STRING, FINDERZ_METADATA_SOURCE_XATTR },
+    { FINDERZ_FIELD_KEYWORDS, "keywords", "Keywords", "General",
+      FINDERZ_FIELD_TYPE_STRING, FINDERZ_METADATA_SOURCE_XMP },
+    { FINDERZ_FIELD_HAS_XMP, "has_xmp", "XMP", "General",
+      FINDERZ_FIELD_TYPE_FLAG, FINDERZ_METADATA_SOURCE_XMP },
+    { FINDERZ_FIELD_HAS_SIDECAR, "has_sidecar", "Sidecar", "General",
+      FINDERZ_FIELD_TYPE_FLAG, FINDERZ_METADATA_SOURCE_SIDECAR },
+    { FINDERZ_FIELD_AI_PROMPT, "ai_prompt", "AI Prompt", "AI Generation",
+      FINDERZ_FIELD_TYPE_STRING, FINDERZ_METADATA_SOURCE_AI_WORKFLOW },
+    { FINDERZ_FIELD_AI_NEGATIVE_PROMPT, "ai_negative_prompt", "Negative Prompt", "AI Generation",
+      FINDERZ_FIELD_TYPE_STRING, FINDERZ_METADATA_SOURCE_AI_WORKFLOW },
+    { FINDERZ_FIELD_AI_MODEL, "ai_model", "AI Model", "AI Generation",
+      FINDERZ_FIELD_TYPE_STRING, FINDERZ_METADATA_SOURCE_AI_WORKFLOW },
+    { FINDERZ_FIELD_AI_SAMPLER, "ai_sampler", "Sampler", "AI Generation",
+      FINDERZ_FIELD_TYPE_STRING, FINDERZ_METADATA_SOURCE_AI_WORKFLOW },
+    { FINDERZ_FIELD_AI_STEPS, "ai_steps", "Steps", "AI Generation",
+      FINDERZ_FIELD_TYPE_INTEGER, FINDERZ_METADATA_SOURCE_AI_WORKFLOW },
+    { FINDERZ_FIELD_AI_CFG, "ai_cfg", "CFG Scale", "AI Generation",
+      FINDERZ_FIELD_TYPE_REAL, FINDERZ_METADATA_SOURCE_AI_WORKFLOW },
+    { FINDERZ_FIELD_AI_SEED, "ai_seed", "Seed", "AI Generation",
+      FINDERZ_FIELD_TYPE_INTEGER, FINDERZ_METADATA_SOURCE_AI_WORKFLOW },
+    { FINDERZ_FIELD_AI_TOOL, "ai_tool", "AI Tool", "AI Generation",
+      FINDERZ_FIELD_TYPE_STRING, FINDERZ_METADATA_SOURCE_AI_WORKFLOW },
+    { FINDERZ_FIELD_EXIF_CAMERA, "exif_camera", "Camera", "Camera",
+      FINDERZ_FIELD_TYPE_STRING, FINDERZ_METADATA_SOURCE_EXIF },
+    { FINDERZ_FIELD_EXIF_LENS, "exif_lens", "Lens", "Camera",
+      FINDERZ_FIELD_TYPE_STRING, FINDERZ_METADATA_SOURCE_EXIF },
+    { FINDERZ_FIELD_EXIF_FOCAL_LENGTH, "exif_focal_length", "Focal Length", "Camera",
+      FINDERZ_FIELD_TYPE_REAL, FINDERZ_METADATA_SOURCE_EXIF },
+    { FINDERZ_FIELD_EXIF_APERTURE, "exif_aperture", "Aperture", "Camera",
+      FINDERZ_FIELD_TYPE_REAL, FINDERZ_METADATA_SOURCE_EXIF },
+    { FINDERZ_FIELD_EXIF_ISO, "exif_iso", "ISO", "Camera",
+      FINDERZ_FIELD_TYPE_INTEGER, FINDERZ_METADATA_SOURCE_EXIF },
+    { FINDERZ_FIELD_EXIF_DATE_TAKEN, "exif_date_taken", "Date Taken", "Camera",
+      FINDERZ_FIELD_TYPE_DATE, FINDERZ_METADATA_SOURCE_EXIF },
+    { FINDERZ_FIELD_GPS_LOCATION, "gps_location", "GPS Location", "Location",
+      FINDERZ_FIELD_TYPE_STRING, FINDERZ_METADATA_SOURCE_EXIF },
+    { FINDERZ_FIELD_AI_LORAS, "ai_loras", "LoRAs", "AI Generation",
+      FINDERZ_FIELD_TYPE_STRING, FINDERZ_METADATA_SOURCE_AI_WORKFLOW },
+    { FINDERZ_FIELD_AI_WORKFLOW, "ai_workflow", "Workflow", "AI Generation",
+      FINDERZ_FIELD_TYPE_STRING, FINDERZ_METADATA_SOURCE_AI_WORKFLOW },
+    { FINDERZ_FIELD_DIMENSIONS, "dimensions", "Dimensions", "Media",
+      FINDERZ_FIELD_TYPE_STRING, FINDERZ_METADATA_SOURCE_VIDEO },
+    { FINDERZ_FIELD_ASPECT_RATIO, "aspect_ratio", "Aspect Ratio", "Media",
+      FINDERZ_FIELD_TYPE_REAL, FINDERZ_METADATA_SOURCE_VIDEO },
+    { FINDERZ_FIELD_DURATION, "duration", "Duration", "Media",
+      FINDERZ_FIELD_TYPE_DURATION, FINDERZ_METADATA_SOURCE_VIDEO },
+    { FINDERZ_FIELD_BITRATE, "bitrate", "Bitrate (kb/s)", "Media",
+      FINDERZ_FIELD_TYPE_INTEGER, FINDERZ_METADATA_SOURCE_VIDEO },
+    { FINDERZ_FIELD_CODEC, "codec", "Codec", "Media",
+      FINDERZ_FIELD_TYPE_STRING, FINDERZ_METADATA_SOURCE_VIDEO },
+    { FINDERZ_FIELD_MEDIA_TITLE, "media_title", "Title", "Media",
+      FINDERZ_FIELD_TYPE_STRING, FINDERZ_METADATA_SOURCE_ID3 },
+    { FINDERZ_FIELD_MEDIA_ARTIST, "media_artist", "Artist", "Media",
+      FINDERZ_FIELD_TYPE_STRING, FINDERZ_METADATA_SOURCE_ID3 },
+    { FINDERZ_FIELD_MEDIA_ALBUM, "media_album", "Album", "Media",
+      FINDERZ_FIELD_TYPE_STRING, FINDERZ_METADATA_SOURCE_ID3 },
+    { FINDERZ_FIELD_DOC_TITLE, "doc_title", "Document Title", "Document",
+      FINDERZ_FIELD_TYPE_STRING, FINDERZ_METADATA_SOURCE_PDF },
+    { FINDERZ_FIELD_DOC_AUTHOR, "doc_author", "Author", "Document",
+      FINDERZ_FIELD_TYPE_STRING, FINDERZ_METADATA_SOURCE_PDF },
+    { FINDERZ_FIELD_DOC_PAGES, "doc_pages", "Pages", "Document",
+      FINDERZ_FIELD_TYPE_INTEGER, FINDERZ_METADATA_SOURCE_PDF },
+    { FINDERZ_FIELD_DOC_CREATED, "doc_created", "Document Created", "Document",
+      FINDERZ_FIELD_TYPE_DATE, FINDERZ_METADATA_SOURCE_PDF },
+    { FINDERZ_FIELD_DOC_MODIFIED, "doc_modified", "Document Modified", "Document",
+      FINDERZ_FIELD_TYPE_DATE, FINDERZ_METADATA_SOURCE_PDF },
+    { FINDERZ_FIELD_DOC_APPLICATION, "doc_application", "Application", "Document",
+      FINDERZ_FIELD_TYPE_STRING, FINDERZ_METADATA_SOURCE_OFFICE },
+};
+
+G_STATIC_ASSERT (G_N_ELEMENTS (builtin_fields) == FINDERZ_N_BUILTIN_FIELDS - 1);
+
+/* Called with schema_mutex held */
+static FinderzFieldId
+register_locked (const gchar *key,
+                 const gchar *display_name,
+                 const gchar *category,
+                 FinderzFieldType type,
+                 FinderzMetadataSource source)
+{
+    FinderzFieldDescriptor *descriptor;
+    guint id;
+
+    descriptor = g_hash_table_lookup (fields_by_key, key);
+    if (descriptor) {
+        return descriptor->id;
+    }
+
+    id = n_fields + 1;
+    if (id > FIELD_MAX_ID) {
+        g_warning ("FINDERZ: Too many metadata fields, ignoring '%s'", key);
+        return FINDERZ_FIELD_INVALID;
+    }
+
+    if (!field_chunks[id >> FIELD_CHUNK_BITS]) {
+        field_chunks[id >> FIELD_CHUNK_BITS] = g_new0 (FinderzFieldDescriptor, FIELD_CHUNK_SIZE);
+    }
+
+    descriptor = &field_chunks[id >> FIELD_CHUNK_BITS][id & (FIELD_CHUNK_SIZE - 1)];
+    descriptor->id = id;
+    descriptor->type = type;
+    descriptor->source = source;
+    descriptor->key = g_intern_string (key);
+    descriptor->display_name = g_intern_string (display_name ? display_name : key);
+    descriptor->category = g_intern_string (category);
+
+    g_hash_table_insert (fields_by_key, (gpointer)descriptor->key, descriptor);
+
+    /* Publish only after the descriptor is complete */
+    g_atomic_int_set (&n_fields, id);
+
+    return id;
+}
+
+void
+finderz_metadata_schema_init (void)
+{
+    static gsize initialized = 0;
+
+    if (g_once_init_enter (&initialized)) {
+        guint i;
+
+        g_mutex_lock (&schema_mutex);
+        fields_by_key = g_hash_table_new (g_str_hash, g_str_equal);
+        for (i = 0; i < G_N_ELEMENTS (builtin_fields); i++) {
+            FinderzFieldId id = register_locked (builtin_fields[i].key,
+                                                 builtin_fields[i].display_name,
+                                                 builtin_fields[i].category,
+                                                 builtin_fields[i].type,
+                                                 builtin_fields[i].source);
+            g_assert (id == (FinderzFieldId)builtin_fields[i].id);
+        }
+        g_mutex_unlock (&schema_mutex);
+
+        g_once_init_leave (&initialized, 1);
+    }
+}
+
+FinderzFieldId
+finderz_metadata_schema_register (const gchar *key,
+                                  const gchar *display_name,
+                                  const gchar *category,
+                                  FinderzFieldType type,
+                                  FinderzMetadataSource source)
+{
+    FinderzFieldId id;
+
+    g_return_val_if_fail (key != NULL && *key != '\0', FINDERZ_FIELD_INVALID);
+
+    finderz_metadata_schema_init ();
+
+    g_mutex_lock (&schema_mutex);
+    id = register_locked (key, display_name, category, type, source);
+    g_mutex_unlock (&schema_mutex);
+
+    return id;
+}
+
+FinderzFieldId
+finderz_metadata_schema_lookup (const gchar *key)
+{
+    FinderzFieldDescriptor *descriptor;
+
+    if (!key) {
+        return FINDERZ_FIELD_INVALID;
+    }
+
+    finderz_metadata_schema_init ();
+
+    g_mutex_lock (&schema_mutex);
+    descriptor = g_hash_table_lookup (fields_by_key, key);
+    g_mutex_unlock (&schema_mutex);
+
+    return descriptor ? descriptor->id : FINDERZ_FIELD_INVALID;
+}
+
+const FinderzFieldDescriptor*
+finderz_metadata_schema_get (FinderzFieldId id)
+{
+    finderz_metadata_schema_init ();
+
+    if (id == FINDERZ_FIELD_INVALID || id > (guint)g_atomic_int_get (&n_fields)) {
+        return NULL;
+    }
+
+    return &field_chunks[id >> FIELD_CHUNK_BITS][id & (FIELD_CHUNK_SIZE - 1)];
+}
+
+guint
+finderz_metadata_schema_get_n_fields (void)
+{
+    finderz_metadata_schema_init ();
+
+    return g_atomic_int_get (&n_fields);
+}
@@ -0,0 +1,121 @@
+/* finderz-metadata-schema.h
+ *
+ * Global registry of metadata field descriptors
+ * Files store small field ids; names, types and categories live here once
+ */
+
+#ifndef FINDERZ_METADATA_SCHEMA_H
+#define FINDERZ_METADATA_SCHEMA_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Metadata sources */
+typedef enum {
+    FINDERZ_METADATA_SOURCE_EXIF,           /* JPEG/TIFF EXIF data */
+    FINDERZ_METADATA_SOURCE_XMP,            /* XMP sidecar files or embedded */
+    FINDERZ_METADATA_SOURCE_IPTC,           /* IPTC photo metadata */
+    FINDERZ_METADATA_SOURCE_DS_STORE,       /* macOS .DS_Store */
+    FINDERZ_METADATA_SOURCE_XATTR,          /* Extended attributes */
+    FINDERZ_METADATA_SOURCE_AI_WORKFLOW,    /* ComfyUI/SD workflows */
+    FINDERZ_METADATA_SOURCE_PNG_TEXT,       /* PNG text chunks */
+    FINDERZ_METADATA_SOURCE_WEBP_METADATA,  /* WebP metadata */
+    FINDERZ_METADATA_SOURCE_ID3,            /* MP3/audio tags */
+    FINDERZ_METADATA_SOURCE_VIDEO,          /* Video metadata */
+    FINDERZ_METADATA_SOURCE_PDF,            /* PDF metadata */
+    FINDERZ_METADATA_SOURCE_OFFICE,         /* Office document properties */
+    FINDERZ_METADATA_SOURCE_SIDECAR         /* Any .metadata or similar sidecar */
+} FinderzMetadataSource;
+
+/* How a field's values are parsed and displayed */
+typedef enum {
+    FINDERZ_FIELD_TYPE_STRING,
+    FINDERZ_FIELD_TYPE_INTEGER,
+    FINDERZ_FIELD_TYPE_REAL,
+    FINDERZ_FIELD_TYPE_DATE,
+    FINDERZ_FIELD_TYPE_RATING,   /* 0-5, drawn as stars */
+    FINDERZ_FIELD_TYPE_FLAG,     /* present or not, drawn as a check mark */
+    FINDERZ_FIELD_TYPE_DURATION  /* seconds, drawn as h:mm:ss */
+} FinderzFieldType;
+
+typedef guint16 FinderzFieldId;
+
+#define FINDERZ_FIELD_INVALID 0
+
+/* Fields registered at startup, so their ids are compile-time constants */
+typedef enum {
+    FINDERZ_FIELD_RATING = 1,
+    FINDERZ_FIELD_COLOR_LABEL,
+    FINDERZ_FIELD_KEYWORDS,
+    FINDERZ_FIELD_HAS_XMP,
+    FINDERZ_FIELD_HAS_SIDECAR,
+    FINDERZ_FIELD_AI_PROMPT,
+    FINDERZ_FIELD_AI_NEGATIVE_PROMPT,
+    FINDERZ_FIELD_AI_MODEL,
+    FINDERZ_FIELD_AI_SAMPLER,
+    FINDERZ_FIELD_AI_STEPS,
+    FINDERZ_FIELD_AI_CFG,
+    FINDERZ_FIELD_AI_SEED,
+    FINDERZ_FIELD_AI_TOOL,
+    FINDERZ_FIELD_EXIF_CAMERA,
+    FINDERZ_FIELD_EXIF_LENS,
+    FINDERZ_FIELD_EXIF_FOCAL_LENGTH,
+    FINDERZ_FIELD_EXIF_APERTURE,
+    FINDERZ_FIELD_EXIF_ISO,
+    FINDERZ_FIELD_EXIF_DATE_TAKEN,
+    FINDERZ_FIELD_GPS_LOCATION,
+    FINDERZ_FIELD_AI_LORAS,
+    FINDERZ_FIELD_AI_WORKFLOW,
+    FINDERZ_FIELD_DIMENSIONS,
+    FINDERZ_FIELD_ASPECT_RATIO,
+    FINDERZ_FIELD_DURATION,
+    FINDERZ_FIELD_BITRATE,
+    FINDERZ_FIELD_CODEC,
+    FINDERZ_FIELD_MEDIA_TITLE,
+    FINDERZ_FIELD_MEDIA_ARTIST,
+    FINDERZ_FIELD_MEDIA_ALBUM,
+    FINDERZ_FIELD_DOC_TITLE,
+    FINDERZ_FIELD_DOC_AUTHOR,
+    FINDERZ_FIELD_DOC_PAGES,
+    FINDERZ_FIELD_DOC_CREATED,
+    FINDERZ_FIELD_DOC_MODIFIED,
+    FINDERZ_FIELD_DOC_APPLICATION,
+    FINDERZ_N_BUILTIN_FIELDS
+} FinderzBuiltinField;
+
+/* Descriptors are never freed or changed once registered, and their
+ * strings are interned, so pointers to them can be kept freely */
+typedef struct {
+    FinderzFieldId id;
+    FinderzFieldType type;
+    FinderzMetadataSource source;
+    const gchar *key;
+    const gchar *display_name;
+    const gchar *category;
+} FinderzFieldDescriptor;
+
+/* Register the built-in fields; also done on first use */
+void finderz_metadata_schema_init (void);
+
+/* Return the id of @key, registering it if it is new.  The first
+ * registration decides the name, category, type and source.  Returns
+ * FINDERZ_FIELD_INVALID once every id is in use. */
+FinderzFieldId finderz_metadata_schema_register (const gchar *key,
+                                                 const gchar *display_name,
+                                                 const gchar *category,
+                                                 FinderzFieldType type,
+                                                 FinderzMetadataSource source);
+
+/* FINDERZ_FIELD_INVALID if @key was never registered */
+FinderzFieldId finderz_metadata_schema_lookup (const gchar *key);
+
+/* Safe from any thread and lock-free; NULL for unknown ids */
+const FinderzFieldDescriptor* finderz_metadata_schema_get (FinderzFieldId id);
+
+/* Valid ids run from 1 to this value inclusive */
+guint finderz_metadata_schema_get_n_fields (void);
+
+G_END_DECLS
+
+#endif /* FINDERZ_METADATA_SCHEMA_H */
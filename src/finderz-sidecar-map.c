@@ -0,0 +1,251 @@
+/* finderz-sidecar-map.c
+ *
+ * Sidecar files of each directory, taken from its listing
+ *
+ * NemoDirectory already enumerates every name in a folder, so instead
+ * of probing for "photo.jpg.xmp", "photo.xmp", "photo.jpg.json" and so
+ * on for every file, each sidecar seen in the listing is recorded
+ * against the name it belongs to.  A lookup is then two hash lookups.
+ */
+
+#include "finderz-sidecar-map.h"
+#include <string.h>
+
+typedef enum {
+    SIDECAR_XMP      = 1 << 0,
+    SIDECAR_METADATA = 1 << 1,
+    SIDECAR_JSON     = 1 << 2,
+    SIDECAR_META     = 1 << 3
+} SidecarKind;
+
+/* In the order finderz_find_metadata_sidecar() has always preferred */
+static const struct {
+    const gchar *suffix;
+    SidecarKind kind;
+} sidecar_suffixes[] = {
+    { ".xmp",      SIDECAR_XMP },
+    { ".metadata", SIDECAR_METADATA },
+    { ".json",     SIDECAR_JSON },
+    { ".meta",     SIDECAR_META },
+};
+
+struct _FinderzSidecarMap {
+    gchar *directory;       /* local path, NULL if the folder has none */
+    GHashTable *owners;     /* owner name -> SidecarKind bits */
+    gboolean complete;
+};
+
+/* Maps by directory path.  Maps are changed on the main thread and
+ * read from extraction threads, so both go through sidecar_mutex. */
+static GHashTable *sidecar_maps = NULL;
+static GMutex sidecar_mutex;
+
+FinderzSidecarMap*
+finderz_sidecar_map_new (GFile *location)
+{
+    FinderzSidecarMap *map;
+    
+    map = g_new0 (FinderzSidecarMap, 1);
+    map->directory = location ? g_file_get_path (location) : NULL;
+    map->owners = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    
+    if (map->directory) {
+        g_mutex_lock (&sidecar_mutex);
+        if (!sidecar_maps) {
+            sidecar_maps = g_hash_table_new (g_str_hash, g_str_equal);
+        }
+        g_hash_table_insert (sidecar_maps, map->directory, map);
+        g_mutex_unlock (&sidecar_mutex);
+    }
+    
+    return map;
+}
+
+void
+finderz_sidecar_map_free (FinderzSidecarMap *map)
+{
+    if (!map) {
+        return;
+    }
+    
+    if (map->directory) {
+        g_mutex_lock (&sidecar_mutex);
+        if (g_hash_table_lookup (sidecar_maps, map->directory) == map) {
+            g_hash_table_remove (sidecar_maps, map->directory);
+        }
+        g_mutex_unlock (&sidecar_mutex);
+    }
+    
+    g_hash_table_destroy (map->owners);
+    g_free (map->directory);
+    g_free (map);
+}
+
+static void
+update_owner (FinderzSidecarMap *map, const gchar *owner, gsize owner_len,
+              SidecarKind kind, gboolean present)
+{
+    gchar *name = g_strndup (owner, owner_len);
+    guint kinds = GPOINTER_TO_UINT (g_hash_table_lookup (map->owners, name));
+    
+    kinds = present ? (kinds | kind) : (kinds & ~kind);
+    if (kinds) {
+        g_hash_table_replace (map->owners, name, GUINT_TO_POINTER (kinds));
+    } else {
+        g_hash_table_remove (map->owners, name);
+        g_free (name);
+    }
+}
+
+/* The suffix entry @name ends with, or -1 if it is no sidecar */
+static gint
+sidecar_suffix_index (const gchar *name, gsize len)
+{
+    guint i;
+    
+    for (i = 0; i < G_N_ELEMENTS (sidecar_suffixes); i++) {
+        gsize suffix_len = strlen (sidecar_suffixes[i].suffix);
+        
+        if (len > suffix_len &&
+            strcmp (name + len - suffix_len, sidecar_suffixes[i].suffix) == 0) {
+            return i;
+        }
+    }
+    
+    return -1;
+}
+
+/* TRUE when @name is a sidecar and the listing was complete before */
+static gboolean
+update_map (FinderzSidecarMap *map, const gchar *name, gboolean present)
+{
+    gboolean complete;
+    gsize len;
+    gint i;
+    
+    if (!map || !map->directory || !name) {
+        return FALSE;
+    }
+    
+    len = strlen (name);
+    i = sidecar_suffix_index (name, len);
+    if (i < 0) {
+        return FALSE;
+    }
+    
+    g_mutex_lock (&sidecar_mutex);
+    update_owner (map, name, len - strlen (sidecar_suffixes[i].suffix),
+                  sidecar_suffixes[i].kind, present);
+    complete = map->complete;
+    g_mutex_unlock (&sidecar_mutex);
+    
+    return complete;
+}
+
+gboolean
+finderz_sidecar_map_file_added (FinderzSidecarMap *map, const gchar *name)
+{
+    return update_map (map, name, TRUE);
+}
+
+gboolean
+finderz_sidecar_map_file_removed (FinderzSidecarMap *map, const gchar *name)
+{
+    return update_map (map, name, FALSE);
+}
+
+gchar*
+finderz_sidecar_get_owner (const gchar *name, gboolean *by_stem)
+{
+    gsize len;
+    gint i;
+    
+    len = name ? strlen (name) : 0;
+    i = name ? sidecar_suffix_index (name, len) : -1;
+    if (i < 0) {
+        return NULL;
+    }
+    
+    if (by_stem) {
+        *by_stem = sidecar_suffixes[i].kind == SIDECAR_XMP;
+    }
+    
+    return g_strndup (name, len - strlen (sidecar_suffixes[i].suffix));
+}
+
+void
+finderz_sidecar_map_set_complete (FinderzSidecarMap *map, gboolean complete)
+{
+    if (!map) {
+        return;
+    }
+    
+    g_mutex_lock (&sidecar_mutex);
+    map->complete = complete;
+    g_mutex_unlock (&sidecar_mutex);
+}
+
+gboolean
+finderz_sidecar_map_lookup (const gchar *file_path,
+                            gchar **xmp_path,
+                            gchar **metadata_path)
+{
+    FinderzSidecarMap *map;
+    const gchar *slash, *name, *dot;
+    gchar *directory, *stem;
+    guint kinds, stem_kinds;
+    guint i;
+    
+    if (xmp_path) {
+        *xmp_path = NULL;
+    }
+    if (metadata_path) {
+        *metadata_path = NULL;
+    }
+    
+    slash = file_path ? strrchr (file_path, G_DIR_SEPARATOR) : NULL;
+    if (!slash || slash[1] == '\0') {
+        return FALSE;
+    }
+    name = slash + 1;
+    directory = slash == file_path ? g_strdup (G_DIR_SEPARATOR_S)
+                                   : g_strndup (file_path, slash - file_path);
+    
+    /* "photo.jpg" may also own "photo.xmp" */
+    dot = strrchr (name, '.');
+    stem = dot && dot != name ? g_strndup (name, dot - name) : NULL;
+    
+    g_mutex_lock (&sidecar_mutex);
+    map = sidecar_maps ? g_hash_table_lookup (sidecar_maps, directory) : NULL;
+    if (!map || !map->complete) {
+        g_mutex_unlock (&sidecar_mutex);
+        g_free (directory);
+        g_free (stem);
+        return FALSE;
+    }
+    kinds = GPOINTER_TO_UINT (g_hash_table_lookup (map->owners, name));
+    stem_kinds = stem ? GPOINTER_TO_UINT (g_hash_table_lookup (map->owners, stem)) : 0;
+    g_mutex_unlock (&sidecar_mutex);
+    
+    if (xmp_path) {
+        if (kinds & SIDECAR_XMP) {
+            *xmp_path = g_strconcat (file_path, ".xmp", NULL);
+        } else if (stem_kinds & SIDECAR_XMP) {
+            *xmp_path = g_strdup_printf ("%.*s.xmp", (int) (dot - file_path), file_path);
+        }
+    }
+    
+    if (metadata_path) {
+        for (i = 0; i < G_N_ELEMENTS (sidecar_suffixes); i++) {
+            if (sidecar_suffixes[i].kind != SIDECAR_XMP &&
+                (kinds & sidecar_suffixes[i].kind)) {
+                *metadata_path = g_strconcat (file_path, sidecar_suffixes[i].suffix, NULL);
+                break;
+            }
+        }
+    }
+    
+    g_free (directory);
+    g_free (stem);
+    return TRUE;
+}
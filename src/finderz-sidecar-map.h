@@ -0,0 +1,42 @@
+/* finderz-sidecar-map.h
+ *
+ * Sidecar files of each directory, taken from its listing
+ */
+
+#ifndef FINDERZ_SIDECAR_MAP_H
+#define FINDERZ_SIDECAR_MAP_H
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+typedef struct _FinderzSidecarMap FinderzSidecarMap;
+
+/* A map for the directory at @location, kept by its NemoDirectory */
+FinderzSidecarMap* finderz_sidecar_map_new (GFile *location);
+void finderz_sidecar_map_free (FinderzSidecarMap *map);
+
+/* Follow the directory listing as files come and go.  TRUE when @name
+ * is a sidecar that came or went after the listing was complete, so
+ * the files it belongs to have to be looked at again. */
+gboolean finderz_sidecar_map_file_added (FinderzSidecarMap *map, const gchar *name);
+gboolean finderz_sidecar_map_file_removed (FinderzSidecarMap *map, const gchar *name);
+
+/* The name of the file sidecar @name belongs to, or NULL if @name is
+ * not a sidecar.  @by_stem is set when it also belongs to the files
+ * named that plus an extension, as "photo.xmp" does to "photo.jpg". */
+gchar* finderz_sidecar_get_owner (const gchar *name, gboolean *by_stem);
+
+/* Whether every file of the directory has been added */
+void finderz_sidecar_map_set_complete (FinderzSidecarMap *map, gboolean complete);
+
+/* Sidecars of @file_path, answered without touching the disk.  Returns
+ * FALSE when its directory has no complete listing; the caller has to
+ * look on disk instead.  Either out argument may be NULL. */
+gboolean finderz_sidecar_map_lookup (const gchar *file_path,
+                                     gchar **xmp_path,
+                                     gchar **metadata_path);
+
+G_END_DECLS
+
+#endif /* FINDERZ_SIDECAR_MAP_H */
@@ -0,0 +1,1576 @@
+/* finderz-sorting-profiles.c
+ *
+ * Sorting profiles, and sorting files by them
+ *
+ * A profile is compiled, for each sort, into one fixed-width key per
+ * file: a word for folders first, a word per sort level and a word with
+ * the first eight bytes of the name's sort key, compared as unsigned
+ * numbers most significant first.  Sizes and dates go into their word
+ * as they are; text goes in as its rank among the texts of the files
+ * being sorted.  Comparing two keys is then the whole profile, so the
+ * files are radix sorted on them without calling back into NemoFile,
+ * and only files whose keys are equal, whose names share their first
+ * eight bytes, are compared again by their full names.
+ *
+ * Placing one file among sorted ones compares a key kept on each file
+ * instead, built once from the same values with text held whole rather
+ * than ranked, and dropped when the file changes.
+ *
+ * A profile given to a directory holds for everything under it that
+ * has none of its own.  The directories given profiles are kept in a
+ * tree by path component, so the profile of any path is found with one
+ * hash lookup per component, and the result is kept on the
+ * NemoDirectory until profiles change.
+ */
+
+#include "finderz-sorting-profiles.h"
+#include "finderz-file-attributes.h"
+#include <libnemo-private/nemo-file-private.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+/* Sort levels of a profile that are used; the rest are ignored.  Keys
+ * have a word for folders first, one per level and one for the name. */
+#define SORT_MAX_LEVELS 4
+
+#define SIGN_BIT        (G_GUINT64_CONSTANT (1) << 63)
+
+typedef struct {
+    FinderzSortCriteria criteria[SORT_MAX_LEVELS];
+    gboolean descending[SORT_MAX_LEVELS];
+    guint n_levels;
+    guint n_words;
+} SortPlan;
+
+typedef struct {
+    const gchar *text;
+    guint32 row;
+} RankEntry;
+
+/* The key of one file for finderz_sorting_profile_compare_files(): a
+ * word per level, sizes and dates as they are and text as its first
+ * eight bytes, then the same for the name.  Only when words are equal
+ * are the texts themselves compared. */
+typedef struct {
+    FinderzSortingProfile *profile;
+    gboolean is_file;
+    guint64 words[SORT_MAX_LEVELS + 1];
+    gchar *texts[SORT_MAX_LEVELS];
+    gchar *name;
+} FileSortKey;
+
+static gboolean file_sort_keys_kept = FALSE;
+
+static void
+compile_plan (FinderzSortingProfile *profile, SortPlan *plan)
+{
+    GList *l;
+    
+    plan->n_levels = 0;
+    for (l = profile->sort_levels; l != NULL && plan->n_levels < SORT_MAX_LEVELS; l = l->next) {
+        FinderzSortLevel *level = l->data;
+        
+        plan->criteria[plan->n_levels] = level->criteria;
+        plan->descending[plan->n_levels] = level->direction == FINDERZ_SORT_DESCENDING;
+        plan->n_levels++;
+    }
+    
+    /* Names ascending last are what files are ordered by when all else
+     * is equal anyway */
+    if (plan->n_levels > 0 &&
+        plan->criteria[plan->n_levels - 1] == FINDERZ_SORT_BY_NAME &&
+        !plan->descending[plan->n_levels - 1]) {
+        plan->n_levels--;
+    }
+    plan->n_words = plan->n_levels + 2;
+}
+
+static gboolean
+criteria_is_text (FinderzSortCriteria criteria)
+{
+    switch (criteria) {
+        case FINDERZ_SORT_BY_NAME:
+        case FINDERZ_SORT_BY_TYPE:
+        case FINDERZ_SORT_BY_EXTENSION:
+        case FINDERZ_SORT_BY_COLOR_LABEL:
+        case FINDERZ_SORT_BY_TAGS:
+            return TRUE;
+        default:
+            return FALSE;
+    }
+}
+
+/* Folders before files, and either with an unknown size before the
+ * others, as Nemo sorts by size; the item count or size below that */
+static guint64
+get_size_key (NemoFile *file)
+{
+    if (nemo_file_is_directory (file)) {
+        guint count;
+        gboolean unreadable;
+        
+        if (!nemo_file_get_directory_item_count (file, &count, &unreadable) || unreadable) {
+            return 0;
+        }
+        return (G_GUINT64_CONSTANT (1) << 62) | count;
+    } else {
+        goffset size = nemo_file_get_size (file);
+        
+        if (size < 0) {
+            return G_GUINT64_CONSTANT (2) << 62;
+        }
+        return (G_GUINT64_CONSTANT (3) << 62) |
+               MIN ((guint64) size, (G_GUINT64_CONSTANT (1) << 62) - 1);
+    }
+}
+
+/* Sizes and dates as words that order the way the values do */
+static guint64
+get_number_key (NemoFile *file, FinderzSortCriteria criteria)
+{
+    NemoDateType date_type;
+    time_t date;
+    
+    switch (criteria) {
+        case FINDERZ_SORT_BY_SIZE:
+            return get_size_key (file);
+        case FINDERZ_SORT_BY_DATE_CREATED:
+            date_type = NEMO_DATE_TYPE_CREATED;
+            break;
+        case FINDERZ_SORT_BY_DATE_ACCESSED:
+            date_type = NEMO_DATE_TYPE_ACCESSED;
+            break;
+        default:
+            date_type = NEMO_DATE_TYPE_MODIFIED;
+            break;
+    }
+    
+    /* Unknown dates are 0, the epoch, as Nemo sorts them */
+    nemo_file_get_date (file, date_type, &date);
+    return (guint64) (gint64) date ^ SIGN_BIT;
+}
+
+/* The text names are sorted on: the natural sort collation key Nemo
+ * keeps for every file, a plain collation key, or the name itself when
+ * case matters.  *@owned is set when the key has to be freed. */
+static const gchar*
+get_name_key (FinderzSortingProfile *profile, NemoFile *file, gchar **owned)
+{
+    const gchar *name = file->details->display_name;
+    
+    *owned = NULL;
+    if (name == NULL) {
+        return "";
+    }
+    if (profile->case_sensitive) {
+        return name;
+    }
+    if (!profile->natural_sorting) {
+        *owned = g_utf8_collate_key (name, -1);
+        return *owned;
+    }
+    return file->details->display_name_collation_key != NULL ?
+           file->details->display_name_collation_key : "";
+}
+
+static const gchar*
+get_extension (NemoFile *file)
+{
+    const gchar *name = file->details->display_name;
+    const gchar *dot;
+    
+    if (name == NULL || nemo_file_is_directory (file)) {
+        return NULL;
+    }
+    dot = strrchr (name, '.');
+    return dot != NULL && dot != name ? dot + 1 : NULL;
+}
+
+static const gchar*
+get_metadata_key (NemoFile *file, FinderzFieldId field_id)
+{
+    const FinderzMetadataValue *value;
+    
+    /* Only what is attached: the view asks for the folder's metadata
+     * when its profile needs it, and comparisons must not queue loads
+     * or see a key change half way through a sort */
+    value = finderz_metadata_get_value (finderz_file_get_attached_metadata (file), field_id);
+    if (value == NULL) {
+        return NULL;
+    }
+    return value->collate_key != NULL ? value->collate_key : value->string;
+}
+
+/* The text of a text level other than the name, borrowed from @file;
+ * NULL when the file has none */
+static const gchar*
+get_text_key (NemoFile *file, FinderzSortCriteria criteria)
+{
+    switch (criteria) {
+        case FINDERZ_SORT_BY_TYPE:
+            return file->details->mime_type;
+        case FINDERZ_SORT_BY_EXTENSION:
+            return get_extension (file);
+        case FINDERZ_SORT_BY_COLOR_LABEL:
+            return get_metadata_key (file, FINDERZ_FIELD_COLOR_LABEL);
+        case FINDERZ_SORT_BY_TAGS:
+            return get_metadata_key (file, FINDERZ_FIELD_KEYWORDS);
+        default:
+            return NULL;
+    }
+}
+
+/* Files without the text first; extensions ignore case.  MIME types
+ * are interned, so equal ones are mostly the same pointer. */
+static gint
+compare_text (FinderzSortCriteria criteria, const gchar *a, const gchar *b)
+{
+    if (a == b) {
+        return 0;
+    }
+    if (a == NULL || b == NULL) {
+        return a == NULL ? -1 : 1;
+    }
+    if (criteria == FINDERZ_SORT_BY_EXTENSION) {
+        return g_ascii_strcasecmp (a, b);
+    }
+    return strcmp (a, b);
+}
+
+static gint
+compare_rank_entries (gconstpointer a, gconstpointer b, gpointer user_data)
+{
+    const RankEntry *entry_a = a;
+    const RankEntry *entry_b = b;
+    
+    return compare_text (GPOINTER_TO_INT (user_data), entry_a->text, entry_b->text);
+}
+
+/* Set word @word of every key to the rank of its row's text among
+ * @texts, equal texts sharing a rank */
+static void
+rank_texts (const gchar **texts,
+            guint n_rows,
+            FinderzSortCriteria criteria,
+            guint64 *keys,
+            guint n_words,
+            guint word)
+{
+    RankEntry *entries = g_new (RankEntry, n_rows);
+    guint64 rank = 0;
+    guint i;
+    
+    for (i = 0; i < n_rows; i++) {
+        entries[i].text = texts[i];
+        entries[i].row = i;
+    }
+    g_qsort_with_data (entries, n_rows, sizeof (RankEntry),
+                       compare_rank_entries, GINT_TO_POINTER (criteria));
+    
+    for (i = 0; i < n_rows; i++) {
+        if (i == 0 || compare_text (criteria, entries[i - 1].text, entries[i].text) != 0) {
+            rank++;
+        }
+        keys[(gsize) entries[i].row * n_words + word] = rank;
+    }
+    
+    g_free (entries);
+}
+
+static guint
+ascii_case_hash (gconstpointer key)
+{
+    const gchar *p;
+    guint hash = 5381;
+    
+    for (p = key; *p != '\0'; p++) {
+        hash = (hash << 5) + hash + g_ascii_tolower (*p);
+    }
+    return hash;
+}
+
+static gboolean
+ascii_case_equal (gconstpointer a, gconstpointer b)
+{
+    return g_ascii_strcasecmp (a, b) == 0;
+}
+
+/* rank_texts() for texts that repeat, as types, extensions and labels
+ * do: only the distinct ones are sorted.  Files without the text rank
+ * 0. */
+static void
+rank_repeated_texts (const gchar **texts,
+                     guint n_rows,
+                     FinderzSortCriteria criteria,
+                     guint64 *keys,
+                     guint n_words,
+                     guint word)
+{
+    GHashTable *distinct;
+    GPtrArray *values = g_ptr_array_new ();
+    guint *value_of_row = g_new (guint, n_rows);
+    guint64 *ranks;
+    RankEntry *entries;
+    guint i;
+    
+    if (criteria == FINDERZ_SORT_BY_EXTENSION) {
+        distinct = g_hash_table_new (ascii_case_hash, ascii_case_equal);
+    } else {
+        distinct = g_hash_table_new (g_str_hash, g_str_equal);
+    }
+    
+    for (i = 0; i < n_rows; i++) {
+        gpointer value;
+        
+        if (texts[i] == NULL) {
+            value_of_row[i] = G_MAXUINT;
+        } else if (i > 0 && texts[i] == texts[i - 1]) {
+            value_of_row[i] = value_of_row[i - 1];
+        } else if (g_hash_table_lookup_extended (distinct, texts[i], NULL, &value)) {
+            value_of_row[i] = GPOINTER_TO_UINT (value);
+        } else {
+            value_of_row[i] = values->len;
+            g_hash_table_insert (distinct, (gpointer) texts[i], GUINT_TO_POINTER (values->len));
+            g_ptr_array_add (values, (gpointer) texts[i]);
+        }
+    }
+    
+    entries = g_new (RankEntry, values->len);
+    for (i = 0; i < values->len; i++) {
+        entries[i].text = g_ptr_array_index (values, i);
+        entries[i].row = i;
+    }
+    g_qsort_with_data (entries, values->len, sizeof (RankEntry),
+                       compare_rank_entries, GINT_TO_POINTER (criteria));
+    
+    ranks = g_new (guint64, values->len);
+    for (i = 0; i < values->len; i++) {
+        ranks[entries[i].row] = i + 1;
+    }
+    for (i = 0; i < n_rows; i++) {
+        keys[(gsize) i * n_words + word] =
+            value_of_row[i] == G_MAXUINT ? 0 : ranks[value_of_row[i]];
+    }
+    
+    g_free (ranks);
+    g_free (entries);
+    g_free (value_of_row);
+    g_ptr_array_unref (values);
+    g_hash_table_destroy (distinct);
+}
+
+/* The first eight bytes of @text, big-endian, so the words of two
+ * texts order as the texts do when they differ in those bytes */
+static guint64
+get_prefix_word (const gchar *text)
+{
+    guint64 word = 0;
+    guint i;
+    
+    for (i = 0; i < 8; i++) {
+        word <<= 8;
+        if (*text != '\0') {
+            word |= (guchar) *text++;
+        }
+    }
+    return word;
+}
+
+/* Sort @order, the rows of @keys, by their keys of @n_words words, most
+ * significant first, keeping the order of rows with equal keys.  Every
+ * byte of a key is counted in one pass first, and bytes that are the
+ * same in all keys, as most high bytes of sizes and dates are, are not
+ * sorted on. */
+static void
+radix_sort (const guint64 *keys, guint n_words, guint32 *order, guint n_rows)
+{
+    guint n_digits = n_words * 8;
+    guint32 *counts = g_new0 (guint32, (gsize) n_digits * 256);
+    guint32 *scratch = g_new (guint32, n_rows);
+    guint32 *from = order;
+    guint32 *to = scratch;
+    guint32 offsets[256];
+    gint digit;
+    guint i, w, b;
+    
+    /* counts[(w * 8 + b) * 256 + v]: keys whose word w has v in byte b,
+     * counting bytes from the least significant */
+    for (i = 0; i < n_rows; i++) {
+        const guint64 *key = keys + (gsize) i * n_words;
+        
+        for (w = 0; w < n_words; w++) {
+            guint32 *word_counts = counts + (gsize) w * 8 * 256;
+            guint64 value = key[w];
+            
+            for (b = 0; b < 8; b++) {
+                word_counts[b * 256 + (value & 0xff)]++;
+                value >>= 8;
+            }
+        }
+    }
+    
+    /* From the least significant byte of the last word */
+    for (digit = n_digits - 1; digit >= 0; digit--) {
+        guint word = digit / 8;
+        guint byte = 7 - digit % 8;
+        const guint32 *digit_counts = counts + ((gsize) word * 8 + byte) * 256;
+        guint32 sum = 0;
+        guint32 *swap;
+        
+        for (i = 0; i < 256; i++) {
+            if (digit_counts[i] == n_rows) {
+                break;
+            }
+            offsets[i] = sum;
+            sum += digit_counts[i];
+        }
+        if (i < 256) {
+            continue;
+        }
+        
+        for (i = 0; i < n_rows; i++) {
+            guint32 row = from[i];
+            guint value = (keys[(gsize) row * n_words + word] >> (byte * 8)) & 0xff;
+            
+            to[offsets[value]++] = row;
+        }
+        swap = from;
+        from = to;
+        to = swap;
+    }
+    
+    if (from != order) {
+        memcpy (order, from, n_rows * sizeof (guint32));
+    }
+    
+    g_free (counts);
+    g_free (scratch);
+}
+
+static gint
+compare_rows_by_name (gconstpointer a, gconstpointer b, gpointer user_data)
+{
+    const gchar **names = user_data;
+    guint32 row_a = *(const guint32 *) a;
+    guint32 row_b = *(const guint32 *) b;
+    gint result = strcmp (names[row_a], names[row_b]);
+    
+    if (result != 0) {
+        return result;
+    }
+    return row_a < row_b ? -1 : row_a > row_b;
+}
+
+/* Put runs of rows with equal keys, whose names share their first eight
+ * bytes, in order by their full names, keeping the order of rows whose
+ * names are equal too */
+static void
+sort_equal_keys (const guint64 *keys,
+                 guint n_words,
+                 const gchar **names,
+                 guint32 *order,
+                 guint n_rows)
+{
+    guint start = 0;
+    guint i;
+    
+    for (i = 1; i <= n_rows; i++) {
+        if (i < n_rows &&
+            memcmp (keys + (gsize) order[start] * n_words,
+                    keys + (gsize) order[i] * n_words,
+                    n_words * sizeof (guint64)) == 0) {
+            continue;
+        }
+        if (i - start > 1) {
+            g_qsort_with_data (order + start, i - start, sizeof (guint32),
+                               compare_rows_by_name, names);
+        }
+        start = i;
+    }
+}
+
+void
+finderz_sorting_profile_sort_files (FinderzSortingProfile *profile,
+                                    GPtrArray *files)
+{
+    SortPlan plan;
+    guint n_rows;
+    guint64 *keys;
+    const gchar **names;
+    gchar **owned_names;
+    const gchar **texts = NULL;
+    guint32 *order;
+    gpointer *sorted;
+    guint i, level;
+    
+    g_return_if_fail (profile != NULL);
+    g_return_if_fail (files != NULL);
+    
+    n_rows = files->len;
+    if (n_rows < 2) {
+        return;
+    }
+    
+    compile_plan (profile, &plan);
+    keys = g_new (guint64, (gsize) n_rows * plan.n_words);
+    names = g_new (const gchar *, n_rows);
+    owned_names = g_new (gchar *, n_rows);
+    
+    for (i = 0; i < n_rows; i++) {
+        NemoFile *file = g_ptr_array_index (files, i);
+        guint64 *key = keys + (gsize) i * plan.n_words;
+        
+        key[0] = profile->folders_first && !nemo_file_is_directory (file);
+        names[i] = get_name_key (profile, file, &owned_names[i]);
+        key[plan.n_words - 1] = get_prefix_word (names[i]);
+    }
+    
+    for (level = 0; level < plan.n_levels; level++) {
+        FinderzSortCriteria criteria = plan.criteria[level];
+        guint word = level + 1;
+        
+        if (criteria == FINDERZ_SORT_BY_NAME) {
+            rank_texts (names, n_rows, criteria, keys, plan.n_words, word);
+        } else if (criteria_is_text (criteria)) {
+            if (texts == NULL) {
+                texts = g_new (const gchar *, n_rows);
+            }
+            for (i = 0; i < n_rows; i++) {
+                texts[i] = get_text_key (g_ptr_array_index (files, i), criteria);
+            }
+            rank_repeated_texts (texts, n_rows, criteria, keys, plan.n_words, word);
+        } else {
+            for (i = 0; i < n_rows; i++) {
+                keys[(gsize) i * plan.n_words + word] =
+                    get_number_key (g_ptr_array_index (files, i), criteria);
+            }
+        }
+        
+        if (plan.descending[level]) {
+            for (i = 0; i < n_rows; i++) {
+                keys[(gsize) i * plan.n_words + word] ^= G_MAXUINT64;
+            }
+        }
+    }
+    
+    order = g_new (guint32, n_rows);
+    for (i = 0; i < n_rows; i++) {
+        order[i] = i;
+    }
+    radix_sort (keys, plan.n_words, order, n_rows);
+    sort_equal_keys (keys, plan.n_words, names, order, n_rows);
+    
+    sorted = g_new (gpointer, n_rows);
+    for (i = 0; i < n_rows; i++) {
+        sorted[i] = files->pdata[order[i]];
+    }
+    memcpy (files->pdata, sorted, n_rows * sizeof (gpointer));
+    
+    for (i = 0; i < n_rows; i++) {
+        g_free (owned_names[i]);
+    }
+    g_free (sorted);
+    g_free (order);
+    g_free (texts);
+    g_free (owned_names);
+    g_free (names);
+    g_free (keys);
+}
+
+static GQuark
+file_sort_key_quark (void)
+{
+    static GQuark quark = 0;
+    
+    if (quark == 0) {
+        quark = g_quark_from_static_string ("finderz-sort-key");
+    }
+    return quark;
+}
+
+static void
+file_sort_key_free (gpointer data)
+{
+    FileSortKey *key = data;
+    guint level;
+    
+    for (level = 0; level < SORT_MAX_LEVELS; level++) {
+        g_free (key->texts[level]);
+    }
+    g_free (key->name);
+    g_free (key);
+}
+
+/* The key of @file under @profile, built on first use and kept on the
+ * file until it changes or is compared under another profile */
+static FileSortKey*
+get_file_sort_key (FinderzSortingProfile *profile, const SortPlan *plan, NemoFile *file)
+{
+    FileSortKey *key;
+    const gchar *name;
+    gchar *owned;
+    guint level;
+    
+    key = g_object_get_qdata (G_OBJECT (file), file_sort_key_quark ());
+    if (key != NULL && key->profile == profile) {
+        return key;
+    }
+    
+    key = g_new0 (FileSortKey, 1);
+    key->profile = profile;
+    key->is_file = !nemo_file_is_directory (file);
+    
+    name = get_name_key (profile, file, &owned);
+    key->name = owned != NULL ? owned : g_strdup (name);
+    key->words[plan->n_levels] = get_prefix_word (key->name);
+    
+    for (level = 0; level < plan->n_levels; level++) {
+        FinderzSortCriteria criteria = plan->criteria[level];
+        
+        if (criteria == FINDERZ_SORT_BY_NAME) {
+            key->words[level] = key->words[plan->n_levels];
+        } else if (criteria_is_text (criteria)) {
+            const gchar *text = get_text_key (file, criteria);
+            
+            if (text == NULL) {
+                continue;
+            }
+            /* Extensions ignore case, so keep them folded */
+            key->texts[level] = criteria == FINDERZ_SORT_BY_EXTENSION ?
+                                g_ascii_strdown (text, -1) : g_strdup (text);
+            key->words[level] = get_prefix_word (key->texts[level]);
+        } else {
+            key->words[level] = get_number_key (file, criteria);
+        }
+    }
+    
+    g_object_set_qdata_full (G_OBJECT (file), file_sort_key_quark (),
+                             key, file_sort_key_free);
+    file_sort_keys_kept = TRUE;
+    return key;
+}
+
+gint
+finderz_sorting_profile_compare_files (FinderzSortingProfile *profile,
+                                       NemoFile *file1,
+                                       NemoFile *file2)
+{
+    SortPlan plan;
+    FileSortKey *key1, *key2;
+    gint result = 0;
+    guint level;
+    
+    g_return_val_if_fail (profile != NULL, 0);
+    
+    compile_plan (profile, &plan);
+    key1 = get_file_sort_key (profile, &plan, file1);
+    key2 = get_file_sort_key (profile, &plan, file2);
+    
+    if (profile->folders_first && key1->is_file != key2->is_file) {
+        return key1->is_file ? 1 : -1;
+    }
+    
+    for (level = 0; level < plan.n_levels && result == 0; level++) {
+        FinderzSortCriteria criteria = plan.criteria[level];
+        
+        if (key1->words[level] != key2->words[level]) {
+            result = key1->words[level] < key2->words[level] ? -1 : 1;
+        } else if (criteria == FINDERZ_SORT_BY_NAME) {
+            result = strcmp (key1->name, key2->name);
+        } else if (criteria_is_text (criteria)) {
+            result = compare_text (criteria, key1->texts[level], key2->texts[level]);
+        }
+        if (plan.descending[level]) {
+            result = -result;
+        }
+    }
+    
+    if (result == 0) {
+        if (key1->words[plan.n_levels] != key2->words[plan.n_levels]) {
+            result = key1->words[plan.n_levels] < key2->words[plan.n_levels] ? -1 : 1;
+        } else {
+            result = strcmp (key1->name, key2->name);
+        }
+    }
+    
+    return result < 0 ? -1 : result > 0;
+}
+
+void
+finderz_sorting_profile_file_changed (NemoFile *file)
+{
+    if (file_sort_keys_kept) {
+        g_object_set_qdata (G_OBJECT (file), file_sort_key_quark (), NULL);
+    }
+}
+
+gboolean
+finderz_sorting_profile_needs_metadata (FinderzSortingProfile *profile)
+{
+    SortPlan plan;
+    guint level;
+    
+    g_return_val_if_fail (profile != NULL, FALSE);
+    
+    if (profile->grouping_type == FINDERZ_GROUP_BY_TAGS ||
+        profile->grouping_type == FINDERZ_GROUP_BY_COLOR_LABEL) {
+        return TRUE;
+    }
+    compile_plan (profile, &plan);
+    for (level = 0; level < plan.n_levels; level++) {
+        if (plan.criteria[level] == FINDERZ_SORT_BY_COLOR_LABEL ||
+            plan.criteria[level] == FINDERZ_SORT_BY_TAGS) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+FinderzSortingProfile*
+finderz_sorting_profile_new (const gchar *name)
+{
+    FinderzSortingProfile *profile = g_new0 (FinderzSortingProfile, 1);
+    
+    profile->name = g_strdup (name);
+    profile->grouping_type = FINDERZ_GROUP_NONE;
+    profile->show_groups_expanded = TRUE;
+    profile->folders_first = TRUE;
+    profile->natural_sorting = TRUE;
+    return profile;
+}
+
+static void
+size_range_free (gpointer data)
+{
+    FinderzSizeRange *range = data;
+    
+    g_free (range->name);
+    g_free (range);
+}
+
+void
+finderz_sorting_profile_free (FinderzSortingProfile *profile)
+{
+    if (profile == NULL) {
+        return;
+    }
+    
+    g_free (profile->name);
+    g_free (profile->description);
+    g_list_free_full (profile->sort_levels, g_free);
+    g_list_free_full (profile->custom_size_ranges, size_range_free);
+    g_list_free (profile->custom_date_ranges);
+    g_free (profile);
+}
+
+static void
+add_sort_level (FinderzSortingProfile *profile,
+                FinderzSortCriteria criteria,
+                FinderzSortDirection direction)
+{
+    FinderzSortLevel *level = g_new (FinderzSortLevel, 1);
+    
+    level->criteria = criteria;
+    level->direction = direction;
+    profile->sort_levels = g_list_append (profile->sort_levels, level);
+}
+
+static void
+add_size_range (FinderzSortingProfile *profile,
+                const gchar *name,
+                gint64 min_size,
+                gint64 max_size)
+{
+    FinderzSizeRange *range = g_new (FinderzSizeRange, 1);
+    
+    range->name = g_strdup (name);
+    range->min_size = min_size;
+    range->max_size = max_size;
+    profile->custom_size_ranges = g_list_append (profile->custom_size_ranges, range);
+}
+
+FinderzSortingProfile*
+finderz_sorting_profile_copy (FinderzSortingProfile *profile)
+{
+    FinderzSortingProfile *copy;
+    GList *l;
+    
+    g_return_val_if_fail (profile != NULL, NULL);
+    
+    copy = finderz_sorting_profile_new (profile->name);
+    copy->description = g_strdup (profile->description);
+    copy->is_default = profile->is_default;
+    copy->grouping_type = profile->grouping_type;
+    copy->show_groups_expanded = profile->show_groups_expanded;
+    copy->folders_first = profile->folders_first;
+    copy->show_hidden_files = profile->show_hidden_files;
+    copy->case_sensitive = profile->case_sensitive;
+    copy->natural_sorting = profile->natural_sorting;
+    
+    for (l = profile->sort_levels; l != NULL; l = l->next) {
+        FinderzSortLevel *level = l->data;
+        
+        add_sort_level (copy, level->criteria, level->direction);
+    }
+    for (l = profile->custom_size_ranges; l != NULL; l = l->next) {
+        FinderzSizeRange *range = l->data;
+        
+        add_size_range (copy, range->name, range->min_size, range->max_size);
+    }
+    return copy;
+}
+
+/* A directory in the tree of those given a profile, or above one */
+struct _FinderzProfileNode {
+    GHashTable *children;   /* path component -> FinderzProfileNode */
+    gchar *profile_name;    /* NULL when inherited */
+};
+
+/* Generations of every manager's profiles, so a directory's memo can
+ * tell whether it is still good whichever manager made it */
+static guint profiles_generation = 0;
+
+static void
+profiles_changed (FinderzSortingProfileManager *manager)
+{
+    manager->generation = (guint) g_atomic_int_add (&profiles_generation, 1) + 1;
+}
+
+static FinderzProfileNode*
+profile_node_new (void)
+{
+    return g_new0 (FinderzProfileNode, 1);
+}
+
+static void
+profile_node_free (gpointer data)
+{
+    FinderzProfileNode *node = data;
+    
+    if (node->children != NULL) {
+        g_hash_table_destroy (node->children);
+    }
+    g_free (node->profile_name);
+    g_free (node);
+}
+
+/* The component of @path after any slashes, as *@start and *@length;
+ * returns what follows it, or NULL when there is none */
+static const gchar*
+next_component (const gchar *path, const gchar **start, gsize *length)
+{
+    while (*path == '/') {
+        path++;
+    }
+    if (*path == '\0') {
+        return NULL;
+    }
+    
+    *start = path;
+    *length = strcspn (path, "/");
+    return path + *length;
+}
+
+static FinderzProfileNode*
+lookup_child (FinderzProfileNode *node, const gchar *start, gsize length)
+{
+    gchar buffer[256];
+    FinderzProfileNode *child;
+    gchar *component;
+    
+    if (node->children == NULL) {
+        return NULL;
+    }
+    if (length < sizeof (buffer)) {
+        memcpy (buffer, start, length);
+        buffer[length] = '\0';
+        return g_hash_table_lookup (node->children, buffer);
+    }
+    
+    component = g_strndup (start, length);
+    child = g_hash_table_lookup (node->children, component);
+    g_free (component);
+    return child;
+}
+
+static void
+set_path (FinderzProfileNode *node, const gchar *path, const gchar *profile_name)
+{
+    const gchar *start;
+    gsize length;
+    
+    while ((path = next_component (path, &start, &length)) != NULL) {
+        FinderzProfileNode *child = lookup_child (node, start, length);
+        
+        if (child == NULL) {
+            if (node->children == NULL) {
+                node->children = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                        g_free, profile_node_free);
+            }
+            child = profile_node_new ();
+            g_hash_table_insert (node->children, g_strndup (start, length), child);
+        }
+        node = child;
+    }
+    
+    g_free (node->profile_name);
+    node->profile_name = g_strdup (profile_name);
+}
+
+/* Clear the profile of @path below @node, dropping the directories left
+ * with nothing under them; whether @node is left so */
+static gboolean
+clear_path (FinderzProfileNode *node, const gchar *path)
+{
+    FinderzProfileNode *child;
+    const gchar *start, *rest;
+    gsize length;
+    
+    rest = next_component (path, &start, &length);
+    if (rest == NULL) {
+        g_clear_pointer (&node->profile_name, g_free);
+    } else {
+        child = lookup_child (node, start, length);
+        if (child != NULL && clear_path (child, rest)) {
+            gchar *component = g_strndup (start, length);
+            
+            g_hash_table_remove (node->children, component);
+            g_free (component);
+        }
+    }
+    
+    return node->profile_name == NULL &&
+           (node->children == NULL || g_hash_table_size (node->children) == 0);
+}
+
+/* The name of the profile given to @path or the nearest directory above
+ * it, one lookup per component of the path */
+static const gchar*
+resolve_profile_name (FinderzSortingProfileManager *manager, const gchar *path)
+{
+    FinderzProfileNode *node = manager->directory_tree;
+    const gchar *profile_name = node->profile_name;
+    const gchar *start;
+    gsize length;
+    
+    while ((path = next_component (path, &start, &length)) != NULL) {
+        node = lookup_child (node, start, length);
+        if (node == NULL) {
+            break;
+        }
+        if (node->profile_name != NULL) {
+            profile_name = node->profile_name;
+        }
+    }
+    return profile_name;
+}
+
+FinderzSortingProfileManager*
+finderz_sorting_profile_manager_new (void)
+{
+    FinderzSortingProfileManager *manager = g_new0 (FinderzSortingProfileManager, 1);
+    
+    manager->directory_profiles = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                         g_free, g_free);
+    manager->directory_tree = profile_node_new ();
+    profiles_changed (manager);
+    return manager;
+}
+
+void
+finderz_sorting_profile_manager_free (FinderzSortingProfileManager *manager)
+{
+    if (manager == NULL) {
+        return;
+    }
+    
+    g_list_free_full (manager->profiles, (GDestroyNotify) finderz_sorting_profile_free);
+    g_hash_table_destroy (manager->directory_profiles);
+    profile_node_free (manager->directory_tree);
+    g_free (manager);
+}
+
+static GList*
+find_profile_link (FinderzSortingProfileManager *manager, const gchar *profile_name)
+{
+    GList *l;
+    
+    for (l = manager->profiles; l != NULL; l = l->next) {
+        FinderzSortingProfile *profile = l->data;
+        
+        if (g_strcmp0 (profile->name, profile_name) == 0) {
+            return l;
+        }
+    }
+    return NULL;
+}
+
+/* Takes @profile; one with the same name is replaced */
+void
+finderz_sorting_profile_manager_add_profile (FinderzSortingProfileManager *manager,
+                                             FinderzSortingProfile *profile)
+{
+    GList *link;
+    
+    g_return_if_fail (manager != NULL);
+    g_return_if_fail (profile != NULL && profile->name != NULL);
+    
+    profiles_changed (manager);
+    
+    link = find_profile_link (manager, profile->name);
+    if (link == NULL) {
+        manager->profiles = g_list_append (manager->profiles, profile);
+        return;
+    }
+    
+    if (manager->active_profile == link->data) {
+        manager->active_profile = profile;
+    }
+    finderz_sorting_profile_free (link->data);
+    link->data = profile;
+}
+
+void
+finderz_sorting_profile_manager_remove_profile (FinderzSortingProfileManager *manager,
+                                                const gchar *profile_name)
+{
+    GList *link;
+    
+    g_return_if_fail (manager != NULL);
+    
+    link = find_profile_link (manager, profile_name);
+    if (link == NULL) {
+        return;
+    }
+    
+    profiles_changed (manager);
+    if (manager->active_profile == link->data) {
+        manager->active_profile = NULL;
+    }
+    finderz_sorting_profile_free (link->data);
+    manager->profiles = g_list_delete_link (manager->profiles, link);
+}
+
+FinderzSortingProfile*
+finderz_sorting_profile_manager_get_profile (FinderzSortingProfileManager *manager,
+                                             const gchar *profile_name)
+{
+    GList *link;
+    
+    g_return_val_if_fail (manager != NULL, NULL);
+    
+    link = find_profile_link (manager, profile_name);
+    return link != NULL ? link->data : NULL;
+}
+
+void
+finderz_sorting_profile_manager_set_active_profile (FinderzSortingProfileManager *manager,
+                                                    const gchar *profile_name)
+{
+    g_return_if_fail (manager != NULL);
+    
+    profiles_changed (manager);
+    manager->active_profile = finderz_sorting_profile_manager_get_profile (manager, profile_name);
+}
+
+/* The active profile, or else the one marked default, or else none */
+FinderzSortingProfile*
+finderz_sorting_profile_manager_get_active_profile (FinderzSortingProfileManager *manager)
+{
+    GList *l;
+    
+    g_return_val_if_fail (manager != NULL, NULL);
+    
+    if (manager->active_profile != NULL) {
+        return manager->active_profile;
+    }
+    for (l = manager->profiles; l != NULL; l = l->next) {
+        FinderzSortingProfile *profile = l->data;
+        
+        if (profile->is_default) {
+            return profile;
+        }
+    }
+    return NULL;
+}
+
+/* A NULL @profile_name clears the directory's profile, so it inherits
+ * one again */
+void
+finderz_sorting_profile_manager_set_directory_profile (FinderzSortingProfileManager *manager,
+                                                       const gchar *directory_path,
+                                                       const gchar *profile_name)
+{
+    g_return_if_fail (manager != NULL);
+    g_return_if_fail (directory_path != NULL);
+    
+    profiles_changed (manager);
+    if (profile_name == NULL) {
+        g_hash_table_remove (manager->directory_profiles, directory_path);
+        clear_path (manager->directory_tree, directory_path);
+    } else {
+        g_hash_table_replace (manager->directory_profiles,
+                              g_strdup (directory_path), g_strdup (profile_name));
+        set_path (manager->directory_tree, directory_path, profile_name);
+    }
+}
+
+FinderzSortingProfile*
+finderz_sorting_profile_manager_get_directory_profile (FinderzSortingProfileManager *manager,
+                                                       const gchar *directory_path)
+{
+    const gchar *profile_name;
+    
+    g_return_val_if_fail (manager != NULL, NULL);
+    
+    if (directory_path == NULL) {
+        return NULL;
+    }
+    profile_name = resolve_profile_name (manager, directory_path);
+    if (profile_name == NULL) {
+        return NULL;
+    }
+    return finderz_sorting_profile_manager_get_profile (manager, profile_name);
+}
+
+typedef struct {
+    guint generation;
+    FinderzSortingProfile *profile;
+} ResolvedProfile;
+
+FinderzSortingProfile*
+finderz_sorting_profile_manager_get_profile_for_directory (FinderzSortingProfileManager *manager,
+                                                           NemoDirectory *directory)
+{
+    static GQuark resolved_quark = 0;
+    ResolvedProfile *resolved;
+    GFile *location;
+    gchar *path;
+    
+    g_return_val_if_fail (manager != NULL, NULL);
+    g_return_val_if_fail (directory != NULL, NULL);
+    
+    if (resolved_quark == 0) {
+        resolved_quark = g_quark_from_static_string ("finderz-sorting-profile");
+    }
+    
+    resolved = g_object_get_qdata (G_OBJECT (directory), resolved_quark);
+    if (resolved != NULL && resolved->generation == manager->generation) {
+        return resolved->profile;
+    }
+    
+    if (resolved == NULL) {
+        resolved = g_new0 (ResolvedProfile, 1);
+        g_object_set_qdata_full (G_OBJECT (directory), resolved_quark, resolved, g_free);
+    }
+    
+    location = nemo_directory_get_location (directory);
+    path = g_file_get_path (location);
+    if (path == NULL) {
+        path = g_file_get_uri (location);
+    }
+    resolved->profile = finderz_sorting_profile_manager_get_directory_profile (manager, path);
+    if (resolved->profile == NULL) {
+        resolved->profile = finderz_sorting_profile_manager_get_active_profile (manager);
+    }
+    resolved->generation = manager->generation;
+    
+    g_free (path);
+    g_object_unref (location);
+    return resolved->profile;
+}
+
+/* Profile files: a header, then arrays of size ranges, profiles, sort
+ * levels and directories, then a pool of strings they point into by
+ * offset.  Every array starts 8-byte aligned, so the file is read in
+ * place once mapped. */
+
+#define PROFILES_MAGIC "FZSP"
+#define PROFILES_VERSION 1
+#define NO_STRING G_MAXUINT32
+
+enum {
+    PROFILE_FLAG_DEFAULT = 1 << 0,
+    PROFILE_FLAG_GROUPS_EXPANDED = 1 << 1,
+    PROFILE_FLAG_FOLDERS_FIRST = 1 << 2,
+    PROFILE_FLAG_SHOW_HIDDEN = 1 << 3,
+    PROFILE_FLAG_CASE_SENSITIVE = 1 << 4,
+    PROFILE_FLAG_NATURAL_SORTING = 1 << 5
+};
+
+typedef struct {
+    gchar magic[4];
+    guint32 version;
+    guint32 n_profiles;
+    guint32 n_levels;
+    guint32 n_ranges;
+    guint32 n_directories;
+    guint32 strings_size;
+    guint32 active;
+} ProfilesHeader;
+
+typedef struct {
+    gint64 min_size;
+    gint64 max_size;
+    guint32 name;
+    guint32 reserved;
+} ProfilesRange;
+
+typedef struct {
+    guint32 name;
+    guint32 description;
+    guint32 first_level;
+    guint32 n_levels;
+    guint32 first_range;
+    guint32 n_ranges;
+    guint32 grouping;
+    guint32 flags;
+} ProfilesProfile;
+
+typedef struct {
+    guint32 criteria;
+    guint32 direction;
+} ProfilesLevel;
+
+typedef struct {
+    guint32 path;
+    guint32 profile;
+} ProfilesDirectory;
+
+static guint32
+add_string (GByteArray *strings, GHashTable *offsets, const gchar *string)
+{
+    gpointer offset;
+    guint32 result;
+    
+    if (string == NULL) {
+        return NO_STRING;
+    }
+    if (g_hash_table_lookup_extended (offsets, string, NULL, &offset)) {
+        return GPOINTER_TO_UINT (offset);
+    }
+    
+    result = strings->len;
+    g_byte_array_append (strings, (const guint8 *) string, strlen (string) + 1);
+    g_hash_table_insert (offsets, (gpointer) string, GUINT_TO_POINTER (result));
+    return result;
+}
+
+gboolean
+finderz_sorting_profile_manager_save_profiles (FinderzSortingProfileManager *manager,
+                                               const gchar *config_file,
+                                               GError **error)
+{
+    ProfilesHeader header;
+    GArray *ranges, *profiles, *levels, *directories;
+    GByteArray *strings, *contents;
+    GHashTable *offsets;
+    GHashTableIter iter;
+    gpointer path, profile_name;
+    gchar *directory;
+    GList *l, *m;
+    gboolean result;
+    
+    g_return_val_if_fail (manager != NULL, FALSE);
+    g_return_val_if_fail (config_file != NULL, FALSE);
+    
+    ranges = g_array_new (FALSE, TRUE, sizeof (ProfilesRange));
+    profiles = g_array_new (FALSE, TRUE, sizeof (ProfilesProfile));
+    levels = g_array_new (FALSE, TRUE, sizeof (ProfilesLevel));
+    directories = g_array_new (FALSE, TRUE, sizeof (ProfilesDirectory));
+    strings = g_byte_array_new ();
+    offsets = g_hash_table_new (g_str_hash, g_str_equal);
+    
+    for (l = manager->profiles; l != NULL; l = l->next) {
+        FinderzSortingProfile *profile = l->data;
+        ProfilesProfile record = { 0 };
+        
+        record.name = add_string (strings, offsets, profile->name);
+        record.description = add_string (strings, offsets, profile->description);
+        record.first_level = levels->len;
+        record.first_range = ranges->len;
+        record.grouping = profile->grouping_type;
+        record.flags = (profile->is_default ? PROFILE_FLAG_DEFAULT : 0) |
+                       (profile->show_groups_expanded ? PROFILE_FLAG_GROUPS_EXPANDED : 0) |
+                       (profile->folders_first ? PROFILE_FLAG_FOLDERS_FIRST : 0) |
+                       (profile->show_hidden_files ? PROFILE_FLAG_SHOW_HIDDEN : 0) |
+                       (profile->case_sensitive ? PROFILE_FLAG_CASE_SENSITIVE : 0) |
+                       (profile->natural_sorting ? PROFILE_FLAG_NATURAL_SORTING : 0);
+        
+        for (m = profile->sort_levels; m != NULL; m = m->next) {
+            FinderzSortLevel *level = m->data;
+            ProfilesLevel level_record = { level->criteria, level->direction };
+            
+            g_array_append_val (levels, level_record);
+        }
+        for (m = profile->custom_size_ranges; m != NULL; m = m->next) {
+            FinderzSizeRange *range = m->data;
+            ProfilesRange range_record = { range->min_size, range->max_size, 0, 0 };
+            
+            range_record.name = add_string (strings, offsets, range->name);
+            g_array_append_val (ranges, range_record);
+        }
+        record.n_levels = levels->len - record.first_level;
+        record.n_ranges = ranges->len - record.first_range;
+        g_array_append_val (profiles, record);
+    }
+    
+    g_hash_table_iter_init (&iter, manager->directory_profiles);
+    while (g_hash_table_iter_next (&iter, &path, &profile_name)) {
+        ProfilesDirectory record;
+        
+        record.path = add_string (strings, offsets, path);
+        record.profile = add_string (strings, offsets, profile_name);
+        g_array_append_val (directories, record);
+    }
+    
+    memset (&header, 0, sizeof (header));
+    memcpy (header.magic, PROFILES_MAGIC, 4);
+    header.version = PROFILES_VERSION;
+    header.n_profiles = profiles->len;
+    header.n_levels = levels->len;
+    header.n_ranges = ranges->len;
+    header.n_directories = directories->len;
+    header.active = manager->active_profile != NULL ?
+                    add_string (strings, offsets, manager->active_profile->name) : NO_STRING;
+    header.strings_size = strings->len;
+    
+    contents = g_byte_array_new ();
+    g_byte_array_append (contents, (const guint8 *) &header, sizeof (header));
+    g_byte_array_append (contents, (const guint8 *) ranges->data, ranges->len * sizeof (ProfilesRange));
+    g_byte_array_append (contents, (const guint8 *) profiles->data, profiles->len * sizeof (ProfilesProfile));
+    g_byte_array_append (contents, (const guint8 *) levels->data, levels->len * sizeof (ProfilesLevel));
+    g_byte_array_append (contents, (const guint8 *) directories->data,
+                         directories->len * sizeof (ProfilesDirectory));
+    g_byte_array_append (contents, strings->data, strings->len);
+    
+    /* Written to a temporary file and renamed, so a reader maps either
+     * the old file or the new one */
+    directory = g_path_get_dirname (config_file);
+    g_mkdir_with_parents (directory, 0700);
+    g_free (directory);
+    result = g_file_set_contents (config_file, (const gchar *) contents->data,
+                                  contents->len, error);
+    
+    g_byte_array_unref (contents);
+    g_hash_table_destroy (offsets);
+    g_byte_array_unref (strings);
+    g_array_unref (directories);
+    g_array_unref (levels);
+    g_array_unref (profiles);
+    g_array_unref (ranges);
+    return result;
+}
+
+/* Pointers into a mapped profiles file */
+typedef struct {
+    const ProfilesHeader *header;
+    const ProfilesRange *ranges;
+    const ProfilesProfile *profiles;
+    const ProfilesLevel *levels;
+    const ProfilesDirectory *directories;
+    const gchar *strings;
+} ProfilesLayout;
+
+static gboolean
+map_layout (const guint8 *data, gsize length, ProfilesLayout *layout)
+{
+    const ProfilesHeader *header = (const ProfilesHeader *) data;
+    guint64 offset = sizeof (ProfilesHeader);
+    
+    if (length < sizeof (ProfilesHeader) ||
+        memcmp (header->magic, PROFILES_MAGIC, 4) != 0 ||
+        header->version != PROFILES_VERSION) {
+        return FALSE;
+    }
+    
+    layout->header = header;
+    layout->ranges = (const ProfilesRange *) (data + offset);
+    offset += (guint64) header->n_ranges * sizeof (ProfilesRange);
+    layout->profiles = (const ProfilesProfile *) (data + MIN (offset, length));
+    offset += (guint64) header->n_profiles * sizeof (ProfilesProfile);
+    layout->levels = (const ProfilesLevel *) (data + MIN (offset, length));
+    offset += (guint64) header->n_levels * sizeof (ProfilesLevel);
+    layout->directories = (const ProfilesDirectory *) (data + MIN (offset, length));
+    offset += (guint64) header->n_directories * sizeof (ProfilesDirectory);
+    layout->strings = (const gchar *) (data + MIN (offset, length));
+    offset += header->strings_size;
+    
+    return offset <= length &&
+           (header->strings_size == 0 || layout->strings[header->strings_size - 1] == '\0');
+}
+
+/* A string of @layout, NULL for none; *@valid is cleared when the
+ * offset is out of the pool */
+static const gchar*
+get_string (const ProfilesLayout *layout, guint32 offset, gboolean *valid)
+{
+    if (offset == NO_STRING) {
+        return NULL;
+    }
+    if (offset >= layout->header->strings_size) {
+        *valid = FALSE;
+        return NULL;
+    }
+    return layout->strings + offset;
+}
+
+static FinderzSortingProfile*
+read_profile (const ProfilesLayout *layout, const ProfilesProfile *record, gboolean *valid)
+{
+    const ProfilesHeader *header = layout->header;
+    FinderzSortingProfile *profile;
+    const gchar *name;
+    guint i;
+    
+    name = get_string (layout, record->name, valid);
+    if (name == NULL ||
+        (guint64) record->first_level + record->n_levels > header->n_levels ||
+        (guint64) record->first_range + record->n_ranges > header->n_ranges ||
+        record->grouping > FINDERZ_GROUP_CUSTOM) {
+        *valid = FALSE;
+        return NULL;
+    }
+    
+    profile = finderz_sorting_profile_new (name);
+    profile->description = g_strdup (get_string (layout, record->description, valid));
+    profile->grouping_type = record->grouping;
+    profile->is_default = (record->flags & PROFILE_FLAG_DEFAULT) != 0;
+    profile->show_groups_expanded = (record->flags & PROFILE_FLAG_GROUPS_EXPANDED) != 0;
+    profile->folders_first = (record->flags & PROFILE_FLAG_FOLDERS_FIRST) != 0;
+    profile->show_hidden_files = (record->flags & PROFILE_FLAG_SHOW_HIDDEN) != 0;
+    profile->case_sensitive = (record->flags & PROFILE_FLAG_CASE_SENSITIVE) != 0;
+    profile->natural_sorting = (record->flags & PROFILE_FLAG_NATURAL_SORTING) != 0;
+    
+    for (i = 0; i < record->n_levels; i++) {
+        const ProfilesLevel *level = &layout->levels[record->first_level + i];
+        
+        if (level->criteria > FINDERZ_SORT_BY_TAGS || level->direction > FINDERZ_SORT_DESCENDING) {
+            *valid = FALSE;
+            break;
+        }
+        add_sort_level (profile, level->criteria, level->direction);
+    }
+    for (i = 0; i < record->n_ranges; i++) {
+        const ProfilesRange *range = &layout->ranges[record->first_range + i];
+        
+        add_size_range (profile, get_string (layout, range->name, valid),
+                        range->min_size, range->max_size);
+    }
+    
+    return profile;
+}
+
+/* Profiles from @config_file are added to the manager's, replacing those
+ * of the same names, and so are its directories.  Nothing is changed
+ * when the file is not valid. */
+gboolean
+finderz_sorting_profile_manager_load_profiles (FinderzSortingProfileManager *manager,
+                                               const gchar *config_file,
+                                               GError **error)
+{
+    GMappedFile *mapped;
+    ProfilesLayout layout;
+    GPtrArray *profiles;
+    gboolean valid;
+    guint i;
+    
+    g_return_val_if_fail (manager != NULL, FALSE);
+    g_return_val_if_fail (config_file != NULL, FALSE);
+    
+    mapped = g_mapped_file_new (config_file, FALSE, error);
+    if (mapped == NULL) {
+        return FALSE;
+    }
+    
+    valid = map_layout ((const guint8 *) g_mapped_file_get_contents (mapped),
+                        g_mapped_file_get_length (mapped), &layout);
+    
+    profiles = g_ptr_array_new_with_free_func ((GDestroyNotify) finderz_sorting_profile_free);
+    for (i = 0; valid && i < layout.header->n_profiles; i++) {
+        FinderzSortingProfile *profile = read_profile (&layout, &layout.profiles[i], &valid);
+        
+        if (profile != NULL) {
+            g_ptr_array_add (profiles, profile);
+        }
+    }
+    for (i = 0; valid && i < layout.header->n_directories; i++) {
+        const ProfilesDirectory *directory = &layout.directories[i];
+        
+        if (get_string (&layout, directory->path, &valid) == NULL ||
+            get_string (&layout, directory->profile, &valid) == NULL) {
+            valid = FALSE;
+        }
+    }
+    if (valid) {
+        get_string (&layout, layout.header->active, &valid);
+    }
+    
+    if (!valid) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                     "%s is not a valid sorting profiles file", config_file);
+        g_ptr_array_unref (profiles);
+        g_mapped_file_unref (mapped);
+        return FALSE;
+    }
+    
+    for (i = 0; i < profiles->len; i++) {
+        finderz_sorting_profile_manager_add_profile (manager, g_ptr_array_index (profiles, i));
+    }
+    /* The manager owns them now */
+    g_ptr_array_set_free_func (profiles, NULL);
+    g_ptr_array_unref (profiles);
+    
+    for (i = 0; i < layout.header->n_directories; i++) {
+        const ProfilesDirectory *directory = &layout.directories[i];
+        
+        finderz_sorting_profile_manager_set_directory_profile (manager,
+                                                               layout.strings + directory->path,
+                                                               layout.strings + directory->profile);
+    }
+    if (layout.header->active != NO_STRING) {
+        finderz_sorting_profile_manager_set_active_profile (manager,
+                                                            layout.strings + layout.header->active);
+    }
+    profiles_changed (manager);
+    
+    g_mapped_file_unref (mapped);
+    return TRUE;
+}
+
+void
+finderz_sorting_profile_manager_create_default_profiles (FinderzSortingProfileManager *manager)
+{
+    FinderzSortingProfile *profile;
+    
+    g_return_if_fail (manager != NULL);
+    
+    profile = finderz_sorting_profile_new ("Name");
+    profile->description = g_strdup ("By name, folders first");
+    profile->is_default = TRUE;
+    add_sort_level (profile, FINDERZ_SORT_BY_NAME, FINDERZ_SORT_ASCENDING);
+    finderz_sorting_profile_manager_add_profile (manager, profile);
+    
+    profile = finderz_sorting_profile_new ("Recent");
+    profile->description = g_strdup ("Most recently modified first");
+    profile->folders_first = FALSE;
+    add_sort_level (profile, FINDERZ_SORT_BY_DATE_MODIFIED, FINDERZ_SORT_DESCENDING);
+    profile->grouping_type = FINDERZ_GROUP_BY_DATE_RANGE;
+    finderz_sorting_profile_manager_add_profile (manager, profile);
+    
+    profile = finderz_sorting_profile_new ("Kind");
+    profile->description = g_strdup ("By type, then by name");
+    add_sort_level (profile, FINDERZ_SORT_BY_TYPE, FINDERZ_SORT_ASCENDING);
+    add_sort_level (profile, FINDERZ_SORT_BY_NAME, FINDERZ_SORT_ASCENDING);
+    profile->grouping_type = FINDERZ_GROUP_BY_KIND;
+    finderz_sorting_profile_manager_add_profile (manager, profile);
+    
+    profile = finderz_sorting_profile_new ("Size");
+    profile->description = g_strdup ("Largest first");
+    add_sort_level (profile, FINDERZ_SORT_BY_SIZE, FINDERZ_SORT_DESCENDING);
+    add_size_range (profile, "Small", 0, 1024 * 1024 - 1);
+    add_size_range (profile, "Medium", 1024 * 1024, 100 * 1024 * 1024 - 1);
+    add_size_range (profile, "Large", 100 * 1024 * 1024, G_MAXINT64);
+    profile->grouping_type = FINDERZ_GROUP_BY_SIZE_RANGE;
+    finderz_sorting_profile_manager_add_profile (manager, profile);
+}
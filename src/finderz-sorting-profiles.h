@@ -9,11 +9,14 @@
 
 #include <glib.h>
 #include <gio/gio.h>
+#include <libnemo-private/nemo-file.h>
+#include <libnemo-private/nemo-directory.h>
 
 G_BEGIN_DECLS
 
 typedef struct _FinderzSortingProfile FinderzSortingProfile;
 typedef struct _FinderzSortingProfileManager FinderzSortingProfileManager;
+typedef struct _FinderzProfileNode FinderzProfileNode;
 
 /* Sort criteria */
 typedef enum {
@@ -99,10 +102,11 @@ struct _FinderzSortingProfile {
 
 /* Profile manager */
 struct _FinderzSortingProfileManager {
-    GObject parent_instance;
     GList *profiles;
     FinderzSortingProfile *active_profile;
     GHashTable *directory_profiles; /* directory_path -> profile_name */
+    FinderzProfileNode *directory_tree; /* the same, by path component */
+    guint generation; /* changes whenever any profile could resolve differently */
 };
 
 /* Public functions */
@@ -127,14 +131,23 @@ void finderz_sorting_profile_manager_set_active_profile (FinderzSortingProfileMa
                                                           const gchar *profile_name);
 FinderzSortingProfile* finderz_sorting_profile_manager_get_active_profile (FinderzSortingProfileManager *manager);
 
-/* Directory-specific profiles */
+/* Directory-specific profiles.  A directory's profile holds for the
+ * directories under it too, unless they are given their own. */
 void finderz_sorting_profile_manager_set_directory_profile (FinderzSortingProfileManager *manager,
                                                              const gchar *directory_path,
                                                              const gchar *profile_name);
+/* The profile given to @directory_path or the nearest directory above
+ * it, or NULL; found in O(depth) */
 FinderzSortingProfile* finderz_sorting_profile_manager_get_directory_profile (FinderzSortingProfileManager *manager,
                                                                                const gchar *directory_path);
-
-/* Profile persistence */
+/* The profile @directory is shown with: its own or inherited one, or
+ * else the active profile.  Kept on @directory until profiles change
+ * through the manager. */
+FinderzSortingProfile* finderz_sorting_profile_manager_get_profile_for_directory (FinderzSortingProfileManager *manager,
+                                                                                   NemoDirectory *directory);
+
+/* Profile persistence, in a binary file that is mapped to be read and
+ * replaced atomically when written */
 gboolean finderz_sorting_profile_manager_save_profiles (FinderzSortingProfileManager *manager,
                                                          const gchar *config_file,
                                                          GError **error);
@@ -146,9 +159,26 @@ gboolean finderz_sorting_profile_manager_load_profiles (FinderzSortingProfileMan
 void finderz_sorting_profile_manager_create_default_profiles (FinderzSortingProfileManager *manager);
 
 /* Sorting functions */
+
+/* Sort @files, an array of NemoFile, in place.  The profile's levels
+ * are compiled into a fixed-width key for each file, which the files
+ * are radix sorted on; the sort is stable. */
+void finderz_sorting_profile_sort_files (FinderzSortingProfile *profile,
+                                         GPtrArray *files);
+
+/* The order finderz_sorting_profile_sort_files() puts two files in, for
+ * placing one file among sorted ones.  Compares a key kept on each
+ * file, so neither allocates nor reads the files once they have one. */
 gint finderz_sorting_profile_compare_files (FinderzSortingProfile *profile,
-                                             GFileInfo *file1,
-                                             GFileInfo *file2);
+                                             NemoFile *file1,
+                                             NemoFile *file2);
+
+/* Drop the key kept on @file; called whenever it changes */
+void finderz_sorting_profile_file_changed (NemoFile *file);
+
+/* Whether sorting or grouping by @profile reads file metadata, which the view then
+ * has to ask to be loaded for the whole folder */
+gboolean finderz_sorting_profile_needs_metadata (FinderzSortingProfile *profile);
 
 G_END_DECLS
 
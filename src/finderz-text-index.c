@@ -0,0 +1,1695 @@
+/* finderz-text-index.c
+ *
+ * Persistent trigram index over free-text metadata
+ *
+ * One index covers every file, under $XDG_CACHE_HOME/finderz/text-index:
+ *
+ *   text-<generation>.idx
+ *             immutable segments, memory-mapped and read in place.  A
+ *             segment holds files sorted by path, one entry per file
+ *             and field with the field's text case-folded, and for
+ *             every trigram of those texts a posting list of the
+ *             entries containing it.  Posting lists are delta-coded
+ *             varints, as entry numbers in a list only grow.  A file
+ *             with no entries records that it was removed.
+ *   text.log  texts indexed since the newest segment was written,
+ *             appended as checksummed frames and kept in memory.
+ *
+ * A file's newest record hides older ones: the log's, then the
+ * segments' from newest to oldest.  A search intersects the posting
+ * lists of the trigrams in the phrase, rarest first, and checks what
+ * is left against the stored text, so a match is exact.  Files under a
+ * directory are a range of a segment's sorted paths, so searching a
+ * folder only looks at its own entries.
+ *
+ * Every TEXT_INDEX_FLUSH_FILES files the log becomes a new segment,
+ * which absorbs the newer segments until it is smaller than half the
+ * next one, as a binary counter carries.  The segment is built and
+ * written from a snapshot without holding the index lock, so updates
+ * and searches go on meanwhile.  Each file is rewritten
+ * O(log n) times and there are O(log n) segments, while the log, which
+ * is searched by a scan, stays small.  A merge writes its segment
+ * before deleting its inputs, and a segment whose generations another
+ * covers is left over from a crash between the two.
+ */
+
+#include "finderz-text-index.h"
+#include "finderz-metadata-schema.h"
+#include <glib/gstdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEXT_INDEX_MAGIC "FZTX"
+#define TEXT_INDEX_VERSION 1
+#define TEXT_LOG_FRAME_MAGIC 0x464c5854
+
+/* Files logged before they are written out as a segment */
+#define TEXT_INDEX_FLUSH_FILES 1024
+/* Wait after a segment could not be written before trying again */
+#define TEXT_INDEX_FLUSH_RETRY_USEC (60 * G_USEC_PER_SEC)
+/* Once the candidates are this many times fewer than the bytes of the
+ * next posting list, checking them is cheaper than merging it */
+#define TEXT_INDEX_MERGE_RATIO 8
+
+#define TRIGRAM_COUNT (1 << 24)
+#define TRIGRAM(p) ((guint32)(guchar)(p)[0] << 16 | \
+                    (guint32)(guchar)(p)[1] << 8 | \
+                    (guint32)(guchar)(p)[2])
+
+#define ALIGN8(n) (((n) + 7) & ~(guint64)7)
+
+typedef struct {
+    gchar magic[4];
+    guint32 version;
+    guint64 first_generation;    /* the generations merged into it */
+    guint64 last_generation;
+    guint32 n_fields;
+    guint32 n_documents;
+    guint32 n_entries;
+    guint32 n_trigrams;
+    guint32 strings_size;
+    guint32 reserved;
+    guint64 postings_size;
+} TextIndexHeader;
+
+/* A file; its entries run up to the next document's first */
+typedef struct {
+    guint32 path;
+    guint32 first_entry;
+} TextDocument;
+
+typedef struct {
+    guint32 document;
+    guint32 field;        /* into the segment's field keys */
+    guint32 text;
+} TextEntry;
+
+/* Its posting list runs up to the next trigram's offset */
+typedef struct {
+    guint32 trigram;
+    guint32 reserved;
+    guint64 offset;
+} TextTrigram;
+
+/* Section offsets; every section starts 8-byte aligned */
+typedef struct {
+    guint64 fields;
+    guint64 documents;
+    guint64 entries;
+    guint64 trigrams;
+    guint64 postings;
+    guint64 strings;
+    guint64 total;
+} TextOffsets;
+
+typedef struct {
+    gchar *path;
+    GMappedFile *mapped;
+    const TextIndexHeader *header;
+    const guint32 *fields;
+    const TextDocument *documents;
+    const TextEntry *entries;
+    const TextTrigram *trigrams;
+    const guint8 *postings;
+    const gchar *strings;
+    FinderzFieldId *field_ids;    /* segment field -> schema id */
+} TextSegment;
+
+/* One field of a file, folded for matching */
+typedef struct {
+    FinderzFieldId field;
+    gchar *text;
+} TextValue;
+
+typedef struct {
+    guint32 magic;
+    guint32 length;
+    guint32 checksum;
+} TextLogFrameHeader;
+
+/* Free-text fields worth searching by phrase */
+static const FinderzFieldId indexed_fields[] = {
+    FINDERZ_FIELD_AI_PROMPT,
+    FINDERZ_FIELD_AI_NEGATIVE_PROMPT,
+    FINDERZ_FIELD_KEYWORDS,
+    FINDERZ_FIELD_MEDIA_TITLE,
+    FINDERZ_FIELD_DOC_TITLE,
+};
+
+/* Everything below is protected by index_mutex */
+static GMutex index_mutex;
+static gchar *index_dir = NULL;
+static gchar *log_path = NULL;
+static gboolean index_loaded = FALSE;
+static GPtrArray *segments = NULL;     /* TextSegment, newest first */
+static guint64 next_generation = 1;
+static GHashTable *overlay = NULL;     /* path -> GArray of TextValue, empty once removed */
+static guint n_logged = 0;
+static gint log_fd = -1;
+static gboolean flushing = FALSE;
+static gint64 flush_retry_time = 0;
+
+static void
+text_value_clear (TextValue *value)
+{
+    g_free (value->text);
+}
+
+/* Reference counted, so a flush can hold on to what it writes */
+static GArray*
+text_values_new (void)
+{
+    GArray *values = g_array_new (FALSE, FALSE, sizeof (TextValue));
+    
+    g_array_set_clear_func (values, (GDestroyNotify)text_value_clear);
+    return values;
+}
+
+static gint
+indexed_field_slot (FinderzFieldId field)
+{
+    guint i;
+    
+    for (i = 0; i < G_N_ELEMENTS (indexed_fields); i++) {
+        if (indexed_fields[i] == field) {
+            return i;
+        }
+    }
+    
+    return -1;
+}
+
+/* Lower case for ASCII, Unicode case folding otherwise, applied alike
+ * to stored texts and searched phrases */
+static gchar*
+fold_text (const gchar *text)
+{
+    const gchar *p;
+    
+    for (p = text; *p; p++) {
+        if ((guchar)*p >= 0x80) {
+            if (g_utf8_validate (text, -1, NULL)) {
+                return g_utf8_casefold (text, -1);
+            }
+            break;
+        }
+    }
+    
+    return g_ascii_strdown (text, -1);
+}
+
+static void segment_free (TextSegment *segment);
+
+void
+finderz_text_index_init (void)
+{
+    gchar *path;
+    
+    g_mutex_lock (&index_mutex);
+    
+    if (index_dir) {
+        g_mutex_unlock (&index_mutex);
+        return;
+    }
+    
+    path = g_build_filename (g_get_user_cache_dir (), "finderz", "text-index", NULL);
+    if (g_mkdir_with_parents (path, 0700) != 0) {
+        g_debug ("FINDERZ: Text index disabled, cannot create %s", path);
+        g_free (path);
+    } else {
+        index_dir = path;
+        log_path = g_build_filename (path, "text.log", NULL);
+        segments = g_ptr_array_new_with_free_func ((GDestroyNotify)segment_free);
+        overlay = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                         (GDestroyNotify)g_array_unref);
+    }
+    
+    g_mutex_unlock (&index_mutex);
+}
+
+/* Segment layout */
+
+static void
+compute_offsets (const TextIndexHeader *header, TextOffsets *offsets)
+{
+    offsets->fields = sizeof (TextIndexHeader);
+    offsets->documents = ALIGN8 (offsets->fields +
+                                 (guint64)header->n_fields * sizeof (guint32));
+    offsets->entries = ALIGN8 (offsets->documents +
+                               (guint64)header->n_documents * sizeof (TextDocument));
+    offsets->trigrams = ALIGN8 (offsets->entries +
+                                (guint64)header->n_entries * sizeof (TextEntry));
+    offsets->postings = offsets->trigrams + (guint64)header->n_trigrams * sizeof (TextTrigram);
+    offsets->strings = ALIGN8 (offsets->postings + header->postings_size);
+    offsets->total = offsets->strings + header->strings_size;
+}
+
+static guint32
+document_end (const TextSegment *segment, guint32 document)
+{
+    return document + 1 < segment->header->n_documents ?
+           segment->documents[document + 1].first_entry : segment->header->n_entries;
+}
+
+static const gchar*
+document_path (const TextSegment *segment, guint32 document)
+{
+    return segment->strings + segment->documents[document].path;
+}
+
+/* Check everything a search relies on.  Posting lists are only read
+ * through posting_next(), which checks each number it decodes, so
+ * opening a segment does not mean reading them all. */
+static gboolean
+validate_segment (const TextSegment *segment)
+{
+    const TextIndexHeader *header = segment->header;
+    guint i;
+    
+    if (header->first_generation > header->last_generation ||
+        header->strings_size == 0 ||
+        segment->strings[header->strings_size - 1] != '\0') {
+        return FALSE;
+    }
+    
+    for (i = 0; i < header->n_fields; i++) {
+        if (segment->fields[i] >= header->strings_size) {
+            return FALSE;
+        }
+    }
+    
+    for (i = 0; i < header->n_documents; i++) {
+        const TextDocument *document = &segment->documents[i];
+        
+        if (document->path >= header->strings_size ||
+            document->first_entry > header->n_entries ||
+            (i == 0 && document->first_entry != 0) ||
+            (i > 0 && (document->first_entry < document[-1].first_entry ||
+                       strcmp (segment->strings + document->path,
+                               segment->strings + document[-1].path) <= 0))) {
+            return FALSE;
+        }
+    }
+    
+    for (i = 0; i < header->n_entries; i++) {
+        const TextEntry *entry = &segment->entries[i];
+        
+        if (entry->document >= header->n_documents ||
+            i < segment->documents[entry->document].first_entry ||
+            i >= document_end (segment, entry->document) ||
+            entry->field >= header->n_fields ||
+            entry->text >= header->strings_size) {
+            return FALSE;
+        }
+    }
+    
+    for (i = 0; i < header->n_trigrams; i++) {
+        const TextTrigram *trigram = &segment->trigrams[i];
+        
+        if (trigram->trigram >= TRIGRAM_COUNT ||
+            trigram->offset > header->postings_size ||
+            (i > 0 && (trigram->trigram <= trigram[-1].trigram ||
+                       trigram->offset < trigram[-1].offset))) {
+            return FALSE;
+        }
+    }
+    
+    return TRUE;
+}
+
+static void
+segment_free (TextSegment *segment)
+{
+    if (segment->mapped) {
+        g_mapped_file_unref (segment->mapped);
+    }
+    g_free (segment->field_ids);
+    g_free (segment->path);
+    g_free (segment);
+}
+
+/* The segment in @path, or NULL when it cannot be used */
+static TextSegment*
+segment_open (const gchar *path)
+{
+    TextSegment *segment;
+    TextOffsets offsets;
+    const guint8 *data;
+    gsize length;
+    guint i;
+    
+    segment = g_new0 (TextSegment, 1);
+    segment->path = g_strdup (path);
+    segment->mapped = g_mapped_file_new (path, FALSE, NULL);
+    if (!segment->mapped) {
+        segment_free (segment);
+        return NULL;
+    }
+    
+    data = (const guint8 *)g_mapped_file_get_contents (segment->mapped);
+    length = g_mapped_file_get_length (segment->mapped);
+    segment->header = (const TextIndexHeader *)data;
+    
+    if (length < sizeof (TextIndexHeader) ||
+        memcmp (segment->header->magic, TEXT_INDEX_MAGIC, 4) != 0 ||
+        segment->header->version != TEXT_INDEX_VERSION) {
+        goto invalid;
+    }
+    
+    compute_offsets (segment->header, &offsets);
+    if (offsets.total > length) {
+        goto invalid;
+    }
+    
+    segment->fields = (const guint32 *)(data + offsets.fields);
+    segment->documents = (const TextDocument *)(data + offsets.documents);
+    segment->entries = (const TextEntry *)(data + offsets.entries);
+    segment->trigrams = (const TextTrigram *)(data + offsets.trigrams);
+    segment->postings = data + offsets.postings;
+    segment->strings = (const gchar *)(data + offsets.strings);
+    
+    if (!validate_segment (segment)) {
+        goto invalid;
+    }
+    
+    /* Field ids are per process, so the segment stores keys */
+    segment->field_ids = g_new (FinderzFieldId, MAX (segment->header->n_fields, 1));
+    for (i = 0; i < segment->header->n_fields; i++) {
+        segment->field_ids[i] =
+            finderz_metadata_schema_lookup (segment->strings + segment->fields[i]);
+    }
+    
+    return segment;
+    
+invalid:
+    g_debug ("FINDERZ: Ignoring damaged text index %s", path);
+    segment_free (segment);
+    return NULL;
+}
+
+/* The document for @path, or -1 */
+static gint64
+segment_find_document (const TextSegment *segment, const gchar *path)
+{
+    guint low = 0, high = segment->header->n_documents;
+    
+    while (low < high) {
+        guint middle = low + (high - low) / 2;
+        gint cmp = strcmp (document_path (segment, middle), path);
+        
+        if (cmp == 0) {
+            return middle;
+        } else if (cmp < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    
+    return -1;
+}
+
+/* The first document whose path, cut to the length of @prefix, sorts
+ * after it, or equal to it unless @past is set.  Paths starting with
+ * @prefix lie between the two. */
+static guint
+segment_bound_prefix (const TextSegment *segment,
+                      const gchar *prefix,
+                      gsize length,
+                      gboolean past)
+{
+    guint low = 0, high = segment->header->n_documents;
+    
+    while (low < high) {
+        guint middle = low + (high - low) / 2;
+        gint cmp = strncmp (document_path (segment, middle), prefix, length);
+        
+        if (cmp < 0 || (cmp == 0 && past)) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    
+    return low;
+}
+
+static gint
+trigram_compare (const void *key, const void *member)
+{
+    guint32 trigram = *(const guint32 *)key;
+    guint32 other = ((const TextTrigram *)member)->trigram;
+    
+    return (trigram > other) - (trigram < other);
+}
+
+typedef struct {
+    const guint8 *data;
+    const guint8 *end;
+    guint64 position;     /* last entry read, plus one */
+    guint32 n_entries;
+} PostingReader;
+
+static void
+posting_reader_init (PostingReader *reader,
+                     const TextSegment *segment,
+                     const TextTrigram *trigram)
+{
+    const TextIndexHeader *header = segment->header;
+    guint64 end = trigram + 1 < segment->trigrams + header->n_trigrams ?
+                  trigram[1].offset : header->postings_size;
+    
+    reader->data = segment->postings + trigram->offset;
+    reader->end = segment->postings + end;
+    reader->position = 0;
+    reader->n_entries = header->n_entries;
+}
+
+/* The next entry of the list; FALSE at its end, or where it stops
+ * making sense */
+static inline gboolean
+posting_next (PostingReader *reader, guint32 *entry)
+{
+    guint64 gap = 0;
+    guint shift = 0;
+    guint8 byte;
+    
+    do {
+        if (reader->data == reader->end || shift > 28) {
+            return FALSE;
+        }
+        byte = *reader->data++;
+        gap |= (guint64)(byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    
+    if (gap == 0 || reader->position + gap > reader->n_entries) {
+        return FALSE;
+    }
+    
+    reader->position += gap;
+    *entry = reader->position - 1;
+    return TRUE;
+}
+
+/* Log frames */
+
+static guint32
+frame_checksum (const guint8 *data, gsize length)
+{
+    guint32 hash = 2166136261u;
+    gsize i;
+    
+    for (i = 0; i < length; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    
+    return hash;
+}
+
+static void
+put_u32 (GByteArray *out, guint32 value)
+{
+    g_byte_array_append (out, (const guint8 *)&value, sizeof (value));
+}
+
+/* Length, then the bytes and their terminating NUL */
+static void
+put_string (GByteArray *out, const gchar *string)
+{
+    guint32 length = strlen (string);
+    
+    put_u32 (out, length);
+    g_byte_array_append (out, (const guint8 *)string, length + 1);
+}
+
+typedef struct {
+    const guint8 *data;
+    gsize remaining;
+} LogReader;
+
+static gboolean
+get_u32 (LogReader *reader, guint32 *value)
+{
+    if (reader->remaining < sizeof (guint32)) {
+        return FALSE;
+    }
+    
+    memcpy (value, reader->data, sizeof (guint32));
+    reader->data += sizeof (guint32);
+    reader->remaining -= sizeof (guint32);
+    return TRUE;
+}
+
+static const gchar*
+get_string (LogReader *reader)
+{
+    const gchar *string;
+    guint32 length;
+    
+    if (!get_u32 (reader, &length) ||
+        reader->remaining <= length ||
+        reader->data[length] != '\0') {
+        return NULL;
+    }
+    
+    string = (const gchar *)reader->data;
+    reader->data += length + 1;
+    reader->remaining -= length + 1;
+    return string;
+}
+
+/* Frame payload: the path, then each field's key and folded text; a
+ * removed path has no fields */
+static GByteArray*
+encode_frame (const gchar *path, GArray *values)
+{
+    GByteArray *frame = g_byte_array_new ();
+    TextLogFrameHeader header = { TEXT_LOG_FRAME_MAGIC, 0, 0 };
+    guint i;
+    
+    g_byte_array_append (frame, (const guint8 *)&header, sizeof (header));
+    
+    put_string (frame, path);
+    put_u32 (frame, values->len);
+    for (i = 0; i < values->len; i++) {
+        const TextValue *value = &g_array_index (values, TextValue, i);
+        
+        put_string (frame, finderz_metadata_schema_get (value->field)->key);
+        put_string (frame, value->text);
+    }
+    
+    header.length = frame->len - sizeof (header);
+    header.checksum = frame_checksum (frame->data + sizeof (header), header.length);
+    memcpy (frame->data, &header, sizeof (header));
+    
+    return frame;
+}
+
+static gboolean
+decode_frame (LogReader *reader, const gchar **path, GArray **values)
+{
+    guint32 n_values, i;
+    
+    *path = get_string (reader);
+    if (!*path || !get_u32 (reader, &n_values)) {
+        return FALSE;
+    }
+    
+    *values = text_values_new ();
+    for (i = 0; i < n_values; i++) {
+        const gchar *key = get_string (reader);
+        const gchar *text = get_string (reader);
+        TextValue value;
+        
+        if (!key || !text) {
+            g_array_unref (*values);
+            return FALSE;
+        }
+        
+        /* Fields this build does not index are dropped */
+        value.field = finderz_metadata_schema_lookup (key);
+        if (indexed_field_slot (value.field) >= 0) {
+            value.text = g_strdup (text);
+            g_array_append_val (*values, value);
+        }
+    }
+    
+    return TRUE;
+}
+
+/* Read the log into the overlay, cutting off a torn tail so later
+ * appends stay readable */
+static void
+replay_log (void)
+{
+    gchar *contents;
+    gsize length, offset = 0;
+    
+    if (!g_file_get_contents (log_path, &contents, &length, NULL)) {
+        return;
+    }
+    
+    while (length - offset >= sizeof (TextLogFrameHeader)) {
+        TextLogFrameHeader header;
+        LogReader reader;
+        const gchar *path;
+        GArray *values;
+        
+        memcpy (&header, contents + offset, sizeof (header));
+        if (header.magic != TEXT_LOG_FRAME_MAGIC ||
+            header.length > length - offset - sizeof (header) ||
+            frame_checksum ((const guint8 *)contents + offset + sizeof (header),
+                            header.length) != header.checksum) {
+            break;
+        }
+        
+        reader.data = (const guint8 *)contents + offset + sizeof (header);
+        reader.remaining = header.length;
+        if (!decode_frame (&reader, &path, &values)) {
+            break;
+        }
+        
+        g_hash_table_replace (overlay, g_strdup (path), values);
+        n_logged++;
+        offset += sizeof (header) + header.length;
+    }
+    
+    if (offset < length) {
+        g_debug ("FINDERZ: Dropping %" G_GSIZE_FORMAT " damaged bytes from %s",
+                 length - offset, log_path);
+        if (truncate (log_path, offset) != 0) {
+            g_unlink (log_path);
+        }
+    }
+    
+    g_free (contents);
+}
+
+static gint
+segment_newer_compare (gconstpointer a, gconstpointer b)
+{
+    const TextIndexHeader *header1 = (*(TextSegment **)a)->header;
+    const TextIndexHeader *header2 = (*(TextSegment **)b)->header;
+    
+    if (header1->last_generation != header2->last_generation) {
+        return header1->last_generation > header2->last_generation ? -1 : 1;
+    }
+    /* The wider of two segments ending together comes first */
+    return (header1->first_generation > header2->first_generation) -
+           (header1->first_generation < header2->first_generation);
+}
+
+/* Open every segment, newest first.  Damaged segments are deleted, as
+ * are the inputs of a merge that finished writing its output. */
+static void
+load_segments (void)
+{
+    GPtrArray *found;
+    const gchar *name;
+    GDir *dir;
+    guint i, j;
+    
+    dir = g_dir_open (index_dir, 0, NULL);
+    if (!dir) {
+        return;
+    }
+    
+    found = g_ptr_array_new ();
+    while ((name = g_dir_read_name (dir)) != NULL) {
+        gchar *path;
+        TextSegment *segment;
+        
+        if (!g_str_has_prefix (name, "text-") || !g_str_has_suffix (name, ".idx")) {
+            continue;
+        }
+        
+        path = g_build_filename (index_dir, name, NULL);
+        segment = segment_open (path);
+        if (segment) {
+            g_ptr_array_add (found, segment);
+        } else {
+            g_unlink (path);
+        }
+        g_free (path);
+    }
+    g_dir_close (dir);
+    
+    g_ptr_array_sort (found, segment_newer_compare);
+    for (i = 0; i < found->len; i++) {
+        TextSegment *segment = g_ptr_array_index (found, i);
+        gboolean covered = FALSE;
+        
+        for (j = 0; j < segments->len && !covered; j++) {
+            const TextIndexHeader *kept = ((TextSegment *)g_ptr_array_index (segments, j))->header;
+            
+            covered = kept->first_generation <= segment->header->first_generation &&
+                      segment->header->last_generation <= kept->last_generation;
+        }
+        
+        if (covered) {
+            g_unlink (segment->path);
+            segment_free (segment);
+        } else {
+            g_ptr_array_add (segments, segment);
+        }
+    }
+    g_ptr_array_free (found, TRUE);
+    
+    if (segments->len > 0) {
+        TextSegment *newest = g_ptr_array_index (segments, 0);
+        
+        next_generation = newest->header->last_generation + 1;
+    }
+}
+
+/* Called with index_mutex held; FALSE when there is no index */
+static gboolean
+ensure_loaded (void)
+{
+    if (!index_dir) {
+        return FALSE;
+    }
+    
+    if (!index_loaded) {
+        index_loaded = TRUE;
+        load_segments ();
+        replay_log ();
+    }
+    
+    return TRUE;
+}
+
+/* Writing segments */
+
+typedef struct {
+    FinderzFieldId field;
+    const gchar *text;
+} BuildEntry;
+
+typedef struct {
+    GPtrArray *paths;
+    GArray *first_entries;    /* guint32 per path */
+    GArray *entries;          /* BuildEntry */
+    gboolean drop_removed;
+} BuildDocuments;
+
+static void
+build_add_segment_document (BuildDocuments *build,
+                            const TextSegment *segment,
+                            guint32 document)
+{
+    guint32 first = build->entries->len;
+    guint32 i;
+    
+    for (i = segment->documents[document].first_entry; i < document_end (segment, document); i++) {
+        BuildEntry entry;
+        
+        entry.field = segment->field_ids[segment->entries[i].field];
+        entry.text = segment->strings + segment->entries[i].text;
+        if (indexed_field_slot (entry.field) >= 0) {
+            g_array_append_val (build->entries, entry);
+        }
+    }
+    
+    if (build->entries->len > first || !build->drop_removed) {
+        g_ptr_array_add (build->paths, (gpointer)document_path (segment, document));
+        g_array_append_val (build->first_entries, first);
+    }
+}
+
+static void
+build_add_overlay_document (BuildDocuments *build, const gchar *path, GArray *values)
+{
+    guint32 first = build->entries->len;
+    guint i;
+    
+    for (i = 0; i < values->len; i++) {
+        const TextValue *value = &g_array_index (values, TextValue, i);
+        BuildEntry entry = { value->field, value->text };
+        
+        g_array_append_val (build->entries, entry);
+    }
+    
+    if (values->len > 0 || !build->drop_removed) {
+        g_ptr_array_add (build->paths, (gpointer)path);
+        g_array_append_val (build->first_entries, first);
+    }
+}
+
+static gint
+path_compare (gconstpointer a, gconstpointer b)
+{
+    return strcmp (*(const gchar **)a, *(const gchar **)b);
+}
+
+/* The newest record of every path in @logged and @merged, whose
+ * segments are newest first, in path order */
+static void
+collect_documents (BuildDocuments *build, GHashTable *logged, GPtrArray *merged)
+{
+    const gchar **keys;
+    guint *positions;
+    guint n_keys, n_segments, next_key = 0, i;
+    
+    keys = (const gchar **)g_hash_table_get_keys_as_array (logged, &n_keys);
+    qsort (keys, n_keys, sizeof (gchar *), path_compare);
+    n_segments = merged->len;
+    positions = g_new0 (guint, MAX (n_segments, 1));
+    
+    while (TRUE) {
+        const gchar *path = NULL;
+        gint newest = -1;
+        
+        /* Sources are looked at newest first, so ties go to the newest */
+        if (next_key < n_keys) {
+            path = keys[next_key];
+        }
+        for (i = 0; i < n_segments; i++) {
+            const TextSegment *segment = g_ptr_array_index (merged, i);
+            
+            if (positions[i] < segment->header->n_documents &&
+                (!path || strcmp (document_path (segment, positions[i]), path) < 0)) {
+                path = document_path (segment, positions[i]);
+                newest = i;
+            }
+        }
+        
+        if (!path) {
+            break;
+        }
+        
+        if (newest < 0) {
+            build_add_overlay_document (build, path, g_hash_table_lookup (logged, path));
+        } else {
+            build_add_segment_document (build, g_ptr_array_index (merged, newest),
+                                        positions[newest]);
+        }
+        
+        if (next_key < n_keys && strcmp (keys[next_key], path) == 0) {
+            next_key++;
+        }
+        for (i = 0; i < n_segments; i++) {
+            const TextSegment *segment = g_ptr_array_index (merged, i);
+            
+            if (positions[i] < segment->header->n_documents &&
+                strcmp (document_path (segment, positions[i]), path) == 0) {
+                positions[i]++;
+            }
+        }
+    }
+    
+    g_free (positions);
+    g_free (keys);
+}
+
+static guint32
+pool_add (GByteArray *pool, const gchar *string)
+{
+    guint32 offset = pool->len;
+    
+    g_byte_array_append (pool, (const guint8 *)string, strlen (string) + 1);
+    return offset;
+}
+
+static guint
+varint_size (guint32 value)
+{
+    guint size = 1;
+    
+    while (value >= 0x80) {
+        value >>= 7;
+        size++;
+    }
+    
+    return size;
+}
+
+/* Trigrams present are marked in a bitmap of all 2^24; a slot is the
+ * number of marked trigrams below it, so slots follow trigram order */
+static inline guint32
+trigram_slot (const guint64 *bitmap, const guint32 *ranks, guint32 trigram)
+{
+    guint64 below = bitmap[trigram >> 6] & ((G_GUINT64_CONSTANT (1) << (trigram & 63)) - 1);
+    
+    return ranks[trigram >> 6] + __builtin_popcountll (below);
+}
+
+/* Serialize @build.  Posting lists are laid out in two passes over the
+ * texts, one sizing them and one writing them in place, so nothing
+ * per posting is held besides the output. */
+static GBytes*
+encode_segment (BuildDocuments *build, guint64 first_generation, guint64 last_generation)
+{
+    const guint n_words = TRIGRAM_COUNT / 64;
+    TextIndexHeader header;
+    TextOffsets offsets;
+    GByteArray *pool;
+    GHashTable *texts;
+    guint32 *text_offsets, *ranks, *last;
+    guint64 *bitmap, *positions, postings_size;
+    guint32 n_trigrams;
+    guint8 *data;
+    guint32 e, i;
+    
+    /* Generated images share prompts, so each text is stored once */
+    pool = g_byte_array_new ();
+    pool_add (pool, "");
+    texts = g_hash_table_new (g_str_hash, g_str_equal);
+    text_offsets = g_new (guint32, MAX (build->entries->len, 1));
+    for (e = 0; e < build->entries->len; e++) {
+        const gchar *text = g_array_index (build->entries, BuildEntry, e).text;
+        gpointer offset;
+        
+        if (!g_hash_table_lookup_extended (texts, text, NULL, &offset)) {
+            offset = GUINT_TO_POINTER (pool_add (pool, text));
+            g_hash_table_insert (texts, (gpointer)text, offset);
+        }
+        text_offsets[e] = GPOINTER_TO_UINT (offset);
+    }
+    g_hash_table_destroy (texts);
+    
+    bitmap = g_new0 (guint64, n_words);
+    for (e = 0; e < build->entries->len; e++) {
+        const gchar *p = g_array_index (build->entries, BuildEntry, e).text;
+        
+        for (; p[0] && p[1] && p[2]; p++) {
+            guint32 trigram = TRIGRAM (p);
+            
+            bitmap[trigram >> 6] |= G_GUINT64_CONSTANT (1) << (trigram & 63);
+        }
+    }
+    
+    ranks = g_new (guint32, n_words);
+    n_trigrams = 0;
+    for (i = 0; i < n_words; i++) {
+        ranks[i] = n_trigrams;
+        n_trigrams += __builtin_popcountll (bitmap[i]);
+    }
+    
+    /* Sizing pass; last holds each list's last entry plus one */
+    positions = g_new0 (guint64, MAX (n_trigrams, 1));
+    last = g_new0 (guint32, MAX (n_trigrams, 1));
+    for (e = 0; e < build->entries->len; e++) {
+        const gchar *p = g_array_index (build->entries, BuildEntry, e).text;
+        
+        for (; p[0] && p[1] && p[2]; p++) {
+            guint32 slot = trigram_slot (bitmap, ranks, TRIGRAM (p));
+            
+            if (last[slot] != e + 1) {
+                positions[slot] += varint_size (e + 1 - last[slot]);
+                last[slot] = e + 1;
+            }
+        }
+    }
+    
+    postings_size = 0;
+    for (i = 0; i < n_trigrams; i++) {
+        guint64 size = positions[i];
+        
+        positions[i] = postings_size;
+        postings_size += size;
+    }
+    
+    memset (&header, 0, sizeof (header));
+    memcpy (header.magic, TEXT_INDEX_MAGIC, 4);
+    header.version = TEXT_INDEX_VERSION;
+    header.first_generation = first_generation;
+    header.last_generation = last_generation;
+    header.n_fields = G_N_ELEMENTS (indexed_fields);
+    header.n_documents = build->paths->len;
+    header.n_entries = build->entries->len;
+    header.n_trigrams = n_trigrams;
+    header.postings_size = postings_size;
+    
+    /* Keys and paths go last in the pool, each once */
+    for (i = 0; i < header.n_fields; i++) {
+        pool_add (pool, finderz_metadata_schema_get (indexed_fields[i])->key);
+    }
+    for (i = 0; i < build->paths->len; i++) {
+        pool_add (pool, g_ptr_array_index (build->paths, i));
+    }
+    header.strings_size = pool->len;
+    
+    compute_offsets (&header, &offsets);
+    data = g_malloc0 (offsets.total);
+    memcpy (data, &header, sizeof (header));
+    memcpy (data + offsets.strings, pool->data, pool->len);
+    
+    {
+        guint32 *fields = (guint32 *)(data + offsets.fields);
+        TextDocument *documents = (TextDocument *)(data + offsets.documents);
+        TextEntry *entries = (TextEntry *)(data + offsets.entries);
+        TextTrigram *trigrams = (TextTrigram *)(data + offsets.trigrams);
+        guint8 *postings = data + offsets.postings;
+        guint32 offset = header.strings_size;
+        guint32 document = 0;
+        
+        /* Walk the pool back from its end to find the keys and paths */
+        for (i = build->paths->len; i-- > 0;) {
+            offset -= strlen (g_ptr_array_index (build->paths, i)) + 1;
+            documents[i].path = offset;
+            documents[i].first_entry = g_array_index (build->first_entries, guint32, i);
+        }
+        for (i = header.n_fields; i-- > 0;) {
+            offset -= strlen (finderz_metadata_schema_get (indexed_fields[i])->key) + 1;
+            fields[i] = offset;
+        }
+        
+        for (e = 0; e < build->entries->len; e++) {
+            while (document + 1 < build->paths->len &&
+                   g_array_index (build->first_entries, guint32, document + 1) <= e) {
+                document++;
+            }
+            entries[e].document = document;
+            entries[e].field = indexed_field_slot (g_array_index (build->entries, BuildEntry, e).field);
+            entries[e].text = text_offsets[e];
+        }
+        
+        for (i = 0; i < n_words; i++) {
+            guint64 word = bitmap[i];
+            
+            while (word) {
+                guint32 trigram = i * 64 + __builtin_ctzll (word);
+                guint32 slot = trigram_slot (bitmap, ranks, trigram);
+                
+                trigrams[slot].trigram = trigram;
+                trigrams[slot].offset = positions[slot];
+                word &= word - 1;
+            }
+        }
+        
+        /* Writing pass */
+        memset (last, 0, MAX (n_trigrams, 1) * sizeof (guint32));
+        for (e = 0; e < build->entries->len; e++) {
+            const gchar *p = g_array_index (build->entries, BuildEntry, e).text;
+            
+            for (; p[0] && p[1] && p[2]; p++) {
+                guint32 slot = trigram_slot (bitmap, ranks, TRIGRAM (p));
+                guint32 gap;
+                
+                if (last[slot] == e + 1) {
+                    continue;
+                }
+                
+                gap = e + 1 - last[slot];
+                last[slot] = e + 1;
+                while (gap >= 0x80) {
+                    postings[positions[slot]++] = (gap & 0x7f) | 0x80;
+                    gap >>= 7;
+                }
+                postings[positions[slot]++] = gap;
+            }
+        }
+    }
+    
+    g_free (text_offsets);
+    g_free (bitmap);
+    g_free (ranks);
+    g_free (positions);
+    g_free (last);
+    g_byte_array_unref (pool);
+    
+    return g_bytes_new_take (data, offsets.total);
+}
+
+/* What a flush writes out, taken with index_mutex held */
+typedef struct {
+    GHashTable *logged;       /* path -> values, shared with the overlay */
+    GPtrArray *merged;        /* the newest segments, absorbed */
+    gboolean drop_removed;
+    guint64 first_generation;
+    guint64 generation;
+} FlushSnapshot;
+
+/* Called with index_mutex held.  The merged segments stay in place
+ * until the flush ends, and only a flush removes segments. */
+static FlushSnapshot*
+flush_begin (void)
+{
+    FlushSnapshot *snapshot;
+    GHashTableIter iter;
+    gpointer path, values;
+    guint64 size;
+    guint i;
+    
+    snapshot = g_new0 (FlushSnapshot, 1);
+    snapshot->logged = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                              (GDestroyNotify)g_array_unref);
+    g_hash_table_iter_init (&iter, overlay);
+    while (g_hash_table_iter_next (&iter, &path, &values)) {
+        g_hash_table_insert (snapshot->logged, g_strdup (path), g_array_ref (values));
+    }
+    
+    size = g_hash_table_size (overlay);
+    snapshot->merged = g_ptr_array_new ();
+    for (i = 0; i < segments->len; i++) {
+        TextSegment *newer = g_ptr_array_index (segments, i);
+        
+        if (newer->header->n_documents > 2 * size) {
+            break;
+        }
+        size += newer->header->n_documents;
+        g_ptr_array_add (snapshot->merged, newer);
+    }
+    
+    snapshot->drop_removed = snapshot->merged->len == segments->len;
+    snapshot->generation = next_generation;
+    snapshot->first_generation = snapshot->merged->len > 0 ?
+        ((TextSegment *)g_ptr_array_index (snapshot->merged, snapshot->merged->len - 1))->header->first_generation :
+        next_generation;
+    
+    flushing = TRUE;
+    return snapshot;
+}
+
+/* Called with index_mutex held after the segment was written: keep in
+ * the overlay and the log only what was updated since the snapshot */
+static void
+flush_trim_log (GHashTable *logged)
+{
+    GHashTableIter iter;
+    gpointer path, values;
+    GByteArray *log;
+    
+    g_hash_table_iter_init (&iter, logged);
+    while (g_hash_table_iter_next (&iter, &path, &values)) {
+        if (g_hash_table_lookup (overlay, path) == values) {
+            g_hash_table_remove (overlay, path);
+        }
+    }
+    n_logged = g_hash_table_size (overlay);
+    
+    if (n_logged == 0) {
+        if (log_fd >= 0 && ftruncate (log_fd, 0) != 0) {
+            close (log_fd);
+            log_fd = -1;
+            g_unlink (log_path);
+        }
+        return;
+    }
+    
+    /* A few updates came in during the flush; the log is rewritten
+     * with them and reopened by the next update */
+    log = g_byte_array_new ();
+    g_hash_table_iter_init (&iter, overlay);
+    while (g_hash_table_iter_next (&iter, &path, &values)) {
+        GByteArray *frame = encode_frame (path, values);
+        
+        g_byte_array_append (log, frame->data, frame->len);
+        g_byte_array_unref (frame);
+    }
+    if (g_file_set_contents (log_path, (const gchar *)log->data, log->len, NULL) &&
+        log_fd >= 0) {
+        close (log_fd);
+        log_fd = -1;
+    }
+    g_byte_array_unref (log);
+}
+
+/* Write @snapshot out as a new segment without holding index_mutex.
+ * Removals are only kept while there is an older segment for them to
+ * hide.  After a failure the next try waits a while, rather than
+ * coming with every update. */
+static void
+flush_log (FlushSnapshot *snapshot)
+{
+    BuildDocuments build;
+    TextSegment *segment = NULL;
+    GBytes *bytes;
+    GError *error = NULL;
+    gboolean written;
+    gchar *name, *path;
+    guint i;
+    
+    build.paths = g_ptr_array_new ();
+    build.first_entries = g_array_new (FALSE, FALSE, sizeof (guint32));
+    build.entries = g_array_new (FALSE, FALSE, sizeof (BuildEntry));
+    build.drop_removed = snapshot->drop_removed;
+    collect_documents (&build, snapshot->logged, snapshot->merged);
+    
+    bytes = encode_segment (&build, snapshot->first_generation, snapshot->generation);
+    g_ptr_array_unref (build.paths);
+    g_array_unref (build.first_entries);
+    g_array_unref (build.entries);
+    
+    name = g_strdup_printf ("text-%016" G_GINT64_MODIFIER "x.idx", snapshot->generation);
+    path = g_build_filename (index_dir, name, NULL);
+    g_free (name);
+    
+    written = g_file_set_contents (path, g_bytes_get_data (bytes, NULL),
+                                   g_bytes_get_size (bytes), &error);
+    g_bytes_unref (bytes);
+    if (written) {
+        segment = segment_open (path);
+    } else {
+        g_debug ("FINDERZ: Failed to write text index: %s", error->message);
+        g_error_free (error);
+    }
+    g_free (path);
+    
+    g_mutex_lock (&index_mutex);
+    
+    if (written) {
+        for (i = 0; i < snapshot->merged->len; i++) {
+            g_unlink (((TextSegment *)g_ptr_array_index (snapshot->merged, i))->path);
+        }
+        g_ptr_array_remove_range (segments, 0, snapshot->merged->len);
+        if (segment) {
+            g_ptr_array_insert (segments, 0, segment);
+        }
+        next_generation++;
+        
+        /* Replaying the log again would only repeat what the segment holds */
+        flush_trim_log (snapshot->logged);
+    } else {
+        flush_retry_time = g_get_monotonic_time () + TEXT_INDEX_FLUSH_RETRY_USEC;
+    }
+    flushing = FALSE;
+    
+    g_mutex_unlock (&index_mutex);
+    
+    g_hash_table_destroy (snapshot->logged);
+    g_ptr_array_unref (snapshot->merged);
+    g_free (snapshot);
+}
+
+/* Updates */
+
+/* The folded texts of @metadata's indexed fields, in field order */
+static GArray*
+collect_values (FinderzUniversalMetadata *metadata)
+{
+    GArray *values = text_values_new ();
+    guint i;
+    
+    for (i = 0; metadata && i < G_N_ELEMENTS (indexed_fields); i++) {
+        const FinderzMetadataValue *found = finderz_metadata_get_value (metadata, indexed_fields[i]);
+        TextValue value;
+        
+        if (!found || found->type != FINDERZ_VALUE_STRING ||
+            !found->string || found->string[0] == '\0') {
+            continue;
+        }
+        
+        value.field = indexed_fields[i];
+        value.text = fold_text (found->string);
+        g_array_append_val (values, value);
+    }
+    
+    return values;
+}
+
+/* Whether @values are what the index already holds for @path */
+static gboolean
+values_indexed (const gchar *path, GArray *values)
+{
+    GArray *current;
+    guint i, j;
+    
+    if (g_hash_table_lookup_extended (overlay, path, NULL, (gpointer *)&current)) {
+        if (current->len != values->len) {
+            return FALSE;
+        }
+        for (i = 0; i < values->len; i++) {
+            const TextValue *a = &g_array_index (current, TextValue, i);
+            const TextValue *b = &g_array_index (values, TextValue, i);
+            
+            if (a->field != b->field || strcmp (a->text, b->text) != 0) {
+                return FALSE;
+            }
+        }
+        return TRUE;
+    }
+    
+    for (i = 0; i < segments->len; i++) {
+        const TextSegment *segment = g_ptr_array_index (segments, i);
+        gint64 document = segment_find_document (segment, path);
+        guint32 first;
+        
+        if (document < 0) {
+            continue;
+        }
+        
+        first = segment->documents[document].first_entry;
+        if (document_end (segment, document) - first != values->len) {
+            return FALSE;
+        }
+        for (j = 0; j < values->len; j++) {
+            const TextEntry *entry = &segment->entries[first + j];
+            const TextValue *value = &g_array_index (values, TextValue, j);
+            
+            if (segment->field_ids[entry->field] != value->field ||
+                strcmp (segment->strings + entry->text, value->text) != 0) {
+                return FALSE;
+            }
+        }
+        return TRUE;
+    }
+    
+    return values->len == 0;
+}
+
+/* Takes @values */
+static void
+index_values (const gchar *path, GArray *values)
+{
+    FlushSnapshot *snapshot = NULL;
+    GByteArray *frame;
+    
+    g_mutex_lock (&index_mutex);
+    
+    if (!ensure_loaded () || values_indexed (path, values)) {
+        g_mutex_unlock (&index_mutex);
+        g_array_unref (values);
+        return;
+    }
+    
+    if (log_fd < 0) {
+        log_fd = g_open (log_path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    }
+    
+    /* One write per frame, so a crash tears at most the last one */
+    frame = encode_frame (path, values);
+    if (log_fd >= 0 &&
+        write (log_fd, frame->data, frame->len) == (gssize)frame->len) {
+        g_hash_table_replace (overlay, g_strdup (path), values);
+        n_logged++;
+    } else {
+        g_array_unref (values);
+    }
+    g_byte_array_unref (frame);
+    
+    if (n_logged >= TEXT_INDEX_FLUSH_FILES && !flushing &&
+        g_get_monotonic_time () >= flush_retry_time) {
+        snapshot = flush_begin ();
+    }
+    
+    g_mutex_unlock (&index_mutex);
+    
+    if (snapshot) {
+        flush_log (snapshot);
+    }
+}
+
+void
+finderz_text_index_update (const gchar *path, FinderzUniversalMetadata *metadata)
+{
+    g_return_if_fail (path != NULL);
+    
+    index_values (path, collect_values (metadata));
+}
+
+void
+finderz_text_index_remove (const gchar *path)
+{
+    g_return_if_fail (path != NULL);
+    
+    index_values (path, text_values_new ());
+}
+
+/* Searching */
+
+typedef struct {
+    FinderzFieldId field;     /* FINDERZ_FIELD_INVALID for any */
+    gchar *pattern;           /* folded */
+    gchar *prefix;            /* the directory, ending in a slash */
+    gsize prefix_length;
+    gboolean recurse;
+    GPtrArray *results;
+} TextQuery;
+
+static gboolean
+query_wants_path (TextQuery *query, const gchar *path)
+{
+    return strncmp (path, query->prefix, query->prefix_length) == 0 &&
+           (query->recurse || strchr (path + query->prefix_length, '/') == NULL);
+}
+
+static gboolean
+query_matches (TextQuery *query, FinderzFieldId field, const gchar *text)
+{
+    return (query->field == FINDERZ_FIELD_INVALID || field == query->field) &&
+           strstr (text, query->pattern) != NULL;
+}
+
+/* Whether the overlay or a segment newer than the one at @index has a
+ * record of @path of its own */
+static gboolean
+path_superseded (const gchar *path, guint index)
+{
+    guint i;
+    
+    if (g_hash_table_contains (overlay, path)) {
+        return TRUE;
+    }
+    
+    for (i = 0; i < index; i++) {
+        if (segment_find_document (g_ptr_array_index (segments, i), path) >= 0) {
+            return TRUE;
+        }
+    }
+    
+    return FALSE;
+}
+
+/* Add the file of @entry if the entry matches; @last_document keeps a
+ * file with several matching fields from being added twice */
+static void
+query_check_entry (TextQuery *query,
+                   guint index,
+                   guint32 entry,
+                   gint64 *last_document)
+{
+    const TextSegment *segment = g_ptr_array_index (segments, index);
+    const TextEntry *text_entry = &segment->entries[entry];
+    const gchar *path;
+    
+    if (text_entry->document == *last_document ||
+        !query_matches (query, segment->field_ids[text_entry->field],
+                        segment->strings + text_entry->text)) {
+        return;
+    }
+    
+    path = document_path (segment, text_entry->document);
+    if (query_wants_path (query, path) && !path_superseded (path, index)) {
+        g_ptr_array_add (query->results, g_strdup (path));
+        *last_document = text_entry->document;
+    }
+}
+
+typedef struct {
+    const TextTrigram *trigram;
+    gsize size;
+} PostingList;
+
+static gint
+posting_list_compare (gconstpointer a, gconstpointer b)
+{
+    const PostingList *list1 = a;
+    const PostingList *list2 = b;
+    
+    if (list1->size != list2->size) {
+        return list1->size < list2->size ? -1 : 1;
+    }
+    /* Repeated trigrams end up next to each other */
+    return (list1->trigram > list2->trigram) - (list1->trigram < list2->trigram);
+}
+
+/* Entries in [@first, @last) containing every trigram of the pattern.
+ * Lists are merged from the shortest until the rest cost more than
+ * checking what is left. */
+static guint32*
+segment_candidates (TextQuery *query,
+                    const TextSegment *segment,
+                    guint32 first,
+                    guint32 last,
+                    gsize *n_candidates)
+{
+    GArray *lists = g_array_new (FALSE, FALSE, sizeof (PostingList));
+    guint32 *candidates = NULL;
+    const gchar *p;
+    guint i;
+    
+    *n_candidates = 0;
+    
+    for (p = query->pattern; p[0] && p[1] && p[2]; p++) {
+        guint32 trigram = TRIGRAM (p);
+        PostingList list;
+        PostingReader reader;
+        
+        list.trigram = bsearch (&trigram, segment->trigrams, segment->header->n_trigrams,
+                                sizeof (TextTrigram), trigram_compare);
+        if (!list.trigram) {
+            g_array_unref (lists);
+            return NULL;
+        }
+        
+        posting_reader_init (&reader, segment, list.trigram);
+        list.size = reader.end - reader.data;
+        g_array_append_val (lists, list);
+    }
+    g_array_sort (lists, posting_list_compare);
+    
+    for (i = 0; i < lists->len; i++) {
+        const PostingList *list = &g_array_index (lists, PostingList, i);
+        PostingReader reader;
+        guint32 entry;
+        gsize j = 0, kept = 0;
+        
+        if (i > 0 && list->trigram == list[-1].trigram) {
+            continue;
+        }
+        
+        posting_reader_init (&reader, segment, list->trigram);
+        if (!candidates) {
+            /* Every posting takes at least a byte */
+            candidates = g_new (guint32, MAX (list->size, 1));
+            while (posting_next (&reader, &entry) && entry < last) {
+                if (entry >= first) {
+                    candidates[kept++] = entry;
+                }
+            }
+        } else if (list->size > *n_candidates * TEXT_INDEX_MERGE_RATIO) {
+            break;
+        } else {
+            while (j < *n_candidates && posting_next (&reader, &entry)) {
+                while (j < *n_candidates && candidates[j] < entry) {
+                    j++;
+                }
+                if (j < *n_candidates && candidates[j] == entry) {
+                    candidates[kept++] = entry;
+                    j++;
+                }
+            }
+        }
+        
+        *n_candidates = kept;
+        if (kept == 0) {
+            break;
+        }
+    }
+    
+    g_array_unref (lists);
+    return candidates;
+}
+
+static void
+segment_search (TextQuery *query, guint index)
+{
+    const TextSegment *segment = g_ptr_array_index (segments, index);
+    guint first_document, last_document;
+    guint32 first, last, i;
+    gint64 found_document = -1;
+    
+    first_document = segment_bound_prefix (segment, query->prefix, query->prefix_length, FALSE);
+    last_document = segment_bound_prefix (segment, query->prefix, query->prefix_length, TRUE);
+    if (first_document == last_document) {
+        return;
+    }
+    first = segment->documents[first_document].first_entry;
+    last = document_end (segment, last_document - 1);
+    
+    /* Phrases too short for a trigram are looked for in every entry */
+    if (strlen (query->pattern) < 3) {
+        for (i = first; i < last; i++) {
+            query_check_entry (query, index, i, &found_document);
+        }
+    } else {
+        gsize n_candidates;
+        guint32 *candidates = segment_candidates (query, segment, first, last, &n_candidates);
+        
+        for (i = 0; i < n_candidates; i++) {
+            query_check_entry (query, index, candidates[i], &found_document);
+        }
+        g_free (candidates);
+    }
+}
+
+static void
+overlay_search (TextQuery *query)
+{
+    GHashTableIter iter;
+    gpointer key, value;
+    
+    g_hash_table_iter_init (&iter, overlay);
+    while (g_hash_table_iter_next (&iter, &key, &value)) {
+        GArray *values = value;
+        guint i;
+        
+        if (!query_wants_path (query, key)) {
+            continue;
+        }
+        
+        for (i = 0; i < values->len; i++) {
+            const TextValue *text_value = &g_array_index (values, TextValue, i);
+            
+            if (query_matches (query, text_value->field, text_value->text)) {
+                g_ptr_array_add (query->results, g_strdup (key));
+                break;
+            }
+        }
+    }
+}
+
+/* The indexed field @name refers to, trying the common prefixes in
+ * front of it; FINDERZ_FIELD_INVALID for any field when @name is NULL */
+static gboolean
+lookup_field (const gchar *name, FinderzFieldId *field)
+{
+    static const gchar *prefixes[] = { "ai_", "doc_", "media_" };
+    guint i;
+    
+    *field = FINDERZ_FIELD_INVALID;
+    if (!name || name[0] == '\0') {
+        return TRUE;
+    }
+    
+    *field = finderz_metadata_schema_lookup (name);
+    for (i = 0; i < G_N_ELEMENTS (prefixes) && indexed_field_slot (*field) < 0; i++) {
+        gchar *prefixed = g_strconcat (prefixes[i], name, NULL);
+        
+        *field = finderz_metadata_schema_lookup (prefixed);
+        g_free (prefixed);
+    }
+    
+    return indexed_field_slot (*field) >= 0;
+}
+
+gboolean
+finderz_text_index_has_field (const gchar *field)
+{
+    FinderzFieldId id;
+    
+    return field != NULL && lookup_field (field, &id);
+}
+
+GPtrArray*
+finderz_text_index_search (const gchar *field,
+                           const gchar *text,
+                           const gchar *directory,
+                           gboolean recurse)
+{
+    TextQuery query;
+    gchar *stripped;
+    guint i;
+    
+    g_return_val_if_fail (text != NULL, NULL);
+    
+    if (!lookup_field (field, &query.field)) {
+        return NULL;
+    }
+    
+    stripped = g_strstrip (g_strdup (text));
+    query.pattern = fold_text (stripped);
+    g_free (stripped);
+    
+    if (!directory || g_str_equal (directory, "/")) {
+        query.prefix = g_strdup ("/");
+    } else if (g_str_has_suffix (directory, "/")) {
+        query.prefix = g_strdup (directory);
+    } else {
+        query.prefix = g_strconcat (directory, "/", NULL);
+    }
+    query.prefix_length = strlen (query.prefix);
+    query.recurse = recurse;
+    query.results = g_ptr_array_new_with_free_func (g_free);
+    
+    g_mutex_lock (&index_mutex);
+    if (!ensure_loaded ()) {
+        g_clear_pointer (&query.results, g_ptr_array_unref);
+    } else if (query.pattern[0] != '\0') {
+        for (i = 0; i < segments->len; i++) {
+            segment_search (&query, i);
+        }
+        overlay_search (&query);
+    }
+    g_mutex_unlock (&index_mutex);
+    
+    g_free (query.pattern);
+    g_free (query.prefix);
+    
+    return query.results;
+}
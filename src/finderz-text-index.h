@@ -0,0 +1,43 @@
+/* finderz-text-index.h
+ *
+ * Persistent trigram index over free-text metadata
+ * Finds files whose prompts, keywords or titles contain a phrase
+ * without opening any of them
+ */
+
+#ifndef FINDERZ_TEXT_INDEX_H
+#define FINDERZ_TEXT_INDEX_H
+
+#include <glib.h>
+#include "finderz-universal-metadata.h"
+
+G_BEGIN_DECLS
+
+/* Set up the index under the user cache directory */
+void finderz_text_index_init (void);
+
+/* Index the text fields of @metadata, extracted from @path.  Nothing
+ * is written when they are the ones already indexed. */
+void finderz_text_index_update (const gchar *path,
+                                FinderzUniversalMetadata *metadata);
+
+/* Forget @path, as when it no longer exists */
+void finderz_text_index_remove (const gchar *path);
+
+/* Whether @field, named as for finderz_text_index_search(), is one
+ * that is indexed */
+gboolean finderz_text_index_has_field (const gchar *field);
+
+/* Paths of the files whose @field contains @text, ignoring case.
+ * @field is a schema key, with or without its ai_, doc_ or media_
+ * prefix, or NULL for any indexed field.  Only files below @directory
+ * are returned, and only those directly in it unless @recurse is set.
+ * NULL when @field is not indexed or the index is unavailable. */
+GPtrArray* finderz_text_index_search (const gchar *field,
+                                      const gchar *text,
+                                      const gchar *directory,
+                                      gboolean recurse);
+
+G_END_DECLS
+
+#endif /* FINDERZ_TEXT_INDEX_H */
@@ -4,23 +4,12 @@
  */
 
 #include "finderz-universal-metadata.h"
+#include "finderz-sidecar-map.h"
+#include "finderz-field-census.h"
+#include "finderz-xmp-parser.h"
 #include <string.h>
-
-/* Free a metadata field */
-void
-finderz_metadata_field_free (FinderzMetadataField *field)
-{
-    if (!field) return;
-    
-    g_free (field->key);
-    g_free (field->value);
-    g_free (field->display_name);
-    g_free (field->category);
-    if (field->date_value) {
-        g_date_time_unref (field->date_value);
-    }
-    g_free (field);
-}
+#include <errno.h>
+#include <math.h>
 
 /* Free AI metadata */
 void
@@ -33,7 +22,7 @@ finderz_ai_metadata_free (FinderzAIMetadata *metadata)
     g_free (metadata->model);
     g_free (metadata->sampler);
     g_free (metadata->tool);
-    g_free (metadata->workflow);
+    g_free (metadata->workflow_hash);
     
     if (metadata->loras) {
         g_hash_table_destroy (metadata->loras);
@@ -62,39 +51,575 @@ finderz_image_metadata_free (FinderzImageMetadata *metadata)
     
     g_free (metadata->color_label);
     g_free (metadata->caption);
+    g_free (metadata->title);
+    g_free (metadata->creator);
     g_list_free_full (metadata->keywords, g_free);
     
     g_free (metadata);
 }
 
-/* Free universal metadata */
+/* The records of one directory share their strings: model, sampler
+ * and keyword values repeat across a folder of renders and are stored
+ * once.  Strings are reclaimed only when the directory's last record
+ * goes, so only short text is shared, and only up to a point: prompts,
+ * numbers and paths are unique to a file and kept by its record, and
+ * so is everything once the arena is full. */
+struct _FinderzMetadataArena {
+    gchar *directory;
+    GStringChunk *strings;
+    GHashTable *interned;   /* string in strings -> itself */
+    gsize size;             /* bytes interned */
+    GMutex mutex;
+    gint ref_count;  /* protected by arenas_mutex */
+};
+
+#define FINDERZ_ARENA_BLOCK_SIZE 4096
+/* Longest string shared, and the most bytes one arena holds */
+#define FINDERZ_ARENA_MAX_STRING 64
+#define FINDERZ_ARENA_MAX_SIZE (256 * 1024)
+
+/* FinderzMetadataValue.flags: strings the record allocated itself */
+#define VALUE_OWNS_STRING       (1 << 0)
+#define VALUE_OWNS_COLLATE_KEY  (1 << 1)
+
+static GHashTable *arenas = NULL;  /* directory -> FinderzMetadataArena */
+static GMutex arenas_mutex;
+
+static FinderzMetadataArena*
+arena_get_for_path (const gchar *file_path)
+{
+    FinderzMetadataArena *arena;
+    gchar *directory;
+    
+    directory = file_path ? g_path_get_dirname (file_path) : g_strdup ("");
+    
+    g_mutex_lock (&arenas_mutex);
+    if (!arenas) {
+        arenas = g_hash_table_new (g_str_hash, g_str_equal);
+    }
+    
+    arena = g_hash_table_lookup (arenas, directory);
+    if (arena) {
+        arena->ref_count++;
+        g_free (directory);
+    } else {
+        arena = g_new0 (FinderzMetadataArena, 1);
+        arena->directory = directory;
+        arena->strings = g_string_chunk_new (FINDERZ_ARENA_BLOCK_SIZE);
+        arena->interned = g_hash_table_new (g_str_hash, g_str_equal);
+        g_mutex_init (&arena->mutex);
+        arena->ref_count = 1;
+        g_hash_table_insert (arenas, arena->directory, arena);
+    }
+    g_mutex_unlock (&arenas_mutex);
+    
+    return arena;
+}
+
+static void
+arena_unref (FinderzMetadataArena *arena)
+{
+    gboolean last;
+    
+    g_mutex_lock (&arenas_mutex);
+    last = --arena->ref_count == 0;
+    if (last) {
+        g_hash_table_remove (arenas, arena->directory);
+    }
+    g_mutex_unlock (&arenas_mutex);
+    
+    if (last) {
+        g_hash_table_destroy (arena->interned);
+        g_string_chunk_free (arena->strings);
+        g_mutex_clear (&arena->mutex);
+        g_free (arena->directory);
+        g_free (arena);
+    }
+}
+
+/* Identical strings are stored once per arena; NULL when @string is
+ * not there yet and the arena is full */
+static const gchar*
+arena_intern (FinderzMetadataArena *arena, const gchar *string)
+{
+    const gchar *result;
+    gsize length;
+    
+    g_mutex_lock (&arena->mutex);
+    result = g_hash_table_lookup (arena->interned, string);
+    if (!result) {
+        length = strlen (string) + 1;
+        if (arena->size + length <= FINDERZ_ARENA_MAX_SIZE) {
+            result = g_string_chunk_insert_len (arena->strings, string, length - 1);
+            g_hash_table_add (arena->interned, (gpointer)result);
+            arena->size += length;
+        }
+    }
+    g_mutex_unlock (&arena->mutex);
+    
+    return result;
+}
+
+/* @string shared through the arena when @shared allows and there is
+ * room, else a copy owned by @value as @owns says */
+static const gchar*
+value_store_string (FinderzUniversalMetadata *metadata,
+                    FinderzMetadataValue *value,
+                    const gchar *string,
+                    gboolean shared,
+                    guint8 owns)
+{
+    const gchar *result = NULL;
+    
+    if (shared) {
+        result = arena_intern (metadata->arena, string);
+    }
+    if (!result) {
+        result = g_strdup (string);
+        value->flags |= owns;
+    }
+    
+    return result;
+}
+
+static void
+value_clear (FinderzMetadataValue *value)
+{
+    if (value->flags & VALUE_OWNS_STRING) {
+        g_free ((gchar *)value->string);
+    }
+    if (value->flags & VALUE_OWNS_COLLATE_KEY) {
+        g_free ((gchar *)value->collate_key);
+    }
+}
+
+FinderzUniversalMetadata*
+finderz_universal_metadata_new (const gchar *file_path)
+{
+    FinderzUniversalMetadata *metadata = g_new0 (FinderzUniversalMetadata, 1);
+    
+    metadata->arena = arena_get_for_path (file_path);
+    metadata->file_path = g_strdup (file_path);
+    metadata->last_extracted = g_get_real_time ();
+    metadata->ref_count = 1;
+    
+    return metadata;
+}
+
+FinderzUniversalMetadata*
+finderz_universal_metadata_ref (FinderzUniversalMetadata *metadata)
+{
+    g_return_val_if_fail (metadata != NULL, NULL);
+    
+    g_atomic_int_inc (&metadata->ref_count);
+    
+    return metadata;
+}
+
+/* Release universal metadata; the last reference frees it */
 void
-finderz_universal_metadata_free (FinderzUniversalMetadata *metadata)
+finderz_universal_metadata_unref (FinderzUniversalMetadata *metadata)
 {
+    guint i;
+    
     if (!metadata) return;
     
-    if (metadata->fields) {
-        g_hash_table_destroy (metadata->fields);
+    if (!g_atomic_int_dec_and_test (&metadata->ref_count)) {
+        return;
     }
-    g_list_free_full (metadata->categories, g_free);
-    g_free (metadata->file_path);
-    if (metadata->last_extracted) {
-        g_date_time_unref (metadata->last_extracted);
+    
+    for (i = 0; i < metadata->n_values; i++) {
+        value_clear (&metadata->values[i]);
     }
+    g_free (metadata->values);
+    g_free (metadata->file_path);
+    arena_unref (metadata->arena);
     
     g_free (metadata);
 }
 
+void
+finderz_universal_metadata_freeze (FinderzUniversalMetadata *metadata)
+{
+    g_return_if_fail (metadata != NULL);
+    
+    if (metadata->n_values < metadata->n_allocated) {
+        metadata->values = g_renew (FinderzMetadataValue, metadata->values,
+                                    metadata->n_values);
+        metadata->n_allocated = metadata->n_values;
+    }
+}
+
+gsize
+finderz_universal_metadata_get_size (FinderzUniversalMetadata *metadata)
+{
+    gsize size;
+    guint i;
+    
+    g_return_val_if_fail (metadata != NULL, 0);
+    
+    size = sizeof (FinderzUniversalMetadata) +
+           metadata->n_allocated * sizeof (FinderzMetadataValue);
+    if (metadata->file_path) {
+        size += strlen (metadata->file_path) + 1;
+    }
+    
+    for (i = 0; i < metadata->n_values; i++) {
+        const FinderzMetadataValue *value = &metadata->values[i];
+        
+        if (value->string) {
+            size += strlen (value->string) + 1;
+        }
+        if (value->collate_key) {
+            size += strlen (value->collate_key) + 1;
+        }
+    }
+    
+    return size;
+}
+
+/* Index of @field_id in the sorted values, or where it would go */
+static guint
+value_index (FinderzUniversalMetadata *metadata, FinderzFieldId field_id)
+{
+    guint low = 0;
+    guint high = metadata->n_values;
+    
+    while (low < high) {
+        guint middle = low + (high - low) / 2;
+        
+        if (metadata->values[middle].field_id < field_id) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    
+    return low;
+}
+
+/* Cleared slot for @field_id, inserted in order if it is new */
+static FinderzMetadataValue*
+ensure_value (FinderzUniversalMetadata *metadata, FinderzFieldId field_id)
+{
+    FinderzMetadataValue *value;
+    guint index = value_index (metadata, field_id);
+    
+    if (index == metadata->n_values || metadata->values[index].field_id != field_id) {
+        if (metadata->n_values == metadata->n_allocated) {
+            metadata->n_allocated = MAX (8, metadata->n_allocated * 2);
+            metadata->values = g_renew (FinderzMetadataValue, metadata->values,
+                                        metadata->n_allocated);
+        }
+        memmove (&metadata->values[index + 1], &metadata->values[index],
+                 (metadata->n_values - index) * sizeof (FinderzMetadataValue));
+        metadata->n_values++;
+    } else {
+        value_clear (&metadata->values[index]);
+    }
+    
+    value = &metadata->values[index];
+    memset (value, 0, sizeof (FinderzMetadataValue));
+    value->field_id = field_id;
+    
+    return value;
+}
+
+/* Whole-string numbers only, surrounding blanks allowed */
+static gboolean
+parse_int64 (const gchar *text, gint64 *result)
+{
+    gchar *end;
+    
+    while (g_ascii_isspace (*text)) {
+        text++;
+    }
+    
+    errno = 0;
+    *result = g_ascii_strtoll (text, &end, 10);
+    while (end != text && g_ascii_isspace (*end)) {
+        end++;
+    }
+    
+    return errno == 0 && end != text && *end == '\0';
+}
+
+static gboolean
+parse_double (const gchar *text, gdouble *result)
+{
+    gchar *end;
+    
+    while (g_ascii_isspace (*text)) {
+        text++;
+    }
+    
+    *result = g_ascii_strtod (text, &end);
+    while (end != text && g_ascii_isspace (*end)) {
+        end++;
+    }
+    
+    return end != text && *end == '\0' && isfinite (*result);
+}
+
+void
+finderz_metadata_set_string (FinderzUniversalMetadata *metadata,
+                             FinderzFieldId field_id,
+                             const gchar *string)
+{
+    FinderzMetadataValue *value;
+    gint64 int_value;
+    gdouble double_value;
+    
+    g_return_if_fail (metadata != NULL);
+    
+    if (field_id == FINDERZ_FIELD_INVALID || !string) {
+        return;
+    }
+    
+    value = ensure_value (metadata, field_id);
+    value->type = FINDERZ_VALUE_STRING;
+    
+    /* Numbers written as text, such as the seeds and step counts
+     * stored in xattrs, still sort as numbers.  Those and long text
+     * are rarely the same for two files, so are not shared. */
+    if (parse_int64 (string, &int_value)) {
+        value->sort_type = FINDERZ_SORT_KEY_INT64;
+        value->data.v_int64 = int_value;
+        value->string = value_store_string (metadata, value, string, FALSE,
+                                            VALUE_OWNS_STRING);
+    } else if (parse_double (string, &double_value)) {
+        value->sort_type = FINDERZ_SORT_KEY_DOUBLE;
+        value->data.v_double = double_value;
+        value->string = value_store_string (metadata, value, string, FALSE,
+                                            VALUE_OWNS_STRING);
+    } else {
+        gboolean shared = strlen (string) < FINDERZ_ARENA_MAX_STRING;
+        gchar *collate_key = g_utf8_collate_key (string, -1);
+        
+        value->sort_type = FINDERZ_SORT_KEY_COLLATE;
+        value->string = value_store_string (metadata, value, string, shared,
+                                            VALUE_OWNS_STRING);
+        value->collate_key = value_store_string (metadata, value, collate_key, shared,
+                                                 VALUE_OWNS_COLLATE_KEY);
+        g_free (collate_key);
+    }
+}
+
+void
+finderz_metadata_set_int (FinderzUniversalMetadata *metadata,
+                          FinderzFieldId field_id,
+                          gint64 number)
+{
+    FinderzMetadataValue *value;
+    
+    g_return_if_fail (metadata != NULL);
+    
+    if (field_id == FINDERZ_FIELD_INVALID) {
+        return;
+    }
+    
+    value = ensure_value (metadata, field_id);
+    value->type = FINDERZ_VALUE_INT64;
+    value->sort_type = FINDERZ_SORT_KEY_INT64;
+    value->data.v_int64 = number;
+}
+
+void
+finderz_metadata_set_double (FinderzUniversalMetadata *metadata,
+                             FinderzFieldId field_id,
+                             gdouble number)
+{
+    FinderzMetadataValue *value;
+    
+    g_return_if_fail (metadata != NULL);
+    
+    /* NaN has no place in a sort order */
+    if (field_id == FINDERZ_FIELD_INVALID || !isfinite (number)) {
+        return;
+    }
+    
+    value = ensure_value (metadata, field_id);
+    value->type = FINDERZ_VALUE_DOUBLE;
+    value->sort_type = FINDERZ_SORT_KEY_DOUBLE;
+    value->data.v_double = number;
+}
+
+void
+finderz_metadata_set_date_usec (FinderzUniversalMetadata *metadata,
+                                FinderzFieldId field_id,
+                                gint64 usec)
+{
+    FinderzMetadataValue *value;
+    
+    g_return_if_fail (metadata != NULL);
+    
+    if (field_id == FINDERZ_FIELD_INVALID) {
+        return;
+    }
+    
+    value = ensure_value (metadata, field_id);
+    value->type = FINDERZ_VALUE_DATE;
+    value->sort_type = FINDERZ_SORT_KEY_DATE;
+    value->data.v_int64 = usec;
+}
+
+void
+finderz_metadata_set_date (FinderzUniversalMetadata *metadata,
+                           FinderzFieldId field_id,
+                           GDateTime *date)
+{
+    if (!date) {
+        return;
+    }
+    
+    finderz_metadata_set_date_usec (metadata, field_id,
+                                    g_date_time_to_unix (date) * G_USEC_PER_SEC +
+                                    g_date_time_get_microsecond (date));
+}
+
+void
+finderz_metadata_set_from_string (FinderzUniversalMetadata *metadata,
+                                  FinderzFieldId field_id,
+                                  const gchar *text)
+{
+    const FinderzFieldDescriptor *descriptor;
+    gint64 int_value;
+    gdouble double_value;
+    
+    descriptor = finderz_metadata_schema_get (field_id);
+    if (!descriptor || !text) {
+        return;
+    }
+    
+    switch (descriptor->type) {
+        case FINDERZ_FIELD_TYPE_INTEGER:
+            if (parse_int64 (text, &int_value)) {
+                finderz_metadata_set_int (metadata, field_id, int_value);
+                return;
+            }
+            break;
+        case FINDERZ_FIELD_TYPE_REAL:
+        case FINDERZ_FIELD_TYPE_DURATION:
+            if (parse_double (text, &double_value)) {
+                finderz_metadata_set_double (metadata, field_id, double_value);
+                return;
+            }
+            break;
+        case FINDERZ_FIELD_TYPE_RATING:
+            if (parse_double (text, &double_value)) {
+                finderz_metadata_set_int (metadata, field_id,
+                                          (gint64)CLAMP (round (double_value), 0, 5));
+                return;
+            }
+            break;
+        case FINDERZ_FIELD_TYPE_FLAG:
+            finderz_metadata_set_int (metadata, field_id,
+                                      g_strcmp0 (text, "0") != 0 &&
+                                      g_ascii_strcasecmp (text, "false") != 0);
+            return;
+        case FINDERZ_FIELD_TYPE_DATE: {
+            GDateTime *date = g_date_time_new_from_iso8601 (text, NULL);
+            
+            if (date) {
+                finderz_metadata_set_date (metadata, field_id, date);
+                g_date_time_unref (date);
+                return;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    
+    finderz_metadata_set_string (metadata, field_id, text);
+}
+
+/* Get a value by field id */
+const FinderzMetadataValue*
+finderz_metadata_get_value (FinderzUniversalMetadata *metadata,
+                            FinderzFieldId field_id)
+{
+    guint index;
+    
+    if (!metadata || field_id == FINDERZ_FIELD_INVALID) {
+        return NULL;
+    }
+    
+    index = value_index (metadata, field_id);
+    if (index < metadata->n_values && metadata->values[index].field_id == field_id) {
+        return &metadata->values[index];
+    }
+    
+    return NULL;
+}
+
 /* Get metadata field */
-FinderzMetadataField*
+const FinderzMetadataValue*
 finderz_get_metadata_field (FinderzUniversalMetadata *metadata,
                              const gchar *key)
 {
-    if (!metadata || !metadata->fields || !key) {
+    if (!metadata || !key) {
         return NULL;
     }
     
-    return g_hash_table_lookup (metadata->fields, key);
+    return finderz_metadata_get_value (metadata, finderz_metadata_schema_lookup (key));
+}
+
+static inline gboolean
+sort_key_is_number (const FinderzMetadataValue *value)
+{
+    return value->sort_type == FINDERZ_SORT_KEY_INT64 ||
+           value->sort_type == FINDERZ_SORT_KEY_DOUBLE;
+}
+
+static inline gdouble
+sort_key_to_double (const FinderzMetadataValue *value)
+{
+    return value->sort_type == FINDERZ_SORT_KEY_INT64 ?
+           (gdouble)value->data.v_int64 : value->data.v_double;
+}
+
+/* Compare two values by their precomputed keys.  Missing values sort
+ * first; numbers of either kind compare by value, and otherwise
+ * differing kinds sort in FinderzSortKeyType order. */
+gint
+finderz_metadata_value_compare (const FinderzMetadataValue *value1,
+                                const FinderzMetadataValue *value2)
+{
+    if (value1 == value2) {
+        return 0;
+    } else if (!value1) {
+        return -1;
+    } else if (!value2) {
+        return 1;
+    }
+    
+    if (sort_key_is_number (value1) && sort_key_is_number (value2)) {
+        if (value1->sort_type == FINDERZ_SORT_KEY_INT64 &&
+            value2->sort_type == FINDERZ_SORT_KEY_INT64) {
+            return (value1->data.v_int64 > value2->data.v_int64) -
+                   (value1->data.v_int64 < value2->data.v_int64);
+        } else {
+            gdouble number1 = sort_key_to_double (value1);
+            gdouble number2 = sort_key_to_double (value2);
+            
+            return (number1 > number2) - (number1 < number2);
+        }
+    }
+    
+    if (value1->sort_type != value2->sort_type) {
+        return value1->sort_type < value2->sort_type ? -1 : 1;
+    }
+    
+    switch (value1->sort_type) {
+        case FINDERZ_SORT_KEY_DATE:
+            return (value1->data.v_int64 > value2->data.v_int64) -
+                   (value1->data.v_int64 < value2->data.v_int64);
+        case FINDERZ_SORT_KEY_COLLATE:
+            return strcmp (value1->collate_key, value2->collate_key);
+        default:
+            return 0;
+    }
 }
 
 /* Get all fields in a category */
@@ -102,39 +627,43 @@ GList*
 finderz_get_metadata_by_category (FinderzUniversalMetadata *metadata,
                                    const gchar *category)
 {
-    GList *fields = NULL;
+    GList *values = NULL;
+    guint i;
     
-    if (!metadata || !metadata->fields || !category) {
+    if (!metadata || !category) {
         return NULL;
     }
     
-    GHashTableIter iter;
-    gpointer key, value;
-    
-    g_hash_table_iter_init (&iter, metadata->fields);
-    while (g_hash_table_iter_next (&iter, &key, &value)) {
-        FinderzMetadataField *field = value;
-        if (field->category && g_strcmp0 (field->category, category) == 0) {
-            fields = g_list_append (fields, field);
+    for (i = 0; i < metadata->n_values; i++) {
+        const FinderzFieldDescriptor *descriptor;
+        
+        descriptor = finderz_metadata_schema_get (metadata->values[i].field_id);
+        if (descriptor && g_strcmp0 (descriptor->category, category) == 0) {
+            values = g_list_prepend (values, &metadata->values[i]);
         }
     }
     
-    return fields;
+    return g_list_reverse (values);
 }
 
 /* Format metadata for display */
 gchar*
-finderz_format_metadata_value (FinderzMetadataField *field)
+finderz_format_metadata_value (const FinderzMetadataValue *value)
 {
-    if (!field || !field->value) {
+    const FinderzFieldDescriptor *descriptor;
+    
+    if (!value) {
         return g_strdup ("");
     }
     
+    descriptor = finderz_metadata_schema_get (value->field_id);
+    
     /* Special formatting for certain types */
-    if (g_strcmp0 (field->key, "rating") == 0 && field->numeric) {
+    if (descriptor && descriptor->type == FINDERZ_FIELD_TYPE_RATING &&
+        value->type == FINDERZ_VALUE_INT64) {
         /* Show as stars */
         GString *stars = g_string_new ("");
-        gint rating = (gint)field->numeric_value;
+        gint rating = CLAMP (value->data.v_int64, 0, 5);
         for (int i = 0; i < rating; i++) {
             g_string_append (stars, "★");
         }
@@ -143,43 +672,81 @@ finderz_format_metadata_value (FinderzMetadataField *field)
         }
         return g_string_free (stars, FALSE);
     }
-    else if (field->date_value) {
-        return g_date_time_format (field->date_value, "%Y-%m-%d %H:%M");
+    else if (descriptor && descriptor->type == FINDERZ_FIELD_TYPE_FLAG) {
+        return g_strdup (value->type != FINDERZ_VALUE_INT64 || value->data.v_int64 ? "✓" : "");
     }
-    else if (field->numeric) {
-        if (field->numeric_value == (gint)field->numeric_value) {
-            return g_strdup_printf ("%d", (gint)field->numeric_value);
-        } else {
-            return g_strdup_printf ("%.2f", field->numeric_value);
+    else if (descriptor && descriptor->type == FINDERZ_FIELD_TYPE_DURATION &&
+             value->type == FINDERZ_VALUE_DOUBLE) {
+        gint64 seconds = (gint64)round (MAX (value->data.v_double, 0));
+        
+        if (seconds >= 3600) {
+            return g_strdup_printf ("%" G_GINT64_FORMAT ":%02d:%02d", seconds / 3600,
+                                    (gint)(seconds / 60 % 60), (gint)(seconds % 60));
+        }
+        return g_strdup_printf ("%d:%02d", (gint)(seconds / 60), (gint)(seconds % 60));
+    }
+    
+    switch (value->type) {
+        case FINDERZ_VALUE_DATE: {
+            GDateTime *date = g_date_time_new_from_unix_local (value->data.v_int64 / G_USEC_PER_SEC);
+            gchar *result = g_date_time_format (date, "%Y-%m-%d %H:%M");
+            
+            g_date_time_unref (date);
+            return result;
         }
+        case FINDERZ_VALUE_INT64:
+            return g_strdup_printf ("%" G_GINT64_FORMAT, value->data.v_int64);
+        case FINDERZ_VALUE_DOUBLE:
+            if (value->data.v_double == floor (value->data.v_double) &&
+                fabs (value->data.v_double) < 1e15) {
+                return g_strdup_printf ("%.0f", value->data.v_double);
+            }
+            return g_strdup_printf ("%.2f", value->data.v_double);
+        default:
+            break;
     }
     
     /* Truncate very long values for display */
-    if (strlen (field->value) > 100) {
-        gchar *truncated = g_strndup (field->value, 97);
+    if (!value->string) {
+        return g_strdup ("");
+    }
+    if (g_utf8_strlen (value->string, -1) > 100) {
+        gchar *truncated = g_utf8_substring (value->string, 0, 97);
         gchar *result = g_strdup_printf ("%s...", truncated);
         g_free (truncated);
         return result;
     }
     
-    return g_strdup (field->value);
+    return g_strdup (value->string);
 }
 
-/* Check for sidecar files */
+/* Check for sidecar files.  The directory listing answers this when
+ * it is loaded; otherwise look on disk. */
 gchar*
 finderz_find_xmp_sidecar (const gchar *file_path)
 {
-    gchar *xmp_path = g_strdup_printf ("%s.xmp", file_path);
+    gchar *xmp_path = NULL;
+    const gchar *name, *dot;
+    
+    if (finderz_sidecar_map_lookup (file_path, &xmp_path, NULL)) {
+        return xmp_path;
+    }
+    
+    xmp_path = g_strdup_printf ("%s.xmp", file_path);
     if (g_file_test (xmp_path, G_FILE_TEST_EXISTS)) {
         return xmp_path;
     }
     g_free (xmp_path);
     
     /* Try without extension */
-    gchar *base = g_strndup (file_path, strrchr (file_path, '.') - file_path);
-    xmp_path = g_strdup_printf ("%s.xmp", base);
-    g_free (base);
+    name = strrchr (file_path, G_DIR_SEPARATOR);
+    name = name ? name + 1 : file_path;
+    dot = strrchr (name, '.');
+    if (!dot || dot == name) {
+        return NULL;
+    }
     
+    xmp_path = g_strdup_printf ("%.*s.xmp", (int) (dot - file_path), file_path);
     if (g_file_test (xmp_path, G_FILE_TEST_EXISTS)) {
         return xmp_path;
     }
@@ -191,11 +758,17 @@ finderz_find_xmp_sidecar (const gchar *file_path)
 gchar*
 finderz_find_metadata_sidecar (const gchar *file_path)
 {
+    gchar *sidecar_path = NULL;
+    
+    if (finderz_sidecar_map_lookup (file_path, NULL, &sidecar_path)) {
+        return sidecar_path;
+    }
+    
     /* Check for various sidecar formats */
     const gchar *extensions[] = {".metadata", ".json", ".meta", NULL};
     
     for (int i = 0; extensions[i]; i++) {
-        gchar *sidecar_path = g_strdup_printf ("%s%s", file_path, extensions[i]);
+        sidecar_path = g_strdup_printf ("%s%s", file_path, extensions[i]);
         if (g_file_test (sidecar_path, G_FILE_TEST_EXISTS)) {
             return sidecar_path;
         }
@@ -205,32 +778,108 @@ finderz_find_metadata_sidecar (const gchar *file_path)
     return NULL;
 }
 
-/* Get list of available metadata columns */
+/* Copy the values of @source that @metadata does not have */
+static void
+merge_missing_values (FinderzUniversalMetadata *metadata,
+                      FinderzUniversalMetadata *source)
+{
+    for (guint i = 0; i < source->n_values; i++) {
+        const FinderzMetadataValue *value = &source->values[i];
+        
+        if (finderz_metadata_get_value (metadata, value->field_id)) {
+            continue;
+        }
+        
+        switch (value->type) {
+            case FINDERZ_VALUE_STRING:
+                finderz_metadata_set_string (metadata, value->field_id, value->string);
+                break;
+            case FINDERZ_VALUE_INT64:
+                finderz_metadata_set_int (metadata, value->field_id, value->data.v_int64);
+                break;
+            case FINDERZ_VALUE_DOUBLE:
+                finderz_metadata_set_double (metadata, value->field_id, value->data.v_double);
+                break;
+            case FINDERZ_VALUE_DATE:
+                finderz_metadata_set_date_usec (metadata, value->field_id, value->data.v_int64);
+                break;
+        }
+    }
+}
+
+void
+finderz_apply_sidecar_metadata (FinderzUniversalMetadata *metadata,
+                                const gchar *file_path)
+{
+    gchar *xmp_path, *metadata_path;
+    
+    g_return_if_fail (metadata != NULL);
+    g_return_if_fail (file_path != NULL);
+    
+    xmp_path = finderz_find_xmp_sidecar (file_path);
+    metadata_path = finderz_find_metadata_sidecar (file_path);
+    
+    if (xmp_path) {
+        /* Parsed once per version of the sidecar */
+        FinderzUniversalMetadata *xmp = finderz_xmp_read_sidecar (xmp_path);
+        
+        if (xmp) {
+            merge_missing_values (metadata, xmp);
+            finderz_universal_metadata_unref (xmp);
+        }
+        finderz_metadata_set_int (metadata, FINDERZ_FIELD_HAS_XMP, TRUE);
+    }
+    if (xmp_path || metadata_path) {
+        finderz_metadata_set_int (metadata, FINDERZ_FIELD_HAS_SIDECAR, TRUE);
+    }
+    
+    g_free (xmp_path);
+    g_free (metadata_path);
+    
+    finderz_universal_metadata_freeze (metadata);
+}
+
+/* Get list of available metadata columns: the keys of the fields
+ * files have been found to carry, most common first */
 GList*
 finderz_get_available_metadata_columns (void)
 {
     GList *columns = NULL;
+    GList *fields, *l;
     
-    /* Standard columns always available */
-    columns = g_list_append (columns, g_strdup ("rating"));
-    columns = g_list_append (columns, g_strdup ("ai_prompt"));
-    columns = g_list_append (columns, g_strdup ("ai_model"));
-    columns = g_list_append (columns, g_strdup ("ai_sampler"));
-    columns = g_list_append (columns, g_strdup ("ai_steps"));
-    columns = g_list_append (columns, g_strdup ("ai_cfg"));
-    columns = g_list_append (columns, g_strdup ("ai_seed"));
-    columns = g_list_append (columns, g_strdup ("exif_camera"));
-    columns = g_list_append (columns, g_strdup ("exif_lens"));
-    columns = g_list_append (columns, g_strdup ("exif_iso"));
-    columns = g_list_append (columns, g_strdup ("exif_aperture"));
-    columns = g_list_append (columns, g_strdup ("exif_focal_length"));
-    columns = g_list_append (columns, g_strdup ("gps_location"));
-    columns = g_list_append (columns, g_strdup ("keywords"));
-    columns = g_list_append (columns, g_strdup ("color_label"));
+    /* Until files have been extracted, the usual suspects */
+    if (finderz_field_census_is_empty ()) {
+        columns = g_list_append (columns, g_strdup ("rating"));
+        columns = g_list_append (columns, g_strdup ("ai_prompt"));
+        columns = g_list_append (columns, g_strdup ("ai_model"));
+        columns = g_list_append (columns, g_strdup ("ai_sampler"));
+        columns = g_list_append (columns, g_strdup ("ai_steps"));
+        columns = g_list_append (columns, g_strdup ("ai_cfg"));
+        columns = g_list_append (columns, g_strdup ("ai_seed"));
+        columns = g_list_append (columns, g_strdup ("exif_camera"));
+        columns = g_list_append (columns, g_strdup ("exif_lens"));
+        columns = g_list_append (columns, g_strdup ("exif_iso"));
+        columns = g_list_append (columns, g_strdup ("exif_aperture"));
+        columns = g_list_append (columns, g_strdup ("exif_focal_length"));
+        columns = g_list_append (columns, g_strdup ("gps_location"));
+        columns = g_list_append (columns, g_strdup ("keywords"));
+        columns = g_list_append (columns, g_strdup ("color_label"));
+        
+        return columns;
+    }
     
-    /* TODO: Dynamically discover more based on actual files */
+    fields = finderz_field_census_get_fields (NULL);
+    for (l = fields; l; l = l->next) {
+        const FinderzFieldDescriptor *field;
+        
+        field = finderz_metadata_schema_get (GPOINTER_TO_UINT (l->data));
+        if (field) {
+            columns = g_list_prepend (columns, g_strdup (field->key));
+        }
+    }
+    g_list_free (fields);
     
-    return columns;
+    return g_list_reverse (columns);
 }
 
 /* Initialize metadata system */
@@ -240,11 +889,12 @@ finderz_universal_metadata_init (void)
     g_debug ("FINDERZ: Initializing universal metadata system");
     
     /* Initialize subsystems */
+    finderz_metadata_schema_init ();
+    
     extern void finderz_xattr_init (void);
     finderz_xattr_init ();
     
     /* TODO: Initialize libexiv2 */
-    /* TODO: Initialize media extractors */
     
     g_debug ("FINDERZ: Metadata system initialized");
 }
\ No newline at end of file
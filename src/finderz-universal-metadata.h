@@ -9,45 +9,70 @@
 
 #include <glib.h>
 #include <gio/gio.h>
+#include "finderz-metadata-schema.h"
 
 G_BEGIN_DECLS
 
-/* Metadata sources */
+/* Kinds of precomputed sort key, in the order mixed kinds sort */
 typedef enum {
-    FINDERZ_METADATA_SOURCE_EXIF,           /* JPEG/TIFF EXIF data */
-    FINDERZ_METADATA_SOURCE_XMP,            /* XMP sidecar files or embedded */
-    FINDERZ_METADATA_SOURCE_IPTC,           /* IPTC photo metadata */
-    FINDERZ_METADATA_SOURCE_DS_STORE,       /* macOS .DS_Store */
-    FINDERZ_METADATA_SOURCE_XATTR,          /* Extended attributes */
-    FINDERZ_METADATA_SOURCE_AI_WORKFLOW,    /* ComfyUI/SD workflows */
-    FINDERZ_METADATA_SOURCE_PNG_TEXT,       /* PNG text chunks */
-    FINDERZ_METADATA_SOURCE_WEBP_METADATA,  /* WebP metadata */
-    FINDERZ_METADATA_SOURCE_ID3,            /* MP3/audio tags */
-    FINDERZ_METADATA_SOURCE_VIDEO,          /* Video metadata */
-    FINDERZ_METADATA_SOURCE_PDF,            /* PDF metadata */
-    FINDERZ_METADATA_SOURCE_OFFICE,         /* Office document properties */
-    FINDERZ_METADATA_SOURCE_SIDECAR         /* Any .metadata or similar sidecar */
-} FinderzMetadataSource;
-
-/* Metadata field - generic container for any metadata */
+    FINDERZ_SORT_KEY_NONE = 0,
+    FINDERZ_SORT_KEY_INT64,
+    FINDERZ_SORT_KEY_DOUBLE,
+    FINDERZ_SORT_KEY_DATE,      /* microseconds since the epoch */
+    FINDERZ_SORT_KEY_COLLATE    /* g_utf8_collate_key() of the value */
+} FinderzSortKeyType;
+
+/* How a single value is stored */
+typedef enum {
+    FINDERZ_VALUE_STRING,
+    FINDERZ_VALUE_INT64,
+    FINDERZ_VALUE_DOUBLE,
+    FINDERZ_VALUE_DATE          /* microseconds since the epoch */
+} FinderzValueType;
+
+/* One field of one file.  The field's name, category and display type
+ * are in its FinderzFieldDescriptor; short strings are shared through
+ * the arena of the file's directory, others belong to the record.  The
+ * sort key is computed when the value is set so
+ * comparisons never allocate: numbers and dates sort by data, numeric
+ * text by the number it parses to, other text by collate_key. */
+typedef struct {
+    FinderzFieldId field_id;
+    guint8 type;                /* FinderzValueType */
+    guint8 sort_type;           /* FinderzSortKeyType */
+    guint8 flags;               /* private */
+    union {
+        gint64 v_int64;         /* INT64 and DATE */
+        gdouble v_double;
+    } data;
+    const gchar *string;        /* STRING values */
+    const gchar *collate_key;
+} FinderzMetadataValue;
+
+/* Shared string storage for the records of one directory */
+typedef struct _FinderzMetadataArena FinderzMetadataArena;
+
+/* The version of a file a record was extracted from, as Nemo saw it
+ * when extraction was requested; a change means the record is stale */
 typedef struct {
-    gchar *key;          /* Field name/key */
-    gchar *value;        /* String value */
-    gchar *display_name; /* Human-readable name */
-    gchar *category;     /* Category for grouping */
-    FinderzMetadataSource source;
-    gboolean sortable;   /* Can this field be used for sorting? */
-    gboolean numeric;    /* Is this a numeric field? */
-    GDateTime *date_value; /* For date fields */
-    gdouble numeric_value; /* For numeric fields */
-} FinderzMetadataField;
-
-/* Universal metadata container */
+    gint64 mtime;
+    gint64 ctime;
+    goffset size;
+} FinderzFileStamp;
+
+/* Universal metadata container.  Filled in by one extractor thread,
+ * then frozen and shared read-only. */
 typedef struct {
-    GHashTable *fields;  /* key -> FinderzMetadataField */
-    GList *categories;   /* List of categories found */
+    FinderzMetadataValue *values;  /* sorted by field_id */
+    guint n_values;
+    guint n_allocated;
     gchar *file_path;
-    GDateTime *last_extracted;
+    gint64 last_extracted;         /* g_get_real_time() */
+    FinderzFileStamp stamp;
+    guint8 skipped_parsers;        /* FinderzParserFlags left out */
+    guint skip_generation;         /* of the census, when they were */
+    FinderzMetadataArena *arena;
+    gint ref_count;
 } FinderzUniversalMetadata;
 
 /* AI-specific metadata */
@@ -58,10 +83,10 @@ typedef struct {
     gchar *sampler;
     gint steps;
     gdouble cfg_scale;
-    gint seed;
+    gint64 seed;
     gchar *tool;        /* ComfyUI, SD WebUI, Midjourney, etc */
-    gchar *workflow;    /* Full workflow JSON if available */
-    GHashTable *loras;  /* LoRA models used */
+    gchar *workflow_hash; /* Workflow's key in the blob store */
+    GHashTable *loras;  /* LoRA models used, name -> strength */
     GHashTable *custom; /* Tool-specific fields */
 } FinderzAIMetadata;
 
@@ -81,6 +106,7 @@ typedef struct {
     gdouble latitude;
     gdouble longitude;
     gdouble altitude;
+    gboolean has_location;
     
     /* AI Generation */
     FinderzAIMetadata *ai_data;
@@ -90,6 +116,10 @@ typedef struct {
     gchar *color_label;
     GList *keywords;
     gchar *caption;
+    
+    /* Descriptive; XMP dc:title and the first dc:creator */
+    gchar *title;
+    gchar *creator;
 } FinderzImageMetadata;
 
 /* Public functions */
@@ -97,39 +127,114 @@ typedef struct {
 /* Initialize metadata system */
 void finderz_universal_metadata_init (void);
 
+/* Create an empty container holding one reference */
+FinderzUniversalMetadata* finderz_universal_metadata_new (const gchar *file_path);
+
+/* The parsers extraction runs on embedded metadata, by file type */
+typedef enum {
+    FINDERZ_PARSER_IMAGE    = 1 << 0,   /* EXIF, XMP and AI parameters */
+    FINDERZ_PARSER_MEDIA    = 1 << 1,   /* audio and video containers */
+    FINDERZ_PARSER_DOCUMENT = 1 << 2    /* PDF and office documents */
+} FinderzParserFlags;
+
+#define FINDERZ_N_PARSERS 3
+
 /* Extract all available metadata from a file */
 FinderzUniversalMetadata* finderz_extract_all_metadata (const gchar *file_path,
                                                          GError **error);
 
+/* The parser extraction runs for @file_path, 0 if there is none */
+FinderzParserFlags finderz_metadata_parser_for_file (const gchar *file_path);
+
+/* Extract as finderz_extract_all_metadata() does, but leave the
+ * parsers in @skip out; xattrs are read all the same */
+FinderzUniversalMetadata* finderz_extract_metadata_skipping (const gchar *file_path,
+                                                             FinderzParserFlags skip,
+                                                             GError **error);
+
+/* The same, with @file_path's folder open as @dir_fd; the file is
+ * found and its xattrs read through the folder rather than by path */
+FinderzUniversalMetadata* finderz_extract_metadata_at (int dir_fd,
+                                                       const gchar *file_path,
+                                                       FinderzParserFlags skip,
+                                                       GError **error);
+
 /* Extract specific metadata type */
 FinderzImageMetadata* finderz_extract_image_metadata (const gchar *file_path,
                                                        GError **error);
 FinderzAIMetadata* finderz_extract_ai_metadata (const gchar *file_path,
                                                  GError **error);
 
+/* A new record holding the fields of @img_meta */
+FinderzUniversalMetadata* finderz_image_to_universal_metadata (FinderzImageMetadata *img_meta,
+                                                                const gchar *file_path);
+
+/* Set a field, replacing any earlier value; only while extracting */
+void finderz_metadata_set_string (FinderzUniversalMetadata *metadata,
+                                  FinderzFieldId field_id,
+                                  const gchar *value);
+void finderz_metadata_set_int (FinderzUniversalMetadata *metadata,
+                               FinderzFieldId field_id,
+                               gint64 value);
+void finderz_metadata_set_double (FinderzUniversalMetadata *metadata,
+                                  FinderzFieldId field_id,
+                                  gdouble value);
+void finderz_metadata_set_date (FinderzUniversalMetadata *metadata,
+                                FinderzFieldId field_id,
+                                GDateTime *value);
+void finderz_metadata_set_date_usec (FinderzUniversalMetadata *metadata,
+                                     FinderzFieldId field_id,
+                                     gint64 usec);
+/* Parse @text according to the field's type, such as the text of an
+ * xattr, falling back to storing it as a string */
+void finderz_metadata_set_from_string (FinderzUniversalMetadata *metadata,
+                                       FinderzFieldId field_id,
+                                       const gchar *text);
+
+/* Release spare capacity once extraction is done; the record must not
+ * be changed afterwards */
+void finderz_universal_metadata_freeze (FinderzUniversalMetadata *metadata);
+
+/* Approximate heap footprint, for cache budgets.  Strings shared
+ * through the arena are counted in full by every record using them,
+ * which more than covers the arena, bounded as it is. */
+gsize finderz_universal_metadata_get_size (FinderzUniversalMetadata *metadata);
+
 /* Get metadata field for display/sorting */
-FinderzMetadataField* finderz_get_metadata_field (FinderzUniversalMetadata *metadata,
-                                                   const gchar *key);
+const FinderzMetadataValue* finderz_metadata_get_value (FinderzUniversalMetadata *metadata,
+                                                        FinderzFieldId field_id);
+const FinderzMetadataValue* finderz_get_metadata_field (FinderzUniversalMetadata *metadata,
+                                                        const gchar *key);
 
-/* Get all fields in a category */
+/* Get all values in a category, as borrowed FinderzMetadataValue pointers */
 GList* finderz_get_metadata_by_category (FinderzUniversalMetadata *metadata,
                                           const gchar *category);
 
+/* Compare by precomputed sort keys; NULL sorts first */
+gint finderz_metadata_value_compare (const FinderzMetadataValue *value1,
+                                     const FinderzMetadataValue *value2);
+
 /* Check for sidecar files */
 gchar* finderz_find_xmp_sidecar (const gchar *file_path);
 gchar* finderz_find_metadata_sidecar (const gchar *file_path);
 
+/* Add the fields of @file_path's sidecars that @metadata lacks.  Done
+ * apart from extraction because a sidecar can change while the file
+ * does not; @metadata must not be shared yet. */
+void finderz_apply_sidecar_metadata (FinderzUniversalMetadata *metadata,
+                                     const gchar *file_path);
+
 /* Free functions */
-void finderz_universal_metadata_free (FinderzUniversalMetadata *metadata);
+FinderzUniversalMetadata* finderz_universal_metadata_ref (FinderzUniversalMetadata *metadata);
+void finderz_universal_metadata_unref (FinderzUniversalMetadata *metadata);
 void finderz_image_metadata_free (FinderzImageMetadata *metadata);
 void finderz_ai_metadata_free (FinderzAIMetadata *metadata);
-void finderz_metadata_field_free (FinderzMetadataField *field);
 
 /* Get list of all possible metadata fields for column selection */
 GList* finderz_get_available_metadata_columns (void);
 
 /* Format metadata for display */
-gchar* finderz_format_metadata_value (FinderzMetadataField *field);
+gchar* finderz_format_metadata_value (const FinderzMetadataValue *value);
 
 /* Metadata writing (future) */
 gboolean finderz_write_metadata_field (const gchar *file_path,
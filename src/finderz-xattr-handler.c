@@ -8,7 +8,15 @@
 #include <gio/gio.h>
 #include <sys/xattr.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <string.h>
+#include "finderz-xattr-handler.h"
+
+/* Linux reports a missing attribute as ENODATA; ENOATTR is the BSD name */
+#ifndef ENOATTR
+#define ENOATTR ENODATA
+#endif
 
 #define FINDERZ_XATTR_PREFIX "user.finderz."
 #define FINDERZ_XATTR_RATING FINDERZ_XATTR_PREFIX "rating"
@@ -138,33 +146,158 @@ finderz_xattr_remove (const gchar *path, const gchar *name, GError **error)
     return TRUE;
 }
 
-/* Get all Finderz-specific attributes as a hash table */
-GHashTable*
-finderz_xattr_get_all_finderz (const gchar *path)
+/* Most files carry a handful of short attributes, so names and values
+ * are read into stack buffers first and only a larger one is allocated */
+#define XATTR_STACK_BUFFER_SIZE 1024
+
+/* Where attributes are read from: an open file, or a path when the
+ * file could not be opened */
+typedef struct {
+    int fd;
+    const gchar *path;
+} XattrSource;
+
+static ssize_t
+source_list (const XattrSource *source, char *buffer, size_t size)
+{
+    return source->fd >= 0 ? flistxattr (source->fd, buffer, size) :
+                             listxattr (source->path, buffer, size);
+}
+
+static ssize_t
+source_get (const XattrSource *source, const char *name, void *buffer, size_t size)
+{
+    return source->fd >= 0 ? fgetxattr (source->fd, name, buffer, size) :
+                             getxattr (source->path, name, buffer, size);
+}
+
+/* Read a whole attribute or list with @read_func, trying @stack_buffer
+ * before asking for the size.  Returns the length, or -1; *@result is
+ * @stack_buffer or a g_malloc'd buffer the caller frees. */
+static ssize_t
+read_sized (const XattrSource *source,
+            const char *name,
+            char *stack_buffer,
+            gsize stack_size,
+            char **result)
+{
+    ssize_t length;
+    
+    *result = stack_buffer;
+    length = name ? source_get (source, name, stack_buffer, stack_size) :
+                    source_list (source, stack_buffer, stack_size);
+    
+    /* Retry if the attribute grows between the two calls */
+    while (length < 0 && errno == ERANGE) {
+        ssize_t size = name ? source_get (source, name, NULL, 0) :
+                              source_list (source, NULL, 0);
+        
+        if (size < 0) {
+            break;
+        }
+        
+        if (*result != stack_buffer) {
+            g_free (*result);
+        }
+        *result = g_malloc (size + 1);
+        length = name ? source_get (source, name, *result, size) :
+                        source_list (source, *result, size);
+    }
+    
+    if (length < 0 && *result != stack_buffer) {
+        g_free (*result);
+        *result = stack_buffer;
+    }
+    
+    return length;
+}
+
+static GHashTable*
+read_all_finderz (const XattrSource *source)
 {
     GHashTable *attrs = g_hash_table_new_full (g_str_hash, g_str_equal,
                                                 g_free, g_free);
-    GList *all_attrs = finderz_xattr_list (path, NULL);
-    GList *l;
+    char list_buffer[XATTR_STACK_BUFFER_SIZE];
+    char value_buffer[XATTR_STACK_BUFFER_SIZE];
+    char *list;
+    char *name;
+    ssize_t list_length;
+    
+    list_length = read_sized (source, NULL, list_buffer, sizeof (list_buffer), &list);
     
-    for (l = all_attrs; l != NULL; l = l->next) {
-        const gchar *name = l->data;
+    /* Parse null-terminated list */
+    for (name = list; list_length > 0 && name < list + list_length; name += strlen (name) + 1) {
+        char *value;
+        ssize_t value_length;
         
         /* Only get our attributes */
-        if (g_str_has_prefix (name, FINDERZ_XATTR_PREFIX)) {
-            gchar *value = finderz_xattr_get (path, name, NULL);
-            if (value) {
-                /* Strip prefix for cleaner keys */
-                const gchar *key = name + strlen (FINDERZ_XATTR_PREFIX);
-                g_hash_table_insert (attrs, g_strdup (key), value);
-            }
+        if (!g_str_has_prefix (name, FINDERZ_XATTR_PREFIX)) {
+            continue;
+        }
+        
+        value_length = read_sized (source, name, value_buffer, sizeof (value_buffer), &value);
+        if (value_length >= 0) {
+            /* Strip prefix for cleaner keys */
+            g_hash_table_insert (attrs,
+                                 g_strdup (name + strlen (FINDERZ_XATTR_PREFIX)),
+                                 g_strndup (value, value_length));
+        }
+        
+        if (value != value_buffer) {
+            g_free (value);
         }
     }
     
-    g_list_free_full (all_attrs, g_free);
+    if (list != list_buffer) {
+        g_free (list);
+    }
+    
     return attrs;
 }
 
+static int
+source_set (const XattrSource *source, const char *name, const char *value)
+{
+    return source->fd >= 0 ? fsetxattr (source->fd, name, value, strlen (value), 0) :
+                             setxattr (source->path, name, value, strlen (value), 0);
+}
+
+/* Get all Finderz-specific attributes of @name, relative to @dir_fd, as
+ * a hash table.  The file is resolved once and its attributes read
+ * through the descriptor, which saves a round trip per call on network
+ * filesystems. */
+GHashTable*
+finderz_xattr_get_all_finderz_at (int dir_fd, const gchar *name)
+{
+    XattrSource source = { -1, NULL };
+    GHashTable *attrs;
+    
+    /* Non-blocking, so a FIFO can't stall us */
+    source.fd = openat (dir_fd, name, O_RDONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+    
+    /* Files we may not read can still have readable attributes */
+    if (source.fd < 0 && (dir_fd == AT_FDCWD || g_path_is_absolute (name))) {
+        source.path = name;
+    } else if (source.fd < 0) {
+        return g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    }
+    
+    attrs = read_all_finderz (&source);
+    
+    if (source.fd >= 0) {
+        close (source.fd);
+    }
+    
+    return attrs;
+}
+
+/* Get all Finderz-specific attributes as a hash table */
+GHashTable*
+finderz_xattr_get_all_finderz (const gchar *path)
+{
+    return finderz_xattr_get_all_finderz_at (AT_FDCWD, path);
+}
+
 /* High-level functions for specific metadata */
 
 /* Get/Set rating (1-5 stars) */
@@ -26,9 +26,15 @@ gboolean finderz_xattr_set (const gchar *path, const gchar *name,
 /* Remove an extended attribute */
 gboolean finderz_xattr_remove (const gchar *path, const gchar *name, GError **error);
 
-/* Get all Finderz-specific attributes as a hash table */
+/* Get all Finderz-specific attributes as a hash table, keyed by name
+ * without the "user.finderz." prefix; empty if there are none */
 GHashTable* finderz_xattr_get_all_finderz (const gchar *path);
 
+/* The same for @name relative to the directory @dir_fd, as for openat();
+ * listing a folder opens the folder once and reads every file through
+ * it, rather than resolving each full path again */
+GHashTable* finderz_xattr_get_all_finderz_at (int dir_fd, const gchar *name);
+
 /* High-level functions for specific metadata */
 
 /* Rating (1-5 stars) */
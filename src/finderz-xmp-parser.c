@@ -0,0 +1,749 @@
+/* finderz-xmp-parser.c
+ *
+ * Streaming XMP parser for embedded packets and sidecar files
+ *
+ * XMP is RDF/XML, but only a handful of simple properties are wanted,
+ * so no tree is built: GMarkup reports elements as they are read and
+ * text is kept only while inside a wanted property.  A property is
+ * written either as an attribute of rdf:Description, xmp:Rating="3",
+ * or as an element, <xmp:Rating>3</xmp:Rating>, whose value may be a
+ * list of rdf:li items.  Prefixes are resolved through the xmlns
+ * declarations in scope, since not every tool uses the usual ones.
+ */
+
+#include "finderz-xmp-parser.h"
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define XMP_READ_BLOCK_SIZE   (16 * 1024)
+/* Sidecars with a long edit history run to a few hundred KB */
+#define XMP_MAX_SIDECAR_SIZE  (16 * 1024 * 1024)
+/* Longest property value kept; anything longer is not a field we show */
+#define XMP_MAX_VALUE_LENGTH  (64 * 1024)
+/* Parsed sidecars kept in memory */
+#define XMP_CACHE_MAX_ENTRIES 4096
+
+#define NS_RDF       "http://www.w3.org/1999/02/22-rdf-syntax-ns#"
+#define NS_XMP       "http://ns.adobe.com/xap/1.0/"
+#define NS_DC        "http://purl.org/dc/elements/1.1/"
+#define NS_PHOTOSHOP "http://ns.adobe.com/photoshop/1.0/"
+#define NS_EXIF      "http://ns.adobe.com/exif/1.0/"
+#define NS_EXIF_EX   "http://cipa.jp/exif/1.0/"
+#define NS_EXIF_AUX  "http://ns.adobe.com/exif/1.0/aux/"
+#define NS_TIFF      "http://ns.adobe.com/tiff/1.0/"
+
+typedef enum {
+    XMP_PROPERTY_NONE,
+    XMP_PROPERTY_RATING,
+    XMP_PROPERTY_LABEL,
+    XMP_PROPERTY_SUBJECT,
+    XMP_PROPERTY_DATE_TAKEN,
+    XMP_PROPERTY_MAKE,
+    XMP_PROPERTY_MODEL,
+    XMP_PROPERTY_LENS,
+    XMP_PROPERTY_APERTURE,
+    XMP_PROPERTY_FOCAL_LENGTH,
+    XMP_PROPERTY_ISO,
+    XMP_PROPERTY_LATITUDE,
+    XMP_PROPERTY_LONGITUDE,
+    XMP_PROPERTY_TITLE,
+    XMP_PROPERTY_CREATOR
+} XmpProperty;
+
+/* The properties read; everything else is skipped unparsed */
+static const struct {
+    const gchar *namespace;
+    const gchar *name;
+    XmpProperty property;
+} xmp_properties[] = {
+    { NS_XMP,       "Rating",                  XMP_PROPERTY_RATING },
+    { NS_XMP,       "Label",                   XMP_PROPERTY_LABEL },
+    { NS_DC,        "subject",                 XMP_PROPERTY_SUBJECT },
+    { NS_EXIF,      "DateTimeOriginal",        XMP_PROPERTY_DATE_TAKEN },
+    { NS_PHOTOSHOP, "DateCreated",             XMP_PROPERTY_DATE_TAKEN },
+    { NS_TIFF,      "Make",                    XMP_PROPERTY_MAKE },
+    { NS_TIFF,      "Model",                   XMP_PROPERTY_MODEL },
+    { NS_EXIF_EX,   "LensModel",               XMP_PROPERTY_LENS },
+    { NS_EXIF_AUX,  "Lens",                    XMP_PROPERTY_LENS },
+    { NS_EXIF,      "FNumber",                 XMP_PROPERTY_APERTURE },
+    { NS_EXIF,      "FocalLength",             XMP_PROPERTY_FOCAL_LENGTH },
+    { NS_EXIF,      "ISOSpeedRatings",         XMP_PROPERTY_ISO },
+    { NS_EXIF_EX,   "PhotographicSensitivity", XMP_PROPERTY_ISO },
+    { NS_EXIF,      "GPSLatitude",             XMP_PROPERTY_LATITUDE },
+    { NS_EXIF,      "GPSLongitude",            XMP_PROPERTY_LONGITUDE },
+    { NS_DC,        "title",                   XMP_PROPERTY_TITLE },
+    { NS_DC,        "creator",                 XMP_PROPERTY_CREATOR },
+};
+
+/* Assumed for prefixes used without an xmlns declaration, which some
+ * writers of embedded packets leave out */
+static const struct {
+    const gchar *prefix;
+    const gchar *uri;
+} xmp_default_namespaces[] = {
+    { "rdf",       NS_RDF },
+    { "xmp",       NS_XMP },
+    { "dc",        NS_DC },
+    { "photoshop", NS_PHOTOSHOP },
+    { "exif",      NS_EXIF },
+    { "exifEX",    NS_EXIF_EX },
+    { "aux",       NS_EXIF_AUX },
+    { "tiff",      NS_TIFF },
+};
+
+typedef struct {
+    gchar *prefix;
+    gchar *uri;
+    guint depth;                /* of the element declaring it */
+} XmpNamespace;
+
+typedef struct {
+    FinderzImageMetadata *img_meta;
+    GArray *namespaces;         /* XmpNamespace, innermost last */
+    guint depth;
+    gboolean started;
+    
+    /* The wanted property element being read, if any */
+    XmpProperty property;
+    guint property_depth;
+    gboolean property_has_items;
+    GString *text;
+    
+    /* Applied when parsing ends */
+    GList *keywords;            /* dc:subject items, last first */
+    gboolean want_keywords;
+    gdouble latitude, longitude;
+    gboolean has_latitude, has_longitude;
+} XmpParser;
+
+typedef struct {
+    gchar *path;
+    gint64 mtime_nsec;
+    goffset size;
+    FinderzUniversalMetadata *metadata;
+    GList *lru_link;
+} SidecarCacheEntry;
+
+/* Parsed sidecars by path, most recently used first in sidecar_lru */
+static GHashTable *sidecar_cache = NULL;
+static GQueue sidecar_lru = G_QUEUE_INIT;
+static GMutex sidecar_cache_mutex;
+
+/* Namespace URI of the prefix of @qname, with @local set to the rest */
+static const gchar*
+xmp_resolve (XmpParser *parser, const gchar *qname, const gchar **local)
+{
+    const gchar *colon = strchr (qname, ':');
+    gsize prefix_length;
+    guint i;
+    
+    if (!colon) {
+        return NULL;
+    }
+    prefix_length = colon - qname;
+    *local = colon + 1;
+    
+    for (i = parser->namespaces->len; i > 0; i--) {
+        XmpNamespace *ns = &g_array_index (parser->namespaces, XmpNamespace, i - 1);
+        
+        if (strncmp (ns->prefix, qname, prefix_length) == 0 &&
+            ns->prefix[prefix_length] == '\0') {
+            return ns->uri;
+        }
+    }
+    
+    for (i = 0; i < G_N_ELEMENTS (xmp_default_namespaces); i++) {
+        if (strncmp (xmp_default_namespaces[i].prefix, qname, prefix_length) == 0 &&
+            xmp_default_namespaces[i].prefix[prefix_length] == '\0') {
+            return xmp_default_namespaces[i].uri;
+        }
+    }
+    
+    return NULL;
+}
+
+static XmpProperty
+xmp_lookup_property (XmpParser *parser, const gchar *qname)
+{
+    const gchar *uri, *local;
+    guint i;
+    
+    if (!(uri = xmp_resolve (parser, qname, &local))) {
+        return XMP_PROPERTY_NONE;
+    }
+    
+    for (i = 0; i < G_N_ELEMENTS (xmp_properties); i++) {
+        if (strcmp (local, xmp_properties[i].name) == 0 &&
+            strcmp (uri, xmp_properties[i].namespace) == 0) {
+            return xmp_properties[i].property;
+        }
+    }
+    
+    return XMP_PROPERTY_NONE;
+}
+
+static gboolean
+xmp_is_list_item (XmpParser *parser, const gchar *qname)
+{
+    const gchar *uri, *local;
+    
+    uri = xmp_resolve (parser, qname, &local);
+    return uri && strcmp (uri, NS_RDF) == 0 && strcmp (local, "li") == 0;
+}
+
+/* XMP dates are ISO 8601 cut short anywhere after the year, as in
+ * "2023", "2023-05-04" or "2023-05-04T12:34:56.78+02:00".  Without a
+ * zone the time is local. */
+static GDateTime*
+xmp_parse_date (const gchar *text)
+{
+    GDateTime *utc, *result;
+    gint year, month = 1, day = 1, hour = 0, minute = 0;
+    gdouble seconds = 0;
+    gint offset_hours = 0, offset_minutes = 0;
+    const gchar *zone = NULL;
+    gchar sign = '+';
+    
+    if (sscanf (text, "%4d-%2d-%2dT%2d:%2d:%lf",
+                &year, &month, &day, &hour, &minute, &seconds) < 1) {
+        return NULL;
+    }
+    
+    if ((zone = strchr (text, 'T'))) {
+        zone = strpbrk (zone, "Z+-");
+    }
+    if (!zone) {
+        return g_date_time_new_local (year, month, day, hour, minute, seconds);
+    }
+    
+    if (*zone != 'Z' &&
+        sscanf (zone, "%c%2d:%2d", &sign, &offset_hours, &offset_minutes) != 3) {
+        return NULL;
+    }
+    
+    utc = g_date_time_new_utc (year, month, day, hour, minute, seconds);
+    if (!utc) {
+        return NULL;
+    }
+    
+    result = g_date_time_add_seconds (utc, (sign == '+' ? -60 : 60) *
+                                           (offset_hours * 60 + offset_minutes));
+    g_date_time_unref (utc);
+    
+    return result;
+}
+
+/* "28/10" or "2.8" */
+static gboolean
+xmp_parse_rational (const gchar *text, gdouble *result)
+{
+    gdouble number;
+    gchar *end;
+    
+    number = g_ascii_strtod (text, &end);
+    if (end == text) {
+        return FALSE;
+    }
+    if (*end == '/') {
+        gdouble denominator = g_ascii_strtod (end + 1, NULL);
+        
+        if (denominator == 0) {
+            return FALSE;
+        }
+        number /= denominator;
+    }
+    
+    if (!isfinite (number) || number <= 0) {
+        return FALSE;
+    }
+    
+    *result = number;
+    return TRUE;
+}
+
+/* "DDD,MM.mmR" or "DDD,MM,SSR", where R is one of @refs: the positive
+ * direction, then the negative one */
+static gboolean
+xmp_parse_coordinate (const gchar *text, const gchar *refs, gdouble *result)
+{
+    gsize length = strlen (text);
+    gdouble degrees, minutes, seconds = 0;
+    gchar *end;
+    gchar ref;
+    
+    if (length < 2) {
+        return FALSE;
+    }
+    ref = g_ascii_toupper (text[length - 1]);
+    if (ref != refs[0] && ref != refs[1]) {
+        return FALSE;
+    }
+    
+    degrees = g_ascii_strtod (text, &end);
+    if (end == text || *end != ',') {
+        return FALSE;
+    }
+    minutes = g_ascii_strtod (end + 1, &end);
+    if (*end == ',') {
+        seconds = g_ascii_strtod (end + 1, &end);
+    }
+    if (end != text + length - 1 || degrees < 0 || degrees > 180) {
+        return FALSE;
+    }
+    
+    *result = degrees + minutes / 60.0 + seconds / 3600.0;
+    if (ref == refs[1]) {
+        *result = -*result;
+    }
+    
+    return TRUE;
+}
+
+/* Fields already set by an earlier source are left alone */
+static void
+xmp_apply (XmpParser *parser, XmpProperty property, const gchar *text)
+{
+    FinderzImageMetadata *img_meta = parser->img_meta;
+    gchar *value = g_strstrip (g_strdup (text));
+    gchar **target = NULL;
+    
+    if (*value == '\0') {
+        g_free (value);
+        return;
+    }
+    
+    switch (property) {
+        case XMP_PROPERTY_RATING: {
+            /* Lightroom writes -1 for rejected photos */
+            gint rating = atoi (value);
+            
+            if (rating > 0 && img_meta->rating == 0) {
+                img_meta->rating = MIN (rating, 5);
+            }
+            break;
+        }
+        case XMP_PROPERTY_LABEL:
+            target = &img_meta->color_label;
+            break;
+        case XMP_PROPERTY_SUBJECT:
+            if (parser->want_keywords) {
+                parser->keywords = g_list_prepend (parser->keywords, value);
+                value = NULL;
+            }
+            break;
+        case XMP_PROPERTY_DATE_TAKEN:
+            if (!img_meta->date_taken) {
+                img_meta->date_taken = xmp_parse_date (value);
+            }
+            break;
+        case XMP_PROPERTY_MAKE:
+            target = &img_meta->camera_make;
+            break;
+        case XMP_PROPERTY_MODEL:
+            target = &img_meta->camera_model;
+            break;
+        case XMP_PROPERTY_LENS:
+            target = &img_meta->lens;
+            break;
+        case XMP_PROPERTY_APERTURE:
+            if (img_meta->aperture <= 0) {
+                xmp_parse_rational (value, &img_meta->aperture);
+            }
+            break;
+        case XMP_PROPERTY_FOCAL_LENGTH:
+            if (img_meta->focal_length <= 0) {
+                xmp_parse_rational (value, &img_meta->focal_length);
+            }
+            break;
+        case XMP_PROPERTY_ISO:
+            /* A list; the first item is the one that applies */
+            if (img_meta->iso <= 0) {
+                img_meta->iso = MAX (atoi (value), 0);
+            }
+            break;
+        case XMP_PROPERTY_LATITUDE:
+            if (!parser->has_latitude) {
+                parser->has_latitude = xmp_parse_coordinate (value, "NS", &parser->latitude);
+            }
+            break;
+        case XMP_PROPERTY_LONGITUDE:
+            if (!parser->has_longitude) {
+                parser->has_longitude = xmp_parse_coordinate (value, "EW", &parser->longitude);
+            }
+            break;
+        case XMP_PROPERTY_TITLE:
+            /* A list of translations, the default first */
+            target = &img_meta->title;
+            break;
+        case XMP_PROPERTY_CREATOR:
+            target = &img_meta->creator;
+            break;
+        case XMP_PROPERTY_NONE:
+            break;
+    }
+    
+    if (target && !*target) {
+        *target = value;
+        value = NULL;
+    }
+    g_free (value);
+}
+
+static void
+xmp_start_element (GMarkupParseContext *context,
+                   const gchar *element_name,
+                   const gchar **attribute_names,
+                   const gchar **attribute_values,
+                   gpointer user_data,
+                   GError **error)
+{
+    XmpParser *parser = user_data;
+    guint i;
+    
+    parser->depth++;
+    
+    for (i = 0; attribute_names[i]; i++) {
+        if (g_str_has_prefix (attribute_names[i], "xmlns:")) {
+            XmpNamespace ns;
+            
+            ns.prefix = g_strdup (attribute_names[i] + strlen ("xmlns:"));
+            ns.uri = g_strdup (attribute_values[i]);
+            ns.depth = parser->depth;
+            g_array_append_val (parser->namespaces, ns);
+        }
+    }
+    
+    if (parser->property != XMP_PROPERTY_NONE) {
+        /* Inside a wanted property only list items matter */
+        if (xmp_is_list_item (parser, element_name)) {
+            g_string_truncate (parser->text, 0);
+            parser->property_has_items = TRUE;
+        }
+        return;
+    }
+    
+    /* Properties written as attributes, usually of rdf:Description */
+    for (i = 0; attribute_names[i]; i++) {
+        XmpProperty property = xmp_lookup_property (parser, attribute_names[i]);
+        
+        if (property != XMP_PROPERTY_NONE) {
+            xmp_apply (parser, property, attribute_values[i]);
+        }
+    }
+    
+    parser->property = xmp_lookup_property (parser, element_name);
+    if (parser->property != XMP_PROPERTY_NONE) {
+        parser->property_depth = parser->depth;
+        parser->property_has_items = FALSE;
+        g_string_truncate (parser->text, 0);
+    }
+}
+
+static void
+xmp_end_element (GMarkupParseContext *context,
+                 const gchar *element_name,
+                 gpointer user_data,
+                 GError **error)
+{
+    XmpParser *parser = user_data;
+    
+    if (parser->property != XMP_PROPERTY_NONE) {
+        if (parser->depth == parser->property_depth) {
+            if (!parser->property_has_items) {
+                xmp_apply (parser, parser->property, parser->text->str);
+            }
+            if (parser->property == XMP_PROPERTY_SUBJECT && parser->keywords) {
+                parser->want_keywords = FALSE;
+            }
+            parser->property = XMP_PROPERTY_NONE;
+        } else if (xmp_is_list_item (parser, element_name)) {
+            xmp_apply (parser, parser->property, parser->text->str);
+            g_string_truncate (parser->text, 0);
+        }
+    }
+    
+    while (parser->namespaces->len > 0) {
+        guint last = parser->namespaces->len - 1;
+        XmpNamespace *ns = &g_array_index (parser->namespaces, XmpNamespace, last);
+        
+        if (ns->depth != parser->depth) {
+            break;
+        }
+        g_free (ns->prefix);
+        g_free (ns->uri);
+        g_array_set_size (parser->namespaces, last);
+    }
+    
+    parser->depth--;
+}
+
+static void
+xmp_text (GMarkupParseContext *context,
+          const gchar *text,
+          gsize text_len,
+          gpointer user_data,
+          GError **error)
+{
+    XmpParser *parser = user_data;
+    
+    if (parser->property != XMP_PROPERTY_NONE &&
+        parser->text->len + text_len <= XMP_MAX_VALUE_LENGTH) {
+        g_string_append_len (parser->text, text, text_len);
+    }
+}
+
+static const GMarkupParser xmp_markup_parser = {
+    xmp_start_element,
+    xmp_end_element,
+    xmp_text,
+    NULL,
+    NULL
+};
+
+static GMarkupParseContext*
+xmp_parser_init (XmpParser *parser, FinderzImageMetadata *img_meta)
+{
+    memset (parser, 0, sizeof (XmpParser));
+    parser->img_meta = img_meta;
+    parser->namespaces = g_array_new (FALSE, FALSE, sizeof (XmpNamespace));
+    parser->text = g_string_new (NULL);
+    parser->want_keywords = img_meta->keywords == NULL;
+    
+    return g_markup_parse_context_new (&xmp_markup_parser,
+                                       G_MARKUP_TREAT_CDATA_AS_TEXT,
+                                       parser, NULL);
+}
+
+static gboolean
+xmp_parser_feed (XmpParser *parser,
+                 GMarkupParseContext *context,
+                 const gchar *data,
+                 gsize length)
+{
+    GError *error = NULL;
+    
+    /* GMarkup does not expect a byte order mark */
+    if (!parser->started) {
+        if (length >= 3 && memcmp (data, "\xef\xbb\xbf", 3) == 0) {
+            data += 3;
+            length -= 3;
+        }
+        parser->started = TRUE;
+    }
+    
+    if (!g_markup_parse_context_parse (context, data, length, &error)) {
+        g_debug ("FINDERZ: Stopped reading XMP: %s", error->message);
+        g_error_free (error);
+        return FALSE;
+    }
+    
+    return TRUE;
+}
+
+/* Apply what was gathered and free the parser */
+static gboolean
+xmp_parser_finish (XmpParser *parser, GMarkupParseContext *context, gboolean ok)
+{
+    FinderzImageMetadata *img_meta = parser->img_meta;
+    guint i;
+    
+    if (ok) {
+        ok = g_markup_parse_context_end_parse (context, NULL);
+    }
+    g_markup_parse_context_free (context);
+    
+    if (parser->keywords && !img_meta->keywords) {
+        img_meta->keywords = g_list_reverse (parser->keywords);
+    } else {
+        g_list_free_full (parser->keywords, g_free);
+    }
+    
+    if (parser->has_latitude && parser->has_longitude && !img_meta->has_location) {
+        img_meta->latitude = parser->latitude;
+        img_meta->longitude = parser->longitude;
+        img_meta->has_location = TRUE;
+    }
+    
+    for (i = 0; i < parser->namespaces->len; i++) {
+        XmpNamespace *ns = &g_array_index (parser->namespaces, XmpNamespace, i);
+        
+        g_free (ns->prefix);
+        g_free (ns->uri);
+    }
+    g_array_free (parser->namespaces, TRUE);
+    g_string_free (parser->text, TRUE);
+    
+    return ok;
+}
+
+gboolean
+finderz_xmp_parse_packet (const gchar *packet,
+                          gsize length,
+                          FinderzImageMetadata *img_meta)
+{
+    GMarkupParseContext *context;
+    XmpParser parser;
+    gboolean ok;
+    
+    g_return_val_if_fail (img_meta != NULL, FALSE);
+    
+    /* Embedded packets may be padded out with NULs */
+    while (length > 0 && packet[length - 1] == '\0') {
+        length--;
+    }
+    
+    context = xmp_parser_init (&parser, img_meta);
+    ok = xmp_parser_feed (&parser, context, packet, length);
+    
+    return xmp_parser_finish (&parser, context, ok);
+}
+
+gboolean
+finderz_xmp_parse_stream (GInputStream *stream,
+                          FinderzImageMetadata *img_meta,
+                          GCancellable *cancellable)
+{
+    GMarkupParseContext *context;
+    XmpParser parser;
+    gchar *block;
+    gboolean ok;
+    
+    g_return_val_if_fail (G_IS_INPUT_STREAM (stream), FALSE);
+    g_return_val_if_fail (img_meta != NULL, FALSE);
+    
+    context = xmp_parser_init (&parser, img_meta);
+    block = g_malloc (XMP_READ_BLOCK_SIZE);
+    
+    for (;;) {
+        gssize n_read = g_input_stream_read (stream, block, XMP_READ_BLOCK_SIZE,
+                                             cancellable, NULL);
+        
+        if (n_read <= 0) {
+            ok = n_read == 0;
+            break;
+        }
+        if (!xmp_parser_feed (&parser, context, block, n_read)) {
+            ok = FALSE;
+            break;
+        }
+    }
+    
+    g_free (block);
+    return xmp_parser_finish (&parser, context, ok);
+}
+
+/* The sidecar cache helpers below are called with sidecar_cache_mutex held */
+
+static void
+sidecar_cache_entry_free (SidecarCacheEntry *entry)
+{
+    g_free (entry->path);
+    finderz_universal_metadata_unref (entry->metadata);
+    g_free (entry);
+}
+
+static void
+sidecar_cache_remove (SidecarCacheEntry *entry)
+{
+    g_queue_delete_link (&sidecar_lru, entry->lru_link);
+    g_hash_table_remove (sidecar_cache, entry->path);
+}
+
+/* Takes over the caller's reference to @metadata */
+static void
+sidecar_cache_insert (const gchar *path,
+                      gint64 mtime_nsec,
+                      goffset size,
+                      FinderzUniversalMetadata *metadata)
+{
+    SidecarCacheEntry *entry;
+    
+    if (!sidecar_cache) {
+        sidecar_cache = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                               (GDestroyNotify)sidecar_cache_entry_free);
+    }
+    
+    if ((entry = g_hash_table_lookup (sidecar_cache, path))) {
+        sidecar_cache_remove (entry);
+    }
+    
+    entry = g_new0 (SidecarCacheEntry, 1);
+    entry->path = g_strdup (path);
+    entry->mtime_nsec = mtime_nsec;
+    entry->size = size;
+    entry->metadata = metadata;
+    
+    g_queue_push_head (&sidecar_lru, entry);
+    entry->lru_link = sidecar_lru.head;
+    g_hash_table_insert (sidecar_cache, entry->path, entry);
+    
+    while (g_queue_get_length (&sidecar_lru) > XMP_CACHE_MAX_ENTRIES) {
+        sidecar_cache_remove (g_queue_peek_tail (&sidecar_lru));
+    }
+}
+
+FinderzUniversalMetadata*
+finderz_xmp_read_sidecar (const gchar *sidecar_path)
+{
+    FinderzUniversalMetadata *metadata = NULL;
+    FinderzImageMetadata *img_meta;
+    SidecarCacheEntry *entry;
+    GFileInputStream *stream;
+    GFile *file;
+    GStatBuf st;
+    gint64 mtime_nsec;
+    
+    g_return_val_if_fail (sidecar_path != NULL, NULL);
+    
+    if (g_stat (sidecar_path, &st) != 0 || !S_ISREG (st.st_mode) ||
+        st.st_size > XMP_MAX_SIDECAR_SIZE) {
+        return NULL;
+    }
+    mtime_nsec = (gint64)st.st_mtim.tv_sec * G_GINT64_CONSTANT (1000000000) +
+                 st.st_mtim.tv_nsec;
+    
+    g_mutex_lock (&sidecar_cache_mutex);
+    entry = sidecar_cache ? g_hash_table_lookup (sidecar_cache, sidecar_path) : NULL;
+    if (entry && entry->mtime_nsec == mtime_nsec && entry->size == st.st_size) {
+        if (sidecar_lru.head != entry->lru_link) {
+            g_queue_unlink (&sidecar_lru, entry->lru_link);
+            g_queue_push_head_link (&sidecar_lru, entry->lru_link);
+        }
+        metadata = finderz_universal_metadata_ref (entry->metadata);
+    }
+    g_mutex_unlock (&sidecar_cache_mutex);
+    
+    if (metadata) {
+        return metadata;
+    }
+    
+    /* Parsed outside the lock; stat() came first, so a sidecar saved
+     * meanwhile is cached as the older version and read again later */
+    file = g_file_new_for_path (sidecar_path);
+    stream = g_file_read (file, NULL, NULL);
+    g_object_unref (file);
+    if (!stream) {
+        return NULL;
+    }
+    
+    img_meta = g_new0 (FinderzImageMetadata, 1);
+    if (!finderz_xmp_parse_stream (G_INPUT_STREAM (stream), img_meta, NULL)) {
+        g_debug ("FINDERZ: Incomplete XMP sidecar %s", sidecar_path);
+    }
+    g_object_unref (stream);
+    
+    metadata = finderz_image_to_universal_metadata (img_meta, sidecar_path);
+    finderz_image_metadata_free (img_meta);
+    finderz_universal_metadata_freeze (metadata);
+    
+    g_mutex_lock (&sidecar_cache_mutex);
+    sidecar_cache_insert (sidecar_path, mtime_nsec, st.st_size,
+                          finderz_universal_metadata_ref (metadata));
+    g_mutex_unlock (&sidecar_cache_mutex);
+    
+    return metadata;
+}
+
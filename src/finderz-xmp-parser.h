@@ -0,0 +1,35 @@
+/* finderz-xmp-parser.h
+ *
+ * Streaming XMP parser for embedded packets and sidecar files
+ */
+
+#ifndef FINDERZ_XMP_PARSER_H
+#define FINDERZ_XMP_PARSER_H
+
+#include <glib.h>
+#include <gio/gio.h>
+#include "finderz-universal-metadata.h"
+
+G_BEGIN_DECLS
+
+/* Fill the fields of @img_meta that are still unset from an XMP packet,
+ * such as one embedded in a JPEG.  Returns FALSE if the packet could
+ * not be parsed to the end; fields seen before the error are kept. */
+gboolean finderz_xmp_parse_packet (const gchar *packet,
+                                   gsize length,
+                                   FinderzImageMetadata *img_meta);
+
+/* Same, reading @stream in small blocks instead of all at once */
+gboolean finderz_xmp_parse_stream (GInputStream *stream,
+                                   FinderzImageMetadata *img_meta,
+                                   GCancellable *cancellable);
+
+/* The fields of the sidecar at @sidecar_path, as a frozen record.  The
+ * result is kept until the sidecar's mtime or size changes, so repeated
+ * lookups cost one stat().  Returns a new reference, or NULL if the
+ * sidecar cannot be read. */
+FinderzUniversalMetadata* finderz_xmp_read_sidecar (const gchar *sidecar_path);
+
+G_END_DECLS
+
+#endif /* FINDERZ_XMP_PARSER_H */
@@ -61,6 +61,8 @@
 #define NEMO_ACTION_SHOW_HIDDEN_FILES "Show Hidden Files"
 #define NEMO_ACTION_CLOSE "Close"
 #define NEMO_ACTION_SEARCH "Search"
+#define NEMO_ACTION_FINDERZ_FILTER "Finderz Filter"
+#define NEMO_ACTION_FINDERZ_SORTING_PROFILE "Finderz Sorting Profile"
 #define NEMO_ACTION_FOLDER_WINDOW "Folder Window"
 #define NEMO_ACTION_NEW_TAB "New Tab"
 
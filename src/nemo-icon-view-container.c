@@ -72,6 +72,13 @@ G_DEFINE_TYPE (NemoIconViewContainer, nemo_icon_view_container, NEMO_TYPE_ICON_C
 static GQuark attribute_none_q;
 static GQuark *caption_attributes = NULL;
 
+/* FINDERZ: a group header, laid out above its icons in world units */
+typedef struct {
+    guint index;
+    double y;
+    double height;
+} FinderzHeader;
+
 static NemoIconView *
 get_icon_view (NemoIconContainer *container)
 {
@@ -702,7 +709,8 @@ lay_down_one_column (NemoIconContainer *container,
 #define COLUMN_GAP 4
 #define ROW_GAP 10
 
-static void
+/* Returns where the next line would start */
+static double
 lay_down_icons_horizontal (NemoIconContainer *container,
                GList *icons,
                double start_y)
@@ -730,7 +738,7 @@ lay_down_icons_horizontal (NemoIconContainer *container,
     g_assert (NEMO_IS_ICON_CONTAINER (container));
 
     if (icons == NULL) {
-        return;
+        return start_y;
     }
 
     positions = g_array_new (FALSE, FALSE, sizeof (NemoCanvasRects));
@@ -842,9 +850,133 @@ lay_down_icons_horizontal (NemoIconContainer *container,
             }
 
         lay_down_one_line (container, line_start, NULL, y, icon_size, positions, TRUE, column_gap);
+
+        if (container->details->label_position == NEMO_ICON_LABEL_POSITION_BESIDE) {
+            y += row_gap + icon_size;
+        } else {
+            y += container->details->fixed_text_height + row_gap;
+        }
     }
 
     g_array_free (positions, TRUE);
+
+    return y;
+}
+
+static FinderzGrouping *
+get_finderz_grouping (NemoIconContainer *container)
+{
+    NemoIconView *icon_view;
+
+    icon_view = get_icon_view (container);
+    if (icon_view == NULL || !container->details->auto_layout) {
+        return NULL;
+    }
+
+    return nemo_icon_view_get_finderz_grouping (icon_view);
+}
+
+/* FINDERZ: the icons are put in the order of the grouping's rows, so
+ * showing or hiding a group never sorts the others.  FALSE when some
+ * icon is not grouped, and the icons are left as they were. */
+static gboolean
+order_icons_by_finderz_grouping (NemoIconContainer *container,
+                                 FinderzGrouping   *grouping)
+{
+    FinderzGroup *group;
+    NemoIcon *icon;
+    GList *icons;
+    guint i, j, n_icons;
+
+    icons = NULL;
+    n_icons = 0;
+    for (i = finderz_grouping_get_n_groups (grouping); i-- > 0;) {
+        group = finderz_grouping_get_group (grouping, i);
+        if (finderz_group_get_collapsed (group)) {
+            continue;
+        }
+
+        for (j = finderz_group_get_n_files (group); j-- > 0;) {
+            icon = g_hash_table_lookup (container->details->icon_set,
+                                        finderz_group_get_file (group, j));
+            if (icon != NULL) {
+                icons = g_list_prepend (icons, icon);
+                n_icons++;
+            }
+        }
+    }
+
+    if (n_icons != g_hash_table_size (container->details->icon_set)) {
+        g_list_free (icons);
+        return FALSE;
+    }
+
+    g_list_free (container->details->icons);
+    container->details->icons = icons;
+
+    return TRUE;
+}
+
+static double
+get_finderz_header_height (NemoIconContainer *container)
+{
+    PangoLayout *layout;
+    int height;
+
+    layout = gtk_widget_create_pango_layout (GTK_WIDGET (container), "Ag");
+    pango_layout_get_pixel_size (layout, NULL, &height);
+    g_object_unref (layout);
+
+    return (height + 2 * ROW_GAP) / EEL_CANVAS (container)->pixels_per_unit;
+}
+
+/* FINDERZ: each group is a header line and then its icons, laid out
+ * as lines of their own.  Returns where the last group ends. */
+static double
+lay_down_icons_grouped (NemoIconContainer *container,
+                        FinderzGrouping   *grouping,
+                        double             start_y)
+{
+    GArray *headers;
+    FinderzHeader header;
+    FinderzGroup *group;
+    NemoIcon *icon;
+    GList *group_icons;
+    double y, header_height;
+    guint i, j;
+
+    headers = NEMO_ICON_VIEW_CONTAINER (container)->finderz_headers;
+    g_array_set_size (headers, 0);
+    header_height = get_finderz_header_height (container);
+
+    y = start_y;
+    for (i = 0; i < finderz_grouping_get_n_groups (grouping); i++) {
+        group = finderz_grouping_get_group (grouping, i);
+
+        header.index = i;
+        header.y = y;
+        header.height = header_height;
+        g_array_append_val (headers, header);
+        y += header_height;
+
+        if (finderz_group_get_collapsed (group)) {
+            continue;
+        }
+
+        group_icons = NULL;
+        for (j = finderz_group_get_n_files (group); j-- > 0;) {
+            icon = g_hash_table_lookup (container->details->icon_set,
+                                        finderz_group_get_file (group, j));
+            if (icon != NULL) {
+                group_icons = g_list_prepend (group_icons, icon);
+            }
+        }
+
+        y = lay_down_icons_horizontal (container, group_icons, y);
+        g_list_free (group_icons);
+    }
+
+    return y;
 }
 
 /* column-wise layout. At the moment, this only works with label-beside-icon (used by "Compact View"). */
@@ -1172,11 +1304,32 @@ lay_down_icons_vertical_desktop (NemoIconContainer *container, GList *icons)
 static void
 nemo_icon_view_container_lay_down_icons (NemoIconContainer *container, GList *icons, double start_y)
 {
+    FinderzGrouping *grouping;
+    gboolean grouped;
+
+    /* FINDERZ: a full layout of grouped icons is done a group at a time */
+    grouping = get_finderz_grouping (container);
+    grouped = grouping != NULL && icons == container->details->icons &&
+              order_icons_by_finderz_grouping (container, grouping);
+    if (grouped) {
+        icons = container->details->icons;
+    } else if (grouping != NULL && icons == container->details->icons) {
+        nemo_icon_container_resort (container);
+        icons = container->details->icons;
+    }
+
+    g_array_set_size (NEMO_ICON_VIEW_CONTAINER (container)->finderz_headers, 0);
+    container->details->layout_bottom = 0;
+
     switch (container->details->layout_mode)
     {
     case NEMO_ICON_LAYOUT_L_R_T_B:
     case NEMO_ICON_LAYOUT_R_L_T_B:
-        lay_down_icons_horizontal (container, icons, start_y);
+        if (grouped) {
+            container->details->layout_bottom = lay_down_icons_grouped (container, grouping, start_y);
+        } else {
+            lay_down_icons_horizontal (container, icons, start_y);
+        }
         break;
 
     case NEMO_ICON_LAYOUT_T_B_L_R:
@@ -1773,6 +1926,11 @@ nemo_icon_view_container_finish_adding_new_icons (NemoIconContainer *container)
     new_icons = container->details->new_icons;
     container->details->new_icons = NULL;
 
+    /* FINDERZ: grouped icons are laid out in the grouping's order */
+    if (get_finderz_grouping (container) != NULL) {
+        container->details->needs_resort = FALSE;
+    }
+
     current_monitor = nemo_desktop_utils_get_monitor_for_widget (GTK_WIDGET(container));
 
     /* Position most icons (not unpositioned manual-layout icons). */
@@ -2057,6 +2215,103 @@ nemo_icon_view_container_get_additional_text_line_count (NemoIconContainer *cont
     return real_count;
 }
 
+/* FINDERZ: group headers are drawn under the icons, a bold line each
+ * with a triangle telling whether the group is collapsed */
+static void
+nemo_icon_view_container_draw_background (EelCanvas *canvas,
+                                          cairo_t   *cr)
+{
+    NemoIconContainer *container;
+    FinderzGrouping *grouping;
+    FinderzHeader *header;
+    FinderzGroup *group;
+    GArray *headers;
+    GtkStyleContext *context;
+    GtkAllocation allocation;
+    PangoLayout *layout;
+    PangoAttrList *attributes;
+    char *text;
+    double x, y;
+    int width;
+    guint i;
+
+    EEL_CANVAS_CLASS (nemo_icon_view_container_parent_class)->draw_background (canvas, cr);
+
+    container = NEMO_ICON_CONTAINER (canvas);
+    headers = NEMO_ICON_VIEW_CONTAINER (container)->finderz_headers;
+    grouping = get_finderz_grouping (container);
+    if (grouping == NULL || headers->len == 0) {
+        return;
+    }
+
+    context = gtk_widget_get_style_context (GTK_WIDGET (canvas));
+    gtk_widget_get_allocation (GTK_WIDGET (canvas), &allocation);
+
+    layout = gtk_widget_create_pango_layout (GTK_WIDGET (canvas), NULL);
+    attributes = pango_attr_list_new ();
+    pango_attr_list_insert (attributes, pango_attr_weight_new (PANGO_WEIGHT_BOLD));
+    pango_layout_set_attributes (layout, attributes);
+    pango_attr_list_unref (attributes);
+
+    for (i = 0; i < headers->len; i++) {
+        header = &g_array_index (headers, FinderzHeader, i);
+        group = finderz_grouping_get_group (grouping, header->index);
+        if (group == NULL) {
+            continue;
+        }
+
+        text = g_strdup_printf ("%s %s",
+                                finderz_group_get_collapsed (group) ?
+                                "\342\226\270" : "\342\226\276",
+                                finderz_group_get_name (group));
+        pango_layout_set_text (layout, text, -1);
+        g_free (text);
+        pango_layout_get_pixel_size (layout, &width, NULL);
+
+        eel_canvas_w2c_d (canvas, 0, header->y, &x, &y);
+        if (nemo_icon_container_is_layout_rtl (container)) {
+            x = allocation.width - width - COLUMN_GAP;
+        } else {
+            x = COLUMN_GAP;
+        }
+
+        gtk_render_layout (context, cr, x, y + ROW_GAP, layout);
+    }
+
+    g_object_unref (layout);
+}
+
+/* FINDERZ: a click on a group header collapses or expands the group */
+static gboolean
+nemo_icon_view_container_button_press_event (GtkWidget      *widget,
+                                             GdkEventButton *event)
+{
+    NemoIconContainer *container;
+    FinderzHeader *header;
+    GArray *headers;
+    double world_x, world_y;
+    guint i;
+
+    container = NEMO_ICON_CONTAINER (widget);
+    headers = NEMO_ICON_VIEW_CONTAINER (container)->finderz_headers;
+
+    if (event->button == 1 && event->type == GDK_BUTTON_PRESS &&
+        headers->len > 0 && get_finderz_grouping (container) != NULL) {
+        eel_canvas_window_to_world (EEL_CANVAS (widget), event->x, event->y,
+                                    &world_x, &world_y);
+
+        for (i = 0; i < headers->len; i++) {
+            header = &g_array_index (headers, FinderzHeader, i);
+            if (world_y >= header->y && world_y < header->y + header->height) {
+                nemo_icon_view_toggle_finderz_group (get_icon_view (container), header->index);
+                return TRUE;
+            }
+        }
+    }
+
+    return GTK_WIDGET_CLASS (nemo_icon_view_container_parent_class)->button_press_event (widget, event);
+}
+
 static void
 finalize (GObject *object)
 {
@@ -2072,6 +2327,8 @@ finalize (GObject *object)
                                           update_auto_strv_as_quarks,
                                           &caption_attributes);
 
+    g_array_free (NEMO_ICON_VIEW_CONTAINER (object)->finderz_headers, TRUE);
+
     G_OBJECT_CLASS (nemo_icon_view_container_parent_class)->finalize (object);
 }
 
@@ -2081,6 +2338,8 @@ nemo_icon_view_container_class_init (NemoIconViewContainerClass *klass)
 	NemoIconContainerClass *ic_class;
 
     G_OBJECT_CLASS (klass)->finalize = finalize;
+    GTK_WIDGET_CLASS (klass)->button_press_event = nemo_icon_view_container_button_press_event;
+    EEL_CANVAS_CLASS (klass)->draw_background = nemo_icon_view_container_draw_background;
 
 	ic_class = &klass->parent_class;
 
@@ -2114,6 +2373,8 @@ nemo_icon_view_container_init (NemoIconViewContainer *icon_container)
 	gtk_style_context_add_class (gtk_widget_get_style_context (GTK_WIDGET (icon_container)),
 				     GTK_STYLE_CLASS_VIEW);
 
+    icon_container->finderz_headers = g_array_new (FALSE, FALSE, sizeof (FinderzHeader));
+
     static gboolean setup_prefs = FALSE;
 
     g_signal_connect (icon_container, "get-tooltip-text", G_CALLBACK (on_get_tooltip_text), NULL);
@@ -51,6 +51,9 @@ struct NemoIconViewContainer {
 
 	NemoIconView *view;
 	gboolean    sort_for_desktop;
+
+	/* FINDERZ: where the group headers were last laid out */
+	GArray *finderz_headers;
 };
 
 struct NemoIconViewContainerClass {
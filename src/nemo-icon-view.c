@@ -36,6 +36,7 @@
 #include "nemo-desktop-window.h"
 #include "nemo-desktop-manager.h"
 #include "nemo-application.h"
+#include "finderz-integration.h"
 
 #include <stdlib.h>
 #include <eel/eel-vfs-extensions.h>
@@ -109,6 +110,12 @@ struct NemoIconViewDetails
 	const SortCriterion *sort;
 	gboolean sort_reversed;
 
+	/* FINDERZ: when set, orders the icons in place of sort */
+	FinderzSortingProfile *finderz_profile;
+	NemoDirectory *finderz_sort_directory;
+	/* FINDERZ: set when the profile groups the icons */
+	FinderzGrouping *finderz_grouping;
+
 	GtkActionGroup *icon_action_group;
 	guint icon_merge_id;
 
@@ -193,6 +200,7 @@ static void                 nemo_icon_view_clear_full                 (NemoView
                                                                        gboolean  destroying);
 static const SortCriterion *get_sort_criterion_by_metadata_text (const char *metadata_text);
 static void		    nemo_icon_view_remove_file (NemoView *view, NemoFile *file, NemoDirectory *directory);
+static void                 update_finderz_grouping                   (NemoIconView     *icon_view);
 
 G_DEFINE_TYPE (NemoIconView, nemo_icon_view, NEMO_TYPE_VIEW);
 
@@ -320,24 +328,66 @@ clear_sort_criterion (NemoIconView *icon_view)
 	real_set_sort_criterion (icon_view, NULL, TRUE, TRUE);
 }
 
+/* FINDERZ: Profile comparisons only use metadata already loaded, so
+ * when the profile reads metadata the whole folder's is asked for once
+ * here rather than file by file from the comparator. */
+static void
+set_finderz_profile (NemoIconView *icon_view,
+		     FinderzSortingProfile *profile)
+{
+	NemoDirectory *directory;
+
+	icon_view->details->finderz_profile = profile;
+	update_finderz_grouping (icon_view);
+
+	directory = NULL;
+	if (profile != NULL && finderz_sorting_profile_needs_metadata (profile)) {
+		directory = nemo_view_get_model (NEMO_VIEW (icon_view));
+	}
+
+	if (directory == icon_view->details->finderz_sort_directory) {
+		return;
+	}
+
+	if (icon_view->details->finderz_sort_directory != NULL) {
+		nemo_directory_file_monitor_remove (icon_view->details->finderz_sort_directory,
+						    &icon_view->details->finderz_sort_directory);
+		nemo_directory_unref (icon_view->details->finderz_sort_directory);
+	}
+
+	icon_view->details->finderz_sort_directory = nemo_directory_ref (directory);
+
+	if (directory != NULL) {
+		nemo_directory_file_monitor_add (directory,
+						 &icon_view->details->finderz_sort_directory,
+						 TRUE,
+						 NEMO_FILE_ATTRIBUTE_FINDERZ_METADATA,
+						 NULL, NULL);
+	}
+}
+
 static void
 nemo_icon_view_clean_up (NemoIconView *icon_view)
 {
 	NemoIconContainer *icon_container;
 	gboolean saved_sort_reversed;
+	FinderzSortingProfile *saved_profile;
 
 	icon_container = get_icon_container (icon_view);
 
 	/* Hardwire Clean Up to always be by name, in forward order */
 	saved_sort_reversed = icon_view->details->sort_reversed;
+	saved_profile = icon_view->details->finderz_profile;
 
 	nemo_icon_view_set_sort_reversed (icon_view, FALSE, FALSE);
 	set_sort_criterion (icon_view, &sort_criteria[0], FALSE);
+	icon_view->details->finderz_profile = NULL;
 
 	nemo_icon_container_sort (icon_container);
 	nemo_icon_container_freeze_icon_positions (icon_container);
 
 	nemo_icon_view_set_sort_reversed (icon_view, saved_sort_reversed, FALSE);
+	icon_view->details->finderz_profile = saved_profile;
 }
 
 static void
@@ -388,6 +438,136 @@ unref_cover (NemoIconData *data, gpointer callback_data)
 	nemo_file_unref (NEMO_FILE (data));
 }
 
+/* FINDERZ: the files of a collapsed group have no icons, and get them
+ * back when it is expanded */
+static gboolean
+finderz_show_file (NemoIconView *icon_view, NemoFile *file)
+{
+	if (nemo_icon_container_add (get_icon_container (icon_view),
+					 NEMO_ICON_CONTAINER_ICON_DATA (file))) {
+		nemo_file_ref (file);
+		return TRUE;
+	}
+	return FALSE;
+}
+
+static void
+finderz_hide_file (NemoIconView *icon_view, NemoFile *file)
+{
+	if (nemo_icon_container_remove (get_icon_container (icon_view),
+					    NEMO_ICON_CONTAINER_ICON_DATA (file))) {
+		nemo_file_unref (file);
+	}
+}
+
+static void
+finderz_show_group (NemoIconView *icon_view, FinderzGroup *group, gboolean show)
+{
+	NemoFile *file;
+	guint i, n_files;
+
+	n_files = finderz_group_get_n_files (group);
+	for (i = 0; i < n_files; i++) {
+		file = finderz_group_get_file (group, i);
+		if (show) {
+			finderz_show_file (icon_view, file);
+		} else {
+			finderz_hide_file (icon_view, file);
+		}
+	}
+}
+
+/* FINDERZ: icons are grouped when the profile groups files and they
+ * are laid out automatically; the grouping is made again from the
+ * icons there are */
+static void
+update_finderz_grouping (NemoIconView *icon_view)
+{
+	FinderzSortingProfile *profile;
+	FinderzGrouping *grouping;
+	FinderzGroup *group;
+	NemoIconContainer *icon_container;
+	GSList *file_list, *l;
+	GPtrArray *files;
+	guint i;
+
+	profile = icon_view->details->finderz_profile;
+	grouping = icon_view->details->finderz_grouping;
+	icon_container = get_icon_container (icon_view);
+
+	if (grouping != NULL) {
+		for (i = 0; icon_container != NULL && i < finderz_grouping_get_n_groups (grouping); i++) {
+			group = finderz_grouping_get_group (grouping, i);
+			if (finderz_group_get_collapsed (group)) {
+				finderz_show_group (icon_view, group, TRUE);
+			}
+		}
+		finderz_grouping_free (grouping);
+		icon_view->details->finderz_grouping = NULL;
+	}
+
+	if (profile == NULL || profile->grouping_type == FINDERZ_GROUP_NONE ||
+	    icon_view->details->is_desktop || icon_container == NULL ||
+	    !nemo_icon_view_using_auto_layout (icon_view)) {
+		return;
+	}
+
+	grouping = finderz_grouping_new (profile);
+	icon_view->details->finderz_grouping = grouping;
+
+	file_list = NULL;
+	nemo_icon_container_for_each (icon_container, list_covers, &file_list);
+	files = g_ptr_array_new ();
+	for (l = file_list; l != NULL; l = l->next) {
+		g_ptr_array_add (files, l->data);
+	}
+	finderz_grouping_add_files (grouping, files);
+	g_ptr_array_unref (files);
+	g_slist_free (file_list);
+
+	for (i = 0; i < finderz_grouping_get_n_groups (grouping); i++) {
+		group = finderz_grouping_get_group (grouping, i);
+		if (finderz_group_get_collapsed (group)) {
+			finderz_show_group (icon_view, group, FALSE);
+		}
+	}
+}
+
+FinderzGrouping *
+nemo_icon_view_get_finderz_grouping (NemoIconView *icon_view)
+{
+	g_return_val_if_fail (NEMO_IS_ICON_VIEW (icon_view), NULL);
+
+	return icon_view->details->finderz_grouping;
+}
+
+/* FINDERZ: collapses or expands the group at @index; only its own
+ * icons come or go */
+void
+nemo_icon_view_toggle_finderz_group (NemoIconView *icon_view,
+				     guint         index)
+{
+	FinderzGroup *group;
+	gboolean collapsed;
+
+	g_return_if_fail (NEMO_IS_ICON_VIEW (icon_view));
+
+	if (icon_view->details->finderz_grouping == NULL) {
+		return;
+	}
+
+	group = finderz_grouping_get_group (icon_view->details->finderz_grouping, index);
+	if (group == NULL) {
+		return;
+	}
+
+	collapsed = !finderz_group_get_collapsed (group);
+	finderz_grouping_set_group_collapsed (icon_view->details->finderz_grouping,
+					      group, collapsed);
+	finderz_show_group (icon_view, group, !collapsed);
+	nemo_icon_container_redo_layout (get_icon_container (icon_view));
+}
+
 static void
 nemo_icon_view_clear_full (NemoView *view, gboolean destroying)
 {
@@ -405,6 +585,15 @@ nemo_icon_view_clear_full (NemoView *view, gboolean destroying)
 	nemo_icon_container_for_each (icon_container, list_covers, &file_list);
 	nemo_icon_container_clear (icon_container);
 
+	/* FINDERZ: the files of collapsed groups went with the icons */
+	if (NEMO_ICON_VIEW (view)->details->finderz_grouping != NULL) {
+		finderz_grouping_free (NEMO_ICON_VIEW (view)->details->finderz_grouping);
+		NEMO_ICON_VIEW (view)->details->finderz_grouping = NULL;
+		if (!destroying) {
+			update_finderz_grouping (NEMO_ICON_VIEW (view));
+		}
+	}
+
     if (!destroying) {
         nemo_icon_container_update_scroll_region (icon_container);
     }
@@ -457,10 +646,11 @@ nemo_icon_view_remove_file (NemoView *view, NemoFile *file, NemoDirectory *direc
 
 	icon_view = NEMO_ICON_VIEW (view);
 
-	if (nemo_icon_container_remove (get_icon_container (icon_view),
-					    NEMO_ICON_CONTAINER_ICON_DATA (file))) {
-		nemo_file_unref (file);
+	if (icon_view->details->finderz_grouping != NULL) {
+		finderz_grouping_remove_file (icon_view->details->finderz_grouping, file);
 	}
+
+	finderz_hide_file (icon_view, file);
 }
 
 static void
@@ -490,10 +680,15 @@ nemo_icon_view_add_file (NemoView *view, NemoFile *file, NemoDirectory *director
 		nemo_icon_container_reset_scroll_region (icon_container);
 	}
 
-	if (nemo_icon_container_add (icon_container,
-					 NEMO_ICON_CONTAINER_ICON_DATA (file))) {
-		nemo_file_ref (file);
+	/* FINDERZ: a file that goes in a collapsed group gets no icon */
+	if (icon_view->details->finderz_grouping != NULL) {
+		finderz_grouping_add_file (icon_view->details->finderz_grouping, file);
+		if (finderz_grouping_get_file_row (icon_view->details->finderz_grouping, file) < 0) {
+			return;
+		}
 	}
+
+	finderz_show_file (icon_view, file);
 }
 
 static void
@@ -507,6 +702,19 @@ nemo_icon_view_file_changed (NemoView *view, NemoFile *file, NemoDirectory *dire
 	icon_view = NEMO_ICON_VIEW (view);
 
 	if (!icon_view->details->is_desktop) {
+		/* FINDERZ: the file may have moved into or out of a
+		 * collapsed group */
+		if (icon_view->details->finderz_grouping != NULL) {
+			finderz_grouping_file_changed (icon_view->details->finderz_grouping, file);
+			if (finderz_grouping_get_file_row (icon_view->details->finderz_grouping, file) < 0) {
+				finderz_hide_file (icon_view, file);
+				return;
+			}
+			if (finderz_show_file (icon_view, file)) {
+				return;
+			}
+		}
+
 		nemo_icon_container_request_update
 			(get_icon_container (icon_view),
 			 NEMO_ICON_CONTAINER_ICON_DATA (file));
@@ -1030,6 +1238,13 @@ nemo_icon_view_begin_loading (NemoView *view)
 	/* Set the sort direction from the metadata. */
 	nemo_icon_view_set_sort_reversed (icon_view, nemo_icon_view_get_directory_sort_reversed (icon_view, file), FALSE);
 
+	/* FINDERZ: a sorting profile for the folder takes over from both */
+	if (icon_view->details->is_desktop) {
+		set_finderz_profile (icon_view, NULL);
+	} else {
+		set_finderz_profile (icon_view, finderz_get_sorting_profile (nemo_view_get_model (view)));
+	}
+
     nemo_icon_container_set_horizontal_layout (get_icon_container (icon_view),
                                                nemo_icon_view_get_directory_horizontal_layout (icon_view, file));
 
@@ -1293,10 +1508,14 @@ nemo_icon_view_set_sort_criterion_by_sort_type (NemoIconView     *icon_view,
 	g_return_if_fail (sort != NULL);
 
 	if (sort == icon_view->details->sort
-	    && nemo_icon_view_using_auto_layout (icon_view)) {
+	    && nemo_icon_view_using_auto_layout (icon_view)
+	    && icon_view->details->finderz_profile == NULL) {
 		return;
 	}
 
+	/* FINDERZ: a sort picked by the user wins over the folder's profile */
+	set_finderz_profile (icon_view, NULL);
+
 	set_sort_criterion (icon_view, sort, TRUE);
 	nemo_icon_container_sort (get_icon_container (icon_view));
 	nemo_icon_view_reveal_selection (NEMO_VIEW (icon_view));
@@ -1314,6 +1533,7 @@ action_reversed_order_callback (GtkAction *action,
 	if (nemo_icon_view_set_sort_reversed (icon_view,
 			       gtk_toggle_action_get_active (GTK_TOGGLE_ACTION (action)),
 			       TRUE)) {
+		set_finderz_profile (icon_view, NULL);
 		nemo_icon_container_sort (get_icon_container (icon_view));
 		nemo_icon_view_reveal_selection (NEMO_VIEW (icon_view));
 	}
@@ -1351,6 +1571,9 @@ switch_to_manual_layout (NemoIconView *icon_view)
 
 	nemo_icon_container_set_auto_layout
 		(get_icon_container (icon_view), FALSE);
+
+	/* FINDERZ: icons placed by hand are not grouped */
+	update_finderz_grouping (icon_view);
 }
 
 static void
@@ -1759,6 +1982,22 @@ nemo_icon_view_compare_files (NemoIconView   *icon_view,
 				  NemoFile *a,
 				  NemoFile *b)
 {
+	if (icon_view->details->finderz_grouping != NULL) {
+		int row_a, row_b;
+
+		/* FINDERZ: grouped icons go in the rows of the grouping */
+		row_a = finderz_grouping_get_file_row (icon_view->details->finderz_grouping, a);
+		row_b = finderz_grouping_get_file_row (icon_view->details->finderz_grouping, b);
+		if (row_a >= 0 && row_b >= 0) {
+			return (row_a > row_b) - (row_a < row_b);
+		}
+	}
+
+	if (icon_view->details->finderz_profile != NULL) {
+		return finderz_sorting_profile_compare_files (icon_view->details->finderz_profile,
+							      a, b);
+	}
+
 	return nemo_file_compare_for_sort
 		(a, b, icon_view->details->sort->sort_type,
 		 /* Use type-unsafe cast for performance */
@@ -2573,6 +2812,8 @@ nemo_icon_view_finalize (GObject *object)
 
 	icon_view = NEMO_ICON_VIEW (object);
 
+	set_finderz_profile (icon_view, NULL);
+
 	g_free (icon_view->details);
 
 	g_signal_handlers_disconnect_by_func (nemo_preferences,
@@ -27,6 +27,7 @@
 #define NEMO_ICON_VIEW_H
 
 #include "nemo-view.h"
+#include "finderz-grouping.h"
 
 typedef struct NemoIconView NemoIconView;
 typedef struct NemoIconViewClass NemoIconViewClass;
@@ -96,4 +97,9 @@ void nemo_icon_view_get_directory_grid_adjusts (NemoIconView *icon_view,
                                                 NemoFile     *file,
                                                 gint         *horizontal,
                                                 gint         *vertical);
+
+/* FINDERZ: the grouping the icons are laid out in, if any */
+FinderzGrouping *nemo_icon_view_get_finderz_grouping (NemoIconView *icon_view);
+void nemo_icon_view_toggle_finderz_group (NemoIconView *icon_view,
+                                          guint         index);
 #endif /* NEMO_ICON_VIEW_H */
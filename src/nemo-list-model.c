@@ -27,6 +27,7 @@
 #include <config.h>
 
 #include "nemo-list-model.h"
+#include "finderz-grouping.h"
 
 #include <string.h>
 #include <glib.h>
@@ -77,6 +78,14 @@ struct NemoListModelDetails {
 	gboolean sort_directories_first;
 	gboolean sort_favorites_first;
 
+	/* FINDERZ: when set, orders the files in place of sort_attribute */
+	FinderzSortingProfile *finderz_profile;
+	/* FINDERZ: when the profile groups files, the top level is the
+	 * rows of the grouping, a header for each group and then its
+	 * files; files of collapsed groups wait in finderz_hidden */
+	FinderzGrouping *finderz_grouping;
+	GSequence *finderz_hidden;
+
 	GtkTreeView *drag_view;
 	int drag_begin_x;
 	int drag_begin_y;
@@ -105,6 +114,7 @@ struct FileEntry {
 	guint loaded : 1;
     guint expanding : 1;
     guint ok_to_show_thumb : 1;
+	FinderzGroup *finderz_group; /* FINDERZ: set on group header rows */
 };
 
 G_DEFINE_TYPE_WITH_CODE (NemoListModel, nemo_list_model, G_TYPE_OBJECT,
@@ -429,6 +439,8 @@ nemo_list_model_get_value (GtkTreeModel *tree_model, GtkTreeIter *iter, int colu
             {
                 g_value_set_int (value, NORMAL_TEXT_WEIGHT);
             }
+        } else if (file_entry->finderz_group != NULL) {
+            g_value_set_int (value, PANGO_WEIGHT_BOLD);
         }
         break;
     case NEMO_LIST_MODEL_ICON_SHOWN:
@@ -454,6 +466,16 @@ nemo_list_model_get_value (GtkTreeModel *tree_model, GtkTreeIter *iter, int colu
                     str = nemo_file_get_string_attribute_with_default_q (file, attribute);
                 }
 				g_value_take_string (value, str);
+			} else if (file_entry->finderz_group != NULL) {
+				/* FINDERZ: a group header, with a triangle telling
+				 * whether the group is collapsed */
+				if (attribute == attribute_name_q) {
+					str = g_strdup_printf ("%s %s",
+							       finderz_group_get_collapsed (file_entry->finderz_group) ?
+							       "\342\226\270" : "\342\226\276",
+							       finderz_group_get_name (file_entry->finderz_group));
+					g_value_take_string (value, str);
+				}
 			} else if (attribute == attribute_name_q) {
 				if (file_entry->parent->loaded) {
 					g_value_set_string (value, _("(Empty)"));
@@ -607,6 +629,10 @@ lookup_file (NemoListModel *model, NemoFile *file,
 		ptr = g_hash_table_lookup (file_entry->reverse_map, file);
 	} else {
 		ptr = g_hash_table_lookup (model->details->top_reverse_map, file);
+		/* FINDERZ: files of collapsed groups have no row */
+		if (ptr && g_sequence_iter_get_sequence (ptr) == model->details->finderz_hidden) {
+			return NULL;
+		}
 	}
 
 	if (ptr) {
@@ -630,7 +656,7 @@ dir_to_iters (struct GetIters *data,
 	GSequenceIter *ptr;
 
 	ptr = g_hash_table_lookup (reverse_map, data->file);
-	if (ptr) {
+	if (ptr && g_sequence_iter_get_sequence (ptr) != data->model->details->finderz_hidden) {
 		GtkTreeIter *iter;
 		iter = g_new0 (GtkTreeIter, 1);
 		nemo_list_model_ptr_to_iter (data->model, ptr, iter);
@@ -721,6 +747,10 @@ nemo_list_model_file_entry_compare_func (gconstpointer a,
 	file_entry2 = (FileEntry *)b;
 
 	if (file_entry1->file != NULL && file_entry2->file != NULL) {
+		if (model->details->finderz_profile != NULL) {
+			return finderz_sorting_profile_compare_files (model->details->finderz_profile,
+								      file_entry1->file, file_entry2->file);
+		}
 		result = nemo_file_compare_for_sort_by_attribute_q (file_entry1->file, file_entry2->file,
 									model->details->sort_attribute,
 									model->details->sort_directories_first,
@@ -743,6 +773,11 @@ nemo_list_model_compare_func (NemoListModel *model,
 {
 	int result;
 
+	if (model->details->finderz_profile != NULL) {
+		return finderz_sorting_profile_compare_files (model->details->finderz_profile,
+							      file1, file2);
+	}
+
 	result = nemo_file_compare_for_sort_by_attribute_q (file1, file2,
 								model->details->sort_attribute,
 								model->details->sort_directories_first,
@@ -753,6 +788,68 @@ nemo_list_model_compare_func (NemoListModel *model,
 	return result;
 }
 
+static int
+file_entry_rank_compare_func (gconstpointer a,
+			      gconstpointer b,
+			      gpointer      user_data)
+{
+	FileEntry *file_entry1;
+	FileEntry *file_entry2;
+	GHashTable *ranks;
+	guint rank1, rank2;
+
+	ranks = user_data;
+
+	file_entry1 = (FileEntry *)a;
+	file_entry2 = (FileEntry *)b;
+
+	if (file_entry1->file == NULL) {
+		return -1;
+	} else if (file_entry2->file == NULL) {
+		return 1;
+	}
+
+	rank1 = GPOINTER_TO_UINT (g_hash_table_lookup (ranks, file_entry1->file));
+	rank2 = GPOINTER_TO_UINT (g_hash_table_lookup (ranks, file_entry2->file));
+
+	return (rank1 > rank2) - (rank1 < rank2);
+}
+
+/* FINDERZ: sorting a whole level by a profile radix sorts the files on
+ * their profile keys once, rather than building the keys again in
+ * every comparison */
+static void
+sort_file_entries_by_profile (NemoListModel *model, GSequence *files)
+{
+	GSequenceIter *ptr;
+	GPtrArray *sorted;
+	GHashTable *ranks;
+	FileEntry *file_entry;
+	guint i;
+
+	sorted = g_ptr_array_sized_new (g_sequence_get_length (files));
+	for (ptr = g_sequence_get_begin_iter (files);
+	     !g_sequence_iter_is_end (ptr);
+	     ptr = g_sequence_iter_next (ptr)) {
+		file_entry = g_sequence_get (ptr);
+		if (file_entry->file != NULL) {
+			g_ptr_array_add (sorted, file_entry->file);
+		}
+	}
+
+	finderz_sorting_profile_sort_files (model->details->finderz_profile, sorted);
+
+	ranks = g_hash_table_new (g_direct_hash, g_direct_equal);
+	for (i = 0; i < sorted->len; i++) {
+		g_hash_table_insert (ranks, g_ptr_array_index (sorted, i), GUINT_TO_POINTER (i));
+	}
+
+	g_sequence_sort (files, file_entry_rank_compare_func, ranks);
+
+	g_hash_table_destroy (ranks);
+	g_ptr_array_free (sorted, TRUE);
+}
+
 static void
 nemo_list_model_sort_file_entries (NemoListModel *model, GSequence *files, GtkTreePath *path)
 {
@@ -770,6 +867,20 @@ nemo_list_model_sort_file_entries (NemoListModel *model, GSequence *files, GtkTr
 		return;
 	}
 
+	/* FINDERZ: grouped files keep the order of their groups, and only
+	 * the folders expanded among them are sorted */
+	if (model->details->finderz_grouping != NULL && files == model->details->files) {
+		for (i = 0; i < length; ++i) {
+			file_entry = g_sequence_get (g_sequence_get_iter_at_pos (files, i));
+			if (file_entry->files != NULL) {
+				gtk_tree_path_append_index (path, i);
+				nemo_list_model_sort_file_entries (model, file_entry->files, path);
+				gtk_tree_path_up (path);
+			}
+		}
+		return;
+	}
+
 	/* generate old order of GSequenceIter's */
 	old_order = g_new (GSequenceIter *, length);
 	for (i = 0; i < length; ++i) {
@@ -786,7 +897,11 @@ nemo_list_model_sort_file_entries (NemoListModel *model, GSequence *files, GtkTr
 	}
 
 	/* sort */
-	g_sequence_sort (files, nemo_list_model_file_entry_compare_func, model);
+	if (model->details->finderz_profile != NULL) {
+		sort_file_entries_by_profile (model, files);
+	} else {
+		g_sequence_sort (files, nemo_list_model_file_entry_compare_func, model);
+	}
 
 	/* generate new order */
 	new_order = g_new (int, length);
@@ -992,6 +1107,197 @@ add_dummy_row (NemoListModel *model, FileEntry *parent_entry)
 	gtk_tree_path_free (path);
 }
 
+/* FINDERZ: the row at @position of the top level goes, a header for
+ * good and a file to wait with the hidden ones */
+static void
+finderz_hide_row (NemoListModel *model, guint position)
+{
+	GSequenceIter *ptr;
+	FileEntry *file_entry;
+	GtkTreeIter iter;
+	GtkTreePath *path;
+
+	ptr = g_sequence_get_iter_at_pos (model->details->files, position);
+	file_entry = g_sequence_get (ptr);
+
+	if (file_entry->subdirectory != NULL) {
+		nemo_list_model_ptr_to_iter (model, ptr, &iter);
+		nemo_list_model_unload_subdirectory (model, &iter);
+	}
+
+	if (file_entry->file == NULL) {
+		g_sequence_remove (ptr);
+	} else {
+		g_sequence_move (ptr, g_sequence_get_end_iter (model->details->finderz_hidden));
+	}
+
+	path = gtk_tree_path_new_from_indices (position, -1);
+	model->details->stamp++;
+	gtk_tree_model_row_deleted (GTK_TREE_MODEL (model), path);
+	gtk_tree_path_free (path);
+}
+
+/* FINDERZ: the top level follows the rows of the grouping */
+static void
+finderz_grouping_rows_changed (FinderzGrouping *grouping,
+			       guint position,
+			       guint removed,
+			       guint added,
+			       gpointer user_data)
+{
+	NemoListModel *model;
+	FileEntry *file_entry;
+	FinderzGroup *group;
+	NemoFile *file;
+	GSequenceIter *ptr, *before_ptr;
+	GtkTreeIter iter;
+	GtkTreePath *path;
+	guint i;
+
+	model = NEMO_LIST_MODEL (user_data);
+
+	for (i = 0; i < removed; i++) {
+		finderz_hide_row (model, position);
+	}
+
+	for (i = position; i < position + added; i++) {
+		file = finderz_grouping_get_row (grouping, i, &group);
+		before_ptr = g_sequence_get_iter_at_pos (model->details->files, i);
+		if (file == NULL) {
+			file_entry = g_new0 (FileEntry, 1);
+			file_entry->finderz_group = group;
+			file_entry->ptr = g_sequence_insert_before (before_ptr, file_entry);
+		} else {
+			ptr = g_hash_table_lookup (model->details->top_reverse_map, file);
+			file_entry = g_sequence_get (ptr);
+			g_sequence_move (ptr, before_ptr);
+		}
+
+		nemo_list_model_ptr_to_iter (model, file_entry->ptr, &iter);
+		path = gtk_tree_path_new_from_indices (i, -1);
+		gtk_tree_model_row_inserted (GTK_TREE_MODEL (model), path, &iter);
+		if (file_entry->files != NULL && g_sequence_get_length (file_entry->files) > 0) {
+			gtk_tree_model_row_has_child_toggled (GTK_TREE_MODEL (model), path, &iter);
+		}
+		gtk_tree_path_free (path);
+	}
+}
+
+/* FINDERZ: a new file of the top level waits with the hidden ones
+ * until the grouping shows it */
+static void
+finderz_add_grouped_file (NemoListModel *model, NemoFile *file)
+{
+	FileEntry *file_entry, *dummy_file_entry;
+	guint count;
+	gboolean got_count, unreadable;
+
+	file_entry = g_new0 (FileEntry, 1);
+	file_entry->file = nemo_file_ref (file);
+	file_entry->ok_to_show_thumb =
+		nemo_file_get_load_deferred_attrs (file) == NEMO_FILE_LOAD_DEFERRED_ATTRS_PRELOAD;
+
+	if (nemo_file_is_directory (file)) {
+		file_entry->files = g_sequence_new ((GDestroyNotify)file_entry_free);
+
+		got_count = nemo_file_get_directory_item_count (file, &count, &unreadable);
+		if ((!got_count && !unreadable) || count > 0) {
+			dummy_file_entry = g_new0 (FileEntry, 1);
+			dummy_file_entry->parent = file_entry;
+			dummy_file_entry->ptr = g_sequence_append (file_entry->files, dummy_file_entry);
+		}
+	}
+
+	file_entry->ptr = g_sequence_append (model->details->finderz_hidden, file_entry);
+	g_hash_table_insert (model->details->top_reverse_map, file, file_entry->ptr);
+
+	finderz_grouping_add_file (model->details->finderz_grouping, file);
+}
+
+/* FINDERZ: whether @file of @directory is in the top level, and so
+ * grouped */
+static gboolean
+finderz_is_grouped (NemoListModel *model, NemoDirectory *directory)
+{
+	return model->details->finderz_grouping != NULL &&
+		(directory == NULL ||
+		 g_hash_table_lookup (model->details->directory_reverse_map, directory) == NULL);
+}
+
+static void
+finderz_new_grouping (NemoListModel *model)
+{
+	model->details->finderz_grouping = finderz_grouping_new (model->details->finderz_profile);
+	finderz_grouping_set_rows_changed_func (model->details->finderz_grouping,
+						finderz_grouping_rows_changed, model);
+}
+
+/* FINDERZ: every row of the top level goes, then the files come back
+ * in the groups of the profile, or sorted when it does not group */
+static void
+finderz_update_grouping (NemoListModel *model)
+{
+	FinderzSortingProfile *profile;
+	GSequence *hidden;
+	GSequenceIter *ptr;
+	GPtrArray *files;
+	FileEntry *file_entry;
+	GtkTreeIter iter;
+	GtkTreePath *path;
+
+	profile = model->details->finderz_profile;
+	hidden = model->details->finderz_hidden;
+
+	if (model->details->finderz_grouping == NULL &&
+	    (profile == NULL || profile->grouping_type == FINDERZ_GROUP_NONE)) {
+		nemo_list_model_sort (model);
+		return;
+	}
+
+	while (!g_sequence_is_empty (model->details->files)) {
+		finderz_hide_row (model, 0);
+	}
+	finderz_grouping_free (model->details->finderz_grouping);
+	model->details->finderz_grouping = NULL;
+
+	if (profile != NULL && profile->grouping_type != FINDERZ_GROUP_NONE) {
+		files = g_ptr_array_sized_new (g_sequence_get_length (hidden));
+		for (ptr = g_sequence_get_begin_iter (hidden);
+		     !g_sequence_iter_is_end (ptr);
+		     ptr = g_sequence_iter_next (ptr)) {
+			file_entry = g_sequence_get (ptr);
+			g_ptr_array_add (files, file_entry->file);
+		}
+
+		finderz_new_grouping (model);
+		finderz_grouping_add_files (model->details->finderz_grouping, files);
+		g_ptr_array_unref (files);
+		return;
+	}
+
+	g_sequence_move_range (g_sequence_get_end_iter (model->details->files),
+			       g_sequence_get_begin_iter (hidden),
+			       g_sequence_get_end_iter (hidden));
+	if (profile != NULL) {
+		sort_file_entries_by_profile (model, model->details->files);
+	} else {
+		g_sequence_sort (model->details->files, nemo_list_model_file_entry_compare_func, model);
+	}
+
+	for (ptr = g_sequence_get_begin_iter (model->details->files);
+	     !g_sequence_iter_is_end (ptr);
+	     ptr = g_sequence_iter_next (ptr)) {
+		file_entry = g_sequence_get (ptr);
+		nemo_list_model_ptr_to_iter (model, ptr, &iter);
+		path = gtk_tree_model_get_path (GTK_TREE_MODEL (model), &iter);
+		gtk_tree_model_row_inserted (GTK_TREE_MODEL (model), path, &iter);
+		if (file_entry->files != NULL && g_sequence_get_length (file_entry->files) > 0) {
+			gtk_tree_model_row_has_child_toggled (GTK_TREE_MODEL (model), path, &iter);
+		}
+		gtk_tree_path_free (path);
+	}
+}
+
 gboolean
 nemo_list_model_add_file (NemoListModel *model, NemoFile *file,
 			      NemoDirectory *directory)
@@ -1019,6 +1325,11 @@ nemo_list_model_add_file (NemoListModel *model, NemoFile *file,
 		return FALSE;
 	}
 
+	if (parent_ptr == NULL && model->details->finderz_grouping != NULL) {
+		finderz_add_grouped_file (model, file);
+		return TRUE;
+	}
+
 	file_entry = g_new0 (FileEntry, 1);
 	file_entry->file = nemo_file_ref (file);
 	file_entry->parent = NULL;
@@ -1145,9 +1456,15 @@ nemo_list_model_file_changed (NemoListModel *model, NemoFile *file,
 	GSequenceIter *ptr;
 	int pos_before, pos_after, length, i, old;
 	int *new_order;
-	gboolean has_iter;
+	gboolean has_iter, grouped;
 	GSequence *files;
 
+	grouped = finderz_is_grouped (model, directory);
+	if (grouped) {
+		/* FINDERZ: the grouping moves the row where it belongs */
+		finderz_grouping_file_changed (model->details->finderz_grouping, file);
+	}
+
 	ptr = lookup_file (model, file, directory);
 	if (!ptr) {
 		return;
@@ -1155,7 +1472,7 @@ nemo_list_model_file_changed (NemoListModel *model, NemoFile *file,
 
 	pos_before = g_sequence_iter_get_position (ptr);
 
-        if (!model->details->temp_unsorted)
+        if (!model->details->temp_unsorted && !grouped)
                 g_sequence_sort_changed (ptr, nemo_list_model_file_entry_compare_func, model);
 
 	pos_after = g_sequence_iter_get_position (ptr);
@@ -1214,12 +1531,16 @@ nemo_list_model_file_changed (NemoListModel *model, NemoFile *file,
 gboolean
 nemo_list_model_is_empty (NemoListModel *model)
 {
-	return (g_sequence_get_length (model->details->files) == 0);
+	return (nemo_list_model_get_length (model) == 0);
 }
 
 guint
 nemo_list_model_get_length (NemoListModel *model)
 {
+	/* FINDERZ: group headers are not files */
+	if (model->details->finderz_grouping != NULL) {
+		return g_hash_table_size (model->details->top_reverse_map);
+	}
 	return g_sequence_get_length (model->details->files);
 }
 
@@ -1314,6 +1635,18 @@ nemo_list_model_remove_file (NemoListModel *model, NemoFile *file,
 			   NemoDirectory *directory)
 {
 	GtkTreeIter iter;
+	GSequenceIter *ptr;
+
+	if (finderz_is_grouped (model, directory)) {
+		/* FINDERZ: the grouping hides the row, then the file goes */
+		finderz_grouping_remove_file (model->details->finderz_grouping, file);
+		ptr = g_hash_table_lookup (model->details->top_reverse_map, file);
+		if (ptr != NULL) {
+			g_hash_table_remove (model->details->top_reverse_map, file);
+			g_sequence_remove (ptr);
+		}
+		return;
+	}
 
 	if (nemo_list_model_get_tree_iter_from_file (model, file, directory, &iter)) {
 		nemo_list_model_remove (model, &iter);
@@ -1342,9 +1675,25 @@ nemo_list_model_clear_directory (NemoListModel *model, GSequence *files)
 void
 nemo_list_model_clear (NemoListModel *model)
 {
+	GSequenceIter *ptr;
+	FileEntry *file_entry;
+
 	g_return_if_fail (model != NULL);
 
 	nemo_list_model_clear_directory (model, model->details->files);
+
+	if (model->details->finderz_grouping != NULL) {
+		while (!g_sequence_is_empty (model->details->finderz_hidden)) {
+			ptr = g_sequence_get_begin_iter (model->details->finderz_hidden);
+			file_entry = g_sequence_get (ptr);
+			g_hash_table_remove (model->details->top_reverse_map, file_entry->file);
+			g_sequence_remove (ptr);
+		}
+
+		/* FINDERZ: date ranges of the new grouping start from now */
+		finderz_grouping_free (model->details->finderz_grouping);
+		finderz_new_grouping (model);
+	}
 }
 
 NemoFile *
@@ -1460,6 +1809,55 @@ nemo_list_model_set_should_sort_directories_first (NemoListModel *model, gboolea
 	nemo_list_model_sort (model);
 }
 
+/* FINDERZ: @profile, which the model does not own, orders the files
+ * until it is set back to NULL */
+void
+nemo_list_model_set_sorting_profile (NemoListModel *model, FinderzSortingProfile *profile)
+{
+	if (model->details->finderz_profile == profile) {
+		return;
+	}
+
+	model->details->finderz_profile = profile;
+	finderz_update_grouping (model);
+}
+
+FinderzSortingProfile *
+nemo_list_model_get_sorting_profile (NemoListModel *model)
+{
+	return model->details->finderz_profile;
+}
+
+/* FINDERZ: collapses or expands the group whose header is at @path,
+ * leaving the rows of the other groups as they are */
+gboolean
+nemo_list_model_toggle_group (NemoListModel *model, GtkTreePath *path)
+{
+	GtkTreeIter iter;
+	FileEntry *file_entry;
+	FinderzGroup *group;
+
+	if (model->details->finderz_grouping == NULL ||
+	    !gtk_tree_model_get_iter (GTK_TREE_MODEL (model), &iter, path)) {
+		return FALSE;
+	}
+
+	file_entry = g_sequence_get (iter.user_data);
+	group = file_entry->finderz_group;
+	if (group == NULL) {
+		return FALSE;
+	}
+
+	finderz_grouping_set_group_collapsed (model->details->finderz_grouping, group,
+					      !finderz_group_get_collapsed (group));
+
+	/* The header shows whether its group is collapsed */
+	nemo_list_model_ptr_to_iter (model, file_entry->ptr, &iter);
+	gtk_tree_model_row_changed (GTK_TREE_MODEL (model), path, &iter);
+
+	return TRUE;
+}
+
 void
 nemo_list_model_set_should_sort_favorites_first (NemoListModel *model, gboolean sort_favorites_first)
 {
@@ -1656,6 +2054,13 @@ nemo_list_model_dispose (GObject *object)
 		model->details->files = NULL;
 	}
 
+	if (model->details->finderz_hidden) {
+		g_sequence_free (model->details->finderz_hidden);
+		model->details->finderz_hidden = NULL;
+	}
+	finderz_grouping_free (model->details->finderz_grouping);
+	model->details->finderz_grouping = NULL;
+
 	if (model->details->top_reverse_map) {
 		g_hash_table_destroy (model->details->top_reverse_map);
 		model->details->top_reverse_map = NULL;
@@ -1690,6 +2095,7 @@ nemo_list_model_init (NemoListModel *model)
 {
 	model->details = g_new0 (NemoListModelDetails, 1);
 	model->details->files = g_sequence_new ((GDestroyNotify)file_entry_free);
+	model->details->finderz_hidden = g_sequence_new ((GDestroyNotify)file_entry_free);
 	model->details->top_reverse_map = g_hash_table_new (g_direct_hash, g_direct_equal);
 	model->details->directory_reverse_map = g_hash_table_new (g_direct_hash, g_direct_equal);
 	model->details->stamp = g_random_int ();
@@ -28,6 +28,8 @@
 #include <libnemo-private/nemo-directory.h>
 #include <libnemo-extension/nemo-column.h>
 
+#include "finderz-sorting-profiles.h"
+
 #ifndef NEMO_LIST_MODEL_H
 #define NEMO_LIST_MODEL_H
 
@@ -99,6 +101,11 @@ void     nemo_list_model_set_should_sort_directories_first (NemoListModel
 								gboolean              sort_directories_first);
 void     nemo_list_model_set_should_sort_favorites_first (NemoListModel          *model,
 								gboolean              sort_favorites_first);
+void     nemo_list_model_set_sorting_profile               (NemoListModel          *model,
+								FinderzSortingProfile *profile);
+FinderzSortingProfile *nemo_list_model_get_sorting_profile (NemoListModel *model);
+gboolean nemo_list_model_toggle_group                      (NemoListModel          *model,
+								GtkTreePath          *path);
 int      nemo_list_model_get_sort_column_id_from_attribute (NemoListModel *model,
 								GQuark       attribute);
 GQuark   nemo_list_model_get_attribute_from_sort_column_id (NemoListModel *model,
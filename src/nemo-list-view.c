@@ -34,6 +34,8 @@
 #include "nemo-view-dnd.h"
 #include "nemo-view-factory.h"
 #include "nemo-window.h"
+#include "finderz-file-attributes.h"
+#include "finderz-integration.h"
 
 #include <string.h>
 #include <eel/eel-vfs-extensions.h>
@@ -118,6 +120,9 @@ struct NemoListViewDetails {
 
 	GQuark last_sort_attr;
 
+	/* FINDERZ: The folder whose metadata is loaded for sorting by it */
+	NemoDirectory *finderz_sort_directory;
+
     gboolean tooltip_flags;
     gboolean show_tooltips;
 
@@ -832,6 +837,11 @@ static void
 row_activated_callback (GtkTreeView *treeview, GtkTreePath *path,
 			GtkTreeViewColumn *column, NemoListView *view)
 {
+	/* FINDERZ: activating a group header collapses or expands it */
+	if (nemo_list_model_toggle_group (view->details->model, path)) {
+		return;
+	}
+
 	activate_selected_items (view);
 }
 
@@ -1133,6 +1143,13 @@ button_press_callback (GtkWidget *widget, GdkEventButton *event, gpointer callba
 	call_parent = TRUE;
 	if (gtk_tree_view_get_path_at_pos (tree_view, event->x, event->y,
 					   &path, NULL, NULL, NULL)) {
+		/* FINDERZ: a click on a group header collapses or expands it */
+		if (event->button == 1 &&
+		    nemo_list_model_toggle_group (view->details->model, path)) {
+			gtk_tree_path_free (path);
+			return TRUE;
+		}
+
         if (g_settings_get_boolean (nemo_list_view_preferences,
                                       NEMO_PREFERENCES_LIST_VIEW_ENABLE_EXPANSION)) {
     		gtk_widget_style_get (widget,
@@ -1619,6 +1636,56 @@ sort_criterion_changes_due_to_user (GtkTreeView *tree_view)
 	return ret;
 }
 
+/* FINDERZ: Metadata comparisons only use records already loaded, so
+ * when sorting by a metadata column, or by a profile that reads
+ * metadata, the whole folder's metadata is asked for once here rather
+ * than file by file from the comparator. */
+static void
+update_finderz_sort_monitor (NemoListView *view)
+{
+	NemoDirectory *directory;
+	FinderzSortingProfile *profile;
+	gint sort_column_id;
+	GQuark sort_attr;
+
+	directory = NULL;
+	profile = view->details->model != NULL ?
+		nemo_list_model_get_sorting_profile (view->details->model) : NULL;
+	if (profile != NULL) {
+		if (finderz_sorting_profile_needs_metadata (profile)) {
+			directory = nemo_view_get_model (NEMO_VIEW (view));
+		}
+	} else if (view->details->model != NULL &&
+	    gtk_tree_sortable_get_sort_column_id (GTK_TREE_SORTABLE (view->details->model),
+						  &sort_column_id, NULL)) {
+		sort_attr = nemo_list_model_get_attribute_from_sort_column_id (view->details->model,
+									       sort_column_id);
+		if (sort_attr != 0 && finderz_is_metadata_attribute (g_quark_to_string (sort_attr))) {
+			directory = nemo_view_get_model (NEMO_VIEW (view));
+		}
+	}
+
+	if (directory == view->details->finderz_sort_directory) {
+		return;
+	}
+
+	if (view->details->finderz_sort_directory != NULL) {
+		nemo_directory_file_monitor_remove (view->details->finderz_sort_directory,
+						    &view->details->finderz_sort_directory);
+		nemo_directory_unref (view->details->finderz_sort_directory);
+	}
+
+	view->details->finderz_sort_directory = nemo_directory_ref (directory);
+
+	if (directory != NULL) {
+		nemo_directory_file_monitor_add (directory,
+						 &view->details->finderz_sort_directory,
+						 TRUE,
+						 NEMO_FILE_ATTRIBUTE_FINDERZ_METADATA,
+						 NULL, NULL);
+	}
+}
+
 static void
 sort_column_changed_callback (GtkTreeSortable *sortable,
 			      NemoListView *view)
@@ -1651,6 +1718,11 @@ sort_column_changed_callback (GtkTreeSortable *sortable,
 
 	default_reversed_attr = (default_sort_reversed ? (char *)"true" : (char *)"false");
 
+	/* FINDERZ: a column picked by the user wins over the folder's profile */
+	if (sort_criterion_changes_due_to_user (view->details->tree_view)) {
+		nemo_list_model_set_sorting_profile (view->details->model, NULL);
+	}
+
 	if (view->details->last_sort_attr != sort_attr &&
 	    sort_criterion_changes_due_to_user (view->details->tree_view)) {
 		/* at this point, the sort order is always GTK_SORT_ASCENDING, if the sort column ID
@@ -1688,6 +1760,8 @@ sort_column_changed_callback (GtkTreeSortable *sortable,
 	nemo_list_view_reveal_selection (NEMO_VIEW (view));
 
 	view->details->last_sort_attr = sort_attr;
+
+	update_finderz_sort_monitor (view);
 }
 
 static gboolean
@@ -2125,6 +2199,97 @@ column_header_clicked (GtkWidget *column_button,
 	return TRUE;
 }
 
+static void
+append_text_column (NemoListView *view,
+		    int column_num,
+		    const char *name,
+		    const char *label,
+		    float xalign,
+		    gint width_chars,
+		    gboolean ellipsize)
+{
+	GtkCellRenderer *cell;
+	GtkTreeViewColumn *column;
+
+	cell = gtk_cell_renderer_text_new ();
+    g_object_set (cell,
+                  "xalign", xalign,
+                  "xpad", 5,
+                  "width-chars", width_chars,
+                  "ellipsize", ellipsize,
+                  NULL);
+
+	view->details->cells = g_list_append (view->details->cells,
+					      cell);
+    g_object_set_data_full (G_OBJECT (cell),
+                            "column-id", g_strdup (name),
+                            g_free);
+
+    column = gtk_tree_view_column_new ();
+    g_object_set_data_full (G_OBJECT (column),
+                            "column-id", g_strdup (name),
+                            g_free);
+
+    gtk_tree_view_column_set_title (column, label);
+    gtk_tree_view_column_pack_start (column, cell, TRUE);
+    gtk_tree_view_column_set_attributes (column, cell,
+                                         "text", column_num,
+                                         "weight", NEMO_LIST_MODEL_TEXT_WEIGHT_COLUMN,
+                                         NULL);
+
+    gtk_tree_view_append_column (view->details->tree_view, column);
+    gtk_tree_view_column_set_min_width (column, 30);
+	gtk_tree_view_column_set_sort_column_id (column, column_num);
+
+    g_hash_table_insert (view->details->columns,
+                         g_strdup (name),
+                         column);
+
+    g_signal_connect (gtk_tree_view_column_get_button (column),
+                      "button-press-event",
+                      G_CALLBACK (column_header_clicked),
+                      view);
+
+	gtk_tree_view_column_set_resizable (column, TRUE);
+    gtk_tree_view_column_set_reorderable (column, TRUE);
+}
+
+/* FINDERZ: Metadata columns follow the fields found as files are
+ * extracted, so a column can be offered after the view was set up;
+ * it is added to the model and the tree view the first time it is. */
+static void
+add_new_columns (NemoListView *view,
+		 GList *nemo_columns)
+{
+	GList *l;
+
+	for (l = nemo_columns; l != NULL; l = l->next) {
+		int column_num;
+		char *name;
+		char *label;
+		float xalign;
+		gint width_chars;
+		gboolean ellipsize;
+
+		g_object_get (l->data,
+			      "name", &name,
+			      "label", &label,
+			      "xalign", &xalign,
+			      "width-chars", &width_chars,
+			      "ellipsize", &ellipsize, NULL);
+
+		if (g_hash_table_lookup (view->details->columns, name) == NULL) {
+			column_num = nemo_list_model_add_column (view->details->model,
+								 NEMO_COLUMN (l->data));
+			append_text_column (view, column_num, name, label,
+					    xalign, width_chars, ellipsize);
+		}
+
+		g_free (name);
+		g_free (label);
+	}
+}
+
 static void
 apply_columns_settings (NemoListView *list_view,
 			char **column_order,
@@ -2144,6 +2309,7 @@ apply_columns_settings (NemoListView *list_view,
 
 	all_columns = nemo_get_columns_for_file (file);
 	all_columns = nemo_sort_columns (all_columns, column_order);
+	add_new_columns (list_view, all_columns);
 
 	/* hash table to lookup if a given column should be visible */
 	visible_columns_hash = g_hash_table_new_full (g_str_hash,
@@ -2518,7 +2684,6 @@ static void
 create_and_set_up_tree_view (NemoListView *view)
 {
 	GtkCellRenderer *cell;
-	GtkTreeViewColumn *column;
 	GtkBindingSet *binding_set;
 	AtkObject *atk_obj;
 	GList *nemo_columns;
@@ -2718,47 +2883,8 @@ create_and_set_up_tree_view (NemoListView *view)
 								 (GtkTreeCellDataFunc) filename_cell_data_func,
 								 view, NULL);
 		} else {
-			cell = gtk_cell_renderer_text_new ();
-            g_object_set (cell,
-                          "xalign", xalign,
-                          "xpad", 5,
-                          "width-chars", width_chars,
-                          "ellipsize", ellipsize,
-                          NULL);
-
-			view->details->cells = g_list_append (view->details->cells,
-							      cell);
-            g_object_set_data_full (G_OBJECT (cell),
-                                    "column-id", g_strdup (name),
-                                    g_free);
-
-            column = gtk_tree_view_column_new ();
-            g_object_set_data_full (G_OBJECT (column),
-                                    "column-id", g_strdup (name),
-                                    g_free);
-
-            gtk_tree_view_column_set_title (column, label);
-            gtk_tree_view_column_pack_start (column, cell, TRUE);
-            gtk_tree_view_column_set_attributes (column, cell,
-                                                 "text", column_num,
-                                                 "weight", NEMO_LIST_MODEL_TEXT_WEIGHT_COLUMN,
-                                                 NULL);
-
-            gtk_tree_view_append_column (view->details->tree_view, column);
-            gtk_tree_view_column_set_min_width (column, 30);
-			gtk_tree_view_column_set_sort_column_id (column, column_num);
-
-            g_hash_table_insert (view->details->columns,
-                                 g_strdup (name),
-                                 column);
-
-            g_signal_connect (gtk_tree_view_column_get_button (column),
-                              "button-press-event",
-                              G_CALLBACK (column_header_clicked),
-                              view);
-
-			gtk_tree_view_column_set_resizable (column, TRUE);
-            gtk_tree_view_column_set_reorderable (column, TRUE);
+			append_text_column (view, column_num, name, label,
+					    xalign, width_chars, ellipsize);
 		}
 		g_free (name);
 		g_free (label);
@@ -3086,6 +3212,10 @@ nemo_list_view_begin_loading (NemoView *view)
     set_ok_to_load_deferred_attrs (list_view, FALSE);
 
     nemo_list_model_set_view_directory (list_view->details->model, nemo_view_get_model (view));
+    nemo_list_model_set_sorting_profile (list_view->details->model,
+                                         finderz_get_sorting_profile (nemo_view_get_model (view)));
+
+    update_finderz_sort_monitor (list_view);
 
     AtkObject *atk = gtk_widget_get_accessible (GTK_WIDGET (NEMO_LIST_VIEW (view)->details->tree_view));
 
@@ -4121,6 +4251,13 @@ nemo_list_view_dispose (GObject *object)
     g_signal_handlers_disconnect_by_func (gtk_settings_get_default (), update_date_fonts, list_view);
     g_signal_handlers_disconnect_by_func (nemo_preferences, update_date_fonts, list_view);
 
+	if (list_view->details->finderz_sort_directory != NULL) {
+		nemo_directory_file_monitor_remove (list_view->details->finderz_sort_directory,
+						    &list_view->details->finderz_sort_directory);
+		nemo_directory_unref (list_view->details->finderz_sort_directory);
+		list_view->details->finderz_sort_directory = NULL;
+	}
+
 	if (list_view->details->model) {
 		stop_cell_editing (list_view);
 		g_object_unref (list_view->details->model);
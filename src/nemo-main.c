@@ -113,6 +113,12 @@ main (int argc, char *argv[])
 
 	g_object_unref (application);
 
+	/* FINDERZ: Write out queued metadata before exiting */
+	{
+		extern void finderz_cleanup (void);
+		finderz_cleanup ();
+	}
+
  	eel_debug_shut_down ();
 
 	return retval;
@@ -493,6 +493,7 @@ nemo_query_editor_get_query (NemoQueryEditor *editor)
 {
     NemoQuery *query;
     gchar *sanitized = NULL;
+    gchar *file_search_text = NULL;
     const gchar *content_search_text = NULL;
 
 	if (editor == NULL || editor->priv == NULL || editor->priv->file_entry == NULL) {
@@ -510,8 +511,12 @@ nemo_query_editor_get_query (NemoQueryEditor *editor)
     nemo_query_set_recurse (query, gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (editor->priv->file_recurse_toggle)));
     nemo_query_set_location (query, editor->priv->current_uri);
 
+    /* FINDERZ: a term like prompt:"cyberpunk alley" searches the metadata
+     * text index, and the rest of the entry still matches file names */
     sanitized = get_sanitized_file_search_string (editor);
-    GString *file_string = g_string_new (sanitized);
+    file_search_text = nemo_query_take_metadata_pattern (query, sanitized);
+    GString *file_string = g_string_new (file_search_text);
+    g_free (file_search_text);
     g_free (sanitized);
 
     /* - Search for 'all' needs to be different depending on whether regex is enabled for files.
@@ -570,6 +575,21 @@ nemo_query_editor_set_query (NemoQueryEditor	*editor,
         file_pattern = g_strdup ("");
     }
 
+    /* FINDERZ: give back the metadata term the query was made from */
+    if (query != NULL && nemo_query_has_metadata_pattern (query)) {
+        gchar *field = nemo_query_get_metadata_field (query);
+        gchar *metadata_pattern = nemo_query_get_metadata_pattern (query);
+
+        if (field != NULL) {
+            gchar *text = g_strdup_printf ("%s:\"%s\" %s", field, metadata_pattern, file_pattern);
+
+            g_free (file_pattern);
+            file_pattern = text;
+        }
+        g_free (metadata_pattern);
+        g_free (field);
+    }
+
     if (!content_pattern) {
         content_pattern = g_strdup ("");
     }
@@ -40,6 +40,8 @@
 #include "nemo-properties-window.h"
 #include "nemo-bookmark-list.h"
 #include "nemo-directory-private.h"
+#include "finderz-filter.h"
+#include "finderz-file-attributes.h"
 
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -243,6 +245,10 @@ struct NemoViewDetails
 	GList *old_added_files;
 	GList *old_changed_files;
 
+	/* FINDERZ: Metadata filter, and the files it keeps out of the view */
+	FinderzFilter *metadata_filter;
+	GHashTable *filtered_files;
+
 	GList *pending_selection;
 
 	/* whether we are in the active slot */
@@ -962,6 +968,18 @@ file_and_directory_list_from_files (NemoDirectory *directory, GList *files)
 	return g_list_reverse (res);
 }
 
+static FileAndDirectory *
+file_and_directory_new (NemoFile *file, NemoDirectory *directory)
+{
+	FileAndDirectory *fad;
+
+	fad = g_new0 (FileAndDirectory, 1);
+	fad->directory = nemo_directory_ref (directory);
+	fad->file = nemo_file_ref (file);
+
+	return fad;
+}
+
 static void
 file_and_directory_free (FileAndDirectory *fad)
 {
@@ -1004,6 +1022,17 @@ file_and_directory_hash  (gconstpointer  v)
 	return GPOINTER_TO_UINT (fad->file) ^ GPOINTER_TO_UINT (fad->directory);
 }
 
+static gboolean
+file_and_directory_in_directory (gpointer key,
+				 gpointer value,
+				 gpointer user_data)
+{
+	const FileAndDirectory *fad;
+
+	fad = key;
+	return fad->directory == user_data;
+}
+
 
 
 
@@ -2734,6 +2763,11 @@ nemo_view_init (NemoView *view)
 				       file_and_directory_equal,
 				       (GDestroyNotify)file_and_directory_free,
 				       NULL);
+	view->details->filtered_files =
+		g_hash_table_new_full (file_and_directory_hash,
+				       file_and_directory_equal,
+				       (GDestroyNotify)file_and_directory_free,
+				       NULL);
 
 	gtk_scrolled_window_set_policy (GTK_SCROLLED_WINDOW (view),
 					GTK_POLICY_AUTOMATIC,
@@ -3029,6 +3063,8 @@ nemo_view_finalize (GObject *object)
     g_clear_pointer (&view->details->detail_string, g_free);
 
 	g_hash_table_destroy (view->details->non_ready_files);
+	g_hash_table_destroy (view->details->filtered_files);
+	finderz_filter_free (view->details->metadata_filter);
 
 	G_OBJECT_CLASS (nemo_view_parent_class)->finalize (object);
 }
@@ -3615,6 +3651,63 @@ ready_to_load (NemoFile *file)
 					     NEMO_FILE_ATTRIBUTES_FOR_ICON);
 }
 
+/* FINDERZ: Whether @file passes @filter.  Its metadata is only looked
+ * at, and loaded if it is not yet, when the filter has metadata terms. */
+static gboolean
+file_passes_metadata_filter (FinderzFilter *filter, NemoFile *file)
+{
+	return finderz_filter_matches (filter,
+				       nemo_file_peek_name (file),
+				       finderz_filter_needs_metadata (filter) ?
+				       finderz_file_peek_metadata (file) : NULL);
+}
+
+/* FINDERZ: Whether @file would be shown but for the metadata filter */
+static gboolean
+hidden_by_metadata_filter (NemoView *view, NemoFile *file)
+{
+	return view->details->metadata_filter != NULL &&
+		nemo_file_should_show (file,
+				       view->details->show_hidden_files,
+				       view->details->show_foreign_files) &&
+		!file_passes_metadata_filter (view->details->metadata_filter, file);
+}
+
+/* FINDERZ: Follow a changed file in or out of the metadata filter, as
+ * its metadata arrives or changes.  Returns TRUE when the file now
+ * passes and has to be added, or no longer passes and has to be
+ * removed, in which case it is in filtered_files. */
+static gboolean
+process_changed_filtered_file (NemoView *view, FileAndDirectory *pending)
+{
+	GHashTable *filtered_files;
+
+	filtered_files = view->details->filtered_files;
+
+	if (g_hash_table_lookup (filtered_files, pending) != NULL) {
+		if (!view_file_still_belongs (view, pending->file, pending->directory)) {
+			g_hash_table_remove (filtered_files, pending);
+			return FALSE;
+		}
+		if (!nemo_view_should_show_file (view, pending->file)) {
+			return FALSE;
+		}
+
+		g_hash_table_remove (filtered_files, pending);
+		return TRUE;
+	}
+
+	if (view_file_still_belongs (view, pending->file, pending->directory) &&
+	    hidden_by_metadata_filter (view, pending->file)) {
+		g_hash_table_remove (view->details->non_ready_files, pending);
+		g_hash_table_add (filtered_files,
+				  file_and_directory_new (pending->file, pending->directory));
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
 static int
 compare_files_cover (gconstpointer a, gconstpointer b, gpointer callback_data)
 {
@@ -3683,6 +3776,9 @@ process_new_files (NemoView *view)
 					g_hash_table_insert (non_ready_files, pending, pending);
 				}
 			}
+		} else if (hidden_by_metadata_filter (view, pending->file)) {
+			g_hash_table_add (view->details->filtered_files,
+					  file_and_directory_new (pending->file, pending->directory));
 		}
 	}
 	file_and_directory_list_free (new_added_files);
@@ -3695,6 +3791,18 @@ process_new_files (NemoView *view)
 	for (node = new_changed_files; node != NULL; node = next) {
 		next = node->next;
 		pending = (FileAndDirectory *)node->data;
+		if (view->details->metadata_filter != NULL &&
+		    process_changed_filtered_file (view, pending)) {
+			new_changed_files = g_list_delete_link (new_changed_files, node);
+			if (g_hash_table_lookup (view->details->filtered_files, pending) != NULL) {
+				old_changed_files = g_list_prepend (old_changed_files, pending);
+			} else if (ready_to_load (pending->file)) {
+				old_added_files = g_list_prepend (old_added_files, pending);
+			} else {
+				g_hash_table_insert (non_ready_files, pending, pending);
+			}
+			continue;
+		}
 		if (!still_should_show_file (view, pending->file, pending->directory) || ready_to_load (pending->file)) {
 			if (g_hash_table_lookup (non_ready_files, pending) != NULL) {
 				g_hash_table_remove (non_ready_files, pending);
@@ -3744,6 +3852,12 @@ process_old_files (NemoView *view)
 
 		for (node = files_added; node != NULL; node = node->next) {
 			pending = node->data;
+			/* FINDERZ: The metadata filter may have changed since */
+			if (hidden_by_metadata_filter (view, pending->file)) {
+				g_hash_table_add (view->details->filtered_files,
+						  file_and_directory_new (pending->file, pending->directory));
+				continue;
+			}
 			g_signal_emit (view,
 				       signals[ADD_FILE], 0, pending->file, pending->directory);
 		}
@@ -4203,6 +4317,9 @@ nemo_view_remove_subdirectory (NemoView  *view,
 
 	nemo_directory_file_monitor_remove (directory, &view->details->model);
 
+	g_hash_table_foreach_remove (view->details->filtered_files,
+				     file_and_directory_in_directory, directory);
+
 	nemo_directory_unref (directory);
 }
 
@@ -10417,6 +10534,7 @@ load_directory (NemoView *view,
 
 	nemo_view_stop_loading (view);
 	g_signal_emit (view, signals[CLEAR], 0);
+	g_hash_table_remove_all (view->details->filtered_files);
 
 	view->details->loading = TRUE;
 
@@ -10531,6 +10649,26 @@ finish_loading (NemoView *view)
 		NEMO_FILE_ATTRIBUTE_EXTENSION_INFO |
         NEMO_FILE_ATTRIBUTE_FAVORITE_CHECK;
 
+	/* FINDERZ: Where most files carry metadata, or the metadata filter
+	 * needs it, it is loaded with the listing, rather than file by file
+	 * as columns ask for it */
+	if (view->details->metadata_filter != NULL &&
+	    finderz_filter_needs_metadata (view->details->metadata_filter)) {
+		attributes |= NEMO_FILE_ATTRIBUTE_FINDERZ_METADATA;
+	} else {
+		extern gboolean finderz_field_census_should_prefetch (const gchar *directory);
+		GFile *location;
+		gchar *path;
+
+		location = nemo_directory_get_location (view->details->model);
+		path = g_file_get_path (location);
+		if (path != NULL && finderz_field_census_should_prefetch (path)) {
+			attributes |= NEMO_FILE_ATTRIBUTE_FINDERZ_METADATA;
+		}
+		g_free (path);
+		g_object_unref (location);
+	}
+
 	nemo_directory_file_monitor_add (view->details->model,
 					     &view->details->model,
 					     view->details->show_hidden_files,
@@ -10745,9 +10883,186 @@ real_is_read_only (NemoView *view)
 gboolean
 nemo_view_should_show_file (NemoView *view, NemoFile *file)
 {
-	return nemo_file_should_show (file,
-					  view->details->show_hidden_files,
-					  view->details->show_foreign_files);
+	if (!nemo_file_should_show (file,
+				    view->details->show_hidden_files,
+				    view->details->show_foreign_files)) {
+		return FALSE;
+	}
+
+	/* FINDERZ: Files the metadata filter keeps out */
+	return view->details->metadata_filter == NULL ||
+		file_passes_metadata_filter (view->details->metadata_filter, file);
+}
+
+/* FINDERZ: Add and remove the files already loaded as the metadata
+ * filter changes, in one batch and without reloading the directory.
+ * The filter runs over all of them at once, term by term. */
+static void
+refilter_loaded_files (NemoView *view)
+{
+	FinderzFilter *filter;
+	GPtrArray *loaded;
+	GList *directories, *files, *l;
+	GList *added, *removed;
+	const gchar **names;
+	FinderzUniversalMetadata **records;
+	guint8 *matches;
+	gboolean needs_metadata;
+	guint i;
+
+	filter = view->details->metadata_filter;
+
+	if (view->details->model == NULL) {
+		g_hash_table_remove_all (view->details->filtered_files);
+		return;
+	}
+
+	loaded = g_ptr_array_new ();
+	directories = g_list_prepend (g_list_copy (view->details->subdirectory_list),
+				      view->details->model);
+	for (l = directories; l != NULL; l = l->next) {
+		GList *node;
+
+		files = nemo_directory_get_file_list (l->data);
+		for (node = files; node != NULL; node = node->next) {
+			if (nemo_file_should_show (node->data,
+						   view->details->show_hidden_files,
+						   view->details->show_foreign_files)) {
+				g_ptr_array_add (loaded, file_and_directory_new (node->data, l->data));
+			}
+		}
+		nemo_file_list_free (files);
+	}
+	g_list_free (directories);
+
+	matches = g_new (guint8, loaded->len);
+	if (filter != NULL) {
+		names = g_new (const gchar *, loaded->len);
+		records = g_new0 (FinderzUniversalMetadata *, loaded->len);
+		needs_metadata = finderz_filter_needs_metadata (filter);
+
+		for (i = 0; i < loaded->len; i++) {
+			FileAndDirectory *fad = g_ptr_array_index (loaded, i);
+
+			names[i] = nemo_file_peek_name (fad->file);
+			if (needs_metadata) {
+				records[i] = finderz_file_peek_metadata (fad->file);
+			}
+		}
+
+		finderz_filter_run (filter, names, records, loaded->len, matches);
+		g_free (names);
+		g_free (records);
+	} else {
+		memset (matches, 1, loaded->len);
+	}
+
+	added = NULL;
+	removed = NULL;
+	for (i = 0; i < loaded->len; i++) {
+		FileAndDirectory *fad = g_ptr_array_index (loaded, i);
+		gboolean filtered;
+
+		filtered = g_hash_table_lookup (view->details->filtered_files, fad) != NULL;
+		if (matches[i] && filtered) {
+			g_hash_table_remove (view->details->filtered_files, fad);
+			if (ready_to_load (fad->file)) {
+				added = g_list_prepend (added, fad);
+			} else {
+				g_hash_table_replace (view->details->non_ready_files, fad, fad);
+			}
+		} else if (!matches[i] && !filtered) {
+			g_hash_table_remove (view->details->non_ready_files, fad);
+			g_hash_table_add (view->details->filtered_files, fad);
+			removed = g_list_prepend (removed, fad);
+		} else {
+			file_and_directory_free (fad);
+		}
+	}
+	g_ptr_array_free (loaded, TRUE);
+	g_free (matches);
+
+	if (filter == NULL) {
+		g_hash_table_remove_all (view->details->filtered_files);
+	}
+
+	if (added != NULL || removed != NULL) {
+		g_signal_emit (view, signals[BEGIN_FILE_CHANGES], 0);
+
+		for (l = removed; l != NULL; l = l->next) {
+			FileAndDirectory *fad = l->data;
+
+			g_signal_emit (view, signals[REMOVE_FILE], 0, fad->file, fad->directory);
+		}
+
+		sort_files (view, &added);
+		for (l = added; l != NULL; l = l->next) {
+			FileAndDirectory *fad = l->data;
+
+			g_signal_emit (view, signals[ADD_FILE], 0, fad->file, fad->directory);
+		}
+
+		g_signal_emit (view, signals[END_FILE_CHANGES], 0);
+
+		if (removed != NULL) {
+			nemo_view_send_selection_change (view);
+		}
+	}
+
+	file_and_directory_list_free (added);
+	g_list_free (removed);
+}
+
+/**
+ * nemo_view_set_metadata_filter:
+ * @view: a #NemoView
+ * @text: (allow-none): the filter, as finderz_filter_new() reads it;
+ * %NULL or empty to show every file
+ * @error: return location for an error
+ *
+ * Shows only the files passing @text.  The files already loaded are
+ * filtered at once and the ones that change later as they do, so files
+ * whose metadata is not loaded yet come in as it arrives.  When @text
+ * does not parse, the filter in place is kept and %FALSE returned.
+ */
+gboolean
+nemo_view_set_metadata_filter (NemoView *view,
+			       const char *text,
+			       GError **error)
+{
+	FinderzFilter *filter;
+
+	g_return_val_if_fail (NEMO_IS_VIEW (view), FALSE);
+
+	filter = NULL;
+	if (text != NULL && text[strspn (text, " \t")] != '\0') {
+		filter = finderz_filter_new (text, error);
+		if (filter == NULL) {
+			return FALSE;
+		}
+	}
+
+	if (filter == NULL && view->details->metadata_filter == NULL) {
+		return TRUE;
+	}
+
+	finderz_filter_free (view->details->metadata_filter);
+	view->details->metadata_filter = filter;
+	refilter_loaded_files (view);
+
+	return TRUE;
+}
+
+const char *
+nemo_view_get_metadata_filter (NemoView *view)
+{
+	g_return_val_if_fail (NEMO_IS_VIEW (view), NULL);
+
+	if (view->details->metadata_filter == NULL) {
+		return NULL;
+	}
+
+	return finderz_filter_get_text (view->details->metadata_filter);
 }
 
 static gboolean
@@ -363,6 +363,10 @@ void                nemo_view_pop_up_selection_context_menu    (NemoView  *view,
 								    GdkEventButton   *event); 
 gboolean            nemo_view_should_show_file                 (NemoView  *view,
 								    NemoFile     *file);
+gboolean            nemo_view_set_metadata_filter              (NemoView  *view,
+								    const char   *text,
+								    GError      **error);
+const char *        nemo_view_get_metadata_filter              (NemoView  *view);
 gboolean	    nemo_view_should_sort_directories_first    (NemoView  *view);
 gboolean	    nemo_view_should_sort_favorites_first    (NemoView  *view);
 void                nemo_view_ignore_hidden_file_preferences   (NemoView  *view);
@@ -44,6 +44,7 @@
 #include "nemo-icon-view.h"
 #include "nemo-list-view.h"
 #include "nemo-toolbar.h"
+#include "finderz-integration.h"
 
 #include <gtk/gtk.h>
 #include <gio/gio.h>
@@ -292,6 +293,42 @@ action_show_hidden_files_callback (GtkAction *action,
 	nemo_window_set_hidden_files_mode (window, mode);
 }
 
+/* FINDERZ: show or hide the metadata filter bar of the active tab */
+static void
+action_finderz_filter_callback (GtkAction *action,
+				gpointer callback_data)
+{
+	NemoWindow *window;
+	NemoWindowSlot *slot;
+
+	window = NEMO_WINDOW (callback_data);
+	slot = nemo_window_get_active_slot (window);
+
+	if (slot != NULL) {
+		nemo_window_slot_set_metadata_filter_visible (slot,
+							      gtk_toggle_action_get_active (GTK_TOGGLE_ACTION (action)));
+	}
+}
+
+/* FINDERZ: sort the current folder by the next sorting profile, and
+ * reload it so the views pick it up */
+static void
+action_finderz_sorting_profile_callback (GtkAction *action,
+					 gpointer user_data)
+{
+	NemoWindowSlot *slot;
+	NemoView *view;
+
+	slot = nemo_window_get_active_slot (NEMO_WINDOW (user_data));
+	view = nemo_window_slot_get_current_view (slot);
+	if (view == NULL) {
+		return;
+	}
+
+	finderz_next_sorting_profile (nemo_view_get_model (view));
+	nemo_window_slot_queue_reload (slot, TRUE);
+}
+
 static void
 action_preferences_callback (GtkAction *action,
 			     gpointer user_data)
@@ -1396,6 +1433,10 @@ static const GtkActionEntry main_entries[] = {
   /* label, accelerator */       N_("_Reload"), "<control>R",
   /* tooltip */                  N_("Reload the current location"),
                                  G_CALLBACK (action_reload_callback) },
+  /* name, stock id */         { NEMO_ACTION_FINDERZ_SORTING_PROFILE, NULL,
+  /* label, accelerator */       N_("Next Sorting _Profile"), "<control><shift>p",
+  /* tooltip */                  N_("Sort this folder by the next sorting profile"),
+                                 G_CALLBACK (action_finderz_sorting_profile_callback) },
   /* name, stock id */         { "NemoHelp", "help-contents-symbolic",
   /* label, accelerator */       N_("_All Topics"), "F1",
   /* tooltip */                  N_("Display Nemo help"),
@@ -1562,6 +1603,11 @@ static const GtkToggleActionEntry main_toggle_entries[] = {
   /* tooltip */                  N_("Toggle the display of thumbnails in the current directory"),
   /* callback */                 G_CALLBACK (action_show_thumbnails_callback),
   /* default */                  FALSE },
+  /* name, stock id */     { NEMO_ACTION_FINDERZ_FILTER, NULL,
+  /* label, accelerator */   N_("_Filter by Metadata"), "<control><shift>f",
+  /* tooltip */              N_("Show only the files matching a filter on their names and metadata"),
+                             G_CALLBACK (action_finderz_filter_callback),
+  /* is_active */            FALSE },
 };
 
 static const GtkRadioActionEntry sidebar_radio_entries[] = {
@@ -1930,6 +1976,32 @@ nemo_window_initialize_menus (NemoWindow *window)
   	action = gtk_action_group_get_action (action_group, NEMO_ACTION_EDIT_LOCATION);
   	g_object_set (action, "short_label", _("_Location"), NULL);
 
+	/* FINDERZ: the shell UI has no items for the filter or the sorting
+	 * profiles, so bind their accelerators here */
+	action = gtk_action_group_get_action (action_group, NEMO_ACTION_FINDERZ_FILTER);
+	if (NEMO_IS_DESKTOP_WINDOW (window)) {
+		gtk_action_set_sensitive (action, FALSE);
+	}
+	gtk_ui_manager_add_ui (ui_manager,
+			       gtk_ui_manager_new_merge_id (ui_manager),
+			       "/",
+			       NEMO_ACTION_FINDERZ_FILTER,
+			       NEMO_ACTION_FINDERZ_FILTER,
+			       GTK_UI_MANAGER_ACCELERATOR,
+			       FALSE);
+
+	action = gtk_action_group_get_action (action_group, NEMO_ACTION_FINDERZ_SORTING_PROFILE);
+	if (NEMO_IS_DESKTOP_WINDOW (window)) {
+		gtk_action_set_sensitive (action, FALSE);
+	}
+	gtk_ui_manager_add_ui (ui_manager,
+			       gtk_ui_manager_new_merge_id (ui_manager),
+			       "/",
+			       NEMO_ACTION_FINDERZ_SORTING_PROFILE,
+			       NEMO_ACTION_FINDERZ_SORTING_PROFILE,
+			       GTK_UI_MANAGER_ACCELERATOR,
+			       FALSE);
+
 	action = gtk_action_group_get_action (action_group, NEMO_ACTION_SHOW_HIDDEN_FILES);
 
     if (NEMO_IS_DESKTOP_WINDOW (window)) {
@@ -226,6 +226,136 @@ nemo_window_slot_set_query_editor_visible (NemoWindowSlot *slot,
 	}
 }
 
+/* FINDERZ: the filter bar applies its text to the content view as it is
+ * typed; text that does not parse keeps the last good filter and marks
+ * the entry with the error until it is fixed.
+ */
+static void
+apply_metadata_filter (NemoWindowSlot *slot)
+{
+	GtkStyleContext *context;
+	GError *error;
+
+	if (slot->content_view == NULL) {
+		return;
+	}
+
+	context = gtk_widget_get_style_context (slot->finderz_filter_entry);
+	error = NULL;
+
+	if (nemo_view_set_metadata_filter (slot->content_view,
+					   gtk_entry_get_text (GTK_ENTRY (slot->finderz_filter_entry)),
+					   &error)) {
+		gtk_style_context_remove_class (context, GTK_STYLE_CLASS_ERROR);
+		gtk_widget_set_tooltip_text (slot->finderz_filter_entry, NULL);
+	} else {
+		gtk_style_context_add_class (context, GTK_STYLE_CLASS_ERROR);
+		gtk_widget_set_tooltip_text (slot->finderz_filter_entry, error->message);
+		g_error_free (error);
+	}
+}
+
+static void
+metadata_filter_changed_callback (GtkEditable *editable,
+				  NemoWindowSlot *slot)
+{
+	apply_metadata_filter (slot);
+}
+
+static gboolean
+metadata_filter_key_press_callback (GtkWidget *widget,
+				    GdkEventKey *event,
+				    NemoWindowSlot *slot)
+{
+	if (event->keyval == GDK_KEY_Escape) {
+		nemo_window_slot_set_metadata_filter_visible (slot, FALSE);
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+static void
+sync_metadata_filter_action (NemoWindowSlot *slot)
+{
+	NemoWindow *window;
+	GtkAction *action;
+
+	window = nemo_window_slot_get_window (slot);
+	if (slot != nemo_window_get_active_slot (window)) {
+		return;
+	}
+
+	/* the action calls back into nemo_window_slot_set_metadata_filter_visible(),
+	 * which does nothing when the bar is already in that state */
+	action = gtk_action_group_get_action (nemo_window_get_main_action_group (window),
+					      NEMO_ACTION_FINDERZ_FILTER);
+	gtk_toggle_action_set_active (GTK_TOGGLE_ACTION (action),
+				      gtk_widget_get_visible (slot->finderz_filter_bar));
+}
+
+static GtkWidget *
+create_metadata_filter_bar (NemoWindowSlot *slot)
+{
+	GtkWidget *box;
+	GtkWidget *widget;
+
+	box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 6);
+	gtk_container_set_border_width (GTK_CONTAINER (box), 4);
+
+	widget = gtk_label_new (_("Filter:"));
+	gtk_box_pack_start (GTK_BOX (box), widget, FALSE, FALSE, 0);
+
+	widget = gtk_entry_new ();
+	gtk_entry_set_placeholder_text (GTK_ENTRY (widget),
+					_("Name or field:value, e.g. *.png rating>=4"));
+	gtk_box_pack_start (GTK_BOX (box), widget, TRUE, TRUE, 0);
+	slot->finderz_filter_entry = widget;
+
+	g_signal_connect (widget, "changed",
+			  G_CALLBACK (metadata_filter_changed_callback), slot);
+	g_signal_connect (widget, "key-press-event",
+			  G_CALLBACK (metadata_filter_key_press_callback), slot);
+
+	gtk_widget_show_all (box);
+	gtk_widget_set_no_show_all (box, TRUE);
+	gtk_widget_hide (box);
+	return box;
+}
+
+void
+nemo_window_slot_set_metadata_filter_visible (NemoWindowSlot *slot,
+					      gboolean visible)
+{
+	if (visible == gtk_widget_get_visible (slot->finderz_filter_bar)) {
+		if (visible) {
+			gtk_widget_grab_focus (slot->finderz_filter_entry);
+		}
+		return;
+	}
+
+	if (visible) {
+		gtk_widget_show (slot->finderz_filter_bar);
+		gtk_widget_grab_focus (slot->finderz_filter_entry);
+	} else {
+		/* clearing the text drops the filter from the view */
+		gtk_entry_set_text (GTK_ENTRY (slot->finderz_filter_entry), "");
+		gtk_widget_hide (slot->finderz_filter_bar);
+
+		if (slot->content_view != NULL) {
+			gtk_widget_grab_focus (GTK_WIDGET (slot->content_view));
+		}
+	}
+
+	sync_metadata_filter_action (slot);
+}
+
+gboolean
+nemo_window_slot_get_metadata_filter_visible (NemoWindowSlot *slot)
+{
+	return gtk_widget_get_visible (slot->finderz_filter_bar);
+}
+
 static void
 real_active (NemoWindowSlot *slot)
 {
@@ -250,6 +380,7 @@ real_active (NemoWindowSlot *slot)
 	nemo_window_pane_sync_location_widgets (slot->pane);
 	nemo_window_pane_sync_search_widgets (slot->pane);
 	nemo_window_sync_thumbnail_action(window);
+	sync_metadata_filter_action (slot);
 
 	if (slot->viewed_file != NULL) {
 		nemo_window_sync_view_type (window);
@@ -322,6 +453,9 @@ nemo_window_slot_init (NemoWindowSlot *slot)
 
 	nemo_window_slot_add_extra_location_widget (slot, GTK_WIDGET (slot->query_editor));
 
+	slot->finderz_filter_bar = create_metadata_filter_bar (slot);
+	nemo_window_slot_add_extra_location_widget (slot, slot->finderz_filter_bar);
+
 	slot->view_overlay = gtk_overlay_new ();
 	gtk_widget_add_events (slot->view_overlay,
 			       GDK_ENTER_NOTIFY_MASK |
@@ -653,6 +787,11 @@ nemo_window_slot_set_content_view_widget (NemoWindowSlot *slot,
 
 		/* connect new view */
 		nemo_window_connect_content_view (window, new_view);
+
+		/* FINDERZ: carry the filter over to the new view */
+		if (gtk_widget_get_visible (slot->finderz_filter_bar)) {
+			apply_metadata_filter (slot);
+		}
 	}
 }
 
@@ -789,7 +928,8 @@ remove_all_extra_location_widgets (GtkWidget *widget,
 	NemoDirectory *directory;
 
 	directory = nemo_directory_get (slot->location);
-	if (widget != GTK_WIDGET (slot->query_editor)) {
+	if (widget != GTK_WIDGET (slot->query_editor) &&
+	    widget != slot->finderz_filter_bar) {
 		gtk_container_remove (GTK_CONTAINER (slot->extra_location_widgets), widget);
 	}
 
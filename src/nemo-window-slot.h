@@ -97,6 +97,10 @@ struct NemoWindowSlot {
 	gulong qe_changed_id;
 	gulong qe_cancel_id;
 
+	/* FINDERZ: metadata filter bar, see nemo_view_set_metadata_filter() */
+	GtkWidget *finderz_filter_bar;
+	GtkWidget *finderz_filter_entry;
+
 	/* New location. */
 	NemoLocationChangeType location_change_type;
 	guint location_change_distance;
@@ -130,6 +134,9 @@ void    nemo_window_slot_update_title		   (NemoWindowSlot *slot);
 void    nemo_window_slot_update_icon		   (NemoWindowSlot *slot);
 void    nemo_window_slot_set_query_editor_visible	   (NemoWindowSlot *slot,
 							    gboolean            visible);
+void     nemo_window_slot_set_metadata_filter_visible (NemoWindowSlot *slot,
+						       gboolean        visible);
+gboolean nemo_window_slot_get_metadata_filter_visible (NemoWindowSlot *slot);
 
 GFile * nemo_window_slot_get_location		   (NemoWindowSlot *slot);
 char *  nemo_window_slot_get_location_uri		   (NemoWindowSlot *slot);